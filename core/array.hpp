@@ -27,12 +27,46 @@
 
 #include <cassert>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <vector>
+#include <limits>
+#include <type_traits>
+#include <algorithm>
 #include <initializer_list>
 #include <memory>
+#include <new>
+#include <map>
+#include <mutex>
+#include <atomic>
 
 #include "taglist.hpp"
+#include "float16.hpp"
+#include "parallel.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define TGD_HAVE_SSE2 1
+#endif
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)) && defined(TGD_HAVE_SSE2)
+# define TGD_HAVE_AVX2_DISPATCH 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define TGD_HAVE_NEON 1
+#endif
+#if defined(TGD_HAVE_SSE2)
+# include <emmintrin.h>
+#endif
+#if defined(TGD_HAVE_AVX2_DISPATCH)
+# include <immintrin.h>
+#endif
+#if defined(TGD_HAVE_NEON)
+# include <arm_neon.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+# define TGD_HAVE_MMAP_ALLOCATOR 1
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
 
 /**
  * \file array.hpp
@@ -65,6 +99,18 @@
  *
  * All array data is shared by default when making copies of an array. If you want
  * a copy of the data, use \a TGD::ArrayContainer::deepCopy() or \a TGD::Array::deepCopy().
+ * For copy-on-write, use \a TGD::ArrayContainer::detach(), which copies the data only
+ * if it is actually shared, or the \a TGD::ArrayContainer::mutableData() accessor.
+ * Arrays can also wrap existing data without copying it, e.g. buffers from other
+ * libraries or memory-mapped files; see the corresponding constructors.
+ * Newly allocated data is uninitialized and aligned to \a TGD::Allocator::alignment
+ * bytes; the allocator can be replaced, see \a TGD::Allocator.
+ * Sub-boxes, component subsets and reordered dimensions can be accessed without
+ * copying via \a TGD::ArrayView.
+ *
+ * The functions in foreach.hpp and operators.hpp can process data in parallel;
+ * see \a TGD::ExecutionPolicy and \a TGD::defaultExecutionPolicy(). Chains of
+ * arithmetic operations can be evaluated in a single pass, see expressions.hpp.
  *
  * Input and output are managed by the \a TGD::Importer and \a TGD::Exporter classes,
  * and there are shortcuts \a TGD::load() and \a TGD::save() to read and write arrays
@@ -208,6 +254,8 @@ enum Type
     uint64 = 7,    /**< \brief uint64_t */
     float32 = 8,   /**< \brief IEEE 754 single precision floating point (on all relevant platforms: float) */
     float64 = 9,   /**< \brief IEEE 754 double precision floating point (on all relevant platforms: double) */
+    float16 = 10,  /**< \brief IEEE 754 half precision floating point (\a Float16) */
+    bfloat16 = 11, /**< \brief bfloat16 floating point (\a BFloat16) */
 };
 
 /*! \brief Returns the size of a TGD type. */
@@ -223,6 +271,8 @@ inline constexpr size_t typeSize(Type t)
     static_assert(sizeof(uint64_t) == 8);
     static_assert(sizeof(float) == 4);
     static_assert(sizeof(double) == 8);
+    static_assert(sizeof(Float16) == 2);
+    static_assert(sizeof(BFloat16) == 2);
     return (t == int8 ? sizeof(int8_t)
             : t == uint8 ? sizeof(uint8_t)
             : t == int16 ? sizeof(int16_t)
@@ -233,6 +283,8 @@ inline constexpr size_t typeSize(Type t)
             : t == uint64 ? sizeof(uint64_t)
             : t == float32 ? sizeof(float)
             : t == float64 ? sizeof(double)
+            : t == float16 ? sizeof(Float16)
+            : t == bfloat16 ? sizeof(BFloat16)
             : 0);
 }
 
@@ -249,6 +301,8 @@ template<> inline constexpr Type typeFromTemplate<int64_t>() { return int64; }
 template<> inline constexpr Type typeFromTemplate<uint64_t>() { return uint64; }
 template<> inline constexpr Type typeFromTemplate<float>() { return float32; }
 template<> inline constexpr Type typeFromTemplate<double>() { return float64; }
+template<> inline constexpr Type typeFromTemplate<Float16>() { return float16; }
+template<> inline constexpr Type typeFromTemplate<BFloat16>() { return bfloat16; }
 /*! \endcond */
 
 /*! \brief Determine the TGD component type described in the string, return false if this fails. */
@@ -275,6 +329,10 @@ inline bool typeFromString(const std::string& s, Type* t)
         *t = float32;
     else if (s == "float64")
         *t = float64;
+    else if (s == "float16")
+        *t = float16;
+    else if (s == "bfloat16")
+        *t = bfloat16;
     else
         ok = false;
     return ok;
@@ -315,10 +373,89 @@ inline const char* typeToString(Type t)
     case float64:
         p = "float64";
         break;
+    case float16:
+        p = "float16";
+        break;
+    case bfloat16:
+        p = "bfloat16";
+        break;
     }
     return p;
 }
 
+/*! \brief A tag that carries the C++ type \a T, see \a visitType(). */
+template<typename T> struct TypeTag { typedef T type; };
+
+/*! \cond */
+template<typename... Ts> struct TypeList {};
+
+typedef TypeList<int8_t, uint8_t, int16_t, uint16_t, int32_t, uint32_t, int64_t, uint64_t,
+        float, double, Float16, BFloat16> ComponentTypes;
+
+template<typename FUNC, typename... Ts>
+inline decltype(auto) visitTypeHelper(Type t, FUNC& func, TypeList<Ts...>)
+{
+    typedef typename std::common_type<decltype(func(TypeTag<Ts>()))...>::type R;
+    if constexpr (std::is_void<R>::value) {
+        static_cast<void>(((t == typeFromTemplate<Ts>() ? (func(TypeTag<Ts>()), true) : false) || ...));
+    } else {
+        R r {};
+        static_cast<void>(((t == typeFromTemplate<Ts>() ? (r = func(TypeTag<Ts>()), true) : false) || ...));
+        return r;
+    }
+}
+/*! \endcond */
+
+/*! \brief Calls \a func with a \a TypeTag for the C++ type that corresponds to the component type
+ * \a t and returns its result. The function is instantiated once for each component type, so
+ * that code that handles data of a type known only at run time can be written once as a
+ * generic lambda whose loops are specialized for each type:
+ * ~~~{.cpp}
+ * double sum = TGD::visitType(array.componentType(), [&] (auto tag) {
+ *         typedef typename decltype(tag)::type T;
+ *         const T* data = static_cast<const T*>(array.data());
+ *         double s = 0.0;
+ *         for (size_t i = 0; i < array.elementCount() * array.componentCount(); i++)
+ *             s += data[i];
+ *         return s;
+ *     });
+ * ~~~
+ * All instantiations must return the same type, which must be default constructible if it is not void. */
+template<typename FUNC>
+inline decltype(auto) visitType(Type t, FUNC&& func)
+{
+    return visitTypeHelper(t, func, ComponentTypes());
+}
+
+/*! \cond */
+/* Returns the position of an element within data in the bricked layout, see
+ * ArrayDescription::isBricked(). The function coordinate(d) must return the
+ * index of the element in dimension d; it is called for d = 0, 1, ... in order.
+ * The bricks before the one that contains the element cover all of the array
+ * below its brick in the highest dimension, then all of that brick layer below
+ * its brick in the next lower dimension, and so on. */
+template<typename COORDINATE>
+inline size_t brickedStorageIndex(const std::vector<size_t>& dimensions, const std::vector<size_t>& brickSize,
+        COORDINATE coordinate)
+{
+    size_t brickPart = 0;
+    size_t localPart = 0;
+    size_t localStride = 1;
+    size_t dimProduct = 1;
+    for (size_t d = 0; d < dimensions.size(); d++) {
+        size_t i = coordinate(d);
+        assert(i < dimensions[d]);
+        size_t brickStart = i / brickSize[d] * brickSize[d];
+        size_t brickExtent = std::min(brickSize[d], dimensions[d] - brickStart);
+        brickPart = brickPart * brickExtent + brickStart * dimProduct;
+        localPart += (i - brickStart) * localStride;
+        localStride *= brickExtent;
+        dimProduct *= dimensions[d];
+    }
+    return brickPart + localPart;
+}
+/*! \endcond */
+
 /*! \brief The ArrayDescription manages array metadata. */
 class ArrayDescription
 {
@@ -331,6 +468,8 @@ private:
     unsigned int _componentSize;
     size_t _elementSize;
     size_t _elementCount;
+    // data layout: brick size in each dimension, or empty for the linear layout
+    std::vector<size_t> _brickSize;
     // meta data
     TagList _globalTagList;
     std::vector<TagList> _dimensionTagLists;
@@ -395,6 +534,29 @@ public:
         _elementSize = componentCount() * componentSize();
     }
 
+    /*! \brief Constructor for an array description
+     * \param descr     Existing array description
+     * \param brickSize Brick size in each dimension, or an empty list
+     *
+     * Constructs an array description that is a copy of the given description except that
+     * it uses the bricked data layout with the given brick size, or the linear layout if
+     * \a brickSize is empty. Brick sizes are clipped to the array dimensions, and a single
+     * brick that covers the whole array is the linear layout. See \a isBricked().
+     */
+    explicit ArrayDescription(const ArrayDescription& descr, const std::vector<size_t>& brickSize) :
+        ArrayDescription(descr)
+    {
+        assert(brickSize.empty() || brickSize.size() == dimensionCount());
+        _brickSize.clear();
+        for (size_t d = 0; d < brickSize.size(); d++) {
+            assert(brickSize[d] > 0);
+            if (brickSize[d] < dimension(d))
+                _brickSize = brickSize;
+        }
+        for (size_t d = 0; d < _brickSize.size(); d++)
+            _brickSize[d] = std::max(size_t(1), std::min(_brickSize[d], dimension(d)));
+    }
+
     /*@}*/
 
     /**
@@ -457,12 +619,40 @@ public:
         return elementCount() * elementSize();
     }
 
+    /*! \brief Returns whether the data uses the bricked layout.
+     *
+     * In the default linear layout, elements are stored in index order, i.e.
+     * dimension 0 varies fastest. In the bricked layout, the array is split into
+     * bricks of \a brickSize() elements, clipped at the upper array borders.
+     * The bricks are stored one after another in the order of their position,
+     * and the elements of each brick are stored in the linear layout of the brick.
+     * This is the same as the chunks of .tgd files. It keeps neighborhoods compact
+     * in memory, so that slices along all dimensions can be accessed equally fast.
+     *
+     * The layout does not change the data size or the meaning of element indices;
+     * only the position of an element within the data differs, see \a storageIndex().
+     * Functions that treat all elements alike, such as component-wise operations,
+     * conversions and statistics, work with either layout. Code that interprets
+     * \a ArrayContainer::data() by position must use the linear layout; see
+     * \a toLinear() and \a toBricked(). */
+    bool isBricked() const
+    {
+        return !_brickSize.empty();
+    }
+
+    /*! \brief Returns the brick size in each dimension, or an empty list for the linear layout. */
+    const std::vector<size_t>& brickSize() const
+    {
+        return _brickSize;
+    }
+
     /*! \brief Returns whether the dimensions and components of array \a match those of this array. */
     bool isCompatible(const ArrayDescription& a) const
     {
         return (componentType() == a.componentType()
                 && componentCount() == a.componentCount()
-                && elementCount() == a.elementCount());
+                && elementCount() == a.elementCount()
+                && brickSize() == a.brickSize());
     }
 
     /*! \brief Returns this as a description. This is useful for derived classes. */
@@ -535,17 +725,42 @@ public:
         }
     }
 
+    /*! \brief Returns the position of the element with index \a elementIndex
+     * within the data, in elements. This is the index itself for the linear layout;
+     * see \a isBricked(). */
+    size_t storageIndex(size_t elementIndex) const
+    {
+        assert(elementIndex < elementCount());
+        if (!isBricked())
+            return elementIndex;
+        return brickedStorageIndex(_dimensions, _brickSize, [&] (size_t d) {
+                size_t i = elementIndex % dimension(d);
+                elementIndex /= dimension(d);
+                return i;
+            });
+    }
+
+    /*! \brief Returns the position of the element with index \a elementIndex
+     * within the data, in elements; see \a isBricked(). */
+    size_t storageIndex(const std::vector<size_t>& elementIndex) const
+    {
+        if (!isBricked())
+            return toLinearIndex(elementIndex);
+        assert(elementIndex.size() == dimensionCount());
+        return brickedStorageIndex(_dimensions, _brickSize, [&] (size_t d) { return elementIndex[d]; });
+    }
+
     /*! \brief Returns the offset of the element with index \a elementIndex within the data. */
     size_t elementOffset(size_t elementIndex) const
     {
         assert(elementIndex < elementCount());
-        return elementIndex * elementSize();
+        return storageIndex(elementIndex) * elementSize();
     }
 
     /*! \brief Returns the offset of the element with index \a elementIndex within the data. */
     size_t elementOffset(const std::vector<size_t>& elementIndex) const
     {
-        return elementOffset(toLinearIndex(elementIndex));
+        return storageIndex(elementIndex) * elementSize();
     }
 
     /*! \brief Returns the offset of the element with index \a elementIndex within the data. */
@@ -632,12 +847,273 @@ public:
     /*@}*/
 };
 
+/*! \brief Initialization of newly allocated array data. */
+enum Initialization
+{
+    Uninitialized = 0,      /**< \brief Leave the data uninitialized */
+    ZeroInitialized = 1     /**< \brief Set all data bytes to zero */
+};
+
+/*! \brief Interface for memory allocators that provide array data.
+ *
+ * All allocators must return memory that is aligned to at least
+ * \a Allocator::alignment bytes. The default allocator is used by all
+ * ArrayContainer constructors that allocate data, unless an allocator is
+ * given explicitly. It can be replaced with \a setDefaultAllocator(), e.g.
+ * with a \a RecyclingAllocator for streaming many arrays of the same size. */
+class Allocator
+{
+private:
+    static std::atomic<Allocator*>& currentDefault()
+    {
+        static std::atomic<Allocator*> allocator(nullptr);
+        return allocator;
+    }
+
+public:
+    /*! \brief The minimum alignment of all allocations, in bytes. */
+    static constexpr size_t alignment = 64;
+
+    virtual ~Allocator() {}
+
+    /*! \brief Allocate \a size bytes aligned to \a alignment. Return nullptr on failure. */
+    virtual void* allocate(size_t size) = 0;
+
+    /*! \brief Free the memory at \a ptr which was previously allocated with size \a size. */
+    virtual void deallocate(void* ptr, size_t size) = 0;
+
+    /*! \brief Returns whether memory of size \a size returned by \a allocate() is
+     * always zero-initialized, so that it need not be cleared again. */
+    virtual bool isZeroInitialized(size_t /* size */) const
+    {
+        return false;
+    }
+
+    /*! \brief Returns the builtin allocator that uses aligned system memory. */
+    static Allocator* systemAllocator();
+
+    /*! \brief Returns the current default allocator. */
+    static Allocator* defaultAllocator()
+    {
+        Allocator* a = currentDefault().load();
+        return a ? a : systemAllocator();
+    }
+
+    /*! \brief Set the default allocator. The allocator must remain valid for as long as
+     * it is the default and as long as data allocated by it exists. Setting nullptr
+     * restores the builtin allocator. */
+    static void setDefaultAllocator(Allocator* allocator)
+    {
+        currentDefault().store(allocator);
+    }
+};
+
+/*! \brief The builtin allocator, using aligned system memory. */
+class SystemAllocator : public Allocator
+{
+public:
+    virtual void* allocate(size_t size) override
+    {
+        // the size must be a multiple of the alignment for aligned_alloc
+        size_t alignedSize = (size == 0 ? alignment : (size + alignment - 1) / alignment * alignment);
+#ifdef _WIN32
+        return _aligned_malloc(alignedSize, alignment);
+#else
+        return std::aligned_alloc(alignment, alignedSize);
+#endif
+    }
+
+    virtual void deallocate(void* ptr, size_t) override
+    {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        std::free(ptr);
+#endif
+    }
+};
+
+inline Allocator* Allocator::systemAllocator()
+{
+    static SystemAllocator allocator;
+    return &allocator;
+}
+
+/*! \brief An allocator that keeps freed memory blocks for reuse.
+ *
+ * This avoids the overhead of repeated allocation and deallocation when
+ * many arrays of identical size are processed, e.g. video frames. At most
+ * \a maxCachedBytes bytes are kept; blocks of other sizes are passed through
+ * to the wrapped allocator. */
+class RecyclingAllocator : public Allocator
+{
+private:
+    Allocator* _allocator;
+    size_t _maxCachedBytes;
+    size_t _cachedBytes;
+    std::multimap<size_t, void*> _cache;
+    std::mutex _mutex;
+
+public:
+    /*! \brief Constructor. The wrapped allocator defaults to the system allocator. */
+    RecyclingAllocator(size_t maxCachedBytes = size_t(1) << 30, Allocator* allocator = nullptr) :
+        _allocator(allocator ? allocator : systemAllocator()),
+        _maxCachedBytes(maxCachedBytes),
+        _cachedBytes(0)
+    {
+    }
+
+    ~RecyclingAllocator()
+    {
+        clear();
+    }
+
+    /*! \brief Free all cached blocks. */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto it = _cache.begin(); it != _cache.end(); it++)
+            _allocator->deallocate(it->second, it->first);
+        _cache.clear();
+        _cachedBytes = 0;
+    }
+
+    virtual void* allocate(size_t size) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _cache.find(size);
+            if (it != _cache.end()) {
+                void* ptr = it->second;
+                _cache.erase(it);
+                _cachedBytes -= size;
+                return ptr;
+            }
+        }
+        return _allocator->allocate(size);
+    }
+
+    virtual void deallocate(void* ptr, size_t size) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_cachedBytes + size <= _maxCachedBytes) {
+                _cache.insert(std::make_pair(size, ptr));
+                _cachedBytes += size;
+                return;
+            }
+        }
+        _allocator->deallocate(ptr, size);
+    }
+};
+
+/*! \brief An allocator for huge arrays on machines with several NUMA nodes.
+ *
+ * Blocks of at least \a minimumSize bytes are mapped directly from the operating
+ * system, aligned to 2 MiB and marked for transparent huge pages where supported,
+ * which reduces TLB misses. Their pages are then touched by the thread pool with
+ * the static partitioning of \a ThreadPool::parallelForStatic(), which is also used
+ * by the parallel element-wise operations and statistics. With the usual first-touch
+ * policy of the operating system, each part of the memory is therefore placed on the
+ * NUMA node of the thread that will process it, as long as the operations are called
+ * from the thread that allocated the array. The memory is zero-initialized.
+ *
+ * Smaller blocks, and all blocks on systems without memory mapping, are passed
+ * through to the wrapped allocator. Use it for all arrays with \a setDefaultAllocator(). */
+class HugePageAllocator : public Allocator
+{
+private:
+    Allocator* _allocator;
+    size_t _minimumSize;
+
+    static constexpr size_t hugePageSize = size_t(1) << 21;
+
+    static size_t mappedSize(size_t size)
+    {
+        return (size + hugePageSize - 1) / hugePageSize * hugePageSize;
+    }
+
+public:
+    /*! \brief Constructor. The wrapped allocator defaults to the system allocator. */
+    HugePageAllocator(size_t minimumSize = size_t(1) << 26, Allocator* allocator = nullptr) :
+        _allocator(allocator ? allocator : systemAllocator()),
+        _minimumSize(std::max(minimumSize, size_t(1)))
+    {
+    }
+
+    virtual void* allocate(size_t size) override
+    {
+#ifdef TGD_HAVE_MMAP_ALLOCATOR
+        if (size >= _minimumSize) {
+            // Map an extra huge page so that the block can be aligned to huge pages
+            size_t length = mappedSize(size);
+            void* mapping = mmap(nullptr, length + hugePageSize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapping == MAP_FAILED)
+                return nullptr;
+            unsigned char* base = static_cast<unsigned char*>(mapping);
+            size_t head = (hugePageSize - reinterpret_cast<uintptr_t>(base) % hugePageSize) % hugePageSize;
+            if (head > 0)
+                munmap(base, head);
+            munmap(base + head + length, hugePageSize - head);
+            unsigned char* ptr = base + head;
+# ifdef MADV_HUGEPAGE
+            madvise(ptr, length, MADV_HUGEPAGE);
+# endif
+            // touch every base page, since huge pages might not be granted; the parts
+            // cover the requested size like the parts of the operations on the array
+            const size_t pageSize = std::max(long(1), sysconf(_SC_PAGESIZE));
+            ThreadPool::instance().parallelForStatic(size, pageSize, [=] (size_t begin, size_t end) {
+                    if (end == size)
+                        end = length;
+                    for (size_t i = begin; i < end; i += pageSize)
+                        ptr[i] = 0;
+                });
+            return ptr;
+        }
+#endif
+        return _allocator->allocate(size);
+    }
+
+    virtual void deallocate(void* ptr, size_t size) override
+    {
+#ifdef TGD_HAVE_MMAP_ALLOCATOR
+        if (size >= _minimumSize) {
+            munmap(ptr, mappedSize(size));
+            return;
+        }
+#endif
+        _allocator->deallocate(ptr, size);
+    }
+
+    virtual bool isZeroInitialized(size_t size) const override
+    {
+#ifdef TGD_HAVE_MMAP_ALLOCATOR
+        if (size >= _minimumSize)
+            return true;
+#endif
+        return _allocator->isZeroInitialized(size);
+    }
+};
+
 /*! \brief The ArrayContainer class manages arrays with arbitrary component data types. */
 class ArrayContainer : public ArrayDescription
 {
     /*! \cond */
 private:
     std::shared_ptr<unsigned char[]> _data;
+    bool _ownsData; // whether _data was allocated by this library
+
+    static std::shared_ptr<unsigned char[]> allocateData(size_t size, Allocator* allocator)
+    {
+        if (!allocator)
+            allocator = Allocator::defaultAllocator();
+        unsigned char* ptr = static_cast<unsigned char*>(allocator->allocate(size));
+        if (!ptr)
+            throw std::bad_alloc();
+        return std::shared_ptr<unsigned char[]>(ptr,
+                [allocator, size] (unsigned char* p) { allocator->deallocate(p, size); });
+    }
 
 protected:
     template<typename T>
@@ -655,14 +1131,21 @@ public:
 
     /*! \brief Constructor for an empty array container. */
     ArrayContainer() :
-        ArrayDescription(), _data(nullptr)
+        ArrayDescription(), _data(nullptr), _ownsData(false)
     {
     }
 
-    /*! \brief Constructor for an array container. */
-    explicit ArrayContainer(const ArrayDescription& desc) :
-        ArrayDescription(desc), _data(new unsigned char[dataSize()])
+    /*! \brief Constructor for an array container. The data is allocated with
+     * the given \a allocator, or with the default allocator if that is nullptr,
+     * and is initialized as specified by \a init. Throws std::bad_alloc if
+     * allocation fails. */
+    explicit ArrayContainer(const ArrayDescription& desc, Initialization init = Uninitialized, Allocator* allocator = nullptr) :
+        ArrayDescription(desc), _data(allocateData(dataSize(), allocator)), _ownsData(true)
     {
+        if (!allocator)
+            allocator = Allocator::defaultAllocator();
+        if (init == ZeroInitialized && dataSize() > 0 && !allocator->isZeroInitialized(dataSize()))
+            std::memset(_data.get(), 0, dataSize());
     }
 
     /*! \brief Constructor for an array container. */
@@ -671,6 +1154,33 @@ public:
     {
     }
 
+    /*! \brief Constructor for an array container that shares existing \a data.
+     * The data is not copied; it must hold at least \a desc.dataSize() bytes. */
+    ArrayContainer(const ArrayDescription& desc, const std::shared_ptr<unsigned char[]>& data) :
+        ArrayDescription(desc), _data(data), _ownsData(false)
+    {
+    }
+
+    /*! \brief Constructor for an array container that adopts external \a data.
+     * The data is not copied; it must hold at least \a desc.dataSize() bytes.
+     * The \a deleter is called with the data pointer when the last container
+     * referencing the data goes away. This can be used to wrap buffers from
+     * other libraries or memory-mapped files. */
+    template<typename DELETER>
+    ArrayContainer(const ArrayDescription& desc, void* data, DELETER deleter) :
+        ArrayDescription(desc), _data(static_cast<unsigned char*>(data), deleter), _ownsData(false)
+    {
+    }
+
+    /*! \brief Constructor for an array container that uses external \a data
+     * without taking ownership. The data is not copied; it must hold at least
+     * \a desc.dataSize() bytes, and the caller must make sure that it remains
+     * valid for as long as any container references it. */
+    ArrayContainer(const ArrayDescription& desc, void* data) :
+        ArrayContainer(desc, data, [] (unsigned char*) {})
+    {
+    }
+
     /*! \brief Construct an array and perform deep copy of data */
     ArrayContainer deepCopy() const
     {
@@ -701,6 +1211,54 @@ public:
         return static_cast<void*>(_data.get());
     }
 
+    /*! \brief Returns whether this container is the only one that refers to its data.
+     * In this case, the data can be modified without affecting other containers. */
+    bool isUnique() const
+    {
+        return (_data && _data.use_count() == 1);
+    }
+
+    /*! \brief Returns whether the data was allocated by this library, as opposed to
+     * external data that this container wraps or shares. Operations on temporaries
+     * reuse only such data for their results, so that external buffers are never
+     * overwritten behind the caller's back. */
+    bool ownsData() const
+    {
+        return _ownsData;
+    }
+
+    /*! \brief Make sure that this container is the only one that refers to its data,
+     * by copying the data if it is currently shared with other containers. This
+     * implements copy-on-write: call this before modifying data that might be shared.
+     * Note that data is not detached automatically; copies of containers share their
+     * data until one of them calls this function. */
+    void detach()
+    {
+        if (_data && !isUnique()) {
+            std::shared_ptr<unsigned char[]> data = allocateData(dataSize(), nullptr);
+            std::memcpy(data.get(), _data.get(), dataSize());
+            _data = data;
+            _ownsData = true;
+        }
+    }
+
+    /*! \brief Returns a pointer to the data after calling \a detach(), so that
+     * modifications through this pointer do not affect other containers. */
+    void* mutableData()
+    {
+        detach();
+        return data();
+    }
+
+    /*! \brief Returns a pointer to the element with index \a elementIndex after
+     * calling \a detach(), see \a mutableData(). */
+    template<typename T>
+    T* mutableGet(size_t elementIndex)
+    {
+        detach();
+        return get<T>(elementIndex);
+    }
+
     /*! \brief Returns a pointer to the element with index \a elementIndex.
      * Note that the data must be allocated, see \a createData(). */
     template<typename T>
@@ -721,12 +1279,13 @@ public:
     template<typename T>
     const T* get(const std::vector<size_t>& elementIndex) const
     {
-        return get<T>(toLinearIndex(elementIndex));
+        assert(typeMatchesTemplate<T>());
+        return reinterpret_cast<const T*>(_data.get() + elementOffset(elementIndex));
     }
     /*! \cond */
     const void* get(const std::vector<size_t>& elementIndex) const
     {
-        return get(toLinearIndex(elementIndex));
+        return static_cast<const void*>(_data.get() + elementOffset(elementIndex));
     }
     /*! \endcond */
 
@@ -764,12 +1323,13 @@ public:
     template<typename T>
     T* get(const std::vector<size_t>& elementIndex)
     {
-        return get<T>(toLinearIndex(elementIndex));
+        assert(typeMatchesTemplate<T>());
+        return reinterpret_cast<T*>(_data.get() + elementOffset(elementIndex));
     }
     /*! \cond */
     void* get(const std::vector<size_t>& elementIndex)
     {
-        return get(toLinearIndex(elementIndex));
+        return static_cast<void*>(_data.get() + elementOffset(elementIndex));
     }
     /*! \endcond */
 
@@ -904,9 +1464,9 @@ public:
     {
     }
 
-    /*! \brief Constructor for an array. */
-    explicit Array(const ArrayDescription& desc) :
-        ArrayContainer(desc)
+    /*! \brief Constructor for an array. See the corresponding ArrayContainer constructor. */
+    explicit Array(const ArrayDescription& desc, Initialization init = Uninitialized, Allocator* allocator = nullptr) :
+        ArrayContainer(desc, init, allocator)
     {
         assert(typeMatchesTemplate<T>());
     }
@@ -917,6 +1477,23 @@ public:
     {
     }
 
+    /*! \brief Constructor for an array that adopts external \a data.
+     * See the corresponding ArrayContainer constructor. */
+    template<typename DELETER>
+    explicit Array(const ArrayDescription& desc, T* data, DELETER deleter) :
+        ArrayContainer(desc, data, [deleter] (unsigned char* p) mutable { deleter(reinterpret_cast<T*>(p)); })
+    {
+        assert(typeMatchesTemplate<T>());
+    }
+
+    /*! \brief Constructor for an array that uses external \a data without taking ownership.
+     * See the corresponding ArrayContainer constructor. */
+    explicit Array(const ArrayDescription& desc, T* data) :
+        ArrayContainer(desc, data)
+    {
+        assert(typeMatchesTemplate<T>());
+    }
+
     /*! \brief Construct an array and perform deep copy of data */
     Array deepCopy() const
     {
@@ -1158,373 +1735,1227 @@ public:
     /*@}*/
 };
 
-/*! \cond */
-template<typename TO, typename FROM>
-void convertData(TO* dst, const FROM* src, size_t n)
-{
-    for (size_t i = 0; i < n; i++)
-        dst[i] = src[i];
-}
-/*! \endcond */
-
-/*! \brief Convert the given array to the given new component type.
- * If conversion is not actually necessary because the new type is the same
- * as the old, the returned array will simply share its data with the 
- * original array. */
-inline ArrayContainer convert(const ArrayContainer& a, Type newType)
+/*! \brief Iterates over the elements of a box within an array.
+ *
+ * The box is given by the multidimensional index of its first element and
+ * its size. The iterator visits all elements of the box in index order
+ * and updates both the multidimensional index and the linear
+ * element index incrementally, using precomputed strides.
+ *
+ * In addition to single-element steps with \a next(), the iterator can
+ * hand out contiguous runs of elements with \a runLength() and \a nextRun().
+ * A run covers at least the box extent in dimension 0; if the box spans the
+ * full array in the lower dimensions, these are merged into longer runs.
+ * For arrays in the bricked layout (see \a ArrayDescription::isBricked()),
+ * runs end at brick borders in dimension 0. The iterator must be constructed
+ * from the description of the array to know its layout. */
+class BoxIterator
 {
-    if (a.componentType() == newType) {
-        return a;
-    } else {
-        ArrayDescription rDescr(a, newType);
-        ArrayContainer r(rDescr);
-        void* dst = r.data();
-        const void* src = a.data();
-        size_t n = r.elementCount() * r.componentCount();
-        switch (newType) {
-        case int8:
-            switch (a.componentType()) {
-            case int8:
-                convertData(static_cast<int8_t*>(dst), static_cast<const int8_t*>(src), n);
-                break;
-            case uint8:
-                convertData(static_cast<int8_t*>(dst), static_cast<const uint8_t*>(src), n);
-                break;
-            case int16:
-                convertData(static_cast<int8_t*>(dst), static_cast<const int16_t*>(src), n);
-                break;
-            case uint16:
-                convertData(static_cast<int8_t*>(dst), static_cast<const uint16_t*>(src), n);
-                break;
-            case int32:
-                convertData(static_cast<int8_t*>(dst), static_cast<const int32_t*>(src), n);
-                break;
-            case uint32:
-                convertData(static_cast<int8_t*>(dst), static_cast<const uint32_t*>(src), n);
-                break;
-            case int64:
-                convertData(static_cast<int8_t*>(dst), static_cast<const int64_t*>(src), n);
-                break;
-            case uint64:
-                convertData(static_cast<int8_t*>(dst), static_cast<const uint64_t*>(src), n);
-                break;
-            case float32:
-                convertData(static_cast<int8_t*>(dst), static_cast<const float*>(src), n);
-                break;
-            case float64:
-                convertData(static_cast<int8_t*>(dst), static_cast<const double*>(src), n);
-                break;
-            }
-            break;
-        case uint8:
-            switch (a.componentType()) {
-            case int8:
-                convertData(static_cast<uint8_t*>(dst), static_cast<const int8_t*>(src), n);
-                break;
-            case uint8:
-                convertData(static_cast<uint8_t*>(dst), static_cast<const uint8_t*>(src), n);
-                break;
-            case int16:
-                convertData(static_cast<uint8_t*>(dst), static_cast<const int16_t*>(src), n);
-                break;
-            case uint16:
-                convertData(static_cast<uint8_t*>(dst), static_cast<const uint16_t*>(src), n);
-                break;
-            case int32:
-                convertData(static_cast<uint8_t*>(dst), static_cast<const int32_t*>(src), n);
-                break;
-            case uint32:
-                convertData(static_cast<uint8_t*>(dst), static_cast<const uint32_t*>(src), n);
-                break;
-            case int64:
-                convertData(static_cast<uint8_t*>(dst), static_cast<const int64_t*>(src), n);
-                break;
-            case uint64:
-                convertData(static_cast<uint8_t*>(dst), static_cast<const uint64_t*>(src), n);
-                break;
-            case float32:
-                convertData(static_cast<uint8_t*>(dst), static_cast<const float*>(src), n);
-                break;
-            case float64:
-                convertData(static_cast<uint8_t*>(dst), static_cast<const double*>(src), n);
-                break;
-            }
-            break;
-        case int16:
-            switch (a.componentType()) {
-            case int8:
-                convertData(static_cast<int16_t*>(dst), static_cast<const int8_t*>(src), n);
-                break;
-            case uint8:
-                convertData(static_cast<int16_t*>(dst), static_cast<const uint8_t*>(src), n);
-                break;
-            case int16:
-                convertData(static_cast<int16_t*>(dst), static_cast<const int16_t*>(src), n);
-                break;
-            case uint16:
-                convertData(static_cast<int16_t*>(dst), static_cast<const uint16_t*>(src), n);
-                break;
-            case int32:
-                convertData(static_cast<int16_t*>(dst), static_cast<const int32_t*>(src), n);
-                break;
-            case uint32:
-                convertData(static_cast<int16_t*>(dst), static_cast<const uint32_t*>(src), n);
-                break;
-            case int64:
-                convertData(static_cast<int16_t*>(dst), static_cast<const int64_t*>(src), n);
-                break;
-            case uint64:
-                convertData(static_cast<int16_t*>(dst), static_cast<const uint64_t*>(src), n);
-                break;
-            case float32:
-                convertData(static_cast<int16_t*>(dst), static_cast<const float*>(src), n);
-                break;
-            case float64:
-                convertData(static_cast<int16_t*>(dst), static_cast<const double*>(src), n);
-                break;
+private:
+    std::vector<size_t> _dimensions;
+    std::vector<size_t> _brickSize;     // empty for the linear layout
+    std::vector<size_t> _start;
+    std::vector<size_t> _end;
+    std::vector<size_t> _strides;       // element strides of the array
+    std::vector<size_t> _index;
+    size_t _linearIndex;
+    size_t _runDimensions;              // number of dimensions merged into a run
+    size_t _runLength;
+    bool _atEnd;
+
+    void advance(size_t startDim)
+    {
+        for (size_t d = startDim; d < _index.size(); d++) {
+            if (++_index[d] < _end[d]) {
+                _linearIndex += _strides[d];
+                return;
             }
-            break;
-        case uint16:
-            switch (a.componentType()) {
-            case int8:
-                convertData(static_cast<uint16_t*>(dst), static_cast<const int8_t*>(src), n);
-                break;
-            case uint8:
-                convertData(static_cast<uint16_t*>(dst), static_cast<const uint8_t*>(src), n);
-                break;
-            case int16:
-                convertData(static_cast<uint16_t*>(dst), static_cast<const int16_t*>(src), n);
-                break;
-            case uint16:
-                convertData(static_cast<uint16_t*>(dst), static_cast<const uint16_t*>(src), n);
-                break;
-            case int32:
-                convertData(static_cast<uint16_t*>(dst), static_cast<const int32_t*>(src), n);
-                break;
-            case uint32:
-                convertData(static_cast<uint16_t*>(dst), static_cast<const uint32_t*>(src), n);
-                break;
-            case int64:
-                convertData(static_cast<uint16_t*>(dst), static_cast<const int64_t*>(src), n);
-                break;
-            case uint64:
-                convertData(static_cast<uint16_t*>(dst), static_cast<const uint64_t*>(src), n);
-                break;
-            case float32:
-                convertData(static_cast<uint16_t*>(dst), static_cast<const float*>(src), n);
-                break;
-            case float64:
-                convertData(static_cast<uint16_t*>(dst), static_cast<const double*>(src), n);
-                break;
-            }
-            break;
-        case int32:
-            switch (a.componentType()) {
-            case int8:
-                convertData(static_cast<int32_t*>(dst), static_cast<const int8_t*>(src), n);
-                break;
-            case uint8:
-                convertData(static_cast<int32_t*>(dst), static_cast<const uint8_t*>(src), n);
-                break;
-            case int16:
-                convertData(static_cast<int32_t*>(dst), static_cast<const int16_t*>(src), n);
-                break;
-            case uint16:
-                convertData(static_cast<int32_t*>(dst), static_cast<const uint16_t*>(src), n);
-                break;
-            case int32:
-                convertData(static_cast<int32_t*>(dst), static_cast<const int32_t*>(src), n);
-                break;
-            case uint32:
-                convertData(static_cast<int32_t*>(dst), static_cast<const uint32_t*>(src), n);
-                break;
-            case int64:
-                convertData(static_cast<int32_t*>(dst), static_cast<const int64_t*>(src), n);
-                break;
-            case uint64:
-                convertData(static_cast<int32_t*>(dst), static_cast<const uint64_t*>(src), n);
-                break;
-            case float32:
-                convertData(static_cast<int32_t*>(dst), static_cast<const float*>(src), n);
-                break;
-            case float64:
-                convertData(static_cast<int32_t*>(dst), static_cast<const double*>(src), n);
-                break;
-            }
-            break;
-        case uint32:
-            switch (a.componentType()) {
-            case int8:
-                convertData(static_cast<uint32_t*>(dst), static_cast<const int8_t*>(src), n);
-                break;
-            case uint8:
-                convertData(static_cast<uint32_t*>(dst), static_cast<const uint8_t*>(src), n);
-                break;
-            case int16:
-                convertData(static_cast<uint32_t*>(dst), static_cast<const int16_t*>(src), n);
-                break;
-            case uint16:
-                convertData(static_cast<uint32_t*>(dst), static_cast<const uint16_t*>(src), n);
-                break;
-            case int32:
-                convertData(static_cast<uint32_t*>(dst), static_cast<const int32_t*>(src), n);
-                break;
-            case uint32:
-                convertData(static_cast<uint32_t*>(dst), static_cast<const uint32_t*>(src), n);
-                break;
-            case int64:
-                convertData(static_cast<uint32_t*>(dst), static_cast<const int64_t*>(src), n);
-                break;
-            case uint64:
-                convertData(static_cast<uint32_t*>(dst), static_cast<const uint64_t*>(src), n);
-                break;
-            case float32:
-                convertData(static_cast<uint32_t*>(dst), static_cast<const float*>(src), n);
-                break;
-            case float64:
-                convertData(static_cast<uint32_t*>(dst), static_cast<const double*>(src), n);
-                break;
-            }
-            break;
-        case int64:
-            switch (a.componentType()) {
-            case int8:
-                convertData(static_cast<int64_t*>(dst), static_cast<const int8_t*>(src), n);
-                break;
-            case uint8:
-                convertData(static_cast<int64_t*>(dst), static_cast<const uint8_t*>(src), n);
-                break;
-            case int16:
-                convertData(static_cast<int64_t*>(dst), static_cast<const int16_t*>(src), n);
-                break;
-            case uint16:
-                convertData(static_cast<int64_t*>(dst), static_cast<const uint16_t*>(src), n);
-                break;
-            case int32:
-                convertData(static_cast<int64_t*>(dst), static_cast<const int32_t*>(src), n);
-                break;
-            case uint32:
-                convertData(static_cast<int64_t*>(dst), static_cast<const uint32_t*>(src), n);
-                break;
-            case int64:
-                convertData(static_cast<int64_t*>(dst), static_cast<const int64_t*>(src), n);
-                break;
-            case uint64:
-                convertData(static_cast<int64_t*>(dst), static_cast<const uint64_t*>(src), n);
-                break;
-            case float32:
-                convertData(static_cast<int64_t*>(dst), static_cast<const float*>(src), n);
-                break;
-            case float64:
-                convertData(static_cast<int64_t*>(dst), static_cast<const double*>(src), n);
-                break;
-            }
-            break;
-        case uint64:
-            switch (a.componentType()) {
-            case int8:
-                convertData(static_cast<uint64_t*>(dst), static_cast<const int8_t*>(src), n);
-                break;
-            case uint8:
-                convertData(static_cast<uint64_t*>(dst), static_cast<const uint8_t*>(src), n);
-                break;
-            case int16:
-                convertData(static_cast<uint64_t*>(dst), static_cast<const int16_t*>(src), n);
-                break;
-            case uint16:
-                convertData(static_cast<uint64_t*>(dst), static_cast<const uint16_t*>(src), n);
-                break;
-            case int32:
-                convertData(static_cast<uint64_t*>(dst), static_cast<const int32_t*>(src), n);
-                break;
-            case uint32:
-                convertData(static_cast<uint64_t*>(dst), static_cast<const uint32_t*>(src), n);
-                break;
-            case int64:
-                convertData(static_cast<uint64_t*>(dst), static_cast<const int64_t*>(src), n);
-                break;
-            case uint64:
-                convertData(static_cast<uint64_t*>(dst), static_cast<const uint64_t*>(src), n);
-                break;
-            case float32:
-                convertData(static_cast<uint64_t*>(dst), static_cast<const float*>(src), n);
-                break;
-            case float64:
-                convertData(static_cast<uint64_t*>(dst), static_cast<const double*>(src), n);
+            _linearIndex -= (_index[d] - 1 - _start[d]) * _strides[d];
+            _index[d] = _start[d];
+        }
+        _atEnd = true;
+    }
+
+    void init(const std::vector<size_t>& dimensions, const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize,
+            const std::vector<size_t>& brickSize = std::vector<size_t>())
+    {
+        assert(boxIndex.size() == dimensions.size());
+        assert(boxSize.size() == dimensions.size());
+        const size_t n = dimensions.size();
+        _dimensions = dimensions;
+        _brickSize = brickSize;
+        _start = boxIndex;
+        _end.resize(n);
+        _strides.resize(n);
+        _index = boxIndex;
+        _linearIndex = 0;
+        _atEnd = (n == 0);
+        size_t stride = 1;
+        for (size_t d = 0; d < n; d++) {
+            assert(boxIndex[d] + boxSize[d] <= dimensions[d]);
+            _end[d] = boxIndex[d] + boxSize[d];
+            _strides[d] = stride;
+            _linearIndex += boxIndex[d] * stride;
+            stride *= dimensions[d];
+            if (boxSize[d] == 0)
+                _atEnd = true;
+        }
+        _runDimensions = 0;
+        _runLength = 1;
+        if (!_brickSize.empty()) {
+            _runDimensions = 1;
+            _runLength = boxSize[0];
+        }
+        while (_runDimensions < n && _brickSize.empty()) {
+            _runLength *= boxSize[_runDimensions];
+            _runDimensions++;
+            if (boxSize[_runDimensions - 1] != dimensions[_runDimensions - 1])
                 break;
+        }
+    }
+
+public:
+    /*! \brief Constructor for a box with the given index and size within an array of the given dimensions. */
+    BoxIterator(const std::vector<size_t>& dimensions, const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize)
+    {
+        init(dimensions, boxIndex, boxSize);
+    }
+
+    /*! \brief Constructor for a box with the given index and size within an array with the given description. */
+    BoxIterator(const ArrayDescription& desc, const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize)
+    {
+        init(desc.dimensions(), boxIndex, boxSize, desc.brickSize());
+    }
+
+    /*! \brief Constructor for all elements of an array with the given description. */
+    BoxIterator(const ArrayDescription& desc)
+    {
+        init(desc.dimensions(), std::vector<size_t>(desc.dimensionCount(), 0), desc.dimensions(), desc.brickSize());
+    }
+
+    /*! \brief Returns whether the iterator has passed the last element of the box. */
+    bool atEnd() const
+    {
+        return _atEnd;
+    }
+
+    /*! \brief Returns the multidimensional index of the current element. */
+    const std::vector<size_t>& index() const
+    {
+        return _index;
+    }
+
+    /*! \brief Returns the linear index of the current element within the array. */
+    size_t linearIndex() const
+    {
+        return _linearIndex;
+    }
+
+    /*! \brief Returns the position of the current element within the data
+     * of the array, in elements; see \a ArrayDescription::storageIndex(). */
+    size_t storageIndex() const
+    {
+        if (_brickSize.empty())
+            return _linearIndex;
+        return brickedStorageIndex(_dimensions, _brickSize, [&] (size_t d) { return _index[d]; });
+    }
+
+    /*! \brief Advances to the next element of the box. */
+    void next()
+    {
+        advance(0);
+    }
+
+    /*! \brief Returns the number of contiguous elements from the current
+     * element to the end of the current run. */
+    size_t runLength() const
+    {
+        if (!_brickSize.empty()) {
+            size_t brickEnd = (_index[0] / _brickSize[0] + 1) * _brickSize[0];
+            return std::min(brickEnd, _end[0]) - _index[0];
+        }
+        size_t offset = 0;
+        size_t extent = 1;
+        for (size_t d = 0; d < _runDimensions; d++) {
+            offset += (_index[d] - _start[d]) * extent;
+            extent *= _end[d] - _start[d];
+        }
+        return _runLength - offset;
+    }
+
+    /*! \brief Advances to the first element of the next run. */
+    void nextRun()
+    {
+        if (!_brickSize.empty()) {
+            size_t n = runLength();
+            if (_index[0] + n < _end[0]) {
+                _index[0] += n;
+                _linearIndex += n;
+                return;
             }
-            break;
-        case float32:
-            switch (a.componentType()) {
-            case int8:
-                convertData(static_cast<float*>(dst), static_cast<const int8_t*>(src), n);
-                break;
-            case uint8:
-                convertData(static_cast<float*>(dst), static_cast<const uint8_t*>(src), n);
-                break;
-            case int16:
-                convertData(static_cast<float*>(dst), static_cast<const int16_t*>(src), n);
-                break;
-            case uint16:
-                convertData(static_cast<float*>(dst), static_cast<const uint16_t*>(src), n);
-                break;
-            case int32:
-                convertData(static_cast<float*>(dst), static_cast<const int32_t*>(src), n);
-                break;
-            case uint32:
-                convertData(static_cast<float*>(dst), static_cast<const uint32_t*>(src), n);
-                break;
-            case int64:
-                convertData(static_cast<float*>(dst), static_cast<const int64_t*>(src), n);
-                break;
-            case uint64:
-                convertData(static_cast<float*>(dst), static_cast<const uint64_t*>(src), n);
-                break;
-            case float32:
-                convertData(static_cast<float*>(dst), static_cast<const float*>(src), n);
-                break;
-            case float64:
-                convertData(static_cast<float*>(dst), static_cast<const double*>(src), n);
-                break;
+        }
+        for (size_t d = 0; d < _runDimensions; d++) {
+            _linearIndex -= (_index[d] - _start[d]) * _strides[d];
+            _index[d] = _start[d];
+        }
+        advance(_runDimensions);
+    }
+
+    /*! \brief Returns a pointer to the current element of the given array.
+     * The following \a runLength() elements are contiguous in memory. */
+    void* get(ArrayContainer& array) const
+    {
+        assert(array.brickSize() == _brickSize);
+        return static_cast<unsigned char*>(array.data()) + storageIndex() * array.elementSize();
+    }
+
+    /*! \brief Returns a pointer to the current element of the given array.
+     * The following \a runLength() elements are contiguous in memory. */
+    const void* get(const ArrayContainer& array) const
+    {
+        assert(array.brickSize() == _brickSize);
+        return static_cast<const unsigned char*>(array.data()) + storageIndex() * array.elementSize();
+    }
+
+    /*! \brief Returns a pointer to the current element of the given array.
+     * The following \a runLength() elements are contiguous in memory. */
+    template<typename T> T* get(Array<T>& array) const
+    {
+        assert(array.brickSize() == _brickSize);
+        return static_cast<T*>(array.data()) + storageIndex() * array.componentCount();
+    }
+
+    /*! \brief Returns a pointer to the current element of the given array.
+     * The following \a runLength() elements are contiguous in memory. */
+    template<typename T> const T* get(const Array<T>& array) const
+    {
+        assert(array.brickSize() == _brickSize);
+        return static_cast<const T*>(array.data()) + storageIndex() * array.componentCount();
+    }
+};
+
+/*! \cond */
+
+/* Conversion from floating point to integer saturates to the range of the
+ * integer type; NaN is converted to zero. Other conversions follow the C++ rules.
+ * Half precision values are converted via float. */
+template<typename TO, typename FROM>
+inline TO convertComponent(FROM v)
+{
+    if constexpr (isHalfFloat<FROM>::value && !std::is_same<TO, FROM>::value) {
+        return convertComponent<TO>(float(v));
+    } else if constexpr (isHalfFloat<TO>::value && !std::is_same<TO, FROM>::value) {
+        return TO(convertComponent<float>(v));
+    } else if constexpr (std::is_floating_point<FROM>::value && std::is_integral<TO>::value) {
+        return (v != v ? TO(0)
+                : v <= FROM(std::numeric_limits<TO>::min()) ? std::numeric_limits<TO>::min()
+                : v >= FROM(std::numeric_limits<TO>::max()) ? std::numeric_limits<TO>::max()
+                : TO(v));
+    } else {
+        return v;
+    }
+}
+
+template<typename TO, typename FROM>
+void convertData(TO* dst, const FROM* src, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = convertComponent<TO>(src[i]);
+}
+
+#ifdef TGD_HAVE_AVX2_DISPATCH
+inline bool cpuHasAVX2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+
+__attribute__((target("avx2"))) inline size_t convertDataAVX2(float* dst, const uint8_t* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(x)));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) inline size_t convertDataAVX2(float* dst, const uint16_t* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(x)));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) inline size_t convertDataAVX2(float* dst, const int16_t* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x)));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) inline size_t convertDataAVX2(double* dst, const float* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(dst + i, _mm256_cvtps_pd(_mm_loadu_ps(src + i)));
+    return i;
+}
+
+__attribute__((target("avx2"))) inline size_t convertDataAVX2(float* dst, const double* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(dst + i, _mm256_cvtpd_ps(_mm256_loadu_pd(src + i)));
+    return i;
+}
+
+// All CPUs with AVX2 also have the F16C half precision conversion instructions
+__attribute__((target("avx2,f16c"))) inline size_t convertDataAVX2(float* dst, const Float16* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(x));
+    }
+    return i;
+}
+
+__attribute__((target("avx2,f16c"))) inline size_t convertDataAVX2(Float16* dst, const float* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), x);
+    }
+    return i;
+}
+#endif
+
+#if defined(TGD_HAVE_SSE2)
+inline __m128 convertClampSSE2(__m128 v, float lo, float hi)
+{
+    v = _mm_and_ps(v, _mm_cmpord_ps(v, v)); // NaN -> 0
+    return _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(lo)), _mm_set1_ps(hi));
+}
+#endif
+
+inline void convertData(float* dst, const uint8_t* src, size_t n)
+{
+    size_t i = 0;
+#ifdef TGD_HAVE_AVX2_DISPATCH
+    if (cpuHasAVX2())
+        i = convertDataAVX2(dst, src, n);
+#endif
+#if defined(TGD_HAVE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i lo = _mm_unpacklo_epi8(x, zero);
+        __m128i hi = _mm_unpackhi_epi8(x, zero);
+        _mm_storeu_ps(dst + i +  0, _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_ps(dst + i +  4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_ps(dst + i +  8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_ps(dst + i + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+    }
+#elif defined(TGD_HAVE_NEON)
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t x = vld1q_u8(src + i);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(x));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(x));
+        vst1q_f32(dst + i +  0, vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))));
+        vst1q_f32(dst + i +  4, vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo))));
+        vst1q_f32(dst + i +  8, vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))));
+        vst1q_f32(dst + i + 12, vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi))));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = src[i];
+}
+
+inline void convertData(float* dst, const uint16_t* src, size_t n)
+{
+    size_t i = 0;
+#ifdef TGD_HAVE_AVX2_DISPATCH
+    if (cpuHasAVX2())
+        i = convertDataAVX2(dst, src, n);
+#endif
+#if defined(TGD_HAVE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_ps(dst + i + 0, _mm_cvtepi32_ps(_mm_unpacklo_epi16(x, zero)));
+        _mm_storeu_ps(dst + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(x, zero)));
+    }
+#elif defined(TGD_HAVE_NEON)
+    for (; i + 8 <= n; i += 8) {
+        uint16x8_t x = vld1q_u16(src + i);
+        vst1q_f32(dst + i + 0, vcvtq_f32_u32(vmovl_u16(vget_low_u16(x))));
+        vst1q_f32(dst + i + 4, vcvtq_f32_u32(vmovl_u16(vget_high_u16(x))));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = src[i];
+}
+
+inline void convertData(float* dst, const int16_t* src, size_t n)
+{
+    size_t i = 0;
+#ifdef TGD_HAVE_AVX2_DISPATCH
+    if (cpuHasAVX2())
+        i = convertDataAVX2(dst, src, n);
+#endif
+#if defined(TGD_HAVE_SSE2)
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_ps(dst + i + 0, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)));
+        _mm_storeu_ps(dst + i + 4, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)));
+    }
+#elif defined(TGD_HAVE_NEON)
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t x = vld1q_s16(src + i);
+        vst1q_f32(dst + i + 0, vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))));
+        vst1q_f32(dst + i + 4, vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = src[i];
+}
+
+inline void convertData(double* dst, const float* src, size_t n)
+{
+    size_t i = 0;
+#ifdef TGD_HAVE_AVX2_DISPATCH
+    if (cpuHasAVX2())
+        i = convertDataAVX2(dst, src, n);
+#endif
+#if defined(TGD_HAVE_SSE2)
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(src + i);
+        _mm_storeu_pd(dst + i + 0, _mm_cvtps_pd(x));
+        _mm_storeu_pd(dst + i + 2, _mm_cvtps_pd(_mm_movehl_ps(x, x)));
+    }
+#elif defined(TGD_HAVE_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t x = vld1q_f32(src + i);
+        vst1q_f64(dst + i + 0, vcvt_f64_f32(vget_low_f32(x)));
+        vst1q_f64(dst + i + 2, vcvt_high_f64_f32(x));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = src[i];
+}
+
+inline void convertData(float* dst, const double* src, size_t n)
+{
+    size_t i = 0;
+#ifdef TGD_HAVE_AVX2_DISPATCH
+    if (cpuHasAVX2())
+        i = convertDataAVX2(dst, src, n);
+#endif
+#if defined(TGD_HAVE_SSE2)
+    for (; i + 4 <= n; i += 4) {
+        __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(src + i + 0));
+        __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(src + i + 2));
+        _mm_storeu_ps(dst + i, _mm_movelh_ps(lo, hi));
+    }
+#elif defined(TGD_HAVE_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4) {
+        float32x2_t lo = vcvt_f32_f64(vld1q_f64(src + i + 0));
+        vst1q_f32(dst + i, vcvt_high_f32_f64(lo, vld1q_f64(src + i + 2)));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = src[i];
+}
+
+inline void convertData(uint8_t* dst, const float* src, size_t n)
+{
+    size_t i = 0;
+#if defined(TGD_HAVE_SSE2)
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_cvttps_epi32(convertClampSSE2(_mm_loadu_ps(src + i +  0), 0.0f, 255.0f));
+        __m128i b = _mm_cvttps_epi32(convertClampSSE2(_mm_loadu_ps(src + i +  4), 0.0f, 255.0f));
+        __m128i c = _mm_cvttps_epi32(convertClampSSE2(_mm_loadu_ps(src + i +  8), 0.0f, 255.0f));
+        __m128i d = _mm_cvttps_epi32(convertClampSSE2(_mm_loadu_ps(src + i + 12), 0.0f, 255.0f));
+        __m128i ab = _mm_packs_epi32(a, b);
+        __m128i cd = _mm_packs_epi32(c, d);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(ab, cd));
+    }
+#elif defined(TGD_HAVE_NEON) && defined(__aarch64__)
+    for (; i + 8 <= n; i += 8) {
+        uint32x4_t a = vcvtq_u32_f32(vld1q_f32(src + i + 0));
+        uint32x4_t b = vcvtq_u32_f32(vld1q_f32(src + i + 4));
+        vst1_u8(dst + i, vqmovn_u16(vcombine_u16(vqmovn_u32(a), vqmovn_u32(b))));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = convertComponent<uint8_t>(src[i]);
+}
+
+inline void convertData(uint16_t* dst, const float* src, size_t n)
+{
+    size_t i = 0;
+#if defined(TGD_HAVE_SSE2)
+    // SSE2 has no unsigned 32->16 bit pack, so shift to the signed range and back
+    const __m128i bias32 = _mm_set1_epi32(32768);
+    const __m128i bias16 = _mm_set1_epi16(-32768);
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_cvttps_epi32(convertClampSSE2(_mm_loadu_ps(src + i + 0), 0.0f, 65535.0f));
+        __m128i b = _mm_cvttps_epi32(convertClampSSE2(_mm_loadu_ps(src + i + 4), 0.0f, 65535.0f));
+        __m128i ab = _mm_packs_epi32(_mm_sub_epi32(a, bias32), _mm_sub_epi32(b, bias32));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(ab, bias16));
+    }
+#elif defined(TGD_HAVE_NEON) && defined(__aarch64__)
+    for (; i + 8 <= n; i += 8) {
+        uint32x4_t a = vcvtq_u32_f32(vld1q_f32(src + i + 0));
+        uint32x4_t b = vcvtq_u32_f32(vld1q_f32(src + i + 4));
+        vst1q_u16(dst + i, vcombine_u16(vqmovn_u32(a), vqmovn_u32(b)));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = convertComponent<uint16_t>(src[i]);
+}
+
+inline void convertData(int16_t* dst, const float* src, size_t n)
+{
+    size_t i = 0;
+#if defined(TGD_HAVE_SSE2)
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_cvttps_epi32(convertClampSSE2(_mm_loadu_ps(src + i + 0), -32768.0f, 32767.0f));
+        __m128i b = _mm_cvttps_epi32(convertClampSSE2(_mm_loadu_ps(src + i + 4), -32768.0f, 32767.0f));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(a, b));
+    }
+#elif defined(TGD_HAVE_NEON) && defined(__aarch64__)
+    for (; i + 8 <= n; i += 8) {
+        int32x4_t a = vcvtq_s32_f32(vld1q_f32(src + i + 0));
+        int32x4_t b = vcvtq_s32_f32(vld1q_f32(src + i + 4));
+        vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = convertComponent<int16_t>(src[i]);
+}
+
+inline void convertData(uint8_t* dst, const uint16_t* src, size_t n)
+{
+    size_t i = 0;
+#if defined(TGD_HAVE_SSE2)
+    const __m128i mask = _mm_set1_epi16(0xff);
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 0)), mask);
+        __m128i b = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8)), mask);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(a, b));
+    }
+#elif defined(TGD_HAVE_NEON)
+    for (; i + 8 <= n; i += 8)
+        vst1_u8(dst + i, vmovn_u16(vld1q_u16(src + i)));
+#endif
+    for (; i < n; i++)
+        dst[i] = src[i];
+}
+
+inline void convertData(float* dst, const Float16* src, size_t n)
+{
+    size_t i = 0;
+#ifdef TGD_HAVE_AVX2_DISPATCH
+    if (cpuHasAVX2())
+        i = convertDataAVX2(dst, src, n);
+#endif
+#if defined(TGD_HAVE_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4) {
+        float16x4_t x = vreinterpret_f16_u16(vld1_u16(reinterpret_cast<const uint16_t*>(src + i)));
+        vst1q_f32(dst + i, vcvt_f32_f16(x));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = src[i];
+}
+
+inline void convertData(Float16* dst, const float* src, size_t n)
+{
+    size_t i = 0;
+#ifdef TGD_HAVE_AVX2_DISPATCH
+    if (cpuHasAVX2())
+        i = convertDataAVX2(dst, src, n);
+#endif
+#if defined(TGD_HAVE_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4) {
+        float16x4_t x = vcvt_f16_f32(vld1q_f32(src + i));
+        vst1_u16(reinterpret_cast<uint16_t*>(dst + i), vreinterpret_u16_f16(x));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = src[i];
+}
+
+inline void convertData(float* dst, const BFloat16* src, size_t n)
+{
+    size_t i = 0;
+#if defined(TGD_HAVE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_ps(dst + i + 0, _mm_castsi128_ps(_mm_unpacklo_epi16(zero, x)));
+        _mm_storeu_ps(dst + i + 4, _mm_castsi128_ps(_mm_unpackhi_epi16(zero, x)));
+    }
+#elif defined(TGD_HAVE_NEON)
+    for (; i + 4 <= n; i += 4) {
+        uint32x4_t x = vshll_n_u16(vld1_u16(reinterpret_cast<const uint16_t*>(src + i)), 16);
+        vst1q_f32(dst + i, vreinterpretq_f32_u32(x));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = src[i];
+}
+
+#if defined(TGD_HAVE_SSE2)
+// Round four floats to nearest even bfloat16 values, returned as sign-extended 32 bit integers
+inline __m128i convertBFloat16SSE2(__m128 v)
+{
+    __m128i x = _mm_castps_si128(v);
+    __m128i lsb = _mm_and_si128(_mm_srli_epi32(x, 16), _mm_set1_epi32(1));
+    __m128i rounded = _mm_add_epi32(x, _mm_add_epi32(lsb, _mm_set1_epi32(0x7fff)));
+    __m128i nan = _mm_or_si128(x, _mm_set1_epi32(0x400000));
+    __m128i isNaN = _mm_castps_si128(_mm_cmpunord_ps(v, v));
+    x = _mm_or_si128(_mm_and_si128(isNaN, nan), _mm_andnot_si128(isNaN, rounded));
+    return _mm_srai_epi32(x, 16);
+}
+#endif
+
+inline void convertData(BFloat16* dst, const float* src, size_t n)
+{
+    size_t i = 0;
+#if defined(TGD_HAVE_SSE2)
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = convertBFloat16SSE2(_mm_loadu_ps(src + i + 0));
+        __m128i b = convertBFloat16SSE2(_mm_loadu_ps(src + i + 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(a, b));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = src[i];
+}
+
+/*! \endcond */
+
+/*! \brief Convert \a n components of type \a srcType at \a src to type
+ * \a dstType and store them at \a dst. The memory regions must not overlap. */
+inline void convertComponents(void* dst, Type dstType, const void* src, Type srcType, size_t n)
+{
+    visitType(dstType, [=] (auto dstTag) {
+            typedef typename decltype(dstTag)::type TO;
+            visitType(srcType, [=] (auto srcTag) {
+                    typedef typename decltype(srcTag)::type FROM;
+                    convertData(static_cast<TO*>(dst), static_cast<const FROM*>(src), n);
+                });
+        });
+}
+
+/*! \brief Convert the given array to the given new component type.
+ * If conversion is not actually necessary because the new type is the same
+ * as the old, the returned array will simply share its data with the 
+ * original array. */
+inline ArrayContainer convert(const ArrayContainer& a, Type newType)
+{
+    if (a.componentType() == newType) {
+        return a;
+    } else {
+        ArrayDescription rDescr(a, newType);
+        ArrayContainer r(rDescr);
+        convertComponents(r.data(), newType, a.data(), a.componentType(), r.elementCount() * r.componentCount());
+        return r;
+    }
+}
+
+/*! \cond */
+template<typename T> inline constexpr double normalizationFactorPos() { return std::numeric_limits<T>::max(); }
+template<typename T> inline constexpr double normalizationFactorNeg() { return -double(std::numeric_limits<T>::min()); }
+
+// Blocks keep the intermediate data in the cache between the conversion and scaling steps
+constexpr size_t normalizationBlockSize = 4096;
+
+template<typename TO, typename FROM>
+void convertDataNormalizedToFloat(TO* dst, const FROM* src, size_t n)
+{
+    for (size_t i = 0; i < n; i += normalizationBlockSize) {
+        size_t m = std::min(normalizationBlockSize, n - i);
+        convertData(dst + i, src + i, m);
+        const TO pos = normalizationFactorPos<FROM>();
+        if constexpr (std::is_signed<FROM>::value) {
+            const TO neg = normalizationFactorNeg<FROM>();
+            for (size_t j = i; j < i + m; j++)
+                dst[j] = (dst[j] < TO(0) ? dst[j] / neg : dst[j] / pos);
+        } else {
+            for (size_t j = i; j < i + m; j++)
+                dst[j] /= pos;
+        }
+    }
+}
+
+template<typename TO, typename FROM>
+void convertDataNormalizedFromFloat(TO* dst, const FROM* src, size_t n)
+{
+    FROM tmp[normalizationBlockSize];
+    for (size_t i = 0; i < n; i += normalizationBlockSize) {
+        size_t m = std::min(normalizationBlockSize, n - i);
+        const FROM pos = normalizationFactorPos<TO>();
+        if constexpr (std::is_signed<TO>::value) {
+            const FROM neg = normalizationFactorNeg<TO>();
+            for (size_t j = 0; j < m; j++)
+                tmp[j] = (src[i + j] < FROM(0) ? src[i + j] * neg : src[i + j] * pos);
+        } else {
+            for (size_t j = 0; j < m; j++)
+                tmp[j] = src[i + j] * pos;
+        }
+        convertData(dst + i, tmp, m);
+    }
+}
+
+template<typename F>
+bool convertComponentsNormalizedToFloat(F* dst, const void* src, Type srcType, size_t n)
+{
+    switch (srcType) {
+    case int8:
+        convertDataNormalizedToFloat(dst, static_cast<const int8_t*>(src), n);
+        return true;
+    case uint8:
+        convertDataNormalizedToFloat(dst, static_cast<const uint8_t*>(src), n);
+        return true;
+    case int16:
+        convertDataNormalizedToFloat(dst, static_cast<const int16_t*>(src), n);
+        return true;
+    case uint16:
+        convertDataNormalizedToFloat(dst, static_cast<const uint16_t*>(src), n);
+        return true;
+    default:
+        return false;
+    }
+}
+
+template<typename F>
+bool convertComponentsNormalizedFromFloat(void* dst, Type dstType, const F* src, size_t n)
+{
+    switch (dstType) {
+    case int8:
+        convertDataNormalizedFromFloat(static_cast<int8_t*>(dst), src, n);
+        return true;
+    case uint8:
+        convertDataNormalizedFromFloat(static_cast<uint8_t*>(dst), src, n);
+        return true;
+    case int16:
+        convertDataNormalizedFromFloat(static_cast<int16_t*>(dst), src, n);
+        return true;
+    case uint16:
+        convertDataNormalizedFromFloat(static_cast<uint16_t*>(dst), src, n);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Half precision values are normalized in blocks of float32 values
+inline bool convertComponentsNormalizedHalf(void* dst, Type dstType, const void* src, Type srcType, size_t n)
+{
+    const bool toHalf = (dstType == float16 || dstType == bfloat16);
+    const Type intType = (toHalf ? srcType : dstType);
+    if (intType != int8 && intType != uint8 && intType != int16 && intType != uint16)
+        return false;
+    float tmp[normalizationBlockSize];
+    for (size_t i = 0; i < n; i += normalizationBlockSize) {
+        size_t m = std::min(normalizationBlockSize, n - i);
+        void* d = static_cast<unsigned char*>(dst) + i * typeSize(dstType);
+        const void* s = static_cast<const unsigned char*>(src) + i * typeSize(srcType);
+        if (toHalf) {
+            convertComponentsNormalizedToFloat(tmp, s, srcType, m);
+            convertComponents(d, dstType, tmp, float32, m);
+        } else {
+            convertComponents(tmp, float32, s, srcType, m);
+            convertComponentsNormalizedFromFloat(d, dstType, tmp, m);
+        }
+    }
+    return true;
+}
+/*! \endcond */
+
+/*! \brief Convert \a n components of type \a srcType at \a src to type \a dstType
+ * with normalization and store them at \a dst.
+ * Conversion from int8, uint8, int16 and uint16 to a floating point type maps
+ * the integer range to [-1,1] or [0,1], and conversion from a floating point
+ * type to these integer types maps [-1,1] or [0,1] back to the integer
+ * range. Returns false if no normalization applies to the given types; in that
+ * case, the data is converted as with \a convertComponents(). */
+inline bool convertComponentsNormalized(void* dst, Type dstType, const void* src, Type srcType, size_t n)
+{
+    bool normalized = false;
+    if (dstType == float16 || dstType == bfloat16 || srcType == float16 || srcType == bfloat16)
+        normalized = convertComponentsNormalizedHalf(dst, dstType, src, srcType, n);
+    else if (dstType == float32)
+        normalized = convertComponentsNormalizedToFloat(static_cast<float*>(dst), src, srcType, n);
+    else if (dstType == float64)
+        normalized = convertComponentsNormalizedToFloat(static_cast<double*>(dst), src, srcType, n);
+    else if (srcType == float32)
+        normalized = convertComponentsNormalizedFromFloat(dst, dstType, static_cast<const float*>(src), n);
+    else if (srcType == float64)
+        normalized = convertComponentsNormalizedFromFloat(dst, dstType, static_cast<const double*>(src), n);
+    if (!normalized)
+        convertComponents(dst, dstType, src, srcType, n);
+    return normalized;
+}
+
+/*! \brief Convert the given array to the given new component type with normalization,
+ * see \a convertComponentsNormalized(). If \a normalized is not nullptr, it will
+ * be set to whether normalization applied. */
+inline ArrayContainer convertNormalized(const ArrayContainer& a, Type newType, bool* normalized = nullptr)
+{
+    if (a.componentType() == newType) {
+        if (normalized)
+            *normalized = false;
+        return a;
+    } else {
+        ArrayContainer r(ArrayDescription(a, newType));
+        bool n = convertComponentsNormalized(r.data(), newType, a.data(), a.componentType(), r.elementCount() * r.componentCount());
+        if (normalized)
+            *normalized = n;
+        return r;
+    }
+}
+
+/*! \cond */
+/* Copy a box of elements between two arrays in the linear layout with the given dimensions, row by row */
+inline void copyBox(unsigned char* dst, const std::vector<size_t>& dstDims, const std::vector<size_t>& dstIndex,
+        const unsigned char* src, const std::vector<size_t>& srcDims, const std::vector<size_t>& srcIndex,
+        const std::vector<size_t>& size, size_t elementSize)
+{
+    const size_t rowSize = size[0] * elementSize;
+    std::vector<size_t> dstRowDims(dstDims.begin() + 1, dstDims.end());
+    std::vector<size_t> dstRowIndex(dstIndex.begin() + 1, dstIndex.end());
+    std::vector<size_t> srcRowDims(srcDims.begin() + 1, srcDims.end());
+    std::vector<size_t> srcRowIndex(srcIndex.begin() + 1, srcIndex.end());
+    std::vector<size_t> rowBoxSize(size.begin() + 1, size.end());
+    if (rowBoxSize.empty()) {
+        std::memcpy(dst + dstIndex[0] * elementSize, src + srcIndex[0] * elementSize, rowSize);
+        return;
+    }
+    BoxIterator dstIt(dstRowDims, dstRowIndex, rowBoxSize);
+    BoxIterator srcIt(srcRowDims, srcRowIndex, rowBoxSize);
+    for (; !dstIt.atEnd(); dstIt.next(), srcIt.next()) {
+        std::memcpy(dst + (dstIt.linearIndex() * dstDims[0] + dstIndex[0]) * elementSize,
+                src + (srcIt.linearIndex() * srcDims[0] + srcIndex[0]) * elementSize,
+                rowSize);
+    }
+}
+
+/* Copy the data of array a to r, which has the same description except for the
+ * layout. One of the two arrays is linear, the other is bricked. The bricks are
+ * contiguous in memory, so each brick is copied row by row from or to its box
+ * in the linear array. */
+inline void copyBetweenLayouts(ArrayContainer& r, const ArrayContainer& a)
+{
+    assert(a.isBricked() != r.isBricked());
+    const bool toBricked = r.isBricked();
+    const ArrayDescription& bricked = (toBricked ? r.description() : a.description());
+    const std::vector<size_t>& brickSize = bricked.brickSize();
+    const size_t n = bricked.dimensionCount();
+    const size_t elementSize = bricked.elementSize();
+    std::vector<size_t> grid(n), boxIndex(n), boxSize(n);
+    for (size_t d = 0; d < n; d++)
+        grid[d] = (bricked.dimension(d) + brickSize[d] - 1) / brickSize[d];
+    unsigned char* linearData = static_cast<unsigned char*>(toBricked ? nullptr : r.data());
+    const unsigned char* constLinearData = static_cast<const unsigned char*>(toBricked ? a.data() : nullptr);
+    unsigned char* brickDst = static_cast<unsigned char*>(toBricked ? r.data() : nullptr);
+    const unsigned char* brickSrc = static_cast<const unsigned char*>(toBricked ? nullptr : a.data());
+    for (BoxIterator brick(grid, std::vector<size_t>(n, 0), grid); !brick.atEnd(); brick.next()) {
+        for (size_t d = 0; d < n; d++) {
+            boxIndex[d] = brick.index()[d] * brickSize[d];
+            boxSize[d] = std::min(brickSize[d], bricked.dimension(d) - boxIndex[d]);
+        }
+        for (BoxIterator it(bricked.dimensions(), boxIndex, boxSize); !it.atEnd(); it.nextRun()) {
+            size_t size = it.runLength() * elementSize;
+            size_t offset = it.linearIndex() * elementSize;
+            if (toBricked) {
+                std::memcpy(brickDst, constLinearData + offset, size);
+                brickDst += size;
+            } else {
+                std::memcpy(linearData + offset, brickSrc, size);
+                brickSrc += size;
             }
-            break;
-        case float64:
-            switch (a.componentType()) {
-            case int8:
-                convertData(static_cast<double*>(dst), static_cast<const int8_t*>(src), n);
-                break;
-            case uint8:
-                convertData(static_cast<double*>(dst), static_cast<const uint8_t*>(src), n);
-                break;
-            case int16:
-                convertData(static_cast<double*>(dst), static_cast<const int16_t*>(src), n);
-                break;
-            case uint16:
-                convertData(static_cast<double*>(dst), static_cast<const uint16_t*>(src), n);
-                break;
-            case int32:
-                convertData(static_cast<double*>(dst), static_cast<const int32_t*>(src), n);
-                break;
-            case uint32:
-                convertData(static_cast<double*>(dst), static_cast<const uint32_t*>(src), n);
-                break;
-            case int64:
-                convertData(static_cast<double*>(dst), static_cast<const int64_t*>(src), n);
-                break;
-            case uint64:
-                convertData(static_cast<double*>(dst), static_cast<const uint64_t*>(src), n);
-                break;
-            case float32:
-                convertData(static_cast<double*>(dst), static_cast<const float*>(src), n);
-                break;
-            case float64:
-                convertData(static_cast<double*>(dst), static_cast<const double*>(src), n);
-                break;
+        }
+    }
+}
+/*! \endcond */
+
+/*! \brief Returns the array \a a in the bricked layout with the given \a brickSize;
+ * see \a ArrayDescription::isBricked(). The brick size must be given for each dimension.
+ * If the array already has that layout, the returned container shares its data. */
+inline ArrayContainer toBricked(const ArrayContainer& a, const std::vector<size_t>& brickSize)
+{
+    ArrayDescription desc(a.description(), brickSize);
+    if (desc.brickSize() == a.brickSize())
+        return a;
+    if (a.isBricked() && desc.isBricked())
+        return toBricked(toBricked(a, std::vector<size_t>()), brickSize);
+    ArrayContainer r(desc);
+    if (r.dataSize() > 0)
+        copyBetweenLayouts(r, a);
+    return r;
+}
+
+/*! \brief Returns the array \a a in the linear layout; see \a ArrayDescription::isBricked().
+ * If the array already has that layout, the returned container shares its data. */
+inline ArrayContainer toLinear(const ArrayContainer& a)
+{
+    return toBricked(a, std::vector<size_t>());
+}
+
+/*! \brief Returns a copy of the box of array \a a that starts at \a boxIndex and has
+ * the size \a boxSize, in the linear layout. This works for both layouts of \a a; for
+ * the bricked layout, the cost of extracting a slice is the same along all dimensions.
+ * For linear arrays, see also \a ArrayView::box(). */
+inline ArrayContainer extractBox(const ArrayContainer& a,
+        const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize)
+{
+    ArrayContainer r(boxSize, a.componentCount(), a.componentType());
+    r.globalTagList() = a.globalTagList();
+    for (size_t d = 0; d < r.dimensionCount(); d++)
+        r.dimensionTagList(d) = a.dimensionTagList(d);
+    for (size_t c = 0; c < r.componentCount(); c++)
+        r.componentTagList(c) = a.componentTagList(c);
+    if (r.dataSize() == 0)
+        return r;
+    unsigned char* dst = static_cast<unsigned char*>(r.data());
+    if (!a.isBricked()) {
+        for (BoxIterator it(a, boxIndex, boxSize); !it.atEnd(); it.nextRun()) {
+            size_t size = it.runLength() * a.elementSize();
+            std::memcpy(dst, it.get(a), size);
+            dst += size;
+        }
+        return r;
+    }
+    // Copy the intersection of each brick with the box
+    const size_t n = a.dimensionCount();
+    const std::vector<size_t>& brickSize = a.brickSize();
+    std::vector<size_t> grid(n), gridIndex(n), gridSize(n);
+    std::vector<size_t> brickIndex(n), brickExtent(n), srcIndex(n), dstIndex(n), copySize(n);
+    for (size_t d = 0; d < n; d++) {
+        grid[d] = (a.dimension(d) + brickSize[d] - 1) / brickSize[d];
+        gridIndex[d] = boxIndex[d] / brickSize[d];
+        gridSize[d] = (boxIndex[d] + boxSize[d] + brickSize[d] - 1) / brickSize[d] - gridIndex[d];
+    }
+    for (BoxIterator brick(grid, gridIndex, gridSize); !brick.atEnd(); brick.next()) {
+        for (size_t d = 0; d < n; d++) {
+            brickIndex[d] = brick.index()[d] * brickSize[d];
+            brickExtent[d] = std::min(brickSize[d], a.dimension(d) - brickIndex[d]);
+            size_t lo = std::max(brickIndex[d], boxIndex[d]);
+            size_t hi = std::min(brickIndex[d] + brickExtent[d], boxIndex[d] + boxSize[d]);
+            srcIndex[d] = lo - brickIndex[d];
+            dstIndex[d] = lo - boxIndex[d];
+            copySize[d] = hi - lo;
+        }
+        copyBox(dst, boxSize, dstIndex, static_cast<const unsigned char*>(a.get(brickIndex)),
+                brickExtent, srcIndex, copySize, a.elementSize());
+    }
+    return r;
+}
+
+/*! \brief A strided, non-owning view on the data of an ArrayContainer.
+ *
+ * A view shares the data of its container and describes a subset of it
+ * with an offset and per-dimension strides. Views can restrict the container
+ * to a box, select and reorder components, permute dimensions, and reverse
+ * dimensions, all without copying data. Use \a materialize() to obtain a
+ * contiguous ArrayContainer; its cost depends only on the size of the view. */
+class ArrayView
+{
+private:
+    ArrayContainer _container;
+    std::vector<size_t> _dimensions;
+    std::vector<ptrdiff_t> _strides;    // in bytes
+    std::vector<size_t> _dimensionMap;  // container dimension for each view dimension
+    std::vector<size_t> _components;    // container component for each view component
+    ptrdiff_t _offset;                  // in bytes
+
+    bool componentsAreIdentity() const
+    {
+        if (_components.size() != _container.componentCount())
+            return false;
+        for (size_t c = 0; c < _components.size(); c++)
+            if (_components[c] != c)
+                return false;
+        return true;
+    }
+
+    const unsigned char* elementAddress(const std::vector<size_t>& elementIndex) const
+    {
+        ptrdiff_t offset = _offset;
+        for (size_t d = 0; d < elementIndex.size(); d++) {
+            assert(elementIndex[d] < _dimensions[d]);
+            offset += elementIndex[d] * _strides[d];
+        }
+        return static_cast<const unsigned char*>(_container.data()) + offset;
+    }
+
+public:
+    /*! \brief Constructor for an empty view. */
+    ArrayView() : _offset(0)
+    {
+    }
+
+    /*! \brief Constructor for a view on all of \a container. Views describe
+     * data in the linear layout, so a container in the bricked layout is
+     * converted with \a toLinear() first; see \a extractBox() for an alternative. */
+    ArrayView(const ArrayContainer& container) :
+        _container(toLinear(container)),
+        _dimensions(container.dimensions()),
+        _strides(container.dimensionCount()),
+        _dimensionMap(container.dimensionCount()),
+        _components(container.componentCount()),
+        _offset(0)
+    {
+        ptrdiff_t stride = container.elementSize();
+        for (size_t d = 0; d < _dimensions.size(); d++) {
+            _strides[d] = stride;
+            _dimensionMap[d] = d;
+            stride *= _dimensions[d];
+        }
+        for (size_t c = 0; c < _components.size(); c++)
+            _components[c] = c;
+    }
+
+    /*! \brief Returns the container that this view refers to. */
+    const ArrayContainer& container() const
+    {
+        return _container;
+    }
+
+    /*! \brief Returns the number of dimensions of the view. */
+    size_t dimensionCount() const
+    {
+        return _dimensions.size();
+    }
+
+    /*! \brief Returns the size of dimension \a d of the view. */
+    size_t dimension(size_t d) const
+    {
+        assert(d < dimensionCount());
+        return _dimensions[d];
+    }
+
+    /*! \brief Returns the list of dimensions of the view. */
+    const std::vector<size_t>& dimensions() const
+    {
+        return _dimensions;
+    }
+
+    /*! \brief Returns the stride of dimension \a d in bytes. This may be negative. */
+    ptrdiff_t stride(size_t d) const
+    {
+        assert(d < dimensionCount());
+        return _strides[d];
+    }
+
+    /*! \brief Returns the number of elements in the view. */
+    size_t elementCount() const
+    {
+        size_t n = (_dimensions.size() > 0 ? 1 : 0);
+        for (size_t d = 0; d < _dimensions.size(); d++)
+            n *= _dimensions[d];
+        return n;
+    }
+
+    /*! \brief Returns the number of components of each element in the view. */
+    size_t componentCount() const
+    {
+        return _components.size();
+    }
+
+    /*! \brief Returns the container component that component \a c of the view refers to. */
+    size_t containerComponent(size_t c) const
+    {
+        assert(c < componentCount());
+        return _components[c];
+    }
+
+    /*! \brief Returns the container dimension that dimension \a d of the view refers to. */
+    size_t containerDimension(size_t d) const
+    {
+        assert(d < dimensionCount());
+        return _dimensionMap[d];
+    }
+
+    /*! \brief Returns the component type. */
+    Type componentType() const
+    {
+        return _container.componentType();
+    }
+
+    /*! \brief Returns the size of a component in bytes. */
+    size_t componentSize() const
+    {
+        return _container.componentSize();
+    }
+
+    /*! \brief Returns whether the view covers all of its container in the original layout. */
+    bool isContiguous() const
+    {
+        if (_offset != 0 || !componentsAreIdentity() || _dimensions != _container.dimensions())
+            return false;
+        ptrdiff_t stride = _container.elementSize();
+        for (size_t d = 0; d < _dimensions.size(); d++) {
+            if (_strides[d] != stride && _dimensions[d] > 1)
+                return false;
+            stride *= _dimensions[d];
+        }
+        return true;
+    }
+
+    /*! \brief Returns a pointer to component \a componentIndex of the element with index \a elementIndex. */
+    const void* get(const std::vector<size_t>& elementIndex, size_t componentIndex) const
+    {
+        assert(elementIndex.size() == dimensionCount());
+        assert(componentIndex < componentCount());
+        return elementAddress(elementIndex) + _components[componentIndex] * componentSize();
+    }
+
+    /*! \brief Returns a pointer to component \a componentIndex of the element with index \a elementIndex. */
+    template<typename T>
+    const T* get(const std::vector<size_t>& elementIndex, size_t componentIndex) const
+    {
+        assert(typeFromTemplate<T>() == componentType());
+        return static_cast<const T*>(get(elementIndex, componentIndex));
+    }
+
+    /*! \brief Returns a view restricted to the box starting at \a index with the given \a size. */
+    ArrayView box(const std::vector<size_t>& index, const std::vector<size_t>& size) const
+    {
+        assert(index.size() == dimensionCount() && size.size() == dimensionCount());
+        ArrayView v(*this);
+        for (size_t d = 0; d < _dimensions.size(); d++) {
+            assert(index[d] + size[d] <= _dimensions[d]);
+            v._offset += index[d] * _strides[d];
+            v._dimensions[d] = size[d];
+        }
+        return v;
+    }
+
+    /*! \brief Returns a view with the given list of components of this view, in the given order. */
+    ArrayView components(const std::vector<size_t>& componentList) const
+    {
+        ArrayView v(*this);
+        v._components.resize(componentList.size());
+        for (size_t c = 0; c < componentList.size(); c++) {
+            assert(componentList[c] < componentCount());
+            v._components[c] = _components[componentList[c]];
+        }
+        return v;
+    }
+
+    /*! \brief Returns a view with permuted dimensions: dimension \a d of the
+     * new view is dimension \a order[d] of this view. */
+    ArrayView permuted(const std::vector<size_t>& order) const
+    {
+        assert(order.size() == dimensionCount());
+        ArrayView v(*this);
+        for (size_t d = 0; d < order.size(); d++) {
+            assert(order[d] < dimensionCount());
+            v._dimensions[d] = _dimensions[order[d]];
+            v._strides[d] = _strides[order[d]];
+            v._dimensionMap[d] = _dimensionMap[order[d]];
+        }
+        return v;
+    }
+
+    /*! \brief Returns a view in which dimension \a d is reversed. */
+    ArrayView reversed(size_t d) const
+    {
+        assert(d < dimensionCount());
+        ArrayView v(*this);
+        if (_dimensions[d] > 0)
+            v._offset += (_dimensions[d] - 1) * _strides[d];
+        v._strides[d] = -_strides[d];
+        return v;
+    }
+
+    /*! \cond */
+    static bool incrementIndex(const std::vector<size_t>& dimensions, std::vector<size_t>& index, size_t startDim = 0)
+    {
+        for (size_t d = startDim; d < dimensions.size(); d++) {
+            if (++index[d] < dimensions[d])
+                return true;
+            index[d] = 0;
+        }
+        return false;
+    }
+    /*! \endcond */
+
+    /*! \brief Returns a contiguous array container with the data of the view,
+     * converted to \a newType. The tag lists follow the selected dimensions
+     * and components. If the view is contiguous and no conversion is
+     * necessary, the returned container shares its data with the original. */
+    ArrayContainer materialize(Type newType) const
+    {
+        if (isContiguous())
+            return convert(_container, newType);
+        ArrayContainer r(_dimensions, componentCount(), newType);
+        r.globalTagList() = _container.globalTagList();
+        for (size_t d = 0; d < dimensionCount(); d++)
+            r.dimensionTagList(d) = _container.dimensionTagList(_dimensionMap[d]);
+        for (size_t c = 0; c < componentCount(); c++)
+            r.componentTagList(c) = _container.componentTagList(_components[c]);
+        if (r.dataSize() == 0)
+            return r;
+
+        // Process the view row by row: gather each row of dimension 0 into
+        // contiguous memory, then convert it if necessary.
+        const size_t rowLength = _dimensions[0];
+        const size_t rowComponents = rowLength * componentCount();
+        const bool denseRows = (componentsAreIdentity() && _strides[0] == ptrdiff_t(_container.elementSize()));
+        const bool needConversion = (newType != componentType());
+        std::vector<unsigned char> rowBuffer(needConversion && !denseRows ? rowComponents * componentSize() : 0);
+        unsigned char* dst = static_cast<unsigned char*>(r.data());
+        std::vector<size_t> index(dimensionCount(), 0);
+        do {
+            const unsigned char* row = elementAddress(index);
+            const unsigned char* src = row;
+            if (!denseRows) {
+                unsigned char* gather = (needConversion ? rowBuffer.data() : dst);
+                for (size_t e = 0; e < rowLength; e++) {
+                    const unsigned char* element = row + ptrdiff_t(e) * _strides[0];
+                    for (size_t c = 0; c < componentCount(); c++) {
+                        std::memcpy(gather, element + _components[c] * componentSize(), componentSize());
+                        gather += componentSize();
+                    }
+                }
+                src = (needConversion ? rowBuffer.data() : nullptr);
             }
-            break;
+            if (needConversion)
+                convertComponents(dst, newType, src, componentType(), rowComponents);
+            else if (denseRows)
+                std::memcpy(dst, src, rowComponents * componentSize());
+            dst += rowComponents * r.componentSize();
         }
+        while (incrementIndex(_dimensions, index, 1));
         return r;
     }
+
+    /*! \brief Returns a contiguous array container with the data of the view.
+     * See \a materialize(Type). */
+    ArrayContainer materialize() const
+    {
+        return materialize(componentType());
+    }
+};
+
+/*! \brief Convert the data of the given view to a contiguous array with the given component type. */
+inline ArrayContainer convert(const ArrayView& v, Type newType)
+{
+    return v.materialize(newType);
 }
 
 }
@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2018, 2019, 2020, 2021, 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TGD_DLPACK_HPP
+#define TGD_DLPACK_HPP
+
+/**
+ * \file dlpack.hpp
+ * \brief Zero-copy exchange of arrays with other libraries via DLPack tensors.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "array.hpp"
+
+/*! \cond */
+#if defined(__has_include)
+# if __has_include(<dlpack/dlpack.h>)
+#  include <dlpack/dlpack.h>
+# endif
+#endif
+#ifndef DLPACK_DLPACK_H_
+// The subset of dlpack.h (DLPack 0.8, https://github.com/dmlc/dlpack) that is
+// needed here. It is binary compatible with the original, and uses the same
+// include guard so that including dlpack.h afterwards has no effect.
+#define DLPACK_DLPACK_H_
+#define DLPACK_VERSION 80
+#define DLPACK_ABI_VERSION 1
+extern "C" {
+typedef enum {
+    kDLCPU = 1,
+    kDLCUDA = 2,
+    kDLCUDAHost = 3,
+    kDLOpenCL = 4,
+    kDLVulkan = 7,
+    kDLMetal = 8,
+    kDLVPI = 9,
+    kDLROCM = 10,
+    kDLROCMHost = 11,
+    kDLExtDev = 12,
+    kDLCUDAManaged = 13,
+    kDLOneAPI = 14,
+    kDLWebGPU = 15,
+    kDLHexagon = 16,
+} DLDeviceType;
+typedef struct {
+    DLDeviceType device_type;
+    int32_t device_id;
+} DLDevice;
+typedef enum {
+    kDLInt = 0U,
+    kDLUInt = 1U,
+    kDLFloat = 2U,
+    kDLOpaqueHandle = 3U,
+    kDLBfloat = 4U,
+    kDLComplex = 5U,
+    kDLBool = 6U,
+} DLDataTypeCode;
+typedef struct {
+    uint8_t code;
+    uint8_t bits;
+    uint16_t lanes;
+} DLDataType;
+typedef struct {
+    void* data;
+    DLDevice device;
+    int32_t ndim;
+    DLDataType dtype;
+    int64_t* shape;
+    int64_t* strides;
+    uint64_t byte_offset;
+} DLTensor;
+typedef struct DLManagedTensor {
+    DLTensor dl_tensor;
+    void* manager_ctx;
+    void (*deleter)(struct DLManagedTensor* self);
+} DLManagedTensor;
+}
+#endif
+/*! \endcond */
+
+namespace TGD {
+
+/*! \brief Returns the DLPack data type that corresponds to \a t. */
+inline DLDataType typeToDLPack(Type t)
+{
+    DLDataType dt;
+    dt.code = (t == float32 || t == float64 || t == float16 ? kDLFloat
+            : t == bfloat16 ? kDLBfloat
+            : t == int8 || t == int16 || t == int32 || t == int64 ? kDLInt
+            : kDLUInt);
+    dt.bits = 8 * typeSize(t);
+    dt.lanes = 1;
+    return dt;
+}
+
+/*! \brief Sets \a t to the type that corresponds to the DLPack data type \a dt.
+ * Returns false if there is no such type. */
+inline bool typeFromDLPack(DLDataType dt, Type* t)
+{
+    if (dt.lanes != 1)
+        return false;
+    Type r;
+    if (dt.code == kDLInt && dt.bits == 8)
+        r = int8;
+    else if (dt.code == kDLUInt && dt.bits == 8)
+        r = uint8;
+    else if (dt.code == kDLInt && dt.bits == 16)
+        r = int16;
+    else if (dt.code == kDLUInt && dt.bits == 16)
+        r = uint16;
+    else if (dt.code == kDLInt && dt.bits == 32)
+        r = int32;
+    else if (dt.code == kDLUInt && dt.bits == 32)
+        r = uint32;
+    else if (dt.code == kDLInt && dt.bits == 64)
+        r = int64;
+    else if (dt.code == kDLUInt && dt.bits == 64)
+        r = uint64;
+    else if (dt.code == kDLFloat && dt.bits == 16)
+        r = float16;
+    else if (dt.code == kDLFloat && dt.bits == 32)
+        r = float32;
+    else if (dt.code == kDLFloat && dt.bits == 64)
+        r = float64;
+    else if (dt.code == kDLBfloat && dt.bits == 16)
+        r = bfloat16;
+    else
+        return false;
+    *t = r;
+    return true;
+}
+
+/*! \cond */
+/* The manager context of exported tensors: it holds a reference to the data
+ * and the storage for shape and strides. */
+struct DLPackExport
+{
+    ArrayContainer container;
+    std::vector<int64_t> shape;
+    std::vector<int64_t> strides;
+    DLManagedTensor tensor;
+};
+
+inline void deleteDLPackExport(DLManagedTensor* tensor)
+{
+    delete static_cast<DLPackExport*>(tensor->manager_ctx);
+}
+
+inline DLManagedTensor* toDLPackHelper(DLPackExport* e, const void* data)
+{
+    DLTensor& t = e->tensor.dl_tensor;
+    t.data = const_cast<void*>(data);
+    t.device.device_type = kDLCPU;
+    t.device.device_id = 0;
+    t.ndim = e->shape.size();
+    t.dtype = typeToDLPack(e->container.componentType());
+    t.shape = e->shape.data();
+    t.strides = e->strides.data();
+    t.byte_offset = 0;
+    e->tensor.manager_ctx = e;
+    e->tensor.deleter = deleteDLPackExport;
+    return &e->tensor;
+}
+/*! \endcond */
+
+/*! \brief Returns a DLPack tensor that shares the data of \a array without copying it.
+ *
+ * The tensor has the axes (n-1, ..., 1, 0, c), where n is the number of array
+ * dimensions and the last axis enumerates the components, so that it is a
+ * row-major (C order) tensor. For example, an RGB image of width w and height h
+ * becomes a tensor with shape (h, w, 3). The data is shared through a reference
+ * to the array data that is held until the deleter of the tensor is called; the
+ * caller owns the returned tensor, e.g. until it is passed to another library.
+ * Arrays in the bricked layout are converted to the linear layout first.
+ * Data that is shared with other containers must not be modified through the tensor. */
+inline DLManagedTensor* toDLPack(const ArrayContainer& array)
+{
+    DLPackExport* e = new DLPackExport;
+    e->container = toLinear(array);
+    const size_t n = array.dimensionCount();
+    e->shape.resize(n + 1);
+    e->strides.resize(n + 1);
+    int64_t stride = array.componentCount();
+    e->shape[n] = array.componentCount();
+    e->strides[n] = 1;
+    for (size_t d = 0; d < n; d++) {
+        e->shape[n - 1 - d] = array.dimension(d);
+        e->strides[n - 1 - d] = stride;
+        stride *= array.dimension(d);
+    }
+    return toDLPackHelper(e, e->container.data());
+}
+
+/*! \brief Returns a DLPack tensor that shares the data of \a view without copying it.
+ *
+ * This works like \a toDLPack(const ArrayContainer&), except that the strides of the
+ * tensor describe the view. This requires that the components of the view are
+ * equally spaced within the container elements; otherwise, nullptr is returned.
+ * Note that some libraries do not accept negative strides, which result from
+ * reversed dimensions. */
+inline DLManagedTensor* toDLPack(const ArrayView& view)
+{
+    const size_t n = view.dimensionCount();
+    const size_t cc = view.componentCount();
+    ptrdiff_t componentStride = (cc > 1 ? ptrdiff_t(view.containerComponent(1)) - ptrdiff_t(view.containerComponent(0)) : 1);
+    for (size_t c = 1; c < cc; c++)
+        if (ptrdiff_t(view.containerComponent(c)) - ptrdiff_t(view.containerComponent(c - 1)) != componentStride)
+            return nullptr;
+    DLPackExport* e = new DLPackExport;
+    e->container = view.container();
+    e->shape.resize(n + 1);
+    e->strides.resize(n + 1);
+    e->shape[n] = cc;
+    e->strides[n] = componentStride;
+    for (size_t d = 0; d < n; d++) {
+        e->shape[n - 1 - d] = view.dimension(d);
+        e->strides[n - 1 - d] = view.stride(d) / ptrdiff_t(view.componentSize());
+    }
+    const void* data = (view.elementCount() > 0 && cc > 0
+            ? view.get(std::vector<size_t>(n, 0), 0) : view.container().data());
+    return toDLPackHelper(e, data);
+}
+
+/*! \brief Returns an array that uses the data of the DLPack \a tensor.
+ *
+ * This is the inverse of \a toDLPack(): the axes (n-1, ..., 1, 0, c) of the tensor
+ * become the n dimensions and the components of the array. If \a lastAxisIsComponents
+ * is false, all axes become dimensions and the array has one component.
+ *
+ * The array takes ownership of the tensor and calls its deleter when the data is not
+ * referenced anymore. The data is not copied if the tensor is compact and row-major;
+ * otherwise, it is copied into a new array and the tensor is released immediately.
+ * If the tensor is not in CPU memory or its data type has no corresponding \a Type,
+ * an empty array is returned and the tensor remains owned by the caller. */
+inline ArrayContainer fromDLPack(DLManagedTensor* tensor, bool lastAxisIsComponents = true)
+{
+    Type type;
+    if (!tensor)
+        return ArrayContainer();
+    const DLTensor& t = tensor->dl_tensor;
+    const size_t dimAxes = (lastAxisIsComponents ? t.ndim - 1 : t.ndim);
+    if ((t.device.device_type != kDLCPU && t.device.device_type != kDLCUDAHost)
+            || t.ndim < (lastAxisIsComponents ? 2 : 1)
+            || !typeFromDLPack(t.dtype, &type))
+        return ArrayContainer();
+    for (int32_t i = 0; i < t.ndim; i++)
+        if (t.shape[i] < 0)
+            return ArrayContainer();
+
+    std::vector<size_t> dimensions(dimAxes);
+    for (size_t i = 0; i < dimAxes; i++)
+        dimensions[dimAxes - 1 - i] = t.shape[i];
+    ArrayDescription desc(dimensions, lastAxisIsComponents ? t.shape[t.ndim - 1] : 1, type);
+    unsigned char* data = static_cast<unsigned char*>(t.data) + t.byte_offset;
+    auto release = [tensor] (unsigned char*) {
+        if (tensor->deleter)
+            tensor->deleter(tensor);
+    };
+
+    // Strides of axes with size 1 do not matter
+    bool compact = true;
+    int64_t expectedStride = 1;
+    for (int32_t i = t.ndim - 1; i >= 0 && t.strides; i--) {
+        if (t.shape[i] != 1 && t.strides[i] != expectedStride)
+            compact = false;
+        expectedStride *= t.shape[i];
+    }
+    if (compact)
+        return ArrayContainer(desc, data, release);
+
+    ArrayContainer r(desc);
+    const size_t componentSize = r.componentSize();
+    unsigned char* dst = static_cast<unsigned char*>(r.data());
+    const size_t n = r.elementCount() * r.componentCount();
+    for (size_t i = 0; i < n; i++) {
+        ptrdiff_t offset = 0;
+        size_t rest = i;
+        for (int32_t a = t.ndim - 1; a >= 0; a--) {
+            offset += ptrdiff_t(rest % t.shape[a]) * t.strides[a];
+            rest /= t.shape[a];
+        }
+        std::memcpy(dst + i * componentSize, data + offset * ptrdiff_t(componentSize), componentSize);
+    }
+    release(data);
+    return r;
+}
+
+}
+
+#endif
@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TGD_DOWNSAMPLE_HPP
+#define TGD_DOWNSAMPLE_HPP
+
+/**
+ * \file downsample.hpp
+ * \brief Reduction of arrays to half their size, e.g. for image pyramids.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include "array.hpp"
+#include "parallel.hpp"
+
+namespace TGD {
+
+/*! \brief Filters for downsampling. */
+enum DownsamplingFilter
+{
+    BoxFilter = 0,      /**< \brief Average of 2 (1D), 2x2 (2D), or 2x2x2 (3D) elements */
+    LanczosFilter = 1   /**< \brief Lanczos filter with a=3: sharper than the box filter, but with some ringing */
+};
+
+/*! \cond */
+
+inline double lanczos3(double x)
+{
+    x = std::abs(x);
+    if (x < 1e-9)
+        return 1.0;
+    if (x >= 3.0)
+        return 0.0;
+    double px = 3.14159265358979323846 * x;
+    return 3.0 * std::sin(px) * std::sin(px / 3.0) / (px * px);
+}
+
+/* The source indices and weights that contribute to each output index when
+ * reducing a dimension of size n to (n + 1) / 2. Indices outside of the
+ * dimension are clamped to its edges, so the lowest and highest index of
+ * each output index never decrease. */
+class DownsamplingTaps
+{
+public:
+    std::vector<size_t> first; // taps of output i are [first[i], first[i + 1])
+    std::vector<size_t> index;
+    std::vector<float> weight;
+
+    DownsamplingTaps(size_t n, DownsamplingFilter filter)
+    {
+        size_t m = (n + 1) / 2;
+        first.push_back(0);
+        for (size_t i = 0; i < m; i++) {
+            if (filter == BoxFilter) {
+                add(2 * i, 1.0);
+                if (2 * i + 1 < n)
+                    add(2 * i + 1, 1.0);
+            } else {
+                // the output element covers source elements 2i and 2i+1, so
+                // its center is at 2i+0.5, and the filter is twice as wide
+                double center = 2 * i + 0.5;
+                long long kMin = std::floor(center - 6.0) + 1;
+                long long kMax = std::ceil(center + 6.0) - 1;
+                for (long long k = kMin; k <= kMax; k++) {
+                    size_t kk = std::min(std::max(k, 0LL), static_cast<long long>(n) - 1);
+                    add(kk, lanczos3((k - center) / 2.0));
+                }
+            }
+            float sum = 0.0f;
+            for (size_t t = first.back(); t < index.size(); t++)
+                sum += weight[t];
+            for (size_t t = first.back(); t < index.size(); t++)
+                weight[t] /= sum;
+            first.push_back(index.size());
+        }
+    }
+
+    void add(size_t k, double w)
+    {
+        if (index.size() > first.back() && index.back() == k) {
+            weight.back() += w;
+        } else {
+            index.push_back(k);
+            weight.push_back(w);
+        }
+    }
+
+    size_t size() const
+    {
+        return first.size() - 1;
+    }
+
+    size_t lowestIndex(size_t i) const
+    {
+        return index[first[i]];
+    }
+
+    size_t highestIndex(size_t i) const
+    {
+        return index[first[i + 1] - 1];
+    }
+};
+
+/* Reduce along one dimension: the source consists of outer blocks of n rows with
+ * inner values each, and the destination has taps.size() rows per block instead. */
+template<typename A>
+inline void downsampleAlong(ExecutionPolicy policy, const A* src, A* dst,
+        size_t inner, size_t n, size_t outer, const DownsamplingTaps& taps)
+{
+    size_t m = taps.size();
+    parallelFor(policy, outer * m * inner, inner, [=, &taps] (size_t begin, size_t end) {
+            for (size_t r = begin / inner; r < end / inner; r++) {
+                size_t o = r / m;
+                size_t i = r % m;
+                A* d = dst + r * inner;
+                for (size_t j = 0; j < inner; j++)
+                    d[j] = A(0);
+                for (size_t t = taps.first[i]; t < taps.first[i + 1]; t++) {
+                    const A* s = src + (o * n + taps.index[t]) * inner;
+                    A w = taps.weight[t];
+                    forRange(policy, 0, inner, [=] (size_t j) { d[j] += w * s[j]; });
+                }
+            }
+        });
+}
+
+template<typename T, typename A>
+inline void downsampleStoreHelper(ExecutionPolicy policy, T* dst, const A* src, size_t n)
+{
+    parallelFor(policy, n, 1024, [=] (size_t begin, size_t end) {
+            forRange(policy, begin, end, [=] (size_t i) {
+                    if constexpr (std::is_integral<T>::value)
+                        dst[i] = convertComponent<T>(std::round(src[i]));
+                    else
+                        dst[i] = src[i];
+                });
+        });
+}
+
+template<typename A>
+inline void downsampleStore(ExecutionPolicy policy, void* dst, Type type, const A* src, size_t n)
+{
+    visitType(type, [=] (auto tag) {
+            typedef typename decltype(tag)::type T;
+            downsampleStoreHelper(policy, static_cast<T*>(dst), src, n);
+        });
+}
+
+/* The work of the Downsampler, with values of type A during filtering */
+template<typename A>
+class DownsamplerHelper
+{
+public:
+    ArrayDescription source;
+    size_t reducedDimensions;
+    bool lastReduced;                       // whether the last dimension is reduced
+    std::vector<DownsamplingTaps> taps;     // per reduced dimension
+    ArrayContainer result;
+    size_t sourceSliceComponents;           // components per slice of the source
+    size_t resultSliceComponents;           // components per slice of the result
+    size_t resultSliceSize;                 // bytes per slice of the result
+    size_t slicesAdded;
+    size_t slicesWritten;                   // slices of the result
+    std::map<size_t, std::vector<A>> window; // reduced source slices that are still needed
+    std::vector<A> buffer0, buffer1;
+
+    DownsamplerHelper(const ArrayDescription& desc, size_t dims, DownsamplingFilter filter) :
+        source(desc), reducedDimensions(dims), lastReduced(dims == desc.dimensionCount()),
+        slicesAdded(0), slicesWritten(0)
+    {
+        std::vector<size_t> resultDims = desc.dimensions();
+        for (size_t d = 0; d < dims; d++) {
+            taps.push_back(DownsamplingTaps(desc.dimension(d), filter));
+            resultDims[d] = taps[d].size();
+        }
+        ArrayDescription resultDesc(resultDims, desc.componentCount(), desc.componentType());
+        resultDesc.globalTagList() = desc.globalTagList();
+        for (size_t d = 0; d < desc.dimensionCount(); d++)
+            resultDesc.dimensionTagList(d) = desc.dimensionTagList(d);
+        for (size_t c = 0; c < desc.componentCount(); c++)
+            resultDesc.componentTagList(c) = desc.componentTagList(c);
+        result = ArrayContainer(resultDesc);
+        size_t lastDim = desc.dimensionCount() - 1;
+        sourceSliceComponents = desc.elementCount() / desc.dimension(lastDim) * desc.componentCount();
+        resultSliceComponents = result.elementCount() / result.dimension(lastDim) * desc.componentCount();
+        resultSliceSize = result.dataSize() / result.dimension(lastDim);
+    }
+
+    size_t sliceCount() const
+    {
+        return source.dimension(source.dimensionCount() - 1);
+    }
+
+    // chunks of a few million components keep the temporary data small
+    void addSlices(ExecutionPolicy policy, const void* data, size_t n)
+    {
+        size_t chunkSlices = std::max(size_t(1), (size_t(1) << 24) / sourceSliceComponents);
+        size_t sourceSliceSize = sourceSliceComponents * typeSize(source.componentType());
+        for (size_t s = 0; s < n; s += chunkSlices) {
+            addChunk(policy, static_cast<const unsigned char*>(data) + s * sourceSliceSize,
+                    std::min(chunkSlices, n - s));
+        }
+    }
+
+    void addChunk(ExecutionPolicy policy, const void* data, size_t n)
+    {
+        const Type accType = (sizeof(A) == sizeof(float) ? float32 : float64);
+        // reduce the dimensions of the slices, for all slices at once
+        buffer0.resize(n * sourceSliceComponents);
+        convertComponents(buffer0.data(), accType, data, source.componentType(), buffer0.size());
+        size_t sliceDimensions = source.dimensionCount() - 1;
+        std::vector<size_t> shape = source.dimensions();
+        shape.back() = n;
+        size_t inner = source.componentCount();
+        for (size_t d = 0; d < std::min(reducedDimensions, sliceDimensions); d++) {
+            size_t outer = 1;
+            for (size_t e = d + 1; e < shape.size(); e++)
+                outer *= shape[e];
+            buffer1.resize(inner * taps[d].size() * outer);
+            downsampleAlong(policy, buffer0.data(), buffer1.data(), inner, shape[d], outer, taps[d]);
+            std::swap(buffer0, buffer1);
+            shape[d] = taps[d].size();
+            inner *= shape[d];
+        }
+        // buffer0 now contains n reduced slices
+        for (size_t s = 0; s < n; s++) {
+            const A* slice = buffer0.data() + s * resultSliceComponents;
+            if (!lastReduced) {
+                downsampleStore(policy, static_cast<unsigned char*>(result.data()) + (slicesAdded + s) * resultSliceSize,
+                        result.componentType(), slice, resultSliceComponents);
+                slicesWritten++;
+            } else {
+                window[slicesAdded + s].assign(slice, slice + resultSliceComponents);
+                reduceWindow(policy, slicesAdded + s);
+            }
+        }
+        slicesAdded += n;
+    }
+
+    // Compute all result slices whose source slices up to the given one are available
+    void reduceWindow(ExecutionPolicy policy, size_t lastAvailable)
+    {
+        const DownsamplingTaps& lastTaps = taps.back();
+        while (slicesWritten < lastTaps.size() && lastTaps.highestIndex(slicesWritten) <= lastAvailable) {
+            size_t i = slicesWritten;
+            buffer1.resize(resultSliceComponents);
+            A* d = buffer1.data();
+            size_t n = resultSliceComponents;
+            parallelFor(policy, n, 1024, [&] (size_t begin, size_t end) {
+                    for (size_t j = begin; j < end; j++)
+                        d[j] = A(0);
+                    for (size_t t = lastTaps.first[i]; t < lastTaps.first[i + 1]; t++) {
+                        const A* s = window.at(lastTaps.index[t]).data();
+                        A w = lastTaps.weight[t];
+                        forRange(policy, begin, end, [=] (size_t j) { d[j] += w * s[j]; });
+                    }
+                });
+            downsampleStore(policy, static_cast<unsigned char*>(result.data()) + i * resultSliceSize,
+                    result.componentType(), d, n);
+            slicesWritten++;
+            size_t lowestNeeded = (slicesWritten < lastTaps.size() ? lastTaps.lowestIndex(slicesWritten) : lastAvailable + 1);
+            window.erase(window.begin(), window.lower_bound(lowestNeeded));
+        }
+    }
+};
+
+/*! \endcond */
+
+/*! \brief Reduces arrays to half their size in the first dimensions, slab by slab.
+ *
+ * The reduced dimensions of size n get the size (n + 1) / 2. The source array is
+ * given in slabs along its last dimension (see \a Importer::beginArray()), so that
+ * arrays larger than the available memory can be reduced: only the result and
+ * the few slices required by the filter are kept. All values are filtered in
+ * single precision, or in double precision for types with more than 16 bits, and
+ * values of integer types are rounded and clamped to the range of the type.
+ *
+ * Example:
+ * \code
+ * TGD::Downsampler downsampler(importer.beginArray(), 2, TGD::BoxFilter);
+ * while (importer.remainingSlices() > 0)
+ *     downsampler.addSlab(importer.readSlab(64));
+ * TGD::ArrayContainer halfSize = downsampler.result();
+ * \endcode
+ */
+class Downsampler
+{
+private:
+    std::shared_ptr<DownsamplerHelper<float>> _helperFloat;
+    std::shared_ptr<DownsamplerHelper<double>> _helperDouble;
+
+public:
+    /*! \brief Constructor for the array described by \a desc, reducing \a dims of its first dimensions
+     * (at least one, at most all) with the given \a filter. */
+    Downsampler(const ArrayDescription& desc, size_t dims, DownsamplingFilter filter = BoxFilter)
+    {
+        Type t = desc.componentType();
+        if (t == int32 || t == uint32 || t == int64 || t == uint64 || t == float64)
+            _helperDouble = std::make_shared<DownsamplerHelper<double>>(desc, dims, filter);
+        else
+            _helperFloat = std::make_shared<DownsamplerHelper<float>>(desc, dims, filter);
+    }
+
+    /*! \brief Adds the next \a sliceCount slices of the source array, whose data is given by \a data. */
+    void addSlices(ExecutionPolicy policy, const void* data, size_t sliceCount)
+    {
+        if (_helperFloat)
+            _helperFloat->addSlices(policy, data, sliceCount);
+        else
+            _helperDouble->addSlices(policy, data, sliceCount);
+    }
+
+    /*! \brief Adds the next slab of the source array. It must have the dimensions, component
+     * count and component type of the source array, except for the last dimension. */
+    void addSlab(ExecutionPolicy policy, const ArrayContainer& slab)
+    {
+        addSlices(policy, slab.data(), slab.dimension(slab.dimensionCount() - 1));
+    }
+
+    /*! \brief Adds the next slab of the source array, see \a addSlab(ExecutionPolicy, const ArrayContainer&). */
+    void addSlab(const ArrayContainer& slab)
+    {
+        addSlab(defaultExecutionPolicy(), slab);
+    }
+
+    /*! \brief Returns the number of slices of the source array that were not added yet. */
+    size_t remainingSlices() const
+    {
+        return (_helperFloat ? _helperFloat->sliceCount() - _helperFloat->slicesAdded
+                : _helperDouble->sliceCount() - _helperDouble->slicesAdded);
+    }
+
+    /*! \brief Returns the reduced array. It is complete when all slices were added, and
+     * has the tags of the source array. */
+    const ArrayContainer& result() const
+    {
+        return (_helperFloat ? _helperFloat->result : _helperDouble->result);
+    }
+};
+
+/*! \brief Returns the array \a a reduced to half its size in its first \a dims dimensions with the
+ * given \a filter, see \a Downsampler. */
+inline ArrayContainer downsample(ExecutionPolicy policy, const ArrayContainer& a, size_t dims,
+        DownsamplingFilter filter = BoxFilter)
+{
+    Downsampler downsampler(a, dims, filter);
+    downsampler.addSlab(policy, a);
+    return downsampler.result();
+}
+
+/*! \brief Returns the array \a a reduced to half its size in its first \a dims dimensions, see
+ * \a downsample(ExecutionPolicy, const ArrayContainer&, size_t, DownsamplingFilter). */
+inline ArrayContainer downsample(const ArrayContainer& a, size_t dims, DownsamplingFilter filter = BoxFilter)
+{
+    return downsample(defaultExecutionPolicy(), a, dims, filter);
+}
+
+}
+
+#endif
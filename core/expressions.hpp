@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2018, 2019, 2020, 2021, 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TGD_EXPRESSIONS_HPP
+#define TGD_EXPRESSIONS_HPP
+
+/**
+ * \file expressions.hpp
+ * \brief Lazy evaluation of arithmetic on arrays.
+ *
+ * The operators in operators.hpp evaluate each operation immediately, so that
+ * an expression like a * b + c creates a temporary array for a * b. With
+ * this header, wrapping an operand with \a TGD::lazy() makes the operators
+ * return expression objects instead. These are evaluated in a single pass
+ * over the data, without temporaries, when the expression is assigned to an
+ * \a TGD::Array:
+ * \code
+ * TGD::Array<float> r = TGD::lazy(a) * b + c;
+ * \endcode
+ * Arrays and expressions hold shared references to the array data, so
+ * expressions stay valid even when the arrays they refer to go out of scope.
+ */
+
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+#include "array.hpp"
+#include "parallel.hpp"
+
+namespace TGD {
+
+/*! \brief Base class of all expression objects. \a E is the derived class, \a T the component type. */
+template<typename T, typename E>
+class Expression
+{
+public:
+    /*! \brief Returns the derived expression object. */
+    const E& self() const
+    {
+        return static_cast<const E&>(*this);
+    }
+
+    /*! \brief Evaluates the expression using the execution \a policy. */
+    Array<T> evaluate(ExecutionPolicy policy) const
+    {
+        const E& e = self();
+        Array<T> r(e.description());
+        T* pr = static_cast<T*>(r.data());
+        parallelForStatic(policy, r.elementCount() * r.componentCount(), 64 / sizeof(T),
+                [&] (size_t begin, size_t end) {
+                    forRange(policy, begin, end, [&] (size_t i) { pr[i] = e[i]; });
+                });
+        return r;
+    }
+
+    /*! \brief Evaluates the expression using the default execution policy. */
+    Array<T> evaluate() const
+    {
+        return evaluate(defaultExecutionPolicy());
+    }
+
+    /*! \brief Evaluates the expression using the default execution policy. */
+    operator Array<T>() const
+    {
+        return evaluate();
+    }
+};
+
+/*! \brief An expression that refers to the data of an array. */
+template<typename T>
+class ArrayExpression : public Expression<T, ArrayExpression<T>>
+{
+private:
+    Array<T> _array;
+    const T* _data;
+
+public:
+    /*! \cond */
+    static constexpr bool hasDescription = true;
+    /*! \endcond */
+
+    /*! \brief Constructor. */
+    explicit ArrayExpression(const Array<T>& array) :
+        _array(array), _data(static_cast<const T*>(array.data()))
+    {
+    }
+
+    /*! \brief Returns the description of the result. */
+    const ArrayDescription& description() const
+    {
+        return _array.description();
+    }
+
+    /*! \brief Returns component \a i of the result. */
+    T operator[](size_t i) const
+    {
+        return _data[i];
+    }
+};
+
+/*! \brief An expression that represents the same value for all components. */
+template<typename T>
+class ScalarExpression : public Expression<T, ScalarExpression<T>>
+{
+private:
+    T _value;
+
+public:
+    /*! \cond */
+    static constexpr bool hasDescription = false;
+    /*! \endcond */
+
+    /*! \brief Constructor. */
+    explicit ScalarExpression(T value) : _value(value)
+    {
+    }
+
+    /*! \brief Returns component \a i of the result. */
+    T operator[](size_t) const
+    {
+        return _value;
+    }
+};
+
+/*! \brief An expression that applies an operation to one operand. */
+template<typename T, typename OP, typename A>
+class UnaryExpression : public Expression<T, UnaryExpression<T, OP, A>>
+{
+private:
+    A _a;
+
+public:
+    /*! \cond */
+    static constexpr bool hasDescription = A::hasDescription;
+    /*! \endcond */
+
+    /*! \brief Constructor. */
+    explicit UnaryExpression(const A& a) : _a(a)
+    {
+    }
+
+    /*! \brief Returns the description of the result. */
+    const ArrayDescription& description() const
+    {
+        return _a.description();
+    }
+
+    /*! \brief Returns component \a i of the result. */
+    T operator[](size_t i) const
+    {
+        return OP::apply(_a[i]);
+    }
+};
+
+/*! \brief An expression that applies an operation to two operands. */
+template<typename T, typename OP, typename A, typename B>
+class BinaryExpression : public Expression<T, BinaryExpression<T, OP, A, B>>
+{
+private:
+    A _a;
+    B _b;
+
+public:
+    /*! \cond */
+    static constexpr bool hasDescription = (A::hasDescription || B::hasDescription);
+    /*! \endcond */
+
+    /*! \brief Constructor. */
+    BinaryExpression(const A& a, const B& b) : _a(a), _b(b)
+    {
+        if constexpr (A::hasDescription && B::hasDescription)
+            assert(a.description().isCompatible(b.description()));
+    }
+
+    /*! \brief Returns the description of the result. */
+    const ArrayDescription& description() const
+    {
+        if constexpr (A::hasDescription)
+            return _a.description();
+        else
+            return _b.description();
+    }
+
+    /*! \brief Returns component \a i of the result. */
+    T operator[](size_t i) const
+    {
+        return OP::apply(_a[i], _b[i]);
+    }
+};
+
+/*! \brief Start a lazily evaluated expression with array \a a. */
+template<typename T>
+ArrayExpression<T> lazy(const Array<T>& a)
+{
+    return ArrayExpression<T>(a);
+}
+
+/*! \cond */
+namespace ExpressionOperations {
+template<typename T> struct Negate { static T apply(T v) { return -v; } };
+template<typename T> struct Abs { static T apply(T v) { return std::abs(v); } };
+template<typename T> struct Add { static T apply(T u, T v) { return u + v; } };
+template<typename T> struct Subtract { static T apply(T u, T v) { return u - v; } };
+template<typename T> struct Multiply { static T apply(T u, T v) { return u * v; } };
+template<typename T> struct Divide { static T apply(T u, T v) { return u / v; } };
+template<typename T> struct Min { static T apply(T u, T v) { return std::min(u, v); } };
+template<typename T> struct Max { static T apply(T u, T v) { return std::max(u, v); } };
+}
+
+#define TGD_EXPRESSION_BINARY_FUNCTION(NAME, OP) \
+    template<typename T, typename A, typename B> \
+    BinaryExpression<T, ExpressionOperations::OP<T>, A, B> \
+    NAME(const Expression<T, A>& a, const Expression<T, B>& b) \
+    { \
+        return BinaryExpression<T, ExpressionOperations::OP<T>, A, B>(a.self(), b.self()); \
+    } \
+    template<typename T, typename A> \
+    BinaryExpression<T, ExpressionOperations::OP<T>, A, ArrayExpression<T>> \
+    NAME(const Expression<T, A>& a, const Array<T>& b) \
+    { \
+        return BinaryExpression<T, ExpressionOperations::OP<T>, A, ArrayExpression<T>>(a.self(), ArrayExpression<T>(b)); \
+    } \
+    template<typename T, typename B> \
+    BinaryExpression<T, ExpressionOperations::OP<T>, ArrayExpression<T>, B> \
+    NAME(const Array<T>& a, const Expression<T, B>& b) \
+    { \
+        return BinaryExpression<T, ExpressionOperations::OP<T>, ArrayExpression<T>, B>(ArrayExpression<T>(a), b.self()); \
+    } \
+    template<typename T, typename A> \
+    BinaryExpression<T, ExpressionOperations::OP<T>, A, ScalarExpression<T>> \
+    NAME(const Expression<T, A>& a, typename std::common_type<T>::type b) \
+    { \
+        return BinaryExpression<T, ExpressionOperations::OP<T>, A, ScalarExpression<T>>(a.self(), ScalarExpression<T>(b)); \
+    } \
+    template<typename T, typename B> \
+    BinaryExpression<T, ExpressionOperations::OP<T>, ScalarExpression<T>, B> \
+    NAME(typename std::common_type<T>::type a, const Expression<T, B>& b) \
+    { \
+        return BinaryExpression<T, ExpressionOperations::OP<T>, ScalarExpression<T>, B>(ScalarExpression<T>(a), b.self()); \
+    }
+
+TGD_EXPRESSION_BINARY_FUNCTION(operator+, Add)
+TGD_EXPRESSION_BINARY_FUNCTION(operator-, Subtract)
+TGD_EXPRESSION_BINARY_FUNCTION(operator*, Multiply)
+TGD_EXPRESSION_BINARY_FUNCTION(operator/, Divide)
+TGD_EXPRESSION_BINARY_FUNCTION(min, Min)
+TGD_EXPRESSION_BINARY_FUNCTION(max, Max)
+
+#undef TGD_EXPRESSION_BINARY_FUNCTION
+/*! \endcond */
+
+/*! \brief Lazily evaluated negation. */
+template<typename T, typename A>
+UnaryExpression<T, ExpressionOperations::Negate<T>, A> operator-(const Expression<T, A>& a)
+{
+    return UnaryExpression<T, ExpressionOperations::Negate<T>, A>(a.self());
+}
+
+/*! \brief Lazily evaluated absolute value. */
+template<typename T, typename A>
+UnaryExpression<T, ExpressionOperations::Abs<T>, A> abs(const Expression<T, A>& a)
+{
+    return UnaryExpression<T, ExpressionOperations::Abs<T>, A>(a.self());
+}
+
+}
+
+#endif
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2018, 2019, 2020, 2021, 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TGD_FLOAT16_HPP
+#define TGD_FLOAT16_HPP
+
+/**
+ * \file float16.hpp
+ * \brief Half precision floating point component types.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+namespace TGD {
+
+/*! \cond */
+inline uint32_t floatToBits(float f)
+{
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    return x;
+}
+
+inline float floatFromBits(uint32_t x)
+{
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+/*! \endcond */
+
+/*! \brief An IEEE 754 half precision floating point value (binary16).
+ *
+ * This is a storage type: it converts implicitly to and from float, and
+ * all computations are done in single precision. Conversion from float
+ * rounds to nearest even; values too large for half precision become infinity. */
+class Float16
+{
+private:
+    uint16_t _bits;
+
+public:
+    /*! \brief Converts a float to the bits of a half precision value. */
+    static uint16_t bitsFromFloat(float f)
+    {
+        const uint32_t f32infty = 255u << 23;
+        const uint32_t f16max = (127u + 16u) << 23;
+        const uint32_t denormMagic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+        uint32_t x = floatToBits(f);
+        uint32_t sign = x & 0x80000000u;
+        x ^= sign;
+        uint16_t h;
+        if (x >= f16max) {
+            // infinity, NaN, or too large
+            h = (x > f32infty ? 0x7e00 : 0x7c00);
+        } else if (x < (113u << 23)) {
+            // subnormal or zero: let the FPU do the rounding
+            h = uint16_t(floatToBits(floatFromBits(x) + floatFromBits(denormMagic)) - denormMagic);
+        } else {
+            uint32_t mantissaOdd = (x >> 13) & 1;
+            x += ((15u - 127u) << 23) + 0xfff;
+            x += mantissaOdd;
+            h = uint16_t(x >> 13);
+        }
+        return h | uint16_t(sign >> 16);
+    }
+
+    /*! \brief Converts the bits of a half precision value to a float. */
+    static float floatFromBits16(uint16_t h)
+    {
+        const uint32_t shiftedExp = 0x7c00u << 13;
+        uint32_t x = uint32_t(h & 0x7fffu) << 13;
+        uint32_t exp = shiftedExp & x;
+        x += (127u - 15u) << 23;
+        if (exp == shiftedExp) {
+            // infinity or NaN
+            x += (128u - 16u) << 23;
+        } else if (exp == 0) {
+            // zero or subnormal
+            x += 1u << 23;
+            x = floatToBits(floatFromBits(x) - floatFromBits(113u << 23));
+        }
+        x |= uint32_t(h & 0x8000u) << 16;
+        return floatFromBits(x);
+    }
+
+    /*! \brief Constructor for an uninitialized value. */
+    Float16() = default;
+    /*! \brief Constructor from a float. */
+    Float16(float f) : _bits(bitsFromFloat(f)) {}
+    /*! \brief Constructor from other arithmetic types, via float. */
+    template<typename T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+    Float16(T v) : Float16(float(v)) {}
+
+    /*! \brief Returns a value with the given \a bits. */
+    static Float16 fromBits(uint16_t bits) { Float16 h; h._bits = bits; return h; }
+    /*! \brief Returns the bits of this value. */
+    uint16_t bits() const { return _bits; }
+
+    /*! \brief Conversion to float. */
+    operator float() const { return floatFromBits16(_bits); }
+
+    /*! \cond */
+    Float16& operator+=(float v) { return *this = float(*this) + v; }
+    Float16& operator-=(float v) { return *this = float(*this) - v; }
+    Float16& operator*=(float v) { return *this = float(*this) * v; }
+    Float16& operator/=(float v) { return *this = float(*this) / v; }
+    /*! \endcond */
+};
+
+/*! \brief A bfloat16 floating point value, i.e. the upper half of an IEEE 754 single
+ * precision value, with the range of float but only 8 significant bits.
+ *
+ * Like \a Float16, this is a storage type that converts implicitly to and
+ * from float and rounds to nearest even. */
+class BFloat16
+{
+private:
+    uint16_t _bits;
+
+public:
+    /*! \brief Converts a float to the bits of a bfloat16 value. */
+    static uint16_t bitsFromFloat(float f)
+    {
+        uint32_t x = floatToBits(f);
+        if ((x & 0x7fffffffu) > 0x7f800000u)
+            return uint16_t((x >> 16) | 0x40u); // keep NaN a quiet NaN
+        x += 0x7fffu + ((x >> 16) & 1u);
+        return uint16_t(x >> 16);
+    }
+
+    /*! \brief Converts the bits of a bfloat16 value to a float. */
+    static float floatFromBits16(uint16_t b)
+    {
+        return floatFromBits(uint32_t(b) << 16);
+    }
+
+    /*! \brief Constructor for an uninitialized value. */
+    BFloat16() = default;
+    /*! \brief Constructor from a float. */
+    BFloat16(float f) : _bits(bitsFromFloat(f)) {}
+    /*! \brief Constructor from other arithmetic types, via float. */
+    template<typename T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+    BFloat16(T v) : BFloat16(float(v)) {}
+
+    /*! \brief Returns a value with the given \a bits. */
+    static BFloat16 fromBits(uint16_t bits) { BFloat16 b; b._bits = bits; return b; }
+    /*! \brief Returns the bits of this value. */
+    uint16_t bits() const { return _bits; }
+
+    /*! \brief Conversion to float. */
+    operator float() const { return floatFromBits16(_bits); }
+
+    /*! \cond */
+    BFloat16& operator+=(float v) { return *this = float(*this) + v; }
+    BFloat16& operator-=(float v) { return *this = float(*this) - v; }
+    BFloat16& operator*=(float v) { return *this = float(*this) * v; }
+    BFloat16& operator/=(float v) { return *this = float(*this) / v; }
+    /*! \endcond */
+};
+
+/*! \brief Whether \a T is one of the half precision storage types \a Float16 and \a BFloat16. */
+template<typename T> struct isHalfFloat : std::integral_constant<bool,
+    std::is_same<T, Float16>::value || std::is_same<T, BFloat16>::value> {};
+
+}
+
+/*! \cond */
+namespace std {
+
+template<> class numeric_limits<TGD::Float16>
+{
+public:
+    static constexpr bool is_specialized = true;
+    static constexpr bool is_signed = true;
+    static constexpr bool is_integer = false;
+    static constexpr bool is_exact = false;
+    static constexpr bool has_infinity = true;
+    static constexpr bool has_quiet_NaN = true;
+    static constexpr bool has_signaling_NaN = true;
+    static constexpr bool is_iec559 = true;
+    static constexpr bool is_bounded = true;
+    static constexpr bool is_modulo = false;
+    static constexpr int digits = 11;
+    static constexpr int digits10 = 3;
+    static constexpr int max_digits10 = 5;
+    static constexpr int radix = 2;
+    static constexpr int min_exponent = -13;
+    static constexpr int min_exponent10 = -4;
+    static constexpr int max_exponent = 16;
+    static constexpr int max_exponent10 = 4;
+    static TGD::Float16 min() noexcept { return TGD::Float16::fromBits(0x0400); }
+    static TGD::Float16 lowest() noexcept { return TGD::Float16::fromBits(0xfbff); }
+    static TGD::Float16 max() noexcept { return TGD::Float16::fromBits(0x7bff); }
+    static TGD::Float16 epsilon() noexcept { return TGD::Float16::fromBits(0x1400); }
+    static TGD::Float16 round_error() noexcept { return TGD::Float16::fromBits(0x3800); }
+    static TGD::Float16 infinity() noexcept { return TGD::Float16::fromBits(0x7c00); }
+    static TGD::Float16 quiet_NaN() noexcept { return TGD::Float16::fromBits(0x7e00); }
+    static TGD::Float16 signaling_NaN() noexcept { return TGD::Float16::fromBits(0x7d00); }
+    static TGD::Float16 denorm_min() noexcept { return TGD::Float16::fromBits(0x0001); }
+};
+
+template<> class numeric_limits<TGD::BFloat16>
+{
+public:
+    static constexpr bool is_specialized = true;
+    static constexpr bool is_signed = true;
+    static constexpr bool is_integer = false;
+    static constexpr bool is_exact = false;
+    static constexpr bool has_infinity = true;
+    static constexpr bool has_quiet_NaN = true;
+    static constexpr bool has_signaling_NaN = true;
+    static constexpr bool is_iec559 = false;
+    static constexpr bool is_bounded = true;
+    static constexpr bool is_modulo = false;
+    static constexpr int digits = 8;
+    static constexpr int digits10 = 2;
+    static constexpr int max_digits10 = 4;
+    static constexpr int radix = 2;
+    static constexpr int min_exponent = -125;
+    static constexpr int min_exponent10 = -37;
+    static constexpr int max_exponent = 128;
+    static constexpr int max_exponent10 = 38;
+    static TGD::BFloat16 min() noexcept { return TGD::BFloat16::fromBits(0x0080); }
+    static TGD::BFloat16 lowest() noexcept { return TGD::BFloat16::fromBits(0xff7f); }
+    static TGD::BFloat16 max() noexcept { return TGD::BFloat16::fromBits(0x7f7f); }
+    static TGD::BFloat16 epsilon() noexcept { return TGD::BFloat16::fromBits(0x3c00); }
+    static TGD::BFloat16 round_error() noexcept { return TGD::BFloat16::fromBits(0x3f00); }
+    static TGD::BFloat16 infinity() noexcept { return TGD::BFloat16::fromBits(0x7f80); }
+    static TGD::BFloat16 quiet_NaN() noexcept { return TGD::BFloat16::fromBits(0x7fc0); }
+    static TGD::BFloat16 signaling_NaN() noexcept { return TGD::BFloat16::fromBits(0x7fa0); }
+    static TGD::BFloat16 denorm_min() noexcept { return TGD::BFloat16::fromBits(0x0001); }
+};
+
+}
+/*! \endcond */
+
+#endif
@@ -30,142 +30,509 @@
  * \brief Apply functions to each component or element of an array.
  */
 
+#include <utility>
+
 #include "array.hpp"
+#include "parallel.hpp"
 
 namespace TGD {
 
-/*! \brief Apply \a func to all components in array \a a. */
+/*! \cond */
+template<typename T> inline constexpr size_t componentGranularity()
+{
+    // chunks of this many components start at cache line boundaries
+    return 64 / sizeof(T);
+}
+constexpr size_t elementGranularity = 64;
+/*! \endcond */
+
+/*! \brief Apply \a func to all components in array \a a using the execution \a policy. */
 template <typename T, typename FUNC>
-Array<T> forEachComponent(const Array<T>& a, FUNC func)
+Array<T> forEachComponent(ExecutionPolicy policy, const Array<T>& a, FUNC func)
 {
     ArrayDescription rd(a);
     Array<T> r(rd);
-    auto itr = r.componentBegin();
-    for (auto ita = a.constComponentBegin(); ita != a.constComponentEnd(); ++ita, ++itr)
-        *itr = func(*ita);
+    const T* pa = static_cast<const T*>(a.data());
+    T* pr = static_cast<T*>(r.data());
+    parallelForStatic(policy, a.elementCount() * a.componentCount(), componentGranularity<T>(),
+            [&] (size_t begin, size_t end) {
+                forRange(policy, begin, end, [&] (size_t i) { pr[i] = func(pa[i]); });
+            });
     return r;
 }
 
+/*! \brief Apply \a func to all components in array \a a. */
+template <typename T, typename FUNC>
+Array<T> forEachComponent(const Array<T>& a, FUNC func)
+{
+    return forEachComponent(defaultExecutionPolicy(), a, func);
+}
+
+/*! \brief Apply \a func to all components in array \a a, in place, using the execution \a policy. */
+template <typename T, typename FUNC>
+Array<T>& forEachComponentInplace(ExecutionPolicy policy, Array<T>& a, FUNC func)
+{
+    T* pa = static_cast<T*>(a.data());
+    parallelForStatic(policy, a.elementCount() * a.componentCount(), componentGranularity<T>(),
+            [&] (size_t begin, size_t end) {
+                forRange(policy, begin, end, [&] (size_t i) { pa[i] = func(pa[i]); });
+            });
+    return a;
+}
+
 /*! \brief Apply \a func to all components in array \a a, in place. */
 template <typename T, typename FUNC>
 Array<T>& forEachComponentInplace(Array<T>& a, FUNC func)
 {
-    for (auto ita = a.componentBegin(); ita != a.componentEnd(); ++ita)
-        *ita = func(*ita);
-    return a;
+    return forEachComponentInplace(defaultExecutionPolicy(), a, func);
 }
 
-/*! \brief Apply \a func to all components in array \a a using value \a b. */
+/*! \brief Apply \a func to all components in array \a a using value \a b and the execution \a policy. */
 template <typename T, typename FUNC>
-Array<T> forEachComponent(const Array<T>& a, T b, FUNC func)
+Array<T> forEachComponent(ExecutionPolicy policy, const Array<T>& a, T b, FUNC func)
 {
     ArrayDescription rd(a);
     Array<T> r(rd);
-    auto itr = r.componentBegin();
-    for (auto ita = a.constComponentBegin(); ita != a.constComponentEnd(); ++ita, ++itr)
-        *itr = func(*ita, b);
+    const T* pa = static_cast<const T*>(a.data());
+    T* pr = static_cast<T*>(r.data());
+    parallelForStatic(policy, a.elementCount() * a.componentCount(), componentGranularity<T>(),
+            [&] (size_t begin, size_t end) {
+                forRange(policy, begin, end, [&] (size_t i) { pr[i] = func(pa[i], b); });
+            });
     return r;
 }
 
+/*! \brief Apply \a func to all components in array \a a using value \a b. */
+template <typename T, typename FUNC>
+Array<T> forEachComponent(const Array<T>& a, T b, FUNC func)
+{
+    return forEachComponent(defaultExecutionPolicy(), a, b, func);
+}
+
+/*! \brief Apply \a func to all components in array \a a using value \a b, in place, using the execution \a policy. */
+template <typename T, typename FUNC>
+Array<T>& forEachComponentInplace(ExecutionPolicy policy, Array<T>& a, T b, FUNC func)
+{
+    T* pa = static_cast<T*>(a.data());
+    parallelForStatic(policy, a.elementCount() * a.componentCount(), componentGranularity<T>(),
+            [&] (size_t begin, size_t end) {
+                forRange(policy, begin, end, [&] (size_t i) { pa[i] = func(pa[i], b); });
+            });
+    return a;
+}
+
 /*! \brief Apply \a func to all components in array \a a using value \a b, in place. */
 template <typename T, typename FUNC>
 Array<T>& forEachComponentInplace(Array<T>& a, T b, FUNC func)
 {
-    for (auto ita = a.componentBegin(); ita != a.componentEnd(); ++ita)
-        *ita = func(*ita, b);
-    return a;
+    return forEachComponentInplace(defaultExecutionPolicy(), a, b, func);
 }
 
-/*! \brief Apply \a func to all components in arrays \a a and \a b. */
+/*! \brief Apply \a func to all components in arrays \a a and \a b using the execution \a policy. */
 template <typename T, typename FUNC>
-Array<T> forEachComponent(const Array<T>& a, const Array<T>& b, FUNC func)
+Array<T> forEachComponent(ExecutionPolicy policy, const Array<T>& a, const Array<T>& b, FUNC func)
 {
     assert(a.isCompatible(b));
     ArrayDescription rd(a);
     Array<T> r(rd);
-    auto itb = b.constComponentBegin();
-    auto itr = r.componentBegin();
-    for (auto ita = a.constComponentBegin(); ita != a.constComponentEnd(); ++ita, ++itb, ++itr)
-        *itr = func(*ita, *itb);
+    const T* pa = static_cast<const T*>(a.data());
+    const T* pb = static_cast<const T*>(b.data());
+    T* pr = static_cast<T*>(r.data());
+    parallelForStatic(policy, a.elementCount() * a.componentCount(), componentGranularity<T>(),
+            [&] (size_t begin, size_t end) {
+                forRange(policy, begin, end, [&] (size_t i) { pr[i] = func(pa[i], pb[i]); });
+            });
     return r;
 }
 
-/*! \brief Apply \a func to all components in arrays \a a and \a b, in place. */
+/*! \brief Apply \a func to all components in arrays \a a and \a b. */
 template <typename T, typename FUNC>
-Array<T>& forEachComponentInplace(Array<T>& a, const Array<T>& b, FUNC func)
+Array<T> forEachComponent(const Array<T>& a, const Array<T>& b, FUNC func)
+{
+    return forEachComponent(defaultExecutionPolicy(), a, b, func);
+}
+
+/*! \brief Apply \a func to all components in arrays \a a and \a b, in place, using the execution \a policy. */
+template <typename T, typename FUNC>
+Array<T>& forEachComponentInplace(ExecutionPolicy policy, Array<T>& a, const Array<T>& b, FUNC func)
 {
     assert(a.isCompatible(b));
-    auto itb = b.constComponentBegin();
-    for (auto ita = a.componentBegin(); ita != a.componentEnd(); ++ita, ++itb)
-        *ita = func(*ita, *itb);
+    T* pa = static_cast<T*>(a.data());
+    const T* pb = static_cast<const T*>(b.data());
+    parallelForStatic(policy, a.elementCount() * a.componentCount(), componentGranularity<T>(),
+            [&] (size_t begin, size_t end) {
+                forRange(policy, begin, end, [&] (size_t i) { pa[i] = func(pa[i], pb[i]); });
+            });
     return a;
 }
 
-/*! \brief Apply \a func to all elements in array \a a. */
+/*! \brief Apply \a func to all components in arrays \a a and \a b, in place. */
 template <typename T, typename FUNC>
-Array<T> forEachElement(const Array<T>& a, FUNC func)
+Array<T>& forEachComponentInplace(Array<T>& a, const Array<T>& b, FUNC func)
+{
+    return forEachComponentInplace(defaultExecutionPolicy(), a, b, func);
+}
+
+/*! \brief Apply \a func to all elements in array \a a using the execution \a policy. */
+template <typename T, typename FUNC>
+Array<T> forEachElement(ExecutionPolicy policy, const Array<T>& a, FUNC func)
 {
     ArrayDescription rd(a);
     Array<T> r(rd);
-    auto itr = r.elementBegin();
-    for (auto ita = a.constElementBegin(); ita != a.constElementEnd(); ++ita, ++itr)
-        func(*itr, *ita);
+    const T* pa = static_cast<const T*>(a.data());
+    T* pr = static_cast<T*>(r.data());
+    size_t cc = a.componentCount();
+    parallelForStatic(policy, a.elementCount(), elementGranularity,
+            [&] (size_t begin, size_t end) {
+                forRange(policy, begin, end, [&] (size_t e) { func(pr + e * cc, pa + e * cc); });
+            });
     return r;
 }
 
+/*! \brief Apply \a func to all elements in array \a a. */
+template <typename T, typename FUNC>
+Array<T> forEachElement(const Array<T>& a, FUNC func)
+{
+    return forEachElement(defaultExecutionPolicy(), a, func);
+}
+
+/*! \brief Apply \a func to all elements in array \a a, in place, using the execution \a policy. */
+template <typename T, typename FUNC>
+Array<T>& forEachElementInplace(ExecutionPolicy policy, Array<T>& a, FUNC func)
+{
+    T* pa = static_cast<T*>(a.data());
+    size_t cc = a.componentCount();
+    parallelForStatic(policy, a.elementCount(), elementGranularity,
+            [&] (size_t begin, size_t end) {
+                forRange(policy, begin, end, [&] (size_t e) { func(pa + e * cc); });
+            });
+    return a;
+}
+
 /*! \brief Apply \a func to all elements in array \a a, in place. */
 template <typename T, typename FUNC>
 Array<T>& forEachElementInplace(Array<T>& a, FUNC func)
 {
-    for (auto ita = a.elementBegin(); ita != a.elementEnd(); ++ita)
-        func(*ita);
-    return a;
+    return forEachElementInplace(defaultExecutionPolicy(), a, func);
 }
 
-/*! \brief Apply \a func to all elements in array \a a using element \a b. */
+/*! \brief Apply \a func to all elements in array \a a using element \a b and the execution \a policy. */
 template <typename T, typename FUNC>
-Array<T> forEachElement(const Array<T>& a, const T* b, FUNC func)
+Array<T> forEachElement(ExecutionPolicy policy, const Array<T>& a, const T* b, FUNC func)
 {
     ArrayDescription rd(a);
     Array<T> r(rd);
-    auto itr = r.elementBegin();
-    for (auto ita = a.constElementBegin(); ita != a.constElementEnd(); ++ita, ++itr)
-        func(*itr, *ita, b);
+    const T* pa = static_cast<const T*>(a.data());
+    T* pr = static_cast<T*>(r.data());
+    size_t cc = a.componentCount();
+    parallelForStatic(policy, a.elementCount(), elementGranularity,
+            [&] (size_t begin, size_t end) {
+                forRange(policy, begin, end, [&] (size_t e) { func(pr + e * cc, pa + e * cc, b); });
+            });
     return r;
 }
 
+/*! \brief Apply \a func to all elements in array \a a using element \a b. */
+template <typename T, typename FUNC>
+Array<T> forEachElement(const Array<T>& a, const T* b, FUNC func)
+{
+    return forEachElement(defaultExecutionPolicy(), a, b, func);
+}
+
+/*! \brief Apply \a func to all elements in array \a a using element \a b, in place, using the execution \a policy. */
+template <typename T, typename FUNC>
+Array<T>& forEachElementInplace(ExecutionPolicy policy, Array<T>& a, const T* b, FUNC func)
+{
+    T* pa = static_cast<T*>(a.data());
+    size_t cc = a.componentCount();
+    parallelForStatic(policy, a.elementCount(), elementGranularity,
+            [&] (size_t begin, size_t end) {
+                forRange(policy, begin, end, [&] (size_t e) { func(pa + e * cc, b); });
+            });
+    return a;
+}
+
 /*! \brief Apply \a func to all elements in array \a a using element \a b, in place. */
 template <typename T, typename FUNC>
 Array<T>& forEachElementInplace(Array<T>& a, const T* b, FUNC func)
 {
-    for (auto ita = a.elementBegin(); ita != a.elementEnd(); ++ita)
-        func(*ita, b);
-    return a;
+    return forEachElementInplace(defaultExecutionPolicy(), a, b, func);
 }
 
-/*! \brief Apply \a func to all elements in arrays \a a and \a b. */
+/*! \brief Apply \a func to all elements in arrays \a a and \a b using the execution \a policy. */
 template <typename T, typename FUNC>
-Array<T> forEachElement(const Array<T>& a, const Array<T>& b, FUNC func)
+Array<T> forEachElement(ExecutionPolicy policy, const Array<T>& a, const Array<T>& b, FUNC func)
 {
     assert(a.isCompatible(b));
     ArrayDescription rd(a);
     Array<T> r(rd);
-    auto itb = b.constElementBegin();
-    auto itr = r.elementBegin();
-    for (auto ita = a.constElementBegin(); ita != a.constElementEnd(); ++ita, ++itb, ++itr)
-        func(*itr, *ita, *itb);
+    const T* pa = static_cast<const T*>(a.data());
+    const T* pb = static_cast<const T*>(b.data());
+    T* pr = static_cast<T*>(r.data());
+    size_t cc = a.componentCount();
+    parallelForStatic(policy, a.elementCount(), elementGranularity,
+            [&] (size_t begin, size_t end) {
+                forRange(policy, begin, end, [&] (size_t e) { func(pr + e * cc, pa + e * cc, pb + e * cc); });
+            });
     return r;
 }
 
+/*! \brief Apply \a func to all elements in arrays \a a and \a b. */
+template <typename T, typename FUNC>
+Array<T> forEachElement(const Array<T>& a, const Array<T>& b, FUNC func)
+{
+    return forEachElement(defaultExecutionPolicy(), a, b, func);
+}
+
+/*! \brief Apply \a func to all elements in arrays \a a and \a b, in place, using the execution \a policy. */
+template <typename T, typename FUNC>
+Array<T>& forEachElementInplace(ExecutionPolicy policy, Array<T>& a, const Array<T>& b, FUNC func)
+{
+    assert(a.isCompatible(b));
+    T* pa = static_cast<T*>(a.data());
+    const T* pb = static_cast<const T*>(b.data());
+    size_t cc = a.componentCount();
+    parallelForStatic(policy, a.elementCount(), elementGranularity,
+            [&] (size_t begin, size_t end) {
+                forRange(policy, begin, end, [&] (size_t e) { func(pa + e * cc, pb + e * cc); });
+            });
+    return a;
+}
+
 /*! \brief Apply \a func to all elements in arrays \a a and \a b, in place. */
 template <typename T, typename FUNC>
 Array<T>& forEachElementInplace(Array<T>& a, const Array<T>& b, FUNC func)
 {
+    return forEachElementInplace(defaultExecutionPolicy(), a, b, func);
+}
+
+/* The following overloads take temporaries; they reuse the data of a temporary
+ * for the result if no other array shares it and it is not external data, and
+ * avoid an allocation that way. */
+
+/*! \cond */
+inline bool isReusable(const ArrayContainer& a)
+{
+    return a.isUnique() && a.ownsData();
+}
+/*! \endcond */
+
+/*! \brief Apply \a func to all components in temporary array \a a using the execution \a policy. */
+template <typename T, typename FUNC>
+Array<T> forEachComponent(ExecutionPolicy policy, Array<T>&& a, FUNC func)
+{
+    if (!isReusable(a))
+        return forEachComponent(policy, static_cast<const Array<T>&>(a), func);
+    forEachComponentInplace(policy, a, func);
+    return std::move(a);
+}
+
+/*! \brief Apply \a func to all components in temporary array \a a. */
+template <typename T, typename FUNC>
+Array<T> forEachComponent(Array<T>&& a, FUNC func)
+{
+    return forEachComponent(defaultExecutionPolicy(), std::move(a), func);
+}
+
+/*! \brief Apply \a func to all components in temporary array \a a using value \a b and the execution \a policy. */
+template <typename T, typename FUNC>
+Array<T> forEachComponent(ExecutionPolicy policy, Array<T>&& a, T b, FUNC func)
+{
+    if (!isReusable(a))
+        return forEachComponent(policy, static_cast<const Array<T>&>(a), b, func);
+    forEachComponentInplace(policy, a, b, func);
+    return std::move(a);
+}
+
+/*! \brief Apply \a func to all components in temporary array \a a using value \a b. */
+template <typename T, typename FUNC>
+Array<T> forEachComponent(Array<T>&& a, T b, FUNC func)
+{
+    return forEachComponent(defaultExecutionPolicy(), std::move(a), b, func);
+}
+
+/*! \brief Apply \a func to all components in temporary array \a a and array \a b using the execution \a policy. */
+template <typename T, typename FUNC>
+Array<T> forEachComponent(ExecutionPolicy policy, Array<T>&& a, const Array<T>& b, FUNC func)
+{
+    if (!isReusable(a))
+        return forEachComponent(policy, static_cast<const Array<T>&>(a), b, func);
+    forEachComponentInplace(policy, a, b, func);
+    return std::move(a);
+}
+
+/*! \brief Apply \a func to all components in temporary array \a a and array \a b. */
+template <typename T, typename FUNC>
+Array<T> forEachComponent(Array<T>&& a, const Array<T>& b, FUNC func)
+{
+    return forEachComponent(defaultExecutionPolicy(), std::move(a), b, func);
+}
+
+/*! \brief Apply \a func to all components in array \a a and temporary array \a b using the execution \a policy. */
+template <typename T, typename FUNC>
+Array<T> forEachComponent(ExecutionPolicy policy, const Array<T>& a, Array<T>&& b, FUNC func)
+{
+    if (!isReusable(b) || a.dimensions() != b.dimensions())
+        return forEachComponent(policy, a, static_cast<const Array<T>&>(b), func);
     assert(a.isCompatible(b));
-    auto itb = b.constElementBegin();
-    for (auto ita = a.elementBegin(); ita != a.elementEnd(); ++ita, ++itb)
-        func(*ita, *itb);
-    return a;
+    const T* pa = static_cast<const T*>(a.data());
+    T* pb = static_cast<T*>(b.data());
+    parallelForStatic(policy, a.elementCount() * a.componentCount(), componentGranularity<T>(),
+            [&] (size_t begin, size_t end) {
+                forRange(policy, begin, end, [&] (size_t i) { pb[i] = func(pa[i], pb[i]); });
+            });
+    // the result has the description of a, including its tags
+    static_cast<ArrayDescription&>(b) = a.description();
+    return std::move(b);
+}
+
+/*! \brief Apply \a func to all components in array \a a and temporary array \a b. */
+template <typename T, typename FUNC>
+Array<T> forEachComponent(const Array<T>& a, Array<T>&& b, FUNC func)
+{
+    return forEachComponent(defaultExecutionPolicy(), a, std::move(b), func);
+}
+
+/*! \brief Apply \a func to all components in temporary arrays \a a and \a b using the execution \a policy. */
+template <typename T, typename FUNC>
+Array<T> forEachComponent(ExecutionPolicy policy, Array<T>&& a, Array<T>&& b, FUNC func)
+{
+    if (isReusable(a))
+        return forEachComponent(policy, std::move(a), static_cast<const Array<T>&>(b), func);
+    else
+        return forEachComponent(policy, static_cast<const Array<T>&>(a), std::move(b), func);
+}
+
+/*! \brief Apply \a func to all components in temporary arrays \a a and \a b. */
+template <typename T, typename FUNC>
+Array<T> forEachComponent(Array<T>&& a, Array<T>&& b, FUNC func)
+{
+    return forEachComponent(defaultExecutionPolicy(), std::move(a), std::move(b), func);
+}
+
+/*! \brief Apply \a func to all elements in temporary array \a a using the execution \a policy.
+ * Since \a func may read and write different components of an element, it
+ * receives a copy of the source element. */
+template <typename T, typename FUNC>
+Array<T> forEachElement(ExecutionPolicy policy, Array<T>&& a, FUNC func)
+{
+    if (!isReusable(a))
+        return forEachElement(policy, static_cast<const Array<T>&>(a), func);
+    T* pa = static_cast<T*>(a.data());
+    size_t cc = a.componentCount();
+    parallelForStatic(policy, a.elementCount(), elementGranularity,
+            [&] (size_t begin, size_t end) {
+                std::vector<T> element(cc);
+                for (size_t e = begin; e < end; e++) {
+                    std::copy(pa + e * cc, pa + (e + 1) * cc, element.begin());
+                    func(pa + e * cc, static_cast<const T*>(element.data()));
+                }
+            });
+    return std::move(a);
+}
+
+/*! \brief Apply \a func to all elements in temporary array \a a. */
+template <typename T, typename FUNC>
+Array<T> forEachElement(Array<T>&& a, FUNC func)
+{
+    return forEachElement(defaultExecutionPolicy(), std::move(a), func);
+}
+
+/*! \brief Apply \a func to all elements in temporary array \a a using element \a b and the execution \a policy.
+ * See the corresponding function without \a b. */
+template <typename T, typename FUNC>
+Array<T> forEachElement(ExecutionPolicy policy, Array<T>&& a, const T* b, FUNC func)
+{
+    if (!isReusable(a))
+        return forEachElement(policy, static_cast<const Array<T>&>(a), b, func);
+    T* pa = static_cast<T*>(a.data());
+    size_t cc = a.componentCount();
+    parallelForStatic(policy, a.elementCount(), elementGranularity,
+            [&] (size_t begin, size_t end) {
+                std::vector<T> element(cc);
+                for (size_t e = begin; e < end; e++) {
+                    std::copy(pa + e * cc, pa + (e + 1) * cc, element.begin());
+                    func(pa + e * cc, static_cast<const T*>(element.data()), b);
+                }
+            });
+    return std::move(a);
+}
+
+/*! \brief Apply \a func to all elements in temporary array \a a using element \a b. */
+template <typename T, typename FUNC>
+Array<T> forEachElement(Array<T>&& a, const T* b, FUNC func)
+{
+    return forEachElement(defaultExecutionPolicy(), std::move(a), b, func);
+}
+
+/*! \brief Apply \a func to all elements in temporary array \a a and array \a b using the execution \a policy.
+ * See the corresponding function without \a b. */
+template <typename T, typename FUNC>
+Array<T> forEachElement(ExecutionPolicy policy, Array<T>&& a, const Array<T>& b, FUNC func)
+{
+    if (!isReusable(a))
+        return forEachElement(policy, static_cast<const Array<T>&>(a), b, func);
+    assert(a.isCompatible(b));
+    T* pa = static_cast<T*>(a.data());
+    const T* pb = static_cast<const T*>(b.data());
+    size_t cc = a.componentCount();
+    parallelForStatic(policy, a.elementCount(), elementGranularity,
+            [&] (size_t begin, size_t end) {
+                std::vector<T> element(cc);
+                for (size_t e = begin; e < end; e++) {
+                    std::copy(pa + e * cc, pa + (e + 1) * cc, element.begin());
+                    func(pa + e * cc, static_cast<const T*>(element.data()), pb + e * cc);
+                }
+            });
+    return std::move(a);
+}
+
+/*! \brief Apply \a func to all elements in temporary array \a a and array \a b. */
+template <typename T, typename FUNC>
+Array<T> forEachElement(Array<T>&& a, const Array<T>& b, FUNC func)
+{
+    return forEachElement(defaultExecutionPolicy(), std::move(a), b, func);
+}
+
+/*! \brief Apply \a func to all components in view \a a. The result is a contiguous array. */
+template <typename T, typename FUNC>
+Array<T> forEachComponent(const ArrayView& a, FUNC func)
+{
+    assert(typeFromTemplate<T>() == a.componentType());
+    Array<T> r(ArrayDescription(a.dimensions(), a.componentCount(), a.componentType()));
+    if (r.dataSize() == 0)
+        return r;
+    auto itr = r.componentBegin();
+    std::vector<size_t> index(a.dimensionCount(), 0);
+    do {
+        for (size_t c = 0; c < a.componentCount(); c++, ++itr)
+            *itr = func(*a.get<T>(index, c));
+    }
+    while (ArrayView::incrementIndex(a.dimensions(), index));
+    return r;
+}
+
+/*! \brief Apply \a func to all elements in view \a a. The result is a contiguous array.
+ * Since the components of a view element need not be contiguous, \a func
+ * receives a copy of each element. */
+template <typename T, typename FUNC>
+Array<T> forEachElement(const ArrayView& a, FUNC func)
+{
+    assert(typeFromTemplate<T>() == a.componentType());
+    Array<T> r(ArrayDescription(a.dimensions(), a.componentCount(), a.componentType()));
+    if (r.dataSize() == 0)
+        return r;
+    std::vector<T> element(a.componentCount());
+    auto itr = r.elementBegin();
+    std::vector<size_t> index(a.dimensionCount(), 0);
+    do {
+        for (size_t c = 0; c < a.componentCount(); c++)
+            element[c] = *a.get<T>(index, c);
+        func(*itr, static_cast<const T*>(element.data()));
+        ++itr;
+    }
+    while (ArrayView::incrementIndex(a.dimensions(), index));
+    return r;
 }
 
 }
@@ -32,9 +32,14 @@
 
 #include <cerrno>
 #include <cstring>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "array.hpp"
+#include "statistics.hpp"
 
 namespace TGD {
 
@@ -64,6 +69,36 @@ enum Error {
 const char* strerror(Error e);
 
 /*! \cond */
+// Clip the given box to the array; returns false if the box does not match
+// the dimensions of the array or if the clipped box is empty
+inline bool clipBox(const ArrayDescription& desc,
+        const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize,
+        std::vector<size_t>& clippedIndex, std::vector<size_t>& clippedSize)
+{
+    if (boxIndex.size() != desc.dimensionCount() || boxSize.size() != desc.dimensionCount())
+        return false;
+    clippedIndex.resize(desc.dimensionCount());
+    clippedSize.resize(desc.dimensionCount());
+    for (size_t d = 0; d < desc.dimensionCount(); d++) {
+        if (boxIndex[d] >= desc.dimension(d) || boxSize[d] == 0)
+            return false;
+        clippedIndex[d] = boxIndex[d];
+        clippedSize[d] = std::min(boxSize[d], desc.dimension(d) - boxIndex[d]);
+    }
+    return true;
+}
+
+// Make the target of FormatImportExport::readArrayInto() an array with the given
+// description, including its tags. The data of the target is reused if it has the
+// required size and is not shared with other containers; otherwise, it is reallocated.
+inline void prepareArray(ArrayContainer& target, const ArrayDescription& desc)
+{
+    if (target.isUnique() && target.dataSize() == desc.dataSize())
+        static_cast<ArrayDescription&>(target) = desc;
+    else
+        target = ArrayContainer(desc);
+}
+
 // This is the interface that file format converters must implement
 class FormatImportExport {
 public:
@@ -79,11 +114,185 @@ public:
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) = 0;
     virtual bool hasMore() = 0;
 
+    // for reading into an existing array whose data may be reused; see Importer::readArrayInto().
+    // Formats that allocate the array themselves should override this, see prepareArray().
+    virtual Error readArrayInto(ArrayContainer& target, int arrayIndex = -1 /* -1 means next */)
+    {
+        Error e = ErrorNone;
+        ArrayContainer array = readArray(&e, arrayIndex);
+        if (e == ErrorNone)
+            target = array;
+        return e;
+    }
+
+    // for reading only the description of an array, including its tags; see Importer::readDescription().
+    // Formats that can read the metadata without decoding the data should override this.
+    virtual Error readDescription(int arrayIndex, ArrayDescription& desc)
+    {
+        Error e = ErrorNone;
+        ArrayContainer array = readArray(&e, arrayIndex);
+        if (e == ErrorNone)
+            desc = array;
+        return e;
+    }
+
+    // for reading a box of an array; see Importer::readArray().
+    // Formats that can read only the required parts of the file should override this.
+    virtual ArrayContainer readArrayBox(Error* error, int arrayIndex,
+            const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize)
+    {
+        Error e = ErrorNone;
+        ArrayContainer array = readArray(&e, arrayIndex);
+        if (e != ErrorNone) {
+            *error = e;
+            return ArrayContainer();
+        }
+        std::vector<size_t> index, size;
+        if (!clipBox(array, boxIndex, boxSize, index, size)) {
+            *error = ErrorInvalidData;
+            return ArrayContainer();
+        }
+        return ArrayView(array).box(index, size).materialize();
+    }
+
+    // for reading an array in slabs along its last dimension; see Importer::beginArray().
+    // Formats that do not override these are handled by the Importer, which then
+    // reads the complete array with readArray() and hands out parts of it.
+    virtual Error beginReadSlabs(int /* arrayIndex */, ArrayDescription& /* desc */)
+    {
+        return ErrorFeaturesUnsupported;
+    }
+    virtual ArrayContainer readSlab(Error* error, size_t /* sliceIndex */, size_t /* sliceCount */)
+    {
+        *error = ErrorFeaturesUnsupported;
+        return ArrayContainer();
+    }
+
+    // for reading precomputed statistics of an array, or of a box of it (empty
+    // box vectors mean the complete array); see Importer::readStatistics().
+    // On success, the array counts as read; otherwise, the position is unchanged.
+    virtual Error readStatistics(int /* arrayIndex */, ArrayDescription& /* desc */,
+            const std::vector<size_t>& /* boxIndex */, const std::vector<size_t>& /* boxSize */,
+            std::vector<ComponentStatistics>& /* statistics */)
+    {
+        return ErrorFeaturesUnsupported;
+    }
+
+    // whether different instances may read different files at the same time in different
+    // threads; see BatchImporter. Formats whose libraries have global state must not override this.
+    virtual bool isReentrant() const
+    {
+        return false;
+    }
+
     // for writing / appending: (it is guaranteed that the file is opened for writing when one of these is called)
     virtual Error writeArray(const ArrayContainer& array) = 0;
+
+    // whether writeArray() accepts arrays in the bricked layout; all other
+    // formats get arrays in the linear layout, see ArrayDescription::isBricked().
+    virtual bool writesBrickedArrays() const
+    {
+        return false;
+    }
+
+    // for writing an array in slabs along its last dimension; see Exporter::beginArray().
+    // Formats that do not override these are handled by the Exporter, which then
+    // collects the slabs and writes the complete array with writeArray().
+    virtual Error beginWriteSlabs(const ArrayDescription& /* desc */)
+    {
+        return ErrorFeaturesUnsupported;
+    }
+    virtual Error writeSlab(const ArrayContainer& /* slab */)
+    {
+        return ErrorFeaturesUnsupported;
+    }
+    virtual Error endWriteSlabs()
+    {
+        return ErrorNone;
+    }
 };
 /*! \endcond */
 
+/*! \brief Performance counters of an importer or exporter.
+ *
+ * Profiling is enabled for an importer or exporter with the hint PROFILE=1, or
+ * for all importers and exporters with \a setProfiling(). The times are those
+ * spent by the caller in the respective functions; when reading or writing in the
+ * background (hints PREFETCH and ASYNC), they include the time waiting for the
+ * background thread. */
+class IOProfile
+{
+public:
+    /*! \brief The file name. */
+    std::string fileName;
+    /*! \brief The file format, e.g. from the FORMAT hint or the file name extension. */
+    std::string format;
+    /*! \brief Whether this is the profile of an exporter. */
+    bool output;
+    /*! \brief The number of arrays read or written. */
+    size_t arrays;
+    /*! \brief The number of bytes of array data read or written. */
+    size_t bytes;
+    /*! \brief The number of bytes of array data allocated by the importer or exporter. */
+    size_t allocatedBytes;
+    /*! \brief Seconds spent selecting the format backend, including loading plugins. */
+    double formatSeconds;
+    /*! \brief Seconds spent opening the file. */
+    double openSeconds;
+    /*! \brief Seconds spent locating arrays, i.e. in arrayCount() and hasMore(). */
+    double seekSeconds;
+    /*! \brief Seconds spent reading and decoding, or encoding and writing arrays and slabs. */
+    double dataSeconds;
+    /*! \brief Seconds spent in flush() and finish(), including closing the file. */
+    double flushSeconds;
+
+    /*! \brief Constructor. */
+    IOProfile(const std::string& fileName = std::string(), const std::string& format = std::string(),
+            bool output = false) :
+        fileName(fileName), format(format), output(output),
+        arrays(0), bytes(0), allocatedBytes(0),
+        formatSeconds(0.0), openSeconds(0.0), seekSeconds(0.0), dataSeconds(0.0), flushSeconds(0.0)
+    {
+    }
+
+    /*! \brief Returns the sum of all times. */
+    double totalSeconds() const
+    {
+        return formatSeconds + openSeconds + seekSeconds + dataSeconds + flushSeconds;
+    }
+
+    /*! \brief Adds the counters of \a p to this profile. */
+    void merge(const IOProfile& p)
+    {
+        arrays += p.arrays;
+        bytes += p.bytes;
+        allocatedBytes += p.allocatedBytes;
+        formatSeconds += p.formatSeconds;
+        openSeconds += p.openSeconds;
+        seekSeconds += p.seekSeconds;
+        dataSeconds += p.dataSeconds;
+        flushSeconds += p.flushSeconds;
+    }
+};
+
+/*! \brief Enables or disables profiling for all importers and exporters that are initialized
+ * afterwards. When such an importer or exporter is destroyed or initialized again, its profile
+ * is stored and can be retrieved with \a collectedProfiles(). */
+void setProfiling(bool enable);
+
+/*! \brief Returns whether profiling is enabled with \a setProfiling(). */
+bool profiling();
+
+/*! \brief Returns the profiles of all importers and exporters with profiling enabled by
+ * \a setProfiling() that were destroyed or initialized again, in that order. */
+std::vector<IOProfile> collectedProfiles();
+
+/*! \cond */
+class ImporterPrefetcher;
+class ExporterWriter;
+class BatchImporter;
+/*! \endcond */
+
 /*! \brief The importer class imports arrays from files or streams. */
 class Importer {
 private:
@@ -92,8 +301,20 @@ private:
     std::string _format;
     std::shared_ptr<FormatImportExport> _fie;
     bool _fileIsOpened;
+    size_t _prefetchCount;
+    std::shared_ptr<ImporterPrefetcher> _prefetcher;
+    // state for reading in slabs:
+    ArrayDescription _slabDescription;
+    ArrayContainer _slabArray;  // only used if the format cannot read slabs
+    bool _slabsNative;
+    size_t _slabPosition;
+    std::shared_ptr<IOProfile> _profile; // null if profiling is disabled
 
     Error ensureFileIsOpenedForReading();
+    bool readPrefetchedArray(ArrayContainer& array, Error& e);
+    void stopPrefetching();
+
+    friend class BatchImporter;
 
 public:
     /*! \brief Constructor. This must be initialized with \a initialize(). */
@@ -114,6 +335,17 @@ public:
      * access the data will report any errors that might occur. If you want to
      * perform some lightweight checks without accessing the file contents, use the
      * checkAccess() function.
+     *
+     * The hint PREFETCH=N enables reading of up to N arrays ahead in a background thread,
+     * so that reading and decoding overlaps with the processing of the previous arrays.
+     * This is done for sequential reading with \a hasMore() and \a readArray() with the
+     * default array index; the behavior of these functions does not change, only the
+     * memory for up to N additional arrays is required. Any other way of reading stops
+     * prefetching; arrays that were already prefetched are still returned as the next arrays.
+     *
+     * For .tgd files with chunked data, the hint BRICKED=1 returns complete arrays in the
+     * bricked layout with the chunk size as brick size (see \a ArrayDescription::isBricked()),
+     * so that the chunks are decoded directly into place.
      */
     Importer(const std::string& fileName, const TagList& hints = TagList());
 
@@ -126,6 +358,13 @@ public:
         return _fileName;
     }
 
+    /*! \brief Returns the profile of this importer, or nullptr if profiling is disabled;
+     * see \a IOProfile. */
+    const IOProfile* profile() const
+    {
+        return _profile.get();
+    }
+
     /*! \brief Checks if the file is accessible and the format is supported. This function
      * does not access the file contents yet, and does not result in an open file descriptor. */
     Error checkAccess() const;
@@ -144,10 +383,170 @@ public:
      */
     ArrayContainer readArray(Error* error = nullptr, int arrayIndex = -1 /* -1 means next */);
 
+    /*! \brief Read an array from the file into \a target. This works like \a readArray(), but
+     * the data of \a target is reused if it has the required size and is not shared with other
+     * containers (see ArrayContainer::isUnique()), so that repeated reading of arrays of the same size
+     * does not (re)allocate memory. Only some file formats support this; for all others, and for
+     * arrays that were prefetched, \a target is replaced by a new array. On error, the contents of
+     * \a target are undefined.
+     */
+    Error readArrayInto(ArrayContainer& target, int arrayIndex = -1 /* -1 means next */);
+
+    /*! \brief Read the \a count consecutive arrays starting with \a firstIndex from the file
+     * into \a arrays, which is resized accordingly. The elements of \a arrays are reused as in
+     * \a readArrayInto(). Only the first array is accessed by index; the others are read as the
+     * next arrays, which avoids seeking for each one, e.g. when reading a range of video frames.
+     */
+    Error readArrays(std::vector<ArrayContainer>& arrays, int firstIndex, int count);
+
+    /*! \brief Read a box of an array from the file and return it. The box is given by the index
+     * of its first element (\a boxIndex) and its size (\a boxSize) in each dimension, and is clipped
+     * to the array. If the box does not match the dimensions of the array or if the clipped box
+     * is empty, the error is set to ErrorInvalidData.
+     *
+     * Some file formats read only the parts of the file that are required for the box; for all
+     * others, the complete array is read and then cropped. See \a readArray(Error*, int)
+     * for the meaning of \a arrayIndex.
+     */
+    ArrayContainer readArray(Error* error, int arrayIndex,
+            const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize);
+
+    /*! \brief Read the description of an array, including its tags, and return it. The array
+     * counts as read, i.e. this can replace \a readArray() when only the dimensions, components,
+     * type and tags are needed. On error, the error code will be set (if \a error is not nullptr)
+     * and an empty description will be returned.
+     *
+     * Many file formats read only their headers or metadata for this; for all others, the complete
+     * array is read. Some formats provide only the tags that are stored in front of the data.
+     * See \a readArray(Error*, int) for the meaning of \a arrayIndex.
+     */
+    ArrayDescription readDescription(Error* error = nullptr, int arrayIndex = -1 /* -1 means next */);
+
+    /*! \brief Read the statistics of each component of an array from statistics that were stored
+     * with it, without reading its data, and set \a desc to its description.
+     * If \a boxIndex and \a boxSize are given, the statistics are restricted to this box, which
+     * is clipped to the array as in \a readArray(Error*, int, const std::vector<size_t>&, const std::vector<size_t>&).
+     *
+     * Currently only TGD files written with the hint STATISTICS=1 store statistics, per chunk
+     * or per slab of slices. Boxes must consist of complete chunks or slabs. In all other cases,
+     * ErrorFeaturesUnsupported is returned and the array is not consumed, so that the caller
+     * can read it and compute its statistics instead. See \a readArray(Error*, int) for the meaning
+     * of \a arrayIndex.
+     */
+    Error readStatistics(ArrayDescription& desc, std::vector<ComponentStatistics>& statistics,
+            int arrayIndex = -1 /* -1 means next */,
+            const std::vector<size_t>& boxIndex = std::vector<size_t>(),
+            const std::vector<size_t>& boxSize = std::vector<size_t>());
+
     /*! \brief Returns whether there are more arrays in the file, i.e. whether you can read the next array
      * with \a readArray(). This information is always available, for all file formats and also for streams.
      * If (and only if) this function returns false, then it sets the error code. */
     bool hasMore(Error* error = nullptr);
+
+    /*! \brief Begin to read an array in slabs and return its description. On error, the error code
+     * will be set (if \a error is not nullptr) and an empty description will be returned.
+     *
+     * A slab is a range of slices along the last dimension, e.g. a range of rows of an image or a
+     * range of layers of a volume. Read the slabs in order with \a readSlab() until \a remainingSlices()
+     * returns zero. This allows to process arrays that are larger than the available memory.
+     *
+     * Some file formats read only the data required for each slab; for all others, the complete array
+     * is read when calling this function. See \a readArray(Error*, int) for the meaning of \a arrayIndex.
+     */
+    ArrayDescription beginArray(Error* error = nullptr, int arrayIndex = -1 /* -1 means next */);
+
+    /*! \brief Read the next slab of the array started with \a beginArray(). The slab has the dimensions
+     * of the array except for the last one, which is the minimum of \a sliceCount and \a remainingSlices().
+     * The slab has the tags of the array. On error, the error code will be set (if \a error is
+     * not nullptr) and a null array will be returned. */
+    ArrayContainer readSlab(size_t sliceCount, Error* error = nullptr);
+
+    /*! \brief Returns the number of slices of the array started with \a beginArray() that were not read yet. */
+    size_t remainingSlices() const
+    {
+        return (_slabDescription.dimensionCount() == 0 ? 0
+                : _slabDescription.dimension(_slabDescription.dimensionCount() - 1) - _slabPosition);
+    }
+};
+
+/*! \brief The batch importer reads arrays from many files in parallel, e.g. the slices
+ * of a volume that are stored in one image file each.
+ *
+ * There is one \a Importer per file, and the functions of this class read the next
+ * array of each file. The files are read on a thread pool; files in formats whose
+ * libraries do not allow concurrent use are read one at a time. */
+class BatchImporter {
+private:
+    std::vector<Importer> _importers;
+    std::shared_ptr<ThreadPool> _pool; // null if the shared pool is used
+    bool _sequential;                  // true if all files are read on the calling thread
+
+public:
+    /*! \brief Constructor. This must be initialized with \a initialize(). */
+    BatchImporter();
+
+    /*! \brief Constructor. There is one importer for each of the \a fileNames, and all of
+     * them use the given \a hints; see \a Importer::Importer(). If \a threadCount is zero,
+     * the thread pool shared by all array operations is used (see \a ThreadPool::instance());
+     * otherwise, at most \a threadCount threads read files at the same time. With one thread,
+     * all files are read on the calling thread. */
+    BatchImporter(const std::vector<std::string>& fileNames, const TagList& hints = TagList(), size_t threadCount = 0);
+
+    /*! \brief Initialize. See the constructor documentation. */
+    void initialize(const std::vector<std::string>& fileNames, const TagList& hints = TagList(), size_t threadCount = 0);
+
+    /*! \brief Returns the file names that result from a \a fileNameTemplate by replacing
+     * its first occurrence of %[n]N with the indices \a firstIndex, \a firstIndex + 1, ...
+     * as long as the resulting files exist. The index is padded with zeroes to n digits
+     * (default 6), e.g. slice-%4N.png gives slice-0000.png, slice-0001.png, ...
+     * If the template is invalid, the error is set (if \a error is not nullptr) and an
+     * empty list is returned. */
+    static std::vector<std::string> fileNamesFromTemplate(const std::string& fileNameTemplate,
+            size_t firstIndex = 0, Error* error = nullptr);
+
+    /*! \brief Returns the number of files. */
+    size_t size() const
+    {
+        return _importers.size();
+    }
+
+    /*! \brief Returns the importers, one per file, e.g. to read the files individually. */
+    std::vector<Importer>& importers()
+    {
+        return _importers;
+    }
+
+    /*! \brief Returns the number of files that are read at the same time. */
+    size_t threadCount() const
+    {
+        if (_sequential)
+            return 1;
+        return (_pool ? _pool->threadCount() : ThreadPool::instance().threadCount()) + 1;
+    }
+
+    /*! \brief Call \a func(i, importer) for the importer of each file i in parallel and wait until
+     * all calls returned. Only the \a count files starting with \a first are processed, e.g. to
+     * limit the number of arrays in memory. Calls for files in formats that do not allow concurrent
+     * use do not overlap. Returns the first error in the order of the files that a call returned. */
+    Error forEach(const std::function<Error (size_t, Importer&)>& func,
+            size_t first = 0, size_t count = std::numeric_limits<size_t>::max());
+
+    /*! \brief Returns whether each file has more arrays; see \a Importer::hasMore().
+     * If (and only if) this function returns false, then it sets the error code. */
+    bool hasMore(Error* error = nullptr);
+
+    /*! \brief Read the next array of each file into \a arrays, which is resized to the number
+     * of files. The elements of \a arrays are reused as in \a Importer::readArrayInto(). */
+    Error readArrays(std::vector<ArrayContainer>& arrays);
+
+    /*! \brief Read the next array of each file and stack the arrays along a new last dimension,
+     * in the order of the files. All arrays must have the same dimensions, component count and
+     * component type, otherwise the error is set to ErrorInvalidData. The tags are taken from
+     * the first array. The result is allocated once, and formats that support it (see
+     * \a Importer::readArrayInto()) decode their array directly into its slice of the result.
+     * On error, the error code will be set (if \a error is not nullptr) and a null array
+     * will be returned. */
+    ArrayContainer readStacked(Error* error = nullptr);
 };
 
 /*! \brief Flag to be used for the append parameter of TGD::save() */
@@ -164,6 +563,16 @@ private:
     std::string _format;
     std::shared_ptr<FormatImportExport> _fie;
     bool _fileIsOpened;
+    size_t _asyncCount;
+    std::shared_ptr<ExporterWriter> _writer;
+    // state for writing in slabs:
+    ArrayDescription _slabDescription;
+    ArrayContainer _slabArray;  // only used if the format cannot write slabs
+    bool _slabsNative;
+    size_t _slabPosition;
+    std::shared_ptr<IOProfile> _profile; // null if profiling is disabled
+
+    Error ensureFileIsOpenedForWriting();
 
 public:
     /*! \brief Constructor. This must be initialized with \a initialize(). */
@@ -179,6 +588,12 @@ public:
      * Note that this initialization does not try to open the file yet, it merely
      * sets up the necessary information (and thus cannot fail). The functions that
      * access the data will report any errors that might occur.
+     *
+     * The hint ASYNC=N enables writing in a background thread: \a writeArray() then only
+     * queues the array, and blocks only if N arrays are already waiting. The array shares its
+     * data with the queued copy, so it must not be modified until it is written; call \a flush()
+     * to wait for that. Errors are reported by the next call to \a writeArray(), \a flush(),
+     * or \a finish(); arrays after an error are not written.
      */
     Exporter(const std::string& fileName, bool append = Overwrite, const TagList& hints = TagList());
 
@@ -194,8 +609,45 @@ public:
         return _fileName;
     }
 
+    /*! \brief Returns the profile of this exporter, or nullptr if profiling is disabled;
+     * see \a IOProfile. */
+    const IOProfile* profile() const
+    {
+        return _profile.get();
+    }
+
     /*! \brief Writes the \a array to the file. */
     Error writeArray(const ArrayContainer& array);
+
+    /*! \brief Waits until all arrays are written, and returns the first error that occurred
+     * while writing them. This is only necessary when writing in the background (see the
+     * constructor documentation). */
+    Error flush();
+
+    /*! \brief Writes all pending arrays and closes the file. Returns the first error that
+     * occurred while writing in the background. The destructor does this, too, but cannot
+     * report errors. Afterwards, the exporter must be initialized again before it can be used. */
+    Error finish();
+
+    /*! \brief Writes the data of the \a view to the file. Only the data covered
+     * by the view is copied, see \a ArrayView::materialize(). */
+    Error writeArray(const ArrayView& view)
+    {
+        return writeArray(view.materialize());
+    }
+
+    /*! \brief Begin to write an array with the description \a desc in slabs along its last dimension;
+     * see \a Importer::beginArray(). The tags of the array are taken from \a desc.
+     * Write the slabs in order with \a writeSlab(). The array is complete when all its slices are written.
+     *
+     * Some file formats write each slab immediately; for all others, the slabs are collected
+     * and the complete array is written when the last slab arrives. */
+    Error beginArray(const ArrayDescription& desc);
+
+    /*! \brief Write the next slab of the array started with \a beginArray(). The slab must have
+     * the dimensions, component count and component type of the array, except for the last dimension,
+     * which must not exceed the number of slices that remain to be written. */
+    Error writeSlab(const ArrayContainer& slab);
 };
 
 /*! \brief Shortcut to read a single array from a file in a single line of code. */
@@ -28,9 +28,15 @@
 /**
  * \file operators.hpp
  * \brief Overloading of common operators and functions for arrays.
+ *
+ * Operators use the default execution policy, see \a TGD::defaultExecutionPolicy()
+ * and \a TGD::ExecutionPolicyScope. Functions additionally accept an explicit policy.
+ * Operators and functions that take temporary arrays reuse their data for the
+ * result when possible, so that chained operations allocate only once.
  */
 
 #include <algorithm>
+#include <utility>
 
 #include "array.hpp"
 #include "foreach.hpp"
@@ -43,30 +49,78 @@ Array<T> operator-(const Array<T>& a)
     return forEachComponent(a, [] (T v) -> T { return -v; });
 }
 
+template<typename T>
+Array<T> operator-(Array<T>&& a)
+{
+    return forEachComponent(std::move(a), [] (T v) -> T { return -v; });
+}
+
 template<typename T>
 Array<T> abs(const Array<T>& a)
 {
     return forEachComponent(a, [] (T v) -> T { return std::abs(v); });
 }
 
+template<typename T>
+Array<T> abs(Array<T>&& a)
+{
+    return forEachComponent(std::move(a), [] (T v) -> T { return std::abs(v); });
+}
+
+template<typename T>
+Array<T> abs(ExecutionPolicy policy, const Array<T>& a)
+{
+    return forEachComponent(policy, a, [] (T v) -> T { return std::abs(v); });
+}
+
 template<typename T>
 Array<T> absInplace(Array<T>& a)
 {
     return forEachComponentInplace(a, [] (T v) -> T { return std::abs(v); });
 }
 
+template<typename T>
+Array<T> absInplace(ExecutionPolicy policy, Array<T>& a)
+{
+    return forEachComponentInplace(policy, a, [] (T v) -> T { return std::abs(v); });
+}
+
 template<typename T>
 Array<T> operator+(const Array<T>& a, const Array<T>& b)
 {
     return forEachComponent(a, b, [] (T u, T v) -> T { return u + v; });
 }
 
+template<typename T>
+Array<T> operator+(Array<T>&& a, const Array<T>& b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return u + v; });
+}
+
+template<typename T>
+Array<T> operator+(const Array<T>& a, Array<T>&& b)
+{
+    return forEachComponent(a, std::move(b), [] (T u, T v) -> T { return u + v; });
+}
+
+template<typename T>
+Array<T> operator+(Array<T>&& a, Array<T>&& b)
+{
+    return forEachComponent(std::move(a), std::move(b), [] (T u, T v) -> T { return u + v; });
+}
+
 template<typename T>
 Array<T> operator+(const Array<T>& a, T b)
 {
     return forEachComponent(a, b, [] (T u, T v) -> T { return u + v; });
 }
 
+template<typename T>
+Array<T> operator+(Array<T>&& a, T b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return u + v; });
+}
+
 template<typename T>
 Array<T> operator+=(Array<T>& a, const Array<T>& b)
 {
@@ -85,12 +139,36 @@ Array<T> operator-(const Array<T>& a, const Array<T>& b)
     return forEachComponent(a, b, [] (T u, T v) -> T { return u - v; });
 }
 
+template<typename T>
+Array<T> operator-(Array<T>&& a, const Array<T>& b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return u - v; });
+}
+
+template<typename T>
+Array<T> operator-(const Array<T>& a, Array<T>&& b)
+{
+    return forEachComponent(a, std::move(b), [] (T u, T v) -> T { return u - v; });
+}
+
+template<typename T>
+Array<T> operator-(Array<T>&& a, Array<T>&& b)
+{
+    return forEachComponent(std::move(a), std::move(b), [] (T u, T v) -> T { return u - v; });
+}
+
 template<typename T>
 Array<T> operator-(const Array<T>& a, T b)
 {
     return forEachComponent(a, b, [] (T u, T v) -> T { return u - v; });
 }
 
+template<typename T>
+Array<T> operator-(Array<T>&& a, T b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return u - v; });
+}
+
 template<typename T>
 Array<T> operator-=(Array<T>& a, const Array<T>& b)
 {
@@ -109,12 +187,36 @@ Array<T> operator*(const Array<T>& a, const Array<T>& b)
     return forEachComponent(a, b, [] (T u, T v) -> T { return u * v; });
 }
 
+template<typename T>
+Array<T> operator*(Array<T>&& a, const Array<T>& b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return u * v; });
+}
+
+template<typename T>
+Array<T> operator*(const Array<T>& a, Array<T>&& b)
+{
+    return forEachComponent(a, std::move(b), [] (T u, T v) -> T { return u * v; });
+}
+
+template<typename T>
+Array<T> operator*(Array<T>&& a, Array<T>&& b)
+{
+    return forEachComponent(std::move(a), std::move(b), [] (T u, T v) -> T { return u * v; });
+}
+
 template<typename T>
 Array<T> operator*(const Array<T>& a, T b)
 {
     return forEachComponent(a, b, [] (T u, T v) -> T { return u * v; });
 }
 
+template<typename T>
+Array<T> operator*(Array<T>&& a, T b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return u * v; });
+}
+
 template<typename T>
 Array<T> operator*=(Array<T>& a, const Array<T>& b)
 {
@@ -133,12 +235,36 @@ Array<T> operator/(const Array<T>& a, const Array<T>& b)
     return forEachComponent(a, b, [] (T u, T v) -> T { return u / v; });
 }
 
+template<typename T>
+Array<T> operator/(Array<T>&& a, const Array<T>& b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return u / v; });
+}
+
+template<typename T>
+Array<T> operator/(const Array<T>& a, Array<T>&& b)
+{
+    return forEachComponent(a, std::move(b), [] (T u, T v) -> T { return u / v; });
+}
+
+template<typename T>
+Array<T> operator/(Array<T>&& a, Array<T>&& b)
+{
+    return forEachComponent(std::move(a), std::move(b), [] (T u, T v) -> T { return u / v; });
+}
+
 template<typename T>
 Array<T> operator/(const Array<T>& a, T b)
 {
     return forEachComponent(a, b, [] (T u, T v) -> T { return u / v; });
 }
 
+template<typename T>
+Array<T> operator/(Array<T>&& a, T b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return u / v; });
+}
+
 template<typename T>
 Array<T> operator/=(Array<T>& a, const Array<T>& b)
 {
@@ -157,12 +283,36 @@ Array<T> operator%(const Array<T>& a, const Array<T>& b)
     return forEachComponent(a, b, [] (T u, T v) -> T { return u % v; });
 }
 
+template<typename T>
+Array<T> operator%(Array<T>&& a, const Array<T>& b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return u % v; });
+}
+
+template<typename T>
+Array<T> operator%(const Array<T>& a, Array<T>&& b)
+{
+    return forEachComponent(a, std::move(b), [] (T u, T v) -> T { return u % v; });
+}
+
+template<typename T>
+Array<T> operator%(Array<T>&& a, Array<T>&& b)
+{
+    return forEachComponent(std::move(a), std::move(b), [] (T u, T v) -> T { return u % v; });
+}
+
 template<typename T>
 Array<T> operator%(const Array<T>& a, T b)
 {
     return forEachComponent(a, b, [] (T u, T v) -> T { return u % v; });
 }
 
+template<typename T>
+Array<T> operator%(Array<T>&& a, T b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return u % v; });
+}
+
 template<typename T>
 Array<T> operator%=(Array<T>& a, const Array<T>& b)
 {
@@ -181,12 +331,36 @@ Array<T> operator&(const Array<T>& a, const Array<T>& b)
     return forEachComponent(a, b, [] (T u, T v) -> T { return u & v; });
 }
 
+template<typename T>
+Array<T> operator&(Array<T>&& a, const Array<T>& b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return u & v; });
+}
+
+template<typename T>
+Array<T> operator&(const Array<T>& a, Array<T>&& b)
+{
+    return forEachComponent(a, std::move(b), [] (T u, T v) -> T { return u & v; });
+}
+
+template<typename T>
+Array<T> operator&(Array<T>&& a, Array<T>&& b)
+{
+    return forEachComponent(std::move(a), std::move(b), [] (T u, T v) -> T { return u & v; });
+}
+
 template<typename T>
 Array<T> operator&(const Array<T>& a, T b)
 {
     return forEachComponent(a, b, [] (T u, T v) -> T { return u & v; });
 }
 
+template<typename T>
+Array<T> operator&(Array<T>&& a, T b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return u & v; });
+}
+
 template<typename T>
 Array<T> operator&=(Array<T>& a, const Array<T>& b)
 {
@@ -205,12 +379,36 @@ Array<T> operator|(const Array<T>& a, const Array<T>& b)
     return forEachComponent(a, b, [] (T u, T v) -> T { return u | v; });
 }
 
+template<typename T>
+Array<T> operator|(Array<T>&& a, const Array<T>& b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return u | v; });
+}
+
+template<typename T>
+Array<T> operator|(const Array<T>& a, Array<T>&& b)
+{
+    return forEachComponent(a, std::move(b), [] (T u, T v) -> T { return u | v; });
+}
+
+template<typename T>
+Array<T> operator|(Array<T>&& a, Array<T>&& b)
+{
+    return forEachComponent(std::move(a), std::move(b), [] (T u, T v) -> T { return u | v; });
+}
+
 template<typename T>
 Array<T> operator|(const Array<T>& a, T b)
 {
     return forEachComponent(a, b, [] (T u, T v) -> T { return u | v; });
 }
 
+template<typename T>
+Array<T> operator|(Array<T>&& a, T b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return u | v; });
+}
+
 template<typename T>
 Array<T> operator|=(Array<T>& a, const Array<T>& b)
 {
@@ -229,12 +427,36 @@ Array<T> operator^(const Array<T>& a, const Array<T>& b)
     return forEachComponent(a, b, [] (T u, T v) -> T { return u ^ v; });
 }
 
+template<typename T>
+Array<T> operator^(Array<T>&& a, const Array<T>& b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return u ^ v; });
+}
+
+template<typename T>
+Array<T> operator^(const Array<T>& a, Array<T>&& b)
+{
+    return forEachComponent(a, std::move(b), [] (T u, T v) -> T { return u ^ v; });
+}
+
+template<typename T>
+Array<T> operator^(Array<T>&& a, Array<T>&& b)
+{
+    return forEachComponent(std::move(a), std::move(b), [] (T u, T v) -> T { return u ^ v; });
+}
+
 template<typename T>
 Array<T> operator^(const Array<T>& a, T b)
 {
     return forEachComponent(a, b, [] (T u, T v) -> T { return u ^ v; });
 }
 
+template<typename T>
+Array<T> operator^(Array<T>&& a, T b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return u ^ v; });
+}
+
 template<typename T>
 Array<T> operator^=(Array<T>& a, const Array<T>& b)
 {
@@ -253,47 +475,143 @@ Array<T> min(const Array<T>& a, const Array<T>& b)
     return forEachComponent(a, b, [] (T u, T v) -> T { return std::min(u, v); });
 }
 
+template<typename T>
+Array<T> min(Array<T>&& a, const Array<T>& b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return std::min(u, v); });
+}
+
+template<typename T>
+Array<T> min(const Array<T>& a, Array<T>&& b)
+{
+    return forEachComponent(a, std::move(b), [] (T u, T v) -> T { return std::min(u, v); });
+}
+
+template<typename T>
+Array<T> min(Array<T>&& a, Array<T>&& b)
+{
+    return forEachComponent(std::move(a), std::move(b), [] (T u, T v) -> T { return std::min(u, v); });
+}
+
+template<typename T>
+Array<T> min(ExecutionPolicy policy, const Array<T>& a, const Array<T>& b)
+{
+    return forEachComponent(policy, a, b, [] (T u, T v) -> T { return std::min(u, v); });
+}
+
 template<typename T>
 Array<T> min(const Array<T>& a, T b)
 {
     return forEachComponent(a, b, [] (T u, T v) -> T { return std::min(u, v); });
 }
 
+template<typename T>
+Array<T> min(Array<T>&& a, T b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return std::min(u, v); });
+}
+
+template<typename T>
+Array<T> min(ExecutionPolicy policy, const Array<T>& a, T b)
+{
+    return forEachComponent(policy, a, b, [] (T u, T v) -> T { return std::min(u, v); });
+}
+
 template<typename T>
 Array<T> minInplace(Array<T>& a, const Array<T>& b)
 {
     return forEachComponentInplace(a, b, [] (T u, T v) -> T { return std::min(u, v); });
 }
 
+template<typename T>
+Array<T> minInplace(ExecutionPolicy policy, Array<T>& a, const Array<T>& b)
+{
+    return forEachComponentInplace(policy, a, b, [] (T u, T v) -> T { return std::min(u, v); });
+}
+
 template<typename T>
 Array<T> minInplace(Array<T>& a, T b)
 {
     return forEachComponentInplace(a, b, [] (T u, T v) -> T { return std::min(u, v); });
 }
 
+template<typename T>
+Array<T> minInplace(ExecutionPolicy policy, Array<T>& a, T b)
+{
+    return forEachComponentInplace(policy, a, b, [] (T u, T v) -> T { return std::min(u, v); });
+}
+
 template<typename T>
 Array<T> max(const Array<T>& a, const Array<T>& b)
 {
     return forEachComponent(a, b, [] (T u, T v) -> T { return std::max(u, v); });
 }
 
+template<typename T>
+Array<T> max(Array<T>&& a, const Array<T>& b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return std::max(u, v); });
+}
+
+template<typename T>
+Array<T> max(const Array<T>& a, Array<T>&& b)
+{
+    return forEachComponent(a, std::move(b), [] (T u, T v) -> T { return std::max(u, v); });
+}
+
+template<typename T>
+Array<T> max(Array<T>&& a, Array<T>&& b)
+{
+    return forEachComponent(std::move(a), std::move(b), [] (T u, T v) -> T { return std::max(u, v); });
+}
+
+template<typename T>
+Array<T> max(ExecutionPolicy policy, const Array<T>& a, const Array<T>& b)
+{
+    return forEachComponent(policy, a, b, [] (T u, T v) -> T { return std::max(u, v); });
+}
+
 template<typename T>
 Array<T> max(const Array<T>& a, T b)
 {
     return forEachComponent(a, b, [] (T u, T v) -> T { return std::max(u, v); });
 }
 
+template<typename T>
+Array<T> max(Array<T>&& a, T b)
+{
+    return forEachComponent(std::move(a), b, [] (T u, T v) -> T { return std::max(u, v); });
+}
+
+template<typename T>
+Array<T> max(ExecutionPolicy policy, const Array<T>& a, T b)
+{
+    return forEachComponent(policy, a, b, [] (T u, T v) -> T { return std::max(u, v); });
+}
+
 template<typename T>
 Array<T> maxInplace(Array<T>& a, const Array<T>& b)
 {
     return forEachComponentInplace(a, b, [] (T u, T v) -> T { return std::max(u, v); });
 }
 
+template<typename T>
+Array<T> maxInplace(ExecutionPolicy policy, Array<T>& a, const Array<T>& b)
+{
+    return forEachComponentInplace(policy, a, b, [] (T u, T v) -> T { return std::max(u, v); });
+}
+
 template<typename T>
 Array<T> maxInplace(Array<T>& a, T b)
 {
     return forEachComponentInplace(a, b, [] (T u, T v) -> T { return std::max(u, v); });
 }
 
+template<typename T>
+Array<T> maxInplace(ExecutionPolicy policy, Array<T>& a, T b)
+{
+    return forEachComponentInplace(policy, a, b, [] (T u, T v) -> T { return std::max(u, v); });
+}
+
 }
 #endif
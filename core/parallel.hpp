@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2018, 2019, 2020, 2021, 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TGD_PARALLEL_HPP
+#define TGD_PARALLEL_HPP
+
+/**
+ * \file parallel.hpp
+ * \brief Execution policies and a thread pool for parallel array operations.
+ */
+
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+
+namespace TGD {
+
+/*! \brief Execution policies for operations on arrays. */
+enum ExecutionPolicy
+{
+    Sequential = 0,         /**< \brief Process all data sequentially in the calling thread */
+    Parallel = 1,           /**< \brief Process chunks of data in parallel using the thread pool */
+    ParallelUnsequenced = 2 /**< \brief Like Parallel, and additionally allow vectorization
+                                 within chunks, i.e. the function must not depend on the order
+                                 of processing. */
+};
+
+/*! \brief A pool of worker threads that is reused for all parallel operations. */
+class ThreadPool
+{
+private:
+    std::vector<std::thread> _threads;
+    std::deque<std::function<void()>> _tasks;
+    std::vector<std::deque<std::function<void()>>> _threadTasks; // tasks for one thread only
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    bool _stop;
+
+    static bool& isWorkerThread()
+    {
+        static thread_local bool worker = false;
+        return worker;
+    }
+
+    void work(size_t index)
+    {
+        isWorkerThread() = true;
+        std::deque<std::function<void()>>& ownTasks = _threadTasks[index];
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _condition.wait(lock, [&] { return _stop || !ownTasks.empty() || !_tasks.empty(); });
+                // tasks for this thread take precedence over tasks for any thread
+                std::deque<std::function<void()>>& tasks = (ownTasks.empty() ? _tasks : ownTasks);
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+public:
+    /*! \brief Constructor. If \a threadCount is zero, one worker thread per
+     * hardware thread except the calling one is used. */
+    explicit ThreadPool(size_t threadCount = 0) : _stop(false)
+    {
+        if (threadCount == 0) {
+            size_t n = std::thread::hardware_concurrency();
+            threadCount = (n > 1 ? n - 1 : 0);
+        }
+        _threadTasks.resize(threadCount);
+        for (size_t i = 0; i < threadCount; i++)
+            _threads.emplace_back([this, i] { work(i); });
+    }
+
+    /*! \brief Destructor. Waits for all pending tasks to finish. */
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _condition.notify_all();
+        for (size_t i = 0; i < _threads.size(); i++)
+            _threads[i].join();
+    }
+
+    /*! \brief Returns the pool shared by all array operations. */
+    static ThreadPool& instance()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    /*! \brief Returns the number of worker threads. */
+    size_t threadCount() const
+    {
+        return _threads.size();
+    }
+
+    /*! \brief Queue a \a task for execution by one of the worker threads. */
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _tasks.push_back(std::move(task));
+        }
+        _condition.notify_one();
+    }
+
+    /*! \brief Queue a \a task for execution by the worker thread with the given \a index. */
+    void submit(size_t index, std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _threadTasks[index].push_back(std::move(task));
+        }
+        _condition.notify_all();
+    }
+
+    /*! \brief Call \a func(begin, end) for chunks that cover the range [0, n) and wait
+     * until all chunks are processed. The calling thread participates. Chunk
+     * boundaries are multiples of \a granularity. Exceptions thrown by \a func are
+     * passed on to the caller. When called from a worker thread, the range is processed
+     * sequentially to avoid deadlocks. */
+    template<typename FUNC>
+    void parallelFor(size_t n, size_t granularity, FUNC func)
+    {
+        granularity = std::max(granularity, size_t(1));
+        size_t maxChunks = (n + granularity - 1) / granularity;
+        if (threadCount() == 0 || maxChunks < 2 || isWorkerThread()) {
+            func(size_t(0), n);
+            return;
+        }
+        // Use more chunks than threads to balance the load
+        size_t chunks = std::min(maxChunks, 4 * (threadCount() + 1));
+        size_t chunkSize = ((n / chunks + granularity - 1) / granularity) * granularity;
+        chunks = (n + chunkSize - 1) / chunkSize;
+
+        std::atomic<size_t> nextChunk(0);
+        std::exception_ptr exception;
+        std::mutex doneMutex;
+        std::condition_variable doneCondition;
+        size_t helpers = std::min(threadCount(), chunks - 1);
+        size_t activeHelpers = helpers;
+        auto processChunks = [&] () {
+            for (;;) {
+                size_t c = nextChunk++;
+                if (c >= chunks)
+                    break;
+                size_t begin = c * chunkSize;
+                size_t end = std::min(begin + chunkSize, n);
+                try {
+                    func(begin, end);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(doneMutex);
+                    if (!exception)
+                        exception = std::current_exception();
+                    nextChunk = chunks;
+                }
+            }
+        };
+        for (size_t h = 0; h < helpers; h++) {
+            submit([&] () {
+                processChunks();
+                std::lock_guard<std::mutex> lock(doneMutex);
+                if (--activeHelpers == 0)
+                    doneCondition.notify_one();
+            });
+        }
+        processChunks();
+        {
+            std::unique_lock<std::mutex> lock(doneMutex);
+            doneCondition.wait(lock, [&] { return activeHelpers == 0; });
+        }
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+
+    /*! \brief Like \a parallelFor(), but the range is split statically into one part
+     * per thread: the calling thread processes part 0, and worker thread i processes
+     * part i + 1. The parts are contiguous, of nearly equal size, and depend only on
+     * \a n, \a granularity and the number of threads. Calls for ranges of the same
+     * proportions therefore process the same parts of the data on the same threads,
+     * which keeps memory that was first touched by a thread on that thread's NUMA node
+     * (see \a HugePageAllocator). */
+    template<typename FUNC>
+    void parallelForStatic(size_t n, size_t granularity, FUNC func)
+    {
+        granularity = std::max(granularity, size_t(1));
+        size_t parts = std::min((n + granularity - 1) / granularity, threadCount() + 1);
+        if (parts < 2 || isWorkerThread()) {
+            func(size_t(0), n);
+            return;
+        }
+        auto boundary = [=] (size_t p) -> size_t {
+            if (p == parts)
+                return n;
+            // p * n / parts without overflow, rounded down to the granularity
+            size_t b = (n / parts) * p + (n % parts) * p / parts;
+            return b / granularity * granularity;
+        };
+
+        std::exception_ptr exception;
+        std::mutex doneMutex;
+        std::condition_variable doneCondition;
+        size_t activeHelpers = parts - 1;
+        auto processPart = [&] (size_t p) {
+            size_t begin = boundary(p);
+            size_t end = boundary(p + 1);
+            if (begin >= end)
+                return;
+            try {
+                func(begin, end);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(doneMutex);
+                if (!exception)
+                    exception = std::current_exception();
+            }
+        };
+        for (size_t p = 1; p < parts; p++) {
+            submit(p - 1, [&, p] () {
+                processPart(p);
+                std::lock_guard<std::mutex> lock(doneMutex);
+                if (--activeHelpers == 0)
+                    doneCondition.notify_one();
+            });
+        }
+        processPart(0);
+        {
+            std::unique_lock<std::mutex> lock(doneMutex);
+            doneCondition.wait(lock, [&] { return activeHelpers == 0; });
+        }
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+};
+
+/*! \cond */
+inline std::atomic<int>& globalExecutionPolicy()
+{
+    static std::atomic<int> policy(Sequential);
+    return policy;
+}
+
+inline int& threadExecutionPolicy()
+{
+    static thread_local int policy = -1;
+    return policy;
+}
+/*! \endcond */
+
+/*! \brief Returns the execution policy that is used by all array operations that
+ * are called without an explicit policy, e.g. operators. This is the policy set
+ * for the current thread, if any, and otherwise the global default. */
+inline ExecutionPolicy defaultExecutionPolicy()
+{
+    int p = threadExecutionPolicy();
+    return static_cast<ExecutionPolicy>(p >= 0 ? p : globalExecutionPolicy().load());
+}
+
+/*! \brief Sets the global default execution policy. The initial policy is \a Sequential. */
+inline void setDefaultExecutionPolicy(ExecutionPolicy policy)
+{
+    globalExecutionPolicy().store(policy);
+}
+
+/*! \brief Sets the default execution policy for the current thread, overriding the global
+ * default. */
+inline void setThreadDefaultExecutionPolicy(ExecutionPolicy policy)
+{
+    threadExecutionPolicy() = policy;
+}
+
+/*! \brief Sets the default execution policy of the current thread for the lifetime of
+ * this object, e.g. to run operators on arrays in parallel within a scope. */
+class ExecutionPolicyScope
+{
+private:
+    int _previousPolicy;
+
+public:
+    /*! \brief Constructor. */
+    explicit ExecutionPolicyScope(ExecutionPolicy policy) : _previousPolicy(threadExecutionPolicy())
+    {
+        threadExecutionPolicy() = policy;
+    }
+
+    /*! \brief Destructor. Restores the previous policy. */
+    ~ExecutionPolicyScope()
+    {
+        threadExecutionPolicy() = _previousPolicy;
+    }
+
+    ExecutionPolicyScope(const ExecutionPolicyScope&) = delete;
+    ExecutionPolicyScope& operator=(const ExecutionPolicyScope&) = delete;
+};
+
+/*! \brief Ranges with fewer items than this are always processed sequentially,
+ * since the overhead of parallelization would outweigh its benefits. */
+constexpr size_t parallelMinimumSize = 32768;
+
+/*! \brief Call \a func(begin, end) for chunks that cover the range [0, n) according
+ * to the execution \a policy. Chunk boundaries are multiples of \a granularity. */
+template<typename FUNC>
+void parallelFor(ExecutionPolicy policy, size_t n, size_t granularity, FUNC func)
+{
+    if (policy == Sequential || n < parallelMinimumSize)
+        func(size_t(0), n);
+    else
+        ThreadPool::instance().parallelFor(n, granularity, func);
+}
+
+/*! \brief Like \a parallelFor(), but with the static partitioning of
+ * \a ThreadPool::parallelForStatic(). This is used for operations whose cost is the
+ * same for all items, so that they process their data on the threads that first
+ * touched it. */
+template<typename FUNC>
+void parallelForStatic(ExecutionPolicy policy, size_t n, size_t granularity, FUNC func)
+{
+    if (policy == Sequential || n < parallelMinimumSize)
+        func(size_t(0), n);
+    else
+        ThreadPool::instance().parallelForStatic(n, granularity, func);
+}
+
+/*! \cond */
+#if defined(__clang__)
+# define TGD_PRAGMA_UNSEQUENCED _Pragma("clang loop vectorize(enable)")
+#elif defined(__GNUC__)
+# define TGD_PRAGMA_UNSEQUENCED _Pragma("GCC ivdep")
+#else
+# define TGD_PRAGMA_UNSEQUENCED
+#endif
+
+/* Call func(i) for i in [begin, end); for the unsequenced policy, the compiler may
+ * assume that iterations are independent. */
+template<typename FUNC>
+inline void forRange(ExecutionPolicy policy, size_t begin, size_t end, FUNC func)
+{
+    if (policy == ParallelUnsequenced) {
+        TGD_PRAGMA_UNSEQUENCED
+        for (size_t i = begin; i < end; i++)
+            func(i);
+    } else {
+        for (size_t i = begin; i < end; i++)
+            func(i);
+    }
+}
+/*! \endcond */
+
+}
+
+#endif
@@ -0,0 +1,801 @@
+/*
+ * Copyright (C) 2018, 2019, 2020, 2021, 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TGD_STATISTICS_HPP
+#define TGD_STATISTICS_HPP
+
+/**
+ * \file statistics.hpp
+ * \brief Statistics, histograms and quantiles of array components, and differences of arrays.
+ */
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+#include "array.hpp"
+#include "parallel.hpp"
+
+namespace TGD {
+
+/*! \brief Statistics of one component of an array.
+ *
+ * Only finite values are taken into account for minimum, maximum, mean and
+ * variance. Partial statistics can be combined with \a merge(), so that
+ * statistics of large data sets can be computed in parts. The mean and the sum
+ * of squared deviations are updated with the method of Chan et al., which is
+ * numerically stable. */
+class ComponentStatistics
+{
+public:
+    /*! \brief Number of values. */
+    size_t count;
+    /*! \brief Number of finite values. */
+    size_t finiteCount;
+    /*! \brief Number of NaN values. */
+    size_t nanCount;
+    /*! \brief Minimum finite value, or NaN if there is none. */
+    double minimum;
+    /*! \brief Maximum finite value, or NaN if there is none. */
+    double maximum;
+    /*! \brief Sum of finite values. */
+    double sum;
+    /*! \brief Mean of finite values, or NaN if there is none. */
+    double mean;
+    /*! \brief Sum of squared deviations of finite values from the mean. */
+    double m2;
+
+    /*! \brief Constructor for empty statistics. */
+    ComponentStatistics() :
+        count(0), finiteCount(0), nanCount(0),
+        minimum(std::numeric_limits<double>::quiet_NaN()),
+        maximum(std::numeric_limits<double>::quiet_NaN()),
+        sum(0.0),
+        mean(std::numeric_limits<double>::quiet_NaN()),
+        m2(0.0)
+    {
+    }
+
+    /*! \brief Returns the number of values that are not finite. */
+    size_t invalidCount() const
+    {
+        return count - finiteCount;
+    }
+
+    /*! \brief Returns the number of infinite values. */
+    size_t infCount() const
+    {
+        return count - finiteCount - nanCount;
+    }
+
+    /*! \brief Returns the sample variance of the finite values, or NaN if there are none. */
+    double variance() const
+    {
+        return (finiteCount > 1 ? m2 / (finiteCount - 1)
+                : finiteCount == 1 ? 0.0
+                : std::numeric_limits<double>::quiet_NaN());
+    }
+
+    /*! \brief Returns the sample standard deviation of the finite values, or NaN if there are none. */
+    double deviation() const
+    {
+        return std::sqrt(variance());
+    }
+
+    /*! \brief Add a single \a value. */
+    void add(double value)
+    {
+        ComponentStatistics s;
+        s.count = 1;
+        if (std::isfinite(value)) {
+            s.finiteCount = 1;
+            s.minimum = s.maximum = s.sum = s.mean = value;
+        } else if (std::isnan(value)) {
+            s.nanCount = 1;
+        }
+        merge(s);
+    }
+
+    /*! \brief Merge the statistics \a s into these statistics. */
+    void merge(const ComponentStatistics& s)
+    {
+        count += s.count;
+        nanCount += s.nanCount;
+        if (s.finiteCount == 0)
+            return;
+        if (finiteCount == 0) {
+            finiteCount = s.finiteCount;
+            minimum = s.minimum;
+            maximum = s.maximum;
+            sum = s.sum;
+            mean = s.mean;
+            m2 = s.m2;
+            return;
+        }
+        double n = double(finiteCount) + double(s.finiteCount);
+        double delta = s.mean - mean;
+        mean += delta * (s.finiteCount / n);
+        m2 += s.m2 + delta * delta * (double(finiteCount) * double(s.finiteCount) / n);
+        finiteCount += s.finiteCount;
+        minimum = std::min(minimum, s.minimum);
+        maximum = std::max(maximum, s.maximum);
+        sum += s.sum;
+    }
+};
+
+/*! \brief Summary of the distribution of the finite values of one component,
+ * for quantiles such as the median or percentiles.
+ *
+ * Values of 8 and 16 bit integer types are counted exactly, so that quantiles
+ * are exact. Other values are counted in buckets whose bounds grow
+ * geometrically, so that each quantile is estimated with a relative error of
+ * at most the accuracy given to the constructor, and the size of the sketch
+ * only depends on the range of magnitudes of the values (see Masson et al.,
+ * DDSketch, 2019). Sketches can be combined with \a merge(), in any order. */
+class QuantileSketch
+{
+private:
+    class Buckets
+    {
+    public:
+        int64_t offset;
+        std::vector<size_t> counts;
+
+        Buckets() : offset(0) {}
+
+        void add(int64_t key, size_t n)
+        {
+            if (counts.size() == 0) {
+                offset = key;
+                counts.resize(1, 0);
+            } else if (key < offset) {
+                counts.insert(counts.begin(), size_t(offset - key), 0);
+                offset = key;
+            } else if (key >= offset + int64_t(counts.size())) {
+                counts.resize(size_t(key - offset + 1), 0);
+            }
+            counts[size_t(key - offset)] += n;
+        }
+
+        void merge(const Buckets& b)
+        {
+            for (size_t i = 0; i < b.counts.size(); i++)
+                if (b.counts[i] > 0)
+                    add(b.offset + int64_t(i), b.counts[i]);
+        }
+    };
+
+    double _gamma;
+    double _logGamma;
+    size_t _count;
+    size_t _zeroCount;
+    Buckets _exact;     // exactly counted integer values
+    Buckets _positive;  // bucket k counts values in (gamma^(k-1), gamma^k]
+    Buckets _negative;  // the same for the magnitudes of negative values
+
+    int64_t key(double magnitude) const
+    {
+        return int64_t(std::ceil(std::log(magnitude) / _logGamma));
+    }
+
+    double value(int64_t key) const
+    {
+        // the value with the smallest maximum relative error in the bucket
+        return 2.0 * std::pow(_gamma, double(key)) / (_gamma + 1.0);
+    }
+
+public:
+    /*! \brief Constructor for an empty sketch with the given relative \a accuracy. */
+    explicit QuantileSketch(double accuracy = 0.01) :
+        _gamma((1.0 + accuracy) / (1.0 - accuracy)),
+        _logGamma(std::log(_gamma)),
+        _count(0), _zeroCount(0)
+    {
+    }
+
+    /*! \brief Returns the number of finite values in the sketch. */
+    size_t count() const
+    {
+        return _count;
+    }
+
+    /*! \brief Add a single \a value. Values that are not finite are ignored. */
+    void add(double value)
+    {
+        if (!std::isfinite(value))
+            return;
+        _count++;
+        if (value > 0.0)
+            _positive.add(key(value), 1);
+        else if (value < 0.0)
+            _negative.add(key(-value), 1);
+        else
+            _zeroCount++;
+    }
+
+    /*! \brief Add \a n values starting at \a p, with a stride of \a s values. */
+    template<typename T>
+    void add(const T* p, size_t n, ptrdiff_t s)
+    {
+        if constexpr (std::is_integral<T>::value && sizeof(T) <= 2) {
+            if (_exact.counts.size() == 0) {
+                _exact.offset = std::numeric_limits<T>::min();
+                _exact.counts.resize(size_t(1) << (8 * sizeof(T)), 0);
+            }
+            for (size_t i = 0; i < n; i++)
+                _exact.counts[size_t(int64_t(p[ptrdiff_t(i) * s]) - _exact.offset)]++;
+            _count += n;
+        } else {
+            for (size_t i = 0; i < n; i++)
+                add(double(p[ptrdiff_t(i) * s]));
+        }
+    }
+
+    /*! \brief Merge the sketch \a q into this sketch. Both must have the same accuracy. */
+    void merge(const QuantileSketch& q)
+    {
+        _count += q._count;
+        _zeroCount += q._zeroCount;
+        _exact.merge(q._exact);
+        _positive.merge(q._positive);
+        _negative.merge(q._negative);
+    }
+
+    /*! \brief Returns the estimated \a q-quantile for \a q in [0,1], e.g. 0.5 for the median,
+     * or NaN if the sketch is empty. */
+    double quantile(double q) const
+    {
+        if (_count == 0)
+            return std::numeric_limits<double>::quiet_NaN();
+        q = std::min(1.0, std::max(0.0, q));
+        size_t rank = size_t(q * double(_count - 1));
+        size_t n = 0;
+        for (size_t i = _negative.counts.size(); i > 0; i--) {
+            n += _negative.counts[i - 1];
+            if (n > rank)
+                return -value(_negative.offset + int64_t(i - 1));
+        }
+        n += _zeroCount;
+        if (n > rank)
+            return 0.0;
+        for (size_t i = 0; i < _exact.counts.size(); i++) {
+            n += _exact.counts[i];
+            if (n > rank)
+                return double(_exact.offset + int64_t(i));
+        }
+        for (size_t i = 0; i < _positive.counts.size(); i++) {
+            n += _positive.counts[i];
+            if (n > rank)
+                return value(_positive.offset + int64_t(i));
+        }
+        return value(_positive.offset + int64_t(_positive.counts.size()) - 1);
+    }
+};
+
+/*! \brief Statistics of the differences between the values of two arrays.
+ *
+ * Differences are computed in double precision from the original values.
+ * Differences that are not finite, e.g. between infinity and a finite value,
+ * are counted in \a nonFiniteCount but not included in \a maxAbs and the RMSE.
+ * Values that are equal, including NaN and NaN, do not differ. */
+class DifferenceStatistics
+{
+public:
+    /*! \brief Number of compared values. */
+    size_t count;
+    /*! \brief Number of values that differ. */
+    size_t differingCount;
+    /*! \brief Number of differing values whose difference is not finite. */
+    size_t nonFiniteCount;
+    /*! \brief Maximum absolute finite difference. */
+    double maxAbs;
+    /*! \brief Sum of the squares of the finite differences. */
+    double sumOfSquares;
+
+    /*! \brief Constructor for empty statistics. */
+    DifferenceStatistics() :
+        count(0), differingCount(0), nonFiniteCount(0), maxAbs(0.0), sumOfSquares(0.0)
+    {
+    }
+
+    /*! \brief Returns the mean squared finite difference, or zero if there is none. */
+    double mse() const
+    {
+        size_t n = count - nonFiniteCount;
+        return (n > 0 ? sumOfSquares / n : 0.0);
+    }
+
+    /*! \brief Returns the root of the mean squared finite difference. */
+    double rmse() const
+    {
+        return std::sqrt(mse());
+    }
+
+    /*! \brief Returns the peak signal-to-noise ratio in dB for the given \a peak value,
+     * or infinity if there is no finite difference, see \a differencePeak(). */
+    double psnr(double peak) const
+    {
+        double m = mse();
+        return (m > 0.0 ? 10.0 * std::log10(peak * peak / m) : std::numeric_limits<double>::infinity());
+    }
+
+    /*! \brief Merge the statistics \a s into these statistics. */
+    void merge(const DifferenceStatistics& s)
+    {
+        count += s.count;
+        differingCount += s.differingCount;
+        nonFiniteCount += s.nonFiniteCount;
+        maxAbs = std::max(maxAbs, s.maxAbs);
+        sumOfSquares += s.sumOfSquares;
+    }
+};
+
+/*! \brief Returns the peak value for PSNR computations with the given type: the size of
+ * its value range for integer types, and 1 for floating point types (values in [0,1]). */
+inline double differencePeak(Type t)
+{
+    switch (t) {
+    case int8:
+    case uint8:
+        return 255.0;
+    case int16:
+    case uint16:
+        return 65535.0;
+    case int32:
+    case uint32:
+        return 4294967295.0;
+    case int64:
+    case uint64:
+        return 18446744073709551615.0;
+    case float32:
+    case float64:
+    case float16:
+    case bfloat16:
+        break;
+    }
+    return 1.0;
+}
+
+/*! \cond */
+/* Values are processed in blocks this small so that the two passes over each
+ * block (sum, then squared deviations) hit the cache. */
+constexpr size_t statisticsBlockSize = 4096;
+/* Number of elements that are processed as one task in parallel computations. */
+constexpr size_t statisticsTaskSize = 65536;
+
+template<typename T>
+inline bool statisticsIsFinite(T v)
+{
+    if constexpr (!std::numeric_limits<T>::is_integer)
+        return std::isfinite(v);
+    else
+        return true;
+}
+
+/* Statistics of n values starting at p, with a stride of s values */
+template<typename T>
+ComponentStatistics statisticsOfValues(const T* p, size_t n, ptrdiff_t s)
+{
+    ComponentStatistics r;
+    for (size_t b = 0; b < n; b += statisticsBlockSize) {
+        const T* q = p + ptrdiff_t(b) * s;
+        size_t m = std::min(statisticsBlockSize, n - b);
+        ComponentStatistics block;
+        block.count = m;
+        size_t k = 0;
+        size_t nans = 0;
+        T lo = std::numeric_limits<T>::max();
+        T hi = std::numeric_limits<T>::lowest();
+        double sum = 0.0;
+        for (size_t i = 0; i < m; i++) {
+            T v = q[ptrdiff_t(i) * s];
+            if (statisticsIsFinite(v)) {
+                k++;
+                lo = std::min(lo, v);
+                hi = std::max(hi, v);
+                sum += v;
+            } else if (v != v) {
+                nans++;
+            }
+        }
+        block.nanCount = nans;
+        if (k > 0) {
+            double mean = sum / k;
+            double m2 = 0.0;
+            for (size_t i = 0; i < m; i++) {
+                T v = q[ptrdiff_t(i) * s];
+                if (statisticsIsFinite(v)) {
+                    double d = v - mean;
+                    m2 += d * d;
+                }
+            }
+            block.finiteCount = k;
+            block.minimum = lo;
+            block.maximum = hi;
+            block.sum = sum;
+            block.mean = mean;
+            block.m2 = m2;
+        }
+        r.merge(block);
+    }
+    return r;
+}
+
+/* Call func(task) for tasks in [0, n) according to the execution policy. */
+template<typename FUNC>
+void statisticsForTasks(ExecutionPolicy policy, size_t n, FUNC func)
+{
+    if (policy == Sequential || n < 2) {
+        for (size_t t = 0; t < n; t++)
+            func(t);
+    } else {
+        ThreadPool::instance().parallelForStatic(n, 1, [&] (size_t begin, size_t end) {
+                for (size_t t = begin; t < end; t++)
+                    func(t);
+            });
+    }
+}
+
+/* Values of a view are processed in tasks: contiguous views are split into
+ * tasks of statisticsTaskSize elements, other views into groups of rows along
+ * dimension 0. Results of tasks must be merged in task order so that the
+ * result does not depend on the execution policy. */
+inline size_t statisticsRowsPerTask(const ArrayView& v)
+{
+    return std::max(size_t(1), statisticsTaskSize / v.dimension(0));
+}
+
+inline size_t statisticsTaskCount(const ArrayView& v)
+{
+    if (v.elementCount() == 0 || v.componentCount() == 0)
+        return 0;
+    else if (v.isContiguous())
+        return (v.elementCount() + statisticsTaskSize - 1) / statisticsTaskSize;
+    else
+        return (v.elementCount() / v.dimension(0) + statisticsRowsPerTask(v) - 1) / statisticsRowsPerTask(v);
+}
+
+/* Calls func(const T* p, size_t n, ptrdiff_t stride, size_t component, size_t task)
+ * for all runs of values of task t of view v */
+template<typename T, typename FUNC>
+void statisticsForRunsOfTask(const ArrayView& v, size_t t, FUNC& func)
+{
+    const size_t cc = v.componentCount();
+    if (v.isContiguous()) {
+        const T* base = static_cast<const T*>(v.container().data());
+        const size_t n = v.elementCount();
+        size_t begin = t * statisticsTaskSize;
+        size_t m = std::min(statisticsTaskSize, n - begin);
+        for (size_t c = 0; c < cc; c++)
+            func(base + begin * cc + c, m, ptrdiff_t(cc), c, t);
+    } else {
+        const size_t rowLength = v.dimension(0);
+        const size_t rowCount = v.elementCount() / rowLength;
+        const size_t rowsPerTask = statisticsRowsPerTask(v);
+        const ptrdiff_t stride = v.stride(0) / ptrdiff_t(sizeof(T));
+        size_t firstRow = t * rowsPerTask;
+        size_t lastRow = std::min(firstRow + rowsPerTask, rowCount);
+        std::vector<size_t> index(v.dimensionCount(), 0);
+        size_t r = firstRow;
+        for (size_t d = 1; d < v.dimensionCount(); d++) {
+            index[d] = r % v.dimension(d);
+            r /= v.dimension(d);
+        }
+        for (size_t row = firstRow; row < lastRow; row++) {
+            for (size_t c = 0; c < cc; c++)
+                func(static_cast<const T*>(v.get(index, c)), rowLength, stride, c, t);
+            ArrayView::incrementIndex(v.dimensions(), index, 1);
+        }
+    }
+}
+
+/* Calls func(const T* p, size_t n, ptrdiff_t stride, size_t component, size_t task)
+ * for all runs of values of view v */
+template<typename T, typename FUNC>
+void statisticsForRuns(ExecutionPolicy policy, const ArrayView& v, FUNC func)
+{
+    statisticsForTasks(policy, statisticsTaskCount(v), [&] (size_t t) {
+            statisticsForRunsOfTask<T>(v, t, func);
+        });
+}
+
+template<typename T>
+std::vector<ComponentStatistics> statisticsHelper(ExecutionPolicy policy, const ArrayView& v)
+{
+    const size_t cc = v.componentCount();
+    const size_t taskCount = statisticsTaskCount(v);
+    std::vector<ComponentStatistics> taskStatistics(taskCount * cc);
+    statisticsForRuns<T>(policy, v,
+            [&] (const T* p, size_t n, ptrdiff_t s, size_t c, size_t t) {
+                taskStatistics[t * cc + c].merge(statisticsOfValues(p, n, s));
+            });
+    std::vector<ComponentStatistics> r(cc);
+    for (size_t t = 0; t < taskCount; t++)
+        for (size_t c = 0; c < cc; c++)
+            r[c].merge(taskStatistics[t * cc + c]);
+    return r;
+}
+
+template<typename T>
+std::vector<size_t> histogramHelper(ExecutionPolicy policy, const ArrayView& v,
+        size_t component, size_t bins, double minVal, double maxVal)
+{
+    std::vector<size_t> r(bins, 0);
+    if (bins == 0 || !(maxVal >= minVal))
+        return r;
+    ArrayView cv = v.components({ component });
+    const size_t taskCount = statisticsTaskCount(cv);
+    std::vector<std::vector<size_t>> taskHistograms(taskCount);
+    const double scale = (maxVal > minVal ? bins / (maxVal - minVal) : 0.0);
+    statisticsForRuns<T>(policy, cv,
+            [&] (const T* p, size_t n, ptrdiff_t s, size_t, size_t t) {
+                std::vector<size_t>& h = taskHistograms[t];
+                if (h.size() == 0)
+                    h.resize(bins, 0);
+                for (size_t i = 0; i < n; i++) {
+                    double val = p[ptrdiff_t(i) * s];
+                    if (val >= minVal && val <= maxVal) {
+                        size_t bin = std::min(size_t((val - minVal) * scale), bins - 1);
+                        h[bin]++;
+                    }
+                }
+            });
+    for (size_t t = 0; t < taskCount; t++)
+        for (size_t b = 0; b < taskHistograms[t].size(); b++)
+            r[b] += taskHistograms[t][b];
+    return r;
+}
+
+/* Sketches only count values, so the order of merging does not matter, and each
+ * chunk of tasks can accumulate into its own sketches. */
+template<typename T>
+std::vector<QuantileSketch> quantileSketchesHelper(ExecutionPolicy policy, const ArrayView& v, double accuracy)
+{
+    const size_t cc = v.componentCount();
+    const size_t taskCount = statisticsTaskCount(v);
+    std::vector<QuantileSketch> r(cc, QuantileSketch(accuracy));
+    std::mutex mutex;
+    auto chunk = [&] (size_t begin, size_t end) {
+        std::vector<QuantileSketch> local(cc, QuantileSketch(accuracy));
+        auto func = [&] (const T* p, size_t n, ptrdiff_t s, size_t c, size_t) {
+            local[c].add(p, n, s);
+        };
+        for (size_t t = begin; t < end; t++)
+            statisticsForRunsOfTask<T>(v, t, func);
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t c = 0; c < cc; c++)
+            r[c].merge(local[c]);
+    };
+    if (policy == Sequential || taskCount < 2)
+        chunk(0, taskCount);
+    else
+        ThreadPool::instance().parallelForStatic(taskCount, 1, chunk);
+    return r;
+}
+
+/* The absolute difference of x and y in type T. For integers, it is computed
+ * exactly and saturates to the maximum of T. */
+template<typename T>
+inline T absoluteDifferenceOf(T x, T y)
+{
+    if constexpr (!std::numeric_limits<T>::is_integer) {
+        return std::abs(x - y);
+    } else {
+        typedef typename std::make_unsigned<T>::type U;
+        U d = (x > y ? U(U(x) - U(y)) : U(U(y) - U(x)));
+        return (d > U(std::numeric_limits<T>::max()) ? std::numeric_limits<T>::max() : T(d));
+    }
+}
+
+/* Difference statistics of n values, optionally storing the absolute differences in d */
+template<typename T, bool STORE>
+DifferenceStatistics differenceOfValues(const T* a, const T* b, T* d, size_t n)
+{
+    DifferenceStatistics r;
+    r.count = n;
+    size_t differing = 0;
+    double maxAbs = 0.0;
+    double sumOfSquares = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        T x = a[i];
+        T y = b[i];
+        if constexpr (STORE)
+            d[i] = absoluteDifferenceOf(x, y);
+        bool differ;
+        if constexpr (!std::numeric_limits<T>::is_integer)
+            differ = !(x == y || (x != x && y != y));
+        else
+            differ = (x != y);
+        if (differ) {
+            differing++;
+            double e = std::abs(double(x) - double(y));
+            if (std::isfinite(e)) {
+                maxAbs = std::max(maxAbs, e);
+                sumOfSquares += e * e;
+            } else {
+                r.nonFiniteCount++;
+            }
+        }
+    }
+    r.differingCount = differing;
+    r.maxAbs = maxAbs;
+    r.sumOfSquares = sumOfSquares;
+    return r;
+}
+
+/* Results of tasks are merged in task order, so the sum of squares does not
+ * depend on the number of threads */
+template<typename T>
+DifferenceStatistics differenceStatisticsHelper(ExecutionPolicy policy,
+        const ArrayContainer& a, const ArrayContainer& b, ArrayContainer* absoluteDifference)
+{
+    const size_t n = a.elementCount() * a.componentCount();
+    const size_t taskCount = (n + statisticsTaskSize - 1) / statisticsTaskSize;
+    const T* pa = static_cast<const T*>(a.data());
+    const T* pb = static_cast<const T*>(b.data());
+    T* pd = nullptr;
+    if (absoluteDifference) {
+        *absoluteDifference = ArrayContainer(a.description());
+        pd = static_cast<T*>(absoluteDifference->data());
+    }
+    std::vector<DifferenceStatistics> taskStats(taskCount);
+    statisticsForTasks(policy, taskCount, [&] (size_t t) {
+            size_t begin = t * statisticsTaskSize;
+            size_t m = std::min(statisticsTaskSize, n - begin);
+            taskStats[t] = (pd
+                    ? differenceOfValues<T, true>(pa + begin, pb + begin, pd + begin, m)
+                    : differenceOfValues<T, false>(pa + begin, pb + begin, nullptr, m));
+        });
+    DifferenceStatistics r;
+    for (size_t t = 0; t < taskCount; t++)
+        r.merge(taskStats[t]);
+    return r;
+}
+
+template<typename T>
+bool equalValuesHelper(ExecutionPolicy policy, const ArrayContainer& a, const ArrayContainer& b)
+{
+    const size_t n = a.elementCount() * a.componentCount();
+    const size_t taskCount = (n + statisticsTaskSize - 1) / statisticsTaskSize;
+    const T* pa = static_cast<const T*>(a.data());
+    const T* pb = static_cast<const T*>(b.data());
+    std::atomic<bool> differ(false);
+    statisticsForTasks(policy, taskCount, [&] (size_t t) {
+            if (differ.load(std::memory_order_relaxed))
+                return;
+            size_t begin = t * statisticsTaskSize;
+            size_t m = std::min(statisticsTaskSize, n - begin);
+            if (std::memcmp(pa + begin, pb + begin, m * sizeof(T)) == 0)
+                return;
+            // floating point values can be equal with different bits, e.g. 0 and -0
+            if (std::numeric_limits<T>::is_integer
+                    || differenceOfValues<T, false>(pa + begin, pb + begin, nullptr, m).differingCount > 0)
+                differ.store(true, std::memory_order_relaxed);
+        });
+    return !differ.load();
+}
+/*! \endcond */
+
+/*! \brief Compute statistics for each component of the view \a v using the execution \a policy.
+ * The computation works on the original component type. The result does not
+ * depend on the policy. */
+inline std::vector<ComponentStatistics> statistics(ExecutionPolicy policy, const ArrayView& v)
+{
+    return visitType(v.componentType(), [&] (auto tag) {
+            return statisticsHelper<typename decltype(tag)::type>(policy, v);
+        });
+}
+
+/*! \brief Compute statistics for each component of the view \a v using the default execution policy. */
+inline std::vector<ComponentStatistics> statistics(const ArrayView& v)
+{
+    return statistics(defaultExecutionPolicy(), v);
+}
+
+/*! \brief Compute a histogram of component \a component of the view \a v using the execution \a policy.
+ * The range [\a minVal, \a maxVal] is divided into \a bins bins of equal size. Values
+ * outside of this range and values that are not finite are not counted. */
+inline std::vector<size_t> histogram(ExecutionPolicy policy, const ArrayView& v,
+        size_t component, size_t bins, double minVal, double maxVal)
+{
+    return visitType(v.componentType(), [&] (auto tag) {
+            return histogramHelper<typename decltype(tag)::type>(policy, v, component, bins, minVal, maxVal);
+        });
+}
+
+/*! \brief Compute a histogram of component \a component of the view \a v using the default execution policy.
+ * See the corresponding function with a policy. */
+inline std::vector<size_t> histogram(const ArrayView& v,
+        size_t component, size_t bins, double minVal, double maxVal)
+{
+    return histogram(defaultExecutionPolicy(), v, component, bins, minVal, maxVal);
+}
+
+/*! \brief Compute a quantile sketch with the given relative \a accuracy for each component
+ * of the view \a v using the execution \a policy. The computation works on the
+ * original component type. The result does not depend on the policy. */
+inline std::vector<QuantileSketch> quantileSketches(ExecutionPolicy policy, const ArrayView& v,
+        double accuracy = 0.01)
+{
+    return visitType(v.componentType(), [&] (auto tag) {
+            return quantileSketchesHelper<typename decltype(tag)::type>(policy, v, accuracy);
+        });
+}
+
+/*! \brief Compute a quantile sketch for each component of the view \a v using the default
+ * execution policy. See the corresponding function with a policy. */
+inline std::vector<QuantileSketch> quantileSketches(const ArrayView& v, double accuracy = 0.01)
+{
+    return quantileSketches(defaultExecutionPolicy(), v, accuracy);
+}
+
+
+/*! \brief Compute the statistics of the differences between the values of the
+ * compatible arrays \a a and \a b using the execution \a policy, see \a ArrayDescription::isCompatible().
+ * The computation works on the original component type. If \a absoluteDifference is not nullptr,
+ * it is set to an array with the description of \a a that holds the absolute differences in the
+ * same pass; for integer types, these are exact and saturate to the maximum of the type.
+ * The result does not depend on the policy. */
+inline DifferenceStatistics differenceStatistics(ExecutionPolicy policy,
+        const ArrayContainer& a, const ArrayContainer& b, ArrayContainer* absoluteDifference = nullptr)
+{
+    return visitType(a.componentType(), [&] (auto tag) {
+            return differenceStatisticsHelper<typename decltype(tag)::type>(policy, a, b, absoluteDifference);
+        });
+}
+
+/*! \brief Compute difference statistics using the default execution policy.
+ * See the corresponding function with a policy. */
+inline DifferenceStatistics differenceStatistics(const ArrayContainer& a, const ArrayContainer& b,
+        ArrayContainer* absoluteDifference = nullptr)
+{
+    return differenceStatistics(defaultExecutionPolicy(), a, b, absoluteDifference);
+}
+
+/*! \brief Returns whether the compatible arrays \a a and \a b have equal values, using the
+ * execution \a policy. This stops early at the first part of the data that differs.
+ * Floating point values are compared by value, so 0 and -0 are equal, and NaN equals NaN. */
+inline bool equalValues(ExecutionPolicy policy, const ArrayContainer& a, const ArrayContainer& b)
+{
+    return visitType(a.componentType(), [&] (auto tag) {
+            return equalValuesHelper<typename decltype(tag)::type>(policy, a, b);
+        });
+}
+
+/*! \brief Returns whether two arrays have equal values using the default execution policy.
+ * See the corresponding function with a policy. */
+inline bool equalValues(const ArrayContainer& a, const ArrayContainer& b)
+{
+    return equalValues(defaultExecutionPolicy(), a, b);
+}
+
+}
+
+#endif
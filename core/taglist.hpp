@@ -34,16 +34,56 @@
 #include <cerrno>
 #include <string>
 #include <limits>
-#include <map>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <algorithm>
 #include <initializer_list>
 
 namespace TGD {
 
-/*! \brief A tag list to store key/value pairs, where both key and value are strings. */
+/*! \brief A tag list to store key/value pairs, where both key and value are strings.
+ *
+ * The pairs are kept sorted by key in a flat vector that is shared between copies
+ * of a tag list and only copied when one of them is modified. Copying a tag list
+ * is therefore cheap, and empty tag lists do not allocate memory. */
 class TagList
 {
 private:
-    std::map<std::string, std::string> _tags;
+    typedef std::vector<std::pair<std::string, std::string>> Tags;
+    std::shared_ptr<Tags> _tags;
+
+    static const Tags& emptyTags()
+    {
+        static const Tags empty;
+        return empty;
+    }
+
+    const Tags& tags() const
+    {
+        return (_tags ? *_tags : emptyTags());
+    }
+
+    // Get exclusive ownership of the tags before modifying them
+    Tags& mutableTags()
+    {
+        if (!_tags)
+            _tags = std::make_shared<Tags>();
+        else if (_tags.use_count() > 1)
+            _tags = std::make_shared<Tags>(*_tags);
+        return *_tags;
+    }
+
+    static bool keyLess(const std::pair<std::string, std::string>& tag, const std::string& key)
+    {
+        return tag.first < key;
+    }
+
+    static Tags::const_iterator find(const Tags& t, const std::string& key)
+    {
+        auto it = std::lower_bound(t.cbegin(), t.cend(), key, keyLess);
+        return (it != t.cend() && it->first == key ? it : t.cend());
+    }
 
     // Conversion helper: generic string to type function
     template<typename T> static T strtox(const char* nptr, char** endptr, int base)
@@ -143,42 +183,52 @@ public:
     }
 
     /*! \brief Returns the number of key/value pairs in this tag list. */
-    size_t size() const { return _tags.size(); }
-    /*! \brief Iterator, for accessing all key/value pairs in this tag list. */
-    std::map<std::string, std::string>::const_iterator cbegin() const noexcept { return _tags.cbegin(); }
-    /*! \brief Iterator, for accessing all key/value pairs in this tag list. */
-    std::map<std::string, std::string>::const_iterator cend() const noexcept { return _tags.cend(); }
+    size_t size() const { return tags().size(); }
+    /*! \brief Iterator, for accessing all key/value pairs in this tag list in the order of their keys. */
+    Tags::const_iterator cbegin() const noexcept { return tags().cbegin(); }
+    /*! \brief Iterator, for accessing all key/value pairs in this tag list in the order of their keys. */
+    Tags::const_iterator cend() const noexcept { return tags().cend(); }
 
     /*! \brief Clear the tag list. */
     void clear()
     {
-        _tags.clear();
+        _tags.reset();
     }
 
     /*! \brief Set a \a key to a \a value. */
     void set(const std::string& key, const std::string& value)
     {
-        _tags.erase(key);
-        _tags.insert(std::make_pair(sanitize(key), sanitize(value)));
+        std::string k = sanitize(key);
+        Tags& t = mutableTags();
+        auto it = std::lower_bound(t.begin(), t.end(), k, keyLess);
+        if (it != t.end() && it->first == k)
+            it->second = sanitize(value);
+        else
+            t.insert(it, std::make_pair(std::move(k), sanitize(value)));
     }
 
     /*! \brief Unset a \a key. */
     void unset(const std::string& key)
     {
-        _tags.erase(key);
+        auto it = find(tags(), key);
+        if (it != tags().cend()) {
+            size_t i = it - tags().cbegin();
+            Tags& t = mutableTags();
+            t.erase(t.begin() + i);
+        }
     }
 
     /*! \brief Check if this list contains a given \a key. */
     bool contains(const std::string& key) const
     {
-        return (_tags.find(key) != _tags.end());
+        return (find(tags(), key) != tags().cend());
     }
 
     /*! \brief Return the value to a given \a key, or the \a defaultValue if the \a key is not set. */
     const std::string& value(const std::string& key, const std::string& defaultValue = std::string()) const
     {
-        auto it = _tags.find(key);
-        return (it == _tags.end() ? defaultValue : it->second);
+        auto it = find(tags(), key);
+        return (it == tags().cend() ? defaultValue : it->second);
     }
 
     /*! \brief Return the value to a given \a key in \a result and return true, or return false if the key is not set. */
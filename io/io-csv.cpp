@@ -23,17 +23,29 @@
  */
 
 #include <cmath>
+#include <cctype>
+#include <cstring>
 #include <limits>
 #include <locale>
+#include <charconv>
+#include <atomic>
 
 #include "io-csv.hpp"
+#include "parallel.hpp"
 
 
 namespace TGD {
 
+// Input is read in blocks of this size; lines may be longer
+static const size_t csvBlockSize = size_t(1) << 24;
+
+// Output is written in pieces of about this size
+static const size_t csvWriteSize = size_t(1) << 20;
+
 FormatImportExportCSV::FormatImportExportCSV() :
     _f(nullptr),
-    _arrayCount(-2)
+    _arrayCount(-2),
+    _bufferPos(0)
 {
 }
 
@@ -68,6 +80,37 @@ void FormatImportExportCSV::close()
         }
         _f = nullptr;
     }
+    _buffer.clear();
+    _bufferPos = 0;
+}
+
+bool FormatImportExportCSV::fillBuffer()
+{
+    // keep only the data that was not consumed yet and append the next block
+    if (_bufferPos > 0) {
+        _buffer.erase(_buffer.begin(), _buffer.begin() + _bufferPos);
+        _bufferPos = 0;
+    }
+    size_t oldSize = _buffer.size();
+    _buffer.resize(oldSize + csvBlockSize);
+    size_t n = std::fread(_buffer.data() + oldSize, 1, csvBlockSize, _f);
+    _buffer.resize(oldSize + n);
+    return (n > 0);
+}
+
+off_t FormatImportExportCSV::tell()
+{
+    off_t pos = ftello(_f);
+    if (pos < 0)
+        return pos;
+    return pos - off_t(_buffer.size() - _bufferPos);
+}
+
+bool FormatImportExportCSV::seek(off_t pos)
+{
+    _buffer.clear();
+    _bufferPos = 0;
+    return (fseeko(_f, pos, SEEK_SET) == 0);
 }
 
 int FormatImportExportCSV::arrayCount()
@@ -76,14 +119,13 @@ int FormatImportExportCSV::arrayCount()
         return _arrayCount;
 
     // find offsets of all CSVs in the file
-    off_t curPos = ftello(_f);
-    if (curPos < 0) {
+    off_t curPos = tell();
+    if (curPos < 0 || !seek(0)) {
         _arrayCount = -1;
         return _arrayCount;
     }
-    rewind(_f);
     while (hasMore()) {
-        off_t arrayPos = ftello(_f);
+        off_t arrayPos = tell();
         if (arrayPos < 0) {
             _arrayOffsets.clear();
             _arrayCount = -1;
@@ -103,7 +145,7 @@ int FormatImportExportCSV::arrayCount()
             return -1;
         }
     }
-    if (fseeko(_f, curPos, SEEK_SET) < 0) {
+    if (!seek(curPos)) {
         _arrayOffsets.clear();
         _arrayCount = -1;
         return -1;
@@ -112,21 +154,220 @@ int FormatImportExportCSV::arrayCount()
     return _arrayCount;
 }
 
-static float readFloat(const char* s, char** nextChar = nullptr)
+/* Read a float from [s, end). This behaves like std::strtof() in the "C" locale,
+ * but uses the much faster std::from_chars() for everything except hexadecimal
+ * numbers and values out of range. Returns NaN and sets *nextChar to nullptr if no
+ * value could be read. */
+static float readFloat(const char* s, const char* end, const char** nextChar)
 {
-    char* endptr = nullptr;
-    float v = std::strtof(s, &endptr);
-    if (endptr != s) {
-        if (nextChar)
-            *nextChar = endptr;
+    const char* p = s;
+    while (p < end && std::isspace(static_cast<unsigned char>(*p)))
+        p++;
+#ifdef __cpp_lib_to_chars
+    // from_chars() does not accept a plus sign
+    const char* q = (p + 1 < end && p[0] == '+' && p[1] != '-' && p[1] != '+') ? p + 1 : p;
+    float v;
+    std::from_chars_result r = std::from_chars(q, end, v);
+    if (r.ec == std::errc() && (r.ptr == end || (*r.ptr != 'x' && *r.ptr != 'X'))) {
+        *nextChar = r.ptr;
         return v;
+    }
+#endif
+    // strtof() needs a terminated string: copy the characters that can be part of a value
+    const char* tokenEnd = p;
+    while (tokenEnd < end && (std::isalnum(static_cast<unsigned char>(*tokenEnd))
+                || (*tokenEnd != '\0' && std::strchr("+-._()", *tokenEnd))))
+        tokenEnd++;
+    std::string token(p, tokenEnd);
+    char* endptr = nullptr;
+    float v2 = std::strtof(token.c_str(), &endptr);
+    if (endptr != token.c_str()) {
+        *nextChar = p + (endptr - token.c_str());
+        return v2;
     } else {
-        if (nextChar)
-            *nextChar = nullptr;
+        *nextChar = nullptr;
         return std::numeric_limits<float>::quiet_NaN();
     }
 }
 
+static size_t find(const char* line, size_t len, char c, size_t pos)
+{
+    if (pos >= len)
+        return std::string::npos;
+    const void* p = std::memchr(line + pos, c, len - pos);
+    return (p ? static_cast<const char*>(p) - line : std::string::npos);
+}
+
+/* The values of a range of lines */
+class CSVValues
+{
+public:
+    std::vector<float> values;
+    bool singleComponentElements;             // as long as this is true, componentsInElement is not used
+    std::vector<size_t> componentsInElement;
+    size_t elementCount;
+    std::vector<size_t> elementsInLine;
+    size_t maxElementsInLine;
+    size_t maxComponentsInElement;
+    float minValue;
+    float maxValue;
+    bool allValuesAreFinite;
+    bool allValuesAreInteger;
+    bool haveFiniteValue;
+    bool foundInvalidCharacter;
+
+    CSVValues() :
+        singleComponentElements(true), elementCount(0), maxElementsInLine(0), maxComponentsInElement(0),
+        minValue(0.0f), maxValue(0.0f),
+        allValuesAreFinite(true), allValuesAreInteger(true), haveFiniteValue(false),
+        foundInvalidCharacter(false)
+    {
+    }
+
+    size_t components(size_t elementIndex) const
+    {
+        return singleComponentElements ? 1 : componentsInElement[elementIndex];
+    }
+
+    void addElement(const std::vector<float>& element)
+    {
+        for (size_t k = 0; k < element.size(); k++) {
+            float v = element[k];
+            if (!std::isfinite(v)) {
+                allValuesAreFinite = false;
+                allValuesAreInteger = false;
+            } else {
+                if (!haveFiniteValue) {
+                    minValue = v;
+                    maxValue = v;
+                    haveFiniteValue = true;
+                } else if (v < minValue) {
+                    minValue = v;
+                } else if (v > maxValue) {
+                    maxValue = v;
+                }
+                if (std::nearbyint(v) != v) {
+                    allValuesAreInteger = false;
+                }
+            }
+        }
+        values.insert(values.end(), element.begin(), element.end());
+        if (element.size() != 1 && singleComponentElements) {
+            componentsInElement.assign(elementCount, 1);
+            singleComponentElements = false;
+        }
+        if (!singleComponentElements)
+            componentsInElement.push_back(element.size());
+        elementCount++;
+        maxComponentsInElement = std::max(maxComponentsInElement, element.size());
+    }
+
+    void append(const CSVValues& other)
+    {
+        values.insert(values.end(), other.values.begin(), other.values.end());
+        if (!other.singleComponentElements && singleComponentElements) {
+            componentsInElement.assign(elementCount, 1);
+            singleComponentElements = false;
+        }
+        if (!singleComponentElements) {
+            if (other.singleComponentElements)
+                componentsInElement.resize(elementCount + other.elementCount, 1);
+            else
+                componentsInElement.insert(componentsInElement.end(),
+                        other.componentsInElement.begin(), other.componentsInElement.end());
+        }
+        elementCount += other.elementCount;
+        elementsInLine.insert(elementsInLine.end(), other.elementsInLine.begin(), other.elementsInLine.end());
+        maxElementsInLine = std::max(maxElementsInLine, other.maxElementsInLine);
+        maxComponentsInElement = std::max(maxComponentsInElement, other.maxComponentsInElement);
+        if (other.haveFiniteValue) {
+            if (!haveFiniteValue) {
+                minValue = other.minValue;
+                maxValue = other.maxValue;
+                haveFiniteValue = true;
+            } else {
+                minValue = std::min(minValue, other.minValue);
+                maxValue = std::max(maxValue, other.maxValue);
+            }
+        }
+        allValuesAreFinite = allValuesAreFinite && other.allValuesAreFinite;
+        allValuesAreInteger = allValuesAreInteger && other.allValuesAreInteger;
+        foundInvalidCharacter = foundInvalidCharacter || other.foundInvalidCharacter;
+    }
+};
+
+/* Parse one line of values, without newline. The delimiter is determined from the
+ * first value if that has not happened yet. */
+static void parseLine(const char* line, size_t len, char& delimiter, bool& determinedDelimiter,
+        CSVValues& csv, std::vector<float>& element)
+{
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = line[i];
+        if (c == 127 || (c < 32 && (c != '\t' && c != '\r'))) {
+            csv.foundInvalidCharacter = true;
+            len = i;
+            break;
+        }
+    }
+    size_t elementsInLine = 0;
+    size_t i = 0;
+    for (;;) {
+        while (i < len && (line[i] == ' ' || (delimiter != '\t' && line[i] == '\t')))
+            i++;
+        if (i >= len) // line ends; we are done
+            break;
+        element.clear();
+        if (line[i] == '"') { // quoted value
+            size_t j = i + 1;
+            size_t nextDQuote = find(line, len, '"', i + 1);
+            if (nextDQuote == std::string::npos) {
+                i = len;
+            } else {
+                i = find(line, len, delimiter, nextDQuote + 1);
+                if (i == std::string::npos)
+                    i = len;
+            }
+            if (!determinedDelimiter) {
+                if (i < len && line[i] >= 33 && line[i] < 127)
+                    delimiter = line[i];
+                determinedDelimiter = true;
+            }
+            for (;;) {
+                const char* nextChar;
+                float value = readFloat(line + j, line + len, &nextChar);
+                element.push_back(value);
+                if (nextChar)
+                    j = nextChar - line;
+                j = find(line, len, delimiter, j);
+                if (j == std::string::npos || j >= nextDQuote)
+                    break;
+                j++;
+            }
+        } else { // unquoted value
+            const char* nextChar;
+            float value = readFloat(line + i, line + len, &nextChar);
+            element.push_back(value);
+            if (!determinedDelimiter && nextChar) {
+                if (nextChar < line + len && *nextChar >= 33 && *nextChar < 127)
+                    delimiter = *nextChar;
+                determinedDelimiter = true;
+            }
+            if (nextChar)
+                i = nextChar - line;
+            i = find(line, len, delimiter, i);
+            if (i == std::string::npos)
+                i = len;
+        }
+        csv.addElement(element);
+        elementsInLine++;
+        // skip to next value
+        if (i < len)
+            i++;
+    }
+    csv.elementsInLine.push_back(elementsInLine);
+    csv.maxElementsInLine = std::max(csv.maxElementsInLine, elementsInLine);
+}
+
 ArrayContainer FormatImportExportCSV::readArray(Error* error, int arrayIndex)
 {
     // Seek if necessary
@@ -139,181 +380,160 @@ ArrayContainer FormatImportExportCSV::readArray(Error* error, int arrayIndex)
             *error = ErrorInvalidData;
             return ArrayContainer();
         }
-        if (fseeko(_f, _arrayOffsets[arrayIndex], SEEK_SET) < 0) {
+        if (!seek(_arrayOffsets[arrayIndex])) {
             *error = ErrorSysErrno;
             return ArrayContainer();
         }
     }
 
-    // Read the data (in "C" locale!)
+    // Read the data (in "C" locale!), block by block. The array ends with an empty line
+    // or at the end of the file.
     std::string localebak = std::string(setlocale(LC_NUMERIC, NULL));
     setlocale(LC_NUMERIC, "C");
     bool determinedDelimiter = false;
     char delimiter = ',';
-    std::vector<std::vector<std::vector<float>>> values;
-    size_t maxElementsInLine = 0;
-    size_t maxComponentsInElement = 0;
-    float minValue = 0.0f;
-    float maxValue = 0.0f;
-    bool allValuesAreFinite = true;
-    bool allValuesAreInteger = true;
-    bool haveFiniteValue = false;
-    bool foundInvalidCharacter = false;
-    for (;;) {
-        // read a line, without newline
-        std::string line;
-        int c;
-        while ((c = std::fgetc(_f)) != EOF) {
-            if (c == '\n') {
+    CSVValues csv;
+    std::vector<float> element;
+    bool eof = false;
+    bool arrayEnd = false;
+    std::vector<size_t> lineStarts, lineLengths;
+    while (!arrayEnd) {
+        // Find the lines that are completely available in the buffer
+        lineStarts.clear();
+        lineLengths.clear();
+        size_t p = _bufferPos;
+        for (;;) {
+            const char* data = _buffer.data();
+            const void* newline = (p < _buffer.size() ? std::memchr(data + p, '\n', _buffer.size() - p) : nullptr);
+            size_t lineEnd, next;
+            if (newline) {
+                lineEnd = static_cast<const char*>(newline) - data;
+                next = lineEnd + 1;
+            } else if (lineStarts.empty() && !eof) {
+                // read more data to complete the first line
+                if (!fillBuffer()) {
+                    if (std::ferror(_f))
+                        break;
+                    eof = true;
+                }
+                p = _bufferPos;
+                continue;
+            } else if (eof && p < _buffer.size()) {
+                // last line without newline
+                lineEnd = _buffer.size();
+                next = lineEnd;
+            } else {
                 break;
             }
-            if (c == 127 || (c < 32 && (c != '\t' && c != '\r'))) {
-                foundInvalidCharacter = true;
+            size_t lineLength = lineEnd - p;
+            if (lineLength > 0 && data[lineEnd - 1] == '\r')
+                lineLength--;
+            if (lineLength == 0) {
+                arrayEnd = true;
+                p = next;
                 break;
             }
-            line.push_back(c);
+            lineStarts.push_back(p);
+            lineLengths.push_back(lineLength);
+            p = next;
         }
-        if (line.length() > 0 && line[line.length() - 1] == '\r')
-            line.erase(line.length() - 1);
-        // are we finished?
-        if (line.length() == 0) {
+        if (std::ferror(_f))
             break;
-        }
-        // parse one line of values
-        values.push_back(std::vector<std::vector<float>>());
-        size_t i = 0;
-        for (;;) {
-            while (line[i] == ' ' || (delimiter != '\t' && line[i] == '\t'))
-                i++;
-            if (line[i] == '\0') // line ends; we are done
-                break;
-            std::vector<float> element;
-            if (line[i] == '"') { // quoted value
-                size_t j = i + 1;
-                size_t nextDQuote = line.find('"', i + 1);
-                if (nextDQuote == std::string::npos) {
-                    i = line.length();
-                } else {
-                    i = nextDQuote + 1;
-                    i = line.find(delimiter, i);
-                    if (i == std::string::npos)
-                        i = line.length();
-                }
-                if (!determinedDelimiter) {
-                    if (line[i] >= 33 && line[i] < 127)
-                        delimiter = line[i];
-                    determinedDelimiter = true;
-                }
-                for (;;) {
-                    //fprintf(stderr, "j=%zu, nextDQuote=%zu, rest='%s'\n", j, nextDQuote, &(line[j]));
-                    char* nextChar;
-                    float value = readFloat(&(line[j]), &nextChar);
-                    //fprintf(stderr, "v=%g\n", value);
-                    element.push_back(value);
-                    if (nextChar)
-                        j = nextChar - line.c_str();
-                    j = line.find(delimiter, j);
-                    if (j == std::string::npos || j >= nextDQuote)
-                        break;
-                    j++;
-                }
-            } else { // unquoted value
-                //fprintf(stderr, "i=%zu, rest='%s'\n", i, &(line[i]));
-                char* nextChar;
-                float value = readFloat(&(line[i]), &nextChar);
-                //fprintf(stderr, "v=%g\n", value);
-                element.push_back(value);
-                if (!determinedDelimiter && nextChar) {
-                    if (*nextChar >= 33 && *nextChar < 127)
-                        delimiter = *nextChar;
-                    determinedDelimiter = true;
-                }
-                if (nextChar)
-                    i = nextChar - line.c_str();
-                i = line.find(delimiter, i);
-                if (i == std::string::npos)
-                    i = line.length();
-            }
-            // check element properties and store it
-            for (size_t k = 0; k < element.size(); k++) {
-                if (!std::isfinite(element[k])) {
-                    allValuesAreFinite = false;
-                    allValuesAreInteger = false;
-                } else {
-                    if (!haveFiniteValue) {
-                        minValue = element[k];
-                        maxValue = element[k];
-                        haveFiniteValue = true;
-                    } else if (element[k] < minValue) {
-                        minValue = element[k];
-                    } else if (element[k] > maxValue) {
-                        maxValue = element[k];
-                    }
-                    if (std::nearbyint(element[k]) != element[k]) {
-                        allValuesAreInteger = false;
-                    }
-                }
+        if (lineStarts.empty())
+            arrayEnd = true;
+
+        // Parse the lines. The lines are independent once the delimiter is known,
+        // so they can be parsed in parallel ranges whose results are appended in order.
+        const char* data = _buffer.data();
+        size_t l = 0;
+        for (; l < lineStarts.size() && !determinedDelimiter; l++)
+            parseLine(data + lineStarts[l], lineLengths[l], delimiter, determinedDelimiter, csv, element);
+        size_t lineCount = lineStarts.size() - l;
+        if (lineCount > 0) {
+            size_t rangeCount = 1;
+            if (defaultExecutionPolicy() != Sequential && lineCount > 1)
+                rangeCount = std::min(lineCount, 4 * (ThreadPool::instance().threadCount() + 1));
+            std::vector<CSVValues> ranges(rangeCount);
+            auto parseRange = [&] (size_t r) {
+                std::vector<float> rangeElement;
+                char rangeDelimiter = delimiter;
+                bool rangeDeterminedDelimiter = determinedDelimiter;
+                size_t begin = l + r * lineCount / rangeCount;
+                size_t end = l + (r + 1) * lineCount / rangeCount;
+                for (size_t k = begin; k < end; k++)
+                    parseLine(data + lineStarts[k], lineLengths[k], rangeDelimiter, rangeDeterminedDelimiter,
+                            ranges[r], rangeElement);
+            };
+            if (rangeCount == 1) {
+                parseRange(0);
+            } else {
+                ThreadPool::instance().parallelFor(rangeCount, 1, [&] (size_t begin, size_t end) {
+                    for (size_t r = begin; r < end; r++)
+                        parseRange(r);
+                });
             }
-            values.back().push_back(element);
-            if (values.back().back().size() > maxComponentsInElement)
-                maxComponentsInElement = values.back().back().size();
-            // skip to next value
-            if (i < line.length())
-                i++;
+            for (size_t r = 0; r < rangeCount; r++)
+                csv.append(ranges[r]);
         }
-        if (values.back().size() > maxElementsInLine)
-            maxElementsInLine = values.back().size();
+        _bufferPos = p;
     }
     setlocale(LC_NUMERIC, localebak.c_str());
     if (std::ferror(_f)) {
         *error = ErrorSysErrno;
         return ArrayContainer();
     }
-    if (foundInvalidCharacter) {
+    if (csv.foundInvalidCharacter) {
         *error = ErrorInvalidData;
         return ArrayContainer();
     }
 
-    // Store the data in a floating point array
+    // Store the data in a floating point array; missing values are NaN
     ArrayContainer r;
-    if (values.size() == 0 || maxElementsInLine == 0 || maxComponentsInElement == 0) {
+    size_t height = csv.elementsInLine.size();
+    size_t width = csv.maxElementsInLine;
+    size_t comps = csv.maxComponentsInElement;
+    bool allValuesAreFinite = csv.allValuesAreFinite;
+    if (height == 0 || width == 0 || comps == 0) {
         // do nothing
-    } else if (values.size() == 1) {
-        Array<float> rf({ maxElementsInLine }, maxComponentsInElement);
-        for (size_t e = 0; e < maxElementsInLine; e++) {
-            std::memcpy(rf.get(e), values[0][e].data(), values[0][e].size() * sizeof(float));
-            if (values[0][e].size() < maxComponentsInElement)
-                allValuesAreFinite = false;
-            for (size_t c = values[0][e].size(); c < maxComponentsInElement; c++)
-                rf[e][c] = std::numeric_limits<float>::quiet_NaN();
-        }
-        r = rf;
     } else {
-        size_t height = values.size();
-        size_t width = maxElementsInLine;
-        size_t comps = maxComponentsInElement;
-        Array<float> rf({ width, height }, comps);
-        for (size_t y = 0; y < height; y++) {
-            size_t ry = height - 1 - y;
-            for (size_t x = 0; x < values[ry].size(); x++) {
-                std::memcpy(rf.get({ x, y }), values[ry][x].data(), values[ry][x].size() * sizeof(float));
-                if (values[ry][x].size() < comps)
-                    allValuesAreFinite = false;
-                for (size_t c = values[ry][x].size(); c < comps; c++)
-                    rf[{ x, y }][c] = std::numeric_limits<float>::quiet_NaN();
-            }
-            if (values[ry].size() < width)
+        Array<float> rf;
+        if (height == 1)
+            rf = Array<float>({ width }, comps);
+        else
+            rf = Array<float>({ width, height }, comps);
+        size_t v = 0;
+        size_t e = 0;
+        for (size_t line = 0; line < height; line++) {
+            size_t y = height - 1 - line;
+            float* row = static_cast<float*>(rf.data()) + y * width * comps;
+            size_t n = csv.elementsInLine[line];
+            if (n < width)
                 allValuesAreFinite = false;
-            for (size_t x = values[ry].size(); x < width; x++) {
-                for (size_t c = 0; c < comps; c++)
-                    rf[{ x, y }][c] = std::numeric_limits<float>::quiet_NaN();
+            if (csv.singleComponentElements && comps == 1) {
+                std::memcpy(row, csv.values.data() + v, n * sizeof(float));
+                v += n;
+                e += n;
+            } else {
+                for (size_t x = 0; x < n; x++) {
+                    size_t k = csv.components(e++);
+                    std::memcpy(row + x * comps, csv.values.data() + v, k * sizeof(float));
+                    v += k;
+                    if (k < comps)
+                        allValuesAreFinite = false;
+                    for (size_t c = k; c < comps; c++)
+                        row[x * comps + c] = std::numeric_limits<float>::quiet_NaN();
+                }
             }
+            for (size_t i = n * comps; i < width * comps; i++)
+                row[i] = std::numeric_limits<float>::quiet_NaN();
         }
         r = rf;
     }
 
     // Convert the data to a simple integer type if possible
-    if (allValuesAreFinite && allValuesAreInteger) {
+    float minValue = csv.minValue;
+    float maxValue = csv.maxValue;
+    if (allValuesAreFinite && csv.allValuesAreInteger) {
         if (minValue >= 0) {
             if (maxValue <= std::numeric_limits<uint8_t>::max()) {
                 r = convert(r, uint8);
@@ -335,44 +555,58 @@ ArrayContainer FormatImportExportCSV::readArray(Error* error, int arrayIndex)
 
 bool FormatImportExportCSV::hasMore()
 {
-    int c = fgetc(_f);
-    if (c == EOF) {
-        return false;
-    } else {
-        ungetc(c, _f);
-        return true;
-    }
+    return (_bufferPos < _buffer.size() || fillBuffer());
 }
 
 template<typename T>
-std::string valueToString(T value)
+void appendValue(std::string& s, T value)
 {
-    return std::to_string(value);
+    char buf[32];
+    std::to_chars_result r = std::to_chars(buf, buf + sizeof(buf), value);
+    s.append(buf, r.ptr);
 }
-template<> std::string valueToString<float>(float value)
+template<> void appendValue<float>(std::string& s, float value)
 {
     char buf[128];
+#ifdef __cpp_lib_to_chars
+    std::to_chars_result r = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::general, 10);
+    s.append(buf, r.ptr);
+#else
     std::snprintf(buf, sizeof(buf), "%.10g", value);
-    return buf;
+    s += buf;
+#endif
 }
-template<> std::string valueToString<double>(double value)
+template<> void appendValue<double>(std::string& s, double value)
 {
     char buf[128];
+#ifdef __cpp_lib_to_chars
+    std::to_chars_result r = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::general, 20);
+    s.append(buf, r.ptr);
+#else
     std::snprintf(buf, sizeof(buf), "%.20g", value);
-    return buf;
+    s += buf;
+#endif
+}
+
+template<> void appendValue<Float16>(std::string& s, Float16 value)
+{
+    appendValue<float>(s, value);
+}
+template<> void appendValue<BFloat16>(std::string& s, BFloat16 value)
+{
+    appendValue<float>(s, value);
 }
 
 template<typename T>
-std::string rowToString(const T* data, size_t ne, size_t nc)
+void appendRow(std::string& s, const T* data, size_t ne, size_t nc)
 {
-    std::string s;
     for (size_t e = 0; e < ne; e++) {
         if (nc == 1) {
-            s += valueToString(data[e]);
+            appendValue(s, data[e]);
         } else {
             s += '"';
             for (size_t c = 0; c < nc; c++) {
-                s += valueToString(data[e * nc + c]);
+                appendValue(s, data[e * nc + c]);
                 if (c + 1 < nc)
                     s += ',';
             }
@@ -382,45 +616,14 @@ std::string rowToString(const T* data, size_t ne, size_t nc)
             s += ',';
     }
     s += "\r\n";
-    return s;
 }
 
-static std::string rowToString(const void* data, Type type, size_t ne, size_t nc)
+static void appendRow(std::string& s, const void* data, Type type, size_t ne, size_t nc)
 {
-    std::string s;
-    switch (type) {
-    case int8:
-        s = rowToString<int8_t>(static_cast<const int8_t*>(data), ne, nc);
-        break;
-    case uint8:
-        s = rowToString<uint8_t>(static_cast<const uint8_t*>(data), ne, nc);
-        break;
-    case int16:
-        s = rowToString<int16_t>(static_cast<const int16_t*>(data), ne, nc);
-        break;
-    case uint16:
-        s = rowToString<uint16_t>(static_cast<const uint16_t*>(data), ne, nc);
-        break;
-    case int32:
-        s = rowToString<int32_t>(static_cast<const int32_t*>(data), ne, nc);
-        break;
-    case uint32:
-        s = rowToString<uint32_t>(static_cast<const uint32_t*>(data), ne, nc);
-        break;
-    case int64:
-        s = rowToString<int64_t>(static_cast<const int64_t*>(data), ne, nc);
-        break;
-    case uint64:
-        s = rowToString<uint64_t>(static_cast<const uint64_t*>(data), ne, nc);
-        break;
-    case float32:
-        s = rowToString<float>(static_cast<const float*>(data), ne, nc);
-        break;
-    case float64:
-        s = rowToString<double>(static_cast<const double*>(data), ne, nc);
-        break;
-    }
-    return s;
+    visitType(type, [&] (auto tag) {
+            typedef typename decltype(tag)::type T;
+            appendRow<T>(s, static_cast<const T*>(data), ne, nc);
+        });
 }
 
 Error FormatImportExportCSV::writeArray(const ArrayContainer& array)
@@ -433,19 +636,25 @@ Error FormatImportExportCSV::writeArray(const ArrayContainer& array)
 
     std::string localebak = std::string(setlocale(LC_NUMERIC, NULL));
     setlocale(LC_NUMERIC, "C");
+    // Format the rows into a buffer that is written whenever it is large enough
+    std::string s;
+    bool ok = true;
     if (array.dimensionCount() == 1) {
-        std::fputs(rowToString(array.data(), array.componentType(),
-                    array.elementCount(), array.componentCount()).c_str(), _f);
+        appendRow(s, array.data(), array.componentType(), array.elementCount(), array.componentCount());
     } else {
-        for (size_t row = 0; row < array.dimension(1); row++) {
+        for (size_t row = 0; row < array.dimension(1) && ok; row++) {
             size_t y = array.dimension(1) - 1 - row;
-            std::fputs(rowToString(array.get(y * array.dimension(0)), array.componentType(),
-                        array.dimension(0), array.componentCount()).c_str(), _f);
+            appendRow(s, array.get(y * array.dimension(0)), array.componentType(),
+                    array.dimension(0), array.componentCount());
+            if (s.size() >= csvWriteSize) {
+                ok = (std::fwrite(s.data(), 1, s.size(), _f) == s.size());
+                s.clear();
+            }
         }
     }
     setlocale(LC_NUMERIC, localebak.c_str());
-    std::fputs("\r\n", _f);
-    if (std::fflush(_f) != 0) {
+    s += "\r\n";
+    if (!ok || std::fwrite(s.data(), 1, s.size(), _f) != s.size() || std::fflush(_f) != 0) {
         return ErrorSysErrno;
     }
 
@@ -36,6 +36,13 @@ private:
     FILE* _f;
     int _arrayCount;
     std::vector<off_t> _arrayOffsets;
+    // input is read in blocks; _buffer[_bufferPos] is the next character
+    std::vector<char> _buffer;
+    size_t _bufferPos;
+
+    bool fillBuffer();
+    off_t tell();
+    bool seek(off_t pos);
 
 public:
     FormatImportExportCSV();
@@ -50,6 +57,8 @@ public:
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
 
+    virtual bool isReentrant() const override { return true; }
+
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
 };
@@ -23,42 +23,235 @@
  */
 
 #include <cerrno>
+#include <cmath>
+#include <mutex>
 #include <string>
+#include <vector>
+#include <algorithm>
 
 #include "io-dcmtk.hpp"
 #include "io-utils.hpp"
 
 #include <dcmtk/oflog/oflog.h>
+#include <dcmtk/ofstd/ofstd.h>
+#include <dcmtk/ofstd/oflist.h>
 #include <dcmtk/dcmimage/diregist.h>
 #include <dcmtk/dcmimgle/dcmimage.h>
 #include <dcmtk/dcmdata/dcfilefo.h>
+#include <dcmtk/dcmdata/dcdeftag.h>
 #include <dcmtk/dcmdata/dcrledrg.h>
 #include <dcmtk/dcmjpeg/djdecode.h>
 
 
 namespace TGD {
 
+/* The codecs are registered once per process and never cleaned up, since
+ * other instances may still decode in other threads */
+static void registerCodecs()
+{
+    static std::once_flag once;
+    std::call_once(once, [] () {
+            OFLog::configure(OFLogger::OFF_LOG_LEVEL);
+            DcmRLEDecoderRegistration::registerCodecs(OFFalse, OFFalse);
+            DJDecoderRegistration::registerCodecs(EDC_photometricInterpretation, EUC_default, EPC_default, OFFalse);
+        });
+}
+
 FormatImportExportDCMTK::FormatImportExportDCMTK() :
     _dff(nullptr), _di(nullptr)
 {
-    OFLog::configure(OFLogger::OFF_LOG_LEVEL);
-    DcmRLEDecoderRegistration::registerCodecs(OFFalse, OFFalse);
-    DJDecoderRegistration::registerCodecs(EDC_photometricInterpretation, EUC_default, EPC_default, OFFalse);
+    registerCodecs();
     close();
 }
 
 FormatImportExportDCMTK::~FormatImportExportDCMTK()
 {
     close();
-    DcmRLEDecoderRegistration::cleanup();
-    DJDecoderRegistration::cleanup();
 }
 
-Error FormatImportExportDCMTK::openForReading(const std::string& fileName, const TagList&)
+/* Get the description of one frame of a DICOM image */
+static Error frameDescription(DicomImage* di, E_TransferSyntax xfer, ArrayDescription& desc)
 {
-    if (fileName == "-")
+    Type type;
+    if (di->getDepth() <= 8) {
+        type = uint8;
+    } else if (di->getDepth() <= 16) {
+        type = uint16;
+    } else if (di->getDepth() <= 32) {
+        type = uint32;
+    } else if (di->getDepth() <= 64) {
+        type = uint64;
+    } else {
+        return ErrorFeaturesUnsupported;
+    }
+
+    size_t compCount = di->isMonochrome() ? 1 : 3;
+    desc = ArrayDescription({ di->getWidth(), di->getHeight() }, compCount, type);
+    desc.globalTagList().set("DICOM/TRANSFER_SYNTAX", DcmXfer(xfer).getXferName());
+    if (di->getPhotometricInterpretation() == EPI_RGB) {
+        desc.componentTagList(0).set("INTERPRETATION", "SRGB/R");
+        desc.componentTagList(1).set("INTERPRETATION", "SRGB/G");
+        desc.componentTagList(2).set("INTERPRETATION", "SRGB/B");
+    }
+    desc.globalTagList().set("DICOM/PIXEL_ASPECT_RATIO", std::to_string(di->getHeightWidthRatio()).c_str());
+    desc.globalTagList().set("DICOM/BITS_PER_SAMPLE", std::to_string(di->getDepth()).c_str());
+    return ErrorNone;
+}
+
+/* Decode count frames starting with frame first of a DICOM file into dst, one after
+ * the other. Each call loads the file itself, so that calls can run in parallel. */
+static Error decodeFrames(const std::string& fileName, const ArrayDescription& frameDesc,
+        unsigned long first, unsigned long count, unsigned char* dst)
+{
+    DcmFileFormat* dff = new DcmFileFormat();
+    OFCondition cond = dff->loadFile(fileName.c_str(), EXS_Unknown, EGL_withoutGL, DCM_MaxReadLength, ERM_autoDetect);
+    if (cond.bad()) {
+        delete dff;
+        return ErrorLibrary;
+    }
+    E_TransferSyntax xfer = dff->getDataset()->getOriginalXfer();
+    // the image takes over the file format object and decodes only the requested frames
+    DicomImage di(dff, xfer, CIF_MayDetachPixelData | CIF_TakeOverExternalDataset | CIF_UsePartialAccessToPixelData,
+            first, count);
+    ArrayDescription desc;
+    if (di.getStatus() != EIS_Normal || frameDescription(&di, xfer, desc) != ErrorNone)
+        return ErrorLibrary;
+    if (desc.dimensions() != frameDesc.dimensions()
+            || desc.componentCount() != frameDesc.componentCount()
+            || desc.componentType() != frameDesc.componentType())
+        return ErrorInvalidData;
+    for (unsigned long i = 0; i < count; i++) {
+        ArrayContainer frame(frameDesc, dst + i * frameDesc.dataSize());
+        if (!di.getOutputData(frame.data(), frame.dataSize(), frame.componentSize() * 8, i, 0))
+            return ErrorLibrary;
+        reverseY(frame);
+    }
+    return ErrorNone;
+}
+
+/* Find the files of a series in a directory, sorted by the position of their slices
+ * along the slice normal, or by their instance numbers if positions are missing.
+ * The series is that of seriesFile if it is not empty, and otherwise that of the
+ * first DICOM file in name order. Other files are ignored. */
+static Error findSeries(const std::string& directory, const std::string& seriesFile,
+        std::vector<std::string>& files, TagList& tags)
+{
+    class Slice {
+    public:
+        std::string fileName;
+        bool valid = false;
+        OFString seriesUID;
+        bool hasPosition = false;
+        double position[3];
+        bool hasOrientation = false;
+        double orientation[6];
+        Sint32 instanceNumber = 0;
+        double key = 0.0;
+    };
+
+    OFList<OFFilename> fileList;
+    OFStandard::searchDirectoryRecursively(OFFilename(directory.c_str()), fileList,
+            OFFilename(), OFFilename(), OFFalse);
+    std::vector<Slice> slices;
+    for (OFListIterator(OFFilename) it = fileList.begin(); it != fileList.end(); ++it) {
+        slices.emplace_back();
+        slices.back().fileName = it->getCharPointer();
+    }
+    std::sort(slices.begin(), slices.end(),
+            [] (const Slice& a, const Slice& b) { return a.fileName < b.fileName; });
+
+    // Read the headers in parallel; the pixel data is not loaded
+    auto readHeaders = [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            Slice& s = slices[i];
+            DcmFileFormat dff;
+            if (dff.loadFile(s.fileName.c_str(), EXS_Unknown, EGL_noChange, DCM_MaxReadLength, ERM_autoDetect).bad())
+                continue;
+            DcmDataset* dataset = dff.getDataset();
+            if (dataset->findAndGetOFString(DCM_SeriesInstanceUID, s.seriesUID).bad())
+                continue;
+            s.valid = true;
+            s.hasPosition = true;
+            for (unsigned long j = 0; j < 3; j++) {
+                Float64 v;
+                if (dataset->findAndGetFloat64(DCM_ImagePositionPatient, v, j).bad())
+                    s.hasPosition = false;
+                s.position[j] = v;
+            }
+            s.hasOrientation = true;
+            for (unsigned long j = 0; j < 6; j++) {
+                Float64 v;
+                if (dataset->findAndGetFloat64(DCM_ImageOrientationPatient, v, j).bad())
+                    s.hasOrientation = false;
+                s.orientation[j] = v;
+            }
+            dataset->findAndGetSint32(DCM_InstanceNumber, s.instanceNumber);
+        }
+    };
+    if (defaultExecutionPolicy() == Sequential)
+        readHeaders(0, slices.size());
+    else
+        ThreadPool::instance().parallelFor(slices.size(), 1, readHeaders);
+
+    // Select the series
+    OFString seriesUID;
+    bool haveSeriesUID = false;
+    if (!seriesFile.empty()) {
+        DcmFileFormat dff;
+        if (dff.loadFile(seriesFile.c_str(), EXS_Unknown, EGL_noChange, DCM_MaxReadLength, ERM_autoDetect).bad()
+                || dff.getDataset()->findAndGetOFString(DCM_SeriesInstanceUID, seriesUID).bad())
+            return ErrorInvalidData;
+        haveSeriesUID = true;
+    }
+    std::vector<Slice> series;
+    for (size_t i = 0; i < slices.size(); i++) {
+        if (!slices[i].valid)
+            continue;
+        if (!haveSeriesUID) {
+            seriesUID = slices[i].seriesUID;
+            haveSeriesUID = true;
+        }
+        if (slices[i].seriesUID == seriesUID)
+            series.push_back(slices[i]);
+    }
+    if (series.empty())
         return ErrorInvalidData;
 
+    // Sort the slices
+    bool usePositions = series[0].hasOrientation;
+    for (size_t i = 0; i < series.size(); i++)
+        usePositions = usePositions && series[i].hasPosition;
+    if (usePositions) {
+        const double* o = series[0].orientation;
+        double normal[3] = {
+            o[1] * o[5] - o[2] * o[4],
+            o[2] * o[3] - o[0] * o[5],
+            o[0] * o[4] - o[1] * o[3]
+        };
+        for (size_t i = 0; i < series.size(); i++) {
+            const double* p = series[i].position;
+            series[i].key = p[0] * normal[0] + p[1] * normal[1] + p[2] * normal[2];
+        }
+    } else {
+        for (size_t i = 0; i < series.size(); i++)
+            series[i].key = series[i].instanceNumber;
+    }
+    std::stable_sort(series.begin(), series.end(),
+            [] (const Slice& a, const Slice& b) { return a.key < b.key; });
+
+    files.clear();
+    for (size_t i = 0; i < series.size(); i++)
+        files.push_back(series[i].fileName);
+    tags.set("DICOM/SERIES_INSTANCE_UID", seriesUID.c_str());
+    if (usePositions && series.size() > 1) {
+        double spacing = (series.back().key - series.front().key) / (series.size() - 1);
+        tags.set("DICOM/SLICE_SPACING", std::to_string(spacing));
+    }
+    return ErrorNone;
+}
+
+Error FormatImportExportDCMTK::openFile(const std::string& fileName)
+{
     _dff = new DcmFileFormat();
     OFCondition cond = _dff->loadFile(fileName.c_str(), EXS_Unknown, EGL_withoutGL, DCM_MaxReadLength, ERM_autoDetect);
     if (cond.bad()) {
@@ -66,43 +259,50 @@ Error FormatImportExportDCMTK::openForReading(const std::string& fileName, const
         return ErrorLibrary;
     }
     E_TransferSyntax xfer = _dff->getDataset()->getOriginalXfer();
-    _di = new DicomImage(_dff, xfer, CIF_MayDetachPixelData | CIF_TakeOverExternalDataset);
-    if (!_di) {
-        close();
-        errno = ENOMEM;
-        return ErrorSysErrno;
-    }
+    // only the first frame is processed here; the image takes over the file format object
+    _di = new DicomImage(_dff, xfer, CIF_MayDetachPixelData | CIF_TakeOverExternalDataset
+            | CIF_UsePartialAccessToPixelData, 0, 1);
     if (_di->getStatus() != EIS_Normal) {
         close();
         return ErrorLibrary;
     }
-    _di->hideAllOverlays();
-
-    Type type;
-    if (_di->getDepth() <= 8) {
-        type = uint8;
-    } else if (_di->getDepth() <= 16) {
-        type = uint16;
-    } else if (_di->getDepth() <= 32) {
-        type = uint32;
-    } else if (_di->getDepth() <= 64) {
-        type = uint64;
-    } else {
+    _frameCount = _di->getNumberOfFrames();
+    Error e = frameDescription(_di, xfer, _desc);
+    if (e != ErrorNone) {
         close();
-        return ErrorFeaturesUnsupported;
+        return e;
     }
+    _fileName = fileName;
+    return ErrorNone;
+}
 
-    size_t compCount = _di->isMonochrome() ? 1 : 3;
-    _desc = ArrayDescription({ _di->getWidth(), _di->getHeight() }, compCount, type);
-    _desc.globalTagList().set("DICOM/TRANSFER_SYNTAX", DcmXfer(xfer).getXferName());
-    if (_di->getPhotometricInterpretation() == EPI_RGB) {
-        _desc.componentTagList(0).set("INTERPRETATION", "SRGB/R");
-        _desc.componentTagList(1).set("INTERPRETATION", "SRGB/G");
-        _desc.componentTagList(2).set("INTERPRETATION", "SRGB/B");
+Error FormatImportExportDCMTK::openForReading(const std::string& fileName, const TagList& hints)
+{
+    if (fileName == "-")
+        return ErrorInvalidData;
+
+    // A directory, or a file with the hint SERIES=1, is read as a series of slices
+    bool isDirectory = OFStandard::dirExists(OFFilename(fileName.c_str()));
+    if (isDirectory || hints.value("SERIES", false)) {
+        std::string directory = fileName;
+        std::string seriesFile;
+        if (!isDirectory) {
+            size_t slash = fileName.find_last_of("/\\");
+            directory = (slash == std::string::npos ? std::string(".") : fileName.substr(0, slash));
+            seriesFile = fileName;
+        }
+        std::vector<std::string> files;
+        TagList seriesTags;
+        Error e = findSeries(directory, seriesFile, files, seriesTags);
+        if (e == ErrorNone)
+            e = openFile(files[0]);
+        if (e != ErrorNone)
+            return e;
+        _seriesFiles = files;
+        _seriesTags = seriesTags;
+        return ErrorNone;
     }
-    _desc.globalTagList().set("DICOM/PIXEL_ASPECT_RATIO", std::to_string(_di->getHeightWidthRatio()).c_str());
-    _desc.globalTagList().set("DICOM/BITS_PER_SAMPLE", std::to_string(_di->getDepth()).c_str());
-    return ErrorNone;
+    return openFile(fileName);
 }
 
 Error FormatImportExportDCMTK::openForWriting(const std::string&, bool, const TagList&)
@@ -112,39 +312,102 @@ Error FormatImportExportDCMTK::openForWriting(const std::string&, bool, const Ta
 
 void FormatImportExportDCMTK::close()
 {
-    if (_dff) {
-        delete _dff;
-        _dff = nullptr;
-    }
     if (_di) {
-        // delete _di; // Automatically deleted!?
+        // this also deletes the file format object that the image took over
+        delete _di;
         _di = nullptr;
+        _dff = nullptr;
+    } else if (_dff) {
+        delete _dff;
+        _dff = nullptr;
     }
+    _fileName.clear();
     _desc = ArrayDescription();
+    _frameCount = 0;
+    _frames = ArrayContainer();
+    _seriesFiles.clear();
+    _seriesTags = TagList();
     _indexOfLastReadFrame = -1;
 }
 
 int FormatImportExportDCMTK::arrayCount()
 {
-    return _di->getFrameCount();
+    return (_seriesFiles.size() > 0 ? 1 : _frameCount);
 }
 
 ArrayContainer FormatImportExportDCMTK::readArray(Error* error, int arrayIndex)
 {
-    if (arrayIndex >= arrayCount()) {
-        *error = ErrorInvalidData;
-        return ArrayContainer();
-    }
     int index = _indexOfLastReadFrame + 1;
     if (arrayIndex >= 0)
         index = arrayIndex;
-    ArrayContainer r(_desc);
-    if (!_di->getOutputData(r.data(), r.dataSize(), r.componentSize() * 8, index, 0)) {
-        *error = ErrorLibrary;
+    if (index >= arrayCount()) {
+        *error = ErrorInvalidData;
         return ArrayContainer();
     }
+
+    ArrayContainer r;
+    if (_seriesFiles.size() > 0) {
+        // Decode the slices in parallel directly into the volume
+        ArrayDescription volumeDesc({ _desc.dimension(0), _desc.dimension(1), _seriesFiles.size() },
+                _desc.componentCount(), _desc.componentType());
+        volumeDesc.globalTagList() = _desc.globalTagList();
+        for (auto it = _seriesTags.cbegin(); it != _seriesTags.cend(); it++)
+            volumeDesc.globalTagList().set(it->first, it->second);
+        for (size_t c = 0; c < _desc.componentCount(); c++)
+            volumeDesc.componentTagList(c) = _desc.componentTagList(c);
+        r = ArrayContainer(volumeDesc);
+        unsigned char* data = static_cast<unsigned char*>(r.data());
+        std::vector<Error> errors(_seriesFiles.size(), ErrorNone);
+        auto decodeSlices = [&] (size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                errors[i] = decodeFrames(_seriesFiles[i], _desc, 0, 1, data + i * _desc.dataSize());
+        };
+        if (defaultExecutionPolicy() == Sequential)
+            decodeSlices(0, _seriesFiles.size());
+        else
+            ThreadPool::instance().parallelFor(_seriesFiles.size(), 1, decodeSlices);
+        for (size_t i = 0; i < errors.size(); i++) {
+            if (errors[i] != ErrorNone) {
+                *error = errors[i];
+                return ArrayContainer();
+            }
+        }
+    } else if (_frameCount > 1) {
+        // Decode all frames in parallel on first access; the frames are independent,
+        // and each range of frames is decoded from its own copy of the dataset
+        if (!_frames.data()) {
+            ArrayContainer frames({ _desc.dimension(0), _desc.dimension(1), size_t(_frameCount) },
+                    _desc.componentCount(), _desc.componentType());
+            unsigned char* data = static_cast<unsigned char*>(frames.data());
+            std::vector<Error> errors(_frameCount, ErrorNone);
+            auto decodeRange = [&] (size_t begin, size_t end) {
+                errors[begin] = decodeFrames(_fileName, _desc, begin, end - begin, data + begin * _desc.dataSize());
+            };
+            if (defaultExecutionPolicy() == Sequential)
+                decodeRange(0, _frameCount);
+            else
+                ThreadPool::instance().parallelFor(_frameCount, 1, decodeRange);
+            for (size_t i = 0; i < errors.size(); i++) {
+                if (errors[i] != ErrorNone) {
+                    *error = errors[i];
+                    return ArrayContainer();
+                }
+            }
+            _frames = frames;
+        }
+        // the frame shares the data of all frames
+        ArrayContainer frames = _frames;
+        r = ArrayContainer(_desc, static_cast<unsigned char*>(frames.data()) + index * _desc.dataSize(),
+                [frames] (unsigned char*) {});
+    } else {
+        r = ArrayContainer(_desc);
+        if (!_di->getOutputData(r.data(), r.dataSize(), r.componentSize() * 8, 0, 0)) {
+            *error = ErrorLibrary;
+            return ArrayContainer();
+        }
+        reverseY(r);
+    }
     _indexOfLastReadFrame = index;
-    reverseY(r);
     return r;
 }
 
@@ -34,11 +34,18 @@ namespace TGD {
 
 class FormatImportExportDCMTK : public FormatImportExport {
 private:
+    std::string _fileName;
     DcmFileFormat* _dff;
-    DicomImage* _di;
-    ArrayDescription _desc;
+    DicomImage* _di; // only the first frame
+    ArrayDescription _desc; // of one frame
+    int _frameCount;
+    ArrayContainer _frames; // all frames of a multi-frame file, decoded on first access
+    std::vector<std::string> _seriesFiles; // the slices of a series in order, or empty
+    TagList _seriesTags;
     int _indexOfLastReadFrame;
 
+    Error openFile(const std::string& fileName);
+
 public:
     FormatImportExportDCMTK();
     ~FormatImportExportDCMTK();
@@ -52,6 +59,8 @@ public:
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
 
+    virtual bool isReentrant() const override { return true; }
+
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
 };
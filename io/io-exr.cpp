@@ -24,6 +24,8 @@
 
 #include <cstdio>
 #include <cstring>
+#include <algorithm>
+#include <iterator>
 
 #include <OpenEXR/openexr.h>
 #include <OpenEXR/ImfChannelList.h>
@@ -32,6 +34,8 @@
 #include <OpenEXR/ImfHeader.h>
 #include <OpenEXR/ImfStringAttribute.h>
 #include <OpenEXR/ImfFrameBuffer.h>
+#include <OpenEXR/OpenEXRConfig.h>
+#include <OpenEXR/ImfThreading.h>
 
 #include "io-exr.hpp"
 #include "io-utils.hpp"
@@ -39,7 +43,8 @@
 
 namespace TGD {
 
-FormatImportExportEXR::FormatImportExportEXR() : _arrayWasReadOrWritten(false)
+FormatImportExportEXR::FormatImportExportEXR() :
+    _arrayWasReadOrWritten(false), _threadCount(0), _compression(Imf::PIZ_COMPRESSION), _compressionLevel(-1)
 {
 }
 
@@ -47,8 +52,34 @@ FormatImportExportEXR::~FormatImportExportEXR()
 {
 }
 
-Error FormatImportExportEXR::openForReading(const std::string& fileName, const TagList&)
+/* OpenEXR decodes and encodes line blocks and tiles in parallel in its own
+ * global thread pool. By default it uses as many threads as there are
+ * hardware threads; the tag THREADS=N overrides this, and THREADS=0 makes
+ * it work in the calling thread only. */
+static Error initThreadCount(const TagList& hints, int& threadCount)
 {
+    threadCount = (defaultExecutionPolicy() == Sequential ? 0
+            : int(ThreadPool::instance().threadCount() + 1));
+    if (hints.contains("THREADS")) {
+        try {
+            threadCount = std::stoi(hints.value("THREADS"));
+        }
+        catch (...) {
+            return ErrorInvalidData;
+        }
+        if (threadCount < 0)
+            return ErrorInvalidData;
+    }
+    if (threadCount > Imf::globalThreadCount())
+        Imf::setGlobalThreadCount(threadCount);
+    return ErrorNone;
+}
+
+Error FormatImportExportEXR::openForReading(const std::string& fileName, const TagList& hints)
+{
+    Error e = initThreadCount(hints, _threadCount);
+    if (e != ErrorNone)
+        return e;
     if (fileName == "-") {
         return ErrorInvalidData;
     } else {
@@ -63,10 +94,55 @@ Error FormatImportExportEXR::openForReading(const std::string& fileName, const T
     }
 }
 
-Error FormatImportExportEXR::openForWriting(const std::string& fileName, bool append, const TagList&)
+Error FormatImportExportEXR::openForWriting(const std::string& fileName, bool append, const TagList& hints)
 {
     if (append)
         return ErrorFeaturesUnsupported;
+
+    std::string compression = hints.value("COMPRESSION", "default");
+    switch (compressionPreset(compression)) {
+    case CompressionFast:
+        _compression = Imf::RLE_COMPRESSION;
+        break;
+    case CompressionDefault:
+        _compression = Imf::PIZ_COMPRESSION;
+        break;
+    case CompressionSmall:
+        _compression = Imf::ZIP_COMPRESSION;
+        break;
+    case CompressionMethod:
+        if (compression == "none")
+            _compression = Imf::NO_COMPRESSION;
+        else if (compression == "rle")
+            _compression = Imf::RLE_COMPRESSION;
+        else if (compression == "zips")
+            _compression = Imf::ZIPS_COMPRESSION;
+        else if (compression == "zip")
+            _compression = Imf::ZIP_COMPRESSION;
+        else if (compression == "piz")
+            _compression = Imf::PIZ_COMPRESSION;
+        else if (compression == "pxr24")
+            _compression = Imf::PXR24_COMPRESSION;
+        else if (compression == "b44")
+            _compression = Imf::B44_COMPRESSION;
+        else if (compression == "b44a")
+            _compression = Imf::B44A_COMPRESSION;
+        else if (compression == "dwaa")
+            _compression = Imf::DWAA_COMPRESSION;
+        else if (compression == "dwab")
+            _compression = Imf::DWAB_COMPRESSION;
+        else
+            return ErrorFeaturesUnsupported;
+        break;
+    }
+    _compressionLevel = -1;
+    Error e = compressionLevel(hints, 0, 9, _compressionLevel);
+    if (e != ErrorNone)
+        return e;
+    e = initThreadCount(hints, _threadCount);
+    if (e != ErrorNone)
+        return e;
+
     if (fileName == "-") {
         return ErrorInvalidData;
     } else {
@@ -94,6 +170,61 @@ int FormatImportExportEXR::arrayCount()
 using namespace Imf;
 using namespace Imath;
 
+/* The channels in the order of array components: the known channels first,
+ * then all others */
+static std::vector<std::string> channelNames(const ChannelList& channellist)
+{
+    static const char* knownNames[] = { "Y", "R", "G", "B", "A", "Z" };
+    std::vector<std::string> names;
+    for (const char* name : knownNames) {
+        if (channellist.findChannel(name))
+            names.push_back(name);
+    }
+    for (ChannelList::ConstIterator iter = channellist.begin(); iter != channellist.end(); iter++) {
+        if (std::find(std::begin(knownNames), std::end(knownNames), std::string(iter.name())) == std::end(knownNames))
+            names.push_back(iter.name());
+    }
+    return names;
+}
+
+static std::string channelInterpretation(const std::string& name)
+{
+    return (name == "Y" ? "XYZ/Y"
+            : name == "R" ? "RED"
+            : name == "G" ? "GREEN"
+            : name == "B" ? "BLUE"
+            : name == "A" ? "ALPHA"
+            : name == "Z" ? "DEPTH"
+            : name);
+}
+
+/* The description of the array stored in a file with the given header, or an
+ * empty description if the file is invalid */
+static ArrayDescription exrDescription(const Header& header)
+{
+    Box2i dw = header.dataWindow();
+    int width = dw.max.x - dw.min.x + 1;
+    int height = dw.max.y - dw.min.y + 1;
+    std::vector<std::string> names = channelNames(header.channels());
+    if (width < 1 || height < 1 || names.size() < 1)
+        return ArrayDescription();
+    // Files that store only half channels are read as float16 arrays
+    bool allHalf = true;
+    for (ChannelList::ConstIterator iter = header.channels().begin(); iter != header.channels().end(); iter++) {
+        if (iter.channel().type != HALF)
+            allHalf = false;
+    }
+    ArrayDescription desc({ size_t(width), size_t(height) }, names.size(), allHalf ? float16 : float32);
+    for (auto it = header.begin(); it != header.end(); it++) {
+        if (std::string(it.attribute().typeName()) == std::string("string")) {
+            desc.globalTagList().set(it.name(), header.typedAttribute<StringAttribute>(it.name()).value());
+        }
+    }
+    for (size_t i = 0; i < names.size(); i++)
+        desc.componentTagList(i).set("INTERPRETATION", channelInterpretation(names[i]));
+    return desc;
+}
+
 ArrayContainer FormatImportExportEXR::readArray(Error* error, int arrayIndex)
 {
     if (arrayIndex > 0) {
@@ -102,88 +233,33 @@ ArrayContainer FormatImportExportEXR::readArray(Error* error, int arrayIndex)
     }
 
     try {
-        InputFile file(_fileName.c_str());
-        Box2i dw = file.header().dataWindow();
-        int width = dw.max.x - dw.min.x + 1;
-        int height = dw.max.y - dw.min.y + 1;
-        if (width < 1 || height < 1) {
-            *error = ErrorInvalidData;
-            return ArrayContainer();
-        }
-        const ChannelList &channellist = file.header().channels();
-        size_t channelCount = 0;
-        for (ChannelList::ConstIterator iter = channellist.begin(); iter != channellist.end(); iter++) {
-            channelCount++;
-        }
-        if (channelCount < 1) {
+        InputFile file(_fileName.c_str(), _threadCount);
+        ArrayDescription desc = exrDescription(file.header());
+        if (desc.dimensionCount() == 0) {
             *error = ErrorInvalidData;
             return ArrayContainer();
         }
-
-        ArrayContainer r({ size_t(width), size_t(height) }, channelCount, float32);
-        for (auto it = file.header().begin(); it != file.header().end(); it++) {
-            if (std::string(it.attribute().typeName()) == std::string("string")) {
-                r.globalTagList().set(it.name(),
-                        file.header().typedAttribute<StringAttribute>(it.name()).value());
-            }
-        }
-        char* charData = static_cast<char*>(r.data());
+        ArrayContainer r(desc);
+        const size_t compSize = r.componentSize();
+        PixelType pixelType = (r.componentType() == float16 ? HALF : FLOAT);
+        // Let the slices point to the last row with a negative y stride, so that
+        // the library writes rows bottom-up directly into the array and handles
+        // data windows that do not start at the origin.
+        Box2i dw = file.header().dataWindow();
+        size_t xStride = r.elementSize();
+        ptrdiff_t rowSize = ptrdiff_t(r.dimension(0)) * xStride;
+        char* charData = static_cast<char*>(r.data())
+            + (ptrdiff_t(r.dimension(1)) - 1 + dw.min.y) * rowSize - ptrdiff_t(dw.min.x) * xStride;
+        size_t yStride = size_t(-rowSize);
         FrameBuffer framebuffer;
-        int channelIndex = 0;
-        if (channellist.findChannel("Y")) {
-            r.componentTagList(channelIndex).set("INTERPRETATION", "XYZ/Y");
-            framebuffer.insert("Y", Slice(FLOAT, charData + channelIndex * sizeof(float),
-                        channelCount * sizeof(float), channelCount * width * sizeof(float), 1, 1, 0.0f));
-            channelIndex++;
-        }
-        if (channellist.findChannel("R")) {
-            r.componentTagList(channelIndex).set("INTERPRETATION", "RED");
-            framebuffer.insert("R", Slice(FLOAT, charData + channelIndex * sizeof(float),
-                        channelCount * sizeof(float), channelCount * width * sizeof(float), 1, 1, 0.0f));
-            channelIndex++;
-        }
-        if (channellist.findChannel("G")) {
-            r.componentTagList(channelIndex).set("INTERPRETATION", "GREEN");
-            framebuffer.insert("G", Slice(FLOAT, charData + channelIndex * sizeof(float),
-                        channelCount * sizeof(float), channelCount * width * sizeof(float), 1, 1, 0.0f));
-            channelIndex++;
-        }
-        if (channellist.findChannel("B")) {
-            r.componentTagList(channelIndex).set("INTERPRETATION", "BLUE");
-            framebuffer.insert("B", Slice(FLOAT, charData + channelIndex * sizeof(float),
-                        channelCount * sizeof(float), channelCount * width * sizeof(float), 1, 1, 0.0f));
-            channelIndex++;
-        }
-        if (channellist.findChannel("A")) {
-            r.componentTagList(channelIndex).set("INTERPRETATION", "ALPHA");
-            framebuffer.insert("A", Slice(FLOAT, charData + channelIndex * sizeof(float),
-                        channelCount * sizeof(float), channelCount * width * sizeof(float), 1, 1, 0.0f));
-            channelIndex++;
-        }
-        if (channellist.findChannel("Z")) {
-            r.componentTagList(channelIndex).set("INTERPRETATION", "DEPTH");
-            framebuffer.insert("Z", Slice(FLOAT, charData + channelIndex * sizeof(float),
-                        channelCount * sizeof(float), channelCount * width * sizeof(float), 1, 1, 0.0f));
-            channelIndex++;
-        }
-        for (ChannelList::ConstIterator iter = channellist.begin(); iter != channellist.end(); iter++) {
-            if (std::strcmp(iter.name(), "Y") == 0
-                    || std::strcmp(iter.name(), "R") == 0
-                    || std::strcmp(iter.name(), "G") == 0
-                    || std::strcmp(iter.name(), "B") == 0
-                    || std::strcmp(iter.name(), "A") == 0
-                    || std::strcmp(iter.name(), "Z") == 0) {
-                continue;
-            }
-            r.componentTagList(channelIndex).set("INTERPRETATION", iter.name());
-            framebuffer.insert(iter.name(), Slice(FLOAT, charData + channelIndex * sizeof(float),
-                        channelCount * sizeof(float), channelCount * width * sizeof(float), 1, 1, 0.0f));
-            channelIndex++;
+        std::vector<std::string> names = channelNames(file.header().channels());
+        for (size_t i = 0; i < names.size(); i++) {
+            framebuffer.insert(names[i].c_str(), Slice(pixelType, charData + i * compSize,
+                        xStride, yStride, 1, 1, 0.0f));
         }
         file.setFrameBuffer(framebuffer);
         file.readPixels(dw.min.y, dw.max.y);
 
-        reverseY(r);
         _arrayWasReadOrWritten = true;
         return r;
     }
@@ -193,6 +269,24 @@ ArrayContainer FormatImportExportEXR::readArray(Error* error, int arrayIndex)
     }
 }
 
+Error FormatImportExportEXR::readDescription(int arrayIndex, ArrayDescription& desc)
+{
+    if (arrayIndex > 0)
+        return ErrorSeekingNotSupported;
+    try {
+        // this reads only the header
+        InputFile file(_fileName.c_str(), _threadCount);
+        desc = exrDescription(file.header());
+    }
+    catch (...) {
+        return ErrorInvalidData;
+    }
+    if (desc.dimensionCount() == 0)
+        return ErrorInvalidData;
+    _arrayWasReadOrWritten = true;
+    return ErrorNone;
+}
+
 bool FormatImportExportEXR::hasMore()
 {
     return !_arrayWasReadOrWritten;
@@ -204,16 +298,23 @@ Error FormatImportExportEXR::writeArray(const ArrayContainer& array)
             || array.dimension(0) <= 0 || array.dimension(1) <= 0
             || array.dimension(0) > 65535 || array.dimension(1) > 65535
             || array.componentCount() < 1
-            || array.componentType() != float32
+            || (array.componentType() != float32 && array.componentType() != float16)
             || _arrayWasReadOrWritten) {
         return ErrorFeaturesUnsupported;
     }
 
     try {
-        Header header(array.dimension(0), array.dimension(1), 1.0f, Imath::V2f(0, 0), 1.0f, INCREASING_Y, PIZ_COMPRESSION);
+        Header header(array.dimension(0), array.dimension(1), 1.0f, Imath::V2f(0, 0), 1.0f, INCREASING_Y,
+                static_cast<Compression>(_compression));
+#if OPENEXR_VERSION_MAJOR > 3 || (OPENEXR_VERSION_MAJOR == 3 && OPENEXR_VERSION_MINOR >= 1)
+        if (_compressionLevel >= 0 && (_compression == ZIPS_COMPRESSION || _compression == ZIP_COMPRESSION))
+            header.zipCompressionLevel() = _compressionLevel;
+#endif
         for (auto it = array.globalTagList().cbegin(); it != array.globalTagList().cend(); it++) {
             header.insert(it->first.c_str(), StringAttribute(it->second.c_str()));
         }
+        PixelType pixelType = (array.componentType() == float16 ? HALF : FLOAT);
+        const size_t compSize = array.componentSize();
         std::vector<std::string> channelNames(array.componentCount());
         for (size_t c = 0; c < channelNames.size(); c++) {
             std::string channelName;
@@ -235,18 +336,18 @@ Error FormatImportExportEXR::writeArray(const ArrayContainer& array)
             else
                 channelName = std::string("U") + std::to_string(c);
             channelNames[c] = channelName;
-            header.channels().insert(channelName.c_str(), Channel(FLOAT));
+            header.channels().insert(channelName.c_str(), Channel(pixelType));
         }
-        OutputFile file(_fileName.c_str(), header);
+        OutputFile file(_fileName.c_str(), header, _threadCount);
         FrameBuffer framebuffer;
-        ArrayContainer reversedArray = array.deepCopy();
-        reverseY(reversedArray);
-        char* charData = static_cast<char*>(reversedArray.data());
+        // read the rows bottom-up via a negative y stride instead of flipping a copy
+        size_t xStride = array.componentCount() * compSize;
+        ptrdiff_t rowSize = ptrdiff_t(array.dimension(0) * xStride);
+        char* charData = const_cast<char*>(static_cast<const char*>(array.data()))
+            + (ptrdiff_t(array.dimension(1)) - 1) * rowSize;
         for (size_t c = 0; c < array.componentCount(); c++) {
             framebuffer.insert(channelNames[c].c_str(),
-                    Slice(FLOAT, charData + c * sizeof(float),
-                        array.componentCount() * sizeof(float),
-                        array.componentCount() * array.dimension(0) * sizeof(float)));
+                    Slice(pixelType, charData + c * compSize, xStride, size_t(-rowSize)));
         }
         file.setFrameBuffer(framebuffer);
         file.writePixels(array.dimension(1));
@@ -33,6 +33,10 @@ class FormatImportExportEXR : public FormatImportExport {
 private:
     std::string _fileName;
     bool _arrayWasReadOrWritten;
+    int _threadCount;
+    // for writing:
+    int _compression;
+    int _compressionLevel;
 
 public:
     FormatImportExportEXR();
@@ -46,6 +50,9 @@ public:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual Error readDescription(int arrayIndex, ArrayDescription& desc) override;
+
+    virtual bool isReentrant() const override { return true; }
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
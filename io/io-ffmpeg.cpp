@@ -23,15 +23,21 @@
  */
 
 #include <cerrno>
+#include <cstdio>
 #include <limits>
+#include <algorithm>
+
+#include <sys/stat.h>
 
 extern "C" {
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libavutil/avutil.h>
+#include <libavutil/hwcontext.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/pixdesc.h>
 #include <libavutil/cpu.h>
+#include <libavutil/parseutils.h>
 #include <libswscale/swscale.h>
 }
 
@@ -64,6 +70,15 @@ public:
     AVBufferRef* hwDeviceCtx;
     AVFrame* videoFrameFromHW;
 
+    // for writing:
+    AVFormatContext* outFormatCtx;
+    AVCodecContext* encCodecCtx;
+    AVStream* outStream;
+    AVFrame* encFrame;
+    AVPacket* encPkt;
+    int64_t encFrameCount;
+    bool headerWritten;
+
     FFmpeg() :
         formatCtx(nullptr),
         codecCtx(nullptr),
@@ -81,12 +96,22 @@ public:
         hwDeviceType(AV_HWDEVICE_TYPE_NONE),
         hwPixelFormat(AV_PIX_FMT_NONE),
         hwDeviceCtx(nullptr),
-        videoFrameFromHW(nullptr)
+        videoFrameFromHW(nullptr),
+        outFormatCtx(nullptr),
+        encCodecCtx(nullptr),
+        outStream(nullptr),
+        encFrame(nullptr),
+        encPkt(nullptr),
+        encFrameCount(0),
+        headerWritten(false)
     {
     }
 };
 
-FormatImportExportFFMPEG::FormatImportExportFFMPEG()
+FormatImportExportFFMPEG::FormatImportExportFFMPEG() :
+    _savedFrameIndexSize(0),
+    _savedFrameIndexComplete(false),
+    _reopening(false)
 {
     av_log_set_level(AV_LOG_ERROR);
     _ffmpeg = new FFmpeg;
@@ -99,6 +124,47 @@ FormatImportExportFFMPEG::~FormatImportExportFFMPEG()
     delete _ffmpeg;
 }
 
+static void setLogLevel(const TagList& hints)
+{
+    std::string logLevel = hints.value("LOGLEVEL", "error");
+    if (logLevel == "quiet")
+        av_log_set_level(AV_LOG_QUIET);
+    else if (logLevel == "panic")
+        av_log_set_level(AV_LOG_PANIC);
+    else if (logLevel == "fatal")
+        av_log_set_level(AV_LOG_FATAL);
+    else if (logLevel == "error")
+        av_log_set_level(AV_LOG_ERROR);
+    else if (logLevel == "warning")
+        av_log_set_level(AV_LOG_WARNING);
+    else if (logLevel == "info")
+        av_log_set_level(AV_LOG_INFO);
+    else if (logLevel == "verbose")
+        av_log_set_level(AV_LOG_VERBOSE);
+    else if (logLevel == "debug")
+        av_log_set_level(AV_LOG_DEBUG);
+    else if (logLevel == "trace")
+        av_log_set_level(AV_LOG_TRACE);
+    else
+        av_log_set_level(AV_LOG_ERROR);
+}
+
+// The pixel format that matches the data layout of arrays with the given type and components
+static AVPixelFormat arrayPixelFormat(Type type, size_t componentCount)
+{
+    if (type == uint8) {
+        return (componentCount == 1 ? AV_PIX_FMT_GRAY8
+                : componentCount == 2 ? AV_PIX_FMT_YA8
+                : componentCount == 3 ? AV_PIX_FMT_RGB24
+                : AV_PIX_FMT_RGBA);
+    } else {
+        return (componentCount == 1 ? AV_PIX_FMT_GRAY16
+                : componentCount == 2 ? AV_PIX_FMT_YA16
+                : componentCount == 3 ? AV_PIX_FMT_RGB48
+                : AV_PIX_FMT_RGBA64);
+    }
+}
+
 // FFmpeg callback for hw-accel
 static enum AVPixelFormat getHwFormat(AVCodecContext* ctx, const enum AVPixelFormat* pix_fmts)
 {
@@ -120,6 +186,73 @@ static enum AVPixelFormat getHwFormat(AVCodecContext* ctx, const enum AVPixelFor
     return ret;
 }
 
+// Sends a frame to the encoder (or nullptr to drain it) and writes all resulting packets
+static int encodeFrame(FFmpeg* ffmpeg, AVFrame* frame)
+{
+    int ret = avcodec_send_frame(ffmpeg->encCodecCtx, frame);
+    while (ret >= 0) {
+        ret = avcodec_receive_packet(ffmpeg->encCodecCtx, ffmpeg->encPkt);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return 0;
+        else if (ret < 0)
+            break;
+        av_packet_rescale_ts(ffmpeg->encPkt, ffmpeg->encCodecCtx->time_base, ffmpeg->outStream->time_base);
+        ffmpeg->encPkt->stream_index = ffmpeg->outStream->index;
+        ret = av_interleaved_write_frame(ffmpeg->outFormatCtx, ffmpeg->encPkt);
+    }
+    return ret;
+}
+
+// The list of pixel formats supported by an encoder, or nullptr if unknown
+static const AVPixelFormat* encoderPixelFormats(const AVCodec* enc)
+{
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(61, 13, 100)
+    const void* configs = nullptr;
+    if (avcodec_get_supported_config(nullptr, enc, AV_CODEC_CONFIG_PIX_FORMAT, 0, &configs, nullptr) < 0)
+        return nullptr;
+    return static_cast<const AVPixelFormat*>(configs);
+#else
+    return enc->pix_fmts;
+#endif
+}
+
+// Allocates and opens the encoder context; returns nullptr if the encoder cannot be used
+static AVCodecContext* openEncoder(const AVCodec* enc, AVFormatContext* formatCtx,
+        int w, int h, AVPixelFormat srcPixFmt, AVRational frameRate, const TagList& hints)
+{
+    AVPixelFormat pixFmt = av_get_pix_fmt(hints.value("PIXFMT").c_str());
+    if (pixFmt == AV_PIX_FMT_NONE) {
+        const AVPixelFormat* pixFmts = encoderPixelFormats(enc);
+        bool hasAlpha = (av_pix_fmt_desc_get(srcPixFmt)->flags & AV_PIX_FMT_FLAG_ALPHA);
+        pixFmt = (pixFmts ? avcodec_find_best_pix_fmt_of_list(pixFmts, srcPixFmt, hasAlpha, nullptr) : srcPixFmt);
+    }
+    AVCodecContext* ctx = avcodec_alloc_context3(enc);
+    if (!ctx)
+        return nullptr;
+    ctx->width = w;
+    ctx->height = h;
+    ctx->pix_fmt = pixFmt;
+    ctx->framerate = frameRate;
+    ctx->time_base = av_inv_q(frameRate);
+    ctx->bit_rate = hints.value("BITRATE", 0LL);
+    // frame and slice threads; hardware encoders ignore this
+    ctx->thread_count = hints.value("THREADS", std::min(av_cpu_count(), 16));
+    ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    if (formatCtx->oformat->flags & AVFMT_GLOBALHEADER)
+        ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    // encoder private options; encoders that do not know them ignore them
+    AVDictionary* options = nullptr;
+    if (hints.contains("CRF"))
+        av_dict_set(&options, "crf", hints.value("CRF").c_str(), 0);
+    if (hints.contains("PRESET"))
+        av_dict_set(&options, "preset", hints.value("PRESET").c_str(), 0);
+    int ret = avcodec_open2(ctx, enc, &options);
+    av_dict_free(&options);
+    if (ret < 0)
+        avcodec_free_context(&ctx);
+    return ctx;
+}
+
 Error FormatImportExportFFMPEG::openForReading(const std::string& fileName, const TagList& hints)
 {
     if (fileName == "-")
@@ -128,27 +261,7 @@ Error FormatImportExportFFMPEG::openForReading(const std::string& fileName, cons
     _fileName = fileName;
     _hints = hints;
     int enableHWAccel = _hints.value("HWACCEL", 1);
-    std::string logLevel = _hints.value("LOGLEVEL", "error");
-    if (logLevel == "quiet")
-        av_log_set_level(AV_LOG_QUIET);
-    else if (logLevel == "panic")
-        av_log_set_level(AV_LOG_PANIC);
-    else if (logLevel == "fatal")
-        av_log_set_level(AV_LOG_FATAL);
-    else if (logLevel == "error")
-        av_log_set_level(AV_LOG_ERROR);
-    else if (logLevel == "warning")
-        av_log_set_level(AV_LOG_WARNING);
-    else if (logLevel == "info")
-        av_log_set_level(AV_LOG_INFO);
-    else if (logLevel == "verbose")
-        av_log_set_level(AV_LOG_VERBOSE);
-    else if (logLevel == "debug")
-        av_log_set_level(AV_LOG_DEBUG);
-    else if (logLevel == "trace")
-        av_log_set_level(AV_LOG_TRACE);
-    else
-        av_log_set_level(AV_LOG_ERROR);
+    setLogLevel(_hints);
 
     if (avformat_open_input(&(_ffmpeg->formatCtx), _fileName.c_str(), nullptr, nullptr) < 0
             || avformat_find_stream_info(_ffmpeg->formatCtx, nullptr) < 0
@@ -241,16 +354,68 @@ Error FormatImportExportFFMPEG::openForReading(const std::string& fileName, cons
         return ErrorSysErrno;
     }
 
+    if (!_reopening) {
+        _frameIndexFileName = _hints.value("FRAMEINDEX");
+        _savedFrameIndexSize = 0;
+        _savedFrameIndexComplete = false;
+        bool haveFrameIndex = (!_frameIndexFileName.empty() && loadFrameIndex());
+        if (!haveFrameIndex && _hints.value("FRAMESCAN", 0))
+            scanFrameIndex();
+    }
+
     return ErrorNone;
 }
 
-Error FormatImportExportFFMPEG::openForWriting(const std::string&, bool, const TagList&)
+Error FormatImportExportFFMPEG::openForWriting(const std::string& fileName, bool append, const TagList& hints)
 {
-    return ErrorFeaturesUnsupported;
+    // Video containers cannot be extended, but all arrays written after
+    // opening the file become frames of the same video stream.
+    if (append)
+        return ErrorFeaturesUnsupported;
+    if (fileName == "-")
+        return ErrorInvalidData;
+
+    _fileName = fileName;
+    _hints = hints;
+    setLogLevel(_hints);
+    // The encoder is set up when the first frame is written since it needs
+    // to know the frame size.
+    if (avformat_alloc_output_context2(&(_ffmpeg->outFormatCtx), nullptr, nullptr, _fileName.c_str()) < 0)
+        return ErrorFormatUnsupported;
+    return ErrorNone;
 }
 
 void FormatImportExportFFMPEG::close()
 {
+    if (_ffmpeg->outFormatCtx) {
+        if (_ffmpeg->headerWritten) {
+            // drain the encoder and finish the file
+            if (encodeFrame(_ffmpeg, nullptr) == 0)
+                av_write_trailer(_ffmpeg->outFormatCtx);
+        }
+        if (!(_ffmpeg->outFormatCtx->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&(_ffmpeg->outFormatCtx->pb));
+        avformat_free_context(_ffmpeg->outFormatCtx);
+        _ffmpeg->outFormatCtx = nullptr;
+        _ffmpeg->outStream = nullptr;
+    }
+    if (_ffmpeg->encCodecCtx) {
+        avcodec_free_context(&(_ffmpeg->encCodecCtx));
+        _ffmpeg->encCodecCtx = nullptr;
+    }
+    if (_ffmpeg->encFrame) {
+        av_frame_free(&(_ffmpeg->encFrame));
+        _ffmpeg->encFrame = nullptr;
+    }
+    if (_ffmpeg->encPkt) {
+        av_packet_free(&(_ffmpeg->encPkt));
+        _ffmpeg->encPkt = nullptr;
+    }
+    _ffmpeg->encFrameCount = 0;
+    _ffmpeg->headerWritten = false;
+    if (_ffmpeg->formatCtx && !_reopening) {
+        saveFrameIndex();
+    }
     if (_ffmpeg->formatCtx) {
         avformat_close_input(&(_ffmpeg->formatCtx));
         _ffmpeg->formatCtx = nullptr;
@@ -297,6 +462,8 @@ void FormatImportExportFFMPEG::close()
     _framePTSs.clear();
     _keyFrames.clear();
     _indexOfLastReadFrame = -1;
+    _frameIndexScanned = false;
+    _frameIndexComplete = false;
 }
 
 bool FormatImportExportFFMPEG::hardReset(bool disableHWAccel = false)
@@ -308,16 +475,192 @@ bool FormatImportExportFFMPEG::hardReset(bool disableHWAccel = false)
     std::vector<int64_t> bakFrameDTSs = _frameDTSs;
     std::vector<int64_t> bakFramePTSs = _framePTSs;
     std::vector<int> bakKeyFrames = _keyFrames;
+    bool bakFrameIndexScanned = _frameIndexScanned;
+    bool bakFrameIndexComplete = _frameIndexComplete;
+    _reopening = true;
     close();
     if (disableHWAccel)
         _hints.set("HWACCEL", "0");
-    if (openForReading(_fileName, _hints) != ErrorNone)
+    bool ok = (openForReading(_fileName, _hints) == ErrorNone);
+    _reopening = false;
+    if (!ok)
         return false;
     _minDTS = bakMinDTS;
     _unreliableTimeStamps = bakUnreliableTimeStamps;
     _frameDTSs = bakFrameDTSs;
     _framePTSs = bakFramePTSs;
     _keyFrames = bakKeyFrames;
+    _frameIndexScanned = bakFrameIndexScanned;
+    _frameIndexComplete = bakFrameIndexComplete;
+    return true;
+}
+
+/* The frame index consists of the DTS and PTS of each frame in presentation order
+ * and the list of key frames. It is built while decoding, but this is lost when the
+ * file is closed, so that random access requires to decode the video up to the
+ * requested frame each time it is opened. Therefore the index can be saved to
+ * a sidecar file (input tag FRAMEINDEX) and/or built by a fast scan of the packets
+ * without decoding (input tag FRAMESCAN). */
+
+static const char frameIndexSignature[] = "TGD-FFMPEG-FRAMEINDEX 1";
+
+bool FormatImportExportFFMPEG::fileStamp(long long& size, long long& mtime) const
+{
+    struct stat statbuf;
+    if (stat(_fileName.c_str(), &statbuf) != 0)
+        return false;
+    size = statbuf.st_size;
+    mtime = statbuf.st_mtime;
+    return true;
+}
+
+void FormatImportExportFFMPEG::checkFrameIndexComplete()
+{
+    // at the end of the stream, the index built while decoding contains all frames
+    // if the time stamps of every frame were recorded
+    if (!_frameIndexScanned && _frameDTSs.size() == size_t(_indexOfLastReadFrame + 1))
+        _frameIndexComplete = true;
+}
+
+bool FormatImportExportFFMPEG::loadFrameIndex()
+{
+    long long size, mtime;
+    if (!fileStamp(size, mtime))
+        return false;
+    FILE* f = fopen(_frameIndexFileName.c_str(), "rb");
+    if (!f)
+        return false;
+    char signature[sizeof(frameIndexSignature)];
+    long long indexSize, indexMTime, frameCount;
+    int streamIndex, unreliable, scanned, complete;
+    long long minDTS;
+    bool ok = (fgets(signature, sizeof(signature), f)
+            && std::string(signature) == frameIndexSignature
+            && fscanf(f, "%lld %lld %d %d %d %d %lld %lld", &indexSize, &indexMTime,
+                &streamIndex, &unreliable, &scanned, &complete, &minDTS, &frameCount) == 8
+            && indexSize == size && indexMTime == mtime
+            && streamIndex == _ffmpeg->streamIndex
+            && frameCount >= 0 && frameCount < std::numeric_limits<int>::max());
+    std::vector<int64_t> frameDTSs, framePTSs;
+    std::vector<int> keyFrames;
+    for (long long i = 0; ok && i < frameCount; i++) {
+        long long dts, pts;
+        int key;
+        if (fscanf(f, "%lld %lld %d", &dts, &pts, &key) != 3) {
+            ok = false;
+        } else {
+            frameDTSs.push_back(dts);
+            framePTSs.push_back(pts);
+            if (key)
+                keyFrames.push_back(i);
+        }
+    }
+    fclose(f);
+    if (!ok)
+        return false;
+    _minDTS = minDTS;
+    _unreliableTimeStamps = unreliable;
+    _frameDTSs = frameDTSs;
+    _framePTSs = framePTSs;
+    _keyFrames = keyFrames;
+    _frameIndexScanned = scanned;
+    _frameIndexComplete = complete;
+    _savedFrameIndexSize = _frameDTSs.size();
+    _savedFrameIndexComplete = _frameIndexComplete;
+    return true;
+}
+
+void FormatImportExportFFMPEG::saveFrameIndex()
+{
+    if (_frameIndexFileName.empty() || _frameDTSs.empty()
+            || (_frameDTSs.size() == _savedFrameIndexSize && _frameIndexComplete == _savedFrameIndexComplete))
+        return;
+    long long size, mtime;
+    if (!fileStamp(size, mtime))
+        return;
+    // write to a temporary file first so that concurrent readers never see partial data
+    std::string tmpFileName = _frameIndexFileName + ".tmp";
+    FILE* f = fopen(tmpFileName.c_str(), "wb");
+    if (!f)
+        return;
+    fprintf(f, "%s\n%lld %lld %d %d %d %d %lld %lld\n", frameIndexSignature, size, mtime,
+            _ffmpeg->streamIndex, _unreliableTimeStamps ? 1 : 0, _frameIndexScanned ? 1 : 0,
+            _frameIndexComplete ? 1 : 0, static_cast<long long>(_minDTS),
+            static_cast<long long>(_frameDTSs.size()));
+    size_t k = 0;
+    for (size_t i = 0; i < _frameDTSs.size(); i++) {
+        while (k < _keyFrames.size() && size_t(_keyFrames[k]) < i)
+            k++;
+        bool key = (k < _keyFrames.size() && size_t(_keyFrames[k]) == i);
+        fprintf(f, "%lld %lld %d\n", static_cast<long long>(_frameDTSs[i]),
+                static_cast<long long>(_framePTSs[i]), key ? 1 : 0);
+    }
+    if (fclose(f) != 0 || std::rename(tmpFileName.c_str(), _frameIndexFileName.c_str()) != 0) {
+        std::remove(tmpFileName.c_str());
+        return;
+    }
+    _savedFrameIndexSize = _frameDTSs.size();
+    _savedFrameIndexComplete = _frameIndexComplete;
+}
+
+bool FormatImportExportFFMPEG::scanFrameIndex()
+{
+    /* Read all packets of the video stream with a separate demuxer so that the state
+     * of the decoding pipeline is not affected. This assumes that each packet holds one
+     * frame, which is true for the common video codecs. Decoding later verifies the
+     * time stamps of each frame that it seeks to, and fails if they do not match. */
+    AVFormatContext* formatCtx = nullptr;
+    if (avformat_open_input(&formatCtx, _fileName.c_str(), nullptr, nullptr) < 0)
+        return false;
+    AVPacket* pkt = av_packet_alloc();
+    bool ok = (pkt && avformat_find_stream_info(formatCtx, nullptr) >= 0
+            && _ffmpeg->streamIndex < int(formatCtx->nb_streams));
+    struct Entry {
+        int64_t dts;
+        int64_t pts;
+        bool key;
+    };
+    std::vector<Entry> entries;
+    if (ok) {
+        for (int i = 0; i < int(formatCtx->nb_streams); i++) {
+            if (i != _ffmpeg->streamIndex)
+                formatCtx->streams[i]->discard = AVDISCARD_ALL;
+        }
+        int ret = 0;
+        while (ok && (ret = av_read_frame(formatCtx, pkt)) >= 0) {
+            if (pkt->stream_index == _ffmpeg->streamIndex && !(pkt->flags & AV_PKT_FLAG_DISCARD)) {
+                if (pkt->dts == AV_NOPTS_VALUE || pkt->pts == AV_NOPTS_VALUE)
+                    ok = false; // we cannot know the presentation order or seek
+                else
+                    entries.push_back({ pkt->dts, pkt->pts, (pkt->flags & AV_PKT_FLAG_KEY) != 0 });
+            }
+            av_packet_unref(pkt);
+        }
+        if (ok && ret != AVERROR_EOF)
+            ok = false;
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&formatCtx);
+    if (!ok || entries.empty() || entries.size() >= size_t(std::numeric_limits<int>::max()))
+        return false;
+
+    // frames are returned in presentation order
+    std::stable_sort(entries.begin(), entries.end(),
+            [] (const Entry& a, const Entry& b) { return a.pts < b.pts; });
+    _frameDTSs.clear();
+    _framePTSs.clear();
+    _keyFrames.clear();
+    for (size_t i = 0; i < entries.size(); i++) {
+        _frameDTSs.push_back(entries[i].dts);
+        _framePTSs.push_back(entries[i].pts);
+        if (i == 0 || entries[i].dts < _minDTS)
+            _minDTS = entries[i].dts;
+        if (entries[i].key)
+            _keyFrames.push_back(i);
+    }
+    _unreliableTimeStamps = false;
+    _frameIndexScanned = true;
+    _frameIndexComplete = false;
     return true;
 }
 
@@ -334,11 +677,42 @@ int FormatImportExportFFMPEG::arrayCount()
      * correspondence between packets and frames.
      *
      * 3. Decoding the whole stream is obviously far too slow.
+     *
+     * But if the whole stream was decoded before, the number is known from the frame index.
      */
+    if (_frameIndexComplete)
+        return _frameDTSs.size();
     return -1;
 }
 
 ArrayContainer FormatImportExportFFMPEG::readArray(Error* error, int arrayIndex)
+{
+    ArrayContainer r;
+    Error e = readArrayInto(r, arrayIndex);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    return r;
+}
+
+Error FormatImportExportFFMPEG::readArrayInto(ArrayContainer& r, int arrayIndex)
+{
+    return readFrame(&r, arrayIndex);
+}
+
+Error FormatImportExportFFMPEG::readDescription(int arrayIndex, ArrayDescription& desc)
+{
+    Error e = readFrame(nullptr, arrayIndex);
+    if (e == ErrorNone)
+        desc = _desc;
+    return e;
+}
+
+/* Decode the requested frame. If r is null, only _desc is updated: the frame
+ * must still be decoded to keep the decoder state, but it is neither transferred
+ * from hardware nor converted. */
+Error FormatImportExportFFMPEG::readFrame(ArrayContainer* r, int arrayIndex)
 {
     bool seeked = false;
     if (arrayIndex >= 0) {
@@ -397,8 +771,7 @@ ArrayContainer FormatImportExportFFMPEG::readArray(Error* error, int arrayIndex)
                 // over with the first frame
                 if (!hardReset()) {
                     close();
-                    *error = ErrorInvalidData;
-                    return ArrayContainer();
+                    return ErrorInvalidData;
                 }
             }
         }
@@ -416,6 +789,7 @@ ArrayContainer FormatImportExportFFMPEG::readArray(Error* error, int arrayIndex)
         }
         if (ret == AVERROR_EOF && _ffmpeg->fileEof) {
             _ffmpeg->codecEof = true;
+            checkFrameIndexComplete();
             break;
         } else if (ret == AVERROR(EAGAIN)) {
             for (;;) {
@@ -430,31 +804,27 @@ ArrayContainer FormatImportExportFFMPEG::readArray(Error* error, int arrayIndex)
                     _ffmpeg->fileEof = true;
                     if (avcodec_send_packet(_ffmpeg->codecCtx, NULL) < 0) {
                         close();
-                        *error = ErrorInvalidData;
-                        return ArrayContainer();
+                        return ErrorInvalidData;
                     }
                     break;
                 } else if (ret < 0) {
                     close();
-                    *error = ErrorInvalidData;
-                    return ArrayContainer();
+                    return ErrorInvalidData;
                 } else if (_ffmpeg->pkt->stream_index == _ffmpeg->streamIndex) {
                     bool haveHWAccel = (_ffmpeg->hwDeviceType != AV_HWDEVICE_TYPE_NONE);
                     if (avcodec_send_packet(_ffmpeg->codecCtx, _ffmpeg->pkt) < 0) {
                         close();
-                        *error = ErrorInvalidData;
-                        return ArrayContainer();
+                        return ErrorInvalidData;
                     }
                     av_packet_unref(_ffmpeg->pkt);
                     if (haveHWAccel && (_ffmpeg->hwDeviceType == AV_HWDEVICE_TYPE_NONE)) {
                         /* hardware acceleration failed late, signalled by getHwFormat()
                          * because FFmpeg won't let us know otherwise */
                         if (hardReset(true)) {
-                            return readArray(error, arrayIndex);
+                            return readFrame(r, arrayIndex);
                         } else {
                             close();
-                            *error = ErrorInvalidData;
-                            return ArrayContainer();
+                            return ErrorInvalidData;
                         }
                     }
                     break;
@@ -464,8 +834,7 @@ ArrayContainer FormatImportExportFFMPEG::readArray(Error* error, int arrayIndex)
             }
         } else if (ret < 0) {
             close();
-            *error = ErrorInvalidData;
-            return ArrayContainer();
+            return ErrorInvalidData;
         } else {
             /* Record the timestamps of this frame if it is the next one that needs to be recorded. */
             if (!seeked && _frameDTSs.size() == size_t(_indexOfLastReadFrame + 1)) {
@@ -510,8 +879,7 @@ ArrayContainer FormatImportExportFFMPEG::readArray(Error* error, int arrayIndex)
                 }
                 if (frameIndex == -1) {
                     close();
-                    *error = ErrorInvalidData;
-                    return ArrayContainer();
+                    return ErrorInvalidData;
                 }
                 _indexOfLastReadFrame = frameIndex;
                 if (frameIndex == arrayIndex) {
@@ -524,8 +892,7 @@ ArrayContainer FormatImportExportFFMPEG::readArray(Error* error, int arrayIndex)
                     // So we have a terrible fallback here: hard reset
                     if (triedHardReset || !hardReset()) {
                         close();
-                        *error = ErrorInvalidData;
-                        return ArrayContainer();
+                        return ErrorInvalidData;
                     }
                     triedHardReset = true;
                 }
@@ -535,26 +902,31 @@ ArrayContainer FormatImportExportFFMPEG::readArray(Error* error, int arrayIndex)
 
     /* Make videoFramePtr point to the video frame in main memory */
     AVFrame* videoFramePtr;
+    int pixFmt;
     if (_ffmpeg->hwDeviceType == AV_HWDEVICE_TYPE_NONE) {
         videoFramePtr = _ffmpeg->videoFrame;
+        pixFmt = videoFramePtr->format;
+    } else if (!r && _ffmpeg->videoFrame->hw_frames_ctx) {
+        /* the format in main memory is known without a transfer */
+        videoFramePtr = _ffmpeg->videoFrame;
+        pixFmt = reinterpret_cast<AVHWFramesContext*>(videoFramePtr->hw_frames_ctx->data)->sw_format;
     } else {
         /* transfer data to main memory */
         if (av_hwframe_transfer_data(_ffmpeg->videoFrameFromHW, _ffmpeg->videoFrame, 0) < 0) {
             close();
-            *error = ErrorLibrary;
-            return ArrayContainer();
+            return ErrorLibrary;
         }
         videoFramePtr = _ffmpeg->videoFrameFromHW;
+        pixFmt = videoFramePtr->format;
     }
 
     /* Lazily initialize _desc */
     int w = _ffmpeg->codecCtx->width;
     int h = _ffmpeg->codecCtx->height;
-    const AVPixFmtDescriptor* pixFmtDesc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(videoFramePtr->format));
+    const AVPixFmtDescriptor* pixFmtDesc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(pixFmt));
     if (w < 1 || h < 1 || !pixFmtDesc || pixFmtDesc->nb_components < 1 || pixFmtDesc->nb_components > 4) {
         close();
-        *error = ErrorInvalidData;
-        return ArrayContainer();
+        return ErrorInvalidData;
     }
     int componentCount = pixFmtDesc->nb_components;
     Type type = uint8;
@@ -583,44 +955,28 @@ ArrayContainer FormatImportExportFFMPEG::readArray(Error* error, int arrayIndex)
         }
     }
 
+    if (!r)
+        return ErrorNone;
+
     /* Lazily initialize swsCtx. FFmpeg takes care of reusing an existing context if possible. */
-    AVPixelFormat dstPixFmt;
-    if (type == uint8) {
-        if (componentCount == 1)
-            dstPixFmt = AV_PIX_FMT_GRAY8;
-        else if (componentCount == 2)
-            dstPixFmt = AV_PIX_FMT_YA8;
-        else if (componentCount == 3)
-            dstPixFmt = AV_PIX_FMT_RGB24;
-        else
-            dstPixFmt = AV_PIX_FMT_RGBA;
-    } else {
-        if (componentCount == 1)
-            dstPixFmt = AV_PIX_FMT_GRAY16;
-        else if (componentCount == 2)
-            dstPixFmt = AV_PIX_FMT_YA16;
-        else if (componentCount == 3)
-            dstPixFmt = AV_PIX_FMT_RGB48;
-        else
-            dstPixFmt = AV_PIX_FMT_RGBA64;
-    }
+    AVPixelFormat dstPixFmt = arrayPixelFormat(type, componentCount);
     _ffmpeg->swsCtx = sws_getCachedContext(_ffmpeg->swsCtx,
             w, h, static_cast<AVPixelFormat>(videoFramePtr->format),
             w, h, dstPixFmt,
             SWS_BILINEAR, nullptr, nullptr, nullptr);
     if (!_ffmpeg->swsCtx) {
         close();
-        *error = ErrorLibrary;
-        return ArrayContainer();
+        return ErrorLibrary;
     }
 
-    ArrayContainer r(_desc);
-    uint8_t* dst[4] = { static_cast<uint8_t*>(r.data()), nullptr, nullptr, nullptr };
-    int dstStride[4] = { int(r.dimension(0) * r.elementSize()), 0, 0, 0 };
+    prepareArray(*r, _desc);
+    // write the rows bottom to top so that the image needs no flipping afterwards
+    size_t lineSize = r->dimension(0) * r->elementSize();
+    uint8_t* dst[4] = { static_cast<uint8_t*>(r->data()) + (r->dimension(1) - 1) * lineSize, nullptr, nullptr, nullptr };
+    int dstStride[4] = { -int(lineSize), 0, 0, 0 };
     sws_scale(_ffmpeg->swsCtx, videoFramePtr->data, videoFramePtr->linesize, 0, videoFramePtr->height, dst, dstStride);
-    reverseY(r);
 
-    return r;
+    return ErrorNone;
 }
 
 bool FormatImportExportFFMPEG::hasMore()
@@ -675,6 +1031,7 @@ bool FormatImportExportFFMPEG::hasMore()
                 if (_ffmpeg->haveFrameRet == AVERROR_EOF) {
                     /* Nothing more to drain */
                     _ffmpeg->codecEof = true;
+                    checkFrameIndexComplete();
                     return false;
                 } else if (_ffmpeg->haveFrameRet < 0) {
                     /* Some decoding error - give up */
@@ -689,9 +1046,115 @@ bool FormatImportExportFFMPEG::hasMore()
     }
 }
 
-Error FormatImportExportFFMPEG::writeArray(const ArrayContainer&)
+Error FormatImportExportFFMPEG::initializeWriting(const ArrayDescription& desc)
 {
-    return ErrorFeaturesUnsupported;
+    AVRational frameRate = { 25, 1 };
+    if (_hints.contains("FRAMERATE")
+            && (av_parse_video_rate(&frameRate, _hints.value("FRAMERATE").c_str()) < 0
+                || frameRate.num <= 0 || frameRate.den <= 0)) {
+        return ErrorInvalidData;
+    }
+    const AVCodec* swEnc = (_hints.contains("CODEC")
+            ? avcodec_find_encoder_by_name(_hints.value("CODEC").c_str())
+            : avcodec_find_encoder(_ffmpeg->outFormatCtx->oformat->video_codec));
+    if (!swEnc)
+        return ErrorFeaturesUnsupported;
+    int w = desc.dimension(0);
+    int h = desc.dimension(1);
+    AVPixelFormat srcPixFmt = arrayPixelFormat(desc.componentType(), desc.componentCount());
+
+    // With HWACCEL=1, try the hardware encoders for the codec that accept frames
+    // in main memory first, and fall back to the software encoder.
+    if (_hints.value("HWACCEL", 0)) {
+        const char* hwEncoderSuffixes[5] = { "nvenc", "qsv", "amf", "videotoolbox", "mediacodec" };
+        for (int i = 0; i < 5 && !_ffmpeg->encCodecCtx; i++) {
+            std::string name = std::string(avcodec_get_name(swEnc->id)) + '_' + hwEncoderSuffixes[i];
+            const AVCodec* hwEnc = avcodec_find_encoder_by_name(name.c_str());
+            if (hwEnc)
+                _ffmpeg->encCodecCtx = openEncoder(hwEnc, _ffmpeg->outFormatCtx, w, h, srcPixFmt, frameRate, _hints);
+        }
+    }
+    if (!_ffmpeg->encCodecCtx)
+        _ffmpeg->encCodecCtx = openEncoder(swEnc, _ffmpeg->outFormatCtx, w, h, srcPixFmt, frameRate, _hints);
+    if (!_ffmpeg->encCodecCtx)
+        return ErrorLibrary;
+
+    _ffmpeg->outStream = avformat_new_stream(_ffmpeg->outFormatCtx, nullptr);
+    _ffmpeg->encFrame = av_frame_alloc();
+    _ffmpeg->encPkt = av_packet_alloc();
+    if (!_ffmpeg->outStream || !_ffmpeg->encFrame || !_ffmpeg->encPkt) {
+        errno = ENOMEM;
+        return ErrorSysErrno;
+    }
+    _ffmpeg->outStream->time_base = _ffmpeg->encCodecCtx->time_base;
+    _ffmpeg->outStream->avg_frame_rate = frameRate;
+    _ffmpeg->encFrame->format = _ffmpeg->encCodecCtx->pix_fmt;
+    _ffmpeg->encFrame->width = w;
+    _ffmpeg->encFrame->height = h;
+    if (avcodec_parameters_from_context(_ffmpeg->outStream->codecpar, _ffmpeg->encCodecCtx) < 0
+            || av_frame_get_buffer(_ffmpeg->encFrame, 0) < 0) {
+        return ErrorLibrary;
+    }
+    if (!(_ffmpeg->outFormatCtx->oformat->flags & AVFMT_NOFILE)) {
+        int ret = avio_open(&(_ffmpeg->outFormatCtx->pb), _fileName.c_str(), AVIO_FLAG_WRITE);
+        if (ret < 0) {
+            errno = AVUNERROR(ret);
+            return ErrorSysErrno;
+        }
+    }
+    if (avformat_write_header(_ffmpeg->outFormatCtx, nullptr) < 0)
+        return ErrorLibrary;
+    _ffmpeg->headerWritten = true;
+    _desc = desc;
+    return ErrorNone;
+}
+
+Error FormatImportExportFFMPEG::writeArray(const ArrayContainer& array)
+{
+    if (array.dimensionCount() != 2
+            || array.dimension(0) < 1 || array.dimension(1) < 1
+            || array.dimension(0) > size_t(std::numeric_limits<int>::max())
+            || array.dimension(1) > size_t(std::numeric_limits<int>::max())
+            || array.componentCount() < 1 || array.componentCount() > 4
+            || (array.componentType() != uint8 && array.componentType() != uint16)) {
+        return ErrorFeaturesUnsupported;
+    }
+    if (!_ffmpeg->outFormatCtx)
+        return ErrorInvalidData;
+    if (!_ffmpeg->encCodecCtx) {
+        Error e = initializeWriting(array);
+        if (e != ErrorNone) {
+            close();
+            return e;
+        }
+    } else if (!array.isCompatible(_desc)) {
+        // all frames of a video must have the same size and pixel format
+        return ErrorFeaturesUnsupported;
+    }
+
+    // Convert to the encoder pixel format. The encoder may still reference the
+    // previous frame data, so get a new buffer if necessary.
+    int w = array.dimension(0);
+    int h = array.dimension(1);
+    _ffmpeg->swsCtx = sws_getCachedContext(_ffmpeg->swsCtx,
+            w, h, arrayPixelFormat(array.componentType(), array.componentCount()),
+            w, h, _ffmpeg->encCodecCtx->pix_fmt,
+            SWS_BILINEAR, nullptr, nullptr, nullptr);
+    if (!_ffmpeg->swsCtx || av_frame_make_writable(_ffmpeg->encFrame) < 0) {
+        close();
+        return ErrorLibrary;
+    }
+    // read the rows bottom to top since arrays store the bottom row first
+    size_t lineSize = array.dimension(0) * array.elementSize();
+    const uint8_t* src[4] = { static_cast<const uint8_t*>(array.data()) + (h - 1) * lineSize, nullptr, nullptr, nullptr };
+    int srcStride[4] = { -int(lineSize), 0, 0, 0 };
+    sws_scale(_ffmpeg->swsCtx, src, srcStride, 0, h, _ffmpeg->encFrame->data, _ffmpeg->encFrame->linesize);
+    _ffmpeg->encFrame->pts = _ffmpeg->encFrameCount++;
+    if (encodeFrame(_ffmpeg, _ffmpeg->encFrame) < 0) {
+        close();
+        return ErrorLibrary;
+    }
+    return ErrorNone;
 }
 
 extern "C" FormatImportExport* FormatImportExportFactory_ffmpeg()
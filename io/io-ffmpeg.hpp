@@ -43,8 +43,22 @@ private:
     std::vector<int64_t> _framePTSs;
     std::vector<int> _keyFrames;
     int _indexOfLastReadFrame;
+    // the frame index above can be loaded from and saved to a sidecar file
+    bool _frameIndexScanned;
+    bool _frameIndexComplete;
+    std::string _frameIndexFileName;
+    size_t _savedFrameIndexSize;
+    bool _savedFrameIndexComplete;
+    bool _reopening;
 
     bool hardReset(bool disableHWAccel);
+    bool fileStamp(long long& size, long long& mtime) const;
+    void checkFrameIndexComplete();
+    bool loadFrameIndex();
+    void saveFrameIndex();
+    bool scanFrameIndex();
+    Error readFrame(ArrayContainer* r, int arrayIndex);
+    Error initializeWriting(const ArrayDescription& desc);
 
 public:
     FormatImportExportFFMPEG();
@@ -57,7 +71,11 @@ public:
     // for reading:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual Error readArrayInto(ArrayContainer& target, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual Error readDescription(int arrayIndex, ArrayDescription& desc) override;
+
+    virtual bool isReentrant() const override { return true; }
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
@@ -24,10 +24,12 @@
 
 #include <cerrno>
 #include <string>
+#include <algorithm>
 
 #include <fitsio.h>
 
 #include "io-fits.hpp"
+#include "io-utils.hpp"
 
 
 namespace TGD {
@@ -53,12 +55,75 @@ Error FormatImportExportFITS::openForReading(const std::string& fileName, const
         return ErrorInvalidData;
     }
 
+    // List the image HDUs once so that arrays can be accessed randomly
+    int hdunum;
+    fits_get_num_hdus(static_cast<fitsfile*>(_f), &hdunum, &status);
+    for (int i = 1; i <= hdunum; i++) {
+        int hdutype = ANY_HDU;
+        fits_movabs_hdu(static_cast<fitsfile*>(_f), i, &hdutype, &status);
+        if (hdutype == IMAGE_HDU)
+            _imgHDUs.push_back(i);
+    }
+    if (status) {
+        close();
+        return ErrorInvalidData;
+    }
+    _fileName = fileName;
     return ErrorNone;
 }
 
-Error FormatImportExportFITS::openForWriting(const std::string&, bool, const TagList&)
+Error FormatImportExportFITS::openForWriting(const std::string& fileName, bool append, const TagList& hints)
 {
-    return ErrorFeaturesUnsupported;
+    if (fileName == "-")
+        return ErrorInvalidData;
+
+    std::string compression = hints.value("COMPRESSION", "none");
+    switch (compressionPreset(compression)) {
+    case CompressionFast:
+        _compression = RICE_1;
+        break;
+    case CompressionDefault:
+        _compression = GZIP_2;
+        break;
+    case CompressionSmall:
+        _compression = HCOMPRESS_1;
+        break;
+    case CompressionMethod:
+        if (compression == "none")
+            _compression = NOCOMPRESS;
+        else if (compression == "rice")
+            _compression = RICE_1;
+        else if (compression == "gzip")
+            _compression = GZIP_1;
+        else if (compression == "gzip2")
+            _compression = GZIP_2;
+        else if (compression == "hcompress")
+            _compression = HCOMPRESS_1;
+        else
+            return ErrorFeaturesUnsupported;
+        break;
+    }
+    long tileSize = hints.value("TILE_SIZE", 256L);
+    if (tileSize < 1)
+        return ErrorInvalidData;
+    _tileSize = std::vector<long>(2, tileSize);
+
+    int status = 0;
+    if (append) {
+        fits_open_file(reinterpret_cast<fitsfile**>(&_f), fileName.c_str(), READWRITE, &status);
+        int hdunum = 0;
+        fits_get_num_hdus(static_cast<fitsfile*>(_f), &hdunum, &status);
+        if (hdunum > 0)
+            fits_movabs_hdu(static_cast<fitsfile*>(_f), hdunum, nullptr, &status);
+    } else {
+        // the leading '!' lets CFITSIO overwrite an existing file
+        fits_create_file(reinterpret_cast<fitsfile**>(&_f), (std::string("!") + fileName).c_str(), &status);
+    }
+    if (status) {
+        close();
+        return ErrorLibrary;
+    }
+    return ErrorNone;
 }
 
 void FormatImportExportFITS::close()
@@ -68,55 +133,35 @@ void FormatImportExportFITS::close()
         fits_close_file(static_cast<fitsfile*>(_f), &status);
         _f = nullptr;
     }
-    _haveArrayCount = false;
+    _fileName.clear();
     _imgHDUs.clear();
     _indexOfLastReadArray = -1;
+    _compression = NOCOMPRESS;
+    _tileSize.clear();
 }
 
 int FormatImportExportFITS::arrayCount()
 {
-    if (!_haveArrayCount) {
-        int status = 0;
-        int hdunum;
-        fits_get_num_hdus(static_cast<fitsfile*>(_f), &hdunum, &status);
-        for (int i = 1; i <= hdunum; i++) {
-            int hdutype = ANY_HDU;
-            fits_movabs_hdu(static_cast<fitsfile*>(_f), i, &hdutype, &status);
-            if (hdutype == IMAGE_HDU)
-                _imgHDUs.push_back(i);
-        }
-        if (status)
-            _imgHDUs.clear();
-        _haveArrayCount = true;
-    }
     return _imgHDUs.size();
 }
 
-ArrayContainer FormatImportExportFITS::readArray(Error* error, int arrayIndex)
+/* Move to the image HDU of the given array and read its description and FITS data type */
+Error FormatImportExportFITS::readHeader(int arrayIndex, ArrayDescription& desc, int& fitsttype)
 {
-    if (arrayIndex >= arrayCount()) {
-        *error = ErrorInvalidData;
-        return ArrayContainer();
-    }
+    int index = (arrayIndex >= 0 ? arrayIndex : _indexOfLastReadArray + 1);
+    if (index >= arrayCount())
+        return ErrorInvalidData;
     int status = 0;
-    if (arrayIndex >= 0) {
-        fits_movabs_hdu(static_cast<fitsfile*>(_f), _imgHDUs[arrayIndex], nullptr, &status);
-    } else {
-        fits_movabs_hdu(static_cast<fitsfile*>(_f), _imgHDUs[_indexOfLastReadArray + 1], nullptr, &status);
-    }
-    if (status) {
-        *error = ErrorSeekingNotSupported;
-        return ArrayContainer();
-    }
+    fits_movabs_hdu(static_cast<fitsfile*>(_f), _imgHDUs[index], nullptr, &status);
+    if (status)
+        return ErrorSeekingNotSupported;
 
     int fitstype;
     fits_get_img_type(static_cast<fitsfile*>(_f), &fitstype, &status);
     if (status) {
-        *error = ErrorInvalidData;
-        return ArrayContainer();
+        return ErrorInvalidData;
     }
     Type type;
-    int fitsttype;
     if (fitstype == SBYTE_IMG) {
         type = int8;
         fitsttype = TSBYTE;
@@ -150,60 +195,253 @@ ArrayContainer FormatImportExportFITS::readArray(Error* error, int arrayIndex)
         type = float64;
         fitsttype = TDOUBLE;
     } else {
-        *error = ErrorFeaturesUnsupported;
-        return ArrayContainer();
+        return ErrorFeaturesUnsupported;
     }
 
     int fitsdimcount;
     fits_get_img_dim(static_cast<fitsfile*>(_f), &fitsdimcount, &status);
     if (status) {
-        *error = ErrorInvalidData;
-        return ArrayContainer();
+        return ErrorInvalidData;
     }
     if (fitsdimcount < 1) {
-        *error = ErrorFeaturesUnsupported;
-        return ArrayContainer();
+        return ErrorFeaturesUnsupported;
     }
     std::vector<long> fitsdims(fitsdimcount, -1);
     fits_get_img_size(static_cast<fitsfile*>(_f), fitsdimcount, fitsdims.data(), &status);
     if (status) {
-        *error = ErrorInvalidData;
-        return ArrayContainer();
+        return ErrorInvalidData;
     }
     std::vector<size_t> dims(fitsdims.size());
     for (int i = 0; i < fitsdimcount; i++) {
         if (fitsdims[i] < 1) {
-            *error = ErrorFeaturesUnsupported;
-            return ArrayContainer();
+            return ErrorFeaturesUnsupported;
         }
         dims[i] = fitsdims[i];
     }
 
-    ArrayContainer r(dims, 1, type);
-    for (int i = 0; i < fitsdimcount; i++)
-        fitsdims[i] = 1;
-    fits_read_pix(static_cast<fitsfile*>(_f), fitsttype, fitsdims.data(), r.elementCount(),
-            nullptr, r.data(), nullptr, &status);
-    if (status) {
+    desc = ArrayDescription(dims, 1, type);
+    return ErrorNone;
+}
+
+/* Read a box of the image in the current HDU into data. Tile-compressed images are
+ * decoded in parallel in bands of tiles along the last dimension, each band through
+ * its own file handle, if CFITSIO was built to be reentrant. */
+Error FormatImportExportFITS::readBox(int hdu, const ArrayDescription& desc, int fitsttype,
+        const std::vector<size_t>& index, const std::vector<size_t>& size, void* data)
+{
+    fitsfile* f = static_cast<fitsfile*>(_f);
+    size_t last = desc.dimensionCount() - 1;
+    size_t sliceSize = desc.elementSize();
+    for (size_t d = 0; d < last; d++)
+        sliceSize *= size[d];
+
+    auto readRows = [&] (fitsfile* g, size_t firstRow, size_t rowCount) -> int {
+        std::vector<long> fpixel(desc.dimensionCount());
+        std::vector<long> lpixel(desc.dimensionCount());
+        std::vector<long> inc(desc.dimensionCount(), 1);
+        for (size_t d = 0; d < desc.dimensionCount(); d++) {
+            fpixel[d] = index[d] + 1;
+            lpixel[d] = index[d] + size[d];
+        }
+        fpixel[last] = firstRow + 1;
+        lpixel[last] = firstRow + rowCount;
+        int status = 0;
+        fits_read_subset(g, fitsttype, fpixel.data(), lpixel.data(), inc.data(), nullptr,
+                static_cast<unsigned char*>(data) + (firstRow - index[last]) * sliceSize, nullptr, &status);
+        return status;
+    };
+
+    int status = 0;
+    size_t tileRows = 0;
+    if (defaultExecutionPolicy() != Sequential && ThreadPool::instance().threadCount() > 0
+            && fits_is_compressed_image(f, &status) && fits_is_reentrant()) {
+        // CFITSIO tiles are whole rows unless ZTILEn says otherwise
+        long t = (last == 0 ? desc.dimension(0) : 1);
+        std::string key = std::string("ZTILE") + std::to_string(last + 1);
+        int keyStatus = 0;
+        fits_read_key(f, TLONG, key.c_str(), &t, nullptr, &keyStatus);
+        tileRows = std::max(t, 1L);
+    }
+    size_t firstTile = (tileRows > 0 ? index[last] / tileRows : 0);
+    size_t tileCount = (tileRows > 0 ? (index[last] + size[last] - 1) / tileRows - firstTile + 1 : 1);
+    if (tileCount < 2) {
+        return readRows(f, index[last], size[last]) ? ErrorInvalidData : ErrorNone;
+    }
+
+    std::vector<int> errors(tileCount, 0);
+    ThreadPool::instance().parallelFor(tileCount, 1, [&] (size_t begin, size_t end) {
+            size_t firstRow = std::max(index[last], (firstTile + begin) * tileRows);
+            size_t endRow = std::min(index[last] + size[last], (firstTile + end) * tileRows);
+            fitsfile* g = nullptr;
+            int s = 0;
+            fits_open_file(&g, _fileName.c_str(), READONLY, &s);
+            fits_movabs_hdu(g, hdu, nullptr, &s);
+            if (!s)
+                s = readRows(g, firstRow, endRow - firstRow);
+            if (g) {
+                int closeStatus = 0;
+                fits_close_file(g, &closeStatus);
+            }
+            errors[begin] = s;
+        });
+    for (size_t i = 0; i < errors.size(); i++)
+        if (errors[i])
+            return ErrorInvalidData;
+    return ErrorNone;
+}
+
+ArrayContainer FormatImportExportFITS::readArray(Error* error, int arrayIndex)
+{
+    ArrayDescription desc;
+    int fitsttype;
+    Error e = readHeader(arrayIndex, desc, fitsttype);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    int index = (arrayIndex >= 0 ? arrayIndex : _indexOfLastReadArray + 1);
+    ArrayContainer r(desc);
+    e = readBox(_imgHDUs[index], desc, fitsttype, std::vector<size_t>(desc.dimensionCount(), 0),
+            desc.dimensions(), r.data());
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    _indexOfLastReadArray = index;
+    return r;
+}
+
+ArrayContainer FormatImportExportFITS::readArrayBox(Error* error, int arrayIndex,
+        const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize)
+{
+    ArrayDescription desc;
+    int fitsttype;
+    Error e = readHeader(arrayIndex, desc, fitsttype);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    std::vector<size_t> index, size;
+    if (!clipBox(desc, boxIndex, boxSize, index, size)) {
         *error = ErrorInvalidData;
         return ArrayContainer();
     }
-    if (arrayIndex >= 0) {
-        _indexOfLastReadArray = arrayIndex;
-    } else {
-        _indexOfLastReadArray++;
+    int arrayIndexToRead = (arrayIndex >= 0 ? arrayIndex : _indexOfLastReadArray + 1);
+    ArrayContainer r(size, desc.componentCount(), desc.componentType());
+    e = readBox(_imgHDUs[arrayIndexToRead], desc, fitsttype, index, size, r.data());
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
     }
+    _indexOfLastReadArray = arrayIndexToRead;
     return r;
 }
 
+Error FormatImportExportFITS::readDescription(int arrayIndex, ArrayDescription& desc)
+{
+    int fitsttype;
+    Error e = readHeader(arrayIndex, desc, fitsttype);
+    if (e == ErrorNone)
+        _indexOfLastReadArray = (arrayIndex >= 0 ? arrayIndex : _indexOfLastReadArray + 1);
+    return e;
+}
+
 bool FormatImportExportFITS::hasMore()
 {
     return (_indexOfLastReadArray < arrayCount() - 1);
 }
 
-Error FormatImportExportFITS::writeArray(const ArrayContainer&)
+Error FormatImportExportFITS::writeArray(const ArrayContainer& array)
 {
-    return ErrorFeaturesUnsupported;
+    if (array.componentCount() != 1)
+        return ErrorFeaturesUnsupported;
+
+    int bitpix;
+    int fitsttype;
+    bool integerUpTo32Bits = true;
+    switch (array.componentType()) {
+    case int8:
+        bitpix = SBYTE_IMG;
+        fitsttype = TSBYTE;
+        break;
+    case uint8:
+        bitpix = BYTE_IMG;
+        fitsttype = TBYTE;
+        break;
+    case int16:
+        bitpix = SHORT_IMG;
+        fitsttype = TSHORT;
+        break;
+    case uint16:
+        bitpix = USHORT_IMG;
+        fitsttype = TUSHORT;
+        break;
+    case int32:
+        bitpix = LONG_IMG;
+        fitsttype = TINT;
+        break;
+    case uint32:
+        bitpix = ULONG_IMG;
+        fitsttype = TUINT;
+        break;
+    case int64:
+        bitpix = LONGLONG_IMG;
+        fitsttype = TLONGLONG;
+        integerUpTo32Bits = false;
+        break;
+#ifdef ULONGLONG_IMG
+    case uint64:
+        bitpix = ULONGLONG_IMG;
+        fitsttype = TULONGLONG;
+        integerUpTo32Bits = false;
+        break;
+#endif
+    case float32:
+        bitpix = FLOAT_IMG;
+        fitsttype = TFLOAT;
+        integerUpTo32Bits = false;
+        break;
+    case float64:
+        bitpix = DOUBLE_IMG;
+        fitsttype = TDOUBLE;
+        integerUpTo32Bits = false;
+        break;
+    default:
+        return ErrorFeaturesUnsupported;
+    }
+
+    fitsfile* f = static_cast<fitsfile*>(_f);
+    int status = 0;
+    std::vector<long> naxes(array.dimensionCount());
+    for (size_t d = 0; d < naxes.size(); d++)
+        naxes[d] = array.dimension(d);
+
+    // Rice and H-compress are lossless only for integers of up to 32 bits, and
+    // H-compress needs 2D tiles; gzip2 is used where they do not apply.
+    // Floating point data is not quantized so that compression is lossless.
+    int compression = _compression;
+    if ((compression == RICE_1 || compression == HCOMPRESS_1) && !integerUpTo32Bits)
+        compression = GZIP_2;
+    if (compression == HCOMPRESS_1 && naxes.size() < 2)
+        compression = RICE_1;
+    fits_set_compression_type(f, compression, &status);
+    if (compression != NOCOMPRESS) {
+        std::vector<long> tileDims(naxes.size(), 1);
+        for (size_t d = 0; d < std::min(naxes.size(), _tileSize.size()); d++)
+            tileDims[d] = std::min(naxes[d], _tileSize[d]);
+        fits_set_tile_dim(f, tileDims.size(), tileDims.data(), &status);
+        if (array.componentType() == float32 || array.componentType() == float64)
+            fits_set_quantize_level(f, 0.0f, &status);
+    }
+
+    fits_create_img(f, bitpix, naxes.size(), naxes.data(), &status);
+    std::vector<long> firstPixel(naxes.size(), 1);
+    fits_write_pix(f, fitsttype, firstPixel.data(), array.elementCount(),
+            const_cast<void*>(array.data()), &status);
+    if (status) {
+        return ErrorLibrary;
+    }
+    return ErrorNone;
 }
 
 extern "C" FormatImportExport* FormatImportExportFactory_fits()
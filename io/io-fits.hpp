@@ -32,10 +32,16 @@ namespace TGD {
 
 class FormatImportExportFITS : public FormatImportExport {
 private:
+    std::string _fileName;
     void* _f;
-    bool _haveArrayCount;
     std::vector<int> _imgHDUs;
     int _indexOfLastReadArray;
+    int _compression;
+    std::vector<long> _tileSize;
+
+    Error readHeader(int arrayIndex, ArrayDescription& desc, int& fitsttype);
+    Error readBox(int hdu, const ArrayDescription& desc, int fitsttype,
+            const std::vector<size_t>& index, const std::vector<size_t>& size, void* data);
 
 public:
     FormatImportExportFITS();
@@ -49,6 +55,9 @@ public:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual Error readDescription(int arrayIndex, ArrayDescription& desc) override;
+    virtual ArrayContainer readArrayBox(Error* error, int arrayIndex,
+            const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize) override;
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
@@ -45,7 +45,7 @@ FormatImportExportGDAL::~FormatImportExportGDAL()
     close();
 }
 
-Error FormatImportExportGDAL::openForReading(const std::string& fileName, const TagList&)
+Error FormatImportExportGDAL::openForReading(const std::string& fileName, const TagList& hints)
 {
     if (fileName == "-")
         return ErrorInvalidData;
@@ -108,7 +108,15 @@ Error FormatImportExportGDAL::openForReading(const std::string& fileName, const
             return ErrorFeaturesUnsupported;
         }
     }
-    _desc = ArrayDescription({ width, height }, compCount, type);
+    // Reduced resolution: GDAL reads from overviews if they exist when the
+    // buffer is smaller than the raster window
+    unsigned int level;
+    Error e = reducedImageLevel(hints, width, height, level);
+    if (e != ErrorNone) {
+        close();
+        return e;
+    }
+    _desc = ArrayDescription({ reducedImageSize(width, level), reducedImageSize(height, level) }, compCount, type);
 
     std::string description = GDALGetDescription(_dataset);
     if (description.length() > 0 && description != fileName)
@@ -117,6 +125,12 @@ Error FormatImportExportGDAL::openForReading(const std::string& fileName, const
         _desc.globalTagList().set("GDAL/PROJECTION", GDALGetProjectionRef(_dataset));
     double geoTransform[6];
     if (GDALGetGeoTransform(_dataset, geoTransform) == CE_None) {
+        double scaleX = double(width) / _desc.dimension(0);
+        double scaleY = double(height) / _desc.dimension(1);
+        geoTransform[1] *= scaleX;
+        geoTransform[2] *= scaleY;
+        geoTransform[4] *= scaleX;
+        geoTransform[5] *= scaleY;
         _desc.globalTagList().set("GDAL/GEO_TRANSFORM",
                 std::to_string(geoTransform[0]) + " "
                 + std::to_string(geoTransform[1]) + " "
@@ -233,7 +247,7 @@ ArrayContainer FormatImportExportGDAL::readArray(Error* error, int arrayIndex)
     }
     ArrayContainer r(_desc);
     CPLErr err = GDALDatasetRasterIO(_dataset, GF_Read,
-            0, 0, r.dimension(0), r.dimension(1),
+            0, 0, GDALGetRasterXSize(_dataset), GDALGetRasterYSize(_dataset),
             r.data(), r.dimension(0), r.dimension(1),
             static_cast<GDALDataType>(_gdalType), r.componentCount(), nullptr,
             r.elementSize(), r.elementSize() * r.dimension(0), r.componentSize());
@@ -246,6 +260,16 @@ ArrayContainer FormatImportExportGDAL::readArray(Error* error, int arrayIndex)
     return r;
 }
 
+Error FormatImportExportGDAL::readDescription(int arrayIndex, ArrayDescription& desc)
+{
+    if (arrayIndex >= arrayCount())
+        return ErrorInvalidData;
+    // the description is known from the metadata
+    desc = _desc;
+    _arrayWasRead = true;
+    return ErrorNone;
+}
+
 bool FormatImportExportGDAL::hasMore()
 {
     return !_arrayWasRead;
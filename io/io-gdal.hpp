@@ -48,6 +48,9 @@ public:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual Error readDescription(int arrayIndex, ArrayDescription& desc) override;
+
+    virtual bool isReentrant() const override { return true; }
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
@@ -335,6 +335,8 @@ bool FormatImportExportGTA::hasMore()
 
 Error FormatImportExportGTA::writeArray(const ArrayContainer& array)
 {
+    if (array.componentType() == float16 || array.componentType() == bfloat16)
+        return ErrorFeaturesUnsupported;
     Error e = ErrorNone;
     try {
         gta::header hdr;
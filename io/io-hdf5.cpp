@@ -23,6 +23,8 @@
  */
 
 #include <cstdio>
+#include <cmath>
+#include <algorithm>
 
 #include "io-hdf5.hpp"
 #include "io-utils.hpp"
@@ -32,7 +34,7 @@
 
 namespace TGD {
 
-FormatImportExportHDF5::FormatImportExportHDF5() : _f(nullptr), _counter(0)
+FormatImportExportHDF5::FormatImportExportHDF5() : _f(nullptr), _counter(0), _slabDatasetIndex(-1), _shuffle(true)
 {
     H5::Exception::dontPrint();
 }
@@ -42,7 +44,59 @@ FormatImportExportHDF5::~FormatImportExportHDF5()
     close();
 }
 
-Error FormatImportExportHDF5::openForReading(const std::string& fileName, const TagList&)
+static herr_t datasetVisitor(hid_t /* loc_id */, const char* name, const H5L_info_t* /* linfo */, void* opdata)
+{
+    std::vector<std::string>* datasetNames = reinterpret_cast<std::vector<std::string>*>(opdata);
+    datasetNames->push_back(name);
+    return 0;
+}
+
+/* HDF5 has no predefined half precision types; they are described by their bit fields */
+static H5::FloatType halfFloatType(Type t)
+{
+    H5::FloatType type(H5::PredType::NATIVE_FLOAT);
+    if (t == float16) {
+        type.setFields(15, 10, 5, 0, 10);
+        type.setSize(2);
+        type.setEbias(15);
+    } else {
+        type.setFields(15, 7, 8, 0, 7);
+        type.setSize(2);
+        type.setEbias(127);
+    }
+    return type;
+}
+
+/* Open the file with the chunk cache size requested by the hint CHUNK_CACHE_SIZE
+ * (in bytes), and gather the list of datasets. */
+Error FormatImportExportHDF5::openFile(const std::string& fileName, unsigned int flags, const TagList& hints)
+{
+    H5::FileAccPropList fapl;
+    size_t chunkCacheSize = hints.value("CHUNK_CACHE_SIZE", size_t(0));
+    if (chunkCacheSize > 0) {
+        // the number of hash table slots should be a prime number about 100 times
+        // larger than the number of chunks that fit in the cache; this is a rough guess
+        fapl.setCache(0, 12421, chunkCacheSize, 0.75);
+    }
+    _f = new H5::H5File;
+    try {
+        *_f = H5::H5File(fileName.c_str(), flags, H5::FileCreatPropList::DEFAULT, fapl);
+    }
+    catch (H5::Exception& error) {
+        delete _f;
+        _f = nullptr;
+        if (flags == H5F_ACC_RDONLY)
+            return ErrorInvalidData;
+        fprintf(stderr, "%s: %s\n", fileName.c_str(), error.getCDetailMsg());
+        return ErrorLibrary;
+    }
+    _datasetNames.clear();
+    if (flags != H5F_ACC_TRUNC)
+        H5Literate(_f->getId(), H5_INDEX_NAME, H5_ITER_INC, NULL, datasetVisitor, &_datasetNames);
+    return ErrorNone;
+}
+
+Error FormatImportExportHDF5::openForReading(const std::string& fileName, const TagList& hints)
 {
     if (fileName == "-") {
         return ErrorInvalidData;
@@ -52,21 +106,37 @@ Error FormatImportExportHDF5::openForReading(const std::string& fileName, const
             return ErrorSysErrno;
         }
         fclose(f);
-        _f = new H5::H5File;
-        try {
-            _f->openFile(fileName.c_str(), H5F_ACC_RDONLY);
-        }
-        catch (H5::Exception& error) {
-            delete _f;
-            _f = nullptr;
-            return ErrorInvalidData;
-        }
-        return ErrorNone;
+        return openFile(fileName, H5F_ACC_RDONLY, hints);
     }
 }
 
-Error FormatImportExportHDF5::openForWriting(const std::string& fileName, bool append, const TagList&)
+Error FormatImportExportHDF5::openForWriting(const std::string& fileName, bool append, const TagList& hints)
 {
+    // Chunked layout: requested by a compression method or a chunk size
+    _compression = hints.value("COMPRESSION", "none");
+    if (_compression == "deflate") {
+        if (!H5Zfilter_avail(H5Z_FILTER_DEFLATE))
+            return ErrorFeaturesUnsupported;
+    } else if (_compression == "szip") {
+        if (!H5Zfilter_avail(H5Z_FILTER_SZIP))
+            return ErrorFeaturesUnsupported;
+    } else if (_compression != "none") {
+        return ErrorFeaturesUnsupported;
+    }
+    _shuffle = hints.value("SHUFFLE", true);
+    _chunkSize.clear();
+    size_t chunkSize = hints.value("CHUNK_SIZE", size_t(0));
+    if (hints.contains("CHUNK_SIZE0")) {
+        for (size_t d = 0; hints.contains(std::string("CHUNK_SIZE") + std::to_string(d)); d++) {
+            size_t s = hints.value(std::string("CHUNK_SIZE") + std::to_string(d), size_t(0));
+            if (s == 0)
+                return ErrorInvalidData;
+            _chunkSize.push_back(s);
+        }
+    } else if (chunkSize > 0) {
+        _chunkSize.push_back(chunkSize);
+    }
+
     if (fileName == "-") {
         return ErrorInvalidData;
     } else {
@@ -78,16 +148,9 @@ Error FormatImportExportHDF5::openForWriting(const std::string& fileName, bool a
         if (!append) {
             remove(fileName.c_str());
         }
-        _f = new H5::H5File;
-        try {
-            *_f = H5::H5File(fileName.c_str(), append ? H5F_ACC_RDWR : H5F_ACC_TRUNC);
-        }
-        catch (H5::Exception& error) {
-            fprintf(stderr, "%s: %s\n", fileName.c_str(), error.getCDetailMsg());
-            delete _f;
-            _f = nullptr;
-            return ErrorLibrary;
-        }
+        Error e = openFile(fileName, append ? H5F_ACC_RDWR : H5F_ACC_TRUNC, hints);
+        if (e != ErrorNone)
+            return e;
         _counter = arrayCount();
         return ErrorNone;
     }
@@ -104,24 +167,33 @@ void FormatImportExportHDF5::close()
         delete _f;
         _f = nullptr;
     }
-}
-
-static herr_t datasetVisitor(hid_t /* loc_id */, const char* name, const H5L_info_t* /* linfo */, void* opdata)
-{
-    std::vector<std::string>* datasetNames = reinterpret_cast<std::vector<std::string>*>(opdata);
-    datasetNames->push_back(name);
-    return 0;
+    _datasetNames.clear();
+    _counter = 0;
+    _slabDatasetIndex = -1;
 }
 
 int FormatImportExportHDF5::arrayCount()
 {
-    if (_datasetNames.size() == 0) {
-        H5Literate(_f->getId(), H5_INDEX_NAME, H5_ITER_INC, NULL, datasetVisitor, &_datasetNames);
-    }
     return _datasetNames.size();
 }
 
 ArrayContainer FormatImportExportHDF5::readArray(Error* error, int arrayIndex)
+{
+    return readArrayHelper(error, arrayIndex, nullptr, nullptr);
+}
+
+ArrayContainer FormatImportExportHDF5::readArrayBox(Error* error, int arrayIndex,
+        const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize)
+{
+    return readArrayHelper(error, arrayIndex, &boxIndex, &boxSize);
+}
+
+/* If arrayDimensions is given, it is set to the dimensions of the complete array.
+ * If additionally no box is given, only the first element is read (to find out the
+ * component count and type as well as the tags of the array). */
+ArrayContainer FormatImportExportHDF5::readArrayHelper(Error* error, int arrayIndex,
+        const std::vector<size_t>* boxIndex, const std::vector<size_t>* boxSize,
+        std::vector<size_t>* arrayDimensions, bool readAttributes)
 {
     int datasetIndex;
     if (arrayIndex >= 0) {
@@ -189,6 +261,9 @@ ArrayContainer FormatImportExportHDF5::readArray(Error* error, int arrayIndex)
         } else if (datatype.getSize() == 8) {
             type = H5::PredType::NATIVE_DOUBLE;
             rType = float64;
+        } else if (datatype.getSize() == 2) {
+            rType = (dataset.getFloatType().getEbias() == 15 ? float16 : bfloat16);
+            type = halfFloatType(rType);
         } else {
             *error = ErrorFeaturesUnsupported;
             return ArrayContainer();
@@ -205,12 +280,48 @@ ArrayContainer FormatImportExportHDF5::readArray(Error* error, int arrayIndex)
     }
     std::vector<hsize_t> hdims(dimCount);
     dataspace.getSimpleExtentDims(hdims.data(), nullptr);
+    // For a box, select the corresponding hyperslab of the data space.
+    // See reorderMatlabInputData() for the relation of the HDF5 dimensions
+    // to the array dimensions and components.
+    std::vector<hsize_t> hstart(dimCount, 0);
+    bool hasComponentDim = (dimCount > 2 && hdims[0] <= 4);
+    size_t firstArrayDim = (hasComponentDim ? 1 : 0);
+    std::vector<size_t> arrayDims(hdims.begin() + firstArrayDim, hdims.end());
+    std::vector<size_t> firstElementIndex, firstElementSize;
+    if (arrayDimensions) {
+        *arrayDimensions = arrayDims;
+        if (!boxIndex) {
+            firstElementIndex = std::vector<size_t>(arrayDims.size(), 0);
+            firstElementSize = std::vector<size_t>(arrayDims.size(), 1);
+            boxIndex = &firstElementIndex;
+            boxSize = &firstElementSize;
+        }
+    }
+    if (boxIndex) {
+        std::vector<size_t> index, size;
+        if (!clipBox(ArrayDescription(arrayDims, 1, rType), *boxIndex, *boxSize, index, size)) {
+            *error = ErrorInvalidData;
+            return ArrayContainer();
+        }
+        for (size_t d = 0; d < index.size(); d++) {
+            hstart[firstArrayDim + d] = index[d];
+            hdims[firstArrayDim + d] = size[d];
+        }
+        if (hasComponentDim && arrayDims.size() == 2) // images are flipped in y
+            hstart[2] = arrayDims[1] - index[1] - size[1];
+    }
     std::vector<size_t> dims(dimCount);
     for (size_t i = 0; i < dims.size(); i++)
         dims[i] = hdims[dims.size() - 1 - i];
     ArrayContainer dataArray(dims, 1, rType);
     try {
-        dataset.read(dataArray.data(), type, dataspace, dataspace);
+        if (boxIndex) {
+            H5::DataSpace memspace(dimCount, hdims.data());
+            dataspace.selectHyperslab(H5S_SELECT_SET, hdims.data(), hstart.data());
+            dataset.read(dataArray.data(), type, memspace, dataspace);
+        } else {
+            dataset.read(dataArray.data(), type, dataspace, dataspace);
+        }
     }
     catch (H5::Exception& e) {
         *error = ErrorLibrary;
@@ -219,7 +330,7 @@ ArrayContainer FormatImportExportHDF5::readArray(Error* error, int arrayIndex)
     ArrayContainer r = reorderMatlabInputData(dims, rType, dataArray.data());
     // read attributes
     H5::StrType strType(H5::PredType::C_S1, H5T_VARIABLE);
-    for (int i = 0; i < dataset.getNumAttrs(); i++) {
+    for (int i = 0; readAttributes && i < dataset.getNumAttrs(); i++) {
         H5::Attribute a = dataset.openAttribute(i);
         std::string name = a.getName();
         std::string value;
@@ -248,6 +359,44 @@ ArrayContainer FormatImportExportHDF5::readArray(Error* error, int arrayIndex)
     return r;
 }
 
+Error FormatImportExportHDF5::readDescription(int arrayIndex, ArrayDescription& desc)
+{
+    // only the first element is read
+    Error e = ErrorNone;
+    std::vector<size_t> dims;
+    ArrayContainer firstElement = readArrayHelper(&e, arrayIndex, nullptr, nullptr, &dims);
+    if (e != ErrorNone)
+        return e;
+    desc = ArrayDescription(dims, firstElement.componentCount(), firstElement.componentType());
+    copyTagLists(firstElement, desc);
+    return ErrorNone;
+}
+
+Error FormatImportExportHDF5::beginReadSlabs(int arrayIndex, ArrayDescription& desc)
+{
+    int datasetIndex = (arrayIndex >= 0 ? arrayIndex : _counter);
+    Error e = readDescription(datasetIndex, desc);
+    if (e != ErrorNone)
+        return e;
+    _slabDatasetIndex = datasetIndex;
+    _slabDescription = desc;
+    if (arrayIndex < 0)
+        _counter++;
+    return ErrorNone;
+}
+
+ArrayContainer FormatImportExportHDF5::readSlab(Error* error, size_t sliceIndex, size_t sliceCount)
+{
+    std::vector<size_t> boxIndex(_slabDescription.dimensionCount(), 0);
+    std::vector<size_t> boxSize = _slabDescription.dimensions();
+    boxIndex.back() = sliceIndex;
+    boxSize.back() = sliceCount;
+    // the attributes are known from beginReadSlabs()
+    ArrayContainer r = readArrayHelper(error, _slabDatasetIndex, &boxIndex, &boxSize, nullptr, false);
+    copyTagLists(_slabDescription, r);
+    return r;
+}
+
 bool FormatImportExportHDF5::hasMore()
 {
     return (_counter < arrayCount());
@@ -298,6 +447,10 @@ Error FormatImportExportHDF5::writeArray(const ArrayContainer& array)
     case TGD::float64:
         type = H5::FloatType(H5::PredType::NATIVE_DOUBLE);
         break;
+    case TGD::float16:
+    case TGD::bfloat16:
+        type = halfFloatType(array.componentType());
+        break;
     }
     ArrayContainer dataArray = reorderMatlabOutputData(array);
     std::vector<hsize_t> dims(dataArray.dimensionCount());
@@ -307,8 +460,32 @@ Error FormatImportExportHDF5::writeArray(const ArrayContainer& array)
     }
     H5::DataSpace dataspace(dims.size(), dims.data());
     try {
-        H5::DataSet dataset = _f->createDataSet(datasetname.c_str(), type, dataspace);
+        H5::DSetCreatPropList dcpl;
+        if (_compression != "none" || _chunkSize.size() > 0) {
+            // The chunk size applies to the array dimensions; all components
+            // of an element are always in the same chunk. Without a requested
+            // chunk size, aim for chunks of about 1 MiB.
+            std::vector<hsize_t> chunkDims(dims.size());
+            chunkDims[0] = dims[0];
+            size_t defaultChunkSize = std::max(size_t(1), size_t(std::pow(
+                            double(size_t(1) << 20) / array.elementSize(), 1.0 / array.dimensionCount())));
+            for (size_t i = 1; i < dims.size(); i++) {
+                size_t s = (_chunkSize.size() == 0 ? defaultChunkSize
+                        : _chunkSize.size() == 1 ? _chunkSize[0]
+                        : i - 1 < _chunkSize.size() ? _chunkSize[i - 1] : dims[i]);
+                chunkDims[i] = std::min(hsize_t(s), dims[i]);
+            }
+            dcpl.setChunk(chunkDims.size(), chunkDims.data());
+            if (_compression != "none" && _shuffle)
+                dcpl.setShuffle();
+            if (_compression == "deflate")
+                dcpl.setDeflate(6);
+            else if (_compression == "szip")
+                dcpl.setSzip(H5_SZIP_NN_OPTION_MASK, 16);
+        }
+        H5::DataSet dataset = _f->createDataSet(datasetname.c_str(), type, dataspace, dcpl);
         dataset.write(dataArray.data(), type);
+        _datasetNames.push_back(datasetname);
         // write attributes
         H5::StrType strType(H5::PredType::C_S1, H5T_VARIABLE);
         H5::DataSpace attSpace(H5S_SCALAR);
@@ -39,9 +39,20 @@ namespace TGD {
 class FormatImportExportHDF5 : public FormatImportExport {
 private:
     H5::H5File* _f;
-    std::vector<std::string> _datasetNames; // for reading only
+    std::vector<std::string> _datasetNames; // gathered once when opening
     int _counter;
-    
+    int _slabDatasetIndex;
+    ArrayDescription _slabDescription;
+    // for writing:
+    std::string _compression;
+    bool _shuffle;
+    std::vector<size_t> _chunkSize;
+
+    Error openFile(const std::string& fileName, unsigned int flags, const TagList& hints);
+    ArrayContainer readArrayHelper(Error* error, int arrayIndex,
+            const std::vector<size_t>* boxIndex, const std::vector<size_t>* boxSize,
+            std::vector<size_t>* arrayDimensions = nullptr, bool readAttributes = true);
+
 public:
     FormatImportExportHDF5();
     ~FormatImportExportHDF5();
@@ -54,6 +65,11 @@ public:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual Error readDescription(int arrayIndex, ArrayDescription& desc) override;
+    virtual ArrayContainer readArrayBox(Error* error, int arrayIndex,
+            const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize) override;
+    virtual Error beginReadSlabs(int arrayIndex, ArrayDescription& desc) override;
+    virtual ArrayContainer readSlab(Error* error, size_t sliceIndex, size_t sliceCount) override;
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
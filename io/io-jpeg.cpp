@@ -23,6 +23,8 @@
  */
 
 #include <cstdio>
+#include <algorithm>
+#include <vector>
 
 #include <setjmp.h>
 #include <jpeglib.h>
@@ -47,7 +49,8 @@ static void my_error_exit(j_common_ptr cinfo)
 }
 
 FormatImportExportJPEG::FormatImportExportJPEG() :
-    _f(nullptr), _arrayWasReadOrWritten(false)
+    _f(nullptr), _arrayWasReadOrWritten(false),
+    _quality(85), _subsampling(2), _optimize(false), _progressive(false)
 {
 }
 
@@ -56,8 +59,9 @@ FormatImportExportJPEG::~FormatImportExportJPEG()
     close();
 }
 
-Error FormatImportExportJPEG::openForReading(const std::string& fileName, const TagList&)
+Error FormatImportExportJPEG::openForReading(const std::string& fileName, const TagList& hints)
 {
+    _hints = hints;
     if (fileName == "-") {
         _f = stdin;
     } else {
@@ -68,10 +72,24 @@ Error FormatImportExportJPEG::openForReading(const std::string& fileName, const
     return _f ? ErrorNone : ErrorSysErrno;
 }
 
-Error FormatImportExportJPEG::openForWriting(const std::string& fileName, bool append, const TagList&)
+Error FormatImportExportJPEG::openForWriting(const std::string& fileName, bool append, const TagList& hints)
 {
     if (append)
         return ErrorFeaturesUnsupported;
+    _quality = hints.value("QUALITY", 85);
+    if (_quality < 1 || _quality > 100)
+        return ErrorInvalidData;
+    std::string subsampling = hints.value("SUBSAMPLING", "420");
+    if (subsampling == "444")
+        _subsampling = 1;
+    else if (subsampling == "422")
+        _subsampling = -2; // horizontal only
+    else if (subsampling == "420")
+        _subsampling = 2;
+    else
+        return ErrorInvalidData;
+    _optimize = hints.value("OPTIMIZE", false);
+    _progressive = hints.value("PROGRESSIVE", false);
     if (fileName == "-") {
         _f = stdout;
     } else {
@@ -101,61 +119,132 @@ int FormatImportExportJPEG::arrayCount()
 
 ArrayContainer FormatImportExportJPEG::readArray(Error* error, int arrayIndex)
 {
-    if (arrayIndex > 0) {
-        *error = ErrorSeekingNotSupported;
+    ArrayContainer r;
+    Error e = readArrayInto(r, arrayIndex);
+    if (e != ErrorNone) {
+        *error = e;
         return ArrayContainer();
     }
+    return r;
+}
+
+static void setInterpretationTags(ArrayDescription& desc)
+{
+    if (desc.componentCount() == 1) {
+        desc.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
+    } else {
+        desc.componentTagList(0).set("INTERPRETATION", "SRGB/R");
+        desc.componentTagList(1).set("INTERPRETATION", "SRGB/G");
+        desc.componentTagList(2).set("INTERPRETATION", "SRGB/B");
+    }
+}
+
+Error FormatImportExportJPEG::readArrayInto(ArrayContainer& r, int arrayIndex)
+{
+    return readHelper(arrayIndex, &r, nullptr);
+}
+
+Error FormatImportExportJPEG::readDescription(int arrayIndex, ArrayDescription& desc)
+{
+    return readHelper(arrayIndex, nullptr, &desc);
+}
+
+Error FormatImportExportJPEG::readHelper(int arrayIndex, ArrayContainer* array, ArrayDescription* description)
+{
+    if (arrayIndex > 0) {
+        return ErrorSeekingNotSupported;
+    }
     std::rewind(_f);
 
     struct jpeg_decompress_struct cinfo;
     struct my_error_mgr jerr;
+    std::vector<JSAMPROW> jrows;
+    ImageOriginLocation originLocation = getImageOriginLocation(_fileName);
 
     cinfo.err = jpeg_std_error(&jerr.pub);
     jerr.pub.error_exit = my_error_exit;
     if (setjmp(jerr.setjmp_buffer)) {
         jpeg_destroy_decompress(&cinfo);
-        *error = ErrorInvalidData;
-        return ArrayContainer();
+        return ErrorInvalidData;
     }
     jpeg_create_decompress(&cinfo);
     jpeg_stdio_src(&cinfo, _f);
     jpeg_read_header(&cinfo, TRUE);
 
-    ArrayContainer r({cinfo.image_width, cinfo.image_height}, cinfo.num_components, uint8);
-    if (cinfo.num_components == 1) {
-        r.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
-    } else {
-        r.componentTagList(0).set("INTERPRETATION", "SRGB/R");
-        r.componentTagList(1).set("INTERPRETATION", "SRGB/G");
-        r.componentTagList(2).set("INTERPRETATION", "SRGB/B");
+    // Reduced resolution: libjpeg can scale by 1/2, 1/4, 1/8 almost for free
+    // by skipping the higher DCT coefficients; further reduction is done afterwards.
+    // SCALE=1/N is an alternative to LEVEL.
+    unsigned int level;
+    Error e = (originSwapsAxes(originLocation)
+            ? reducedImageLevel(_hints, cinfo.image_height, cinfo.image_width, level)
+            : reducedImageLevel(_hints, cinfo.image_width, cinfo.image_height, level));
+    if (_hints.contains("SCALE")) {
+        const std::string& scale = _hints.value("SCALE");
+        unsigned int scaleLevel = (scale == "1" || scale == "1/1" ? 0
+                : scale == "1/2" ? 1 : scale == "1/4" ? 2 : scale == "1/8" ? 3 : 4);
+        if (scaleLevel > 3)
+            e = ErrorInvalidData;
+        level = std::max(level, scaleLevel);
+    }
+    if (e != ErrorNone) {
+        jpeg_destroy_decompress(&cinfo);
+        return e;
+    }
+    if (level > 0) {
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = 1 << std::min(level, 3u);
+    }
+    jpeg_calc_output_dimensions(&cinfo);
+    size_t reducedWidth = reducedImageSize(cinfo.image_width, level);
+    size_t reducedHeight = reducedImageSize(cinfo.image_height, level);
+
+    if (description) {
+        // the header suffices
+        *description = (originSwapsAxes(originLocation)
+                ? ArrayDescription({ reducedHeight, reducedWidth }, cinfo.num_components, uint8)
+                : ArrayDescription({ reducedWidth, reducedHeight }, cinfo.num_components, uint8));
+        setInterpretationTags(*description);
+        jpeg_destroy_decompress(&cinfo);
+        _arrayWasReadOrWritten = true;
+        return ErrorNone;
+    }
+
+    ArrayContainer& r = *array;
+    prepareArray(r, ArrayDescription({cinfo.output_width, cinfo.output_height}, cinfo.num_components, uint8));
+    setInterpretationTags(r);
+    if (_hints.value("FAST", false)) {
+        // faster, at a small cost in quality
+        cinfo.do_fancy_upsampling = FALSE;
+        cinfo.dct_method = JDCT_IFAST;
     }
-    ImageOriginLocation originLocation = getImageOriginLocation(_fileName);
-#if 0
-    // These flags improve performance, but at unclear costs in quality.
-    cinfo.do_fancy_upsampling = TRUE;
-    cinfo.dct_method = JDCT_FASTEST;
-#endif
     jpeg_start_decompress(&cinfo);
-    std::vector<JSAMPROW> jrows(cinfo.output_height);
+    // libjpeg decodes directly into the final rows of the array
+    jrows.resize(cinfo.output_height);
     for (unsigned int i = 0; i < cinfo.output_height; i++) {
-        if (originLocation == OriginTopLeft)
-            jrows[i] = static_cast<unsigned char*>(r.get((cinfo.output_height - 1 - i) * cinfo.image_width));
-        else
-            jrows[i] = static_cast<unsigned char*>(r.get(i * cinfo.image_width));
+        size_t y = originDestinationRow(originLocation, cinfo.output_height, i);
+        jrows[i] = static_cast<unsigned char*>(r.get(y * cinfo.output_width));
     }
-    while (cinfo.output_scanline < cinfo.image_height) {
-        jpeg_read_scanlines(&cinfo, &jrows[cinfo.output_scanline],
+    bool mirrorRows = originMirrorsX(originLocation);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JDIMENSION firstRow = cinfo.output_scanline;
+        JDIMENSION rows = jpeg_read_scanlines(&cinfo, &jrows[cinfo.output_scanline],
                 cinfo.output_height - cinfo.output_scanline);
+        if (mirrorRows) {
+            for (JDIMENSION i = firstRow; i < firstRow + rows; i++)
+                reverseRow(cinfo.output_width, r.elementSize(), jrows[i]);
+        }
     }
     jpeg_finish_decompress(&cinfo);
     jpeg_destroy_decompress(&cinfo);
 
-    if (originLocation != OriginTopLeft)
+    if (r.dimension(0) != reducedWidth || r.dimension(1) != reducedHeight)
+        r = reduceImage(r, reducedWidth, reducedHeight);
+    if (originSwapsAxes(originLocation))
         fixImageOrientation(r, originLocation);
 
     _arrayWasReadOrWritten = true;
 
-    return r;
+    return ErrorNone;
 }
 
 bool FormatImportExportJPEG::hasMore()
@@ -190,7 +279,15 @@ Error FormatImportExportJPEG::writeArray(const ArrayContainer& array)
     cinfo.input_components = array.componentCount();
     cinfo.in_color_space = (array.componentCount() == 1 ? JCS_GRAYSCALE : JCS_RGB);
     jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, 85, TRUE);
+    jpeg_set_quality(&cinfo, _quality, TRUE);
+    if (cinfo.in_color_space == JCS_RGB) {
+        // the first component (Y) determines the chroma subsampling
+        cinfo.comp_info[0].h_samp_factor = (_subsampling == 1 ? 1 : 2);
+        cinfo.comp_info[0].v_samp_factor = (_subsampling == 2 ? 2 : 1);
+    }
+    cinfo.optimize_coding = (_optimize ? TRUE : FALSE);
+    if (_progressive)
+        jpeg_simple_progression(&cinfo);
 
     jpeg_start_compress(&cinfo, TRUE);
     std::vector<JSAMPROW> jrows(cinfo.image_height);
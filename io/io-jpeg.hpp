@@ -35,7 +35,15 @@ class FormatImportExportJPEG : public FormatImportExport {
 private:
     FILE* _f;
     std::string _fileName;
+    TagList _hints;
     bool _arrayWasReadOrWritten;
+    // for writing:
+    int _quality;
+    int _subsampling; // horizontal and vertical chroma subsampling factor
+    bool _optimize;
+    bool _progressive;
+
+    Error readHelper(int arrayIndex, ArrayContainer* array, ArrayDescription* description);
 
 public:
     FormatImportExportJPEG();
@@ -48,7 +56,11 @@ public:
     // for reading:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual Error readArrayInto(ArrayContainer& target, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual Error readDescription(int arrayIndex, ArrayDescription& desc) override;
+
+    virtual bool isReentrant() const override { return true; }
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
@@ -26,6 +26,7 @@
 
 #include <vector>
 #include <limits>
+#include <string>
 
 #include <Magick++.h>
 #if MagickLibVersion < 0x700
@@ -101,6 +102,55 @@ int FormatImportExportMagick::arrayCount()
     return _magick->imgs.size();
 }
 
+static ImageOriginLocation magickOrigin(Magick::Image& img)
+{
+    switch (img.orientation()) {
+    case Magick::UndefinedOrientation:
+    case Magick::TopLeftOrientation:
+        return OriginTopLeft;
+    case Magick::TopRightOrientation:
+        return OriginTopRight;
+    case Magick::BottomRightOrientation:
+        return OriginBottomRight;
+    case Magick::BottomLeftOrientation:
+        return OriginBottomLeft;
+    case Magick::LeftTopOrientation:
+        return OriginLeftTop;
+    case Magick::RightTopOrientation:
+        return OriginRightTop;
+    case Magick::RightBottomOrientation:
+        return OriginRightBottom;
+    case Magick::LeftBottomOrientation:
+        return OriginLeftBottom;
+    }
+    return OriginTopLeft;
+}
+
+static ArrayDescription magickDescription(Magick::Image& img, bool& isGray, bool& hasAlpha)
+{
+    size_t width = img.columns();
+    size_t height = img.rows();
+    Type type = (img.depth() <= 8 ? uint8
+            : img.depth() <= 16 ? uint16
+            : float32);
+    hasAlpha = (img.alpha());
+    isGray = (img.colorSpaceType() == Magick::GRAYColorspace);
+    unsigned int channels = (isGray ? 1 : 3) + (hasAlpha ? 1 : 0);
+
+    ArrayDescription desc({ width, height }, channels, type);
+    if (isGray) {
+        desc.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
+    } else {
+        desc.componentTagList(0).set("INTERPRETATION", "SRGB/R");
+        desc.componentTagList(1).set("INTERPRETATION", "SRGB/G");
+        desc.componentTagList(2).set("INTERPRETATION", "SRGB/B");
+    }
+    if (hasAlpha) {
+        desc.componentTagList(isGray ? 1 : 3).set("INTERPRETATION", "ALPHA");
+    }
+    return desc;
+}
+
 ArrayContainer FormatImportExportMagick::readArray(Error* error, int arrayIndex)
 {
     readImagesOnce(_fileName, _triedReading, _magick->imgs);
@@ -115,54 +165,12 @@ ArrayContainer FormatImportExportMagick::readArray(Error* error, int arrayIndex)
     ImageOriginLocation originLocation = OriginTopLeft;
     try {
         Magick::Image& img = _magick->imgs[arrayIndex];
-        size_t width = img.columns();
-        size_t height = img.rows();
-        Type type = (img.depth() <= 8 ? uint8
-                : img.depth() <= 16 ? uint16
-                : float32);
-        bool hasAlpha = (img.alpha());
-        bool isGray = (img.colorSpaceType() == Magick::GRAYColorspace);
-        unsigned int channels = (isGray ? 1 : 3) + (hasAlpha ? 1 : 0);
-
-        array = TGD::ArrayContainer({ width, height }, channels, type);
-        if (isGray) {
-            array.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
-        } else {
-            array.componentTagList(0).set("INTERPRETATION", "SRGB/R");
-            array.componentTagList(1).set("INTERPRETATION", "SRGB/G");
-            array.componentTagList(2).set("INTERPRETATION", "SRGB/B");
-        }
-        if (hasAlpha) {
-            array.componentTagList(isGray ? 1 : 3).set("INTERPRETATION", "ALPHA");
-        }
-        switch (img.orientation()) {
-        case Magick::UndefinedOrientation:
-            break;
-        case Magick::TopLeftOrientation:
-            originLocation = OriginTopLeft;
-            break;
-        case Magick::TopRightOrientation:
-            originLocation = OriginTopRight;
-            break;
-        case Magick::BottomRightOrientation:
-            originLocation = OriginBottomRight;
-            break;
-        case Magick::BottomLeftOrientation:
-            originLocation = OriginBottomLeft;
-            break;
-        case Magick::LeftTopOrientation:
-            originLocation = OriginLeftTop;
-            break;
-        case Magick::RightTopOrientation:
-            originLocation = OriginRightTop;
-            break;
-        case Magick::RightBottomOrientation:
-            originLocation = OriginRightBottom;
-            break;
-        case Magick::LeftBottomOrientation:
-            originLocation = OriginLeftBottom;
-            break;
-        }
+        bool isGray, hasAlpha;
+        array = ArrayContainer(magickDescription(img, isGray, hasAlpha));
+        size_t width = array.dimension(0);
+        size_t height = array.dimension(1);
+        Type type = array.componentType();
+        originLocation = magickOrigin(img);
 
         Magick::StorageType storageType = (type == uint8 ? Magick::CharPixel
                 : type == uint16 ? Magick::ShortPixel : Magick::FloatPixel);
@@ -181,6 +189,38 @@ ArrayContainer FormatImportExportMagick::readArray(Error* error, int arrayIndex)
     return array;
 }
 
+Error FormatImportExportMagick::readDescription(int arrayIndex, ArrayDescription& desc)
+{
+    if (arrayIndex < 0)
+        arrayIndex = _lastArrayIndex + 1;
+    try {
+        Magick::Image img;
+        if (_triedReading) {
+            // the images are already in memory
+            if (arrayIndex >= arrayCount())
+                return ErrorInvalidData;
+            img = _magick->imgs[arrayIndex];
+        } else {
+            // ping only the requested image: this reads its attributes but not its pixels
+            img.ping(_fileName + '[' + std::to_string(arrayIndex) + ']');
+        }
+        bool isGray, hasAlpha;
+        ArrayDescription d = magickDescription(img, isGray, hasAlpha);
+        if (originSwapsAxes(magickOrigin(img))) {
+            desc = ArrayDescription({ d.dimension(1), d.dimension(0) }, d.componentCount(), d.componentType());
+            for (size_t i = 0; i < d.componentCount(); i++)
+                desc.componentTagList(i) = d.componentTagList(i);
+        } else {
+            desc = d;
+        }
+    }
+    catch (...) {
+        return ErrorInvalidData;
+    }
+    _lastArrayIndex = arrayIndex;
+    return ErrorNone;
+}
+
 bool FormatImportExportMagick::hasMore()
 {
     return _lastArrayIndex + 1 < arrayCount();
@@ -48,6 +48,7 @@ public:
     // for reading:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual Error readDescription(int arrayIndex, ArrayDescription& desc) override;
     virtual bool hasMore() override;
 
     // for writing / appending:
@@ -32,7 +32,7 @@
 
 namespace TGD {
 
-FormatImportExportMAT::FormatImportExportMAT() : _mat(nullptr), _counter(0)
+FormatImportExportMAT::FormatImportExportMAT() : _mat(nullptr), _counter(0), _compression(MAT_COMPRESSION_NONE)
 {
 }
 
@@ -55,14 +55,21 @@ Error FormatImportExportMAT::openForReading(const std::string& fileName, const T
         if (!_mat) {
             return ErrorInvalidData;
         }
-        return ErrorNone;
+        return readVarInfos();
     }
 }
 
-Error FormatImportExportMAT::openForWriting(const std::string& fileName, bool append, const TagList&)
+Error FormatImportExportMAT::openForWriting(const std::string& fileName, bool append, const TagList& hints)
 {
     if (append)
         return ErrorFeaturesUnsupported;
+    std::string compression = hints.value("COMPRESSION", "none");
+    if (compression == "none")
+        _compression = MAT_COMPRESSION_NONE;
+    else if (compression == "deflate")
+        _compression = MAT_COMPRESSION_ZLIB;
+    else
+        return ErrorInvalidData;
     if (fileName == "-") {
         return ErrorInvalidData;
     } else {
@@ -83,66 +90,64 @@ Error FormatImportExportMAT::openForWriting(const std::string& fileName, bool ap
 
 void FormatImportExportMAT::close()
 {
+    for (size_t i = 0; i < _varInfos.size(); i++)
+        Mat_VarFree(static_cast<matvar_t*>(_varInfos[i]));
+    _varInfos.clear();
+    _counter = 0;
     if (_mat) {
         Mat_Close(static_cast<mat_t*>(_mat));
         _mat = nullptr;
     }
 }
 
+Error FormatImportExportMAT::readVarInfos()
+{
+    matvar_t* matvar;
+    while ((matvar = Mat_VarReadNextInfo(static_cast<mat_t*>(_mat))))
+        _varInfos.push_back(matvar);
+    Mat_Rewind(static_cast<mat_t*>(_mat));
+    return ErrorNone;
+}
+
 int FormatImportExportMAT::arrayCount()
 {
-    if (_varNames.size() == 0) {
-        matvar_t* matvar;
-        while ((matvar = Mat_VarReadNextInfo(static_cast<mat_t*>(_mat)))) {
-            _varNames.push_back(matvar->name);
-            Mat_VarFree(matvar);
-        }
-        Mat_Rewind(static_cast<mat_t*>(_mat));
-    }
-    return _varNames.size();
+    return _varInfos.size();
 }
 
 ArrayContainer FormatImportExportMAT::readArray(Error* error, int arrayIndex)
 {
-    matvar_t* matvar;
-    if (arrayIndex >= 0) {
-        if (arrayIndex >= arrayCount()) {
-            *error = ErrorInvalidData;
-            return ArrayContainer();
-        }
-        matvar = Mat_VarRead(static_cast<mat_t*>(_mat), _varNames[arrayIndex].c_str());
-    } else {
-        matvar = Mat_VarReadNext(static_cast<mat_t*>(_mat));
-        _counter++;
-    }
-    if (!matvar) {
+    if (arrayIndex < 0)
+        arrayIndex = _counter;
+    if (arrayIndex >= arrayCount()) {
         *error = ErrorInvalidData;
         return ArrayContainer();
     }
+    _counter = arrayIndex + 1;
+    matvar_t* matvar = static_cast<matvar_t*>(_varInfos[arrayIndex]);
     if (matvar->isComplex) {
         *error = ErrorFormatUnsupported;
         return ArrayContainer();
     }
     Type type;
-    if (matvar->data_type == MAT_T_INT8) {
+    if (matvar->class_type == MAT_C_INT8) {
         type = int8;
-    } else if (matvar->data_type == MAT_T_UINT8) {
+    } else if (matvar->class_type == MAT_C_UINT8) {
         type = uint8;
-    } else if (matvar->data_type == MAT_T_INT16) {
+    } else if (matvar->class_type == MAT_C_INT16) {
         type = int16;
-    } else if (matvar->data_type == MAT_T_UINT16) {
+    } else if (matvar->class_type == MAT_C_UINT16) {
         type = uint16;
-    } else if (matvar->data_type == MAT_T_INT32) {
+    } else if (matvar->class_type == MAT_C_INT32) {
         type = int32;
-    } else if (matvar->data_type == MAT_T_UINT32) {
+    } else if (matvar->class_type == MAT_C_UINT32) {
         type = uint32;
-    } else if (matvar->data_type == MAT_T_INT64) {
+    } else if (matvar->class_type == MAT_C_INT64) {
         type = int64;
-    } else if (matvar->data_type == MAT_T_UINT64) {
+    } else if (matvar->class_type == MAT_C_UINT64) {
         type = uint64;
-    } else if (matvar->data_type == MAT_T_SINGLE) {
+    } else if (matvar->class_type == MAT_C_SINGLE) {
         type = float32;
-    } else if (matvar->data_type == MAT_T_DOUBLE) {
+    } else if (matvar->class_type == MAT_C_DOUBLE) {
         type = float64;
     } else {
         *error = ErrorFormatUnsupported;
@@ -156,11 +161,22 @@ ArrayContainer FormatImportExportMAT::readArray(Error* error, int arrayIndex)
             return ArrayContainer();
         }
     }
-    ArrayContainer r = reorderMatlabInputData(dimensions, type, matvar->data);
+    // Read the data directly into a buffer, using the position that matio
+    // remembered in the variable directory, so that no search is necessary.
+    ArrayDescription dataDesc(dimensions, 1, type);
+    std::vector<unsigned char> data(dataDesc.dataSize());
+    std::vector<int> start(dimensions.size(), 0), stride(dimensions.size(), 1), edge(dimensions.size());
+    for (size_t i = 0; i < dimensions.size(); i++)
+        edge[i] = dimensions[i];
+    if (Mat_VarReadData(static_cast<mat_t*>(_mat), matvar, data.data(),
+                start.data(), stride.data(), edge.data()) != 0) {
+        *error = ErrorInvalidData;
+        return ArrayContainer();
+    }
+    ArrayContainer r = reorderMatlabInputData(dimensions, type, data.data());
     if (matvar->name && matvar->name[0] != '\0') {
         r.globalTagList().set("NAME", matvar->name);
     }
-    Mat_VarFree(matvar);
     return r;
 }
 
@@ -214,6 +230,9 @@ Error FormatImportExportMAT::writeArray(const ArrayContainer& array)
         classType = MAT_C_DOUBLE;
         dataType = MAT_T_DOUBLE;
         break;
+    case float16:
+    case bfloat16:
+        return ErrorFeaturesUnsupported;
     }
     std::string name = array.globalTagList().value("NAME");
     if (name.size() == 0)
@@ -223,7 +242,7 @@ Error FormatImportExportMAT::writeArray(const ArrayContainer& array)
     matvar_t* matvar = Mat_VarCreate(name.c_str(), classType, dataType,
             dataArray.dimensionCount(), const_cast<size_t*>(dataArray.dimensions().data()),
             dataArray.data(), MAT_F_DONT_COPY_DATA);
-    if (!matvar || Mat_VarWrite(static_cast<mat_t*>(_mat), matvar, MAT_COMPRESSION_NONE) != 0) {
+    if (!matvar || Mat_VarWrite(static_cast<mat_t*>(_mat), matvar, static_cast<matio_compression>(_compression)) != 0) {
         return ErrorLibrary;
     }
     Mat_VarFree(matvar);
@@ -35,9 +35,12 @@ namespace TGD {
 class FormatImportExportMAT : public FormatImportExport {
 private:
     void* _mat;
-    std::vector<std::string> _varNames;
+    std::vector<void*> _varInfos; // the variable directory, read once when opening
     int _counter;
-    
+    int _compression;
+
+    Error readVarInfos();
+
 public:
     FormatImportExportMAT();
     ~FormatImportExportMAT();
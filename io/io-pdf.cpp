@@ -25,6 +25,12 @@
 #include <cstdio>
 #include <cstring>
 #include <ctime>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <unistd.h>
 
 #include <poppler/cpp/poppler-page.h>
@@ -32,6 +38,7 @@
 #include <poppler/cpp/poppler-document.h>
 
 #include "io-pdf.hpp"
+#include "parallel.hpp"
 
 
 namespace TGD {
@@ -42,7 +49,8 @@ static void popplerDebugOutput(const std::string&, void*)
 }
 
 FormatImportExportPDF::FormatImportExportPDF() :
-    _dpi(0.0f), _renderer(nullptr), _doc(nullptr), _lastReadPage(-1),
+    _dpi(0.0f), _renderer(nullptr), _doc(nullptr), _pageCount(0), _lastReadPage(-1),
+    _renderThreadCount(1), _renderAhead(nullptr),
     _outFile(nullptr), _outArrayCount(0), _outLengthWithoutFooter(0)
 {
     poppler::set_debug_error_function(popplerDebugOutput, nullptr);
@@ -82,6 +90,166 @@ static std::string toString(time_t time, bool forHumans)
     }
 }
 
+static poppler::page_renderer* createRenderer()
+{
+    poppler::page_renderer* renderer = new poppler::page_renderer();
+    renderer->set_image_format(poppler::image::format_rgb24);
+    renderer->set_render_hints(
+              poppler::page_renderer::antialiasing
+            | poppler::page_renderer::text_antialiasing
+            | poppler::page_renderer::text_hinting);
+    return renderer;
+}
+
+/* Render a page into an sRGB array without tags */
+static ArrayContainer renderPage(poppler::document* doc, poppler::page_renderer* renderer,
+        int pageIndex, float dpi, Error* error)
+{
+    std::unique_ptr<poppler::page> page(doc->create_page(pageIndex));
+    if (!page) {
+        *error = ErrorInvalidData;
+        return ArrayContainer();
+    }
+    poppler::page::orientation_enum orientation = page->orientation();
+    poppler::rotation_enum rotation = poppler::rotate_0;
+    switch (orientation) {
+    case poppler::page::landscape:
+        rotation = poppler::rotate_270;
+        break;
+    case poppler::page::portrait:
+        rotation = poppler::rotate_0;
+        break;
+    case poppler::page::seascape:
+        rotation = poppler::rotate_90;
+        break;
+    case poppler::page::upside_down:
+        rotation = poppler::rotate_180;
+        break;
+    }
+    poppler::image img = renderer->render_page(page.get(), dpi, dpi, -1, -1, -1, -1, rotation);
+    if (img.width() < 1 || img.height() < 1) {
+        *error = ErrorInvalidData;
+        return ArrayContainer();
+    }
+
+    Array<uint8_t> r({ size_t(img.width()), size_t(img.height()) }, 3);
+    for (size_t y = 0; y < r.dimension(1); y++) {
+        const char* line = img.const_data() + (r.dimension(1) - 1 - y) * img.bytes_per_row();
+        std::memcpy(r.get<uint8_t>({ 0, y }), line, r.dimension(0) * r.elementSize());
+    }
+    return r;
+}
+
+/* Renders pages ahead of the reader in worker threads. Poppler documents must not
+ * be shared between threads, so each worker has its own document and renderer.
+ * Workers render the pages following the one requested last, up to a window of
+ * pages ahead; pages are handed out by get() in any order, and a request outside
+ * of the window restarts rendering at the requested page. */
+class PDFRenderAhead
+{
+public:
+    class Page
+    {
+    public:
+        ArrayContainer array;
+        Error error;
+    };
+
+    std::string fileName;
+    float dpi;
+    int pageCount;
+    int window;
+    std::vector<poppler::document*> docs;
+    std::vector<poppler::page_renderer*> renderers;
+    std::map<int, Page> done;
+    int next;                   // next page to hand out to a worker
+    int consumer;               // page that the reader wants next
+    unsigned int generation;    // incremented on restarts; results of older ones are dropped
+    bool stopRequested;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<std::thread> threads;
+
+    PDFRenderAhead(const std::string& fileName, float dpi, int pageCount, int threadCount, int firstPage) :
+        fileName(fileName), dpi(dpi), pageCount(pageCount), window(threadCount + 2),
+        next(firstPage), consumer(firstPage), generation(0), stopRequested(false)
+    {
+        for (int i = 0; i < threadCount; i++) {
+            poppler::document* doc = poppler::document::load_from_file(fileName);
+            if (!doc)
+                break;
+            docs.push_back(doc);
+            renderers.push_back(createRenderer());
+        }
+        for (size_t i = 0; i < docs.size(); i++)
+            threads.emplace_back([this, i] () { run(i); });
+    }
+
+    ~PDFRenderAhead()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopRequested = true;
+        }
+        cond.notify_all();
+        for (size_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+        for (size_t i = 0; i < docs.size(); i++) {
+            delete renderers[i];
+            delete docs[i];
+        }
+    }
+
+    bool valid() const
+    {
+        return threads.size() > 0;
+    }
+
+    void run(size_t worker)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            cond.wait(lock, [this] () {
+                    return stopRequested || (next < pageCount && next < consumer + window); });
+            if (stopRequested)
+                break;
+            int pageIndex = next++;
+            unsigned int g = generation;
+            lock.unlock();
+            Page page;
+            page.error = ErrorNone;
+            page.array = renderPage(docs[worker], renderers[worker], pageIndex, dpi, &page.error);
+            lock.lock();
+            if (g == generation) {
+                done[pageIndex] = std::move(page);
+                cond.notify_all();
+            }
+        }
+    }
+
+    Page get(int pageIndex)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (pageIndex < consumer || pageIndex >= next) {
+            // neither rendered nor in progress: restart here
+            generation++;
+            done.clear();
+            next = pageIndex;
+        } else {
+            done.erase(done.begin(), done.lower_bound(pageIndex));
+        }
+        consumer = pageIndex;
+        cond.notify_all();
+        cond.wait(lock, [this, pageIndex] () { return done.count(pageIndex) > 0; });
+        auto it = done.find(pageIndex);
+        Page page = std::move(it->second);
+        done.erase(it);
+        consumer = pageIndex + 1;
+        cond.notify_all();
+        return page;
+    }
+};
+
 Error FormatImportExportPDF::openForReading(const std::string& fileName, const TagList& hints)
 {
     if (fileName == "-")
@@ -95,6 +263,7 @@ Error FormatImportExportPDF::openForReading(const std::string& fileName, const T
         return ErrorInvalidData;
 
     _dpi = hints.value("DPI", 300.0f);
+    _pageCount = _doc->pages();
 
     _author = toString(_doc->get_author());
     _creator = toString(_doc->get_creator());
@@ -104,12 +273,17 @@ Error FormatImportExportPDF::openForReading(const std::string& fileName, const T
     _creationDate = toString(_doc->get_creation_date_t(), true);
     _modificationDate = toString(_doc->get_modification_date_t(), true);
 
-    _renderer = new poppler::page_renderer();
-    _renderer->set_image_format(poppler::image::format_rgb24);
-    _renderer->set_render_hints(
-              poppler::page_renderer::antialiasing
-            | poppler::page_renderer::text_antialiasing
-            | poppler::page_renderer::text_hinting);
+    // Render pages in parallel with up to 4 threads by default, since each thread
+    // needs its own document; THREADS=N changes this, and THREADS=1 renders in the
+    // reading thread. The threads are only started by the first readArray().
+    int threadCount = (defaultExecutionPolicy() == Sequential ? 1
+            : std::min(4, int(ThreadPool::instance().threadCount() + 1)));
+    threadCount = hints.value("THREADS", threadCount);
+    if (threadCount < 1)
+        return ErrorInvalidData;
+    _renderThreadCount = std::min(threadCount, _pageCount);
+    _fileName = fileName;
+    _renderer = createRenderer();
 
     return ErrorNone;
 }
@@ -129,6 +303,10 @@ Error FormatImportExportPDF::openForWriting(const std::string& fileName, bool ap
 
 void FormatImportExportPDF::close()
 {
+    delete _renderAhead;
+    _renderAhead = nullptr;
+    _renderThreadCount = 1;
+    _fileName = std::string();
     delete _renderer;
     _renderer = nullptr;
     delete _doc;
@@ -140,6 +318,7 @@ void FormatImportExportPDF::close()
     _title = std::string();
     _creationDate = std::string();
     _modificationDate = std::string();
+    _pageCount = 0;
     _lastReadPage = -1;
     if (_outFile) {
         fclose(_outFile);
@@ -156,7 +335,7 @@ void FormatImportExportPDF::close()
 
 int FormatImportExportPDF::arrayCount()
 {
-    return _doc->pages();
+    return _pageCount;
 }
 
 ArrayContainer FormatImportExportPDF::readArray(Error* error, int arrayIndex)
@@ -170,31 +349,34 @@ ArrayContainer FormatImportExportPDF::readArray(Error* error, int arrayIndex)
     } else {
         pageIndex = arrayIndex;
     }
+    if (pageIndex >= _pageCount) {
+        *error = ErrorInvalidData;
+        return ArrayContainer();
+    }
 
-    poppler::page* page = _doc->create_page(pageIndex);
-    poppler::page::orientation_enum orientation = page->orientation();
-    poppler::rotation_enum rotation = poppler::rotate_0;
-    switch (orientation) {
-    case poppler::page::landscape:
-        rotation = poppler::rotate_270;
-        break;
-    case poppler::page::portrait:
-        rotation = poppler::rotate_0;
-        break;
-    case poppler::page::seascape:
-        rotation = poppler::rotate_90;
-        break;
-    case poppler::page::upside_down:
-        rotation = poppler::rotate_180;
-        break;
+    if (!_renderAhead && _renderThreadCount > 1) {
+        _renderAhead = new PDFRenderAhead(_fileName, _dpi, _pageCount, _renderThreadCount, pageIndex);
+        if (!_renderAhead->valid()) {
+            delete _renderAhead;
+            _renderAhead = nullptr;
+            _renderThreadCount = 1;
+        }
     }
-    poppler::image img = _renderer->render_page(page, _dpi, _dpi, -1, -1, -1, -1, rotation);
-    if (img.width() < 1 || img.height() < 1) {
-        *error = ErrorInvalidData;
+
+    ArrayContainer r;
+    Error e = ErrorNone;
+    if (_renderAhead) {
+        PDFRenderAhead::Page page = _renderAhead->get(pageIndex);
+        e = page.error;
+        r = page.array;
+    } else {
+        r = renderPage(_doc, _renderer, pageIndex, _dpi, &e);
+    }
+    if (e != ErrorNone) {
+        *error = e;
         return ArrayContainer();
     }
 
-    Array<uint8_t> r({ size_t(img.width()), size_t(img.height()) }, 3);
     if (_author.length() > 0)
         r.globalTagList().set("AUTHOR", _author);
     if (_creator.length() > 0)
@@ -212,10 +394,6 @@ ArrayContainer FormatImportExportPDF::readArray(Error* error, int arrayIndex)
     r.componentTagList(0).set("INTERPRETATION", "SRGB/R");
     r.componentTagList(1).set("INTERPRETATION", "SRGB/G");
     r.componentTagList(2).set("INTERPRETATION", "SRGB/B");
-    for (size_t y = 0; y < r.dimension(1); y++) {
-        const char* line = img.const_data() + (r.dimension(1) - 1 - y) * img.bytes_per_row();
-        std::memcpy(r.get<uint8_t>({ 0, y }), line, r.dimension(0) * r.elementSize());
-    }
 
     _lastReadPage = pageIndex;
     return r;
@@ -34,6 +34,8 @@ namespace poppler {
 
 namespace TGD {
 
+class PDFRenderAhead;
+
 class FormatImportExportPDF : public FormatImportExport {
 private:
     // for reading and writing:
@@ -42,7 +44,11 @@ private:
     std::string _author, _creator, _producer, _subject, _title, _creationDate, _modificationDate;
     poppler::page_renderer* _renderer;
     poppler::document* _doc;
+    int _pageCount;
     int _lastReadPage;
+    std::string _fileName;
+    int _renderThreadCount;
+    PDFRenderAhead* _renderAhead; // started by the first readArray() if _renderThreadCount > 1
     // for writing:
     FILE* _outFile;
     std::string _outCreationDate;
@@ -23,6 +23,7 @@
  */
 
 #include <cstdio>
+#include <vector>
 
 #include <png.h>
 
@@ -44,7 +45,8 @@ static void my_png_warning(png_structp /* png_ptr */, png_const_charp /* warning
 }
 
 FormatImportExportPNG::FormatImportExportPNG() :
-    _f(nullptr), _arrayWasReadOrWritten(false)
+    _f(nullptr), _arrayWasReadOrWritten(false),
+    _compressionLevel(6), _filters(PNG_ALL_FILTERS)
 {
 }
 
@@ -65,10 +67,57 @@ Error FormatImportExportPNG::openForReading(const std::string& fileName, const T
     return _f ? ErrorNone : ErrorSysErrno;
 }
 
-Error FormatImportExportPNG::openForWriting(const std::string& fileName, bool append, const TagList&)
+Error FormatImportExportPNG::openForWriting(const std::string& fileName, bool append, const TagList& hints)
 {
     if (append)
         return ErrorFeaturesUnsupported;
+
+    std::string compression = hints.value("COMPRESSION", "default");
+    switch (compressionPreset(compression)) {
+    case CompressionFast:
+        // level 1 with the cheap SUB filter is several times faster than
+        // the default and still much smaller than uncompressed data
+        _compressionLevel = 1;
+        _filters = PNG_FILTER_SUB;
+        break;
+    case CompressionDefault:
+        _compressionLevel = 6;
+        _filters = PNG_ALL_FILTERS;
+        break;
+    case CompressionSmall:
+        _compressionLevel = 9;
+        _filters = PNG_ALL_FILTERS;
+        break;
+    case CompressionMethod:
+        if (compression == "none") {
+            _compressionLevel = 0;
+            _filters = PNG_FILTER_NONE;
+        } else {
+            return ErrorFeaturesUnsupported;
+        }
+        break;
+    }
+    Error e = compressionLevel(hints, 0, 9, _compressionLevel);
+    if (e != ErrorNone)
+        return e;
+    if (hints.contains("FILTER")) {
+        std::string filter = hints.value("FILTER");
+        if (filter == "none")
+            _filters = PNG_FILTER_NONE;
+        else if (filter == "sub")
+            _filters = PNG_FILTER_SUB;
+        else if (filter == "up")
+            _filters = PNG_FILTER_UP;
+        else if (filter == "avg")
+            _filters = PNG_FILTER_AVG;
+        else if (filter == "paeth")
+            _filters = PNG_FILTER_PAETH;
+        else if (filter == "all")
+            _filters = PNG_ALL_FILTERS;
+        else
+            return ErrorInvalidData;
+    }
+
     if (fileName == "-") {
         _f = stdout;
     } else {
@@ -98,25 +147,42 @@ int FormatImportExportPNG::arrayCount()
 
 ArrayContainer FormatImportExportPNG::readArray(Error* error, int arrayIndex)
 {
-    if (arrayIndex > 0) {
-        *error = ErrorSeekingNotSupported;
+    ArrayContainer r;
+    Error e = readArrayInto(r, arrayIndex);
+    if (e != ErrorNone) {
+        *error = e;
         return ArrayContainer();
     }
+    return r;
+}
+
+Error FormatImportExportPNG::readArrayInto(ArrayContainer& r, int arrayIndex)
+{
+    return readHelper(arrayIndex, &r, nullptr);
+}
+
+Error FormatImportExportPNG::readDescription(int arrayIndex, ArrayDescription& desc)
+{
+    return readHelper(arrayIndex, nullptr, &desc);
+}
+
+Error FormatImportExportPNG::readHelper(int arrayIndex, ArrayContainer* array, ArrayDescription* description)
+{
+    if (arrayIndex > 0) {
+        return ErrorSeekingNotSupported;
+    }
     std::rewind(_f);
 
     png_byte header[8];
     if (std::fread(header, 8, 1, _f) != 1) {
-        *error = std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
-        return ArrayContainer();
+        return std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
     }
     if (png_sig_cmp(header, 0, 8)) {
-        *error = ErrorInvalidData;
-        return ArrayContainer();
+        return ErrorInvalidData;
     }
     png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png_ptr) {
-        *error = ErrorLibrary;
-        return ArrayContainer();
+        return ErrorLibrary;
     }
     png_set_user_limits(png_ptr, 0x7fffffffL, 0x7fffffffL);
     png_set_palette_to_rgb(png_ptr);
@@ -124,30 +190,63 @@ ArrayContainer FormatImportExportPNG::readArray(Error* error, int arrayIndex)
     png_infop info_ptr = png_create_info_struct(png_ptr);
     if (!info_ptr) {
         png_destroy_read_struct(&png_ptr, NULL, NULL);
-        *error = ErrorLibrary;
-        return ArrayContainer();
+        return ErrorLibrary;
     }
+    ImageOriginLocation originLocation = getImageOriginLocation(_fileName);
+    std::vector<png_bytep> row_pointers;
     png_set_error_fn(png_ptr, NULL, my_png_error, my_png_warning);
     if (setjmp(png_jmpbuf(png_ptr))) {
         png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-        *error = ErrorLibrary;
-        return ArrayContainer();
+        return ErrorLibrary;
     }
     png_init_io(png_ptr, _f);
     png_set_sig_bytes(png_ptr, 8);
     // TODO: ??? png_set_gamma(png_ptr, 2.2, 0.45455);
-    png_read_png(png_ptr, info_ptr,
-            PNG_TRANSFORM_EXPAND | PNG_TRANSFORM_PACKING | PNG_TRANSFORM_SWAP_ENDIAN,
-            NULL);
+    png_read_info(png_ptr, info_ptr);
+    png_set_expand(png_ptr);
+    png_set_packing(png_ptr);
+    if (!hostIsBigEndian())
+        png_set_swap(png_ptr);
+    int passes = png_set_interlace_handling(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
     unsigned int width = png_get_image_width(png_ptr, info_ptr);
     unsigned int height = png_get_image_height(png_ptr, info_ptr);
     unsigned int channels = png_get_channels(png_ptr, info_ptr);
     png_byte bit_depth = png_get_bit_depth(png_ptr, info_ptr);
-    png_bytep *row_pointers = png_get_rows(png_ptr, info_ptr);
+    Type type = (bit_depth <= 8 ? uint8 : uint16);
+
+    bool mirrorRows = originMirrorsX(originLocation);
+    if (description) {
+        // only the text chunks in front of the image data are known
+        *description = (originSwapsAxes(originLocation)
+                ? ArrayDescription({ height, width }, channels, type)
+                : ArrayDescription({ width, height }, channels, type));
+    } else {
+        // libpng decodes directly into the final rows of the array
+        prepareArray(*array, ArrayDescription({ width, height }, channels, type));
+        if (png_get_rowbytes(png_ptr, info_ptr) != array->elementSize() * width) {
+            png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+            return ErrorLibrary;
+        }
+        row_pointers.resize(height);
+        for (size_t i = 0; i < height; i++)
+            row_pointers[i] = static_cast<png_bytep>(array->get(originDestinationRow(originLocation, height, i) * width));
+        if (passes == 1) {
+            for (size_t i = 0; i < height; i++) {
+                png_read_row(png_ptr, row_pointers[i], NULL);
+                if (mirrorRows)
+                    reverseRow(width, array->elementSize(), row_pointers[i]);
+            }
+            mirrorRows = false;
+        } else {
+            png_read_image(png_ptr, row_pointers.data());
+        }
+        png_read_end(png_ptr, info_ptr);
+    }
+    ArrayDescription& r = (description ? *description : *array);
+
     png_textp text_ptr;
     png_uint_32 num_text = png_get_text(png_ptr, info_ptr, &text_ptr, NULL);
-
-    ArrayContainer r({ width, height }, channels, bit_depth <= 8 ? uint8 : uint16);
     for (unsigned int i = 0; i < num_text; i++) {
         if (std::strncmp(text_ptr[i].text, "\nexif\n", 6) == 0) {
             // This is EXIF data encoded in a string with control characters.
@@ -158,6 +257,7 @@ ArrayContainer FormatImportExportPNG::readArray(Error* error, int arrayIndex)
         }
         r.globalTagList().set(text_ptr[i].key, text_ptr[i].text);
     }
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
     if (channels == 1) {
         r.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
     } else if (channels == 2) {
@@ -173,21 +273,15 @@ ArrayContainer FormatImportExportPNG::readArray(Error* error, int arrayIndex)
         r.componentTagList(2).set("INTERPRETATION", "SRGB/B");
         r.componentTagList(3).set("INTERPRETATION", "ALPHA");
     }
-    ImageOriginLocation originLocation = getImageOriginLocation(_fileName);
-    for (size_t i = 0; i < height; i++) {
-        if (originLocation == OriginTopLeft)
-            std::memcpy(r.get(i * width), row_pointers[height - 1 - i], r.elementSize() * width);
-        else
-            std::memcpy(r.get(i * width), row_pointers[i], r.elementSize() * width);
-    }
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
 
-    if (originLocation != OriginTopLeft)
-        fixImageOrientation(r, originLocation);
+    if (array && mirrorRows)
+        reverseX(*array);
+    else if (array && originSwapsAxes(originLocation))
+        fixImageOrientation(*array, originLocation);
 
     _arrayWasReadOrWritten = true;
 
-    return r;
+    return ErrorNone;
 }
 
 bool FormatImportExportPNG::hasMore()
@@ -246,7 +340,8 @@ Error FormatImportExportPNG::writeArray(const ArrayContainer& array)
             PNG_INTERLACE_NONE,
             PNG_COMPRESSION_TYPE_DEFAULT,
             PNG_FILTER_TYPE_DEFAULT);
-    png_set_compression_level(png_ptr, 6);
+    png_set_compression_level(png_ptr, _compressionLevel);
+    png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, _filters);
     png_set_sRGB(png_ptr, info_ptr, PNG_sRGB_INTENT_ABSOLUTE);
     if (text.size() > 0)
         png_set_text(png_ptr, info_ptr, &(text[0]), text.size());
@@ -36,6 +36,11 @@ private:
     FILE* _f;
     std::string _fileName;
     bool _arrayWasReadOrWritten;
+    // for writing:
+    int _compressionLevel;
+    int _filters;
+
+    Error readHelper(int arrayIndex, ArrayContainer* array, ArrayDescription* description);
 
 public:
     FormatImportExportPNG();
@@ -48,7 +53,11 @@ public:
     // for reading:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual Error readArrayInto(ArrayContainer& target, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual Error readDescription(int arrayIndex, ArrayDescription& desc) override;
+
+    virtual bool isReentrant() const override { return true; }
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
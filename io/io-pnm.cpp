@@ -24,17 +24,25 @@
 
 #include <cstdio>
 #include <cstring>
+#include <atomic>
+#include <charconv>
 #include <limits>
+#include <vector>
 
 #include "io-pnm.hpp"
 #include "io-utils.hpp"
 
+#ifdef _WIN32
+# define getc_unlocked _fgetc_nolock
+#endif
+
 
 namespace TGD {
 
 FormatImportExportPNM::FormatImportExportPNM() :
     _f(nullptr),
-    _arrayCount(-2)
+    _arrayCount(-2),
+    _mmapMode(-1)
 {
 }
 
@@ -43,8 +51,9 @@ FormatImportExportPNM::~FormatImportExportPNM()
     close();
 }
 
-Error FormatImportExportPNM::openForReading(const std::string& fileName, const TagList&)
+Error FormatImportExportPNM::openForReading(const std::string& fileName, const TagList& hints)
 {
+    _mmapMode = hints.value("MMAP", -1);
     if (fileName == "-")
         _f = stdin;
     else
@@ -69,6 +78,7 @@ void FormatImportExportPNM::close()
         }
         _f = nullptr;
     }
+    _mapping.reset();
 }
 
 typedef struct
@@ -118,7 +128,7 @@ static bool readPnmMaxval(FILE* f, PNMInfo* info)
     bool ret = (readPnmWhitespaceAndComments(f)
             && fscanf(f, "%d", &info->maxval) == 1
             && info->maxval >= 1 && info->maxval <= 65535);
-    info->needsEndianFix = (info->maxval > 255 && !info->plain);
+    info->needsEndianFix = (info->maxval > 255 && !info->plain && !hostIsBigEndian());
     return ret;
 }
 
@@ -126,7 +136,7 @@ static bool readPfmFactor(FILE* f, PNMInfo* info)
 {
     bool ret = (readPnmWhitespaceAndComments(f)
             && fscanf(f, "%f", &info->factor) == 1);
-    info->needsEndianFix = (info->factor > 0.0f);
+    info->needsEndianFix = ((info->factor > 0.0f) != hostIsBigEndian());
     if (info->factor < 0.0f)
         info->factor = -info->factor;
     return ret;
@@ -226,7 +236,7 @@ static bool readPamHeader(FILE* f, PNMInfo* info)
             || info->maxval < 1 || info->maxval > 65535) {
         return false;
     }
-    info->needsEndianFix = (info->maxval > 255);
+    info->needsEndianFix = (info->maxval > 255 && !hostIsBigEndian());
     return true;
 }
 
@@ -289,51 +299,264 @@ static PNMInfo readPnmHeader(FILE* f)
     return info;
 }
 
-bool readPnmData(FILE* f, const PNMInfo& info, ArrayContainer& array)
+static inline bool isPnmSpace(int c)
 {
-    if (info.plain) {
-        for (size_t e = 0; e < array.elementCount(); e++) {
-            for (size_t c = 0; c < array.componentCount(); c++) {
-                int val;
-                if (!readWhitespace(f) || fscanf(f, "%d", &val) != 1) {
+    return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+/* Parse one value of a plain PNM. Values that are outside of the allowed range are
+ * clamped. You could say these files are invalid, and NetPBM itself refuses them,
+ * but nevertheless they exist and this clamping is the sanest way to deal with them. */
+static bool parsePlainValue(const char* begin, const char* end, int& val)
+{
+    long long v;
+    std::from_chars_result r = std::from_chars(begin, end, v);
+    if (begin == end || r.ptr != end)
+        return false;
+    if (r.ec == std::errc::result_out_of_range)
+        v = (*begin == '-' ? 0 : 65535);
+    else if (r.ec != std::errc())
+        return false;
+    val = (v < 0 ? 0 : v > 65535 ? 65535 : int(v));
+    return true;
+}
+
+/* Plain PNM data in seekable files is read in blocks of this size. Each block is
+ * split into parts at whitespace, and the parts are parsed in parallel. */
+static const size_t plainBlockSize = 1 << 24;
+
+/* Read count values of a plain PNM and call store(index, value) for each of them
+ * if parse is true; otherwise, only skip them. On success, the file position is
+ * behind the whitespace that follows the last value. */
+template<typename STORE>
+static bool readPlainValues(FILE* f, size_t count, bool parse, STORE store)
+{
+    off_t blockPos = ftello(f);
+    if (blockPos < 0) {
+        // Not seekable: we must not read beyond the last value, so read byte by byte
+        for (size_t i = 0; i < count; i++) {
+            int c;
+            do {
+                c = getc_unlocked(f);
+            } while (isPnmSpace(c));
+            char token[64];
+            size_t len = 0;
+            while (c != EOF && !isPnmSpace(c)) {
+                if (len == sizeof(token))
                     return false;
-                }
-                // Clamp values that are outside of the allowed range.
-                // You could say these files are invalid, and NetPBM itself refuses them,
-                // but nevertheless they exist and this clamping is the sanest way
-                // to deal with them.
-                if (val < 0) {
-                    val = 0;
-                } else if (val > 65535) {
-                    val = 65535;
-                } else if (array.componentType() == uint8 && val > 255) {
-                    val = 255;
-                }
-                if (array.componentType() == uint8) {
-                    array.set<uint8_t>(e, c, uint8_t(val));
-                } else {
-                    array.set<uint16_t>(e, c, uint16_t(val));
-                }
+                token[len++] = c;
+                c = getc_unlocked(f);
             }
+            int val;
+            if (len == 0 || (parse && !parsePlainValue(token, token + len, val)))
+                return false;
+            if (parse)
+                store(i, val);
         }
         readWhitespace(f); // ignore EOF
         return true;
-    } else {
-        return (fread(array.data(), array.dataSize(), 1, f) == 1);
+    }
+
+    std::vector<char> buf;
+    size_t carry = 0; // bytes of an incomplete value from the previous block
+    size_t index = 0;
+    for (;;) {
+        buf.resize(carry + plainBlockSize);
+        size_t n = std::fread(buf.data() + carry, 1, plainBlockSize, f);
+        if (n < plainBlockSize && std::ferror(f))
+            return false;
+        bool eof = (n < plainBlockSize);
+        size_t size = carry + n;
+        // The last value may continue in the next block
+        size_t end = size;
+        if (!eof) {
+            while (end > 0 && !isPnmSpace(buf[end - 1]))
+                end--;
+            if (end == 0)
+                return false;
+        }
+
+        // Split the block into parts at whitespace, count the values in each
+        // part, and then parse the parts in parallel
+        size_t partCount = 1;
+        if (defaultExecutionPolicy() != Sequential && end >= (1 << 16))
+            partCount = ThreadPool::instance().threadCount() + 1;
+        std::vector<size_t> partBegin(partCount + 1, end);
+        partBegin[0] = 0;
+        for (size_t k = 1; k < partCount; k++) {
+            size_t p = std::max(partBegin[k - 1], end / partCount * k);
+            while (p < end && !isPnmSpace(buf[p]))
+                p++;
+            partBegin[k] = p;
+        }
+        std::vector<size_t> partValues(partCount, 0);
+        std::atomic<bool> valid(true);
+        auto processPart = [&] (size_t k, size_t firstIndex, bool doParse) {
+            const char* p = buf.data() + partBegin[k];
+            const char* partEnd = buf.data() + partBegin[k + 1];
+            size_t i = firstIndex;
+            for (;;) {
+                while (p < partEnd && isPnmSpace(*p))
+                    p++;
+                if (p == partEnd || i >= count)
+                    break;
+                const char* valueEnd = p;
+                while (valueEnd < partEnd && !isPnmSpace(*valueEnd))
+                    valueEnd++;
+                if (doParse) {
+                    int val;
+                    if (!parsePlainValue(p, valueEnd, val))
+                        valid = false;
+                    else
+                        store(i, val);
+                }
+                i++;
+                p = valueEnd;
+            }
+            return i - firstIndex;
+        };
+        ThreadPool::instance().parallelFor(partCount, 1, [&] (size_t begin, size_t end) {
+                for (size_t k = begin; k < end; k++)
+                    partValues[k] = processPart(k, 0, false);
+            });
+        std::vector<size_t> partFirstIndex(partCount);
+        size_t blockValues = 0;
+        for (size_t k = 0; k < partCount; k++) {
+            partFirstIndex[k] = index + blockValues;
+            blockValues += partValues[k];
+        }
+        if (parse) {
+            ThreadPool::instance().parallelFor(partCount, 1, [&] (size_t begin, size_t end) {
+                    for (size_t k = begin; k < end; k++)
+                        processPart(k, partFirstIndex[k], true);
+                });
+            if (!valid)
+                return false;
+        }
+
+        if (index + blockValues >= count) {
+            // Find the end of the last value and continue reading from there
+            size_t k = 0;
+            while (partFirstIndex[k] + partValues[k] < count)
+                k++;
+            size_t p = partBegin[k];
+            for (size_t i = partFirstIndex[k]; i < count; i++) {
+                while (isPnmSpace(buf[p]))
+                    p++;
+                while (p < end && !isPnmSpace(buf[p]))
+                    p++;
+            }
+            if (fseeko(f, blockPos + off_t(p), SEEK_SET) != 0)
+                return false;
+            readWhitespace(f); // ignore EOF
+            return true;
+        }
+        if (eof)
+            return false;
+        index += blockValues;
+        carry = size - end;
+        std::memmove(buf.data(), buf.data() + end, carry);
+        blockPos += end;
     }
 }
 
-bool skipPnmData(FILE* f, const PNMInfo& info)
+/* Read the data into the array. Rows are stored from top to bottom except in PFM,
+ * so they are stored directly in their final row of the array. */
+bool readPnmData(FILE* f, const PNMInfo& info, ArrayContainer& array)
 {
+    size_t width = array.dimension(0);
+    size_t height = array.dimension(1);
+    bool reverseRows = (array.componentType() != float32);
     if (info.plain) {
-        size_t valueCount = info.width * info.height * info.depth;
-        for (size_t i = 0; i < valueCount; i++) {
-            int val;
-            if (!readWhitespace(f) || fscanf(f, "%d", &val) != 1) {
+        size_t componentCount = array.componentCount();
+        bool isUint8 = (array.componentType() == uint8);
+        return readPlainValues(f, array.elementCount() * componentCount, true, [&] (size_t i, int val) {
+                size_t j = i / componentCount;
+                size_t e = (reverseRows ? (height - 1 - j / width) * width + j % width : j);
+                size_t c = i % componentCount;
+                if (isUint8)
+                    array.set<uint8_t>(e, c, uint8_t(std::min(val, 255)));
+                else
+                    array.set<uint16_t>(e, c, uint16_t(val));
+            });
+    } else {
+        if (!reverseRows)
+            return readSwapped(f, array.data(), array.dataSize(), array.componentSize(), info.needsEndianFix);
+        size_t lineSize = width * array.elementSize();
+        for (size_t y = 0; y < height; y++) {
+            if (!readSwapped(f, array.get((height - 1 - y) * width), lineSize,
+                        array.componentSize(), info.needsEndianFix))
                 return false;
+        }
+        return true;
+    }
+}
+
+/* Read binary data from a mapping of the file. The row order and byte order are
+ * fixed up, and PFM values are scaled, while copying the rows in parallel; PFM data
+ * that needs none of this is used in place. */
+static bool readMappedPnmData(FILE* f, std::shared_ptr<FileMapping>& mapping,
+        const PNMInfo& info, const ArrayDescription& desc, ArrayContainer& array)
+{
+#ifdef TGD_HAVE_MMAP
+    off_t dataOffset = ftello(f);
+    if (dataOffset < 0 || desc.dataSize() == 0)
+        return false;
+    size_t dataEnd = dataOffset + desc.dataSize();
+    if (!mapping || mapping->size < dataEnd) {
+        std::shared_ptr<FileMapping> newMapping = FileMapping::create(f, dataEnd);
+        if (!newMapping)
+            return false;
+        mapping = newMapping;
+    }
+    if (fseeko(f, dataEnd, SEEK_SET) != 0)
+        return false;
+    unsigned char* src = static_cast<unsigned char*>(mapping->address) + dataOffset;
+    bool isPfm = (desc.componentType() == float32);
+    if (isPfm && !info.needsEndianFix && info.factor == 1.0f && dataOffset % sizeof(float) == 0) {
+        std::shared_ptr<FileMapping> m = mapping;
+        array = ArrayContainer(desc, src, [m] (unsigned char*) {});
+        return true;
+    }
+    prepareArray(array, desc);
+    size_t height = desc.dimension(1);
+    size_t lineSize = desc.dimension(0) * desc.elementSize();
+    size_t lineComponents = desc.dimension(0) * desc.componentCount();
+    unsigned char* dst = static_cast<unsigned char*>(array.data());
+    auto copyLines = [&] (size_t begin, size_t end) {
+        for (size_t y = begin; y < end; y++) {
+            unsigned char* line = dst + (isPfm ? y : height - 1 - y) * lineSize;
+            std::memcpy(line, src + y * lineSize, lineSize);
+            if (info.needsEndianFix)
+                swapEndianness(line, line, lineComponents, desc.componentSize());
+            if (isPfm && info.factor != 1.0f) {
+                float* values = reinterpret_cast<float*>(line);
+                for (size_t i = 0; i < lineComponents; i++)
+                    values[i] *= info.factor;
             }
         }
-        readWhitespace(f); // ignore EOF
+    };
+    if (defaultExecutionPolicy() == Sequential)
+        copyLines(0, height);
+    else
+        ThreadPool::instance().parallelFor(height, std::max(swapBlockSize / lineSize, size_t(1)), copyLines);
+    return true;
+#else
+    (void)f;
+    (void)mapping;
+    (void)info;
+    (void)desc;
+    (void)array;
+    return false;
+#endif
+}
+
+bool skipPnmData(FILE* f, const PNMInfo& info)
+{
+    if (info.plain) {
+        size_t valueCount = size_t(info.width) * size_t(info.height) * size_t(info.depth);
+        if (!readPlainValues(f, valueCount, false, [] (size_t, int) {}))
+            return false;
     } else {
         off_t bytes =
               off_t(info.width)
@@ -424,45 +647,47 @@ ArrayContainer FormatImportExportPNM::readArray(Error* error, int arrayIndex)
     Type type = (pnminfo.maxval < 0 ? float32
             : pnminfo.maxval <= 255 ? uint8
             : uint16);
-    ArrayContainer r({ size_t(pnminfo.width), size_t(pnminfo.height) },
+    ArrayDescription desc({ size_t(pnminfo.width), size_t(pnminfo.height) },
             size_t(pnminfo.depth), type);
     if (pnminfo.depth <= 2) {
         if (pnminfo.maxval < 0)
-            r.componentTagList(0).set("INTERPRETATION", "GRAY");
+            desc.componentTagList(0).set("INTERPRETATION", "GRAY");
         else
-            r.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
+            desc.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
         if (pnminfo.depth == 2) {
-            r.componentTagList(1).set("INTERPRETATION", "ALPHA");
+            desc.componentTagList(1).set("INTERPRETATION", "ALPHA");
         }
     } else {
         if (pnminfo.maxval < 0) {
-            r.componentTagList(0).set("INTERPRETATION", "RED");
-            r.componentTagList(1).set("INTERPRETATION", "GREEN");
-            r.componentTagList(2).set("INTERPRETATION", "BLUE");
+            desc.componentTagList(0).set("INTERPRETATION", "RED");
+            desc.componentTagList(1).set("INTERPRETATION", "GREEN");
+            desc.componentTagList(2).set("INTERPRETATION", "BLUE");
         } else {
-            r.componentTagList(0).set("INTERPRETATION", "SRGB/R");
-            r.componentTagList(1).set("INTERPRETATION", "SRGB/G");
-            r.componentTagList(2).set("INTERPRETATION", "SRGB/B");
+            desc.componentTagList(0).set("INTERPRETATION", "SRGB/R");
+            desc.componentTagList(1).set("INTERPRETATION", "SRGB/G");
+            desc.componentTagList(2).set("INTERPRETATION", "SRGB/B");
         }
         if (pnminfo.depth == 4) {
-            r.componentTagList(3).set("INTERPRETATION", "ALPHA");
+            desc.componentTagList(3).set("INTERPRETATION", "ALPHA");
         }
     }
-    if (!readPnmData(_f, pnminfo, r)) {
+    ArrayContainer array;
+    if (!pnminfo.plain && _f != stdin && _mmapMode != 0
+            && (_mmapMode == 1 || desc.dataSize() >= mmapMinimumSize)
+            && readMappedPnmData(_f, _mapping, pnminfo, desc, array)) {
+        return array;
+    }
+    array = ArrayContainer(desc);
+    if (!readPnmData(_f, pnminfo, array)) {
         *error = ErrorInvalidData;
         return ArrayContainer();
     }
-    if (pnminfo.needsEndianFix) {
-        swapEndianness(r);
-    }
-    if (type == float32) {
-        for (size_t e = 0; e < r.elementCount(); e++)
-            for (size_t c = 0; c < r.componentCount(); c++)
-                r.set<float>(e, c, r.get<float>(e, c) * pnminfo.factor);
-    } else {
-        reverseY(r);
+    if (type == float32 && pnminfo.factor != 1.0f) {
+        for (size_t e = 0; e < array.elementCount(); e++)
+            for (size_t c = 0; c < array.componentCount(); c++)
+                array.set<float>(e, c, array.get<float>(e, c) * pnminfo.factor);
     }
-    return r;
+    return array;
 }
 
 bool FormatImportExportPNM::hasMore()
@@ -517,20 +742,31 @@ Error FormatImportExportPNM::writeArray(const ArrayContainer& array)
     } else {
         header = std::string("P") + (depth == 1 ? 'f' : 'F') + '\n'
             + std::to_string(width) + ' ' + std::to_string(height) + '\n'
-            + "-1.0\n";
+            + (hostIsBigEndian() ? "1.0\n" : "-1.0\n");
     }
-    ArrayContainer data;
+    if (fputs(header.c_str(), _f) == EOF)
+        return ErrorSysErrno;
     if (array.componentType() == float32) {
-        data = array;
+        // PFM stores rows bottom-to-top just like we do, in host byte order
+        if (fwrite(array.data(), array.dataSize(), 1, _f) != 1)
+            return ErrorSysErrno;
     } else {
-        data = array.deepCopy();
-        reverseY(data);
-        if (array.componentType() == uint16)
-            swapEndianness(data);
+        // write rows top-to-bottom, swapping 16 bit values to big endian on the fly
+        bool swap = (array.componentType() == uint16 && !hostIsBigEndian());
+        size_t lineSize = array.dimension(0) * array.elementSize();
+        std::vector<unsigned char> swappedLine(swap ? lineSize : 0);
+        const unsigned char* data = static_cast<const unsigned char*>(array.data());
+        for (size_t y = 0; y < array.dimension(1); y++) {
+            const unsigned char* line = data + (array.dimension(1) - 1 - y) * lineSize;
+            if (swap) {
+                swapEndianness(swappedLine.data(), line, lineSize / 2, 2);
+                line = swappedLine.data();
+            }
+            if (fwrite(line, lineSize, 1, _f) != 1)
+                return ErrorSysErrno;
+        }
     }
-    if (fputs(header.c_str(), _f) == EOF
-            || fwrite(data.data(), data.dataSize(), 1, _f) != 1
-            || fflush(_f) != 0) {
+    if (fflush(_f) != 0) {
         return ErrorSysErrno;
     }
     return ErrorNone;
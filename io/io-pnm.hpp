@@ -31,11 +31,15 @@
 
 namespace TGD {
 
+class FileMapping;
+
 class FormatImportExportPNM : public FormatImportExport {
 private:
     FILE* _f;
     int _arrayCount;
     std::vector<off_t> _arrayOffsets;
+    int _mmapMode; // 0 = never, 1 = always if possible, -1 = automatic
+    std::shared_ptr<FileMapping> _mapping;
 
 public:
     FormatImportExportPNM();
@@ -50,6 +54,8 @@ public:
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
 
+    virtual bool isReentrant() const override { return true; }
+
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
 };
@@ -28,6 +28,7 @@
 #include <sys/stat.h>
 
 #include "io-raw.hpp"
+#include "io-utils.hpp"
 
 
 namespace TGD {
@@ -35,7 +36,10 @@ namespace TGD {
 FormatImportExportRAW::FormatImportExportRAW() :
     _template(),
     _f(nullptr),
-    _arrayCount(-1)
+    _arrayCount(-1),
+    _swapEndianness(false),
+    _seekable(false),
+    _directFd(-1)
 {
 }
 
@@ -85,6 +89,10 @@ Error FormatImportExportRAW::openForReading(const std::string& fileName, const T
         return ErrorInvalidData;
 
     _template = ArrayDescription(dimensions, components, type);
+    // Byte order:
+    Error e = endiannessFromHints(hints);
+    if (e != ErrorNone)
+        return e;
 
     // We have the metadata, now try and open the file
     if (fileName == "-")
@@ -97,13 +105,39 @@ Error FormatImportExportRAW::openForReading(const std::string& fileName, const T
             _arrayCount = -1;
         } else {
             _arrayCount = statbuf.st_size / _template.dataSize();
+#ifdef TGD_HAVE_PREAD
+            _seekable = S_ISREG(statbuf.st_mode);
+#endif
         }
     }
+#ifdef TGD_HAVE_PREAD
+    // Direct I/O bypasses the page cache, e.g. for scans of data that is read only once.
+    // If the file system does not support it, the data is read normally.
+    if (_seekable && hints.value("DIRECT_IO", false))
+        _directFd = openDirect(fileName);
+#endif
     return _f ? ErrorNone : ErrorSysErrno;
 }
 
-Error FormatImportExportRAW::openForWriting(const std::string& fileName, bool append, const TagList&)
+Error FormatImportExportRAW::endiannessFromHints(const TagList& hints)
 {
+    std::string endianness = hints.value("ENDIANNESS", "");
+    if (endianness == "")
+        _swapEndianness = false;
+    else if (endianness == "little")
+        _swapEndianness = hostIsBigEndian();
+    else if (endianness == "big")
+        _swapEndianness = !hostIsBigEndian();
+    else
+        return ErrorInvalidData;
+    return ErrorNone;
+}
+
+Error FormatImportExportRAW::openForWriting(const std::string& fileName, bool append, const TagList& hints)
+{
+    Error e = endiannessFromHints(hints);
+    if (e != ErrorNone)
+        return e;
     if (fileName == "-")
         _f = stdout;
     else
@@ -119,6 +153,12 @@ void FormatImportExportRAW::close()
         }
         _f = nullptr;
     }
+#ifdef TGD_HAVE_PREAD
+    if (_directFd >= 0)
+        ::close(_directFd);
+#endif
+    _directFd = -1;
+    _seekable = false;
 }
 
 int FormatImportExportRAW::arrayCount()
@@ -128,15 +168,70 @@ int FormatImportExportRAW::arrayCount()
 
 ArrayContainer FormatImportExportRAW::readArray(Error* error, int arrayIndex)
 {
-    if (arrayIndex >= 0) {
-        if (fseeko(_f, arrayIndex * _template.dataSize(), SEEK_SET) != 0) {
-            *error = ErrorSysErrno;
-            return ArrayContainer();
-        }
+    ArrayContainer r;
+    Error e = readArrayInto(r, arrayIndex);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    return r;
+}
+
+/* Read data at the given offset, or at the current position if the offset is negative,
+ * and leave the file position behind the data. Regular files are read with concurrent
+ * pread() calls instead of stdio. */
+Error FormatImportExportRAW::readData(off_t offset, void* data, size_t size)
+{
+#ifdef TGD_HAVE_PREAD
+    if (_seekable) {
+        if (offset < 0)
+            offset = ftello(_f);
+        if (offset < 0)
+            return ErrorSysErrno;
+        Error e = readParallel(_directFd >= 0 ? _directFd : fileno(_f), offset, data, size, _directFd >= 0);
+        if (e != ErrorNone)
+            return e;
+        if (fseeko(_f, offset + off_t(size), SEEK_SET) != 0)
+            return ErrorSysErrno;
+        if (_swapEndianness)
+            swapEndiannessParallel(data, size / _template.componentSize(), _template.componentSize());
+        return ErrorNone;
+    }
+#endif
+    if (offset >= 0 && fseeko(_f, offset, SEEK_SET) != 0)
+        return ErrorSysErrno;
+    if (!readSwapped(_f, data, size, _template.componentSize(), _swapEndianness))
+        return ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
+    return ErrorNone;
+}
+
+Error FormatImportExportRAW::readArrayInto(ArrayContainer& r, int arrayIndex)
+{
+    prepareArray(r, _template);
+    return readData(arrayIndex >= 0 ? off_t(arrayIndex * _template.dataSize()) : -1, r.data(), r.dataSize());
+}
+
+ArrayContainer FormatImportExportRAW::readArrayBox(Error* error, int arrayIndex,
+        const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize)
+{
+    std::vector<size_t> index, size;
+    if (!clipBox(_template, boxIndex, boxSize, index, size)) {
+        *error = ErrorInvalidData;
+        return ArrayContainer();
+    }
+    off_t dataOffset = (_f == stdin ? -1
+            : arrayIndex >= 0 ? off_t(arrayIndex * _template.dataSize())
+            : ftello(_f));
+    if (dataOffset < 0) {
+        // not seekable: read everything and crop
+        return FormatImportExport::readArrayBox(error, arrayIndex, boxIndex, boxSize);
     }
-    ArrayContainer r(_template);
-    if (fread(r.data(), r.dataSize(), 1, _f) != 1) {
-        *error = ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
+    ArrayContainer r;
+    Error e = readBoxFromFile(_f, dataOffset, _template, index, size, r, _swapEndianness);
+    if (e == ErrorNone && fseeko(_f, dataOffset + _template.dataSize(), SEEK_SET) != 0)
+        e = ErrorSysErrno;
+    if (e != ErrorNone) {
+        *error = e;
         return ArrayContainer();
     }
     return r;
@@ -153,11 +248,52 @@ bool FormatImportExportRAW::hasMore()
     }
 }
 
+Error FormatImportExportRAW::beginReadSlabs(int arrayIndex, ArrayDescription& desc)
+{
+    if (arrayIndex >= 0) {
+        if (fseeko(_f, arrayIndex * _template.dataSize(), SEEK_SET) != 0)
+            return ErrorSysErrno;
+    }
+    desc = _template;
+    return ErrorNone;
+}
+
+ArrayContainer FormatImportExportRAW::readSlab(Error* error, size_t, size_t sliceCount)
+{
+    std::vector<size_t> dimensions = _template.dimensions();
+    dimensions.back() = sliceCount;
+    ArrayContainer r(dimensions, _template.componentCount(), _template.componentType());
+    Error e = readData(-1, r.data(), r.dataSize());
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    return r;
+}
+
 Error FormatImportExportRAW::writeArray(const ArrayContainer& array)
 {
-    if (fwrite(array.data(), array.dataSize(), 1, _f) != 1 || fflush(_f) != 0)
+    if (!writeSwapped(_f, array.data(), array.dataSize(), array.componentSize(), _swapEndianness)
+            || fflush(_f) != 0)
         return ErrorSysErrno;
     return ErrorNone;
 }
 
+Error FormatImportExportRAW::beginWriteSlabs(const ArrayDescription&)
+{
+    return ErrorNone;
+}
+
+Error FormatImportExportRAW::writeSlab(const ArrayContainer& slab)
+{
+    if (!writeSwapped(_f, slab.data(), slab.dataSize(), slab.componentSize(), _swapEndianness))
+        return ErrorSysErrno;
+    return ErrorNone;
+}
+
+Error FormatImportExportRAW::endWriteSlabs()
+{
+    return (fflush(_f) != 0 ? ErrorSysErrno : ErrorNone);
+}
+
 }
@@ -36,6 +36,12 @@ private:
     ArrayDescription _template;
     FILE* _f;
     int _arrayCount;
+    bool _swapEndianness;
+    bool _seekable; // whether the data can be read with pread() instead of stdio
+    int _directFd; // file descriptor for direct I/O, or -1
+
+    Error endiannessFromHints(const TagList& hints);
+    Error readData(off_t offset, void* data, size_t size);
 
 public:
     FormatImportExportRAW();
@@ -48,10 +54,20 @@ public:
     // for reading:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual Error readArrayInto(ArrayContainer& target, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual ArrayContainer readArrayBox(Error* error, int arrayIndex,
+            const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize) override;
+    virtual Error beginReadSlabs(int arrayIndex, ArrayDescription& desc) override;
+    virtual ArrayContainer readSlab(Error* error, size_t sliceIndex, size_t sliceCount) override;
+
+    virtual bool isReentrant() const override { return true; }
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
+    virtual Error beginWriteSlabs(const ArrayDescription& desc) override;
+    virtual Error writeSlab(const ArrayContainer& slab) override;
+    virtual Error endWriteSlabs() override;
 };
 
 }
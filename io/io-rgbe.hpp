@@ -54,6 +54,8 @@ public:
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
 
+    virtual bool isReentrant() const override { return true; }
+
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
 };
@@ -40,7 +40,10 @@
 
 namespace TGD {
 
-FormatImportExportSTB::FormatImportExportSTB() : _f(nullptr), _hasMore(true)
+/* The output buffer starts with this capacity and grows as needed */
+static const size_t initialBufferSize = 1 << 20;
+
+FormatImportExportSTB::FormatImportExportSTB() : _f(nullptr), _hasMore(true), _quality(85)
 {
     stbi_set_flip_vertically_on_load(1);
     stbi_flip_vertically_on_write(1);
@@ -59,10 +62,13 @@ Error FormatImportExportSTB::openForReading(const std::string& fileName, const T
     return _f ? ErrorNone : ErrorSysErrno;
 }
 
-Error FormatImportExportSTB::openForWriting(const std::string& fileName, bool append, const TagList&)
+Error FormatImportExportSTB::openForWriting(const std::string& fileName, bool append, const TagList& hints)
 {
     if (append)
         return ErrorFeaturesUnsupported;
+    _quality = hints.value("QUALITY", 85);
+    if (_quality < 1 || _quality > 100)
+        return ErrorInvalidData;
     if (fileName == "-") {
         _f = stdout;
         _extension = "png";
@@ -99,26 +105,56 @@ ArrayContainer FormatImportExportSTB::readArray(Error* error, int arrayIndex)
         return ArrayContainer();
     }
 
+    // Decode from memory: the rest of the file is either mapped or read completely
+    std::shared_ptr<FileMapping> mapping;
+    std::vector<unsigned char> buffer;
+    const unsigned char* fileData = nullptr;
+    size_t fileSize = 0;
+    off_t offset = (_f == stdin ? -1 : ftello(_f));
+    if (offset >= 0)
+        mapping = FileMapping::create(_f, 0);
+    if (mapping && size_t(offset) <= mapping->size) {
+        fileData = static_cast<const unsigned char*>(mapping->address) + offset;
+        fileSize = mapping->size - offset;
+    } else {
+        size_t n;
+        do {
+            size_t oldSize = buffer.size();
+            buffer.resize(std::max(oldSize * 2, size_t(1 << 16)));
+            n = std::fread(buffer.data() + oldSize, 1, buffer.size() - oldSize, _f);
+            buffer.resize(oldSize + n);
+        } while (n > 0);
+        if (std::ferror(_f)) {
+            *error = ErrorSysErrno;
+            return ArrayContainer();
+        }
+        fileData = buffer.data();
+        fileSize = buffer.size();
+    }
+    if (fileSize > size_t(std::numeric_limits<int>::max())) {
+        *error = ErrorFeaturesUnsupported;
+        return ArrayContainer();
+    }
+
+    // The decoded data is used without a copy and freed by stb
     int width, height, channels;
     TGD::ArrayContainer r;
-    if (stbi_is_16_bit_from_file(_f)) {
-        stbi_us* data = stbi_load_from_file_16(_f, &width, &height, &channels, 0);
+    if (stbi_is_16_bit_from_memory(fileData, fileSize)) {
+        stbi_us* data = stbi_load_16_from_memory(fileData, fileSize, &width, &height, &channels, 0);
         if (!data) {
             *error = ErrorInvalidData;
             return ArrayContainer();
         }
-        r = TGD::ArrayContainer( { size_t(width), size_t(height) }, channels, uint16);
-        std::memcpy(r.data(), data, r.dataSize());
-        stbi_image_free(data);
+        r = TGD::ArrayContainer(ArrayDescription({ size_t(width), size_t(height) }, channels, uint16),
+                data, [] (unsigned char* p) { stbi_image_free(p); });
     } else {
-        stbi_uc* data = stbi_load_from_file(_f, &width, &height, &channels, 0);
+        stbi_uc* data = stbi_load_from_memory(fileData, fileSize, &width, &height, &channels, 0);
         if (!data) {
             *error = ErrorInvalidData;
             return ArrayContainer();
         }
-        r = TGD::ArrayContainer( { size_t(width), size_t(height) }, channels, uint8);
-        std::memcpy(r.data(), data, r.dataSize());
-        stbi_image_free(data);
+        r = TGD::ArrayContainer(ArrayDescription({ size_t(width), size_t(height) }, channels, uint8),
+                data, [] (unsigned char* p) { stbi_image_free(p); });
     }
 
     if (r.componentCount() == 1) {
@@ -146,10 +182,12 @@ bool FormatImportExportSTB::hasMore()
     return _hasMore;
 }
 
+/* Collect the output of stb in the buffer, so that each image is written at once */
 static void writeFunc(void* context, void* data, int size)
 {
-    FILE* f = static_cast<FILE*>(context);
-    fwrite(data, size, 1, f);
+    std::vector<unsigned char>* buffer = static_cast<std::vector<unsigned char>*>(context);
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    buffer->insert(buffer->end(), p, p + size);
 }
 
 Error FormatImportExportSTB::writeArray(const ArrayContainer& array)
@@ -162,15 +200,18 @@ Error FormatImportExportSTB::writeArray(const ArrayContainer& array)
         return ErrorFeaturesUnsupported;
     }
 
+    _buffer.clear();
+    _buffer.reserve(initialBufferSize);
+    void* context = &_buffer;
     int err = 0;
     if (_extension == "png") {
-        err = stbi_write_png_to_func(writeFunc, _f, array.dimension(0), array.dimension(1), array.componentCount(), array.data(), 0);
+        err = stbi_write_png_to_func(writeFunc, context, array.dimension(0), array.dimension(1), array.componentCount(), array.data(), 0);
     } else if (_extension == "bmp") {
-        err = stbi_write_bmp_to_func(writeFunc, _f, array.dimension(0), array.dimension(1), array.componentCount(), array.data());
+        err = stbi_write_bmp_to_func(writeFunc, context, array.dimension(0), array.dimension(1), array.componentCount(), array.data());
     } else if (_extension == "tga") {
-        err = stbi_write_tga_to_func(writeFunc, _f, array.dimension(0), array.dimension(1), array.componentCount(), array.data());
+        err = stbi_write_tga_to_func(writeFunc, context, array.dimension(0), array.dimension(1), array.componentCount(), array.data());
     } else if (_extension == "jpg") {
-        err = stbi_write_jpg_to_func(writeFunc, _f, array.dimension(0), array.dimension(1), array.componentCount(), array.data(), 85);
+        err = stbi_write_jpg_to_func(writeFunc, context, array.dimension(0), array.dimension(1), array.componentCount(), array.data(), _quality);
     } else {
         return ErrorFeaturesUnsupported;
     }
@@ -178,7 +219,7 @@ Error FormatImportExportSTB::writeArray(const ArrayContainer& array)
         return ErrorLibrary;
     }
 
-    if (ferror(_f) || fflush(_f) != 0) {
+    if (std::fwrite(_buffer.data(), 1, _buffer.size(), _f) != _buffer.size() || fflush(_f) != 0) {
         return ErrorSysErrno;
     }
     return ErrorNone;
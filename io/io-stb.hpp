@@ -25,6 +25,7 @@
 #define TGD_IO_STB_HPP
 
 #include <cstdio>
+#include <vector>
 
 #include "io.hpp"
 
@@ -35,6 +36,8 @@ private:
     FILE* _f;
     bool _hasMore; // only for reading
     std::string _extension; // only for writing
+    int _quality; // only for writing JPEG
+    std::vector<unsigned char> _buffer; // only for writing; reused for all arrays
 
 public:
     FormatImportExportSTB();
@@ -23,15 +23,51 @@
  */
 
 #include <cstdio>
+#include <cerrno>
+#include <cmath>
+#include <atomic>
+#include <algorithm>
 
-#include "io-tgd.hpp"
+#ifdef _WIN32
+# include <io.h>
+#else
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+# include <sys/uio.h>
+# include <fcntl.h>
+# include <unistd.h>
+# define TGD_HAVE_WRITEV 1
+#endif
+
+#ifdef TGD_WITH_ZLIB
+# include <zlib.h>
+#endif
 
+#include "io-tgd.hpp"
+#include "io-utils.hpp"
+#include "parallel.hpp"
+#include "statistics.hpp"
 
 namespace TGD {
 
+/* The buffer size requested for pipes, and for reading from stdin if it is a pipe.
+ * Linux allows unprivileged processes to grow pipes to 1 MiB by default. */
+static const size_t pipeBufferSize = 1 << 20;
+
 FormatImportExportTGD::FormatImportExportTGD() :
     _f(nullptr),
-    _arrayCount(-2)
+    _arrayCount(-2),
+    _mmapMode(-1),
+    _directFd(-1),
+    _bricked(false),
+    _indexOffset(-1),
+    _writeIndex(false),
+    _flushEachArray(true),
+    _pipeFd(-1),
+    _writeStatistics(false),
+    _slabOffset(-1),
+    _slabSlices(0)
 {
 }
 
@@ -40,79 +76,433 @@ FormatImportExportTGD::~FormatImportExportTGD()
     close();
 }
 
-Error FormatImportExportTGD::openForReading(const std::string& fileName, const TagList&)
+/* The layout of the data of a TGD: either packed, or in compressed chunks */
+class TGDChunking
 {
-    if (fileName == "-")
-        _f = stdin;
-    else
-        _f = fopen(fileName.c_str(), "rb");
-    return _f ? ErrorNone : ErrorSysErrno;
+public:
+    bool chunked;
+    uint64_t codec;                     // 0 = none, 1 = deflate
+    uint64_t filter;                    // 0 = none, 1 = byte shuffle
+    std::vector<size_t> chunkSize;      // chunk size in each dimension
+    std::vector<uint64_t> offsets;      // start of each chunk relative to the chunk data, plus end
+
+    TGDChunking() : chunked(false), codec(0), filter(0)
+    {
+    }
+
+    size_t chunkCount() const
+    {
+        return offsets.size() - 1;
+    }
+
+    // total size of the data on disk
+    uint64_t storedSize(const ArrayDescription& desc) const
+    {
+        return (chunked ? offsets.back() : desc.dataSize());
+    }
+
+    // number of chunks in each dimension
+    std::vector<size_t> grid(const ArrayDescription& desc) const
+    {
+        std::vector<size_t> g(desc.dimensionCount());
+        for (size_t d = 0; d < g.size(); d++)
+            g[d] = (desc.dimension(d) + chunkSize[d] - 1) / chunkSize[d];
+        return g;
+    }
+
+    // index and size of the box covered by the given chunk
+    void chunkBox(const ArrayDescription& desc, const std::vector<size_t>& chunkIndex,
+            std::vector<size_t>& boxIndex, std::vector<size_t>& boxSize) const
+    {
+        boxIndex.resize(desc.dimensionCount());
+        boxSize.resize(desc.dimensionCount());
+        for (size_t d = 0; d < desc.dimensionCount(); d++) {
+            boxIndex[d] = chunkIndex[d] * chunkSize[d];
+            boxSize[d] = std::min(chunkSize[d], desc.dimension(d) - boxIndex[d]);
+        }
+    }
+};
+
+/* Precomputed statistics of a TGD: the statistics of each component in each
+ * cell of a regular grid. The cells are the chunks of chunked data, and slabs
+ * along the last dimension otherwise. */
+class TGDStatistics
+{
+public:
+    std::vector<size_t> cellSize;               // cell size in each dimension
+    std::vector<ComponentStatistics> cells;     // all components of the first cell, then of the second, ...
+
+    TGDStatistics(const ArrayDescription& desc, const std::vector<size_t>& size) :
+        cellSize(size)
+    {
+        cells.resize(cellCount(desc) * desc.componentCount());
+    }
+
+    // number of cells in each dimension
+    std::vector<size_t> grid(const ArrayDescription& desc) const
+    {
+        std::vector<size_t> g(desc.dimensionCount());
+        for (size_t d = 0; d < g.size(); d++)
+            g[d] = (desc.dimension(d) + cellSize[d] - 1) / cellSize[d];
+        return g;
+    }
+
+    size_t cellCount(const ArrayDescription& desc) const
+    {
+        return ArrayDescription(grid(desc), 1, uint8).elementCount();
+    }
+};
+
+/* Chunks should hold about this many bytes if the chunk size is not given */
+static const size_t defaultChunkBytes = 1 << 20;
+
+static std::vector<size_t> defaultChunkSize(const ArrayDescription& desc)
+{
+    std::vector<size_t> chunkSize(desc.dimensionCount(), 1);
+    double elements = double(defaultChunkBytes) / desc.elementSize();
+    size_t edge = std::max(size_t(1), size_t(std::pow(elements, 1.0 / desc.dimensionCount())));
+    for (size_t d = 0; d < desc.dimensionCount(); d++)
+        chunkSize[d] = std::max(size_t(1), std::min(edge, desc.dimension(d)));
+    return chunkSize;
 }
 
-Error FormatImportExportTGD::openForWriting(const std::string& fileName, bool append, const TagList&)
+/* The statistics cells of packed data: slabs of about the default chunk size */
+static std::vector<size_t> slabCellSize(const ArrayDescription& desc)
 {
-    if (fileName == "-")
-        _f = stdout;
-    else
-        _f = fopen(fileName.c_str(), append ? "ab" : "wb");
-    return _f ? ErrorNone : ErrorSysErrno;
+    std::vector<size_t> cellSize = desc.dimensions();
+    size_t lastDim = desc.dimensionCount() - 1;
+    size_t sliceSize = desc.dataSize() / desc.dimension(lastDim);
+    cellSize[lastDim] = std::max(size_t(1), std::min(desc.dimension(lastDim), defaultChunkBytes / sliceSize));
+    return cellSize;
 }
 
-void FormatImportExportTGD::close()
+/* Add the statistics of a slab of packed data, starting at the given slice, to
+ * the statistics of the slab cells that it intersects. */
+static void addSlabStatistics(TGDStatistics& statistics, size_t firstSlice, const ArrayContainer& slab)
 {
-    if (_f) {
-        if (_f != stdin && _f != stdout) {
-            fclose(_f);
+    size_t lastDim = slab.dimensionCount() - 1;
+    size_t cellSlices = statistics.cellSize[lastDim];
+    std::vector<size_t> boxIndex(slab.dimensionCount(), 0);
+    std::vector<size_t> boxSize = slab.dimensions();
+    for (size_t i = 0; i < slab.dimension(lastDim); i += boxSize[lastDim]) {
+        size_t cell = (firstSlice + i) / cellSlices;
+        boxIndex[lastDim] = i;
+        boxSize[lastDim] = std::min(slab.dimension(lastDim) - i, (cell + 1) * cellSlices - (firstSlice + i));
+        std::vector<ComponentStatistics> s = TGD::statistics(ArrayView(slab).box(boxIndex, boxSize));
+        for (size_t c = 0; c < s.size(); c++)
+            statistics.cells[cell * s.size() + c].merge(s[c]);
+    }
+}
+
+static void serializeComponentStatistics(uint64_t* buf, const ComponentStatistics& s)
+{
+    buf[0] = s.count;
+    buf[1] = s.finiteCount;
+    buf[2] = s.nanCount;
+    const double values[5] = { s.minimum, s.maximum, s.sum, s.mean, s.m2 };
+    std::memcpy(buf + 3, values, sizeof(values));
+}
+
+static void deserializeComponentStatistics(const uint64_t* buf, ComponentStatistics& s)
+{
+    s.count = buf[0];
+    s.finiteCount = buf[1];
+    s.nanCount = buf[2];
+    double values[5];
+    std::memcpy(values, buf + 3, sizeof(values));
+    s.minimum = values[0];
+    s.maximum = values[1];
+    s.sum = values[2];
+    s.mean = values[3];
+    s.m2 = values[4];
+}
+
+/* Byte shuffling groups the n-th bytes of all values, which makes
+ * multi-byte data much more compressible. */
+static void shuffleBytes(unsigned char* dst, const unsigned char* src, size_t size, size_t valueSize)
+{
+    size_t n = size / valueSize;
+    for (size_t i = 0; i < n; i++)
+        for (size_t b = 0; b < valueSize; b++)
+            dst[b * n + i] = src[i * valueSize + b];
+}
+
+static void unshuffleBytes(unsigned char* dst, const unsigned char* src, size_t size, size_t valueSize)
+{
+    size_t n = size / valueSize;
+    for (size_t b = 0; b < valueSize; b++)
+        for (size_t i = 0; i < n; i++)
+            dst[i * valueSize + b] = src[b * n + i];
+}
+
+/* Encode a chunk. Chunks that do not get smaller are stored unmodified;
+ * these are recognized by their size when decoding. */
+static void encodeChunk(const TGDChunking& chunking, size_t componentSize,
+        const unsigned char* raw, size_t rawSize, std::vector<unsigned char>& encoded)
+{
+    std::vector<unsigned char> shuffled;
+    const unsigned char* data = raw;
+    if (chunking.filter == 1 && componentSize > 1) {
+        shuffled.resize(rawSize);
+        shuffleBytes(shuffled.data(), raw, rawSize, componentSize);
+        data = shuffled.data();
+    }
+#ifdef TGD_WITH_ZLIB
+    if (chunking.codec == 1) {
+        uLongf encodedSize = compressBound(rawSize);
+        encoded.resize(encodedSize);
+        if (compress2(encoded.data(), &encodedSize, data, rawSize, Z_BEST_SPEED) == Z_OK
+                && encodedSize < rawSize) {
+            encoded.resize(encodedSize);
+            return;
         }
-        _f = nullptr;
     }
+#endif
+    encoded.assign(raw, raw + rawSize);
 }
 
-static bool writeTgdTagList(FILE* f, const TagList& tl)
+static bool decodeChunk(const TGDChunking& chunking, size_t componentSize,
+        const unsigned char* encoded, size_t encodedSize, unsigned char* raw, size_t rawSize)
 {
-    std::vector<char> data(sizeof(uint64_t), 0);
+    if (encodedSize == rawSize) {
+        std::memcpy(raw, encoded, rawSize);
+        return true;
+    }
+    if (chunking.codec != 1 || encodedSize > rawSize)
+        return false;
+#ifdef TGD_WITH_ZLIB
+    bool shuffled = (chunking.filter == 1 && componentSize > 1);
+    std::vector<unsigned char> tmp(shuffled ? rawSize : 0);
+    uLongf decodedSize = rawSize;
+    if (uncompress(shuffled ? tmp.data() : raw, &decodedSize, encoded, encodedSize) != Z_OK
+            || decodedSize != rawSize) {
+        return false;
+    }
+    if (shuffled)
+        unshuffleBytes(raw, tmp.data(), rawSize, componentSize);
+    return true;
+#else
+    (void)componentSize;
+    (void)raw;
+    return false;
+#endif
+}
+
+static void serializeTgdTagList(std::vector<unsigned char>& buf, const TagList& tl)
+{
+    size_t sizePos = buf.size();
+    buf.resize(buf.size() + sizeof(uint64_t));
     for (auto it = tl.cbegin(); it != tl.cend(); it++) {
-        data.insert(data.end(), it->first.c_str(), it->first.c_str() + it->first.length() + 1);
-        data.insert(data.end(), it->second.c_str(), it->second.c_str() + it->second.length() + 1);
+        buf.insert(buf.end(), it->first.c_str(), it->first.c_str() + it->first.length() + 1);
+        buf.insert(buf.end(), it->second.c_str(), it->second.c_str() + it->second.length() + 1);
     }
-    uint64_t n = data.size() - sizeof(uint64_t);
-    std::memcpy(data.data(), &n, sizeof(uint64_t));
-    return std::fwrite(data.data(), data.size(), 1, f) == 1;
+    uint64_t n = buf.size() - sizePos - sizeof(uint64_t);
+    std::memcpy(buf.data() + sizePos, &n, sizeof(uint64_t));
 }
 
-static bool writeTgd(FILE* f, const ArrayContainer& array)
+static void serializeUint64(std::vector<unsigned char>& buf, uint64_t v)
 {
-    std::vector<uint8_t> start(5 + 2 * sizeof(uint64_t) + array.dimensionCount() * sizeof(uint64_t));
-    start[0] = 'T';
-    start[1] = 'G';
-    start[2] = 'D';
-    start[3] = 0;
-    start[4] = array.componentType();
-    uint64_t v;
-    v = array.componentCount();
-    std::memcpy(start.data() + 5, &v, sizeof(uint64_t));
-    v = array.dimensionCount();
-    std::memcpy(start.data() + 5 + sizeof(uint64_t), &v, sizeof(uint64_t));
-    for (size_t d = 0; d < array.dimensionCount(); d++) {
-        v = array.dimension(d);
-        std::memcpy(start.data() + 5 + 2 * sizeof(uint64_t) + d * sizeof(uint64_t), &v, sizeof(uint64_t));
-    }
-    if (std::fwrite(start.data(), start.size(), 1, f) != 1
-            || !writeTgdTagList(f, array.globalTagList())) {
-        return false;
+    size_t pos = buf.size();
+    buf.resize(pos + sizeof(uint64_t));
+    std::memcpy(buf.data() + pos, &v, sizeof(uint64_t));
+}
+
+/* Serialize everything that precedes the data, including the chunk table of
+ * chunked data, into one buffer so that it can be written at once. */
+static void serializeTgdHeader(std::vector<unsigned char>& buf, const ArrayDescription& array, const TGDChunking& chunking)
+{
+    buf.clear();
+    buf.push_back('T');
+    buf.push_back('G');
+    buf.push_back('D');
+    buf.push_back(chunking.chunked ? 1 : 0);
+    buf.push_back(array.componentType());
+    serializeUint64(buf, array.componentCount());
+    serializeUint64(buf, array.dimensionCount());
+    for (size_t d = 0; d < array.dimensionCount(); d++)
+        serializeUint64(buf, array.dimension(d));
+    serializeTgdTagList(buf, array.globalTagList());
+    for (size_t c = 0; c < array.componentCount(); c++)
+        serializeTgdTagList(buf, array.componentTagList(c));
+    for (size_t d = 0; d < array.dimensionCount(); d++)
+        serializeTgdTagList(buf, array.dimensionTagList(d));
+    if (chunking.chunked) {
+        serializeUint64(buf, chunking.codec);
+        serializeUint64(buf, chunking.filter);
+        for (size_t d = 0; d < chunking.chunkSize.size(); d++)
+            serializeUint64(buf, chunking.chunkSize[d]);
+        for (size_t i = 0; i < chunking.offsets.size(); i++)
+            serializeUint64(buf, chunking.offsets[i]);
     }
-    for (size_t c = 0; c < array.componentCount(); c++) {
-        if (!writeTgdTagList(f, array.componentTagList(c)))
+}
+
+/* A block of data to be written */
+struct TGDBlock
+{
+    const void* data;
+    size_t size;
+};
+
+/* Write the blocks either with fwrite() or, if pipeFd is valid, directly to the
+ * pipe with as few writev() calls as possible, bypassing the stdio buffer. */
+static bool writeTgdBlocks(FILE* f, int pipeFd, const std::vector<TGDBlock>& blocks)
+{
+#ifdef TGD_HAVE_WRITEV
+    if (pipeFd >= 0) {
+        if (std::fflush(f) != 0)
             return false;
+        const size_t maxIovecs = 1024; // the Linux limit
+        std::vector<struct iovec> iov;
+        for (size_t i = 0; i < blocks.size(); i++)
+            if (blocks[i].size > 0)
+                iov.push_back({ const_cast<void*>(blocks[i].data), blocks[i].size });
+        size_t i = 0;
+        while (i < iov.size()) {
+            ssize_t r = writev(pipeFd, iov.data() + i, std::min(iov.size() - i, maxIovecs));
+            if (r < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            // skip what was written; writes to pipes may be partial
+            size_t written = r;
+            while (i < iov.size() && written >= iov[i].iov_len) {
+                written -= iov[i].iov_len;
+                i++;
+            }
+            if (written > 0) {
+                iov[i].iov_base = static_cast<unsigned char*>(iov[i].iov_base) + written;
+                iov[i].iov_len -= written;
+            }
+        }
+        return true;
     }
-    for (size_t d = 0; d < array.dimensionCount(); d++) {
-        if (!writeTgdTagList(f, array.dimensionTagList(d)))
+#else
+    (void)pipeFd;
+#endif
+    for (size_t i = 0; i < blocks.size(); i++) {
+        if (blocks[i].size > 0 && std::fwrite(blocks[i].data, blocks[i].size, 1, f) != 1)
             return false;
     }
-    if (std::fwrite(array.data(), array.dataSize(), 1, f) != 1 || std::fflush(f) != 0) {
+    return true;
+}
+
+static bool writeTgdHeader(FILE* f, int pipeFd, const ArrayDescription& array, const TGDChunking& chunking)
+{
+    std::vector<unsigned char> header;
+    serializeTgdHeader(header, array, chunking);
+    return writeTgdBlocks(f, pipeFd, { { header.data(), header.size() } });
+}
+
+/* If fd refers to a pipe, try to enlarge the pipe buffer so that the writer
+ * and the reader need fewer context switches, and return true. */
+static bool preparePipe(int fd)
+{
+#ifdef TGD_HAVE_WRITEV
+    struct stat statbuf;
+    if (fd < 0 || fstat(fd, &statbuf) != 0 || !S_ISFIFO(statbuf.st_mode))
         return false;
-    }
+# ifdef F_SETPIPE_SZ
+    if (fcntl(fd, F_GETPIPE_SZ) < int(pipeBufferSize))
+        fcntl(fd, F_SETPIPE_SZ, int(pipeBufferSize)); // may fail, e.g. due to limits
+# endif
     return true;
+#else
+    (void)fd;
+    return false;
+#endif
+}
+
+/* Write a TGD. If statistics is not null, it is set to the statistics of the
+ * chunks or slab cells, which are computed while the data is hot in the cache:
+ * chunks when they are encoded, and slab cells just before they are written. */
+static bool writeTgd(FILE* f, int pipeFd, const ArrayContainer& array, const TGDChunking& chunkingTemplate,
+        std::shared_ptr<TGDStatistics>* statistics)
+{
+    // Encode the chunks first since their sizes are part of the header
+    TGDChunking chunking;
+    std::vector<std::vector<unsigned char>> chunks;
+    // Arrays in the bricked layout are always stored in chunks, by default with the brick size
+    if ((chunkingTemplate.chunked || array.isBricked()) && array.dimensionCount() > 0 && array.elementCount() > 0) {
+        chunking = chunkingTemplate;
+        chunking.chunked = true;
+        if (chunking.chunkSize.empty() && array.isBricked())
+            chunking.chunkSize = array.brickSize();
+        else if (chunking.chunkSize.size() == 1)
+            chunking.chunkSize = std::vector<size_t>(array.dimensionCount(), chunking.chunkSize[0]);
+        else if (chunking.chunkSize.size() != array.dimensionCount())
+            chunking.chunkSize = defaultChunkSize(array);
+        for (size_t d = 0; d < array.dimensionCount(); d++)
+            chunking.chunkSize[d] = std::max(size_t(1), std::min(chunking.chunkSize[d], array.dimension(d)));
+        std::vector<size_t> grid = chunking.grid(array);
+        ArrayDescription gridDesc(grid, 1, uint8);
+        chunks.resize(gridDesc.elementCount());
+        if (statistics)
+            *statistics = std::make_shared<TGDStatistics>(array, chunking.chunkSize);
+        parallelFor(defaultExecutionPolicy(), chunks.size(), 1, [&] (size_t begin, size_t end) {
+            std::vector<size_t> chunkIndex(grid.size());
+            std::vector<size_t> boxIndex, boxSize;
+            for (size_t i = begin; i < end; i++) {
+                gridDesc.toVectorIndex(i, chunkIndex.data());
+                chunking.chunkBox(array, chunkIndex, boxIndex, boxSize);
+                ArrayContainer raw;
+                if (array.brickSize() == chunking.chunkSize) {
+                    // the chunk is a brick of the array
+                    unsigned char* brick = static_cast<unsigned char*>(const_cast<void*>(array.data()))
+                        + array.storageIndex(boxIndex) * array.elementSize();
+                    raw = ArrayContainer(ArrayDescription(boxSize, array.componentCount(), array.componentType()), brick);
+                } else {
+                    raw = extractBox(array, boxIndex, boxSize);
+                }
+                encodeChunk(chunking, array.componentSize(),
+                        static_cast<const unsigned char*>(raw.data()), raw.dataSize(), chunks[i]);
+                if (statistics) {
+                    std::vector<ComponentStatistics> s = TGD::statistics(Sequential, raw);
+                    std::copy(s.begin(), s.end(), (*statistics)->cells.begin() + i * s.size());
+                }
+            }
+        });
+        chunking.offsets.resize(chunks.size() + 1);
+        chunking.offsets[0] = 0;
+        for (size_t i = 0; i < chunks.size(); i++)
+            chunking.offsets[i + 1] = chunking.offsets[i] + chunks[i].size();
+    }
+
+    if (statistics && !chunking.chunked) {
+        statistics->reset();
+        if (array.dimensionCount() > 0 && array.elementCount() > 0) {
+            // Write packed data one slab cell at a time
+            *statistics = std::make_shared<TGDStatistics>(array, slabCellSize(array));
+            if (!writeTgdHeader(f, pipeFd, array, chunking))
+                return false;
+            size_t lastDim = array.dimensionCount() - 1;
+            size_t cellSlices = (*statistics)->cellSize[lastDim];
+            size_t sliceSize = array.dataSize() / array.dimension(lastDim);
+            unsigned char* data = static_cast<unsigned char*>(const_cast<void*>(array.data()));
+            std::vector<size_t> cellDimensions = array.dimensions();
+            for (size_t i = 0; i < array.dimension(lastDim); i += cellSlices) {
+                cellDimensions[lastDim] = std::min(cellSlices, array.dimension(lastDim) - i);
+                ArrayContainer cell(ArrayDescription(cellDimensions, array.componentCount(), array.componentType()),
+                        data + i * sliceSize);
+                addSlabStatistics(**statistics, i, cell);
+                if (!writeTgdBlocks(f, pipeFd, { { cell.data(), cell.dataSize() } }))
+                    return false;
+            }
+            return true;
+        }
+    }
+
+    std::vector<unsigned char> header;
+    serializeTgdHeader(header, array, chunking);
+    std::vector<TGDBlock> blocks;
+    blocks.push_back({ header.data(), header.size() });
+    if (chunking.chunked) {
+        for (size_t i = 0; i < chunks.size(); i++)
+            blocks.push_back({ chunks[i].data(), chunks[i].size() });
+    } else {
+        blocks.push_back({ array.data(), array.dataSize() });
+    }
+    return writeTgdBlocks(f, pipeFd, blocks);
 }
 
 static bool readString(const char* data, std::string& s, size_t& len)
@@ -158,7 +548,7 @@ static Error readTgdTagList(FILE* f, TagList& tl)
     return ErrorNone;
 }
 
-static Error readTgdHeader(FILE* f, ArrayContainer& array)
+static Error readTgdHeader(FILE* f, ArrayDescription& array, TGDChunking& chunking)
 {
     uint8_t start[5 + 2 * sizeof(uint64_t)];
     if (std::fread(start, 5 + 2 * sizeof(uint64_t), 1, f) != 1)
@@ -167,8 +557,8 @@ static Error readTgdHeader(FILE* f, ArrayContainer& array)
     uint64_t dimCount;
     std::memcpy(&compCount, start + 5, sizeof(uint64_t));
     std::memcpy(&dimCount, start + 5 + sizeof(uint64_t), sizeof(uint64_t));
-    if (start[0] != 'T' || (start[1] != 'G' && start[1] != 'A') || start[2] != 'D' || start[3] != 0
-            || start[4] > 15
+    if (start[0] != 'T' || (start[1] != 'G' && start[1] != 'A') || start[2] != 'D' || start[3] > 1
+            || start[4] > bfloat16
             || compCount > std::numeric_limits<size_t>::max()
             || dimCount > std::numeric_limits<size_t>::max()) {
         return ErrorInvalidData;
@@ -185,7 +575,7 @@ static Error readTgdHeader(FILE* f, ArrayContainer& array)
             dimensions[d] = origDimensions[d];
     }
 
-    array = ArrayContainer(dimensions, compCount, static_cast<Type>(start[4]));
+    array = ArrayDescription(dimensions, compCount, static_cast<Type>(start[4]));
     Error e;
     if ((e = readTgdTagList(f, array.globalTagList())) != ErrorNone)
         return e;
@@ -195,6 +585,37 @@ static Error readTgdHeader(FILE* f, ArrayContainer& array)
     for (size_t d = 0; d < array.dimensionCount(); d++)
         if ((e = readTgdTagList(f, array.dimensionTagList(d))) != ErrorNone)
             return e;
+    chunking = TGDChunking();
+    if (start[3] == 1) {
+        // chunked data: codec, filter, chunk sizes, chunk offsets
+        chunking.chunked = true;
+        std::vector<uint64_t> table(2 + dimCount);
+        if (std::fread(table.data(), table.size() * sizeof(uint64_t), 1, f) != 1)
+            return std::ferror(f) ? ErrorSysErrno : ErrorInvalidData;
+        chunking.codec = table[0];
+        chunking.filter = table[1];
+        if (chunking.codec > 1 || chunking.filter > 1 || dimCount == 0)
+            return ErrorInvalidData;
+        chunking.chunkSize.resize(dimCount);
+        for (size_t d = 0; d < dimCount; d++) {
+            if (table[2 + d] == 0 || table[2 + d] > array.dimension(d))
+                return ErrorInvalidData;
+            chunking.chunkSize[d] = table[2 + d];
+        }
+        size_t chunkCount = ArrayDescription(chunking.grid(array), 1, uint8).elementCount();
+        chunking.offsets.resize(chunkCount + 1);
+        if (std::fread(chunking.offsets.data(), chunking.offsets.size() * sizeof(uint64_t), 1, f) != 1)
+            return std::ferror(f) ? ErrorSysErrno : ErrorInvalidData;
+        for (size_t i = 0; i < chunkCount; i++)
+            if (chunking.offsets[i] > chunking.offsets[i + 1])
+                return ErrorInvalidData;
+        if (chunking.offsets[0] != 0)
+            return ErrorInvalidData;
+#ifndef TGD_WITH_ZLIB
+        if (chunking.codec == 1)
+            return ErrorFeaturesUnsupported;
+#endif
+    }
     return ErrorNone;
 }
 
@@ -203,9 +624,473 @@ static bool readTgdData(FILE *f, ArrayContainer& array)
     return (std::fread(array.data(), array.dataSize(), 1, f) == 1);
 }
 
-static bool skipTgdData(FILE *f, const ArrayContainer& array)
+static bool skipTgdData(FILE *f, const ArrayDescription& array, const TGDChunking& chunking)
+{
+    uint64_t size = chunking.storedSize(array);
+    if (fseeko(f, size, SEEK_CUR) == 0)
+        return true;
+    if (errno != ESPIPE)
+        return false;
+    // pipes can only be skipped by reading
+    std::vector<unsigned char> buffer(std::min(size, uint64_t(pipeBufferSize)));
+    while (size > 0) {
+        size_t n = std::min(size, uint64_t(buffer.size()));
+        if (std::fread(buffer.data(), n, 1, f) != 1)
+            return false;
+        size -= n;
+    }
+    return true;
+}
+
+/* Read the chunks that intersect the given box and decode them in parallel
+ * into the array, which has the size of the box. The file position must be at
+ * the start of the chunk data, and is left at its end. */
+static Error readTgdChunks(FILE* f, const TGDChunking& chunking, const ArrayDescription& desc,
+        const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize, ArrayContainer& array)
+{
+    const size_t dimCount = desc.dimensionCount();
+    off_t dataOffset = ftello(f);
+    std::vector<size_t> grid = chunking.grid(desc);
+    std::vector<size_t> gridIndex(dimCount), gridSize(dimCount);
+    for (size_t d = 0; d < dimCount; d++) {
+        gridIndex[d] = boxIndex[d] / chunking.chunkSize[d];
+        gridSize[d] = (boxIndex[d] + boxSize[d] + chunking.chunkSize[d] - 1) / chunking.chunkSize[d] - gridIndex[d];
+    }
+    ArrayDescription gridDesc(grid, 1, uint8);
+    ArrayDescription neededGridDesc(gridSize, 1, uint8);
+
+    // Read the needed chunks; if all chunks are needed, read them in one go
+    std::vector<size_t> needed;
+    for (BoxIterator it(grid, gridIndex, gridSize); !it.atEnd(); it.next())
+        needed.push_back(it.linearIndex());
+    std::vector<unsigned char> encoded;
+    std::vector<size_t> encodedStart(needed.size());
+    if (needed.size() == chunking.chunkCount()) {
+        encoded.resize(chunking.offsets.back());
+        if (encoded.size() > 0 && std::fread(encoded.data(), encoded.size(), 1, f) != 1)
+            return std::ferror(f) ? ErrorSysErrno : ErrorInvalidData;
+        for (size_t i = 0; i < needed.size(); i++)
+            encodedStart[i] = chunking.offsets[i];
+    } else {
+        if (dataOffset < 0)
+            return ErrorSeekingNotSupported;
+        for (size_t i = 0; i < needed.size(); i++) {
+            size_t c = needed[i];
+            size_t size = chunking.offsets[c + 1] - chunking.offsets[c];
+            encodedStart[i] = encoded.size();
+            encoded.resize(encoded.size() + size);
+            if (fseeko(f, dataOffset + chunking.offsets[c], SEEK_SET) != 0)
+                return ErrorSysErrno;
+            if (size > 0 && std::fread(encoded.data() + encodedStart[i], size, 1, f) != 1)
+                return std::ferror(f) ? ErrorSysErrno : ErrorInvalidData;
+        }
+        if (fseeko(f, dataOffset + chunking.offsets.back(), SEEK_SET) != 0)
+            return ErrorSysErrno;
+    }
+
+    // Decode the chunks and copy their overlap with the box into the array
+    std::atomic<bool> ok(true);
+    parallelFor(defaultExecutionPolicy(), needed.size(), 1, [&] (size_t begin, size_t end) {
+        std::vector<size_t> chunkIndex(dimCount), chunkBoxIndex, chunkBoxSize;
+        std::vector<size_t> srcIndex(dimCount), dstIndex(dimCount), copySize(dimCount);
+        std::vector<unsigned char> raw;
+        for (size_t i = begin; i < end; i++) {
+            size_t c = needed[i];
+            gridDesc.toVectorIndex(c, chunkIndex.data());
+            chunking.chunkBox(desc, chunkIndex, chunkBoxIndex, chunkBoxSize);
+            size_t rawSize = ArrayDescription(chunkBoxSize, 1, uint8).elementCount() * array.elementSize();
+            if (array.isBricked()) {
+                // the array consists of the chunks, see FormatImportExportTGD::readArrayHelper()
+                assert(array.brickSize() == chunking.chunkSize);
+                unsigned char* brick = static_cast<unsigned char*>(array.data())
+                    + array.storageIndex(chunkBoxIndex) * array.elementSize();
+                if (!decodeChunk(chunking, array.componentSize(), encoded.data() + encodedStart[i],
+                            chunking.offsets[c + 1] - chunking.offsets[c], brick, rawSize)) {
+                    ok = false;
+                    return;
+                }
+                continue;
+            }
+            raw.resize(rawSize);
+            if (!decodeChunk(chunking, array.componentSize(), encoded.data() + encodedStart[i],
+                        chunking.offsets[c + 1] - chunking.offsets[c], raw.data(), rawSize)) {
+                ok = false;
+                return;
+            }
+            for (size_t d = 0; d < dimCount; d++) {
+                size_t lo = std::max(chunkBoxIndex[d], boxIndex[d]);
+                size_t hi = std::min(chunkBoxIndex[d] + chunkBoxSize[d], boxIndex[d] + boxSize[d]);
+                srcIndex[d] = lo - chunkBoxIndex[d];
+                dstIndex[d] = lo - boxIndex[d];
+                copySize[d] = hi - lo;
+            }
+            copyBox(static_cast<unsigned char*>(array.data()), array.dimensions(), dstIndex,
+                    raw.data(), chunkBoxSize, srcIndex, copySize, array.elementSize());
+        }
+    });
+    return ok ? ErrorNone : ErrorInvalidData;
+}
+
+static bool tgdHasMore(FILE* f)
+{
+    int c = fgetc(f);
+    if (c == EOF) {
+        return false;
+    } else {
+        ungetc(c, f);
+        return (c != 'I'); // an index block follows the last TGD
+    }
+}
+
+static bool truncateFile(FILE* f, off_t size)
+{
+    if (std::fflush(f) != 0)
+        return false;
+#ifdef _WIN32
+    return (_chsize_s(_fileno(f), size) == 0);
+#else
+    return (ftruncate(fileno(f), size) == 0);
+#endif
+}
+
+static const char indexBlockMagic[4] = { 'I', 'D', 'X', 0 };
+static const char indexTrailerMagic[8] = { 'T', 'G', 'D', 'I', 'N', 'D', 'E', 'X' };
+
+/* Write the index block. Version 1 of the index block is written if there are
+ * statistics; it stores the statistics of each TGD behind the entries. */
+static bool writeTgdIndex(FILE* f, const std::vector<off_t>& offsets, const std::vector<ArrayDescription>& descriptions,
+        const std::vector<std::shared_ptr<TGDStatistics>>& statistics)
+{
+    off_t indexOffset = ftello(f);
+    if (indexOffset < 0)
+        return false;
+    bool haveStatistics = false;
+    for (size_t i = 0; i < statistics.size(); i++)
+        if (statistics[i])
+            haveStatistics = true;
+    std::vector<uint64_t> entries;
+    entries.push_back(offsets.size());
+    if (haveStatistics)
+        entries.push_back(0); // number of values of the entries, set below
+    std::vector<size_t> statisticsOffsetPositions;
+    for (size_t i = 0; i < offsets.size(); i++) {
+        entries.push_back(offsets[i]);
+        entries.push_back(descriptions[i].componentType());
+        entries.push_back(descriptions[i].componentCount());
+        entries.push_back(descriptions[i].dimensionCount());
+        for (size_t d = 0; d < descriptions[i].dimensionCount(); d++)
+            entries.push_back(descriptions[i].dimension(d));
+        if (haveStatistics) {
+            statisticsOffsetPositions.push_back(entries.size());
+            entries.push_back(0);
+        }
+    }
+    if (haveStatistics) {
+        entries[1] = entries.size() - 2;
+        for (size_t i = 0; i < offsets.size(); i++) {
+            if (!statistics[i])
+                continue;
+            const TGDStatistics& s = *statistics[i];
+            entries[statisticsOffsetPositions[i]] = indexOffset + sizeof(indexBlockMagic) + entries.size() * sizeof(uint64_t);
+            entries.insert(entries.end(), s.cellSize.begin(), s.cellSize.end());
+            size_t pos = entries.size();
+            entries.resize(pos + 8 * s.cells.size());
+            for (size_t j = 0; j < s.cells.size(); j++)
+                serializeComponentStatistics(entries.data() + pos + 8 * j, s.cells[j]);
+        }
+    }
+    entries.push_back(indexOffset);
+    char magic[sizeof(indexBlockMagic)];
+    std::memcpy(magic, indexBlockMagic, sizeof(magic));
+    magic[3] = (haveStatistics ? 1 : 0);
+    if (std::fwrite(magic, sizeof(magic), 1, f) != 1
+            || std::fwrite(entries.data(), entries.size() * sizeof(uint64_t), 1, f) != 1
+            || std::fwrite(indexTrailerMagic, sizeof(indexTrailerMagic), 1, f) != 1
+            || std::fflush(f) != 0) {
+        return false;
+    }
+    return true;
+}
+
+/* Read the index block of a seekable file, if there is one. The offsets of the
+ * statistics of the TGDs are 0 if there are none. This leaves the file position
+ * undefined. */
+static bool readTgdIndex(FILE* f, off_t& indexOffset, std::vector<off_t>& offsets,
+        std::vector<ArrayDescription>& descriptions, std::vector<off_t>& statisticsOffsets)
+{
+    char trailer[sizeof(uint64_t) + sizeof(indexTrailerMagic)];
+    if (fseeko(f, -off_t(sizeof(trailer)), SEEK_END) != 0)
+        return false;
+    off_t trailerOffset = ftello(f);
+    if (trailerOffset < 0
+            || std::fread(trailer, sizeof(trailer), 1, f) != 1
+            || std::memcmp(trailer + sizeof(uint64_t), indexTrailerMagic, sizeof(indexTrailerMagic)) != 0) {
+        return false;
+    }
+    uint64_t v;
+    std::memcpy(&v, trailer, sizeof(uint64_t));
+    if (v + sizeof(indexBlockMagic) + sizeof(uint64_t) > uint64_t(trailerOffset))
+        return false;
+    indexOffset = v;
+    char magic[sizeof(indexBlockMagic)];
+    if (fseeko(f, indexOffset, SEEK_SET) != 0
+            || std::fread(magic, sizeof(magic), 1, f) != 1
+            || std::memcmp(magic, indexBlockMagic, sizeof(indexBlockMagic) - 1) != 0
+            || magic[3] > 1) {
+        return false;
+    }
+    // Version 0 consists of the entries only; version 1 gives their size
+    // since the statistics follow them
+    bool haveStatistics = (magic[3] == 1);
+    size_t blockValues = (trailerOffset - indexOffset - sizeof(indexBlockMagic)) / sizeof(uint64_t);
+    std::vector<uint64_t> entries;
+    if (haveStatistics) {
+        uint64_t header[2];
+        if (blockValues < 2
+                || std::fread(header, sizeof(header), 1, f) != 1
+                || header[1] > blockValues - 2) {
+            return false;
+        }
+        entries.resize(header[1] + 1);
+        entries[0] = header[0];
+        if (entries.size() > 1 && std::fread(entries.data() + 1, (entries.size() - 1) * sizeof(uint64_t), 1, f) != 1)
+            return false;
+    } else {
+        entries.resize(blockValues);
+        if (std::fread(entries.data(), entries.size() * sizeof(uint64_t), 1, f) != 1)
+            return false;
+    }
+    // Validate the entries while parsing them
+    offsets.clear();
+    descriptions.clear();
+    statisticsOffsets.clear();
+    size_t i = 1;
+    for (uint64_t a = 0; a < entries[0]; a++) {
+        if (i + 4 > entries.size())
+            return false;
+        uint64_t offset = entries[i];
+        uint64_t type = entries[i + 1];
+        uint64_t compCount = entries[i + 2];
+        uint64_t dimCount = entries[i + 3];
+        i += 4;
+        if (offset >= uint64_t(indexOffset)
+                || (offsets.size() > 0 && offset <= uint64_t(offsets.back()))
+                || type > bfloat16 || dimCount > entries.size() - i) {
+            return false;
+        }
+        std::vector<size_t> dimensions(entries.begin() + i, entries.begin() + i + dimCount);
+        i += dimCount;
+        uint64_t statisticsOffset = 0;
+        if (haveStatistics) {
+            if (i >= entries.size())
+                return false;
+            statisticsOffset = entries[i++];
+            if (statisticsOffset != 0
+                    && (statisticsOffset <= uint64_t(indexOffset) || statisticsOffset >= uint64_t(trailerOffset)))
+                return false;
+        }
+        offsets.push_back(offset);
+        descriptions.push_back(ArrayDescription(dimensions, compCount, static_cast<Type>(type)));
+        statisticsOffsets.push_back(statisticsOffset);
+    }
+    return (i == entries.size() && offsets.size() <= size_t(std::numeric_limits<int>::max()));
+}
+
+/* Read the statistics of a TGD with the given description from the index block */
+static std::shared_ptr<TGDStatistics> readTgdStatistics(FILE* f, off_t offset, const ArrayDescription& desc)
+{
+    std::vector<uint64_t> cellSize(desc.dimensionCount());
+    if (desc.dimensionCount() == 0
+            || fseeko(f, offset, SEEK_SET) != 0
+            || std::fread(cellSize.data(), cellSize.size() * sizeof(uint64_t), 1, f) != 1) {
+        return nullptr;
+    }
+    for (size_t d = 0; d < desc.dimensionCount(); d++)
+        if (cellSize[d] == 0 || cellSize[d] > desc.dimension(d))
+            return nullptr;
+    std::shared_ptr<TGDStatistics> s = std::make_shared<TGDStatistics>(desc,
+            std::vector<size_t>(cellSize.begin(), cellSize.end()));
+    std::vector<uint64_t> values(8 * s->cells.size());
+    if (values.size() > 0 && std::fread(values.data(), values.size() * sizeof(uint64_t), 1, f) != 1)
+        return nullptr;
+    for (size_t j = 0; j < s->cells.size(); j++)
+        deserializeComponentStatistics(values.data() + 8 * j, s->cells[j]);
+    return s;
+}
+
+/* Find the offsets and descriptions of all TGDs in the file by walking all
+ * headers, starting at the beginning of the file. */
+static bool scanTgd(FILE* f, std::vector<off_t>& offsets, std::vector<ArrayDescription>& descriptions)
+{
+    offsets.clear();
+    descriptions.clear();
+    rewind(f);
+    while (tgdHasMore(f)) {
+        off_t arrayPos = ftello(f);
+        if (arrayPos < 0)
+            return false;
+        ArrayDescription array;
+        TGDChunking chunking;
+        Error e = readTgdHeader(f, array, chunking);
+        if (e != ErrorNone || !skipTgdData(f, array, chunking))
+            return false;
+        offsets.push_back(arrayPos);
+        descriptions.push_back(ArrayDescription(array.dimensions(), array.componentCount(), array.componentType()));
+        if (offsets.size() == size_t(std::numeric_limits<int>::max()) && tgdHasMore(f))
+            return false;
+    }
+    return true;
+}
+
+Error FormatImportExportTGD::openForReading(const std::string& fileName, const TagList& hints)
+{
+    _mmapMode = hints.value("MMAP", -1);
+    _bricked = hints.value("BRICKED", false);
+    if (fileName == "-") {
+        _f = stdin;
+        // Read from pipes in large blocks. The buffer of stdin can only be
+        // changed before the first read.
+        static std::atomic<bool> stdinPrepared(false);
+        if (!stdinPrepared.exchange(true) && preparePipe(fileno(stdin)))
+            setvbuf(stdin, nullptr, _IOFBF, pipeBufferSize);
+    } else {
+        _f = fopen(fileName.c_str(), "rb");
+    }
+    if (!_f)
+        return ErrorSysErrno;
+#ifdef TGD_HAVE_PREAD
+    // Direct I/O bypasses the page cache, and therefore also excludes mapping the file.
+    // If the file system does not support it, the data is read normally.
+    if (_f != stdin && hints.value("DIRECT_IO", false))
+        _directFd = openDirect(fileName);
+#endif
+    if (_f != stdin) {
+        // Use the index block if there is one
+        std::vector<ArrayDescription> descriptions;
+        if (readTgdIndex(_f, _indexOffset, _arrayOffsets, descriptions, _statisticsOffsets)) {
+            _arrayCount = _arrayOffsets.size();
+        } else {
+            _indexOffset = -1;
+            _arrayOffsets.clear();
+            _statisticsOffsets.clear();
+        }
+        rewind(_f);
+    }
+    return ErrorNone;
+}
+
+Error FormatImportExportTGD::openForWriting(const std::string& fileName, bool append, const TagList& hints)
 {
-    return (fseeko(f, array.dataSize(), SEEK_CUR) == 0 ? true : false);
+    _writeIndex = hints.value("INDEX", false);
+    // Statistics are stored in the index block
+    _writeStatistics = hints.value("STATISTICS", false);
+    if (_writeStatistics)
+        _writeIndex = true;
+    _flushEachArray = hints.value("FLUSH", true);
+    // Chunked layout: requested by a compression method or a chunk size
+    std::string compression = hints.value("COMPRESSION", "none");
+    _chunking = std::make_shared<TGDChunking>();
+    if (compression == "deflate") {
+#ifdef TGD_WITH_ZLIB
+        _chunking->codec = 1;
+#else
+        return ErrorFeaturesUnsupported;
+#endif
+    } else if (compression != "none") {
+        return ErrorFeaturesUnsupported;
+    }
+    size_t chunkSize = hints.value("CHUNK_SIZE", size_t(0));
+    bool perDimensionChunkSize = hints.contains("CHUNK_SIZE0");
+    _chunking->chunked = (_chunking->codec != 0 || chunkSize > 0 || perDimensionChunkSize);
+    _chunking->filter = (hints.value("SHUFFLE", true) ? 1 : 0);
+    if (perDimensionChunkSize) {
+        for (size_t d = 0; hints.contains(std::string("CHUNK_SIZE") + std::to_string(d)); d++) {
+            size_t s = hints.value(std::string("CHUNK_SIZE") + std::to_string(d), size_t(0));
+            if (s == 0)
+                return ErrorInvalidData;
+            _chunking->chunkSize.push_back(s);
+        }
+    } else if (chunkSize > 0) {
+        _chunking->chunkSize.push_back(chunkSize);
+    }
+    if (fileName == "-") {
+        _f = stdout;
+        // Write to pipes directly, bypassing the stdio buffer
+        if (preparePipe(fileno(stdout)))
+            _pipeFd = fileno(stdout);
+        return ErrorNone;
+    }
+    if (append) {
+        _f = fopen(fileName.c_str(), "r+b");
+        if (_f) {
+            // Keep an existing index up to date, or create one if requested
+            off_t indexOffset;
+            std::vector<off_t> statisticsOffsets;
+            if (readTgdIndex(_f, indexOffset, _writtenOffsets, _writtenDescriptions, statisticsOffsets)) {
+                _writeIndex = true;
+                // Keep existing statistics, and add statistics for new arrays if there are any
+                _writtenStatistics.resize(_writtenOffsets.size());
+                for (size_t i = 0; i < _writtenOffsets.size(); i++) {
+                    if (statisticsOffsets[i] != 0) {
+                        _writtenStatistics[i] = readTgdStatistics(_f, statisticsOffsets[i], _writtenDescriptions[i]);
+                        if (!_writtenStatistics[i])
+                            return ErrorInvalidData;
+                        _writeStatistics = true;
+                    }
+                }
+                if (!truncateFile(_f, indexOffset))
+                    return ErrorSysErrno;
+            } else if (_writeIndex && !scanTgd(_f, _writtenOffsets, _writtenDescriptions)) {
+                return ErrorInvalidData;
+            }
+            _writtenStatistics.resize(_writtenOffsets.size());
+            if (fseeko(_f, 0, SEEK_END) != 0)
+                return ErrorSysErrno;
+            return ErrorNone;
+        } else if (errno != ENOENT) {
+            return ErrorSysErrno;
+        }
+    }
+    _f = fopen(fileName.c_str(), "wb");
+    return _f ? ErrorNone : ErrorSysErrno;
+}
+
+void FormatImportExportTGD::close()
+{
+    if (_f) {
+        if (_writeIndex && _writtenOffsets.size() > 0) {
+            off_t indexOffset = ftello(_f);
+            if (!writeTgdIndex(_f, _writtenOffsets, _writtenDescriptions, _writtenStatistics) && indexOffset >= 0 && _f != stdout) {
+                // do not leave a broken index block behind
+                truncateFile(_f, indexOffset);
+            }
+        }
+        if (_f != stdin && _f != stdout) {
+            fclose(_f);
+        } else if (_f == stdout) {
+            fflush(_f);
+        }
+        _f = nullptr;
+    }
+    _mapping.reset();
+#ifdef TGD_HAVE_PREAD
+    if (_directFd >= 0)
+        ::close(_directFd);
+#endif
+    _directFd = -1;
+    _indexOffset = -1;
+    _writeIndex = false;
+    _pipeFd = -1;
+    _chunking.reset();
+    _writtenOffsets.clear();
+    _writtenDescriptions.clear();
+    _writeStatistics = false;
+    _writtenStatistics.clear();
+    _statisticsOffsets.clear();
+    _slabChunking.reset();
+    _slabArray = ArrayContainer();
+    _slabStatistics.reset();
+    _slabSlices = 0;
 }
 
 int FormatImportExportTGD::arrayCount()
@@ -222,29 +1107,8 @@ int FormatImportExportTGD::arrayCount()
         _arrayCount = -1;
         return _arrayCount;
     }
-    rewind(_f);
-    while (hasMore()) {
-        off_t arrayPos = ftello(_f);
-        if (arrayPos < 0) {
-            _arrayOffsets.clear();
-            _arrayCount = -1;
-            return -1;
-        }
-        ArrayContainer array;
-        Error e = readTgdHeader(_f, array);
-        if (e != ErrorNone || !skipTgdData(_f, array)) {
-            _arrayOffsets.clear();
-            _arrayCount = -1;
-            return -1;
-        }
-        _arrayOffsets.push_back(arrayPos);
-        if (_arrayOffsets.size() == size_t(std::numeric_limits<int>::max()) && hasMore()) {
-            _arrayOffsets.clear();
-            _arrayCount = -1;
-            return -1;
-        }
-    }
-    if (fseeko(_f, curPos, SEEK_SET) < 0) {
+    std::vector<ArrayDescription> descriptions;
+    if (!scanTgd(_f, _arrayOffsets, descriptions) || fseeko(_f, curPos, SEEK_SET) < 0) {
         _arrayOffsets.clear();
         _arrayCount = -1;
         return -1;
@@ -253,59 +1117,361 @@ int FormatImportExportTGD::arrayCount()
     return _arrayCount;
 }
 
-ArrayContainer FormatImportExportTGD::readArray(Error* error, int arrayIndex)
+Error FormatImportExportTGD::seekArray(int arrayIndex)
 {
-    // Seek if necessary
     if (arrayIndex >= 0) {
-        if (arrayCount() < 0) {
-            *error = ErrorSeekingNotSupported;
-            return ArrayContainer();
-        }
-        if (arrayIndex >= arrayCount()) {
-            *error = ErrorInvalidData;
-            return ArrayContainer();
-        }
-        if (fseeko(_f, _arrayOffsets[arrayIndex], SEEK_SET) < 0) {
-            *error = ErrorSysErrno;
-            return ArrayContainer();
-        }
+        if (arrayCount() < 0)
+            return ErrorSeekingNotSupported;
+        if (arrayIndex >= arrayCount())
+            return ErrorInvalidData;
+        if (fseeko(_f, _arrayOffsets[arrayIndex], SEEK_SET) < 0)
+            return ErrorSysErrno;
     }
+    return ErrorNone;
+}
 
-    // Read the TGD header
+ArrayContainer FormatImportExportTGD::readArray(Error* error, int arrayIndex)
+{
     ArrayContainer array;
-    Error e = readTgdHeader(_f, array);
+    Error e = readArrayHelper(array, arrayIndex, nullptr, nullptr);
     if (e != ErrorNone) {
         *error = e;
         return ArrayContainer();
     }
+    return array;
+}
 
-    // Read the data
-    if (!readTgdData(_f, array)) {
-        e = (std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData);
-    }
+Error FormatImportExportTGD::readArrayInto(ArrayContainer& target, int arrayIndex)
+{
+    return readArrayHelper(target, arrayIndex, nullptr, nullptr);
+}
+
+Error FormatImportExportTGD::readDescription(int arrayIndex, ArrayDescription& desc)
+{
+    Error e = seekArray(arrayIndex);
+    if (e != ErrorNone)
+        return e;
+    TGDChunking chunking;
+    e = readTgdHeader(_f, desc, chunking);
+    if (e == ErrorNone && !skipTgdData(_f, desc, chunking))
+        e = ErrorSysErrno;
+    return e;
+}
+
+ArrayContainer FormatImportExportTGD::readArrayBox(Error* error, int arrayIndex,
+        const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize)
+{
+    ArrayContainer array;
+    Error e = readArrayHelper(array, arrayIndex, &boxIndex, &boxSize);
     if (e != ErrorNone) {
         *error = e;
         return ArrayContainer();
     }
-
-    // Return the array
     return array;
 }
 
-bool FormatImportExportTGD::hasMore()
+Error FormatImportExportTGD::readArrayHelper(ArrayContainer& array, int arrayIndex,
+        const std::vector<size_t>* requestedBoxIndex, const std::vector<size_t>* requestedBoxSize)
 {
-    int c = fgetc(_f);
-    if (c == EOF) {
-        return false;
+    // Seek if necessary
+    Error e = seekArray(arrayIndex);
+    if (e != ErrorNone) {
+        return e;
+    }
+
+    // Read the TGD header
+    ArrayDescription desc;
+    TGDChunking chunking;
+    e = readTgdHeader(_f, desc, chunking);
+    if (e != ErrorNone) {
+        return e;
+    }
+
+    // Determine the box to read
+    std::vector<size_t> boxIndex, boxSize;
+    bool fullArray = true;
+    if (requestedBoxIndex) {
+        if (!clipBox(desc, *requestedBoxIndex, *requestedBoxSize, boxIndex, boxSize)) {
+            return ErrorInvalidData;
+        }
+        fullArray = (boxSize == desc.dimensions());
     } else {
-        ungetc(c, _f);
-        return true;
+        boxIndex = std::vector<size_t>(desc.dimensionCount(), 0);
+        boxSize = desc.dimensions();
+    }
+
+    // Read the data, either by decoding chunks, by mapping it, or with fread()
+    off_t dataOffset = (_f == stdin ? -1 : ftello(_f));
+    bool done = false;
+    if (chunking.chunked) {
+        if (fullArray) {
+            // the chunks become the bricks of the array if requested
+            prepareArray(array, _bricked ? ArrayDescription(desc, chunking.chunkSize) : desc);
+        } else {
+            array = ArrayContainer(boxSize, desc.componentCount(), desc.componentType());
+            copyTagLists(desc, array);
+        }
+        e = readTgdChunks(_f, chunking, desc, boxIndex, boxSize, array);
+        done = true;
+    } else if (_mmapMode != 0 && _directFd < 0 && dataOffset >= 0
+            && (_mmapMode == 1 || desc.dataSize() >= mmapMinimumSize)) {
+        if (readMappedData(array, desc, dataOffset)) {
+            // only the pages of the box will be accessed
+            if (!fullArray)
+                array = ArrayView(array).box(boxIndex, boxSize).materialize();
+            if (!skipTgdData(_f, desc, chunking))
+                e = ErrorSysErrno;
+            done = true;
+        }
+    }
+    if (!done && !fullArray && dataOffset >= 0) {
+        e = readBoxFromFile(_f, dataOffset, desc, boxIndex, boxSize, array);
+        if (e == ErrorNone && fseeko(_f, dataOffset + desc.dataSize(), SEEK_SET) != 0)
+            e = ErrorSysErrno;
+        done = true;
     }
+#ifdef TGD_HAVE_PREAD
+    if (!done && dataOffset >= 0 && (_directFd >= 0 || desc.dataSize() >= mmapMinimumSize)) {
+        // large data is read with concurrent pread() calls
+        prepareArray(array, desc);
+        e = readParallel(_directFd >= 0 ? _directFd : fileno(_f), dataOffset, array.data(), array.dataSize(),
+                _directFd >= 0);
+        if (e == ErrorNone && fseeko(_f, dataOffset + desc.dataSize(), SEEK_SET) != 0)
+            e = ErrorSysErrno;
+        done = true;
+    }
+#endif
+    if (!done) {
+        prepareArray(array, desc);
+        if (!readTgdData(_f, array)) {
+            e = (std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData);
+        } else if (!fullArray) {
+            array = ArrayView(array).box(boxIndex, boxSize).materialize();
+        }
+    }
+    return e;
+}
+
+bool FormatImportExportTGD::readMappedData(ArrayContainer& array, const ArrayDescription& desc, off_t dataOffset)
+{
+#ifdef TGD_HAVE_MMAP
+    // The data must be suitably aligned for its component type
+    if (desc.dataSize() == 0 || dataOffset % desc.componentSize() != 0)
+        return false;
+    size_t dataEnd = dataOffset + desc.dataSize();
+    if (!_mapping || _mapping->size < dataEnd) {
+        // (Re)map the complete file; arrays that reference an older mapping keep it alive
+        std::shared_ptr<FileMapping> mapping = FileMapping::create(_f, dataEnd);
+        if (!mapping)
+            return false;
+        _mapping = mapping;
+    }
+    unsigned char* data = static_cast<unsigned char*>(_mapping->address) + dataOffset;
+    // Advise the kernel on the pages of this array
+    long pageSize = sysconf(_SC_PAGESIZE);
+    size_t adviseOffset = dataOffset / pageSize * pageSize;
+    void* adviseAddress = static_cast<unsigned char*>(_mapping->address) + adviseOffset;
+    madvise(adviseAddress, dataEnd - adviseOffset, MADV_SEQUENTIAL);
+    if (desc.dataSize() <= 64 * mmapMinimumSize)
+        madvise(adviseAddress, dataEnd - adviseOffset, MADV_WILLNEED);
+    std::shared_ptr<FileMapping> mapping = _mapping;
+    array = ArrayContainer(desc, data, [mapping] (unsigned char*) {});
+    return true;
+#else
+    (void)array;
+    (void)desc;
+    (void)dataOffset;
+    return false;
+#endif
+}
+
+bool FormatImportExportTGD::hasMore()
+{
+    return tgdHasMore(_f);
+}
+
+Error FormatImportExportTGD::beginReadSlabs(int arrayIndex, ArrayDescription& desc)
+{
+    _slabArray = ArrayContainer();
+    Error e = seekArray(arrayIndex);
+    if (e != ErrorNone)
+        return e;
+    _slabChunking = std::make_shared<TGDChunking>();
+    e = readTgdHeader(_f, desc, *_slabChunking);
+    if (e != ErrorNone)
+        return e;
+    _slabDescription = desc;
+    _slabOffset = (_f == stdin ? -1 : ftello(_f));
+    if (desc.dimensionCount() == 0 || desc.elementCount() == 0) {
+        // there are no slabs to read
+        if (!skipTgdData(_f, desc, *_slabChunking))
+            return ErrorSysErrno;
+    } else if (_slabChunking->chunked && _slabOffset < 0) {
+        // chunks can only be read individually if the file is seekable
+        _slabArray = ArrayContainer(desc);
+        std::vector<size_t> boxIndex(desc.dimensionCount(), 0);
+        e = readTgdChunks(_f, *_slabChunking, desc, boxIndex, desc.dimensions(), _slabArray);
+    }
+    return e;
+}
+
+ArrayContainer FormatImportExportTGD::readSlab(Error* error, size_t sliceIndex, size_t sliceCount)
+{
+    size_t lastDim = _slabDescription.dimensionCount() - 1;
+    std::vector<size_t> boxIndex(_slabDescription.dimensionCount(), 0);
+    std::vector<size_t> boxSize = _slabDescription.dimensions();
+    boxIndex[lastDim] = sliceIndex;
+    boxSize[lastDim] = sliceCount;
+    if (_slabArray.dimensionCount() > 0) {
+        ArrayContainer slab = ArrayView(_slabArray).box(boxIndex, boxSize).materialize();
+        if (sliceIndex + sliceCount == _slabDescription.dimension(lastDim))
+            _slabArray = ArrayContainer();
+        return slab;
+    }
+    ArrayContainer slab(boxSize, _slabDescription.componentCount(), _slabDescription.componentType());
+    copyTagLists(_slabDescription, slab);
+    Error e = ErrorNone;
+    if (_slabChunking->chunked) {
+        if (fseeko(_f, _slabOffset, SEEK_SET) != 0)
+            e = ErrorSysErrno;
+        else
+            e = readTgdChunks(_f, *_slabChunking, _slabDescription, boxIndex, boxSize, slab);
+    } else if (!readTgdData(_f, slab)) {
+        // slabs are read in order, so the file position is at the start of this one
+        e = (std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData);
+    }
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    return slab;
+}
+
+Error FormatImportExportTGD::readStatistics(int arrayIndex, ArrayDescription& desc,
+        const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize,
+        std::vector<ComponentStatistics>& statistics)
+{
+    // Statistics are only known from the index block
+    if (_statisticsOffsets.empty())
+        return ErrorFeaturesUnsupported;
+    off_t curPos = ftello(_f);
+    if (curPos < 0)
+        return ErrorSysErrno;
+    if (arrayIndex >= int(_arrayOffsets.size()))
+        return ErrorInvalidData;
+    off_t offset = (arrayIndex >= 0 ? _arrayOffsets[arrayIndex] : curPos);
+    auto it = std::lower_bound(_arrayOffsets.begin(), _arrayOffsets.end(), offset);
+    if (it == _arrayOffsets.end() || *it != offset || _statisticsOffsets[it - _arrayOffsets.begin()] == 0)
+        return ErrorFeaturesUnsupported;
+
+    // Read the header and the statistics
+    Error e = ErrorNone;
+    TGDChunking chunking;
+    off_t dataOffset = -1;
+    std::shared_ptr<TGDStatistics> s;
+    if (fseeko(_f, offset, SEEK_SET) != 0 || (e = readTgdHeader(_f, desc, chunking)) != ErrorNone
+            || (dataOffset = ftello(_f)) < 0) {
+        if (e == ErrorNone)
+            e = ErrorSysErrno;
+    } else if (!(s = readTgdStatistics(_f, _statisticsOffsets[it - _arrayOffsets.begin()], desc))) {
+        e = ErrorInvalidData;
+    }
+
+    // Determine the cells of the box; it must not cut through cells
+    std::vector<size_t> cellIndex, cellBoxSize;
+    if (e == ErrorNone) {
+        std::vector<size_t> index(desc.dimensionCount(), 0);
+        std::vector<size_t> size = desc.dimensions();
+        if (!boxIndex.empty() && !clipBox(desc, boxIndex, boxSize, index, size))
+            e = ErrorInvalidData;
+        for (size_t d = 0; e == ErrorNone && d < desc.dimensionCount(); d++) {
+            size_t end = index[d] + size[d];
+            if (index[d] % s->cellSize[d] != 0 || (end % s->cellSize[d] != 0 && end != desc.dimension(d)))
+                e = ErrorFeaturesUnsupported;
+            cellIndex.push_back(index[d] / s->cellSize[d]);
+            cellBoxSize.push_back((end + s->cellSize[d] - 1) / s->cellSize[d] - cellIndex.back());
+        }
+    }
+
+    // Merge the statistics of the cells and skip the data
+    if (e == ErrorNone) {
+        statistics.assign(desc.componentCount(), ComponentStatistics());
+        for (BoxIterator cell(s->grid(desc), cellIndex, cellBoxSize); !cell.atEnd(); cell.next())
+            for (size_t c = 0; c < desc.componentCount(); c++)
+                statistics[c].merge(s->cells[cell.linearIndex() * desc.componentCount() + c]);
+        if (fseeko(_f, dataOffset, SEEK_SET) != 0 || !skipTgdData(_f, desc, chunking))
+            e = ErrorSysErrno;
+    }
+    if (e != ErrorNone)
+        fseeko(_f, curPos, SEEK_SET);
+    return e;
 }
 
 Error FormatImportExportTGD::writeArray(const ArrayContainer& array)
 {
-    return (writeTgd(_f, array) ? ErrorNone : ErrorSysErrno);
+    off_t offset = (_writeIndex ? ftello(_f) : -1);
+    std::shared_ptr<TGDStatistics> statistics;
+    if (!writeTgd(_f, _pipeFd, array, *_chunking, (_writeIndex && _writeStatistics && offset >= 0) ? &statistics : nullptr)
+            || (_flushEachArray && std::fflush(_f) != 0)) {
+        return ErrorSysErrno;
+    }
+    if (_writeIndex) {
+        if (offset < 0) {
+            // cannot know offsets, e.g. when writing to a pipe
+            _writeIndex = false;
+        } else {
+            _writtenOffsets.push_back(offset);
+            _writtenDescriptions.push_back(ArrayDescription(array.dimensions(), array.componentCount(), array.componentType()));
+            _writtenStatistics.push_back(statistics);
+        }
+    }
+    return ErrorNone;
+}
+
+Error FormatImportExportTGD::beginWriteSlabs(const ArrayDescription& desc)
+{
+    // chunks need the complete array, so let the exporter collect the slabs
+    if (_chunking->chunked)
+        return ErrorFeaturesUnsupported;
+    _slabOffset = (_writeIndex ? ftello(_f) : -1);
+    if (!writeTgdHeader(_f, _pipeFd, desc, TGDChunking()))
+        return ErrorSysErrno;
+    _slabDescription = ArrayDescription(desc.dimensions(), desc.componentCount(), desc.componentType());
+    _slabStatistics.reset();
+    _slabSlices = 0;
+    if (_writeIndex && _writeStatistics && _slabOffset >= 0
+            && desc.dimensionCount() > 0 && desc.elementCount() > 0) {
+        _slabStatistics = std::make_shared<TGDStatistics>(desc, slabCellSize(desc));
+    }
+    return ErrorNone;
+}
+
+Error FormatImportExportTGD::writeSlab(const ArrayContainer& slab)
+{
+    if (_slabStatistics) {
+        addSlabStatistics(*_slabStatistics, _slabSlices, slab);
+        _slabSlices += slab.dimension(slab.dimensionCount() - 1);
+    }
+    if (!writeTgdBlocks(_f, _pipeFd, { { slab.data(), slab.dataSize() } }))
+        return ErrorSysErrno;
+    return ErrorNone;
+}
+
+Error FormatImportExportTGD::endWriteSlabs()
+{
+    if (_flushEachArray && std::fflush(_f) != 0)
+        return ErrorSysErrno;
+    if (_writeIndex) {
+        if (_slabOffset < 0) {
+            _writeIndex = false;
+        } else {
+            _writtenOffsets.push_back(_slabOffset);
+            _writtenDescriptions.push_back(_slabDescription);
+            _writtenStatistics.push_back(_slabStatistics);
+        }
+    }
+    _slabStatistics.reset();
+    return ErrorNone;
 }
 
 }
@@ -41,7 +41,8 @@
  * - 1 byte: format version, must be 0
  * - 1 byte: component type:
  *   `int8` = 0, `uint8` = 1, `int16` = 2, `uint16` = 3, `int32` = 4, `uint32` =
- *   5, `int64` = 6, `uint64` = 7, `float32` = 8, `float64` = 9
+ *   5, `int64` = 6, `uint64` = 7, `float32` = 8, `float64` = 9, `float16` = 10,
+ *   `bfloat16` = 11
  * - 1 uint64: number of components (C)
  * - 1 uint64: number of dimensions (D)
  * - D uint64: size in each dimension
@@ -49,19 +50,96 @@
  * - C component tag lists
  * - D dimension tag lists
  * - the data, packed (no fill bytes)
+ *
+ * Format version 1 stores the data in independently compressed chunks. The
+ * dimension tag lists are then followed by:
+ * - 1 uint64: compression method: none = 0, deflate = 1
+ * - 1 uint64: filter: none = 0, byte shuffle = 1
+ * - D uint64: chunk size in each dimension
+ * - K+1 uint64: offset of each of the K chunks relative to the start of the
+ *   chunk data, followed by the total size of the chunk data
+ * - the chunk data
+ * Chunks are ordered like array elements. Each chunk contains the elements
+ * of its box, clipped to the array, packed like an array of its own. A chunk
+ * whose stored size equals its raw size is stored without compression and
+ * filtering. Byte shuffling stores the first bytes of all components of a
+ * chunk, then the second bytes, and so on.
+ *
+ * A file can contain several TGDs one after another. Optionally, the last TGD
+ * is followed by an index block that allows random access without scanning
+ * the file:
+ * - 4 bytes: 'I', 'D', 'X', 0 (73, 68, 88, 0)
+ * - 1 uint64: number of TGDs in the file (N)
+ * - N entries, one per TGD:
+ *   - 1 uint64: offset of the TGD within the file
+ *   - 1 uint64: component type
+ *   - 1 uint64: number of components (C)
+ *   - 1 uint64: number of dimensions (D)
+ *   - D uint64: size in each dimension
+ * - 1 uint64: offset of the index block within the file
+ * - 8 bytes: 'T', 'G', 'D', 'I', 'N', 'D', 'E', 'X'
+ * Readers that do not know about the index block must stop reading at
+ * its first byte.
+ *
+ * Version 1 of the index block additionally stores statistics of each TGD,
+ * per chunk or, for packed data, per slab of consecutive slices:
+ * - 4 bytes: 'I', 'D', 'X', 1 (73, 68, 88, 1)
+ * - 1 uint64: number of TGDs in the file (N)
+ * - 1 uint64: number of uint64 values in the following N entries
+ * - N entries as in version 0, each followed by:
+ *   - 1 uint64: offset of the statistics of the TGD within the file, or 0
+ * - the statistics records, each consisting of:
+ *   - D uint64: cell size in each dimension
+ *   - for each cell in the order of array elements, and for each of its C
+ *     components: 3 uint64 (number of elements, finite values, NaN values)
+ *     and 5 float64 (minimum, maximum, sum, mean, sum of squared deviations
+ *     from the mean)
+ * - 1 uint64: offset of the index block within the file
+ * - 8 bytes: 'T', 'G', 'D', 'I', 'N', 'D', 'E', 'X'
  */
 
 #include <cstdio>
+#include <memory>
 
 #include "io.hpp"
 
 namespace TGD {
 
+class FileMapping;
+class TGDChunking;
+class TGDStatistics;
+
 class FormatImportExportTGD : public FormatImportExport {
 private:
     FILE* _f;
     int _arrayCount;
     std::vector<off_t> _arrayOffsets;
+    int _mmapMode; // 0 = never, 1 = always if possible, -1 = automatic
+    int _directFd; // file descriptor for direct I/O, or -1
+    bool _bricked; // read chunked arrays in the bricked layout
+    std::shared_ptr<FileMapping> _mapping;
+    off_t _indexOffset; // offset of the index block when reading, or -1
+    bool _writeIndex;
+    bool _flushEachArray;
+    int _pipeFd; // file descriptor of stdout if it is a pipe, or -1
+    std::shared_ptr<TGDChunking> _chunking;
+    std::vector<off_t> _writtenOffsets;
+    std::vector<ArrayDescription> _writtenDescriptions;
+    bool _writeStatistics;
+    std::vector<std::shared_ptr<TGDStatistics>> _writtenStatistics;
+    std::vector<off_t> _statisticsOffsets; // offsets of the statistics when reading, 0 if there are none
+    // state for reading and writing in slabs:
+    ArrayDescription _slabDescription;
+    std::shared_ptr<TGDChunking> _slabChunking;
+    off_t _slabOffset; // offset of the data when reading, of the array when writing
+    ArrayContainer _slabArray; // complete array if chunks cannot be read individually
+    std::shared_ptr<TGDStatistics> _slabStatistics;
+    size_t _slabSlices; // number of slices written
+
+    Error seekArray(int arrayIndex);
+    bool readMappedData(ArrayContainer& array, const ArrayDescription& desc, off_t dataOffset);
+    Error readArrayHelper(ArrayContainer& array, int arrayIndex,
+            const std::vector<size_t>* boxIndex, const std::vector<size_t>* boxSize);
 
 public:
     FormatImportExportTGD();
@@ -74,10 +152,25 @@ public:
     // for reading:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual Error readArrayInto(ArrayContainer& target, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual Error readDescription(int arrayIndex, ArrayDescription& desc) override;
+    virtual ArrayContainer readArrayBox(Error* error, int arrayIndex,
+            const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize) override;
+    virtual Error beginReadSlabs(int arrayIndex, ArrayDescription& desc) override;
+    virtual ArrayContainer readSlab(Error* error, size_t sliceIndex, size_t sliceCount) override;
+    virtual Error readStatistics(int arrayIndex, ArrayDescription& desc,
+            const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize,
+            std::vector<ComponentStatistics>& statistics) override;
+
+    virtual bool isReentrant() const override { return true; }
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
+    virtual bool writesBrickedArrays() const override { return true; }
+    virtual Error beginWriteSlabs(const ArrayDescription& desc) override;
+    virtual Error writeSlab(const ArrayContainer& slab) override;
+    virtual Error endWriteSlabs() override;
 };
 
 }
@@ -24,9 +24,12 @@
 
 #include <cstdio>
 #include <cstring>
+#include <atomic>
+#include <algorithm>
 
 #include "io-tiff.hpp"
 #include "io-utils.hpp"
+#include "parallel.hpp"
 
 #include <tiffio.h>
 
@@ -34,7 +37,9 @@
 namespace TGD {
 
 FormatImportExportTIFF::FormatImportExportTIFF() :
-    _tiff(nullptr), _dirCount(-1), _readCount(0)
+    _tiff(nullptr), _dirCount(-1), _readCount(0),
+    _compression(COMPRESSION_NONE), _predictor(PREDICTOR_NONE), _autoPredictor(false),
+    _compressionLevel(-1), _tileSize(0)
 {
     TIFFSetErrorHandler(0);
     TIFFSetWarningHandler(0);
@@ -45,8 +50,9 @@ FormatImportExportTIFF::~FormatImportExportTIFF()
     close();
 }
 
-Error FormatImportExportTIFF::openForReading(const std::string& fileName, const TagList&)
+Error FormatImportExportTIFF::openForReading(const std::string& fileName, const TagList& hints)
 {
+    _hints = hints;
     if (fileName == "-")
         return ErrorInvalidData;
     FILE* f = fopen(fileName.c_str(), "rb");
@@ -56,15 +62,68 @@ Error FormatImportExportTIFF::openForReading(const std::string& fileName, const
     _tiff = TIFFOpen(fileName.c_str(), "r");
     if (!_tiff)
         return ErrorInvalidData;
+    _fileName = fileName;
     return ErrorNone;
 }
 
-Error FormatImportExportTIFF::openForWriting(const std::string& fileName, bool append, const TagList&)
+Error FormatImportExportTIFF::openForWriting(const std::string& fileName, bool append, const TagList& hints)
 {
     if (append)
         return ErrorFeaturesUnsupported;
     if (fileName == "-")
         return ErrorInvalidData;
+
+    std::string compression = hints.value("COMPRESSION", "none");
+    std::string predictor = hints.value("PREDICTOR", "none");
+    _compressionLevel = -1;
+    if (compression == "fast") {
+        _compression = COMPRESSION_ADOBE_DEFLATE;
+        _compressionLevel = 1;
+    } else if (compression == "small") {
+        _compression = COMPRESSION_ADOBE_DEFLATE;
+        _compressionLevel = 9;
+        if (!hints.contains("PREDICTOR"))
+            predictor = "auto";
+    } else if (compression == "none" || compression == "default")
+        _compression = COMPRESSION_NONE;
+    else if (compression == "deflate")
+        _compression = COMPRESSION_ADOBE_DEFLATE;
+    else if (compression == "lzw")
+        _compression = COMPRESSION_LZW;
+    else if (compression == "packbits")
+        _compression = COMPRESSION_PACKBITS;
+#ifdef COMPRESSION_ZSTD
+    else if (compression == "zstd")
+        _compression = COMPRESSION_ZSTD;
+#endif
+    else
+        return ErrorFeaturesUnsupported;
+    if (!TIFFIsCODECConfigured(_compression))
+        return ErrorFeaturesUnsupported;
+    if (_compression == COMPRESSION_ADOBE_DEFLATE) {
+        Error e = compressionLevel(hints, 1, 9, _compressionLevel);
+        if (e != ErrorNone)
+            return e;
+#ifdef COMPRESSION_ZSTD
+    } else if (_compression == COMPRESSION_ZSTD) {
+        Error e = compressionLevel(hints, 1, 22, _compressionLevel);
+        if (e != ErrorNone)
+            return e;
+#endif
+    }
+    _autoPredictor = false;
+    if (predictor == "none")
+        _predictor = PREDICTOR_NONE;
+    else if (predictor == "auto")
+        _autoPredictor = true;
+    else if (predictor == "horizontal")
+        _predictor = PREDICTOR_HORIZONTAL;
+    else if (predictor == "float")
+        _predictor = PREDICTOR_FLOATINGPOINT;
+    else
+        return ErrorFeaturesUnsupported;
+    // tile sizes must be multiples of 16
+    _tileSize = (hints.value("TILE_SIZE", uint32_t(0)) + 15) / 16 * 16;
     FILE* f = fopen(fileName.c_str(), "wb");
     if (!f)
         return ErrorSysErrno;
@@ -97,7 +156,65 @@ int FormatImportExportTIFF::arrayCount()
     return _dirCount;
 }
 
+/* Find the smallest reduced resolution version of the image in the given directory
+ * that is at least of the given size. Candidates are the SubIFDs of the directory and
+ * the directories following it that are marked as reduced resolution images, as in
+ * pyramid TIFFs. The chosen image becomes the current one; its directory is returned
+ * in reducedDirectory and its SubIFD offset, if any, in subIFDOffset. */
+bool FormatImportExportTIFF::setReducedImage(int directory, size_t minWidth, size_t minHeight,
+        int* reducedDirectory, uint64_t* subIFDOffset)
+{
+    uint32_t bestWidth = 0, bestHeight = 0;
+    TIFFGetField(_tiff, TIFFTAG_IMAGEWIDTH, &bestWidth);
+    TIFFGetField(_tiff, TIFFTAG_IMAGELENGTH, &bestHeight);
+    *reducedDirectory = directory;
+    *subIFDOffset = 0;
+    auto consider = [&] (int dir, uint64_t offset) {
+        uint32_t w = 0, h = 0;
+        TIFFGetField(_tiff, TIFFTAG_IMAGEWIDTH, &w);
+        TIFFGetField(_tiff, TIFFTAG_IMAGELENGTH, &h);
+        if (w >= minWidth && h >= minHeight && uint64_t(w) * h < uint64_t(bestWidth) * bestHeight) {
+            bestWidth = w;
+            bestHeight = h;
+            *reducedDirectory = dir;
+            *subIFDOffset = offset;
+        }
+    };
+    uint16_t subIFDCount = 0;
+    toff_t* subIFDs = nullptr;
+    std::vector<uint64_t> subIFDOffsets;
+    if (TIFFGetField(_tiff, TIFFTAG_SUBIFD, &subIFDCount, &subIFDs) && subIFDs)
+        subIFDOffsets.assign(subIFDs, subIFDs + subIFDCount);
+    for (size_t i = 0; i < subIFDOffsets.size(); i++) {
+        if (TIFFSetSubDirectory(_tiff, subIFDOffsets[i]))
+            consider(directory, subIFDOffsets[i]);
+    }
+    for (int dir = directory + 1; dir < arrayCount(); dir++) {
+        uint32_t subFileType = 0;
+        if (!TIFFSetDirectory(_tiff, dir)
+                || !TIFFGetField(_tiff, TIFFTAG_SUBFILETYPE, &subFileType)
+                || !(subFileType & FILETYPE_REDUCEDIMAGE))
+            break;
+        consider(dir, 0);
+    }
+    return (TIFFSetDirectory(_tiff, *reducedDirectory)
+            && (*subIFDOffset == 0 || TIFFSetSubDirectory(_tiff, *subIFDOffset)));
+}
+
 ArrayContainer FormatImportExportTIFF::readArray(Error* error, int arrayIndex)
+{
+    return readHelper(error, arrayIndex, nullptr);
+}
+
+Error FormatImportExportTIFF::readDescription(int arrayIndex, ArrayDescription& desc)
+{
+    Error e = ErrorNone;
+    readHelper(&e, arrayIndex, &desc);
+    return e;
+}
+
+/* If description is given, it is set and nothing is decoded. */
+ArrayContainer FormatImportExportTIFF::readHelper(Error* error, int arrayIndex, ArrayDescription* description)
 {
     if (arrayIndex >= arrayCount()) {
         *error = ErrorInvalidData;
@@ -124,6 +241,27 @@ ArrayContainer FormatImportExportTIFF::readArray(Error* error, int arrayIndex)
         return ArrayContainer();
     }
 
+    // Reduced resolution: read the best matching reduced resolution image if there
+    // is one, and reduce the rest of the way afterwards
+    int directory = TIFFCurrentDirectory(_tiff);
+    uint64_t subIFDOffset = 0;
+    unsigned int level;
+    Error e = reducedImageLevel(_hints, width, height, level);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    size_t reducedWidth = reducedImageSize(width, level);
+    size_t reducedHeight = reducedImageSize(height, level);
+    if (level > 0) {
+        if (!setReducedImage(directory, reducedWidth, reducedHeight, &directory, &subIFDOffset)) {
+            *error = ErrorLibrary;
+            return ArrayContainer();
+        }
+        TIFFGetField(_tiff, TIFFTAG_IMAGEWIDTH, &width);
+        TIFFGetField(_tiff, TIFFTAG_IMAGELENGTH, &height);
+    }
+
     uint32_t tileWidth = 0, tileHeight = 0;
     TIFFGetField(_tiff, TIFFTAG_TILEWIDTH, &tileWidth);
     TIFFGetField(_tiff, TIFFTAG_TILELENGTH, &tileHeight);
@@ -203,8 +341,7 @@ ArrayContainer FormatImportExportTIFF::readArray(Error* error, int arrayIndex)
         } else if (sampleFormat == SAMPLEFORMAT_INT) {
             type = int16;
         } else {
-            *error = ErrorFeaturesUnsupported;
-            return ArrayContainer();
+            type = float16;
         }
     } else if (bps == 32) {
         if (sampleFormat == SAMPLEFORMAT_UINT) {
@@ -224,95 +361,167 @@ ArrayContainer FormatImportExportTIFF::readArray(Error* error, int arrayIndex)
         }
     }
 
-    ArrayContainer r({ width, height }, nSamples, type);
-    if (r.dimension(0) * r.elementSize() != size_t(TIFFScanlineSize(_tiff))) {
-        *error = ErrorLibrary;
-        return ArrayContainer();
-    }
-
+    ArrayDescription d({ width, height }, nSamples, type);
     if (havePhot && phot == PHOTOMETRIC_LOGLUV && (comp == COMPRESSION_SGILOG || comp == COMPRESSION_SGILOG24)) {
-        if (r.componentCount() == 3 || r.componentCount() == 4) {
-            r.componentTagList(0).set("INTERPRETATION", "XYZ/X");
-            r.componentTagList(1).set("INTERPRETATION", "XYZ/Y");
-            r.componentTagList(2).set("INTERPRETATION", "XYZ/Z");
-            if (r.componentCount() == 4)
-                r.componentTagList(3).set("INTERPRETATION", "ALPHA");
+        if (d.componentCount() == 3 || d.componentCount() == 4) {
+            d.componentTagList(0).set("INTERPRETATION", "XYZ/X");
+            d.componentTagList(1).set("INTERPRETATION", "XYZ/Y");
+            d.componentTagList(2).set("INTERPRETATION", "XYZ/Z");
+            if (d.componentCount() == 4)
+                d.componentTagList(3).set("INTERPRETATION", "ALPHA");
         }
     } else if (havePhot && phot == PHOTOMETRIC_RGB) {
-        if (r.componentCount() == 3 || r.componentCount() == 4) {
+        if (d.componentCount() == 3 || d.componentCount() == 4) {
             if (type == uint8) {
-                r.componentTagList(0).set("INTERPRETATION", "SRGB/R");
-                r.componentTagList(1).set("INTERPRETATION", "SRGB/G");
-                r.componentTagList(2).set("INTERPRETATION", "SRGB/B");
+                d.componentTagList(0).set("INTERPRETATION", "SRGB/R");
+                d.componentTagList(1).set("INTERPRETATION", "SRGB/G");
+                d.componentTagList(2).set("INTERPRETATION", "SRGB/B");
             } else {
-                r.componentTagList(0).set("INTERPRETATION", "RED");
-                r.componentTagList(1).set("INTERPRETATION", "GREEN");
-                r.componentTagList(2).set("INTERPRETATION", "BLUE");
+                d.componentTagList(0).set("INTERPRETATION", "RED");
+                d.componentTagList(1).set("INTERPRETATION", "GREEN");
+                d.componentTagList(2).set("INTERPRETATION", "BLUE");
             }
-            if (r.componentCount() == 4)
-                r.componentTagList(3).set("INTERPRETATION", "ALPHA");
+            if (d.componentCount() == 4)
+                d.componentTagList(3).set("INTERPRETATION", "ALPHA");
         }
     } else if (havePhot && phot == PHOTOMETRIC_MINISBLACK) {
-        if (r.componentCount() == 1 || r.componentCount() == 2) {
+        if (d.componentCount() == 1 || d.componentCount() == 2) {
             if (type == uint8)
-                r.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
+                d.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
             else
-                r.componentTagList(0).set("INTERPRETATION", "GRAY");
-            if (r.componentCount() == 2)
-                r.componentTagList(1).set("INTERPRETATION", "ALPHA");
+                d.componentTagList(0).set("INTERPRETATION", "GRAY");
+            if (d.componentCount() == 2)
+                d.componentTagList(1).set("INTERPRETATION", "ALPHA");
         }
     }
 
-    if (tileWidth == 0 && tileHeight == 0) {
-        if (config == PLANARCONFIG_CONTIG) {
-            for (uint32_t row = 0; row < height; row++) {
-                if (!TIFFReadScanline(_tiff, r.get({ 0, row }), row)) {
-                    *error = ErrorLibrary;
-                    return ArrayContainer();
+    if (description) {
+        // the directory suffices
+        *description = ArrayDescription({ reducedWidth, reducedHeight }, nSamples, type);
+        copyTagLists(d, *description);
+        _readCount++;
+        return ArrayContainer();
+    }
+
+    ArrayContainer r(d);
+    bool separate = (config == PLANARCONFIG_SEPARATE);
+    size_t pixelSize = (separate ? r.componentSize() : r.elementSize()); // within a strip or tile
+    if (r.dimension(0) * pixelSize != size_t(TIFFScanlineSize(_tiff))) {
+        *error = ErrorLibrary;
+        return ArrayContainer();
+    }
+
+    /* Determine the layout of the strips or tiles. Strips are handled as tiles that
+     * span the whole width of the image. */
+    bool tiled = TIFFIsTiled(_tiff);
+    size_t unitWidth, unitHeight;
+    if (tiled) {
+        if (tileWidth == 0 || tileHeight == 0) {
+            *error = ErrorInvalidData;
+            return ArrayContainer();
+        }
+        unitWidth = tileWidth;
+        unitHeight = tileHeight;
+    } else {
+        uint32_t rowsPerStrip = 0;
+        TIFFGetFieldDefaulted(_tiff, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip);
+        unitWidth = width;
+        unitHeight = std::min(std::max(rowsPerStrip, uint32_t(1)), height);
+    }
+    size_t unitsAcross = (width + unitWidth - 1) / unitWidth;
+    size_t unitsPerPlane = unitsAcross * ((height + unitHeight - 1) / unitHeight);
+    size_t units = unitsPerPlane * (separate ? nSamples : 1);
+    size_t unitSize = (tiled ? TIFFTileSize(_tiff) : TIFFStripSize(_tiff));
+    if (units != size_t(tiled ? TIFFNumberOfTiles(_tiff) : TIFFNumberOfStrips(_tiff))
+            || unitSize < unitWidth * unitHeight * pixelSize) {
+        *error = ErrorInvalidData;
+        return ArrayContainer();
+    }
+
+    /* Decode the strips or tiles in the given range with the given TIFF handle.
+     * Each row is stored directly in its final row of the array, so the orientation
+     * costs no extra pass. */
+    ImageOriginLocation originLocation = static_cast<ImageOriginLocation>(orientation);
+    auto decodeUnits = [&] (struct tiff* tiff, size_t begin, size_t end) -> bool {
+        std::vector<unsigned char> unitData;
+        size_t rLineSize = r.dimension(0) * r.elementSize();
+        for (size_t u = begin; u < end; u++) {
+            size_t plane = u / unitsPerPlane;
+            size_t x0 = (u % unitsPerPlane) % unitsAcross * unitWidth;
+            size_t y0 = (u % unitsPerPlane) / unitsAcross * unitHeight;
+            size_t w = std::min(unitWidth, width - x0);
+            size_t h = std::min(unitHeight, height - y0);
+            if (!tiled && !separate) {
+                // the layout of the strip matches the array, except that the rows
+                // of the strip may need to be reversed
+                size_t firstRow = std::min(originDestinationRow(originLocation, height, y0),
+                        originDestinationRow(originLocation, height, y0 + h - 1));
+                unsigned char* rdata = static_cast<unsigned char*>(r.get({ 0, firstRow }));
+                if (TIFFReadEncodedStrip(tiff, u, rdata, h * rLineSize) < 0)
+                    return false;
+                if (originDestinationRow(originLocation, height, y0) != y0) {
+                    for (size_t y = 0; y < h / 2; y++)
+                        std::swap_ranges(rdata + y * rLineSize, rdata + (y + 1) * rLineSize,
+                                rdata + (h - 1 - y) * rLineSize);
                 }
+                continue;
             }
-        } else {
-            for (uint16_t s = 0; s < nSamples; s++) {
-                for (uint32_t row = 0; row < height; row++) {
-                    if (!TIFFReadScanline(_tiff, r.get({ 0, row }), row, s)) {
-                        *error = ErrorLibrary;
-                        return ArrayContainer();
+            unitData.resize(unitSize);
+            if ((tiled ? TIFFReadEncodedTile(tiff, u, unitData.data(), unitSize)
+                        : TIFFReadEncodedStrip(tiff, u, unitData.data(), unitSize)) < 0)
+                return false;
+            size_t unitLineSize = unitWidth * pixelSize;
+            for (size_t y = 0; y < h; y++) {
+                size_t ry = originDestinationRow(originLocation, height, y0 + y);
+                unsigned char* dst = static_cast<unsigned char*>(r.get({ x0, ry }));
+                const unsigned char* src = unitData.data() + y * unitLineSize;
+                if (!separate) {
+                    std::memcpy(dst, src, w * r.elementSize());
+                } else {
+                    for (size_t x = 0; x < w; x++) {
+                        std::memcpy(dst + x * r.elementSize() + plane * r.componentSize(),
+                                src + x * r.componentSize(), r.componentSize());
                     }
                 }
             }
         }
+        return true;
+    };
+
+    /* Decode. Large images are decoded in parallel. TIFF handles are not thread safe,
+     * so the threads that do not get the first range open their own handle. */
+    bool ok;
+    bool sgiLogFloat = (havePhot && phot == PHOTOMETRIC_LOGLUV
+            && (comp == COMPRESSION_SGILOG || comp == COMPRESSION_SGILOG24));
+    if (defaultExecutionPolicy() == Sequential || units < 2 || r.dataSize() < (size_t(1) << 22)) {
+        ok = decodeUnits(_tiff, 0, units);
     } else {
-        std::vector<unsigned char> tileData(TIFFTileSize(_tiff));
-        size_t tileLineSize = tileWidth * r.elementSize();
-        for (uint32_t y = 0; y < height; y += tileHeight) {
-            for (uint32_t x = 0; x < width; x+= tileWidth) {
-                for (uint16_t s = 0; s < nSamples; s++) {
-                    TIFFReadTile(_tiff, tileData.data(), x, y, 0, s);
-                    uint32_t remainingTileHeight = tileHeight;
-                    if (y + remainingTileHeight > r.dimension(1))
-                        remainingTileHeight = r.dimension(1) - y;
-                    uint32_t remainingTileWidth = tileWidth;
-                    if (x + remainingTileWidth > r.dimension(0))
-                        remainingTileWidth = r.dimension(0) - x;
-                    for (uint32_t ty = 0; ty < remainingTileHeight; ty++) {
-                        uint32_t ry = y + ty;
-                        unsigned char* rdata = static_cast<unsigned char*>(r.get({ x, ry }));
-                        const unsigned char* tdata = tileData.data() + ty * tileLineSize;
-                        for (uint32_t tx = 0; tx < remainingTileWidth; tx++) {
-                            std::memcpy(
-                                    rdata + tx * r.elementSize() + s * r.componentSize(),
-                                    tdata + tx * r.componentSize(),
-                                    r.componentSize());
-                        }
-                    }
+        std::atomic<bool> allOk(true);
+        ThreadPool::instance().parallelFor(units, 1, [&] (size_t begin, size_t end) {
+            struct tiff* tiff = _tiff;
+            if (begin > 0) {
+                tiff = TIFFOpen(_fileName.c_str(), "r");
+                if (tiff && (!TIFFSetDirectory(tiff, directory)
+                            || (subIFDOffset != 0 && !TIFFSetSubDirectory(tiff, subIFDOffset)))) {
+                    TIFFClose(tiff);
+                    tiff = nullptr;
                 }
+                if (tiff && sgiLogFloat)
+                    TIFFSetField(tiff, TIFFTAG_SGILOGDATAFMT, SGILOGDATAFMT_FLOAT);
             }
-        }
+            if (!tiff || !decodeUnits(tiff, begin, end))
+                allOk = false;
+            if (tiff && tiff != _tiff)
+                TIFFClose(tiff);
+        });
+        ok = allOk;
     }
-
-    if (orientation >= 1 && orientation <= 8) {
-        fixImageOrientation(r, static_cast<ImageOriginLocation>(orientation));
+    if (!ok) {
+        *error = ErrorLibrary;
+        return ArrayContainer();
     }
+    if (r.dimension(0) != reducedWidth || r.dimension(1) != reducedHeight)
+        r = reduceImage(r, reducedWidth, reducedHeight);
 
     _readCount++;
     return r;
@@ -380,11 +589,31 @@ Error FormatImportExportTIFF::writeArray(const ArrayContainer& array)
         sampleFormat = SAMPLEFORMAT_IEEEFP;
         bps = 64;
         break;
+    case float16:
+        sampleFormat = SAMPLEFORMAT_IEEEFP;
+        bps = 16;
+        break;
+    case bfloat16:
+        return ErrorFeaturesUnsupported;
     }
     TIFFSetField(_tiff, TIFFTAG_SAMPLEFORMAT, sampleFormat);
     TIFFSetField(_tiff, TIFFTAG_BITSPERSAMPLE, bps);
 
-    TIFFSetField(_tiff, TIFFTAG_COMPRESSION, uint16_t(COMPRESSION_NONE));
+    if (_autoPredictor)
+        _predictor = (sampleFormat == SAMPLEFORMAT_IEEEFP ? PREDICTOR_FLOATINGPOINT : PREDICTOR_HORIZONTAL);
+    if ((_predictor == PREDICTOR_HORIZONTAL && sampleFormat == SAMPLEFORMAT_IEEEFP)
+            || (_predictor == PREDICTOR_FLOATINGPOINT && sampleFormat != SAMPLEFORMAT_IEEEFP)) {
+        return ErrorFeaturesUnsupported;
+    }
+    TIFFSetField(_tiff, TIFFTAG_COMPRESSION, _compression);
+    if (_compression != COMPRESSION_NONE && _predictor != PREDICTOR_NONE)
+        TIFFSetField(_tiff, TIFFTAG_PREDICTOR, _predictor);
+    if (_compression == COMPRESSION_ADOBE_DEFLATE && _compressionLevel > 0)
+        TIFFSetField(_tiff, TIFFTAG_ZIPQUALITY, _compressionLevel);
+#ifdef COMPRESSION_ZSTD
+    if (_compression == COMPRESSION_ZSTD && _compressionLevel > 0)
+        TIFFSetField(_tiff, TIFFTAG_ZSTD_LEVEL, _compressionLevel);
+#endif
     TIFFSetField(_tiff, TIFFTAG_PLANARCONFIG, uint16_t(PLANARCONFIG_CONTIG));
     TIFFSetField(_tiff, TIFFTAG_ORIENTATION, uint16_t(ORIENTATION_TOPLEFT));
 
@@ -406,8 +635,37 @@ Error FormatImportExportTIFF::writeArray(const ArrayContainer& array)
         TIFFSetField(_tiff, TIFFTAG_PHOTOMETRIC, uint16_t(PHOTOMETRIC_MINISBLACK));
     }
 
-    for (size_t y = 0; y < array.dimension(1); y++) {
-        TIFFWriteScanline(_tiff, const_cast<void*>(array.get({ 0, array.dimension(1) - 1 - y })), y);
+    if (_tileSize > 0) {
+        TIFFSetField(_tiff, TIFFTAG_TILEWIDTH, _tileSize);
+        TIFFSetField(_tiff, TIFFTAG_TILELENGTH, _tileSize);
+        std::vector<unsigned char> tileData(TIFFTileSize(_tiff));
+        size_t tileLineSize = _tileSize * array.elementSize();
+        if (tileData.size() != _tileSize * tileLineSize)
+            return ErrorLibrary;
+        for (size_t y0 = 0; y0 < array.dimension(1); y0 += _tileSize) {
+            for (size_t x0 = 0; x0 < array.dimension(0); x0 += _tileSize) {
+                size_t w = std::min(size_t(_tileSize), array.dimension(0) - x0);
+                size_t h = std::min(size_t(_tileSize), array.dimension(1) - y0);
+                // tiles at the right or bottom border are padded with zeros
+                if (w < _tileSize || h < _tileSize)
+                    std::memset(tileData.data(), 0, tileData.size());
+                for (size_t ty = 0; ty < h; ty++) {
+                    std::memcpy(tileData.data() + ty * tileLineSize,
+                            array.get({ x0, array.dimension(1) - 1 - (y0 + ty) }),
+                            w * array.elementSize());
+                }
+                if (TIFFWriteEncodedTile(_tiff, TIFFComputeTile(_tiff, x0, y0, 0, 0),
+                            tileData.data(), tileData.size()) < 0) {
+                    return ErrorLibrary;
+                }
+            }
+        }
+    } else {
+        TIFFSetField(_tiff, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(_tiff, 0));
+        for (size_t y = 0; y < array.dimension(1); y++) {
+            if (TIFFWriteScanline(_tiff, const_cast<void*>(array.get({ 0, array.dimension(1) - 1 - y })), y) < 0)
+                return ErrorLibrary;
+        }
     }
     return (TIFFFlush(_tiff) ? ErrorNone : ErrorLibrary);
 }
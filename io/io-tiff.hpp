@@ -34,8 +34,20 @@ namespace TGD {
 class FormatImportExportTIFF : public FormatImportExport {
 private:
     struct tiff* _tiff;
+    std::string _fileName;
+    TagList _hints;
     int _dirCount;
     int _readCount;
+    // for writing:
+    uint16_t _compression;
+    uint16_t _predictor;
+    bool _autoPredictor;
+    int _compressionLevel;
+    uint32_t _tileSize;
+
+    bool setReducedImage(int directory, size_t minWidth, size_t minHeight,
+            int* reducedDirectory, uint64_t* subIFDOffset);
+    ArrayContainer readHelper(Error* error, int arrayIndex, ArrayDescription* description);
 
 public:
     FormatImportExportTIFF();
@@ -49,6 +61,9 @@ public:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual Error readDescription(int arrayIndex, ArrayDescription& desc) override;
+
+    virtual bool isReentrant() const override { return true; }
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
@@ -30,12 +30,14 @@
 
 #define TINYEXR_USE_MINIZ (0)
 #define TINYEXR_USE_STB_ZLIB (1)
+#define TINYEXR_USE_THREAD (1)
 #define TINYEXR_IMPLEMENTATION
 #include "../ext/tinyexr.h"
 
 namespace TGD {
 
-FormatImportExportTinyEXR::FormatImportExportTinyEXR() : _arrayWasReadOrWritten(false)
+FormatImportExportTinyEXR::FormatImportExportTinyEXR() :
+    _arrayWasReadOrWritten(false), _compression(TINYEXR_COMPRESSIONTYPE_ZIP)
 {
 }
 
@@ -59,10 +61,38 @@ Error FormatImportExportTinyEXR::openForReading(const std::string& fileName, con
     }
 }
 
-Error FormatImportExportTinyEXR::openForWriting(const std::string& fileName, bool append, const TagList&)
+Error FormatImportExportTinyEXR::openForWriting(const std::string& fileName, bool append, const TagList& hints)
 {
     if (append)
         return ErrorFeaturesUnsupported;
+
+    std::string compression = hints.value("COMPRESSION", "default");
+    switch (compressionPreset(compression)) {
+    case CompressionFast:
+        _compression = TINYEXR_COMPRESSIONTYPE_RLE;
+        break;
+    case CompressionDefault:
+    case CompressionSmall:
+        _compression = TINYEXR_COMPRESSIONTYPE_ZIP;
+        break;
+    case CompressionMethod:
+        if (compression == "none")
+            _compression = TINYEXR_COMPRESSIONTYPE_NONE;
+        else if (compression == "rle")
+            _compression = TINYEXR_COMPRESSIONTYPE_RLE;
+        else if (compression == "zips")
+            _compression = TINYEXR_COMPRESSIONTYPE_ZIPS;
+        else if (compression == "zip")
+            _compression = TINYEXR_COMPRESSIONTYPE_ZIP;
+#if TINYEXR_USE_PIZ
+        else if (compression == "piz")
+            _compression = TINYEXR_COMPRESSIONTYPE_PIZ;
+#endif
+        else
+            return ErrorFeaturesUnsupported;
+        break;
+    }
+
     if (fileName == "-") {
         return ErrorInvalidData;
     } else {
@@ -87,6 +117,53 @@ int FormatImportExportTinyEXR::arrayCount()
     return (_fileName.length() == 0 ? -1 : 1);
 }
 
+/* Interleave the channel images into the array, flipping it vertically if
+ * necessary; chunks of whole rows are processed in parallel */
+template<typename T>
+static void interleaveChannels(ArrayContainer& r, unsigned char** images,
+        const std::vector<size_t>& channelPermutation, bool flip)
+{
+    size_t w = r.dimension(0);
+    size_t h = r.dimension(1);
+    size_t nc = r.componentCount();
+    std::vector<const T*> channels(nc);
+    for (size_t c = 0; c < nc; c++)
+        channels[c] = reinterpret_cast<const T*>(images[channelPermutation[c]]);
+    T* dst = static_cast<T*>(r.data());
+    parallelFor(defaultExecutionPolicy(), w * h, w, [&] (size_t begin, size_t end) {
+            for (size_t y = begin / w; y < end / w; y++) {
+                size_t realY = (flip ? h - 1 - y : y);
+                T* dstRow = dst + y * w * nc;
+                for (size_t c = 0; c < nc; c++) {
+                    const T* srcRow = channels[c] + realY * w;
+                    for (size_t x = 0; x < w; x++)
+                        dstRow[x * nc + c] = srcRow[x];
+                }
+            }
+        });
+}
+
+/* Split the array into channel images bottom-up; chunks of whole rows are
+ * processed in parallel */
+template<typename T>
+static void splitChannels(const ArrayContainer& array, std::vector<std::vector<unsigned char>>& images)
+{
+    size_t w = array.dimension(0);
+    size_t h = array.dimension(1);
+    size_t nc = array.componentCount();
+    const T* src = static_cast<const T*>(array.data());
+    parallelFor(defaultExecutionPolicy(), w * h, w, [&] (size_t begin, size_t end) {
+            for (size_t y = begin / w; y < end / w; y++) {
+                const T* srcRow = src + (h - 1 - y) * w * nc;
+                for (size_t c = 0; c < nc; c++) {
+                    T* dstRow = reinterpret_cast<T*>(images[c].data()) + y * w;
+                    for (size_t x = 0; x < w; x++)
+                        dstRow[x] = srcRow[x * nc + c];
+                }
+            }
+        });
+}
+
 ArrayContainer FormatImportExportTinyEXR::readArray(Error* error, int arrayIndex)
 {
     if (arrayIndex > 0) {
@@ -119,6 +196,8 @@ ArrayContainer FormatImportExportTinyEXR::readArray(Error* error, int arrayIndex
         return ArrayContainer();
     }
 
+    // Files that store only half channels are read as float16 arrays
+    bool allHalf = true;
     for (int i = 0; i < exr_header.num_channels; i++) {
         if (exr_header.pixel_types[i] == TINYEXR_PIXELTYPE_UINT) {
             *error = ErrorFeaturesUnsupported;
@@ -126,7 +205,11 @@ ArrayContainer FormatImportExportTinyEXR::readArray(Error* error, int arrayIndex
             FreeEXRHeader(&exr_header);
             return ArrayContainer();
         }
-        if (exr_header.pixel_types[i] == TINYEXR_PIXELTYPE_HALF) {
+        if (exr_header.pixel_types[i] != TINYEXR_PIXELTYPE_HALF)
+            allHalf = false;
+    }
+    for (int i = 0; i < exr_header.num_channels; i++) {
+        if (exr_header.pixel_types[i] == TINYEXR_PIXELTYPE_HALF && !allHalf) {
             exr_header.requested_pixel_types[i] = TINYEXR_PIXELTYPE_FLOAT;
         }
     }
@@ -190,7 +273,7 @@ ArrayContainer FormatImportExportTinyEXR::readArray(Error* error, int arrayIndex
             channelPermutation.push_back(c);
     }
 
-    TGD::Array<float> r({ w, h }, nc);
+    ArrayContainer r({ w, h }, nc, allHalf ? float16 : float32);
     for (size_t c = 0; c < nc; c++) {
         std::string interpretation = exr_header.channels[channelPermutation[c]].name;
         if (interpretation == "R")
@@ -207,15 +290,11 @@ ArrayContainer FormatImportExportTinyEXR::readArray(Error* error, int arrayIndex
             interpretation = "DEPTH";
         r.componentTagList(c).set("INTERPRETATION", interpretation);
     }
-    for (size_t y = 0; y < h; y++) {
-        for (size_t x = 0; x < w; x++) {
-            for (size_t c = 0; c < nc; c++) {
-                size_t realY = (exr_header.line_order == 0 ? h - 1 - y : y);
-                float v = reinterpret_cast<float*>(exr_image.images[channelPermutation[c]])[realY * w + x];
-                r[{x, y}][c] = v;
-            }
-        }
-    }
+    bool flip = (exr_header.line_order == 0);
+    if (allHalf)
+        interleaveChannels<Float16>(r, exr_image.images, channelPermutation, flip);
+    else
+        interleaveChannels<float>(r, exr_image.images, channelPermutation, flip);
 
     FreeEXRImage(&exr_image);
     FreeEXRHeader(&exr_header);
@@ -234,14 +313,14 @@ Error FormatImportExportTinyEXR::writeArray(const ArrayContainer& array)
             || array.dimension(0) < 1 || array.dimension(1) < 1
             || array.dimension(0) > 65535 || array.dimension(1) > 65535
             || array.componentCount() < 1 || array.componentCount() > 65535
-            || array.componentType() != float32
+            || (array.componentType() != float32 && array.componentType() != float16)
             || _arrayWasReadOrWritten) {
         return ErrorFeaturesUnsupported;
     }
 
     EXRHeader header;
     InitEXRHeader(&header);
-    header.compression_type = TINYEXR_COMPRESSIONTYPE_ZIP;
+    header.compression_type = _compression;
 
     EXRImage image;
     InitEXRImage(&image);
@@ -250,18 +329,13 @@ Error FormatImportExportTinyEXR::writeArray(const ArrayContainer& array)
     image.height = array.dimension(1);
     image.num_channels = array.componentCount();
     header.num_channels = array.componentCount();
-    std::vector<std::vector<float>> images(array.componentCount());
+    std::vector<std::vector<unsigned char>> images(array.componentCount());
     for (size_t c = 0; c < array.componentCount(); c++)
-        images[c].resize(array.elementCount());
-    for (size_t y = 0; y < array.dimension(1); y++) {
-        for (size_t x = 0; x < array.dimension(0); x++) {
-            size_t srcE = (array.dimension(1) - 1 - y) * array.dimension(0) + x;
-            size_t dstE = y * array.dimension(0) + x;
-            for (size_t c = 0; c < array.componentCount(); c++) {
-                images[c][dstE] = array.get<float>(srcE)[c];
-            }
-        }
-    }
+        images[c].resize(array.elementCount() * array.componentSize());
+    if (array.componentType() == float16)
+        splitChannels<Float16>(array, images);
+    else
+        splitChannels<float>(array, images);
     // find RGBA channels and put them in order ABGR
     int indexR = -1, indexG = -1, indexB = -1, indexA = -1;
     for (size_t c = 0; c < array.componentCount(); c++) {
@@ -275,7 +349,7 @@ Error FormatImportExportTinyEXR::writeArray(const ArrayContainer& array)
         else if (s == "ALPHA")
             indexA = c;
     }
-    std::vector<float*> imagePtr;
+    std::vector<unsigned char*> imagePtr;
     imagePtr.reserve(array.componentCount());
     std::vector<EXRChannelInfo> channelInfos;
     channelInfos.reserve(array.componentCount());
@@ -313,9 +387,10 @@ Error FormatImportExportTinyEXR::writeArray(const ArrayContainer& array)
             channelInfos.push_back(chi);
         }
     }
-    image.images = reinterpret_cast<unsigned char**>(imagePtr.data());
+    image.images = imagePtr.data();
     header.channels = channelInfos.data();
-    std::vector<int> pixelTypes(array.componentCount(), TINYEXR_PIXELTYPE_FLOAT);
+    std::vector<int> pixelTypes(array.componentCount(),
+            array.componentType() == float16 ? TINYEXR_PIXELTYPE_HALF : TINYEXR_PIXELTYPE_FLOAT);
     header.pixel_types = pixelTypes.data();
     header.requested_pixel_types = pixelTypes.data();
 
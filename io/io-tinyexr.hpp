@@ -33,6 +33,8 @@ class FormatImportExportTinyEXR : public FormatImportExport {
 private:
     std::string _fileName;
     bool _arrayWasReadOrWritten;
+    // for writing:
+    int _compression;
 
 public:
     FormatImportExportTinyEXR();
@@ -47,6 +49,8 @@ public:
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
 
+    virtual bool isReentrant() const override { return true; }
+
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
 };
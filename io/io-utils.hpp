@@ -26,8 +26,29 @@
 #define TGD_IO_UTILS_HPP
 
 #include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <vector>
 
-#include "array.hpp"
+#ifndef _WIN32
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+# include <fcntl.h>
+# include <unistd.h>
+# define TGD_HAVE_PREAD 1
+# define TGD_HAVE_MMAP 1
+#endif
+
+#include "io.hpp"
+#include "parallel.hpp"
 
 namespace TGD {
 
@@ -43,40 +64,493 @@ inline std::string getExtension(const std::string& fileName)
     return extension;
 }
 
+inline void copyTagLists(const ArrayDescription& src, ArrayDescription& dst)
+{
+    dst.globalTagList() = src.globalTagList();
+    for (size_t d = 0; d < std::min(src.dimensionCount(), dst.dimensionCount()); d++)
+        dst.dimensionTagList(d) = src.dimensionTagList(d);
+    for (size_t c = 0; c < std::min(src.componentCount(), dst.componentCount()); c++)
+        dst.componentTagList(c) = src.componentTagList(c);
+}
+
+inline bool hostIsBigEndian()
+{
+    const uint16_t x = 1;
+    return (*reinterpret_cast<const unsigned char*>(&x) == 0);
+}
+
+inline uint16_t byteSwap(uint16_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap16(x);
+#else
+    return (x << UINT16_C(8)) | (x >> UINT16_C(8));
+#endif
+}
+
+inline uint32_t byteSwap(uint32_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap32(x);
+#else
+    return    ((x                       ) << UINT32_C(24))
+            | ((x & UINT32_C(0x0000ff00)) << UINT32_C(8))
+            | ((x & UINT32_C(0x00ff0000)) >> UINT32_C(8))
+            | ((x                       ) >> UINT32_C(24));
+#endif
+}
+
+inline uint64_t byteSwap(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap64(x);
+#else
+    return    ((x                               ) << UINT64_C(56))
+            | ((x & UINT64_C(0x000000000000ff00)) << UINT64_C(40))
+            | ((x & UINT64_C(0x0000000000ff0000)) << UINT64_C(24))
+            | ((x & UINT64_C(0x00000000ff000000)) << UINT64_C(8))
+            | ((x & UINT64_C(0x000000ff00000000)) >> UINT64_C(8))
+            | ((x & UINT64_C(0x0000ff0000000000)) >> UINT64_C(24))
+            | ((x & UINT64_C(0x00ff000000000000)) >> UINT64_C(40))
+            | ((x                               ) >> UINT64_C(56));
+#endif
+}
+
+template<typename T>
+inline void byteSwap(T* dst, const T* src, size_t n)
+{
+    // simple enough for compilers to vectorize with byte shuffles
+    for (size_t i = 0; i < n; i++)
+        dst[i] = byteSwap(src[i]);
+}
+
+/* Copy n components of the given size from src to dst and swap their endianness.
+ * Both may point to the same data. */
+inline void swapEndianness(void* dst, const void* src, size_t n, size_t componentSize)
+{
+    if (componentSize == 8)
+        byteSwap(static_cast<uint64_t*>(dst), static_cast<const uint64_t*>(src), n);
+    else if (componentSize == 4)
+        byteSwap(static_cast<uint32_t*>(dst), static_cast<const uint32_t*>(src), n);
+    else if (componentSize == 2)
+        byteSwap(static_cast<uint16_t*>(dst), static_cast<const uint16_t*>(src), n);
+    else if (dst != src)
+        std::memcpy(dst, src, n * componentSize);
+}
+
 inline void swapEndianness(ArrayContainer& array)
 {
-    size_t n = array.elementCount() * array.componentCount();
-    if (array.componentSize() == 8) {
-        uint64_t* data = static_cast<uint64_t*>(array.data());
-        for (size_t i = 0; i < n; i++) {
-            uint64_t x = data[i];
-            x =   ((x                               ) << UINT64_C(56))
-                | ((x & UINT64_C(0x000000000000ff00)) << UINT64_C(40))
-                | ((x & UINT64_C(0x0000000000ff0000)) << UINT64_C(24))
-                | ((x & UINT64_C(0x00000000ff000000)) << UINT64_C(8))
-                | ((x & UINT64_C(0x000000ff00000000)) >> UINT64_C(8))
-                | ((x & UINT64_C(0x0000ff0000000000)) >> UINT64_C(24))
-                | ((x & UINT64_C(0x00ff000000000000)) >> UINT64_C(40))
-                | ((x                               ) >> UINT64_C(56));
-            data[i] = x;
+    swapEndianness(array.data(), array.data(), array.elementCount() * array.componentCount(), array.componentSize());
+}
+
+// Blocks of this size are swapped while they are still in the cache
+constexpr size_t swapBlockSize = 65536;
+
+/* Read size bytes of components of the given size, and swap their endianness if
+ * requested. The data is swapped block by block right after reading. */
+inline bool readSwapped(FILE* f, void* data, size_t size, size_t componentSize, bool swap)
+{
+    if (!swap || componentSize == 1)
+        return (size == 0 || std::fread(data, size, 1, f) == 1);
+    unsigned char* p = static_cast<unsigned char*>(data);
+    size_t blockSize = swapBlockSize / componentSize * componentSize;
+    for (size_t done = 0; done < size; ) {
+        size_t n = std::min(blockSize, size - done);
+        if (std::fread(p + done, n, 1, f) != 1)
+            return false;
+        swapEndianness(p + done, p + done, n / componentSize, componentSize);
+        done += n;
+    }
+    return true;
+}
+
+/* Write size bytes of components of the given size, and swap their endianness if
+ * requested. The data is not modified; it is swapped block by block into a scratch buffer. */
+inline bool writeSwapped(FILE* f, const void* data, size_t size, size_t componentSize, bool swap)
+{
+    if (!swap || componentSize == 1)
+        return (size == 0 || std::fwrite(data, size, 1, f) == 1);
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    size_t blockSize = swapBlockSize / componentSize * componentSize;
+    std::vector<unsigned char> scratch(std::min(blockSize, size));
+    for (size_t done = 0; done < size; ) {
+        size_t n = std::min(blockSize, size - done);
+        swapEndianness(scratch.data(), p + done, n / componentSize, componentSize);
+        if (std::fwrite(scratch.data(), n, 1, f) != 1)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+/* Swap the endianness of the given number of components in place, in parallel for large
+ * data unless the default execution policy is sequential */
+inline void swapEndiannessParallel(void* data, size_t n, size_t componentSize)
+{
+    unsigned char* p = static_cast<unsigned char*>(data);
+    parallelFor(defaultExecutionPolicy(), n * componentSize, swapBlockSize, [=] (size_t begin, size_t end) {
+            swapEndianness(p + begin, p + begin, (end - begin) / componentSize, componentSize);
+        });
+}
+
+/* A read-only, copy-on-write mapping of a complete file. Arrays that
+ * reference the mapping keep it alive. */
+class FileMapping
+{
+public:
+    void* address;
+    size_t size;
+
+    FileMapping(void* a, size_t s) : address(a), size(s)
+    {
+    }
+
+    ~FileMapping()
+    {
+#ifdef TGD_HAVE_MMAP
+        munmap(address, size);
+#endif
+    }
+
+    /* Map the regular file f if it has at least minimumSize bytes; returns null otherwise */
+    static std::shared_ptr<FileMapping> create(FILE* f, size_t minimumSize)
+    {
+#ifdef TGD_HAVE_MMAP
+        int fd = fileno(f);
+        struct stat statbuf;
+        if (fd < 0 || fstat(fd, &statbuf) != 0 || !S_ISREG(statbuf.st_mode)
+                || statbuf.st_size == 0 || size_t(statbuf.st_size) < minimumSize) {
+            return nullptr;
         }
-    } else if (array.componentSize() == 4) {
-        uint32_t* data = static_cast<uint32_t*>(array.data());
-        for (size_t i = 0; i < n; i++) {
-            uint32_t x = data[i];
-            x =   ((x                       ) << UINT32_C(24))
-                | ((x & UINT32_C(0x0000ff00)) << UINT32_C(8))
-                | ((x & UINT32_C(0x00ff0000)) >> UINT32_C(8))
-                | ((x                       ) >> UINT32_C(24));
-            data[i] = x;
+        void* address = mmap(nullptr, statbuf.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED)
+            return nullptr;
+        return std::make_shared<FileMapping>(address, statbuf.st_size);
+#else
+        (void)f;
+        (void)minimumSize;
+        return nullptr;
+#endif
+    }
+};
+
+/* Arrays with less data than this are read with fread() instead of from a
+ * file mapping unless mapping is forced. */
+constexpr size_t mmapMinimumSize = size_t(1) << 20;
+
+#ifdef TGD_HAVE_PREAD
+/* Large reads are split into segments of this size, which are read with concurrent
+ * pread() calls so that fast storage gets enough requests to reach its bandwidth */
+constexpr size_t parallelReadSegmentSize = size_t(1) << 23;
+
+/* With direct I/O, file offsets, sizes and buffer addresses must be multiples of this */
+constexpr size_t directIOAlignment = 4096;
+
+/* Open a file for reading with direct I/O, i.e. bypassing the page cache. Returns -1
+ * if this is not supported by the system or the file system. */
+inline int openDirect(const std::string& fileName)
+{
+#ifdef O_DIRECT
+    return open(fileName.c_str(), O_RDONLY | O_DIRECT);
+#else
+    (void)fileName;
+    return -1;
+#endif
+}
+
+/* pread() size bytes at the given offset, continuing after partial reads. Returns
+ * the number of bytes read, which is less than size only at the end of the file,
+ * or -1 on error. */
+inline ssize_t preadFully(int fd, void* data, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t r = pread(fd, static_cast<unsigned char*>(data) + done, size - done, offset + done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            return -1;
+        if (r == 0)
+            break;
+        done += r;
+    }
+    return done;
+}
+
+/* Read size bytes at the given offset of the file descriptor fd into data. Large
+ * reads are split into segments that are read concurrently by the thread pool,
+ * unless the default execution policy is sequential; the file position of fd is not used. If fd was opened with openDirect(), pass
+ * direct = true: segments whose buffer is not suitably aligned are then read into
+ * an aligned buffer first. */
+inline Error readParallel(int fd, off_t offset, void* data, size_t size, bool direct = false)
+{
+    if (size == 0)
+        return ErrorNone;
+    unsigned char* dst = static_cast<unsigned char*>(data);
+    const off_t alignment = directIOAlignment;
+    const off_t segmentSize = parallelReadSegmentSize;
+    off_t begin = (direct ? offset / alignment * alignment : offset);
+    off_t end = offset + off_t(size);
+    size_t segments = (end - begin + segmentSize - 1) / segmentSize;
+    std::atomic<int> errnoValue(0);
+    std::atomic<bool> truncated(false);
+    auto readSegments = [&] (size_t first, size_t last) {
+        std::unique_ptr<unsigned char, decltype(&std::free)> buffer(nullptr, &std::free);
+        for (size_t s = first; s < last && errnoValue == 0 && !truncated; s++) {
+            off_t segmentBegin = begin + off_t(s) * segmentSize;
+            off_t segmentEnd = std::min(segmentBegin + segmentSize, end);
+            off_t copyBegin = std::max(segmentBegin, offset);
+            unsigned char* segmentDst = dst + (copyBegin - offset);
+            size_t n = segmentEnd - copyBegin;
+            ssize_t r;
+            if (!direct || (copyBegin % alignment == 0 && n % alignment == 0
+                        && reinterpret_cast<uintptr_t>(segmentDst) % alignment == 0)) {
+                r = preadFully(fd, segmentDst, n, copyBegin);
+            } else {
+                // segmentBegin is aligned, and the aligned size does not exceed the segment size
+                size_t alignedSize = (segmentEnd - segmentBegin + alignment - 1) / alignment * alignment;
+                void* p = nullptr;
+                if (!buffer && posix_memalign(&p, alignment, segmentSize) == 0)
+                    buffer.reset(static_cast<unsigned char*>(p));
+                if (!buffer) {
+                    errnoValue = ENOMEM;
+                    break;
+                }
+                r = preadFully(fd, buffer.get(), alignedSize, segmentBegin);
+                if (r >= segmentEnd - segmentBegin) {
+                    std::memcpy(segmentDst, buffer.get() + (copyBegin - segmentBegin), n);
+                    r = n;
+                } else if (r > 0) {
+                    r = 0;
+                }
+            }
+            if (r < 0)
+                errnoValue = (errno != 0 ? errno : EIO);
+            else if (size_t(r) < n)
+                truncated = true;
+        }
+    };
+    if (segments > 1 && defaultExecutionPolicy() != Sequential)
+        ThreadPool::instance().parallelFor(segments, 1, readSegments);
+    else
+        readSegments(0, segments);
+    if (errnoValue != 0) {
+        errno = errnoValue;
+        return ErrorSysErrno;
+    }
+    return (truncated ? ErrorInvalidData : ErrorNone);
+}
+#endif
+
+/* Read a box of an array whose data is stored packed at the given offset
+ * of a seekable file. Each contiguous run of elements is read at once, and its
+ * endianness is swapped if requested. The file position is undefined afterwards. */
+inline Error readBoxFromFile(FILE* f, off_t dataOffset, const ArrayDescription& desc,
+        const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize, ArrayContainer& box,
+        bool swap = false)
+{
+    box = ArrayContainer(boxSize, desc.componentCount(), desc.componentType());
+    copyTagLists(desc, box);
+    unsigned char* dst = static_cast<unsigned char*>(box.data());
+    for (BoxIterator it(desc, boxIndex, boxSize); !it.atEnd(); it.nextRun()) {
+        size_t n = it.runLength() * desc.elementSize();
+        if (fseeko(f, dataOffset + off_t(it.linearIndex() * desc.elementSize()), SEEK_SET) != 0)
+            return ErrorSysErrno;
+        if (!readSwapped(f, dst, n, desc.componentSize(), swap))
+            return std::ferror(f) ? ErrorSysErrno : ErrorInvalidData;
+        dst += n;
+    }
+    return ErrorNone;
+}
+
+/* Large images are worth reordering in parallel */
+constexpr size_t parallelReorderMinimumSize = (size_t(1) << 22);
+
+template<size_t N> struct ElementBytes { unsigned char b[N]; };
+
+/* Cache-blocked transposition of the rows [dstRowBegin, dstRowEnd) of dst, which has the
+ * dimensions srcHeight x srcWidth: dst(x, y) = src(mirrorX ? srcWidth - 1 - y : y,
+ * mirrorY ? srcHeight - 1 - x : x). The element type E determines the element size. */
+template<typename E>
+inline void transposeRows(const E* src, size_t srcWidth, size_t srcHeight, E* dst,
+        bool mirrorX, bool mirrorY, size_t dstRowBegin, size_t dstRowEnd)
+{
+    constexpr size_t blockSize = 32;
+    size_t dstWidth = srcHeight;
+    for (size_t by = dstRowBegin; by < dstRowEnd; by += blockSize) {
+        size_t yEnd = std::min(by + blockSize, dstRowEnd);
+        for (size_t bx = 0; bx < dstWidth; bx += blockSize) {
+            size_t xEnd = std::min(bx + blockSize, dstWidth);
+            for (size_t y = by; y < yEnd; y++) {
+                size_t sx = (mirrorX ? srcWidth - 1 - y : y);
+                E* dstRow = dst + y * dstWidth;
+                for (size_t x = bx; x < xEnd; x++) {
+                    size_t sy = (mirrorY ? srcHeight - 1 - x : x);
+                    dstRow[x] = src[sy * srcWidth + sx];
+                }
+            }
         }
-    } else if (array.componentSize() == 2) {
-        uint16_t* data = static_cast<uint16_t*>(array.data());
-        for (size_t i = 0; i < n; i++) {
-            uint16_t x = data[i];
-            x = (x << UINT16_C(8)) | (x >> UINT16_C(8));
-            data[i] = x;
+    }
+}
+
+template<typename E>
+inline void transposeParallel(const void* src, size_t srcWidth, size_t srcHeight, void* dst,
+        bool mirrorX, bool mirrorY)
+{
+    const E* s = static_cast<const E*>(src);
+    E* d = static_cast<E*>(dst);
+    size_t dstHeight = srcWidth;
+    if (defaultExecutionPolicy() == Sequential
+            || srcWidth * srcHeight * sizeof(E) < parallelReorderMinimumSize) {
+        transposeRows(s, srcWidth, srcHeight, d, mirrorX, mirrorY, 0, dstHeight);
+    } else {
+        constexpr size_t rowsPerTask = 64;
+        ThreadPool::instance().parallelFor((dstHeight + rowsPerTask - 1) / rowsPerTask, 1,
+                [=] (size_t begin, size_t end) {
+                    transposeRows(s, srcWidth, srcHeight, d, mirrorX, mirrorY,
+                            begin * rowsPerTask, std::min(end * rowsPerTask, dstHeight));
+                });
+    }
+}
+
+/* Transpose the 2D image src (srcWidth x srcHeight elements of the given size) into
+ * dst (srcHeight x srcWidth elements), optionally mirroring the source axes; see
+ * transposeRows(). */
+inline void transposeImage(const void* src, size_t srcWidth, size_t srcHeight, size_t elementSize,
+        void* dst, bool mirrorX = false, bool mirrorY = false)
+{
+    switch (elementSize) {
+    case 1:  transposeParallel<ElementBytes<1>>(src, srcWidth, srcHeight, dst, mirrorX, mirrorY); break;
+    case 2:  transposeParallel<ElementBytes<2>>(src, srcWidth, srcHeight, dst, mirrorX, mirrorY); break;
+    case 3:  transposeParallel<ElementBytes<3>>(src, srcWidth, srcHeight, dst, mirrorX, mirrorY); break;
+    case 4:  transposeParallel<ElementBytes<4>>(src, srcWidth, srcHeight, dst, mirrorX, mirrorY); break;
+    case 6:  transposeParallel<ElementBytes<6>>(src, srcWidth, srcHeight, dst, mirrorX, mirrorY); break;
+    case 8:  transposeParallel<ElementBytes<8>>(src, srcWidth, srcHeight, dst, mirrorX, mirrorY); break;
+    case 12: transposeParallel<ElementBytes<12>>(src, srcWidth, srcHeight, dst, mirrorX, mirrorY); break;
+    case 16: transposeParallel<ElementBytes<16>>(src, srcWidth, srcHeight, dst, mirrorX, mirrorY); break;
+    default:
+        {
+            const unsigned char* s = static_cast<const unsigned char*>(src);
+            unsigned char* d = static_cast<unsigned char*>(dst);
+            for (size_t y = 0; y < srcWidth; y++) {
+                size_t sx = (mirrorX ? srcWidth - 1 - y : y);
+                for (size_t x = 0; x < srcHeight; x++) {
+                    size_t sy = (mirrorY ? srcHeight - 1 - x : x);
+                    std::memcpy(d + (y * srcHeight + x) * elementSize,
+                            s + (sy * srcWidth + sx) * elementSize, elementSize);
+                }
+            }
         }
+        break;
+    }
+}
+
+/* Fill the contiguous array dst with the dimensions dims (dimension 0 varies fastest)
+ * from src: the element at dst index (j0, j1, ...) is read from element
+ * srcOffset + j0 * srcStrides[0] + j1 * srcStrides[1] + ... of src. If one of the
+ * dimensions has source stride 1, the copy is tiled over that dimension and
+ * dimension 0 so that both reading and writing stay in the cache. */
+template<typename E>
+inline void gatherAxes(const E* src, ptrdiff_t srcOffset, const std::vector<size_t>& dims,
+        const std::vector<ptrdiff_t>& srcStrides, E* dst)
+{
+    size_t n = dims.size();
+    size_t total = 1;
+    for (size_t k = 0; k < n; k++)
+        total *= dims[k];
+    if (total == 0)
+        return;
+    std::vector<size_t> dstStrides(n);
+    for (size_t k = 0; k < n; k++)
+        dstStrides[k] = (k == 0 ? 1 : dstStrides[k - 1] * dims[k - 1]);
+    size_t b = 0; // the dimension that is contiguous in the source
+    for (size_t k = 1; k < n && b == 0; k++)
+        if ((srcStrides[k] == 1 || srcStrides[k] == -1) && dims[k] > 1 && srcStrides[0] != 1 && srcStrides[0] != -1)
+            b = k;
+    constexpr size_t tileSize = (sizeof(E) == 1 ? 64 : 32);
+    size_t tilesB = (b == 0 ? 1 : (dims[b] + tileSize - 1) / tileSize);
+    size_t outerCount = total / dims[0] / (b == 0 ? 1 : dims[b]);
+    // each task covers all of dimension 0 for one tile of dimension b and
+    // one index of all other dimensions
+    auto task = [&] (size_t begin, size_t end) {
+        std::vector<size_t> index(n);
+        for (size_t t = begin; t < end; t++) {
+            size_t o = t / tilesB;
+            ptrdiff_t srcBase = srcOffset;
+            size_t dstBase = 0;
+            for (size_t k = 1; k < n; k++) {
+                if (k == b)
+                    continue;
+                size_t i = o % dims[k];
+                o /= dims[k];
+                srcBase += ptrdiff_t(i) * srcStrides[k];
+                dstBase += i * dstStrides[k];
+            }
+            if (b == 0) {
+                const E* s = src + srcBase;
+                E* d = dst + dstBase;
+                ptrdiff_t s0 = srcStrides[0];
+                for (size_t i0 = 0; i0 < dims[0]; i0++)
+                    d[i0] = s[ptrdiff_t(i0) * s0];
+            } else {
+                size_t b0 = (t % tilesB) * tileSize;
+                size_t b1 = std::min(b0 + tileSize, dims[b]);
+                ptrdiff_t sb = srcStrides[b];
+                ptrdiff_t s0 = srcStrides[0];
+                size_t db = dstStrides[b];
+                for (size_t a0 = 0; a0 < dims[0]; a0 += tileSize) {
+                    size_t a1 = std::min(a0 + tileSize, dims[0]);
+                    for (size_t i0 = a0; i0 < a1; i0++) {
+                        const E* s = src + srcBase + ptrdiff_t(i0) * s0;
+                        E* d = dst + dstBase + i0;
+                        for (size_t ib = b0; ib < b1; ib++)
+                            d[ib * db] = s[ptrdiff_t(ib) * sb];
+                    }
+                }
+            }
+        }
+    };
+    size_t tasks = outerCount * tilesB;
+    if (defaultExecutionPolicy() == Sequential || total * sizeof(E) < parallelReorderMinimumSize || tasks < 2)
+        task(0, tasks);
+    else
+        ThreadPool::instance().parallelFor(tasks, 1, task);
+}
+
+/* Reorder the elements of src (each of size elementSize) into the contiguous array dst
+ * with the dimensions dims: dimension k of dst walks through src with the given stride
+ * (in elements), backwards if reverse[k] is set. */
+inline void reorderAxes(const void* src, size_t elementSize,
+        const std::vector<size_t>& dims, const std::vector<size_t>& srcStrides,
+        const std::vector<bool>& reverse, void* dst)
+{
+    std::vector<size_t> d = dims;
+    std::vector<ptrdiff_t> strides(dims.size());
+    ptrdiff_t offset = 0;
+    for (size_t k = 0; k < dims.size(); k++) {
+        if (dims[k] == 0)
+            return;
+        strides[k] = srcStrides[k];
+        if (reverse[k]) {
+            offset += ptrdiff_t((dims[k] - 1) * srcStrides[k]);
+            strides[k] = -strides[k];
+        }
+    }
+    switch (elementSize) {
+    case 1: gatherAxes(static_cast<const ElementBytes<1>*>(src), offset, d, strides, static_cast<ElementBytes<1>*>(dst)); break;
+    case 2: gatherAxes(static_cast<const ElementBytes<2>*>(src), offset, d, strides, static_cast<ElementBytes<2>*>(dst)); break;
+    case 4: gatherAxes(static_cast<const ElementBytes<4>*>(src), offset, d, strides, static_cast<ElementBytes<4>*>(dst)); break;
+    case 8: gatherAxes(static_cast<const ElementBytes<8>*>(src), offset, d, strides, static_cast<ElementBytes<8>*>(dst)); break;
+    default:
+        // treat each byte of an element as an additional, innermost dimension
+        for (size_t k = 0; k < d.size(); k++) {
+            strides[k] *= elementSize;
+        }
+        offset *= elementSize;
+        d.insert(d.begin(), elementSize);
+        strides.insert(strides.begin(), 1);
+        gatherAxes(static_cast<const unsigned char*>(src), offset, d, strides, static_cast<unsigned char*>(dst));
+        break;
     }
 }
 
@@ -89,72 +563,81 @@ inline ArrayContainer transpose(const ArrayContainer& a)
         vi[vi.size() - 1 - i] = tmp;
     }
     ArrayContainer r(vi, a.componentCount(), a.componentType());
-    std::vector<size_t> original(a.dimensionCount());
-    for (size_t i = 0; i < a.elementCount(); i++) {
-        r.toVectorIndex(i, vi.data());
-        for (size_t i = 0; i < vi.size() / 2; i++) {
-            size_t tmp = vi[i];
-            vi[i] = vi[vi.size() - 1 - i];
-            vi[vi.size() - 1 - i] = tmp;
-        }
-        std::memcpy(r.get(i), a.get(vi), a.elementSize());
+    if (a.dimensionCount() == 2) {
+        transposeImage(a.data(), a.dimension(0), a.dimension(1), a.elementSize(), r.data());
+        return r;
     }
+    // dimension k of r is dimension n-1-k of a
+    size_t n = vi.size();
+    std::vector<size_t> strides(n);
+    for (size_t k = 0; k < n; k++) {
+        strides[k] = 1;
+        for (size_t d = 0; d < n - 1 - k; d++)
+            strides[k] *= a.dimension(d);
+    }
+    reorderAxes(a.data(), a.elementSize(), vi, strides, std::vector<bool>(n, false), r.data());
     return r;
 }
 
+/* Matlab stores data in column-major order, i.e. its first dimension varies fastest.
+ * For arrays with more than two dimensions and at most four entries in the last
+ * dimension, that dimension is assumed to hold the components. Images are flipped in y. */
 inline ArrayContainer reorderMatlabInputData(const std::vector<size_t>& dims, Type t, const void *data)
 {
+    size_t n = dims.size();
+    std::vector<size_t> dataStrides(n);
+    for (size_t d = 0; d < n; d++)
+        dataStrides[d] = (d == 0 ? 1 : dataStrides[d - 1] * dims[d - 1]);
     ArrayContainer r;
-    if (dims.size() > 2 && dims[dims.size() - 1] <= 4) {
-        // heuristic: the first dim is probably a component count
-        std::vector<size_t> dataIndex(dims.size());
-        ArrayDescription dataArray(dims, 1, t);
-        std::vector<size_t> rIndex(dims.size() - 1);
+    if (n > 2 && dims[n - 1] <= 4) {
+        // heuristic: the last dim is probably a component count
+        std::vector<size_t> rIndex(n - 1);
         for (size_t i = 0; i < rIndex.size(); i++)
-            rIndex[i] = dims[dims.size() - 2 - i];
-        r = ArrayContainer(rIndex, dims[dims.size() - 1], t);
-        for (size_t i = 0; i < r.elementCount(); i++) {
-            r.toVectorIndex(i, rIndex.data());
-            for (size_t d = 0; d < rIndex.size(); d++)
-                dataIndex[d] = rIndex[rIndex.size() - 1 - d];
-            if (r.dimensionCount() == 2) // flip images in y
-                dataIndex[0] = r.dimension(1) - 1 - dataIndex[0];
-            for (size_t c = 0; c < r.componentCount(); c++) {
-                dataIndex[2] = c;
-                std::memcpy(static_cast<unsigned char*>(r.data()) + r.componentOffset(i, c),
-                        static_cast<const unsigned char*>(data) + dataArray.elementOffset(dataIndex),
-                        r.componentSize());
-            }
+            rIndex[i] = dims[n - 2 - i];
+        r = ArrayContainer(rIndex, dims[n - 1], t);
+        // the components are the innermost dimension of r
+        std::vector<size_t> rDims(n);
+        std::vector<size_t> strides(n);
+        std::vector<bool> reverse(n, false);
+        rDims[0] = dims[n - 1];
+        strides[0] = dataStrides[n - 1];
+        for (size_t k = 0; k < n - 1; k++) {
+            rDims[1 + k] = rIndex[k];
+            strides[1 + k] = dataStrides[n - 2 - k];
         }
+        if (r.dimensionCount() == 2) // flip images in y
+            reverse[2] = true;
+        reorderAxes(data, r.componentSize(), rDims, strides, reverse, r.data());
     } else {
-        r = ArrayContainer(dims, 1, t);
-        std::memcpy(r.data(), data, r.dataSize());
-        r = transpose(r);
+        std::vector<size_t> rDims(dims.rbegin(), dims.rend());
+        std::vector<size_t> strides(dataStrides.rbegin(), dataStrides.rend());
+        r = ArrayContainer(rDims, 1, t);
+        reorderAxes(data, r.componentSize(), rDims, strides, std::vector<bool>(n, false), r.data());
     }
     return r;
 }
 
 inline ArrayContainer reorderMatlabOutputData(const ArrayContainer& array)
 {
-    std::vector<size_t> dataDims(array.dimensionCount() + 1);
-    for (size_t i = 0; i < array.dimensionCount(); i++)
-        dataDims[i] = array.dimension(array.dimensionCount() - 1 - i);
-    dataDims[array.dimensionCount()] = array.componentCount();
+    size_t n = array.dimensionCount();
+    std::vector<size_t> dataDims(n + 1);
+    for (size_t i = 0; i < n; i++)
+        dataDims[i] = array.dimension(n - 1 - i);
+    dataDims[n] = array.componentCount();
     ArrayContainer dataArray(dataDims, 1, array.componentType());
-    std::vector<size_t> dataIndex(dataArray.dimensionCount());
-    std::vector<size_t> arrayIndex(array.dimensionCount());
-    for (size_t i = 0; i < dataArray.elementCount(); i++) {
-        dataArray.toVectorIndex(i, dataIndex.data());
-        for (size_t d = 0; d < array.dimensionCount(); d++)
-            arrayIndex[array.dimensionCount() - 1 - d] = dataIndex[d];
-        if (array.dimensionCount() == 2) // flip images in y
-            arrayIndex[1] = array.dimension(1) - 1 - arrayIndex[1];
-        size_t arrayComponentIndex = dataIndex[dataArray.dimensionCount() - 1];
-        std::memcpy(dataArray.get(i),
-                static_cast<const unsigned char*>(array.data())
-                + array.componentOffset(arrayIndex, arrayComponentIndex),
-                array.componentSize());
+    // dimension d < n of the data is dimension n-1-d of the array, and the
+    // last dimension of the data walks through the components
+    std::vector<size_t> strides(n + 1);
+    std::vector<bool> reverse(n + 1, false);
+    for (size_t d = 0; d < n; d++) {
+        strides[d] = array.componentCount();
+        for (size_t k = 0; k < n - 1 - d; k++)
+            strides[d] *= array.dimension(k);
     }
+    strides[n] = 1;
+    if (n == 2) // flip images in y
+        reverse[0] = true;
+    reorderAxes(array.data(), array.componentSize(), dataDims, strides, reverse, dataArray.data());
     return dataArray;
 }
 
@@ -173,13 +656,19 @@ typedef enum
 
 inline void reverseY(size_t height, size_t line_size, unsigned char* data)
 {
-    std::vector<unsigned char> tmp_line(line_size);
-    for (size_t y = 0; y < height / 2; y++) {
-        size_t ty = height - 1 - y;
-        std::memcpy(&(tmp_line[0]), &(data[ty * line_size]), line_size);
-        std::memcpy(&(data[ty * line_size]), &(data[y * line_size]), line_size);
-        std::memcpy(&(data[y * line_size]), &(tmp_line[0]), line_size);
-    }
+    auto swapLines = [=] (size_t begin, size_t end) {
+        std::vector<unsigned char> tmp_line(line_size);
+        for (size_t y = begin; y < end; y++) {
+            size_t ty = height - 1 - y;
+            std::memcpy(&(tmp_line[0]), &(data[ty * line_size]), line_size);
+            std::memcpy(&(data[ty * line_size]), &(data[y * line_size]), line_size);
+            std::memcpy(&(data[y * line_size]), &(tmp_line[0]), line_size);
+        }
+    };
+    if (defaultExecutionPolicy() == Sequential || height * line_size < parallelReorderMinimumSize)
+        swapLines(0, height / 2);
+    else
+        ThreadPool::instance().parallelFor(height / 2, 64, swapLines);
 }
 
 inline void reverseY(ArrayContainer& array)
@@ -189,19 +678,53 @@ inline void reverseY(ArrayContainer& array)
             static_cast<unsigned char*>(array.data()));
 }
 
-inline void reverseX(size_t width, size_t height, size_t line_size, size_t elem_size, unsigned char* data)
+template<typename E>
+inline void reverseRow(size_t width, E* row)
+{
+    for (size_t x = 0; x < width / 2; x++) {
+        E tmp = row[x];
+        row[x] = row[width - 1 - x];
+        row[width - 1 - x] = tmp;
+    }
+}
+
+/* Reverse the order of the elements in one image row */
+inline void reverseRow(size_t width, size_t elem_size, unsigned char* row)
 {
-    std::vector<unsigned char> tmp_elem(elem_size);
-    for (size_t y = 0; y < height; y++) {
-        unsigned char* rowData = data + y * line_size;
-        for (size_t x = 0; x < width / 2; x++) {
-            std::memcpy(tmp_elem.data(), rowData + x * elem_size, elem_size);
-            std::memcpy(rowData + x * elem_size, rowData + (width - 1 - x) * elem_size, elem_size);
-            std::memcpy(rowData + (width - 1 - x) * elem_size, tmp_elem.data(), elem_size);
+    switch (elem_size) {
+    case 1:  reverseRow(width, reinterpret_cast<ElementBytes<1>*>(row)); break;
+    case 2:  reverseRow(width, reinterpret_cast<ElementBytes<2>*>(row)); break;
+    case 3:  reverseRow(width, reinterpret_cast<ElementBytes<3>*>(row)); break;
+    case 4:  reverseRow(width, reinterpret_cast<ElementBytes<4>*>(row)); break;
+    case 6:  reverseRow(width, reinterpret_cast<ElementBytes<6>*>(row)); break;
+    case 8:  reverseRow(width, reinterpret_cast<ElementBytes<8>*>(row)); break;
+    case 12: reverseRow(width, reinterpret_cast<ElementBytes<12>*>(row)); break;
+    case 16: reverseRow(width, reinterpret_cast<ElementBytes<16>*>(row)); break;
+    default:
+        {
+            std::vector<unsigned char> tmp_elem(elem_size);
+            for (size_t x = 0; x < width / 2; x++) {
+                std::memcpy(tmp_elem.data(), row + x * elem_size, elem_size);
+                std::memcpy(row + x * elem_size, row + (width - 1 - x) * elem_size, elem_size);
+                std::memcpy(row + (width - 1 - x) * elem_size, tmp_elem.data(), elem_size);
+            }
         }
+        break;
     }
 }
 
+inline void reverseX(size_t width, size_t height, size_t line_size, size_t elem_size, unsigned char* data)
+{
+    auto reverseRows = [=] (size_t begin, size_t end) {
+        for (size_t y = begin; y < end; y++)
+            reverseRow(width, elem_size, data + y * line_size);
+    };
+    if (defaultExecutionPolicy() == Sequential || height * line_size < parallelReorderMinimumSize)
+        reverseRows(0, height);
+    else
+        ThreadPool::instance().parallelFor(height, 64, reverseRows);
+}
+
 inline void reverseX(ArrayContainer& array)
 {
     reverseX(array.dimension(0), array.dimension(1),
@@ -210,6 +733,26 @@ inline void reverseX(ArrayContainer& array)
             static_cast<unsigned char*>(array.data()));
 }
 
+/* Decoders that produce image rows from top to bottom can apply the orientation
+ * while decoding: unless the origin location swaps the axes, decoded row y is
+ * stored in row originDestinationRow() of the final array, mirrored in x if
+ * originMirrorsX(). If the axes are swapped, the rows are stored in file order
+ * and fixImageOrientation() must be called after decoding. */
+inline bool originSwapsAxes(ImageOriginLocation originLocation)
+{
+    return originLocation >= OriginLeftTop;
+}
+
+inline bool originMirrorsX(ImageOriginLocation originLocation)
+{
+    return (originLocation == OriginTopRight || originLocation == OriginBottomRight);
+}
+
+inline size_t originDestinationRow(ImageOriginLocation originLocation, size_t height, size_t y)
+{
+    return ((originLocation == OriginTopLeft || originLocation == OriginTopRight) ? height - 1 - y : y);
+}
+
 inline ArrayContainer createTransposedContainer(const ArrayContainer& array)
 {
     assert(array.dimensionCount() == 2);
@@ -239,52 +782,147 @@ inline void fixImageOrientation(ArrayContainer& array, ImageOriginLocation origi
     case OriginBottomLeft:
         break;
     case OriginLeftTop:
-        {
-            ArrayContainer r = createTransposedContainer(array);
-            for (size_t y = 0; y < r.dimension(1); y++) {
-                for (size_t x = 0; x < r.dimension(0); x++) {
-                    std::memcpy(r.get({ x, y }), array.get({ array.dimension(0) - 1 - y, x }), r.elementSize());
-                }
-            }
-            array = r;
-        }
-        break;
     case OriginRightTop:
-        {
-            ArrayContainer r = createTransposedContainer(array);
-            for (size_t y = 0; y < r.dimension(1); y++) {
-                for (size_t x = 0; x < r.dimension(0); x++) {
-                    std::memcpy(r.get({ x, y }), array.get({ array.dimension(0) - 1 - y, array.dimension(1) - 1 - x }), r.elementSize());
-                }
-            }
-            array = r;
-        }
-        break;
     case OriginRightBottom:
+    case OriginLeftBottom:
         {
             ArrayContainer r = createTransposedContainer(array);
-            for (size_t y = 0; y < r.dimension(1); y++) {
-                for (size_t x = 0; x < r.dimension(0); x++) {
-                    std::memcpy(r.get({ x, y }), array.get({ y, array.dimension(1) - 1 - x }), r.elementSize());
-                }
-            }
+            transposeImage(array.data(), array.dimension(0), array.dimension(1), array.elementSize(), r.data(),
+                    originLocation == OriginLeftTop || originLocation == OriginRightTop,
+                    originLocation == OriginRightTop || originLocation == OriginRightBottom);
             array = r;
         }
         break;
-    case OriginLeftBottom:
-        {
-            ArrayContainer r = createTransposedContainer(array);
-            for (size_t y = 0; y < r.dimension(1); y++) {
-                for (size_t x = 0; x < r.dimension(0); x++) {
-                    std::memcpy(r.get({ x, y }), array.get({ y, x }), r.elementSize());
-                }
+    }
+}
+
+
+/* Reduced resolution reading of images: the input tag LEVEL=n requests the image
+ * at level n, where each level halves the size of the previous one (rounding up),
+ * and MAXSIZE=N or MAXSIZE=WxH requests the first level at which the image fits
+ * into the given size. Importers use existing reduced resolution versions of the
+ * image if available, and reduceImage() otherwise. */
+inline Error reducedImageLevel(const TagList& hints, size_t width, size_t height, unsigned int& level)
+{
+    level = hints.value("LEVEL", 0u);
+    if (hints.contains("MAXSIZE")) {
+        std::string maxSize = hints.value("MAXSIZE");
+        size_t maxWidth, maxHeight;
+        size_t x = maxSize.find('x');
+        try {
+            maxWidth = std::stoul(maxSize.substr(0, x));
+            maxHeight = (x == std::string::npos ? maxWidth : std::stoul(maxSize.substr(x + 1)));
+        }
+        catch (...) {
+            return ErrorInvalidData;
+        }
+        if (maxWidth == 0 || maxHeight == 0)
+            return ErrorInvalidData;
+        while (level < 63 && (((width - 1) >> level) + 1 > maxWidth || ((height - 1) >> level) + 1 > maxHeight))
+            level++;
+    }
+    if (level >= 63)
+        return ErrorInvalidData;
+    return ErrorNone;
+}
+
+inline size_t reducedImageSize(size_t size, unsigned int level)
+{
+    return ((size - 1) >> level) + 1;
+}
+
+template<typename T>
+inline void reduceImageHelper(const ArrayContainer& src, ArrayContainer& dst)
+{
+    size_t sw = src.dimension(0), sh = src.dimension(1);
+    size_t dw = dst.dimension(0), dh = dst.dimension(1);
+    size_t cc = src.componentCount();
+    std::vector<double> sums(cc);
+    for (size_t y = 0; y < dh; y++) {
+        size_t y0 = y * sh / dh;
+        size_t y1 = std::max(y0 + 1, (y + 1) * sh / dh);
+        for (size_t x = 0; x < dw; x++) {
+            size_t x0 = x * sw / dw;
+            size_t x1 = std::max(x0 + 1, (x + 1) * sw / dw);
+            std::fill(sums.begin(), sums.end(), 0.0);
+            for (size_t yy = y0; yy < y1; yy++) {
+                const T* srcRow = static_cast<const T*>(src.get(yy * sw));
+                for (size_t xx = x0; xx < x1; xx++)
+                    for (size_t c = 0; c < cc; c++)
+                        sums[c] += srcRow[xx * cc + c];
+            }
+            T* dstElement = static_cast<T*>(dst.get(y * dw + x));
+            double n = double((y1 - y0) * (x1 - x0));
+            for (size_t c = 0; c < cc; c++) {
+                double v = sums[c] / n;
+                dstElement[c] = (std::numeric_limits<T>::is_integer ? T(v + 0.5) : T(v));
             }
-            array = r;
         }
-        break;
     }
 }
 
+/* Reduce a 2D image to the given smaller size by averaging the covered elements */
+inline ArrayContainer reduceImage(const ArrayContainer& src, size_t width, size_t height)
+{
+    assert(src.dimensionCount() == 2);
+    if (width == src.dimension(0) && height == src.dimension(1))
+        return src;
+    ArrayContainer dst({ width, height }, src.componentCount(), src.componentType());
+    dst.globalTagList() = src.globalTagList();
+    for (size_t i = 0; i < dst.componentCount(); i++)
+        dst.componentTagList(i) = src.componentTagList(i);
+    visitType(src.componentType(), [&] (auto tag) {
+            reduceImageHelper<typename decltype(tag)::type>(src, dst);
+        });
+    return dst;
+}
+
+
+/* Common compression hints for exporters: COMPRESSION=fast selects the fastest
+ * setting that still compresses, COMPRESSION=small the best compression, and
+ * COMPRESSION=default the format's default. Other values of COMPRESSION are
+ * format specific method names. COMPRESSION_LEVEL=n overrides the level of the
+ * chosen method where the format supports it. */
+enum CompressionPreset {
+    CompressionFast,
+    CompressionDefault,
+    CompressionSmall,
+    CompressionMethod   // COMPRESSION names a format specific method
+};
+
+inline CompressionPreset compressionPreset(const std::string& compression)
+{
+    if (compression == "fast")
+        return CompressionFast;
+    else if (compression == "default")
+        return CompressionDefault;
+    else if (compression == "small")
+        return CompressionSmall;
+    else
+        return CompressionMethod;
+}
+
+inline Error compressionLevel(const TagList& hints, int minLevel, int maxLevel, int& level)
+{
+    if (hints.contains("COMPRESSION_LEVEL")) {
+        int l;
+        try {
+            size_t idx;
+            std::string s = hints.value("COMPRESSION_LEVEL");
+            l = std::stoi(s, &idx);
+            if (idx != s.length())
+                return ErrorInvalidData;
+        }
+        catch (...) {
+            return ErrorInvalidData;
+        }
+        if (l < minLevel || l > maxLevel)
+            return ErrorInvalidData;
+        level = l;
+    }
+    return ErrorNone;
+}
+
 }
 
 #endif
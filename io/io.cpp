@@ -24,7 +24,21 @@
 
 #include <cstdio>
 #include <cctype>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
 #include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#ifndef _WIN32
+# include <dirent.h>
+# include <sys/stat.h>
+#endif
 
 #include "io.hpp"
 #include "io-utils.hpp"
@@ -89,147 +103,387 @@ const char* strerror(Error e)
     return str;
 }
 
-static FormatImportExport* openFormatImportExport(const std::string& format)
+/* Registry of format backends.
+ *
+ * The mapping from format names and file name extensions to backend names
+ * as well as the builtin factories are built once. Plugin handles and their
+ * factory functions are cached after the first lookup, including failed
+ * lookups, so that dlopen() is called at most once per backend and process.
+ * Plugin handles are intentionally never closed since objects created by
+ * their factories may live until the process exits. */
+
+typedef FormatImportExport* (*FormatImportExportFactory)();
+
+template<typename FIE> static FormatImportExport* createFormatImportExport()
+{
+    return new FIE;
+}
+
+static const std::vector<std::string>& formatBackends(const std::string& format)
 {
-    /* Create vector of FormatImportExport names in order of preference for the given format */
-    std::vector<std::string> fieNames;
-    if (format == "pbm" || format == "pgm" || format == "ppm" || format == "pnm" || format == "pam" || format == "pfm") {
-        fieNames.push_back("pnm");
-    } else if (format == "hdr" || format == "pic") {
-        fieNames.push_back("rgbe");
-    } else if (format == "exr") {
-        fieNames.push_back("exr");
-        fieNames.push_back("tinyexr");
-    } else if (format == "dcm" || format == "dicom") {
-        fieNames.push_back("dcmtk");
-    } else if (format == "fit") {
-        fieNames.push_back("fits");
-    } else if (format == "mp4" || format == "m4v" || format == "mkv" || format == "ogv"
-            || format == "mpeg" || format == "mpg" || format == "webm"
-            || format == "mov" || format == "avi" || format == "wmv") {
+    static const std::map<std::string, std::vector<std::string>> backends = [] {
+        std::map<std::string, std::vector<std::string>> m;
+        auto add = [&m](std::initializer_list<const char*> formats, std::vector<std::string> names) {
+            for (const char* f : formats)
+                m[f] = names;
+        };
+        add({ "pbm", "pgm", "ppm", "pnm", "pam", "pfm" }, { "pnm" });
+        add({ "hdr", "pic" }, { "rgbe" });
+        add({ "exr" }, { "exr", "tinyexr" });
+        add({ "dcm", "dicom" }, { "dcmtk" });
+        add({ "fit" }, { "fits" });
         // TODO: this list can be much longer; add other extensions when needed
-        fieNames.push_back("ffmpeg");
-    } else if (format == "vrt" || format == "tsx") {
+        add({ "mp4", "m4v", "mkv", "ogv", "mpeg", "mpg", "webm", "mov", "avi", "wmv" }, { "ffmpeg" });
         // TODO: this list can be much longer; add other extensions when needed
-        fieNames.push_back("gdal");
-    } else if (format == "h5" || format == "he5" || format == "hdf5") {
-        fieNames.push_back("hdf5");
-    } else if (format == "jpg" || format == "jpeg") {
-        fieNames.push_back("jpeg");
-        fieNames.push_back("stb");
-    } else if (format == "png") {
-        fieNames.push_back("png");
-        fieNames.push_back("stb");
-    } else if (format == "tif" || format == "tiff") {
-        fieNames.push_back("tiff");
-        fieNames.push_back("magick");
-    } else if (format == "bmp" || format == "tga" || format == "psd") {
-        fieNames.push_back("stb");
-    } else if (format == "gif" || format == "dds" || format == "xpm"
-            || format == "xwd" || format == "ico" || format == "webp") {
+        add({ "vrt", "tsx" }, { "gdal" });
+        add({ "h5", "he5", "hdf5" }, { "hdf5" });
+        add({ "jpg", "jpeg" }, { "jpeg", "stb" });
+        add({ "png" }, { "png", "stb" });
+        add({ "tif", "tiff" }, { "tiff", "magick" });
+        add({ "bmp", "tga", "psd" }, { "stb" });
         // TODO: this list can be much longer; add other extensions when needed
-        fieNames.push_back("magick");
-    } else {
-        // fallback: assume there is an importer/exporter with the extension name
-        fieNames.push_back(format);
-    }
-
-    FormatImportExport* fie = nullptr;
-    for (size_t i = 0; !fie && i < fieNames.size(); i++) {
-        const std::string& fieName = fieNames[i];
-        // first builtin formats...
-        if (fieName == "tgd" || fieName == "tad") {
-            fie = new FormatImportExportTGD;
-        } else if (fieName == "csv") {
-            fie = new FormatImportExportCSV;
-        } else if (fieName == "pnm") {
-            fie = new FormatImportExportPNM;
-        } else if (fieName == "raw") {
-            fie = new FormatImportExportRAW;
-        } else if (fieName == "rgbe") {
-            fie = new FormatImportExportRGBE;
-        } else if (fieName == "stb") {
-            fie = new FormatImportExportSTB;
-        } else if (fieName == "tinyexr") {
-            fie = new FormatImportExportTinyEXR;
+        add({ "gif", "dds", "xpm", "xwd", "ico", "webp" }, { "magick" });
+        return m;
+    }();
+    auto it = backends.find(format);
+    if (it != backends.end())
+        return it->second;
+    // fallback: assume there is an importer/exporter with the extension name
+    thread_local std::vector<std::string> fallback(1);
+    fallback[0] = format;
+    return fallback;
+}
+
+static FormatImportExportFactory builtinFactory(const std::string& name)
+{
+    static const std::map<std::string, FormatImportExportFactory> builtins = {
+        { "tgd", createFormatImportExport<FormatImportExportTGD> },
+        { "tad", createFormatImportExport<FormatImportExportTGD> },
+        { "csv", createFormatImportExport<FormatImportExportCSV> },
+        { "pnm", createFormatImportExport<FormatImportExportPNM> },
+        { "raw", createFormatImportExport<FormatImportExportRAW> },
+        { "rgbe", createFormatImportExport<FormatImportExportRGBE> },
+        { "stb", createFormatImportExport<FormatImportExportSTB> },
+        { "tinyexr", createFormatImportExport<FormatImportExportTinyEXR> },
 #ifdef TGD_STATIC
 #  ifdef TGD_WITH_DCMTK
-        } else if (fieName == "dcmtk") {
-            fie = new FormatImportExportDCMTK;
+        { "dcmtk", createFormatImportExport<FormatImportExportDCMTK> },
 #  endif
 #  ifdef TGD_WITH_OPENEXR
-        } else if (fieName == "exr") {
-            fie = new FormatImportExportEXR;
+        { "exr", createFormatImportExport<FormatImportExportEXR> },
 #  endif
 #  ifdef TGD_WITH_CFITSIO
-        } else if (fieName == "fits") {
-            fie = new FormatImportExportFITS;
+        { "fits", createFormatImportExport<FormatImportExportFITS> },
 #  endif
 #  ifdef TGD_WITH_FFMPEG
-        } else if (fieName == "ffmpeg") {
-            fie = new FormatImportExportFFMPEG;
+        { "ffmpeg", createFormatImportExport<FormatImportExportFFMPEG> },
 #  endif
 #  ifdef TGD_WITH_GDAL
-        } else if (fieName == "gdal") {
-            fie = new FormatImportExportGDAL;
+        { "gdal", createFormatImportExport<FormatImportExportGDAL> },
 #  endif
 #  ifdef TGD_WITH_GTA
-        } else if (fieName == "gta") {
-            fie = new FormatImportExportGTA;
+        { "gta", createFormatImportExport<FormatImportExportGTA> },
 #  endif
 #  ifdef TGD_WITH_HDF5
-        } else if (fieName == "hdf5") {
-            fie = new FormatImportExportHDF5;
+        { "hdf5", createFormatImportExport<FormatImportExportHDF5> },
 #  endif
 #  ifdef TGD_WITH_JPEG
-        } else if (fieName == "jpeg") {
-            fie = new FormatImportExportJPEG;
+        { "jpeg", createFormatImportExport<FormatImportExportJPEG> },
 #  endif
 #  ifdef TGD_WITH_MATIO
-        } else if (fieName == "mat") {
-            fie = new FormatImportExportMAT;
+        { "mat", createFormatImportExport<FormatImportExportMAT> },
 #  endif
 #  ifdef TGD_WITH_POPPLER
-        } else if (fieName == "pdf") {
-            fie = new FormatImportExportPDF;
+        { "pdf", createFormatImportExport<FormatImportExportPDF> },
 #  endif
 #  ifdef TGD_WITH_PFS
-        } else if (fieName == "pfs") {
-            fie = new FormatImportExportPFS;
+        { "pfs", createFormatImportExport<FormatImportExportPFS> },
 #  endif
 #  ifdef TGD_WITH_PNG
-        } else if (fieName == "png") {
-            fie = new FormatImportExportPNG;
+        { "png", createFormatImportExport<FormatImportExportPNG> },
 #  endif
 #  ifdef TGD_WITH_TIFF
-        } else if (fieName == "tiff") {
-            fie = new FormatImportExportTIFF;
+        { "tiff", createFormatImportExport<FormatImportExportTIFF> },
 #  endif
 #  ifdef TGD_WITH_MAGICK
-        } else if (fieName == "magick") {
-            fie = new FormatImportExportMagick;
+        { "magick", createFormatImportExport<FormatImportExportMagick> },
 #  endif
 #endif
-        } else {
-#ifndef TGD_STATIC
-            // ... then plugin formats
-            std::string pluginName = std::string("libtgdio-") + fieName + DOT_SO_STR;
-            void* plugin = dlopen(pluginName.c_str(), RTLD_NOW);
-            if (plugin) {
-                std::string factoryName = std::string("FormatImportExportFactory_") + fieName;
-                void* factory = dlsym(plugin, factoryName.c_str());
-                if (factory) {
-                    FormatImportExport* (*fieFactory)() = reinterpret_cast<FormatImportExport* (*)()>(factory);
-                    fie = fieFactory();
-                }
-            }
+    };
+    auto it = builtins.find(name);
+    return (it == builtins.end() ? nullptr : it->second);
+}
+
+static FormatImportExportFactory pluginFactory(const std::string& name)
+{
+#ifdef TGD_STATIC
+    (void)name;
+    return nullptr;
+#else
+    static std::mutex mutex;
+    static std::map<std::string, FormatImportExportFactory> factories;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = factories.find(name);
+    if (it != factories.end())
+        return it->second;
+    FormatImportExportFactory fieFactory = nullptr;
+    std::string pluginName = std::string("libtgdio-") + name + DOT_SO_STR;
+    void* plugin = dlopen(pluginName.c_str(), RTLD_NOW);
+    if (plugin) {
+        std::string factoryName = std::string("FormatImportExportFactory_") + name;
+        void* factory = dlsym(plugin, factoryName.c_str());
+        if (factory)
+            fieFactory = reinterpret_cast<FormatImportExportFactory>(factory);
+        else
+            dlclose(plugin);
+    }
+    factories[name] = fieFactory;
+    return fieFactory;
 #endif
+}
+
+static FormatImportExport* openFormatImportExport(const std::string& format)
+{
+    for (const std::string& name : formatBackends(format)) {
+        // first builtin formats, then plugin formats
+        FormatImportExportFactory factory = builtinFactory(name);
+        if (!factory)
+            factory = pluginFactory(name);
+        if (factory)
+            return factory();
+    }
+    return nullptr;
+}
+
+/* Guess the format of an existing file from its first bytes. This is used
+ * when the file name extension does not identify a known backend.
+ * Returns an empty string if the format could not be identified. */
+static std::string probeFormat(const std::string& fileName)
+{
+#ifndef _WIN32
+    // A directory is read as a DICOM series if its first file is a DICOM file
+    struct stat statbuf;
+    if (stat(fileName.c_str(), &statbuf) == 0 && S_ISDIR(statbuf.st_mode)) {
+        std::string first;
+        DIR* dir = opendir(fileName.c_str());
+        if (dir) {
+            while (struct dirent* entry = readdir(dir)) {
+                std::string name = entry->d_name;
+                std::string path = fileName + '/' + name;
+                if (name[0] != '.' && (first.empty() || path < first)
+                        && stat(path.c_str(), &statbuf) == 0 && S_ISREG(statbuf.st_mode))
+                    first = path;
+            }
+            closedir(dir);
         }
+        return (!first.empty() && probeFormat(first) == "dcm" ? "dcm" : "");
+    }
+#endif
+    unsigned char b[132];
+    size_t n = 0;
+    FILE* f = std::fopen(fileName.c_str(), "rb");
+    if (f) {
+        n = std::fread(b, 1, sizeof(b), f);
+        std::fclose(f);
     }
-    return fie;
+    auto hasMagic = [&](size_t offset, const char* magic, size_t len) {
+        return n >= offset + len && std::memcmp(b + offset, magic, len) == 0;
+    };
+    if (hasMagic(0, "TGD", 3))
+        return "tgd";
+    if (hasMagic(0, "\x89PNG\r\n\x1a\n", 8))
+        return "png";
+    if (hasMagic(0, "\xff\xd8\xff", 3))
+        return "jpg";
+    if (hasMagic(0, "II*\0", 4) || hasMagic(0, "MM\0*", 4) || hasMagic(0, "II+\0", 4) || hasMagic(0, "MM\0+", 4))
+        return "tif";
+    if (hasMagic(0, "\x76\x2f\x31\x01", 4))
+        return "exr";
+    if (hasMagic(0, "\x89HDF\r\n\x1a\n", 8))
+        return "h5";
+    if (hasMagic(0, "#?RADIANCE", 10) || hasMagic(0, "#?RGBE", 6))
+        return "hdr";
+    if (hasMagic(0, "SIMPLE  =", 9))
+        return "fits";
+    if (hasMagic(128, "DICM", 4))
+        return "dcm";
+    if (hasMagic(0, "MATLAB 5.0", 10))
+        return "mat";
+    if (hasMagic(0, "%PDF", 4))
+        return "pdf";
+    if (hasMagic(0, "GIF8", 4))
+        return "gif";
+    if (hasMagic(0, "BM", 2))
+        return "bmp";
+    if (hasMagic(0, "GTA", 3))
+        return "gta";
+    if (hasMagic(0, "\x1a\x45\xdf\xa3", 4))
+        return "mkv";
+    if (hasMagic(4, "ftyp", 4))
+        return "mp4";
+    if (n >= 3 && b[0] == 'P' && b[1] != '\0' && std::strchr("1234567fF", b[1]) && std::isspace(b[2]))
+        return "pnm";
+    return std::string();
 }
 
-Importer::Importer()
+/* Profiling */
+
+static std::atomic<bool> profilingEnabled(false);
+static std::mutex profilesMutex;
+static std::vector<IOProfile> profiles;
+
+void setProfiling(bool enable)
+{
+    profilingEnabled = enable;
+}
+
+bool profiling()
+{
+    return profilingEnabled;
+}
+
+std::vector<IOProfile> collectedProfiles()
+{
+    std::lock_guard<std::mutex> lock(profilesMutex);
+    return profiles;
+}
+
+/* Returns the profile for a new importer or exporter, or nullptr if profiling is disabled.
+ * With global profiling, the profile is collected when the last reference to it is gone. */
+static std::shared_ptr<IOProfile> createProfile(const std::string& fileName, const std::string& format,
+        bool output, const TagList& hints)
+{
+    if (profilingEnabled) {
+        return std::shared_ptr<IOProfile>(new IOProfile(fileName, format, output), [] (IOProfile* p) {
+                std::lock_guard<std::mutex> lock(profilesMutex);
+                profiles.push_back(*p);
+                delete p;
+            });
+    } else if (hints.value("PROFILE", 0) != 0) {
+        return std::make_shared<IOProfile>(fileName, format, output);
+    } else {
+        return std::shared_ptr<IOProfile>();
+    }
+}
+
+/* Adds the time from construction to destruction to a counter of the profile, if any */
+class ProfileTimer
+{
+private:
+    double* _counter;
+    std::chrono::steady_clock::time_point _start;
+
+public:
+    ProfileTimer(const std::shared_ptr<IOProfile>& profile, double IOProfile::* counter) :
+        _counter(profile ? &(profile.get()->*counter) : nullptr)
+    {
+        if (_counter)
+            _start = std::chrono::steady_clock::now();
+    }
+
+    ~ProfileTimer()
+    {
+        if (_counter)
+            *_counter += std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+    }
+};
+
+static void profileData(const std::shared_ptr<IOProfile>& profile, size_t arrays, size_t bytes, size_t allocatedBytes)
+{
+    if (profile) {
+        profile->arrays += arrays;
+        profile->bytes += bytes;
+        profile->allocatedBytes += allocatedBytes;
+    }
+}
+
+/* Reads arrays ahead in a background thread. The thread is the only user of the
+ * format while it runs; others must wait until it stopped (see halt()), except for
+ * calls that do not change the state of the file, which must hold fieMutex. */
+class ImporterPrefetcher
+{
+public:
+    class Entry
+    {
+    public:
+        ArrayContainer array;
+        Error error;
+        int errnoValue; // errno of the thread for ErrorSysErrno
+        bool end;       // hasMore() was false
+    };
+
+    std::shared_ptr<FormatImportExport> fie;
+    size_t capacity;
+    std::deque<Entry> queue;
+    std::mutex mutex;
+    std::mutex fieMutex;
+    std::condition_variable cond;
+    bool stopRequested;
+    bool finished;
+    std::thread thread;
+
+    ImporterPrefetcher(const std::shared_ptr<FormatImportExport>& f, size_t n) :
+        fie(f), capacity(n), stopRequested(false), finished(false)
+    {
+        thread = std::thread([this] () { run(); });
+    }
+
+    ~ImporterPrefetcher()
+    {
+        halt();
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            cond.wait(lock, [this] () { return stopRequested || queue.size() < capacity; });
+            if (stopRequested)
+                break;
+            lock.unlock();
+            Entry entry;
+            entry.error = ErrorNone;
+            {
+                std::lock_guard<std::mutex> fieLock(fieMutex);
+                entry.end = !fie->hasMore();
+                if (!entry.end)
+                    entry.array = fie->readArray(&entry.error, -1);
+                entry.errnoValue = errno;
+            }
+            lock.lock();
+            queue.push_back(entry);
+            cond.notify_all();
+            // stop where the synchronous reading loop would stop
+            if (entry.end || entry.error != ErrorNone)
+                break;
+        }
+        finished = true;
+        cond.notify_all();
+    }
+
+    // Wait until an entry is available; returns false if there will be none
+    bool wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this] () { return finished || queue.size() > 0; });
+        return queue.size() > 0;
+    }
+
+    // Stop the thread; the queued entries remain available
+    void halt()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopRequested = true;
+        }
+        cond.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+};
+
+Importer::Importer() :
+    _fileIsOpened(false), _prefetchCount(0), _slabsNative(false), _slabPosition(0)
 {
 }
 
@@ -245,8 +499,29 @@ void Importer::initialize(const std::string& fileName, const TagList& hints)
     _format = (hints.contains("FORMAT") ? hints.value("FORMAT")
             : fileName == "-" ? "tgd"
             : getExtension(_fileName));
-    _fie = std::shared_ptr<FormatImportExport>(openFormatImportExport(_format));
+    _prefetcher.reset();
+    _profile = createProfile(_fileName, _format, false, hints);
+    {
+        ProfileTimer timer(_profile, &IOProfile::formatSeconds);
+        _fie = std::shared_ptr<FormatImportExport>(openFormatImportExport(_format));
+        if (!_fie && !hints.contains("FORMAT") && fileName != "-") {
+            std::string probedFormat = probeFormat(_fileName);
+            if (!probedFormat.empty()) {
+                _fie = std::shared_ptr<FormatImportExport>(openFormatImportExport(probedFormat));
+                if (_fie) {
+                    _format = probedFormat;
+                    if (_profile)
+                        _profile->format = _format;
+                }
+            }
+        }
+    }
     _fileIsOpened = false;
+    _prefetchCount = hints.value("PREFETCH", size_t(0));
+    _slabDescription = ArrayDescription();
+    _slabArray = ArrayContainer();
+    _slabsNative = false;
+    _slabPosition = 0;
 }
 
 Error Importer::checkAccess() const
@@ -271,6 +546,7 @@ Error Importer::ensureFileIsOpenedForReading()
     }
     Error e = ErrorNone;
     if (!_fileIsOpened) {
+        ProfileTimer timer(_profile, &IOProfile::openSeconds);
         e = _fie->openForReading(_fileName, _hints);
         if (e == ErrorNone)
             _fileIsOpened = true;
@@ -281,7 +557,43 @@ Error Importer::ensureFileIsOpenedForReading()
 int Importer::arrayCount()
 {
     Error e = ensureFileIsOpenedForReading();
-    return (e == ErrorNone ? _fie->arrayCount() : -1);
+    if (e != ErrorNone)
+        return -1;
+    ProfileTimer timer(_profile, &IOProfile::seekSeconds);
+    if (_prefetcher) {
+        std::lock_guard<std::mutex> fieLock(_prefetcher->fieMutex);
+        return _fie->arrayCount();
+    }
+    return _fie->arrayCount();
+}
+
+bool Importer::readPrefetchedArray(ArrayContainer& array, Error& e)
+{
+    if (_prefetchCount > 0 && !_prefetcher)
+        _prefetcher = std::make_shared<ImporterPrefetcher>(_fie, _prefetchCount);
+    if (!_prefetcher || !_prefetcher->wait())
+        return false;
+    std::lock_guard<std::mutex> lock(_prefetcher->mutex);
+    ImporterPrefetcher::Entry& entry = _prefetcher->queue.front();
+    if (entry.end) {
+        // leave the end marker in place; the format reports what happens
+        // when reading beyond the end
+        return false;
+    }
+    array = entry.array;
+    e = entry.error;
+    if (e == ErrorSysErrno)
+        errno = entry.errnoValue; // errno is thread local
+    _prefetcher->queue.pop_front();
+    _prefetcher->cond.notify_all();
+    return true;
+}
+
+void Importer::stopPrefetching()
+{
+    if (_prefetcher)
+        _prefetcher->halt();
+    _prefetchCount = 0;
 }
 
 ArrayContainer Importer::readArray(Error* error, int arrayIndex)
@@ -292,17 +604,133 @@ ArrayContainer Importer::readArray(Error* error, int arrayIndex)
             *error = e;
         return ArrayContainer();
     }
-    ArrayContainer r = _fie->readArray(&e, arrayIndex);
+    ProfileTimer timer(_profile, &IOProfile::dataSeconds);
+    ArrayContainer r;
+    if (arrayIndex >= 0) {
+        stopPrefetching();
+        r = _fie->readArray(&e, arrayIndex);
+    } else if (!readPrefetchedArray(r, e)) {
+        // the prefetcher has stopped, so the format can be used directly
+        r = _fie->readArray(&e, arrayIndex);
+    }
     if (e != ErrorNone) {
         if (error)
             *error = e;
         return ArrayContainer();
     }
+    profileData(_profile, 1, r.dataSize(), r.dataSize());
     if (error)
         *error = ErrorNone;
     return r;
 }
 
+Error Importer::readArrayInto(ArrayContainer& target, int arrayIndex)
+{
+    Error e = ensureFileIsOpenedForReading();
+    if (e != ErrorNone)
+        return e;
+    ProfileTimer timer(_profile, &IOProfile::dataSeconds);
+    const void* oldData = target.data();
+    if (arrayIndex >= 0) {
+        stopPrefetching();
+        e = _fie->readArrayInto(target, arrayIndex);
+    } else if (!readPrefetchedArray(target, e)) {
+        e = _fie->readArrayInto(target, arrayIndex);
+    }
+    if (e == ErrorNone)
+        profileData(_profile, 1, target.dataSize(), target.data() == oldData ? 0 : target.dataSize());
+    return e;
+}
+
+Error Importer::readArrays(std::vector<ArrayContainer>& arrays, int firstIndex, int count)
+{
+    arrays.resize(std::max(count, 0));
+    Error e = ErrorNone;
+    for (int i = 0; i < count && e == ErrorNone; i++)
+        e = readArrayInto(arrays[i], i == 0 ? firstIndex : -1);
+    return e;
+}
+
+ArrayContainer Importer::readArray(Error* error, int arrayIndex,
+        const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize)
+{
+    Error e = ensureFileIsOpenedForReading();
+    if (e != ErrorNone) {
+        if (error)
+            *error = e;
+        return ArrayContainer();
+    }
+    ProfileTimer timer(_profile, &IOProfile::dataSeconds);
+    stopPrefetching();
+    ArrayContainer r;
+    if (arrayIndex < 0 && readPrefetchedArray(r, e)) {
+        std::vector<size_t> index, size;
+        if (e == ErrorNone && !clipBox(r, boxIndex, boxSize, index, size))
+            e = ErrorInvalidData;
+        if (e == ErrorNone)
+            r = ArrayView(r).box(index, size).materialize();
+    } else {
+        r = _fie->readArrayBox(&e, arrayIndex, boxIndex, boxSize);
+    }
+    if (e != ErrorNone) {
+        if (error)
+            *error = e;
+        return ArrayContainer();
+    }
+    profileData(_profile, 1, r.dataSize(), r.dataSize());
+    if (error)
+        *error = ErrorNone;
+    return r;
+}
+
+ArrayDescription Importer::readDescription(Error* error, int arrayIndex)
+{
+    Error e = ensureFileIsOpenedForReading();
+    if (e != ErrorNone) {
+        if (error)
+            *error = e;
+        return ArrayDescription();
+    }
+    ProfileTimer timer(_profile, &IOProfile::dataSeconds);
+    ArrayDescription desc;
+    ArrayContainer r;
+    if (arrayIndex >= 0) {
+        stopPrefetching();
+        e = _fie->readDescription(arrayIndex, desc);
+    } else if (_prefetcher && readPrefetchedArray(r, e)) {
+        // do not start prefetching complete arrays just for their descriptions
+        desc = r;
+    } else {
+        e = _fie->readDescription(arrayIndex, desc);
+    }
+    if (e != ErrorNone) {
+        if (error)
+            *error = e;
+        return ArrayDescription();
+    }
+    profileData(_profile, 1, 0, 0);
+    if (error)
+        *error = ErrorNone;
+    return desc;
+}
+
+Error Importer::readStatistics(ArrayDescription& desc, std::vector<ComponentStatistics>& statistics,
+        int arrayIndex, const std::vector<size_t>& boxIndex, const std::vector<size_t>& boxSize)
+{
+    Error e = ensureFileIsOpenedForReading();
+    if (e != ErrorNone)
+        return e;
+    // the next array may already be prefetched, and then the format is past it
+    if (arrayIndex < 0 && (_prefetchCount > 0 || _prefetcher))
+        return ErrorFeaturesUnsupported;
+    ProfileTimer timer(_profile, &IOProfile::dataSeconds);
+    stopPrefetching();
+    e = _fie->readStatistics(arrayIndex, desc, boxIndex, boxSize, statistics);
+    if (e == ErrorNone)
+        profileData(_profile, 1, 0, 0);
+    return e;
+}
+
 bool Importer::hasMore(Error* error)
 {
     Error e = ensureFileIsOpenedForReading();
@@ -311,7 +739,16 @@ bool Importer::hasMore(Error* error)
             *error = e;
         return false;
     }
-    bool ret = _fie->hasMore();
+    ProfileTimer timer(_profile, &IOProfile::seekSeconds);
+    bool ret;
+    if (_prefetchCount > 0 && !_prefetcher)
+        _prefetcher = std::make_shared<ImporterPrefetcher>(_fie, _prefetchCount);
+    if (_prefetcher && _prefetcher->wait()) {
+        std::lock_guard<std::mutex> lock(_prefetcher->mutex);
+        ret = !_prefetcher->queue.front().end;
+    } else {
+        ret = _fie->hasMore();
+    }
     if (!ret) {
         if (error)
             *error = ErrorNone;
@@ -319,52 +756,492 @@ bool Importer::hasMore(Error* error)
     return ret;
 }
 
-Exporter::Exporter()
+ArrayDescription Importer::beginArray(Error* error, int arrayIndex)
+{
+    _slabDescription = ArrayDescription();
+    _slabArray = ArrayContainer();
+    _slabPosition = 0;
+    Error e = ensureFileIsOpenedForReading();
+    ProfileTimer timer(_profile, &IOProfile::dataSeconds);
+    stopPrefetching();
+    if (e == ErrorNone && arrayIndex < 0 && readPrefetchedArray(_slabArray, e)) {
+        _slabsNative = false;
+        if (e == ErrorNone)
+            _slabDescription = _slabArray;
+    } else if (e == ErrorNone) {
+        ArrayDescription desc;
+        e = _fie->beginReadSlabs(arrayIndex, desc);
+        if (e == ErrorNone) {
+            _slabsNative = true;
+            _slabDescription = desc;
+        } else if (e == ErrorFeaturesUnsupported) {
+            _slabsNative = false;
+            e = ErrorNone;
+            _slabArray = _fie->readArray(&e, arrayIndex);
+            if (e == ErrorNone)
+                _slabDescription = _slabArray;
+        }
+    }
+    if (e == ErrorNone)
+        profileData(_profile, 1, 0, _slabArray.dataSize());
+    if (error)
+        *error = e;
+    return _slabDescription;
+}
+
+ArrayContainer Importer::readSlab(size_t sliceCount, Error* error)
+{
+    ProfileTimer timer(_profile, &IOProfile::dataSeconds);
+    Error e = ErrorNone;
+    ArrayContainer r;
+    sliceCount = std::min(sliceCount, remainingSlices());
+    if (sliceCount == 0) {
+        e = ErrorInvalidData;
+    } else if (_slabsNative) {
+        r = _fie->readSlab(&e, _slabPosition, sliceCount);
+    } else if (sliceCount == remainingSlices() && _slabPosition == 0) {
+        r = _slabArray;
+    } else {
+        size_t lastDim = _slabDescription.dimensionCount() - 1;
+        std::vector<size_t> boxIndex(lastDim + 1, 0);
+        std::vector<size_t> boxSize = _slabDescription.dimensions();
+        boxIndex[lastDim] = _slabPosition;
+        boxSize[lastDim] = sliceCount;
+        r = ArrayView(_slabArray).box(boxIndex, boxSize).materialize();
+    }
+    if (e == ErrorNone) {
+        profileData(_profile, 0, r.dataSize(), r.data() == _slabArray.data() ? 0 : r.dataSize());
+        _slabPosition += sliceCount;
+        if (remainingSlices() == 0)
+            _slabArray = ArrayContainer();
+    } else {
+        r = ArrayContainer();
+    }
+    if (error)
+        *error = e;
+    return r;
+}
+
+BatchImporter::BatchImporter() : _sequential(false)
+{
+}
+
+BatchImporter::BatchImporter(const std::vector<std::string>& fileNames, const TagList& hints, size_t threadCount) :
+    _sequential(false)
+{
+    initialize(fileNames, hints, threadCount);
+}
+
+void BatchImporter::initialize(const std::vector<std::string>& fileNames, const TagList& hints, size_t threadCount)
+{
+    _importers.clear();
+    _importers.resize(fileNames.size());
+    for (size_t i = 0; i < fileNames.size(); i++)
+        _importers[i].initialize(fileNames[i], hints);
+    // the calling thread participates, so the pool needs one thread less;
+    // a pool without threads would instead get one per hardware thread
+    _pool.reset();
+    _sequential = (threadCount == 1);
+    if (threadCount > 1)
+        _pool = std::make_shared<ThreadPool>(threadCount - 1);
+}
+
+std::vector<std::string> BatchImporter::fileNamesFromTemplate(const std::string& fileNameTemplate,
+        size_t firstIndex, Error* error)
+{
+    std::vector<std::string> fileNames;
+    size_t first = fileNameTemplate.find_first_of('%');
+    size_t last = (first == std::string::npos ? first : fileNameTemplate.find_first_of('N', first));
+    size_t fieldWidth = 6;
+    bool valid = (last != std::string::npos);
+    for (size_t i = first + 1; valid && i < last; i++)
+        valid = (fileNameTemplate[i] >= '0' && fileNameTemplate[i] <= '9');
+    if (valid && last > first + 1) {
+        fieldWidth = std::stoul(fileNameTemplate.substr(first + 1, last - first - 1));
+        valid = (fieldWidth > 0);
+    }
+    if (!valid) {
+        if (error)
+            *error = ErrorInvalidData;
+        return fileNames;
+    }
+    for (size_t index = firstIndex; ; index++) {
+        std::string indexString = std::to_string(index);
+        std::string fileName = fileNameTemplate.substr(0, first);
+        if (indexString.length() < fieldWidth)
+            fileName += std::string(fieldWidth - indexString.length(), '0');
+        fileName += indexString;
+        fileName += fileNameTemplate.substr(last + 1);
+        FILE* f = std::fopen(fileName.c_str(), "rb");
+        if (!f)
+            break;
+        std::fclose(f);
+        fileNames.push_back(fileName);
+    }
+    if (error)
+        *error = ErrorNone;
+    return fileNames;
+}
+
+Error BatchImporter::forEach(const std::function<Error (size_t, Importer&)>& func, size_t first, size_t count)
+{
+    // formats that are not reentrant are used by one thread at a time, across all batch importers
+    static std::mutex nonReentrantMutex;
+    first = std::min(first, _importers.size());
+    count = std::min(count, _importers.size() - first);
+    std::vector<Error> errors(count, ErrorNone);
+    auto body = [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            Importer& importer = _importers[first + i];
+            if (importer._fie && importer._fie->isReentrant()) {
+                errors[i] = func(first + i, importer);
+            } else {
+                std::lock_guard<std::mutex> lock(nonReentrantMutex);
+                errors[i] = func(first + i, importer);
+            }
+        }
+    };
+    if (_sequential) {
+        body(0, count);
+    } else {
+        ThreadPool& pool = (_pool ? *_pool : ThreadPool::instance());
+        pool.parallelFor(count, 1, body);
+    }
+    for (size_t i = 0; i < errors.size(); i++)
+        if (errors[i] != ErrorNone)
+            return errors[i];
+    return ErrorNone;
+}
+
+bool BatchImporter::hasMore(Error* error)
+{
+    std::vector<char> more(_importers.size());
+    Error e = forEach([&] (size_t i, Importer& importer) -> Error {
+            Error ie = ErrorNone;
+            more[i] = importer.hasMore(&ie);
+            return ie;
+        });
+    bool ret = (std::find(more.begin(), more.end(), 0) == more.end());
+    if (!ret && error)
+        *error = e;
+    return ret;
+}
+
+Error BatchImporter::readArrays(std::vector<ArrayContainer>& arrays)
+{
+    arrays.resize(_importers.size());
+    return forEach([&] (size_t i, Importer& importer) -> Error {
+            return importer.readArrayInto(arrays[i]);
+        });
+}
+
+ArrayContainer BatchImporter::readStacked(Error* error)
+{
+    Error e = ErrorNone;
+    ArrayContainer r;
+    if (_importers.size() == 0) {
+        e = ErrorInvalidData;
+    } else {
+        // the first array determines the description of the result
+        ArrayContainer first = _importers[0].readArray(&e);
+        if (e == ErrorNone) {
+            if (first.isBricked())
+                first = toLinear(first);
+            std::vector<size_t> dimensions = first.dimensions();
+            dimensions.push_back(_importers.size());
+            ArrayDescription desc(dimensions, first.componentCount(), first.componentType());
+            desc.globalTagList() = first.globalTagList();
+            for (size_t d = 0; d < first.dimensionCount(); d++)
+                desc.dimensionTagList(d) = first.dimensionTagList(d);
+            for (size_t c = 0; c < first.componentCount(); c++)
+                desc.componentTagList(c) = first.componentTagList(c);
+            r = ArrayContainer(desc);
+            size_t sliceSize = first.dataSize();
+            std::memcpy(r.data(), first.data(), sliceSize);
+            const ArrayDescription& firstDesc = first;
+            e = forEach([&] (size_t i, Importer& importer) -> Error {
+                    if (i == 0)
+                        return ErrorNone;
+                    // the slice is the only user of its data, so that it can be reused
+                    void* sliceData = static_cast<unsigned char*>(r.data()) + i * sliceSize;
+                    ArrayContainer slice(firstDesc, sliceData);
+                    Error ie = importer.readArrayInto(slice);
+                    if (ie != ErrorNone)
+                        return ie;
+                    if (slice.dimensions() != firstDesc.dimensions()
+                            || slice.componentCount() != firstDesc.componentCount()
+                            || slice.componentType() != firstDesc.componentType())
+                        return ErrorInvalidData;
+                    if (slice.isBricked())
+                        slice = toLinear(slice);
+                    if (slice.data() != sliceData)
+                        std::memcpy(sliceData, slice.data(), sliceSize);
+                    return ErrorNone;
+                });
+            if (e != ErrorNone)
+                r = ArrayContainer();
+        }
+    }
+    if (error)
+        *error = e;
+    return r;
+}
+
+/* Writes arrays in a background thread. The thread is the only user of the format
+ * while arrays are queued or being written. */
+class ExporterWriter
+{
+public:
+    std::shared_ptr<FormatImportExport> fie;
+    size_t capacity;
+    std::deque<ArrayContainer> queue;
+    bool busy;          // an array is being written
+    Error error;        // the first error that occurred
+    int errnoValue;     // errno of the writer thread for ErrorSysErrno
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool stopRequested;
+    std::thread thread;
+
+    ExporterWriter(const std::shared_ptr<FormatImportExport>& f, size_t n) :
+        fie(f), capacity(n), busy(false), error(ErrorNone), errnoValue(0), stopRequested(false)
+    {
+        thread = std::thread([this] () { run(); });
+    }
+
+    ~ExporterWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopRequested = true;
+        }
+        cond.notify_all();
+        thread.join();
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            cond.wait(lock, [this] () { return stopRequested || queue.size() > 0; });
+            if (queue.size() == 0)
+                break;
+            ArrayContainer array = queue.front();
+            queue.pop_front();
+            busy = true;
+            bool skip = (error != ErrorNone);
+            cond.notify_all();
+            lock.unlock();
+            Error e = (skip ? ErrorNone : fie->writeArray(array));
+            array = ArrayContainer();
+            lock.lock();
+            busy = false;
+            if (error == ErrorNone) {
+                error = e;
+                errnoValue = errno;
+            }
+            cond.notify_all();
+        }
+    }
+
+    Error push(const ArrayContainer& array)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this] () { return error != ErrorNone || queue.size() < capacity; });
+        if (error == ErrorNone) {
+            queue.push_back(array);
+            cond.notify_all();
+        }
+        return reportError();
+    }
+
+    Error flush()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this] () { return queue.size() == 0 && !busy; });
+        return reportError();
+    }
+
+    // errno is thread local, so pass it on to the caller
+    Error reportError()
+    {
+        if (error == ErrorSysErrno)
+            errno = errnoValue;
+        return error;
+    }
+};
+
+Exporter::Exporter() :
+    _fileIsOpened(false), _asyncCount(0), _slabsNative(false), _slabPosition(0)
 {
 }
 
 Exporter::~Exporter()
 {
-    if (_fie && _fileIsOpened)
-        _fie->close();
+    finish();
 }
 
-Exporter::Exporter(const std::string& fileName, bool append, const TagList& hints)
+Exporter::Exporter(const std::string& fileName, bool append, const TagList& hints) :
+    _fileIsOpened(false), _asyncCount(0), _slabsNative(false), _slabPosition(0)
 {
     initialize(fileName, append, hints);
 }
 
 void Exporter::initialize(const std::string& fileName, bool append, const TagList& hints)
 {
+    finish();
     _fileName = fileName;
     _append = append;
     _hints = hints;
     _format = (hints.contains("FORMAT") ? hints.value("FORMAT")
             : fileName == "-" ? "tgd"
             : getExtension(_fileName));
-    _fie = std::shared_ptr<FormatImportExport>(openFormatImportExport(_format));
+    _profile = createProfile(_fileName, _format, true, hints);
+    {
+        ProfileTimer timer(_profile, &IOProfile::formatSeconds);
+        _fie = std::shared_ptr<FormatImportExport>(openFormatImportExport(_format));
+    }
     _fileIsOpened = false;
+    _asyncCount = hints.value("ASYNC", size_t(0));
+    _slabDescription = ArrayDescription();
+    _slabArray = ArrayContainer();
+    _slabsNative = false;
+    _slabPosition = 0;
 }
 
-Error Exporter::writeArray(const ArrayContainer& array)
+Error Exporter::ensureFileIsOpenedForWriting()
 {
     if (!_fie) {
         return ErrorFormatUnsupported;
     }
-    Error e;
+    Error e = ErrorNone;
     if (!_fileIsOpened) {
+        ProfileTimer timer(_profile, &IOProfile::openSeconds);
         e = _fie->openForWriting(_fileName, _append, _hints);
-        if (e != ErrorNone) {
-            return e;
-        }
-        _fileIsOpened = true;
+        if (e == ErrorNone)
+            _fileIsOpened = true;
+    }
+    return e;
+}
+
+Error Exporter::writeArray(const ArrayContainer& array)
+{
+    Error e = ensureFileIsOpenedForWriting();
+    if (e != ErrorNone) {
+        return e;
+    }
+    if (array.isBricked() && !_fie->writesBrickedArrays()) {
+        return writeArray(toLinear(array));
+    }
+    ProfileTimer timer(_profile, &IOProfile::dataSeconds);
+    if (_asyncCount > 0) {
+        if (!_writer)
+            _writer = std::make_shared<ExporterWriter>(_fie, _asyncCount);
+        e = _writer->push(array);
+    } else {
+        e = _fie->writeArray(array);
     }
-    e = _fie->writeArray(array);
     if (e != ErrorNone) {
         return e;
     }
+    profileData(_profile, 1, array.dataSize(), 0);
+    return ErrorNone;
+}
+
+Error Exporter::flush()
+{
+    ProfileTimer timer(_profile, &IOProfile::flushSeconds);
+    return (_writer ? _writer->flush() : ErrorNone);
+}
 
+Error Exporter::finish()
+{
+    Error e = flush();
+    ProfileTimer timer(_profile, &IOProfile::flushSeconds);
+    _writer.reset();
+    if (_fie && _fileIsOpened) {
+        _fie->close();
+        _fileIsOpened = false;
+    }
+    return e;
+}
+
+Error Exporter::beginArray(const ArrayDescription& arrayDesc)
+{
+    // slabs are always written in the linear layout
+    ArrayDescription desc(arrayDesc, std::vector<size_t>());
+    _slabDescription = ArrayDescription();
+    _slabArray = ArrayContainer();
+    _slabPosition = 0;
+    if (desc.dimensionCount() == 0) {
+        return ErrorInvalidData;
+    }
+    Error e = ensureFileIsOpenedForWriting();
+    if (e == ErrorNone)
+        e = flush(); // slabs are written synchronously
+    if (e != ErrorNone) {
+        return e;
+    }
+    ProfileTimer timer(_profile, &IOProfile::dataSeconds);
+    e = _fie->beginWriteSlabs(desc);
+    if (e == ErrorNone) {
+        _slabsNative = true;
+    } else if (e == ErrorFeaturesUnsupported) {
+        _slabsNative = false;
+        _slabArray = ArrayContainer(desc);
+        profileData(_profile, 0, 0, _slabArray.dataSize());
+        e = ErrorNone;
+    } else {
+        return e;
+    }
+    _slabDescription = desc;
     return ErrorNone;
 }
 
+Error Exporter::writeSlab(const ArrayContainer& slab)
+{
+    if (slab.isBricked()) {
+        return writeSlab(toLinear(slab));
+    }
+    size_t lastDim = _slabDescription.dimensionCount() - 1;
+    if (_slabDescription.dimensionCount() == 0
+            || slab.dimensionCount() != _slabDescription.dimensionCount()
+            || slab.componentCount() != _slabDescription.componentCount()
+            || slab.componentType() != _slabDescription.componentType()
+            || slab.dimension(lastDim) == 0
+            || slab.dimension(lastDim) > _slabDescription.dimension(lastDim) - _slabPosition) {
+        return ErrorInvalidData;
+    }
+    for (size_t d = 0; d < lastDim; d++) {
+        if (slab.dimension(d) != _slabDescription.dimension(d)) {
+            return ErrorInvalidData;
+        }
+    }
+    ProfileTimer timer(_profile, &IOProfile::dataSeconds);
+    Error e = ErrorNone;
+    if (_slabsNative) {
+        e = _fie->writeSlab(slab);
+    } else {
+        // slices are stored contiguously, so the slab is one block of data
+        size_t sliceSize = _slabDescription.dataSize() / _slabDescription.dimension(lastDim);
+        std::memcpy(static_cast<unsigned char*>(_slabArray.data()) + _slabPosition * sliceSize,
+                slab.data(), slab.dataSize());
+    }
+    if (e != ErrorNone) {
+        return e;
+    }
+    _slabPosition += slab.dimension(lastDim);
+    profileData(_profile, _slabPosition == _slabDescription.dimension(lastDim) ? 1 : 0, slab.dataSize(), 0);
+    if (_slabPosition == _slabDescription.dimension(lastDim)) {
+        if (_slabsNative)
+            e = _fie->endWriteSlabs();
+        else
+            e = _fie->writeArray(_slabArray);
+        _slabDescription = ArrayDescription();
+        _slabArray = ArrayContainer();
+        _slabPosition = 0;
+    }
+    return e;
+}
+
 }
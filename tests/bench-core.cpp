@@ -0,0 +1,418 @@
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "core/array.hpp"
+#include "core/foreach.hpp"
+#include "core/operators.hpp"
+#include "core/taglist.hpp"
+#include "io/io-utils.hpp"
+
+/* Micro-benchmarks for the hot core functions.
+ *
+ * Each benchmark runs for a range of data sizes, from L1-resident to far
+ * beyond the last level cache. The results are printed as CSV with one line
+ * per benchmark and size; the nanoseconds per iteration are the median of
+ * several samples. Given a baseline file from a previous run, each result is
+ * compared to the baseline, and the exit status is 1 if any benchmark is
+ * slower than the baseline by more than the threshold.
+ *
+ * Usage: bench-core [--sizes=S0,S1,...] [--filter=SUBSTRING] [--samples=N]
+ *                   [--sample-time=SECONDS] [--parallel] [--output=FILE]
+ *                   [--baseline=FILE] [--threshold=FRACTION]
+ *
+ * Sizes are the bytes of float32 data (suffixes K, M, G) and determine the
+ * number of components per array for all types. */
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options
+{
+    std::vector<size_t> sizes = { size_t(16) << 10, size_t(256) << 10, size_t(8) << 20, size_t(64) << 20 };
+    std::string filter;
+    size_t samples = 5;
+    double sampleTime = 0.02;
+    std::string output;
+    std::string baseline;
+    double threshold = 0.1;
+};
+
+struct Result
+{
+    std::string benchmark;
+    std::string size;
+    size_t items;       // items processed per iteration
+    size_t bytes;       // bytes read and written per iteration
+    double ns;          // median nanoseconds per iteration
+};
+
+static Options options;
+static std::vector<Result> results;
+
+/* Keep the compiler from optimizing away results that are never used */
+static void escape(const void* p)
+{
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(p) : "memory");
+#else
+    static const void* volatile sink;
+    sink = p;
+#endif
+}
+
+static std::string sizeLabel(size_t bytes)
+{
+    return (bytes % (size_t(1) << 30) == 0 ? std::to_string(bytes >> 30) + "G"
+            : bytes % (size_t(1) << 20) == 0 ? std::to_string(bytes >> 20) + "M"
+            : bytes % (size_t(1) << 10) == 0 ? std::to_string(bytes >> 10) + "K"
+            : std::to_string(bytes));
+}
+
+template<typename FUNC>
+static void run(const std::string& benchmark, const std::string& size, size_t items, size_t bytes, FUNC func)
+{
+    if (!options.filter.empty() && benchmark.find(options.filter) == std::string::npos)
+        return;
+    // calibrate the number of iterations per sample
+    size_t iterations = 1;
+    for (;;) {
+        Clock::time_point t0 = Clock::now();
+        for (size_t i = 0; i < iterations; i++)
+            func();
+        double seconds = std::chrono::duration<double>(Clock::now() - t0).count();
+        if (seconds >= options.sampleTime)
+            break;
+        iterations = (seconds <= 0.0 ? iterations * 10
+                : std::max(iterations + 1, size_t(iterations * 1.2 * options.sampleTime / seconds)));
+    }
+    std::vector<double> ns(options.samples);
+    for (size_t s = 0; s < options.samples; s++) {
+        Clock::time_point t0 = Clock::now();
+        for (size_t i = 0; i < iterations; i++)
+            func();
+        ns[s] = std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / iterations;
+    }
+    std::sort(ns.begin(), ns.end());
+    results.push_back({ benchmark, size, items, bytes, ns[ns.size() / 2] });
+    fprintf(stderr, "%s %s: %.1f ns\n", benchmark.c_str(), size.c_str(), results.back().ns);
+}
+
+static void fill(TGD::ArrayContainer& a)
+{
+    unsigned char* p = static_cast<unsigned char*>(a.data());
+    for (size_t i = 0; i < a.dataSize(); i++)
+        p[i] = (i * 7 + 3) % 61;
+}
+
+static void benchConvert(size_t components, const std::string& size)
+{
+    for (int from = TGD::int8; from <= TGD::bfloat16; from++) {
+        TGD::ArrayContainer src({ components }, 1, TGD::Type(from));
+        fill(src);
+        for (int to = TGD::int8; to <= TGD::bfloat16; to++) {
+            TGD::ArrayContainer dst({ components }, 1, TGD::Type(to));
+            std::string name = std::string("convert/") + TGD::typeToString(TGD::Type(from))
+                + "/" + TGD::typeToString(TGD::Type(to));
+            run(name, size, components, src.dataSize() + dst.dataSize(), [&] () {
+                    TGD::convertComponents(dst.data(), TGD::Type(to), src.data(), TGD::Type(from), components);
+                    escape(dst.data());
+                });
+        }
+    }
+}
+
+static void benchForEach(size_t components, const std::string& size)
+{
+    TGD::Array<float> a({ components / 4 }, 4);
+    TGD::Array<float> b({ components / 4 }, 4);
+    TGD::forEachComponentInplace(a, [] (float) { return 0.5f; });
+    TGD::forEachComponentInplace(b, [] (float) { return 2.0f; });
+    size_t bytes = a.dataSize();
+    run("foreach/component-inplace", size, components, 2 * bytes, [&] () {
+            TGD::forEachComponentInplace(a, [] (float v) { return v * 0.5f + 0.25f; });
+            escape(a.data());
+        });
+    run("foreach/component", size, components, 2 * bytes, [&] () {
+            TGD::Array<float> r = TGD::forEachComponent(a, [] (float v) { return v * 0.5f + 0.25f; });
+            escape(r.data());
+        });
+    run("foreach/element-inplace", size, components, 2 * bytes, [&] () {
+            TGD::forEachElementInplace(a, [] (float* e) { std::swap(e[0], e[3]); });
+            escape(a.data());
+        });
+    run("operators/add", size, components, 3 * bytes, [&] () {
+            TGD::Array<float> r = a + b;
+            escape(r.data());
+        });
+    run("operators/add-inplace", size, components, 3 * bytes, [&] () {
+            a += b;
+            escape(a.data());
+        });
+    run("operators/multiply-scalar", size, components, 2 * bytes, [&] () {
+            TGD::Array<float> r = a * 0.5f;
+            escape(r.data());
+        });
+    run("operators/max", size, components, 3 * bytes, [&] () {
+            TGD::Array<float> r = TGD::max(a, b);
+            escape(r.data());
+        });
+}
+
+static void benchIndex(size_t components, const std::string& size)
+{
+    size_t edge = std::max(size_t(std::cbrt(double(components))), size_t(1));
+    TGD::ArrayDescription desc({ edge, edge, edge }, 1, TGD::float32);
+    size_t n = desc.elementCount();
+    run("index/to-vector-and-linear", size, n, 0, [&] () {
+            size_t vi[3];
+            size_t sum = 0;
+            for (size_t e = 0; e < n; e++) {
+                desc.toVectorIndex(e, vi);
+                sum += desc.toLinearIndex({ vi[0], vi[1], vi[2] });
+            }
+            escape(&sum);
+        });
+}
+
+static void benchCopy(size_t components, const std::string& size)
+{
+    TGD::ArrayContainer a({ components }, 1, TGD::float32);
+    fill(a);
+    run("copy/deep-copy", size, components, 2 * a.dataSize(), [&] () {
+            TGD::ArrayContainer r = a.deepCopy();
+            escape(r.data());
+        });
+}
+
+static void benchReorder(size_t components, const std::string& size)
+{
+    // uint8 RGBA images with the given size
+    size_t edge = std::max(size_t(std::sqrt(double(components))), size_t(1));
+    TGD::ArrayContainer image({ edge, edge }, 4, TGD::uint8);
+    fill(image);
+    run("io-utils/transpose", size, edge * edge, 2 * image.dataSize(), [&] () {
+            TGD::ArrayContainer r = TGD::transpose(image);
+            escape(r.data());
+        });
+    run("io-utils/reverse-y", size, edge * edge, 2 * image.dataSize(), [&] () {
+            TGD::reverseY(image);
+            escape(image.data());
+        });
+}
+
+static void benchBricks(size_t components, const std::string& size)
+{
+    // float32 volumes with the given size; slices along each dimension
+    size_t edge = std::max(size_t(std::cbrt(double(components))), size_t(1));
+    TGD::ArrayContainer linear({ edge, edge, edge }, 1, TGD::float32);
+    fill(linear);
+    TGD::ArrayContainer bricked = TGD::toBricked(linear, { 32, 32, 32 });
+    run("bricks/to-bricked", size, edge * edge * edge, 2 * linear.dataSize(), [&] () {
+            TGD::ArrayContainer r = TGD::toBricked(linear, { 32, 32, 32 });
+            escape(r.data());
+        });
+    run("bricks/to-linear", size, edge * edge * edge, 2 * linear.dataSize(), [&] () {
+            TGD::ArrayContainer r = TGD::toLinear(bricked);
+            escape(r.data());
+        });
+    for (size_t d = 0; d < 3; d++) {
+        std::vector<size_t> index(3, 0), sliceSize(3, edge);
+        index[d] = edge / 2;
+        sliceSize[d] = 1;
+        for (const TGD::ArrayContainer* a : { &linear, &bricked }) {
+            std::string name = std::string("bricks/slice") + std::to_string(d)
+                + (a->isBricked() ? "-bricked" : "-linear");
+            run(name, size, edge * edge, 2 * edge * edge * sizeof(float), [&] () {
+                    TGD::ArrayContainer r = TGD::extractBox(*a, index, sliceSize);
+                    escape(r.data());
+                });
+        }
+    }
+}
+
+static void benchTagList()
+{
+    for (size_t tags : { size_t(16), size_t(256) }) {
+        std::vector<std::string> names(tags);
+        for (size_t i = 0; i < tags; i++)
+            names[i] = "DIRECTORY/TAG" + std::to_string(i);
+        run("taglist/set", std::to_string(tags), tags, 0, [&] () {
+                TGD::TagList tl;
+                for (size_t i = 0; i < tags; i++)
+                    tl.set(names[i], "value");
+                escape(&tl);
+            });
+        TGD::TagList tl;
+        for (size_t i = 0; i < tags; i++)
+            tl.set(names[i], "value");
+        run("taglist/lookup", std::to_string(tags), tags, 0, [&] () {
+                size_t found = 0;
+                for (size_t i = 0; i < tags; i++)
+                    found += tl.value(names[i]).size();
+                escape(&found);
+            });
+    }
+}
+
+/* Command line and result files */
+
+static bool parseSize(const std::string& s, size_t* size)
+{
+    char* end;
+    errno = 0;
+    unsigned long long v = std::strtoull(s.c_str(), &end, 10);
+    if (end == s.c_str() || errno != 0)
+        return false;
+    std::string suffix(end);
+    if (suffix == "K")
+        v <<= 10;
+    else if (suffix == "M")
+        v <<= 20;
+    else if (suffix == "G")
+        v <<= 30;
+    else if (!suffix.empty())
+        return false;
+    *size = v;
+    return v >= 16;
+}
+
+static bool parseOptions(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0, eq);
+        std::string value = (eq == std::string::npos ? std::string() : arg.substr(eq + 1));
+        if (name == "--sizes" && !value.empty()) {
+            options.sizes.clear();
+            size_t begin = 0;
+            for (;;) {
+                size_t comma = value.find(',', begin);
+                size_t size;
+                if (!parseSize(value.substr(begin, comma == std::string::npos ? std::string::npos : comma - begin), &size))
+                    return false;
+                options.sizes.push_back(size);
+                if (comma == std::string::npos)
+                    break;
+                begin = comma + 1;
+            }
+        } else if (name == "--filter") {
+            options.filter = value;
+        } else if (name == "--samples" && std::atoi(value.c_str()) > 0) {
+            options.samples = std::atoi(value.c_str());
+        } else if (name == "--sample-time" && std::atof(value.c_str()) > 0.0) {
+            options.sampleTime = std::atof(value.c_str());
+        } else if (name == "--parallel" && eq == std::string::npos) {
+            TGD::setDefaultExecutionPolicy(TGD::ParallelUnsequenced);
+        } else if (name == "--output" && !value.empty()) {
+            options.output = value;
+        } else if (name == "--baseline" && !value.empty()) {
+            options.baseline = value;
+        } else if (name == "--threshold" && std::atof(value.c_str()) > 0.0) {
+            options.threshold = std::atof(value.c_str());
+        } else {
+            fprintf(stderr, "bench-core: invalid option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+static const char* csvHeader = "benchmark,size,items,bytes,ns,items_per_s,gb_per_s";
+
+static void writeResults(FILE* f)
+{
+    fprintf(f, "%s\n", csvHeader);
+    for (const Result& r : results) {
+        fprintf(f, "%s,%s,%zu,%zu,%.6g,%.6g,%.6g\n", r.benchmark.c_str(), r.size.c_str(),
+                r.items, r.bytes, r.ns, r.items / r.ns * 1e9, r.bytes / r.ns);
+    }
+}
+
+/* Read benchmark,size -> ns from a file written by writeResults() */
+static bool readBaseline(const std::string& fileName, std::map<std::string, double>& baseline)
+{
+    FILE* f = std::fopen(fileName.c_str(), "r");
+    if (!f)
+        return false;
+    char line[1024];
+    while (std::fgets(line, sizeof(line), f)) {
+        std::vector<std::string> fields;
+        std::string l(line);
+        while (!l.empty() && (l.back() == '\n' || l.back() == '\r'))
+            l.pop_back();
+        if (l == csvHeader || l.empty())
+            continue;
+        size_t begin = 0;
+        for (;;) {
+            size_t comma = l.find(',', begin);
+            fields.push_back(l.substr(begin, comma == std::string::npos ? std::string::npos : comma - begin));
+            if (comma == std::string::npos)
+                break;
+            begin = comma + 1;
+        }
+        if (fields.size() >= 5)
+            baseline[fields[0] + "," + fields[1]] = std::atof(fields[4].c_str());
+    }
+    std::fclose(f);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (!parseOptions(argc, argv))
+        return 2;
+    std::map<std::string, double> baseline;
+    if (!options.baseline.empty() && !readBaseline(options.baseline, baseline)) {
+        fprintf(stderr, "bench-core: cannot read %s\n", options.baseline.c_str());
+        return 2;
+    }
+
+    for (size_t bytes : options.sizes) {
+        size_t components = bytes / sizeof(float);
+        std::string size = sizeLabel(bytes);
+        benchConvert(components, size);
+        benchForEach(components, size);
+        benchIndex(components, size);
+        benchCopy(components, size);
+        benchReorder(components, size);
+        benchBricks(components, size);
+    }
+    benchTagList();
+
+    if (options.output.empty()) {
+        writeResults(stdout);
+    } else {
+        FILE* f = std::fopen(options.output.c_str(), "w");
+        if (!f) {
+            fprintf(stderr, "bench-core: cannot write %s\n", options.output.c_str());
+            return 2;
+        }
+        writeResults(f);
+        std::fclose(f);
+    }
+
+    int regressions = 0;
+    if (!options.baseline.empty()) {
+        for (const Result& r : results) {
+            auto it = baseline.find(r.benchmark + "," + r.size);
+            if (it == baseline.end() || it->second <= 0.0)
+                continue;
+            double ratio = r.ns / it->second;
+            if (ratio > 1.0 + options.threshold) {
+                fprintf(stderr, "bench-core: regression: %s %s: %.1f ns, baseline %.1f ns (%+.1f%%)\n",
+                        r.benchmark.c_str(), r.size.c_str(), r.ns, it->second, (ratio - 1.0) * 100.0);
+                regressions++;
+            }
+        }
+        fprintf(stderr, "bench-core: %d regression(s) compared to %s\n", regressions, options.baseline.c_str());
+    }
+    return (regressions > 0 ? 1 : 0);
+}
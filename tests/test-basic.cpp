@@ -1,9 +1,15 @@
 #include <cstdio>
 #include <algorithm>
+#include <limits>
+#include <thread>
 
 #include "core/array.hpp"
 #include "core/foreach.hpp"
 #include "core/operators.hpp"
+#include "core/expressions.hpp"
+#include "core/statistics.hpp"
+#include "core/downsample.hpp"
+#include "core/dlpack.hpp"
 #include "core/io.hpp"
 
 void check_failed(const char* expr, const char* file, unsigned int line)
@@ -46,6 +52,199 @@ int main(void)
     r = convert(af, TGD::uint8);
     TGD::forEachComponent(a, r, [] (uint8_t v0, uint8_t v1) -> uint8_t { EXPECT(v0 == v1); return 0; });
 
+    TGD::Array<float> cf({ 37 }, 1);
+    for (size_t i = 0; i < cf.elementCount(); i++)
+        cf[i][0] = -70000.0f + i * 4000.0f;
+    cf[3][0] = std::numeric_limits<float>::quiet_NaN();
+    TGD::Array<uint16_t> cu16 = convert(cf, TGD::uint16);
+    TGD::Array<int16_t> ci16 = convert(cf, TGD::int16);
+    TGD::Array<uint8_t> cu8 = convert(cf, TGD::uint8);
+    TGD::Array<double> cd = convert(cf, TGD::float64);
+    for (size_t i = 0; i < cf.elementCount(); i++) {
+        float v = cf[i][0];
+        EXPECT(cu16[i][0] == (i == 3 ? 0 : v <= 0.0f ? 0 : v >= 65535.0f ? 65535 : uint16_t(v)));
+        EXPECT(ci16[i][0] == (i == 3 ? 0 : v <= -32768.0f ? -32768 : v >= 32767.0f ? 32767 : int16_t(v)));
+        EXPECT(cu8[i][0] == (i == 3 ? 0 : v <= 0.0f ? 0 : v >= 255.0f ? 255 : uint8_t(v)));
+        EXPECT(i == 3 || cd[i][0] == double(v));
+    }
+    TGD::Array<float> cn = convertNormalized(convert(ci16, TGD::int16), TGD::float32);
+    for (size_t i = 0; i < cn.elementCount(); i++)
+        EXPECT(cn[i][0] >= -1.0f && cn[i][0] <= 1.0f);
+    EXPECT(cn[0][0] == -1.0f && cn[36][0] == 1.0f);
+    TGD::Array<int16_t> cn16 = convertNormalized(cn, TGD::int16);
+    TGD::forEachComponent(ci16, cn16, [] (int16_t v0, int16_t v1) -> int16_t { EXPECT(v0 == v1); return 0; });
+
+    // Half precision types
+    EXPECT(TGD::Float16(1.0f).bits() == 0x3c00 && TGD::Float16(-2.0f).bits() == 0xc000);
+    EXPECT(TGD::Float16(65504.0f).bits() == 0x7bff && TGD::Float16(65520.0f).bits() == 0x7c00);
+    EXPECT(TGD::Float16(6e-8f).bits() == 0x0001 && TGD::Float16(1e-8f).bits() == 0x0000);
+    EXPECT(TGD::BFloat16(1.0f).bits() == 0x3f80 && TGD::BFloat16(1.00390625f).bits() == 0x3f80);
+    EXPECT(TGD::BFloat16(1.01171875f).bits() == 0x3f82);
+    TGD::Array<float> hf({ 101 }, 1);
+    for (size_t i = 0; i < hf.elementCount(); i++)
+        hf[i][0] = (i % 2 == 0 ? -1.0f : 1.0f) * std::ldexp(1.0f + (i % 7) / 7.0f, int(i % 40) - 26);
+    hf[5][0] = std::numeric_limits<float>::quiet_NaN();
+    hf[6][0] = std::numeric_limits<float>::infinity();
+    TGD::Array<TGD::Float16> hh = convert(hf, TGD::float16);
+    TGD::Array<TGD::BFloat16> hb = convert(hf, TGD::bfloat16);
+    TGD::Array<float> hfh = convert(hh, TGD::float32);
+    TGD::Array<float> hfb = convert(hb, TGD::float32);
+    for (size_t i = 0; i < hf.elementCount(); i++) {
+        float v = hf[i][0];
+        EXPECT(hh[i][0].bits() == TGD::Float16(v).bits());
+        EXPECT(hb[i][0].bits() == TGD::BFloat16(v).bits());
+        EXPECT(i == 5 ? hfh[i][0] != hfh[i][0] : hfh[i][0] == float(TGD::Float16(v)));
+        EXPECT(i == 5 ? hfb[i][0] != hfb[i][0] : hfb[i][0] == float(TGD::BFloat16(v)));
+        EXPECT(i == 5 || i == 6 || std::abs(hfb[i][0] - v) <= std::abs(v) / 256.0f);
+    }
+    TGD::Array<TGD::Float16> hn = convertNormalized(a, TGD::float16);
+    EXPECT(std::abs(hn[0][0] - 1.0f / 255.0f) < 1e-5f && hn[0][2] == TGD::Float16(3.0f / 255.0f));
+    EXPECT(TGD::statistics(TGD::ArrayView(hh))[0].nanCount == 1);
+
+    // Execution policies
+    TGD::Array<float> pa({ 1000, 300 }, 2);
+    TGD::forEachElementInplace(TGD::Parallel, pa, [] (float* element) { element[0] = 1.0f; element[1] = 2.0f; });
+    TGD::Array<float> pr = TGD::forEachComponent(TGD::Parallel, pa, pa, [] (float u, float v) -> float { return u * v + 1.0f; });
+    TGD::forEachElementInplace(pr, [] (const float* element) { EXPECT(element[0] == 2.0f); EXPECT(element[1] == 5.0f); });
+    {
+        TGD::ExecutionPolicyScope scope(TGD::ParallelUnsequenced);
+        EXPECT(TGD::defaultExecutionPolicy() == TGD::ParallelUnsequenced);
+        pr = pa + pa;
+        pr = TGD::max(TGD::Parallel, pr, 3.0f);
+    }
+    EXPECT(TGD::defaultExecutionPolicy() == TGD::Sequential);
+    TGD::forEachElementInplace(pr, [] (const float* element) { EXPECT(element[0] == 3.0f); EXPECT(element[1] == 4.0f); });
+    {
+        TGD::ThreadPool pool(3);
+        std::vector<int> counts(100000, 0);
+        pool.parallelFor(counts.size(), 16, [&] (size_t begin, size_t end) {
+                EXPECT(begin % 16 == 0);
+                for (size_t i = begin; i < end; i++)
+                    counts[i]++;
+            });
+        EXPECT(std::count(counts.begin(), counts.end(), 1) == 100000);
+        // static partitioning processes the same parts on the same threads every time
+        std::vector<std::thread::id> owners(counts.size());
+        for (int pass = 0; pass < 2; pass++) {
+            pool.parallelForStatic(counts.size(), 16, [&] (size_t begin, size_t end) {
+                    EXPECT(begin % 16 == 0);
+                    for (size_t i = begin; i < end; i++) {
+                        if (pass == 0)
+                            owners[i] = std::this_thread::get_id();
+                        else
+                            EXPECT(owners[i] == std::this_thread::get_id());
+                        counts[i]++;
+                    }
+                });
+        }
+        EXPECT(std::count(counts.begin(), counts.end(), 3) == 100000);
+        EXPECT(owners.front() == std::this_thread::get_id() && owners.back() != std::this_thread::get_id());
+    }
+
+    // Lazy expressions
+    TGD::Array<float> ea = convert(a, TGD::float32);
+    TGD::Array<float> eb = convert(b, TGD::float32);
+    TGD::Array<float> er = TGD::lazy(ea) * eb + 2.0f - TGD::max(TGD::lazy(ea), 2.0f) / ea;
+    TGD::forEachElementInplace(er, [] (const float* element) {
+            EXPECT(element[0] == 1.0f * 4.0f + 2.0f - 2.0f);
+            EXPECT(element[1] == 2.0f * 5.0f + 2.0f - 1.0f);
+            EXPECT(element[2] == 3.0f * 6.0f + 2.0f - 1.0f); });
+    er = -TGD::abs(TGD::lazy(eb) - ea);
+    TGD::forEachComponent(er, [] (float v) -> float { EXPECT(v == -3.0f); return 0.0f; });
+
+    // Reuse of temporaries
+    TGD::Array<float> tmp = ea * eb;
+    const void* tmpData = tmp.data();
+    TGD::Array<float> reused = ea - (std::move(tmp) + ea);
+    EXPECT(reused.data() == tmpData);
+    TGD::forEachElementInplace(reused, [] (const float* element) {
+            EXPECT(element[0] == -4.0f); EXPECT(element[1] == -10.0f); EXPECT(element[2] == -18.0f); });
+    TGD::Array<float> shared = reused;
+    TGD::Array<float> notReused = -std::move(reused);
+    EXPECT(notReused.data() != shared.data());
+    EXPECT(shared.get<float>(0, 0) == -4.0f && notReused.get<float>(0, 0) == 4.0f);
+    TGD::Array<float> swapped = TGD::forEachElement(std::move(notReused),
+            [] (float* dst, const float* src) { dst[0] = src[2]; dst[1] = src[1]; dst[2] = src[0]; });
+    EXPECT(swapped.get<float>(0, 0) == 18.0f && swapped.get<float>(0, 2) == 4.0f);
+    std::vector<float> extBuffer(ea.elementCount() * ea.componentCount(), 1.0f);
+    TGD::Array<float> wrapped(ea.description(), extBuffer.data());
+    TGD::Array<float> wrappedSum = std::move(wrapped) + ea;
+    EXPECT(wrappedSum.data() != extBuffer.data() && extBuffer[0] == 1.0f);
+    TGD::Array<float> wrappedNeg = -TGD::Array<float>(ea.description(), extBuffer.data(), [] (float*) {});
+    EXPECT(wrappedNeg.data() != extBuffer.data() && extBuffer[0] == 1.0f && wrappedNeg.get<float>(0, 0) == -1.0f);
+
+    // Statistics
+    TGD::Array<uint16_t> sa({ 300, 500 }, 2);
+    for (size_t e = 0; e < sa.elementCount(); e++) {
+        sa[e][0] = e % 1000;
+        sa[e][1] = 7;
+    }
+    for (TGD::ExecutionPolicy policy : { TGD::Sequential, TGD::Parallel }) {
+        std::vector<TGD::ComponentStatistics> st = TGD::statistics(policy, sa);
+        EXPECT(st.size() == 2);
+        EXPECT(st[0].count == 150000 && st[0].finiteCount == 150000);
+        EXPECT(st[0].minimum == 0.0 && st[0].maximum == 999.0);
+        EXPECT(std::abs(st[0].mean - 499.5) < 1e-9);
+        EXPECT(std::abs(st[0].variance() - (1000.0 * 1000.0 - 1.0) / 12.0 * 150000.0 / 149999.0) < 1e-6);
+        EXPECT(st[1].mean == 7.0 && st[1].variance() == 0.0);
+        std::vector<size_t> h = TGD::histogram(policy, sa, 0, 10, 0.0, 999.0);
+        EXPECT(h.size() == 10 && h[0] == 15000 && h[9] == 15000);
+        std::vector<TGD::QuantileSketch> q = TGD::quantileSketches(policy, sa);
+        EXPECT(q.size() == 2 && q[0].count() == 150000);
+        EXPECT(q[0].quantile(0.0) == 0.0 && q[0].quantile(0.5) == 499.0 && q[0].quantile(1.0) == 999.0);
+        EXPECT(q[1].quantile(0.25) == 7.0);
+    }
+    TGD::Array<float> sf({ 4, 3 }, 1);
+    for (size_t e = 0; e < sf.elementCount(); e++)
+        sf[e][0] = e;
+    sf[5][0] = std::numeric_limits<float>::infinity();
+    std::vector<TGD::ComponentStatistics> sfs = TGD::statistics(TGD::ArrayView(sf).box({ 1, 1 }, { 2, 2 }));
+    EXPECT(sfs[0].count == 4 && sfs[0].invalidCount() == 1);
+    EXPECT(sfs[0].minimum == 6.0 && sfs[0].maximum == 10.0 && std::abs(sfs[0].mean - 25.0 / 3.0) < 1e-12);
+    sf[6][0] = std::numeric_limits<float>::quiet_NaN();
+    sfs = TGD::statistics(sf);
+    EXPECT(sfs[0].nanCount == 1 && sfs[0].infCount() == 1 && sfs[0].invalidCount() == 2);
+    std::vector<TGD::QuantileSketch> sfq = TGD::quantileSketches(sf);
+    EXPECT(sfq[0].count() == 10 && sfq[0].quantile(0.0) == 0.0);
+    EXPECT(std::abs(sfq[0].quantile(1.0) - 11.0) <= 0.11);
+    TGD::QuantileSketch merged;
+    merged.add(-2.0);
+    merged.merge(sfq[0]);
+    EXPECT(merged.count() == 11 && std::abs(merged.quantile(0.0) + 2.0) <= 0.02);
+
+    // Differences
+    TGD::Array<int8_t> da({ 3 }, 1), db({ 3 }, 1);
+    da[0][0] = -128; db[0][0] = 127;
+    da[1][0] = 5;    db[1][0] = 5;
+    da[2][0] = 3;    db[2][0] = 7;
+    TGD::ArrayContainer dd;
+    TGD::DifferenceStatistics ds = TGD::differenceStatistics(da, db, &dd);
+    EXPECT(ds.count == 3 && ds.differingCount == 2 && ds.maxAbs == 255.0);
+    EXPECT(std::abs(ds.rmse() - std::sqrt((255.0 * 255.0 + 16.0) / 3.0)) < 1e-12);
+    EXPECT(dd.get<int8_t>(0, 0) == 127 && dd.get<int8_t>(1, 0) == 0 && dd.get<int8_t>(2, 0) == 4);
+    EXPECT(!TGD::equalValues(da, db) && TGD::equalValues(da, da));
+    EXPECT(TGD::differenceStatistics(da, da).psnr(255.0) == std::numeric_limits<double>::infinity());
+    TGD::Array<float> fa({ 2 }, 1), fb({ 2 }, 1);
+    fa[0][0] = 0.0f; fb[0][0] = -0.0f;
+    fa[1][0] = std::numeric_limits<float>::quiet_NaN(); fb[1][0] = fa[1][0];
+    EXPECT(TGD::equalValues(fa, fb) && TGD::differenceStatistics(fa, fb).differingCount == 0);
+    fb[1][0] = 1.0f;
+    ds = TGD::differenceStatistics(fa, fb);
+    EXPECT(!TGD::equalValues(fa, fb) && ds.differingCount == 1 && ds.nonFiniteCount == 1);
+
+    // Copy on write
+    TGD::Array<uint8_t> cowA = a.deepCopy();
+    EXPECT(cowA.isUnique());
+    const void* cowData = cowA.data();
+    cowA.detach();
+    EXPECT(cowA.data() == cowData);
+    TGD::Array<uint8_t> cowB = cowA;
+    EXPECT(!cowA.isUnique() && !cowB.isUnique());
+    cowB.mutableGet<uint8_t>(0)[0] = 99;
+    EXPECT(cowB.isUnique() && cowA.isUnique());
+    EXPECT(cowA.data() == cowData && cowB.data() != cowData);
+    EXPECT(cowA.get<uint8_t>(0, 0) == 1 && cowB.get<uint8_t>(0, 0) == 99 && cowB.get<uint8_t>(0, 1) == 2);
+
     // Iterators and the STL
     r = a.deepCopy();
     std::for_each(r.componentBegin(), r.componentEnd(), [](uint8_t& v) { v = 42; });
@@ -62,5 +261,324 @@ int main(void)
         }
     }
 
+    // Wrapping external data
+    std::vector<uint8_t> extData(17 * 19 * 3, 7);
+    bool extDataReleased = false;
+    {
+        TGD::Array<uint8_t> ext(TGD::ArrayDescription({17, 19}, 3, TGD::uint8), extData.data(),
+                [&extDataReleased] (uint8_t*) { extDataReleased = true; });
+        EXPECT(ext.data() == extData.data());
+        r = ext + a;
+        TGD::forEachComponent(r, [] (uint8_t v) -> uint8_t { EXPECT(v >= 8 && v <= 10); return 0; });
+        TGD::forEachComponentInplace(ext, [] (uint8_t v) -> uint8_t { return v + 1; });
+        EXPECT(extData[0] == 8);
+    }
+    EXPECT(extDataReleased);
+    TGD::ArrayContainer extView(TGD::ArrayDescription({17, 19}, 3, TGD::uint8), extData.data());
+    EXPECT(extView.get<uint8_t>(5, 1) == 8);
+
+    // Views
+    TGD::Array<uint16_t> va({5, 4}, 3);
+    for (size_t y = 0; y < 4; y++)
+        for (size_t x = 0; x < 5; x++)
+            for (size_t c = 0; c < 3; c++)
+                va.set<uint16_t>({ x, y }, c, x + 10 * y + 100 * c);
+    TGD::ArrayView view = TGD::ArrayView(va).box({ 1, 1 }, { 3, 2 }).components({ 2, 0 }).permuted({ 1, 0 }).reversed(1);
+    EXPECT(view.dimension(0) == 2 && view.dimension(1) == 3 && view.componentCount() == 2);
+    TGD::Array<uint16_t> vm = view.materialize();
+    EXPECT(vm.dimension(0) == 2 && vm.dimension(1) == 3 && vm.componentCount() == 2);
+    for (size_t y = 0; y < 3; y++) {
+        for (size_t x = 0; x < 2; x++) {
+            EXPECT(vm.get<uint16_t>({ x, y }, 0) == (3 - y) + 10 * (x + 1) + 200);
+            EXPECT(vm.get<uint16_t>({ x, y }, 1) == (3 - y) + 10 * (x + 1));
+        }
+    }
+    TGD::Array<float> vf = convert(view, TGD::float32);
+    EXPECT(vf.get<float>({ 1, 2 }, 0) == 1 + 20 + 200);
+    TGD::Array<uint16_t> vc = TGD::forEachComponent<uint16_t>(view, [] (uint16_t v) -> uint16_t { return v + 1; });
+    EXPECT(vc.get<uint16_t>({ 0, 0 }, 1) == 3 + 10 + 1);
+    EXPECT(TGD::ArrayView(va).materialize().data() == va.data());
+
+    // Box iteration
+    TGD::ArrayDescription boxDesc({ 4, 3, 5 }, 1, TGD::uint8);
+    size_t boxElements = 0;
+    for (TGD::BoxIterator it(boxDesc, { 1, 1, 2 }, { 2, 2, 3 }); !it.atEnd(); it.next()) {
+        EXPECT(it.linearIndex() == boxDesc.toLinearIndex(it.index()));
+        boxElements++;
+    }
+    EXPECT(boxElements == 12);
+    size_t boxRuns = 0;
+    for (TGD::BoxIterator it(boxDesc, { 0, 0, 1 }, { 4, 2, 3 }); !it.atEnd(); it.nextRun()) {
+        EXPECT(it.runLength() == 8 && it.linearIndex() == boxDesc.toLinearIndex(it.index()));
+        boxRuns++;
+    }
+    EXPECT(boxRuns == 3);
+    EXPECT(TGD::BoxIterator(boxDesc, { 0, 0, 0 }, { 0, 3, 5 }).atEnd());
+
+    // Bricked layout
+    TGD::Array<uint16_t> linear({ 9, 7, 5 }, 2);
+    for (size_t i = 0; i < linear.elementCount() * 2; i++)
+        static_cast<uint16_t*>(linear.data())[i] = i;
+    TGD::Array<uint16_t> bricked = TGD::toBricked(linear, { 4, 3, 2 });
+    EXPECT(bricked.isBricked() && !bricked.isCompatible(linear));
+    EXPECT(std::memcmp(bricked.data(), linear.data(), linear.dataSize()) != 0);
+    for (size_t z = 0; z < 5; z++)
+        for (size_t y = 0; y < 7; y++)
+            for (size_t x = 0; x < 9; x++)
+                EXPECT(bricked.get<uint16_t>({ x, y, z }, 1) == linear.get<uint16_t>({ x, y, z }, 1));
+    EXPECT(bricked[linear.toLinearIndex({ 5, 4, 3 })][0] == linear[linear.toLinearIndex({ 5, 4, 3 })][0]);
+    TGD::ArrayContainer relinear = TGD::toLinear(bricked);
+    EXPECT(!relinear.isBricked() && std::memcmp(relinear.data(), linear.data(), linear.dataSize()) == 0);
+    EXPECT(TGD::toBricked(bricked, { 4, 3, 2 }).data() == bricked.data());
+    EXPECT(!TGD::ArrayDescription(linear, { 9, 8, 5 }).isBricked());
+    TGD::ArrayContainer slice = TGD::extractBox(bricked, { 6, 0, 0 }, { 1, 7, 5 });
+    EXPECT(std::memcmp(slice.data(), TGD::ArrayView(linear).box({ 6, 0, 0 }, { 1, 7, 5 }).materialize().data(), slice.dataSize()) == 0);
+    size_t brickedElements = 0;
+    for (TGD::BoxIterator it(bricked, { 2, 1, 1 }, { 7, 5, 3 }); !it.atEnd(); it.nextRun()) {
+        EXPECT(it.runLength() <= 4 && it.get(bricked) == bricked.get<uint16_t>(it.index()));
+        brickedElements += it.runLength();
+    }
+    EXPECT(brickedElements == 7 * 5 * 3);
+    TGD::Array<float> brickedFloat = convert(bricked, TGD::float32);
+    EXPECT(brickedFloat.isBricked() && brickedFloat.get<float>({ 8, 6, 4 }, 0) == linear.get<uint16_t>({ 8, 6, 4 }, 0));
+    EXPECT(TGD::statistics(bricked)[0].maximum == TGD::statistics(linear)[0].maximum);
+    TGD::save(bricked, "tmp-bricked.tgd");
+    TGD::ArrayContainer loaded = TGD::load("tmp-bricked.tgd", TGD::TagList({ { "BRICKED", "1" } }));
+    EXPECT(loaded.brickSize() == bricked.brickSize() && std::memcmp(loaded.data(), bricked.data(), bricked.dataSize()) == 0);
+    loaded = TGD::load("tmp-bricked.tgd");
+    EXPECT(!loaded.isBricked() && std::memcmp(loaded.data(), linear.data(), linear.dataSize()) == 0);
+    std::remove("tmp-bricked.tgd");
+
+    // Stored statistics
+    TGD::save(linear, "tmp-stats.tgd", TGD::Overwrite, nullptr, TGD::TagList({ { "STATISTICS", "1" }, { "CHUNK_SIZE", "4" } }));
+    TGD::save(linear, "tmp-stats.tgd", TGD::Append);
+    {
+        TGD::Importer importer("tmp-stats.tgd");
+        TGD::ArrayDescription storedDesc;
+        std::vector<TGD::ComponentStatistics> stored;
+        std::vector<TGD::ComponentStatistics> computed = TGD::statistics(linear);
+        EXPECT(importer.readStatistics(storedDesc, stored, 0) == TGD::ErrorNone);
+        EXPECT(storedDesc.dimensions() == linear.dimensions() && stored.size() == 2);
+        EXPECT(stored[1].minimum == computed[1].minimum && stored[1].maximum == computed[1].maximum);
+        EXPECT(stored[1].finiteCount == computed[1].finiteCount && std::abs(stored[1].mean - computed[1].mean) < 1e-9);
+        EXPECT(std::abs(stored[1].variance() - computed[1].variance()) < 1e-6);
+        computed = TGD::statistics(TGD::ArrayView(linear).box({ 4, 0, 4 }, { 5, 4, 1 }));
+        EXPECT(importer.readStatistics(storedDesc, stored, 0, { 4, 0, 4 }, { 8, 4, 4 }) == TGD::ErrorNone);
+        EXPECT(stored[0].minimum == computed[0].minimum && stored[0].maximum == computed[0].maximum);
+        EXPECT(stored[0].count == 20);
+        EXPECT(importer.readStatistics(storedDesc, stored, 0, { 1, 0, 0 }, { 4, 4, 4 }) == TGD::ErrorFeaturesUnsupported);
+        // the second array is packed and was appended, so its statistics cover whole slabs
+        EXPECT(importer.readStatistics(storedDesc, stored, 1, { 0, 0, 2 }, { 9, 7, 3 }) == TGD::ErrorFeaturesUnsupported);
+        TGD::ArrayContainer next = importer.readArray();
+        EXPECT(std::memcmp(next.data(), linear.data(), linear.dataSize()) == 0);
+        EXPECT(importer.readStatistics(storedDesc, stored, 1) == TGD::ErrorNone);
+        EXPECT(stored[0].maximum == TGD::statistics(linear)[0].maximum && !importer.hasMore());
+    }
+    {
+        // packed data with several slab cells of 1 MiB, which are written one at a time
+        TGD::Array<float> slabs({ 256, 256, 8 }, 1);
+        for (size_t e = 0; e < slabs.elementCount(); e++)
+            slabs[e][0] = e;
+        TGD::save(slabs, "tmp-stats.tgd", TGD::Overwrite, nullptr, TGD::TagList({ { "STATISTICS", "1" } }));
+        TGD::Importer importer("tmp-stats.tgd");
+        TGD::ArrayContainer loaded = importer.readArray();
+        EXPECT(loaded.dataSize() == slabs.dataSize() && std::memcmp(loaded.data(), slabs.data(), slabs.dataSize()) == 0);
+        TGD::ArrayDescription storedDesc;
+        std::vector<TGD::ComponentStatistics> stored;
+        EXPECT(importer.readStatistics(storedDesc, stored, 0, { 0, 0, 4 }, { 256, 256, 4 }) == TGD::ErrorNone);
+        EXPECT(stored.size() == 1 && stored[0].minimum == 256 * 256 * 4 && stored[0].count == 256 * 256 * 4);
+        EXPECT(importer.readStatistics(storedDesc, stored, 0) == TGD::ErrorNone);
+        EXPECT(stored.size() == 1 && stored[0].maximum == 256 * 256 * 8 - 1 && stored[0].count == 256 * 256 * 8);
+    }
+    std::remove("tmp-stats.tgd");
+
+    // Descriptions without data
+    linear.componentTagList(1).set("NAME", "second");
+    TGD::save(linear, "tmp-desc.tgd");
+    TGD::save(va, "tmp-desc.tgd", TGD::Append);
+    {
+        TGD::Importer importer("tmp-desc.tgd");
+        TGD::Error e;
+        TGD::ArrayDescription d = importer.readDescription(&e);
+        EXPECT(e == TGD::ErrorNone && d.dimensions() == linear.dimensions() && d.componentType() == TGD::uint16);
+        EXPECT(d.componentTagList(1).value("NAME") == "second" && importer.hasMore());
+        TGD::ArrayContainer next = importer.readArray(&e);
+        EXPECT(e == TGD::ErrorNone && next.dimensions() == va.dimensions() && !importer.hasMore());
+        d = importer.readDescription(&e, 0);
+        EXPECT(e == TGD::ErrorNone && d.dimensions() == linear.dimensions());
+    }
+    std::remove("tmp-desc.tgd");
+
+    // Large raw data is read in parallel segments
+    {
+        TGD::Array<uint16_t> big({ 1000, 1000, 7 }, 1);
+        for (size_t e = 0; e < big.elementCount(); e++)
+            big[e][0] = e * 7919;
+        TGD::TagList rawHints({ { "FORMAT", "raw" }, { "ENDIANNESS", "big" } });
+        TGD::save(big, "tmp-big.raw", TGD::Overwrite, nullptr, rawHints);
+        TGD::save(big, "tmp-big.raw", TGD::Append, nullptr, rawHints);
+        rawHints.set("DIMENSIONS", "3");
+        rawHints.set("DIMENSION0", "1000");
+        rawHints.set("DIMENSION1", "1000");
+        rawHints.set("DIMENSION2", "7");
+        rawHints.set("TYPE", "uint16");
+        for (int direct = 0; direct <= 1; direct++) {
+            rawHints.set("DIRECT_IO", std::to_string(direct));
+            TGD::Importer importer("tmp-big.raw", rawHints);
+            TGD::Error e;
+            TGD::ArrayContainer second = importer.readArray(&e, 1);
+            EXPECT(e == TGD::ErrorNone && std::memcmp(second.data(), big.data(), big.dataSize()) == 0);
+            EXPECT(!importer.hasMore());
+            TGD::ArrayContainer first = importer.readArray(&e, 0);
+            EXPECT(e == TGD::ErrorNone && std::memcmp(first.data(), big.data(), big.dataSize()) == 0);
+            TGD::ArrayDescription slabDesc = importer.beginArray(&e);
+            TGD::ArrayContainer slab = importer.readSlab(5, &e);
+            EXPECT(e == TGD::ErrorNone && std::memcmp(slab.data(), big.data(), slab.dataSize()) == 0);
+        }
+        std::remove("tmp-big.raw");
+    }
+
+    // Batch import
+    for (size_t i = 0; i < 5; i++) {
+        TGD::Array<uint16_t> sliceArray({ 4, 3 }, 2);
+        for (size_t e = 0; e < sliceArray.elementCount(); e++)
+            sliceArray[e][0] = sliceArray[e][1] = 100 * i + e;
+        TGD::save(sliceArray, "tmp-slice-" + std::to_string(i) + ".tgd");
+    }
+    std::vector<std::string> sliceNames = TGD::BatchImporter::fileNamesFromTemplate("tmp-slice-%1N.tgd");
+    EXPECT(sliceNames.size() == 5 && sliceNames[4] == "tmp-slice-4.tgd");
+    EXPECT(TGD::BatchImporter::fileNamesFromTemplate("tmp-slice-%1N.tgd", 2).size() == 3);
+    {
+        TGD::BatchImporter batch(sliceNames, TGD::TagList(), 3);
+        TGD::Error e;
+        EXPECT(batch.hasMore(&e));
+        TGD::ArrayContainer stacked = batch.readStacked(&e);
+        EXPECT(e == TGD::ErrorNone && stacked.dimensions() == std::vector<size_t>({ 4, 3, 5 }));
+        EXPECT(stacked.get<uint16_t>({ 2, 1, 3 }, 1) == 306 && !batch.hasMore(&e) && e == TGD::ErrorNone);
+        batch.initialize(sliceNames);
+        std::vector<TGD::ArrayContainer> slices;
+        EXPECT(batch.readArrays(slices) == TGD::ErrorNone && slices.size() == 5);
+        EXPECT(std::memcmp(slices[4].data(), TGD::ArrayView(stacked).box({ 0, 0, 4 }, { 4, 3, 1 }).materialize().data(),
+                    slices[4].dataSize()) == 0);
+        // a single thread reads all files on the calling thread
+        batch.initialize(sliceNames, TGD::TagList(), 1);
+        EXPECT(batch.threadCount() == 1);
+        std::vector<std::thread::id> readers(sliceNames.size());
+        EXPECT(batch.forEach([&] (size_t i, TGD::Importer&) -> TGD::Error {
+                    readers[i] = std::this_thread::get_id();
+                    return TGD::ErrorNone;
+                }) == TGD::ErrorNone);
+        EXPECT(std::count(readers.begin(), readers.end(), std::this_thread::get_id()) == 5);
+    }
+    sliceNames.push_back("tmp-missing.tgd");
+    {
+        TGD::BatchImporter batch(sliceNames);
+        TGD::Error e;
+        EXPECT(batch.readStacked(&e).dimensionCount() == 0 && e != TGD::ErrorNone);
+    }
+    for (size_t i = 0; i < 5; i++)
+        std::remove(sliceNames[i].c_str());
+
+    // DLPack
+    DLManagedTensor* dlt = TGD::toDLPack(va);
+    EXPECT(dlt->dl_tensor.ndim == 3 && dlt->dl_tensor.data == va.data());
+    EXPECT(dlt->dl_tensor.shape[0] == 4 && dlt->dl_tensor.shape[1] == 5 && dlt->dl_tensor.shape[2] == 3);
+    EXPECT(dlt->dl_tensor.strides[0] == 15 && dlt->dl_tensor.strides[1] == 3 && dlt->dl_tensor.strides[2] == 1);
+    EXPECT(dlt->dl_tensor.dtype.code == kDLUInt && dlt->dl_tensor.dtype.bits == 16);
+    TGD::ArrayContainer fromDlt = TGD::fromDLPack(dlt);
+    EXPECT(fromDlt.data() == va.data() && fromDlt.isCompatible(va) && fromDlt.componentType() == TGD::uint16);
+    fromDlt = TGD::fromDLPack(TGD::toDLPack(va), false);
+    EXPECT(fromDlt.dimensionCount() == 3 && fromDlt.dimension(0) == 3 && fromDlt.componentCount() == 1);
+    fromDlt = TGD::ArrayContainer();
+    dlt = TGD::toDLPack(view);
+    EXPECT(dlt->dl_tensor.shape[0] == 3 && dlt->dl_tensor.shape[1] == 2 && dlt->dl_tensor.shape[2] == 2);
+    EXPECT(dlt->dl_tensor.strides[0] == -3 && dlt->dl_tensor.strides[1] == 15 && dlt->dl_tensor.strides[2] == -2);
+    fromDlt = TGD::fromDLPack(dlt);
+    EXPECT(fromDlt.data() != va.data() && std::memcmp(fromDlt.data(), vm.data(), vm.dataSize()) == 0);
+    EXPECT(!TGD::toDLPack(TGD::ArrayView(va).components({ 0, 1, 0 })));
+    bool dltReleased = false;
+    DLManagedTensor extTensor {};
+    int64_t extShape[2] = { 19, 17 };
+    extTensor.dl_tensor.data = extData.data();
+    extTensor.dl_tensor.device.device_type = kDLCPU;
+    extTensor.dl_tensor.ndim = 2;
+    extTensor.dl_tensor.dtype = TGD::typeToDLPack(TGD::uint8);
+    extTensor.dl_tensor.shape = extShape;
+    extTensor.manager_ctx = &dltReleased;
+    extTensor.deleter = [] (DLManagedTensor* self) { *static_cast<bool*>(self->manager_ctx) = true; };
+    fromDlt = TGD::fromDLPack(&extTensor, false);
+    EXPECT(fromDlt.data() == extData.data() && fromDlt.dimension(0) == 17 && fromDlt.dimension(1) == 19);
+    fromDlt = TGD::ArrayContainer();
+    EXPECT(dltReleased);
+    extTensor.dl_tensor.dtype.code = kDLComplex;
+    EXPECT(TGD::fromDLPack(&extTensor).dataSize() == 0);
+
+    // Downsampling
+    TGD::Array<uint8_t> big({ 5, 4 }, 1);
+    for (size_t i = 0; i < big.elementCount(); i++)
+        big[i][0] = i * 10;
+    TGD::Array<uint8_t> half = TGD::downsample(big, 2);
+    EXPECT(half.dimension(0) == 3 && half.dimension(1) == 2);
+    EXPECT(half[0][0] == 30 && half[1][0] == 50 && half[2][0] == 65);
+    EXPECT(half[3][0] == 130 && half[5][0] == 165);
+    TGD::Array<float> volume({ 9, 7, 13 }, 2);
+    for (size_t i = 0; i < volume.elementCount() * 2; i++)
+        static_cast<float*>(volume.data())[i] = std::sin(0.37f * i);
+    for (TGD::DownsamplingFilter filter : { TGD::BoxFilter, TGD::LanczosFilter }) {
+        TGD::Array<float> whole = TGD::downsample(volume, 3, filter);
+        EXPECT(whole.dimension(0) == 5 && whole.dimension(1) == 4 && whole.dimension(2) == 7);
+        TGD::Downsampler downsampler(volume, 3, filter);
+        for (size_t z = 0; z < 13; z += 4)
+            downsampler.addSlices(TGD::Sequential, volume.get({ 0, 0, z }), std::min(size_t(4), 13 - z));
+        EXPECT(downsampler.remainingSlices() == 0);
+        EXPECT(std::memcmp(downsampler.result().data(), whole.data(), whole.dataSize()) == 0);
+        TGD::Array<float> image = TGD::downsample(volume, 2, filter);
+        EXPECT(image.dimension(0) == 5 && image.dimension(1) == 4 && image.dimension(2) == 13);
+    }
+    TGD::Array<float> constant({ 17, 11 }, 1);
+    TGD::forEachComponentInplace(constant, [] (float) { return 0.25f; });
+    TGD::forEachComponent(TGD::Array<float>(TGD::downsample(constant, 2, TGD::LanczosFilter)),
+            [] (float v) { EXPECT(std::abs(v - 0.25f) < 1e-6f); return v; });
+
+    // Allocation
+    TGD::Array<float> zeroed(TGD::ArrayDescription({ 13, 7 }, 5, TGD::float32), TGD::ZeroInitialized);
+    EXPECT(reinterpret_cast<uintptr_t>(zeroed.data()) % TGD::Allocator::alignment == 0);
+    TGD::forEachComponent(zeroed, [] (float v) -> float { EXPECT(v == 0.0f); return 0.0f; });
+    TGD::RecyclingAllocator recycler;
+    void* recycledPtr;
+    {
+        TGD::ArrayContainer tmp(TGD::ArrayDescription({ 640, 480 }, 3, TGD::uint8), TGD::Uninitialized, &recycler);
+        recycledPtr = tmp.data();
+    }
+    TGD::Allocator::setDefaultAllocator(&recycler);
+    {
+        TGD::ArrayContainer tmp(TGD::ArrayDescription({ 640, 480 }, 3, TGD::uint8));
+        EXPECT(tmp.data() == recycledPtr);
+    }
+    TGD::Allocator::setDefaultAllocator(nullptr);
+    TGD::HugePageAllocator hugePages(size_t(1) << 20);
+    {
+        TGD::ArrayContainer huge(TGD::ArrayDescription({ 1000, 1000 }, 3, TGD::uint8), TGD::ZeroInitialized, &hugePages);
+        TGD::ArrayContainer small(TGD::ArrayDescription({ 100, 100 }, 3, TGD::uint8), TGD::ZeroInitialized, &hugePages);
+        EXPECT(reinterpret_cast<uintptr_t>(huge.data()) % TGD::Allocator::alignment == 0);
+        EXPECT(reinterpret_cast<uintptr_t>(small.data()) % TGD::Allocator::alignment == 0);
+        const uint8_t* hugeData = static_cast<const uint8_t*>(huge.data());
+        EXPECT(std::count(hugeData, hugeData + huge.dataSize(), 0) == ptrdiff_t(huge.dataSize()));
+        std::memset(huge.data(), 1, huge.dataSize());
+    }
+
+    // Tag lists
+    TGD::TagList tl0({ { "b", "2" }, { "a", "1" } });
+    tl0.set("c", "3");
+    tl0.set("a", "4");
+    TGD::TagList tl1 = tl0;
+    tl1.set("b", "5");
+    tl1.unset("c");
+    EXPECT(tl0.size() == 3 && tl0.value("a") == "4" && tl0.value("b") == "2" && tl0.value("c") == "3");
+    EXPECT(tl1.size() == 2 && tl1.value("b") == "5" && !tl1.contains("c"));
+    EXPECT(tl0.cbegin()->first == "a" && (tl0.cend() - 1)->first == "c");
+    tl1.clear();
+    EXPECT(tl1.size() == 0 && tl1.cbegin() == tl1.cend() && tl0.value("b", 0) == 2);
+
     return 0;
 }
@@ -23,6 +23,20 @@ for i in int8 uint8 int16 uint16 int32 uint32 int64 uint64 float32 float64; do
         cmp tmp-out.tgd tmp-goal.tgd
     done
 
+    echo "Reading memory-mapped"
+    ./tgd convert -i MMAP=1 tmp-in.tgd tmp-out.tgd
+    cmp tmp-in.tgd tmp-out.tgd
+
+    echo "Converting to/from chunked tgd"
+    ./tgd convert -o CHUNK_SIZE=4 tmp-in.tgd tmp-out-chunked.tgd
+    ./tgd convert tmp-out-chunked.tgd tmp-out.tgd
+    cmp tmp-in.tgd tmp-out.tgd
+    if [[ $@ == *"WITH_ZLIB"* ]]; then
+        ./tgd convert -o COMPRESSION=deflate -o CHUNK_SIZE0=3 -o CHUNK_SIZE1=5 tmp-in.tgd tmp-out-chunked.tgd
+        ./tgd convert tmp-out-chunked.tgd tmp-out.tgd
+        cmp tmp-in.tgd tmp-out.tgd
+    fi
+
     echo "Converting to/from raw"
     ./tgd convert tmp-in.tgd tmp-out.raw
     ./tgd convert -i WIDTH=7 -i HEIGHT=13 -i COMPONENTS=1 -i TYPE=$i tmp-out.raw tmp-out.tgd
@@ -33,6 +47,8 @@ for i in int8 uint8 int16 uint16 int32 uint32 int64 uint64 float32 float64; do
         ./tgd convert tmp-in.tgd tmp-out.pnm
         ./tgd convert --unset-all-tags tmp-out.pnm tmp-out.tgd
         cmp tmp-in.tgd tmp-out.tgd
+        ./tgd convert -i MMAP=1 --unset-all-tags tmp-out.pnm tmp-out.tgd
+        cmp tmp-in.tgd tmp-out.tgd
     fi
 
     if [ $i = "uint8" ]; then
@@ -55,6 +71,11 @@ for i in int8 uint8 int16 uint16 int32 uint32 int64 uint64 float32 float64; do
         ./tgd convert -o FORMAT=stb tmp-in.tgd tmp-out-stb.png
         ./tgd convert -i FORMAT=stb --unset-all-tags tmp-out-stb.png tmp-out-stb.tgd
         cmp tmp-in.tgd tmp-out-stb.tgd
+        cat tmp-out-stb.png | ./tgd convert -i FORMAT=stb --unset-all-tags - tmp-out-stb.tgd
+        cmp tmp-in.tgd tmp-out-stb.tgd
+        ./tgd convert -o FORMAT=stb -o QUALITY=100 tmp-in.tgd tmp-out-stb.jpg
+        ./tgd info tmp-out-stb.jpg | grep -q "^array 0: . x uint8, size 7x13 "
+        ! ./tgd convert -o FORMAT=stb -o QUALITY=0 tmp-in.tgd tmp-out-stb.jpg 2> /dev/null
     fi
 
     if [ $i = "float32" ]; then
@@ -96,6 +117,14 @@ for i in int8 uint8 int16 uint16 int32 uint32 int64 uint64 float32 float64; do
             ./tgd convert tmp-in.tgd tmp-out.png
             ./tgd convert --unset-all-tags tmp-out.png tmp-out.tgd
             cmp tmp-in.tgd tmp-out.tgd
+            for c in fast small none; do
+                ./tgd convert -o COMPRESSION=$c tmp-in.tgd tmp-out.png
+                ./tgd convert --unset-all-tags tmp-out.png tmp-out.tgd
+                cmp tmp-in.tgd tmp-out.tgd
+            done
+            ./tgd convert -o COMPRESSION_LEVEL=3 -o FILTER=paeth tmp-in.tgd tmp-out.png
+            ./tgd convert --unset-all-tags tmp-out.png tmp-out.tgd
+            cmp tmp-in.tgd tmp-out.tgd
         fi
     fi
 
@@ -109,6 +138,16 @@ for i in int8 uint8 int16 uint16 int32 uint32 int64 uint64 float32 float64; do
         fi
     fi
 
+    if [[ $@ == *"WITH_FFMPEG"* ]]; then
+        if [ $i = uint8 ]; then
+            echo "Converting to/from lossless video"
+            ./tgd create -n 3 -d 16,8 -c 3 -t $i tmp-in-video.tgd
+            ./tgd convert -o CODEC=ffv1 tmp-in-video.tgd tmp-out-video.mkv
+            ./tgd convert --unset-all-tags tmp-out-video.mkv tmp-out-video.tgd
+            cmp tmp-in-video.tgd tmp-out-video.tgd
+        fi
+    fi
+
     if [[ $@ == *"WITH_HDF5"* ]]; then
         echo "Converting to/from hdf5"
         ./tgd convert tmp-in.tgd tmp-out.h5
@@ -121,6 +160,9 @@ for i in int8 uint8 int16 uint16 int32 uint32 int64 uint64 float32 float64; do
         ./tgd convert tmp-in.tgd tmp-out.mat
         ./tgd convert --unset-all-tags tmp-out.mat tmp-out.tgd
         cmp tmp-in.tgd tmp-out.tgd
+        ./tgd convert -o COMPRESSION=deflate tmp-in.tgd tmp-out.mat
+        ./tgd convert --unset-all-tags tmp-out.mat tmp-out.tgd
+        cmp tmp-in.tgd tmp-out.tgd
     fi
 
     if [[ $@ == *"WITH_TIFF"* ]]; then
@@ -128,6 +170,14 @@ for i in int8 uint8 int16 uint16 int32 uint32 int64 uint64 float32 float64; do
         ./tgd convert tmp-in.tgd tmp-out.tif
         ./tgd convert tmp-out.tif tmp-out.tgd
         cmp tmp-in.tgd tmp-out.tgd
+        ./tgd convert -o TILE_SIZE=16 -o COMPRESSION=deflate tmp-in.tgd tmp-out.tif
+        ./tgd convert tmp-out.tif tmp-out.tgd
+        cmp tmp-in.tgd tmp-out.tgd
+        for c in fast small; do
+            ./tgd convert -o COMPRESSION=$c tmp-in.tgd tmp-out.tif
+            ./tgd convert tmp-out.tif tmp-out.tgd
+            cmp tmp-in.tgd tmp-out.tgd
+        done
     fi
 
     if [[ $@ == *"WITH_POPPLER"* ]]; then
@@ -142,3 +192,343 @@ for i in int8 uint8 int16 uint16 int32 uint32 int64 uint64 float32 float64; do
         fi
     fi
 done
+
+if [[ $@ == *"WITH_MUPARSER"* ]]; then
+    echo "Multithreaded calc"
+    ./tgd create -d 7,13 -c 2 -t float32 tmp-in.tgd
+    ./tgd calc tmp-in.tgd tmp-goal.tgd -e 'v0=index, v1=i0*i1'
+    ./tgd calc --threads=3 tmp-in.tgd tmp-out.tgd -e 'v0=index, v1=i0*i1'
+    cmp tmp-goal.tgd tmp-out.tgd
+    ./tgd calc --threads=20 tmp-in.tgd tmp-out.tgd -e 'v0=index, v1=i0*i1'
+    cmp tmp-goal.tgd tmp-out.tgd
+    echo "Bulk and element-wise calc"
+    ./tgd calc --element-wise tmp-in.tgd tmp-goal.tgd -e 'x=i0+1, v0=x*i1+dim0' -e 'v1=v(0,i0,dim1-1-i1,0)'
+    ./tgd calc tmp-in.tgd tmp-out.tgd -e 'x=i0+1, v0=x*i1+dim0' -e 'v1=v(0,i0,dim1-1-i1,0)'
+    cmp tmp-goal.tgd tmp-out.tgd
+    ./tgd calc --threads=3 --seed=42 tmp-in.tgd tmp-goal.tgd -e 'v0=random(), v1=gaussian()'
+    ./tgd calc --threads=3 --seed=42 tmp-in.tgd tmp-out.tgd -e 'v0=random(), v1=gaussian()'
+    cmp tmp-goal.tgd tmp-out.tgd
+fi
+
+echo "Reading csv"
+printf '1;2;3\r\n4;5;6\r\n\r\n"1.5,2",  "3,4"\n"5,6",7\n' > tmp-in.csv
+./tgd convert tmp-in.csv tmp-goal.tgd
+./tgd convert -k 1 tmp-in.csv tmp-out.tgd
+./tgd convert -k 1 tmp-goal.tgd tmp-goal-1.tgd
+cmp tmp-goal-1.tgd tmp-out.tgd
+./tgd convert -i FORMAT=csv - tmp-out.tgd < tmp-in.csv
+cmp tmp-goal.tgd tmp-out.tgd
+./tgd convert tmp-goal.tgd tmp-out.csv
+./tgd convert tmp-out.csv tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+
+echo "Writing and appending with array index"
+./tgd create -n 3 -d 7,13 -c 2 -t uint16 tmp-in.tgd
+./tgd create -n 2 -d 5,3 -c 1 -t float32 tmp-in-2.tgd
+./tgd convert -o INDEX=1 tmp-in.tgd tmp-out.tgd
+test "`tail -c 8 tmp-out.tgd`" = TGDINDEX
+./tgd convert tmp-out.tgd tmp-goal.tgd
+cmp tmp-in.tgd tmp-goal.tgd
+./tgd convert --append tmp-in-2.tgd tmp-out.tgd
+test "`tail -c 8 tmp-out.tgd`" = TGDINDEX
+./tgd convert --keep=3-4 tmp-out.tgd tmp-goal.tgd
+cmp tmp-in-2.tgd tmp-goal.tgd
+./tgd convert --append tmp-in-2.tgd tmp-in.tgd
+./tgd convert tmp-out.tgd tmp-goal.tgd
+cmp tmp-in.tgd tmp-goal.tgd
+
+echo "Stored statistics"
+# means may differ in the last digit since the stored statistics are merged per chunk
+head -c 6000 /dev/urandom > tmp-in.raw
+./tgd convert -i DIMENSIONS=2 -i DIMENSION0=40 -i DIMENSION1=50 -i COMPONENTS=3 -i TYPE=uint8 tmp-in.raw tmp-in.tgd
+./tgd convert -o STATISTICS=1 tmp-in.tgd tmp-out.tgd
+./tgd convert -o STATISTICS=1 -o CHUNK_SIZE=10 --append tmp-in.tgd tmp-out.tgd
+test "`tail -c 8 tmp-out.tgd`" = TGDINDEX
+./tgd convert tmp-in.tgd tmp-in.tgd tmp-goal.tgd
+for box in "" "-b 10,20,20,30"; do
+    ./tgd info -s $box tmp-goal.tgd | sed 's/ mean=.* invalid=/ invalid=/' > tmp-goal.txt
+    ./tgd info -s $box tmp-out.tgd | sed 's/ mean=.* invalid=/ invalid=/' > tmp-out.txt
+    cmp tmp-goal.txt tmp-out.txt
+done
+
+echo "Reading boxes"
+head -c 1092 /dev/urandom > tmp-in.raw
+./tgd convert -i DIMENSIONS=3 -i DIMENSION0=7 -i DIMENSION1=13 -i DIMENSION2=3 -i COMPONENTS=2 -i TYPE=uint8 tmp-in.raw tmp-in.tgd
+./tgd convert --box=2,3,1,4,20,2 - tmp-goal.tgd < tmp-in.tgd
+./tgd convert --box=2,3,1,4,20,2 tmp-in.tgd tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+./tgd convert -i MMAP=1 --box=2,3,1,4,20,2 tmp-in.tgd tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+./tgd convert -i DIMENSIONS=3 -i DIMENSION0=7 -i DIMENSION1=13 -i DIMENSION2=3 -i COMPONENTS=2 -i TYPE=uint8 --box=2,3,1,4,20,2 tmp-in.raw tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+./tgd convert -o CHUNK_SIZE=2 tmp-in.tgd tmp-out-chunked.tgd
+./tgd convert --box=2,3,1,4,20,2 tmp-out-chunked.tgd tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+if [[ $@ == *"WITH_HDF5"* ]]; then
+    ./tgd convert tmp-in.tgd tmp-out.h5
+    ./tgd convert --box=2,3,1,4,20,2 tmp-out.h5 tmp-out.tgd
+    cmp tmp-goal.tgd tmp-out.tgd
+    ./tgd convert -o COMPRESSION=deflate -o CHUNK_SIZE=3 tmp-in.tgd tmp-out.h5
+    ./tgd convert -i CHUNK_CACHE_SIZE=1024 --box=2,3,1,4,20,2 tmp-out.h5 tmp-out.tgd
+    cmp tmp-goal.tgd tmp-out.tgd
+fi
+
+echo "Byte order"
+printf '\001\002\003\004\005\006\007\010' > tmp-in.raw
+printf '\002\001\004\003\006\005\010\007' > tmp-goal.raw
+./tgd convert -i SIZE=4 -i TYPE=uint16 -i ENDIANNESS=big -o ENDIANNESS=little tmp-in.raw tmp-out.raw
+cmp tmp-goal.raw tmp-out.raw
+./tgd convert -i SIZE=2 -i TYPE=uint32 -i ENDIANNESS=big tmp-in.raw tmp-out.tgd
+./tgd convert -o ENDIANNESS=big tmp-out.tgd tmp-out.raw
+cmp tmp-in.raw tmp-out.raw
+./tgd convert -i SIZE=4 -i TYPE=uint16 -i ENDIANNESS=big -o ENDIANNESS=little --box=1,2 tmp-in.raw tmp-out.raw
+printf '\004\003\006\005' > tmp-goal.raw
+cmp tmp-goal.raw tmp-out.raw
+
+if [[ $@ == *"WITH_JPEG"* ]]; then
+    echo "Reduced resolution"
+    ./tgd create -d 100,60 -c 3 -t uint8 tmp-in.tgd
+    ./tgd convert tmp-in.tgd tmp-in.jpg
+    ./tgd create -d 25,15 -c 3 -t uint8 tmp-goal.tgd
+    ./tgd convert -i LEVEL=2 --unset-all-tags tmp-in.jpg tmp-out.tgd
+    cmp tmp-goal.tgd tmp-out.tgd
+    ./tgd convert -i MAXSIZE=30x20 --unset-all-tags tmp-in.jpg tmp-out.tgd
+    cmp tmp-goal.tgd tmp-out.tgd
+    ./tgd create -d 4,2 -c 3 -t uint8 tmp-goal.tgd
+    ./tgd convert -i LEVEL=5 --unset-all-tags tmp-in.jpg tmp-out.tgd
+    cmp tmp-goal.tgd tmp-out.tgd
+    ./tgd create -d 13,8 -c 3 -t uint8 tmp-goal.tgd
+    ./tgd convert -i SCALE=1/8 -i FAST=1 --unset-all-tags tmp-in.jpg tmp-out.tgd
+    cmp tmp-goal.tgd tmp-out.tgd
+    ./tgd convert -o QUALITY=100 -o SUBSAMPLING=444 -o OPTIMIZE=1 -o PROGRESSIVE=1 tmp-in.tgd tmp-out.jpg
+    ./tgd convert --unset-all-tags tmp-out.jpg tmp-out.tgd
+    ./tgd convert --unset-all-tags tmp-in.tgd tmp-goal.tgd
+    cmp tmp-goal.tgd tmp-out.tgd
+fi
+
+echo "Streaming slabs"
+head -c 3145728 /dev/urandom > tmp-in.raw
+./tgd convert -i DIMENSIONS=3 -i DIMENSION0=256 -i DIMENSION1=256 -i DIMENSION2=16 -i COMPONENTS=3 -i TYPE=uint8 tmp-in.raw tmp-in.tgd
+rm -f tmp-in2.tgd
+./tgd convert --append tmp-in.tgd tmp-in.tgd tmp-in2.tgd
+./tgd convert -k 1 --type=float32 --normalize --components=2,0,_ --global-tag=X=1 tmp-in2.tgd tmp-goal.tgd
+./tgd convert --memory-budget=1 -k 1 --type=float32 --normalize --components=2,0,_ --global-tag=X=1 tmp-in2.tgd tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+./tgd convert --threads=1 --type=float32 --components=2,0,_ tmp-in2.tgd tmp-goal-threads.tgd
+./tgd convert --threads=4 --type=float32 --components=2,0,_ tmp-in2.tgd tmp-out-threads.tgd
+cmp tmp-goal-threads.tgd tmp-out-threads.tgd
+./tgd convert --memory-budget=1 -k 1 --type=float32 --normalize --components=2,0,_ --global-tag=X=1 - tmp-out.tgd < tmp-in2.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+./tgd convert --memory-budget=1 tmp-in.tgd tmp-out.raw
+cmp tmp-in.raw tmp-out.raw
+./tgd convert --memory-budget=1 -i DIMENSIONS=3 -i DIMENSION0=256 -i DIMENSION1=256 -i DIMENSION2=16 -i COMPONENTS=3 -i TYPE=uint8 tmp-in.raw tmp-out.tgd
+cmp tmp-in.tgd tmp-out.tgd
+./tgd convert -o CHUNK_SIZE=32 --memory-budget=1 tmp-in.tgd tmp-out-chunked.tgd
+./tgd convert --memory-budget=1 tmp-out-chunked.tgd tmp-out.tgd
+cmp tmp-in.tgd tmp-out.tgd
+./tgd convert --memory-budget=1 - tmp-out.tgd < tmp-out-chunked.tgd
+cmp tmp-in.tgd tmp-out.tgd
+./tgd info -s -b 3,5,2,100,70,9 tmp-in.tgd > tmp-goal.txt
+./tgd info --memory-budget=1 -s -b 3,5,2,100,70,9 tmp-in.tgd > tmp-out.txt
+cmp tmp-goal.txt tmp-out.txt
+./tgd info -s --percentiles=1,50,99 --histogram=8,0,256 tmp-in.tgd > tmp-goal.txt
+./tgd info --memory-budget=1 -s --percentiles=1,50,99 --histogram=8,0,256 tmp-in.tgd > tmp-out.txt
+cmp tmp-goal.txt tmp-out.txt
+
+echo "Merging"
+./tgd convert --box=0,0,0,256,256,6 tmp-in.tgd tmp-in-a.tgd
+./tgd convert --box=0,0,6,256,256,10 tmp-in.tgd tmp-in-b.tgd
+./tgd convert -D 2 tmp-in-a.tgd tmp-in-b.tgd tmp-out.tgd
+cmp tmp-in.tgd tmp-out.tgd
+./tgd convert --memory-budget=1 -D 2 tmp-in-a.tgd tmp-in-b.tgd tmp-out.tgd
+cmp tmp-in.tgd tmp-out.tgd
+./tgd convert --box=0,0,0,100,256,16 tmp-in.tgd tmp-in-a.tgd
+./tgd convert --box=100,0,0,156,256,16 tmp-in.tgd tmp-in-b.tgd
+./tgd convert -D 0 tmp-in-a.tgd tmp-in-b.tgd tmp-out.tgd
+cmp tmp-in.tgd tmp-out.tgd
+./tgd convert --components=0 tmp-in.tgd tmp-in-a.tgd
+./tgd convert --components=1,2 tmp-in.tgd tmp-in-b.tgd
+./tgd convert -C tmp-in-a.tgd tmp-in-b.tgd tmp-out.tgd
+cmp tmp-in.tgd tmp-out.tgd
+head -c 196608 tmp-in.raw > tmp-in-a.raw
+tail -c +196609 tmp-in.raw | head -c 196608 > tmp-in-b.raw
+./tgd convert -i DIMENSIONS=2 -i DIMENSION0=256 -i DIMENSION1=256 -i COMPONENTS=3 -i TYPE=uint8 tmp-in-a.raw tmp-in-a.tgd
+./tgd convert -i DIMENSIONS=2 -i DIMENSION0=256 -i DIMENSION1=256 -i COMPONENTS=3 -i TYPE=uint8 tmp-in-b.raw tmp-in-b.tgd
+./tgd convert --box=0,0,0,256,256,2 tmp-in.tgd tmp-goal.tgd
+./tgd convert -D _ tmp-in-a.tgd tmp-in-b.tgd tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+./tgd convert -D _ -b 0,0,0,256,256,2 tmp-in-a.tgd tmp-in-b.tgd tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+for i in 0 1 2 3 4; do ./tgd convert --box=0,0,$i,256,256,1 --dimensions=0,1 tmp-in.tgd tmp-slice-$i.tgd; done
+./tgd convert --box=0,0,0,256,256,5 tmp-in.tgd tmp-goal.tgd
+./tgd convert --threads=3 -D _ tmp-slice-0.tgd tmp-slice-1.tgd tmp-slice-2.tgd tmp-slice-3.tgd tmp-slice-4.tgd tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+./tgd convert --threads=3 -D _ -b 0,0,0,256,256,5 tmp-slice-0.tgd tmp-slice-1.tgd tmp-slice-2.tgd tmp-slice-3.tgd tmp-slice-4.tgd tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+rm -f tmp-slice-?.tgd
+if [[ $@ == *"WITH_HDF5"* ]]; then
+    ./tgd convert tmp-in.tgd tmp-out.h5
+    ./tgd convert tmp-out.h5 tmp-goal.tgd
+    ./tgd convert --memory-budget=1 tmp-out.h5 tmp-out.tgd
+    cmp tmp-goal.tgd tmp-out.tgd
+    ./tgd convert -o COMPRESSION=deflate tmp-in.tgd tmp-out.h5
+    ./tgd convert --memory-budget=1 tmp-out.h5 tmp-out.tgd
+    cmp tmp-goal.tgd tmp-out.tgd
+fi
+
+echo "Prefetching"
+rm -f tmp-in3.tgd
+./tgd convert --append tmp-in.tgd tmp-in.tgd tmp-in.tgd tmp-in3.tgd
+./tgd convert -i PREFETCH=0 tmp-in3.tgd tmp-goal.tgd
+./tgd convert -i PREFETCH=2 tmp-in3.tgd tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+./tgd convert -i PREFETCH=2 - tmp-out.tgd < tmp-in3.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+./tgd convert -i PREFETCH=0 --box=2,3,1,4,20,2 tmp-in3.tgd tmp-goal.tgd
+./tgd convert -i PREFETCH=2 --box=2,3,1,4,20,2 tmp-in3.tgd tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+
+echo "Reusing arrays"
+./tgd create -n 3 -d 256,256,16 -c 3 -t uint8 tmp-goal.tgd
+./tgd diff -i PREFETCH=0 tmp-in3.tgd tmp-in3.tgd tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+./tgd diff -i PREFETCH=0 -i MMAP=0 tmp-in3.tgd tmp-in3.tgd tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+./tgd convert -o CHUNK_SIZE=32 tmp-in3.tgd tmp-out-chunked.tgd
+./tgd diff -i PREFETCH=0 tmp-out-chunked.tgd tmp-in3.tgd tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+
+echo "Comparing"
+./tgd diff -q tmp-out-chunked.tgd tmp-in3.tgd
+./tgd diff tmp-out-chunked.tgd tmp-in3.tgd > tmp-out.txt
+grep -q "array 2: differing=0 of 3145728 max-abs=0 rmse=0 psnr=inf" tmp-out.txt
+r=0; ./tgd diff -q tmp-goal.tgd tmp-in3.tgd || r=$?; [ $r -eq 1 ]
+r=0; ./tgd diff tmp-goal.tgd tmp-in3.tgd > tmp-out.txt || r=$?; [ $r -eq 1 ]
+grep -q "array 0: differing=[1-9]" tmp-out.txt
+r=0; ./tgd diff tmp-in3.tgd tmp-in.tgd > tmp-out.txt || r=$?; [ $r -eq 1 ]
+grep -q "array 1: only in tmp-in3.tgd" tmp-out.txt
+./tgd diff -s tmp-out-chunked.tgd tmp-in3.tgd tmp-out.tgd > tmp-out.txt
+cmp tmp-goal.tgd tmp-out.tgd
+
+echo "Writing in the background"
+./tgd convert -o ASYNC=0 tmp-in3.tgd tmp-goal.tgd
+./tgd convert -o ASYNC=3 -o FLUSH=0 tmp-in3.tgd tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+./tgd convert -o ASYNC=3 tmp-in3.tgd - | ./tgd convert - tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+./tgd convert -o CHUNK_SIZE=4 tmp-in3.tgd - | ./tgd convert - tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+./tgd create -n 2 -d 1000,700 -c 3 -t uint16 tmp-in-large.tgd
+./tgd convert tmp-in-large.tgd - | ./tgd convert - - | ./tgd convert - tmp-out.tgd
+cmp tmp-in-large.tgd tmp-out.tgd
+./tgd convert --split tmp-in3.tgd tmp-split-%N.tgd
+./tgd convert tmp-split-000000.tgd tmp-split-000001.tgd tmp-split-000002.tgd tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+if [[ -w /dev/full ]]; then
+    ! ./tgd convert -o FORMAT=tgd tmp-in3.tgd /dev/full 2> /dev/null
+fi
+
+echo "Benchmarking"
+./tgd bench -d 16,16 -c 3 -n 2 -r 2 -F tgd,raw -O write,read,convert,foreach,statistics > tmp-out.txt
+grep -q "^write *tgd " tmp-out.txt
+grep -q "^read *raw " tmp-out.txt
+grep -q "^statistics " tmp-out.txt
+./tgd bench -r 1 -F tgd -O write,read --json tmp-in3.tgd > tmp-out.txt
+grep -q '"operation": "read", "format": "tgd"' tmp-out.txt
+
+echo "Profiling"
+./tgd --profile convert tmp-in3.tgd tmp-out.tgd 2> tmp-out.txt
+cmp tmp-in3.tgd tmp-out.tgd
+grep -q "input tmp-in3.tgd (tgd): 3 array(s)" tmp-out.txt
+grep -q "output tmp-out.tgd (tgd): 3 array(s)" tmp-out.txt
+
+echo "Pyramids"
+./tgd create -d 37,20 -c 2 -t uint16 tmp-in-pyramid.tgd
+./tgd pyramid tmp-in-pyramid.tgd tmp-out.tgd
+./tgd info tmp-out.tgd > tmp-out.txt
+[ "`grep -c '^array' tmp-out.txt`" = "7" ]
+grep -q "^array 1: 2 x uint16, size 19x10 " tmp-out.txt
+grep -q "^array 6: 2 x uint16, size 1x1 " tmp-out.txt
+./tgd pyramid -f lanczos -l 3 tmp-in3.tgd tmp-goal-pyramid.tgd
+./tgd pyramid -f lanczos -l 3 --memory-budget=1 tmp-in3.tgd tmp-out-pyramid.tgd
+cmp tmp-goal-pyramid.tgd tmp-out-pyramid.tgd
+[ "`./tgd info tmp-out-pyramid.tgd | grep -c '^array'`" = "9" ]
+
+echo "Guessing formats"
+cp tmp-in3.tgd tmp-in3.dat
+./tgd convert tmp-in3.dat tmp-out.tgd
+cmp tmp-in3.tgd tmp-out.tgd
+./tgd convert tmp-in-pyramid.tgd tmp-out.pam
+cp tmp-out.pam tmp-out-pam.dat
+./tgd convert tmp-out.pam tmp-goal.tgd
+./tgd convert tmp-out-pam.dat tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+
+echo "Plain PNM"
+printf 'P2\n# comment\n3 2\n300\n1 2 3\n-4 5 99999\nP3\n2 1\n255\n1 2 3   4\n5 300\n' > tmp-in-plain.pnm
+printf 'P5\n3 2\n300\n\0\1\0\2\0\3\0\0\0\5\377\377P6\n2 1\n255\n\1\2\3\4\5\377' > tmp-in-binary.pnm
+./tgd convert tmp-in-binary.pnm tmp-goal.tgd
+./tgd convert tmp-in-plain.pnm tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+cat tmp-in-plain.pnm | ./tgd convert -i FORMAT=pnm - tmp-out.tgd
+cmp tmp-goal.tgd tmp-out.tgd
+[ "`./tgd info tmp-in-plain.pnm | grep -c '^array'`" = "2" ]
+
+echo "Batch mode"
+rm -f tmp-out.txt tmp-goal.txt
+for i in in3 in-pyramid; do
+    ./tgd info -s tmp-$i.tgd >> tmp-goal.txt
+done
+cat > tmp-in-batch.txt << 'EOF2'
+# comments and empty lines are ignored
+
+tgd info -s tmp-in3.tgd
+info -s 'tmp-in-pyramid.tgd'   # trailing comment
+EOF2
+./tgd batch tmp-in-batch.txt > tmp-out.txt
+cmp tmp-goal.txt tmp-out.txt
+./tgd batch -j 2 < tmp-in-batch.txt > tmp-out.txt
+cmp tmp-goal.txt tmp-out.txt
+echo "info nonexistent.tgd" | ./tgd batch 2> /dev/null && false
+echo "convert tmp-in3.tgd -" | ./tgd batch > /dev/null
+echo "convert tmp-in3.tgd -" | ./tgd batch -j 2 > /dev/null 2> /dev/null && false
+rm -f tmp-in-batch.txt tmp-goal.txt
+
+echo "Half precision types"
+./tgd create -d 7,13 -c 3 -t float32 tmp-in-half.tgd
+if [[ $@ == *"WITH_MUPARSER"* ]]; then
+    ./tgd calc tmp-in-half.tgd tmp-in-half-2.tgd -e 'v0=index/4, v1=-index, v2=i0*i1'
+    mv tmp-in-half-2.tgd tmp-in-half.tgd
+fi
+for i in float16 bfloat16; do
+    ./tgd convert -t $i tmp-in-half.tgd tmp-in.tgd
+    [ "`stat -c %s tmp-in.tgd`" -lt "`stat -c %s tmp-in-half.tgd`" ]
+    ./tgd convert -t float32 tmp-in.tgd tmp-out.tgd
+    cmp tmp-in-half.tgd tmp-out.tgd
+    ./tgd info -s tmp-in.tgd > tmp-out.txt
+    grep -q "3 x $i" tmp-out.txt
+    ./tgd convert tmp-in.tgd tmp-out.raw
+    ./tgd convert -i WIDTH=7 -i HEIGHT=13 -i COMPONENTS=3 -i TYPE=$i tmp-out.raw tmp-out.tgd
+    cmp tmp-in.tgd tmp-out.tgd
+    if [[ $@ == *"WITH_HDF5"* ]]; then
+        ./tgd convert tmp-in.tgd tmp-out.h5
+        ./tgd convert tmp-out.h5 tmp-out.tgd
+        cmp tmp-in.tgd tmp-out.tgd
+    fi
+    if [ $i = float16 ]; then
+        ./tgd convert -o FORMAT=tinyexr tmp-in.tgd tmp-out-tinyexr.exr
+        ./tgd convert -i FORMAT=tinyexr --unset-all-tags tmp-out-tinyexr.exr tmp-out.tgd
+        ./tgd convert --unset-all-tags tmp-in.tgd tmp-goal.tgd
+        cmp tmp-goal.tgd tmp-out.tgd
+        if [[ $@ == *"WITH_OPENEXR"* ]]; then
+            ./tgd convert tmp-in.tgd tmp-out.exr
+            ./tgd convert --unset-all-tags tmp-out.exr tmp-out.tgd
+            cmp tmp-goal.tgd tmp-out.tgd
+        fi
+        if [[ $@ == *"WITH_TIFF"* ]]; then
+            ./tgd convert tmp-in.tgd tmp-out.tif
+            ./tgd convert tmp-out.tif tmp-out.tgd
+            cmp tmp-in.tgd tmp-out.tgd
+        fi
+    fi
+done
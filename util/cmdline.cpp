@@ -23,6 +23,7 @@
  */
 
 #include <cassert>
+#include <mutex>
 #include <getopt.h>
 
 #include "cmdline.hpp"
@@ -88,9 +89,21 @@ bool CmdLine::parse(int argc, char* argv[], int minArgs, int maxArgs, std::strin
     getoptStructs.back().flag = 0;
     getoptStructs.back().val = 0;
 
+    // getopt_long() keeps its state in global variables; commands may parse
+    // their command lines concurrently when run by tgd batch
+    static std::mutex getoptMutex;
+    std::lock_guard<std::mutex> getoptLock(getoptMutex);
+
     bool error = false;
     opterr = 0;
+#if defined(__GLIBC__)
+    optind = 0; // forces full reinitialization when parsing more than once
+#else
+#  if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+    optreset = 1;
+#  endif
     optind = 1;
+#endif
     while (!error) {
         int optVal = getopt_long(argc, argv, shortOptString.c_str(), getoptStructs.data(), nullptr);
         if (optVal == -1) {
@@ -23,19 +23,31 @@
  */
 
 #include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
 #include <cstring>
 #include <cstdio>
 #include <cmath>
+#include <sys/stat.h>
 #ifdef _WIN32
 # include <fcntl.h>
 #endif
 
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #ifdef TGD_WITH_MUPARSER
-# include <chrono>
-# include <random>
+# include <atomic>
 # include <muParser.h>
 #endif
 
@@ -43,10 +55,22 @@
 #include "io.hpp"
 #include "foreach.hpp"
 #include "operators.hpp"
+#include "statistics.hpp"
+#include "downsample.hpp"
 
 #include "cmdline.hpp"
 
 
+/* Standard output of the current command. tgd batch redirects this per
+ * thread so that the output of concurrently running commands does not mix. */
+
+thread_local FILE* commandOutput = nullptr;
+
+FILE* toolOutput()
+{
+    return commandOutput ? commandOutput : stdout;
+}
+
 /* Helper functions to parse command line options */
 
 bool parseUnderscore(const std::string& value)
@@ -157,6 +181,67 @@ std::vector<size_t> getUIntUnderscoreList(const std::string& value)
     return getUIntList(value, true);
 }
 
+bool parseNumber(const std::string& value)
+{
+    if (value.length() == 0 || std::isspace(static_cast<unsigned char>(value[0])))
+        return false;
+    char* p;
+    errno = 0;
+    double v = std::strtod(value.c_str(), &p);
+    return (*p == '\0' && errno == 0 && std::isfinite(v));
+}
+
+double getNumber(const std::string& value)
+{
+    return std::strtod(value.c_str(), nullptr);
+}
+
+bool parseNumberList(const std::string& value)
+{
+    for (size_t i = 0; i <= value.length();) {
+        size_t j = value.find_first_of(',', i);
+        if (!parseNumber(value.substr(i, (j == std::string::npos ? std::string::npos : j - i))))
+            return false;
+        if (j == std::string::npos)
+            break;
+        i = j + 1;
+    }
+    return true;
+}
+
+std::vector<double> getNumberList(const std::string& value)
+{
+    std::vector<double> values;
+    for (size_t i = 0; i < value.length();) {
+        size_t j = value.find_first_of(',', i);
+        values.push_back(getNumber(value.substr(i, (j == std::string::npos ? std::string::npos : j - i))));
+        if (j == std::string::npos)
+            break;
+        i = j + 1;
+    }
+    return values;
+}
+
+bool parsePercentileList(const std::string& value)
+{
+    if (!parseNumberList(value))
+        return false;
+    std::vector<double> p = getNumberList(value);
+    for (size_t i = 0; i < p.size(); i++)
+        if (p[i] < 0.0 || p[i] > 100.0)
+            return false;
+    return true;
+}
+
+bool parseHistogram(const std::string& value)
+{
+    if (!parseNumberList(value))
+        return false;
+    std::vector<double> h = getNumberList(value);
+    return ((h.size() == 1 || (h.size() == 3 && h[1] < h[2]))
+            && h[0] >= 1.0 && h[0] == std::floor(h[0]));
+}
+
 bool parseType(const std::string& value)
 {
     TGD::Type t;
@@ -291,7 +376,7 @@ void removeValueRelatedTags(TGD::ArrayContainer& array)
 
 /* Helper function for handling boxes */
 
-std::vector<size_t> getBoxFromArray(const TGD::ArrayContainer& array)
+std::vector<size_t> getBoxFromArray(const TGD::ArrayDescription& array)
 {
     std::vector<size_t> box(array.dimensionCount() * 2);
     for (size_t i = 0; i < array.dimensionCount(); i++) {
@@ -301,7 +386,7 @@ std::vector<size_t> getBoxFromArray(const TGD::ArrayContainer& array)
     return box;
 }
 
-std::vector<size_t> restrictBoxToArray(const std::vector<size_t>& box, const TGD::ArrayContainer& array)
+std::vector<size_t> restrictBoxToArray(const std::vector<size_t>& box, const TGD::ArrayDescription& array)
 {
     std::vector<size_t> newBox(array.dimensionCount() * 2, 0);
     bool isEmpty = false;
@@ -329,42 +414,179 @@ bool boxIsEmpty(const std::vector<size_t>& box)
     return false;
 }
 
-void initBoxIndex(const std::vector<size_t>& box, std::vector<size_t>& index)
+/* Read the next array in the background while the current one is processed,
+ * unless the user chose otherwise */
+void setDefaultPrefetching(TGD::TagList& importerHints)
+{
+    if (!importerHints.contains("PREFETCH"))
+        importerHints.set("PREFETCH", "1");
+}
+
+size_t getMemoryBudget(const CmdLine& cmdLine)
+{
+    return (cmdLine.isSet("memory-budget") ? getUInt(cmdLine.value("memory-budget")) * 1024 * 1024 : 0);
+}
+
+/* Read all remaining data of an array started with importer.beginArray() */
+TGD::ArrayContainer readBegunArray(TGD::Importer& importer, const TGD::ArrayDescription& desc, TGD::Error* err)
+{
+    if (importer.remainingSlices() > 0)
+        return importer.readSlab(importer.remainingSlices(), err);
+    *err = TGD::ErrorNone;
+    return TGD::ArrayContainer(desc);
+}
+
+/* Begin to read the next array. If its data fits into the memory budget (0 means no limit),
+ * the array is read completely. Otherwise, the array is returned empty and the caller must
+ * read its slabs with importer.readSlab(). The description is set in both cases. */
+TGD::ArrayContainer readArrayWithinBudget(TGD::Importer& importer, size_t memoryBudget,
+        TGD::ArrayDescription& desc, TGD::Error* err)
+{
+    TGD::ArrayContainer array;
+    if (memoryBudget == 0) {
+        array = importer.readArray(err);
+        desc = array;
+    } else {
+        desc = importer.beginArray(err);
+        if (*err == TGD::ErrorNone && desc.dataSize() <= memoryBudget)
+            array = readBegunArray(importer, desc, err);
+    }
+    return array;
+}
+
+/* Number of slices per slab so that a few copies of a slab fit into the memory budget */
+size_t slabSliceCount(const TGD::ArrayDescription& desc, size_t memoryBudget)
 {
-    for (size_t i = 0; i < index.size(); i++)
-        index[i] = box[i];
+    size_t sliceSize = desc.dataSize() / desc.dimension(desc.dimensionCount() - 1);
+    return std::max(size_t(1), memoryBudget / 4 / sliceSize);
 }
 
-bool incBoxIndex(const std::vector<size_t>& box, std::vector<size_t>& index, size_t incDim = 0)
+/* Helper functions for merging arrays */
+
+/* Check if arrays a and b can be merged. The component counts must match unless
+ * components are merged, and dimension skipDim may differ (underscoreValue for none). */
+bool mergeCompatible(const TGD::ArrayDescription& a, const TGD::ArrayDescription& b,
+        bool sameComponentCount, size_t skipDim)
 {
-    if (index.size() == 0 || box.size() != index.size() * 2 || boxIsEmpty(box))
+    if (a.componentType() != b.componentType()
+            || a.dimensionCount() != b.dimensionCount()
+            || (sameComponentCount && a.componentCount() != b.componentCount()))
         return false;
-    size_t dimToInc = incDim;
-    while (index[dimToInc] == box[dimToInc] + box[index.size() + dimToInc] - 1) {
-        if (dimToInc == index.size() - 1)
+    for (size_t k = 0; k < a.dimensionCount(); k++)
+        if (k != skipDim && a.dimension(k) != b.dimension(k))
             return false;
-        dimToInc++;
+    return true;
+}
+
+/* Merging along dimension dim interleaves blocks that span all dimensions up to and
+ * including dim; this returns the size of such a block of the given array in bytes. */
+size_t mergeBlockSize(const TGD::ArrayDescription& desc, size_t dim)
+{
+    size_t elementsInBlock = 1;
+    for (size_t k = 0; k < desc.dimensionCount() && k <= dim; k++)
+        elementsInBlock *= desc.dimension(k);
+    return elementsInBlock * desc.elementSize();
+}
+
+/* When merging along a new dimension, the inputs other than the first are begun only
+ * when their data is needed, and must then match the first input. Returns false and
+ * prints a message on error. */
+bool beginMergeInput(std::vector<TGD::Importer>& importers, size_t j, bool appendDimension,
+        std::vector<TGD::ArrayDescription>& descs, const std::string& inputName, TGD::Error* err)
+{
+    *err = TGD::ErrorNone;
+    if (!appendDimension || j == 0)
+        return true;
+    descs[j] = importers[j].beginArray(err);
+    if (*err != TGD::ErrorNone) {
+        fprintf(stderr, "tgd convert: %s: %s\n", importers[j].fileName().c_str(), TGD::strerror(*err));
+        return false;
     }
-    index[dimToInc]++;
-    for (size_t j = 0; j < dimToInc; j++) {
-        index[j] = box[j];
+    if (!mergeCompatible(descs[0], descs[j], true, underscoreValue)) {
+        fprintf(stderr, "tgd convert: %s: incompatible input arrays\n", inputName.c_str());
+        *err = TGD::ErrorInvalidData;
+        return false;
     }
     return true;
 }
 
+/* Return an array that shares the data of a but has an additional last dimension of size 1 */
+TGD::ArrayContainer appendSliceDimension(TGD::ArrayContainer a)
+{
+    std::vector<size_t> dimensions = a.dimensions();
+    dimensions.push_back(1);
+    TGD::ArrayDescription desc(dimensions, a.componentCount(), a.componentType());
+    desc.globalTagList() = a.globalTagList();
+    for (size_t d = 0; d < a.dimensionCount(); d++)
+        desc.dimensionTagList(d) = a.dimensionTagList(d);
+    for (size_t c = 0; c < a.componentCount(); c++)
+        desc.componentTagList(c) = a.componentTagList(c);
+    return TGD::ArrayContainer(desc, a.data(), [a] (unsigned char*) {});
+}
+
+/* Begin to write an array in slabs whose description is that of the given (converted)
+ * slab except for the size of the last dimension */
+TGD::Error beginArrayInSlabs(TGD::Exporter& exporter, const TGD::ArrayContainer& slab, size_t lastDimSize)
+{
+    std::vector<size_t> outDimensions = slab.dimensions();
+    outDimensions[outDimensions.size() - 1] = lastDimSize;
+    TGD::ArrayDescription outDesc(outDimensions, slab.componentCount(), slab.componentType());
+    outDesc.globalTagList() = slab.globalTagList();
+    for (size_t d = 0; d < outDesc.dimensionCount(); d++)
+        outDesc.dimensionTagList(d) = slab.dimensionTagList(d);
+    for (size_t c = 0; c < outDesc.componentCount(); c++)
+        outDesc.componentTagList(c) = slab.componentTagList(c);
+    return exporter.beginArray(outDesc);
+}
+
+template<size_t S>
+void copyElementsStridedFixed(unsigned char* dst, size_t dstStride, const unsigned char* src, size_t begin, size_t end)
+{
+    for (size_t e = begin; e < end; e++)
+        std::memcpy(dst + e * dstStride, src + e * S, S);
+}
+
+/* Copy n contiguous elements of srcElementSize bytes from src to dst, where the
+ * elements in dst are dstStride bytes apart, e.g. to merge components */
+void copyElementsStrided(void* dst, size_t dstStride, const void* src, size_t srcElementSize, size_t n)
+{
+    unsigned char* d = static_cast<unsigned char*>(dst);
+    const unsigned char* s = static_cast<const unsigned char*>(src);
+    TGD::parallelFor(TGD::defaultExecutionPolicy(), n, 1024, [=] (size_t begin, size_t end) {
+            switch (srcElementSize) {
+            case 1:  copyElementsStridedFixed<1>(d, dstStride, s, begin, end); break;
+            case 2:  copyElementsStridedFixed<2>(d, dstStride, s, begin, end); break;
+            case 3:  copyElementsStridedFixed<3>(d, dstStride, s, begin, end); break;
+            case 4:  copyElementsStridedFixed<4>(d, dstStride, s, begin, end); break;
+            case 6:  copyElementsStridedFixed<6>(d, dstStride, s, begin, end); break;
+            case 8:  copyElementsStridedFixed<8>(d, dstStride, s, begin, end); break;
+            case 12: copyElementsStridedFixed<12>(d, dstStride, s, begin, end); break;
+            case 16: copyElementsStridedFixed<16>(d, dstStride, s, begin, end); break;
+            default:
+                for (size_t e = begin; e < end; e++)
+                    std::memcpy(d + e * dstStride, s + e * srcElementSize, srcElementSize);
+                break;
+            }
+        });
+}
+
 /* tgd commands */
 
 int tgd_help(void)
 {
     fprintf(stderr,
-            "Usage: tgd <command> [options...] [arguments...]\n"
+            "Usage: tgd [--profile] <command> [options...] [arguments...]\n"
             "Available commands:\n"
             "  create\n"
             "  convert\n"
             "  calc\n"
             "  diff\n"
+            "  pyramid\n"
             "  info\n"
-            "Use the --help option to get command-specific help.\n");
+            "  bench\n"
+            "  batch\n"
+            "Use the --help option to get command-specific help.\n"
+            "Use the --profile option to print the time spent reading and writing files.\n");
     return 0;
 }
 
@@ -397,7 +619,8 @@ int tgd_create(int argc, char* argv[])
                 "  -d|--dimensions=D0[,D1,...]  set dimensions, e.g. W,H for 2D\n"
                 "  -c|--components=C          set number of components per element\n"
                 "  -t|--type=T                set type (int8, uint8, int16, uint16, int32,\n"
-                "                             uint32, int64, uint64, float32, float64)\n"
+                "                             uint32, int64, uint64, float32, float64,\n"
+                "                             float16, bfloat16)\n"
                 "  -n|--n=N                   set number of arrays to create (default 1)\n");
         return 0;
     }
@@ -435,56 +658,300 @@ int tgd_create(int argc, char* argv[])
     return (err == TGD::ErrorNone ? 0 : 1);
 }
 
-template<typename T>
-void tgd_convert_normalize_helper_to_float(TGD::Array<T>& array, TGD::Type oldType)
-{
-    if (oldType == TGD::int8) {
-        TGD::forEachComponentInplace(array,
-                [] (T v) -> T { return (v < T(0)
-                    ? v / -std::numeric_limits<int8_t>::min()
-                    : v / std::numeric_limits<int8_t>::max()); });
-        removeValueRelatedTags(array);
-    } else if (oldType == TGD::uint8) {
-        TGD::forEachComponentInplace(array,
-                [] (T v) -> T { return v / std::numeric_limits<uint8_t>::max(); });
-        removeValueRelatedTags(array);
-    } else if (oldType == TGD::int16) {
-        TGD::forEachComponentInplace(array,
-                [] (T v) -> T { return (v < T(0)
-                    ? v / -std::numeric_limits<int16_t>::min()
-                    : v / std::numeric_limits<int16_t>::max()); });
-        removeValueRelatedTags(array);
-    } else if (oldType == TGD::uint16) {
-        TGD::forEachComponentInplace(array,
-                [] (T v) -> T { return v / std::numeric_limits<uint16_t>::max(); });
-        removeValueRelatedTags(array);
+/* Converts arrays in the thread pool while the next arrays are read, and writes
+ * them in their original order. At most depth arrays are converted at the same
+ * time. With a depth of 1, or without pool threads, each array is converted and
+ * written immediately in the calling thread. */
+class ConvertPipeline
+{
+public:
+    typedef std::function<bool (TGD::ArrayContainer&, const std::string&, const std::vector<size_t>&)> ConvertFunc;
+    typedef std::function<TGD::Error (TGD::ArrayContainer&, size_t)> WriteFunc;
+
+private:
+    struct Task
+    {
+        TGD::ArrayContainer array;
+        std::string inputName;
+        std::vector<size_t> box;
+        size_t arrayIndex;
+        bool done;
+        bool ok;
+    };
+
+    size_t _depth;
+    ConvertFunc _convert;
+    WriteFunc _write;
+    std::deque<std::shared_ptr<Task>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+
+    void wait(const Task& task)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cond.wait(lock, [&] { return task.done; });
     }
-}
 
-template<typename T>
-void tgd_convert_normalize_helper_from_float(TGD::Array<T>& array, TGD::Type newType)
-{
-    if (newType == TGD::int8) {
-        TGD::forEachComponentInplace(array,
-                [] (T v) -> T { return (v < T(0)
-                    ? v * -std::numeric_limits<int8_t>::min()
-                    : v * std::numeric_limits<int8_t>::max()); });
-        removeValueRelatedTags(array);
-    } else if (newType == TGD::uint8) {
-        TGD::forEachComponentInplace(array,
-                [] (T v) -> T { return v * std::numeric_limits<uint8_t>::max(); });
-        removeValueRelatedTags(array);
-    } else if (newType == TGD::int16) {
-        TGD::forEachComponentInplace(array,
-                [] (T v) -> T { return (v < T(0)
-                    ? v * -std::numeric_limits<int16_t>::min()
-                    : v * std::numeric_limits<int16_t>::max()); });
-        removeValueRelatedTags(array);
-    } else if (newType == TGD::uint16) {
-        TGD::forEachComponentInplace(array,
-                [] (T v) -> T { return v * std::numeric_limits<uint16_t>::max(); });
-        removeValueRelatedTags(array);
+    TGD::Error writeOldest()
+    {
+        std::shared_ptr<Task> task = _tasks.front();
+        wait(*task);
+        _tasks.pop_front();
+        return (task->ok ? _write(task->array, task->arrayIndex) : TGD::ErrorInvalidData);
+    }
+
+public:
+    ConvertPipeline(size_t depth, ConvertFunc convert, WriteFunc write) :
+        _depth(TGD::ThreadPool::instance().threadCount() > 0 ? depth : 1),
+        _convert(convert), _write(write)
+    {
+    }
+
+    ~ConvertPipeline()
+    {
+        // tasks that are not written because of an error must still finish
+        for (size_t i = 0; i < _tasks.size(); i++)
+            wait(*(_tasks[i]));
+    }
+
+    /* Convert and write the array; returns the first error of this or an earlier array */
+    TGD::Error push(TGD::ArrayContainer& array, const std::string& inputName,
+            const std::vector<size_t>& box, size_t arrayIndex)
+    {
+        if (_depth <= 1)
+            return (_convert(array, inputName, box) ? _write(array, arrayIndex) : TGD::ErrorInvalidData);
+        std::shared_ptr<Task> task = std::make_shared<Task>();
+        task->array = std::move(array);
+        task->inputName = inputName;
+        task->box = box;
+        task->arrayIndex = arrayIndex;
+        task->done = false;
+        task->ok = false;
+        _tasks.push_back(task);
+        // the worker only uses a plain pointer, so that the task and its data are always
+        // released by the calling thread, and nothing is left behind after the pipeline
+        Task* t = task.get();
+        TGD::ThreadPool::instance().submit([this, t] {
+                bool ok = _convert(t->array, t->inputName, t->box);
+                std::lock_guard<std::mutex> lock(_mutex);
+                t->ok = ok;
+                t->done = true;
+                _cond.notify_all();
+            });
+        TGD::Error e = TGD::ErrorNone;
+        while (e == TGD::ErrorNone && _tasks.size() >= _depth)
+            e = writeOldest();
+        return e;
+    }
+
+    /* Write all pending arrays */
+    TGD::Error flush()
+    {
+        TGD::Error e = TGD::ErrorNone;
+        while (e == TGD::ErrorNone && _tasks.size() > 0)
+            e = writeOldest();
+        return e;
+    }
+};
+
+/* Apply the box, dimension, component, type and tag options of tgd convert to the
+ * array. Prints an error message and returns false on failure. */
+static bool tgd_convert_array(TGD::ArrayContainer& array, const std::string& inputName, const CmdLine& cmdLine,
+        const std::vector<size_t>& box, const std::vector<size_t>& dimensions,
+        const std::vector<size_t>& components, TGD::Type type)
+{
+    // Box, dimension and component selection work on a view of the
+    // array, so that only the selected data is copied in the end.
+    TGD::ArrayView view(array);
+    if (box.size() > 0) {
+        if (box.size() != array.dimensionCount() * 2) {
+            fprintf(stderr, "tgd convert: %s: box does not match dimensions\n", inputName.c_str());
+            return false;
+        }
+        std::vector<size_t> localBox = restrictBoxToArray(box, array);
+        if (boxIsEmpty(localBox)) {
+            fprintf(stderr, "tgd convert: %s: empty box\n", inputName.c_str());
+            return false;
+        }
+        view = view.box(
+                std::vector<size_t>(localBox.begin(), localBox.begin() + array.dimensionCount()),
+                std::vector<size_t>(localBox.begin() + array.dimensionCount(), localBox.end()));
+    }
+    if (cmdLine.isSet("dimensions")) {
+        bool valid = true;
+        for (size_t i = 0; i < dimensions.size(); i++) {
+            if (dimensions[i] != underscoreValue && dimensions[i] >= view.dimensionCount()) {
+                fprintf(stderr, "tgd convert: %s: no dimension %zu\n", inputName.c_str(), dimensions[i]);
+                valid = false;
+                break;
+            }
+        }
+        if (!valid)
+            return false;
+        bool isPermutation = (dimensions.size() == view.dimensionCount());
+        for (size_t i = 0; i < dimensions.size(); i++)
+            if (dimensions[i] == underscoreValue)
+                isPermutation = false;
+        if (isPermutation) {
+            view = view.permuted(dimensions);
+        } else {
+            array = view.materialize();
+            std::vector<size_t> dimensionsNew(dimensions.size());
+            std::vector<size_t> srcIndexMap(array.dimensionCount(), underscoreValue);
+            for (size_t i = 0; i < dimensions.size(); i++) {
+                if (dimensions[i] == underscoreValue) {
+                    dimensionsNew[i] = 1;
+                } else {
+                    dimensionsNew[i] = array.dimension(dimensions[i]);
+                    srcIndexMap[dimensions[i]] = i;
+                }
+            }
+            TGD::ArrayContainer arrayNew(dimensionsNew, array.componentCount(), array.componentType());
+            std::vector<size_t> srcIndex(array.dimensionCount());
+            std::vector<size_t> dstIndex(arrayNew.dimensionCount());
+            for (size_t e = 0; e < arrayNew.elementCount(); e++) {
+                void* dst = arrayNew.get(e);
+                arrayNew.toVectorIndex(e, dstIndex.data());
+                for (size_t i = 0; i < srcIndex.size(); i++)
+                    srcIndex[i] = (srcIndexMap[i] == underscoreValue ? 0 : dstIndex[srcIndexMap[i]]);
+                void* src = array.get(srcIndex);
+                std::memcpy(dst, src, array.elementSize());
+            }
+            arrayNew.globalTagList() = array.globalTagList();
+            for (size_t i = 0; i < arrayNew.dimensionCount(); i++)
+                if (dimensions[i] != underscoreValue)
+                    arrayNew.dimensionTagList(i) = array.dimensionTagList(dimensions[i]);
+            for (size_t i = 0; i < arrayNew.componentCount(); i++)
+                arrayNew.componentTagList(i) = array.componentTagList(i);
+            array = arrayNew;
+            view = TGD::ArrayView(array);
+        }
+    }
+    if (cmdLine.isSet("components")) {
+        bool valid = true;
+        for (size_t i = 0; i < components.size(); i++) {
+            if (components[i] != underscoreValue && components[i] >= view.componentCount()) {
+                fprintf(stderr, "tgd convert: %s: no component %zu\n", inputName.c_str(), components[i]);
+                valid = false;
+                break;
+            }
+        }
+        if (!valid)
+            return false;
+        bool isSelection = true;
+        for (size_t i = 0; i < components.size(); i++)
+            if (components[i] == underscoreValue)
+                isSelection = false;
+        if (isSelection) {
+            view = view.components(components);
+        } else {
+            array = view.materialize();
+            TGD::ArrayContainer arrayNew(array.dimensions(), components.size(), array.componentType());
+            for (size_t i = 0; i < components.size(); i++) {
+                for (size_t e = 0; e < array.elementCount(); e++) {
+                    unsigned char* dst = reinterpret_cast<unsigned char*>(arrayNew.get(e));
+                    dst += i * array.componentSize();
+                    if (components[i] == underscoreValue) {
+                        std::memset(dst, 0, array.componentSize());
+                    } else {
+                        assert(components[i] < array.componentCount());
+                        const unsigned char* src = reinterpret_cast<const unsigned char*>(array.get(e));
+                        src += components[i] * array.componentSize();
+                        std::memcpy(dst, src, array.componentSize());
+                    }
+                }
+            }
+            arrayNew.globalTagList() = array.globalTagList();
+            for (size_t i = 0; i < array.dimensionCount(); i++)
+                arrayNew.dimensionTagList(i) = array.dimensionTagList(i);
+            for (size_t i = 0; i < arrayNew.componentCount(); i++)
+                if (components[i] != underscoreValue)
+                    arrayNew.componentTagList(i) = array.componentTagList(components[i]);
+            array = arrayNew;
+            view = TGD::ArrayView(array);
+        }
+    }
+    array = view.materialize();
+    if (cmdLine.isSet("type")) {
+        if (cmdLine.isSet("normalize")) {
+            bool normalized;
+            array = convertNormalized(array, type, &normalized);
+            if (normalized)
+                removeValueRelatedTags(array);
+        } else {
+            array = convert(array, type);
+        }
+    }
+    for (size_t o = 0; o < cmdLine.orderedOptionNames().size(); o++) {
+        const std::string& optName = cmdLine.orderedOptionNames()[o];
+        const std::string& optVal = cmdLine.orderedOptionValues()[o];
+        if (optName == "unset-all-tags") {
+            array.globalTagList().clear();
+            for (size_t d = 0; d < array.dimensionCount(); d++)
+                array.dimensionTagList(d).clear();
+            for (size_t c = 0; c < array.componentCount(); c++)
+                array.componentTagList(c).clear();
+        } else if (optName == "global-tag") {
+            std::string n, v;
+            getNameAndValue(optVal, &n, &v);
+            array.globalTagList().set(n, v);
+        } else if (optName == "unset-global-tag") {
+            array.globalTagList().unset(optVal);
+        } else if (optName == "unset-global-tags") {
+            array.globalTagList().clear();
+        } else if (optName == "dimension-tag") {
+            size_t d;
+            std::string n, v;
+            getUIntAndNameAndValue(optVal, &d, &n, &v);
+            if (d >= array.dimensionCount()) {
+                fprintf(stderr, "tgd convert: %s: no such dimension %zu\n", inputName.c_str(), d);
+                return false;
+            }
+            array.dimensionTagList(d).set(n, v);
+        } else if (optName == "unset-dimension-tag") {
+            size_t d;
+            std::string n;
+            getUIntAndName(optVal, &d, &n);
+            if (d >= array.dimensionCount()) {
+                fprintf(stderr, "tgd convert: %s: no such dimension %zu\n", inputName.c_str(), d);
+                return false;
+            }
+            array.dimensionTagList(d).unset(n);
+        } else if (optName == "unset-dimension-tags") {
+            size_t d = getUInt(optVal);
+            if (d >= array.dimensionCount()) {
+                fprintf(stderr, "tgd convert: %s: no such dimension %zu\n", inputName.c_str(), d);
+                return false;
+            }
+            array.dimensionTagList(d).clear();
+        } else if (optName == "component-tag") {
+            size_t c;
+            std::string n, v;
+            getUIntAndNameAndValue(optVal, &c, &n, &v);
+            if (c >= array.componentCount()) {
+                fprintf(stderr, "tgd convert: %s: no such component %zu\n", inputName.c_str(), c);
+                return false;
+            }
+            array.componentTagList(c).set(n, v);
+        } else if (optName == "unset-component-tag") {
+            size_t c;
+            std::string n;
+            getUIntAndName(optVal, &c, &n);
+            if (c >= array.componentCount()) {
+                fprintf(stderr, "tgd convert: %s: no such component %zu\n", inputName.c_str(), c);
+                return false;
+            }
+            array.componentTagList(c).unset(n);
+        } else if (optName == "unset-component-tags") {
+            size_t c = getUInt(optVal);
+            if (c >= array.componentCount()) {
+                fprintf(stderr, "tgd convert: %s: no such component %zu\n", inputName.c_str(), c);
+                return false;
+            }
+            array.componentTagList(c).clear();
+        }
     }
+    return true;
 }
 
 int tgd_convert(int argc, char* argv[])
@@ -513,6 +980,8 @@ int tgd_convert(int argc, char* argv[])
     cmdLine.addOrderedOptionWithArg("component-tag", 0, parseUIntAndNameAndValue);
     cmdLine.addOrderedOptionWithArg("unset-component-tag", 0, parseUIntAndName);
     cmdLine.addOrderedOptionWithArg("unset-component-tags", 0, parseUInt);
+    cmdLine.addOptionWithArg("memory-budget", 0, parseUIntLargerThanZero);
+    cmdLine.addOptionWithArg("threads", 0, parseUInt);
     std::string errMsg;
     if (!cmdLine.parse(argc, argv, 2, -1, errMsg)) {
         fprintf(stderr, "tgd convert: %s\n", errMsg.c_str());
@@ -547,7 +1016,8 @@ int tgd_convert(int argc, char* argv[])
                 "                             given order; the special entry _ will create a new\n"
                 "                             component initialized to zero\n"
                 "  -t|--type=T                convert to new type (int8, uint8, int16, uint16,\n"
-                "                             int32, uint32, int64, uint64, float32, float64)\n"
+                "                             int32, uint32, int64, uint64, float32, float64,\n"
+                "                             float16, bfloat16)\n"
                 "  -n|--normalize             create/assume floating point values in [-1,1]/[0,1]\n"
                 "                             when converting to/from signed/unsigned integers\n"
                 "  --unset-all-tags           unset all tags\n"
@@ -559,7 +1029,13 @@ int tgd_convert(int argc, char* argv[])
                 "  --unset-dimension-tags=D   unset all tags of dimension D\n"
                 "  --component-tag=C,N=V      set tag N of component C to value V\n"
                 "  --unset-component-tag=C,N  unset tag N of component C\n"
-                "  --unset-component-tags=C   unset all tags of component C\n");
+                "  --unset-component-tags=C   unset all tags of component C\n"
+                "  --memory-budget=MIB        process arrays with more data in slabs along the\n"
+                "                             last dimension (not with -C, -d, and only with\n"
+                "                             -D for the last dimension)\n"
+                "  --threads=N                convert up to N arrays at the same time while the\n"
+                "                             next arrays are read; output order is kept\n"
+                "                             (default 0: one per hardware thread)\n");
         return 0;
     }
     if (cmdLine.isSet("keep") && cmdLine.isSet("drop")) {
@@ -630,7 +1106,12 @@ int tgd_convert(int argc, char* argv[])
     size_t splitTemplateLastIndex = 0;
     size_t splitTemplateFieldWidth = 0;
     std::string outFileName;
-    TGD::Exporter exporter;
+    // Write in the background while the next array is processed; with --split,
+    // several files are written at the same time
+    if (!exporterHints.contains("ASYNC"))
+        exporterHints.set("ASYNC", "1");
+    std::vector<TGD::Exporter> exporters(cmdLine.isSet("split")
+            ? std::max(1u, std::thread::hardware_concurrency()) : 1);
     if (cmdLine.isSet("split")) {
         splitTemplate = cmdLine.arguments()[cmdLine.arguments().size() - 1];
         splitTemplateFirstIndex = splitTemplate.find_first_of('%');
@@ -645,14 +1126,65 @@ int tgd_convert(int argc, char* argv[])
         splitTemplateFieldWidth = (l == 0 ? 6 : getUInt(splitTemplate.substr(splitTemplateFirstIndex + 1, l)));
     } else {
         outFileName = cmdLine.arguments()[cmdLine.arguments().size() - 1];
-        exporter.initialize(outFileName, cmdLine.isSet("append") ? TGD::Append : TGD::Overwrite, exporterHints);
+        exporters[0].initialize(outFileName, cmdLine.isSet("append") ? TGD::Append : TGD::Overwrite, exporterHints);
     }
 
+    // Slabs along the last dimension can be converted independently unless
+    // dimensions are rearranged
+    size_t memoryBudget = (cmdLine.isSet("dimensions") ? 0 : getMemoryBudget(cmdLine));
+    // Prefetching would read complete arrays even if only a box or slabs are needed,
+    // and merges read their inputs one at a time to keep only one of them in memory
+    if (memoryBudget == 0 && box.size() == 0 && !mergeComponents && !mergeDimension)
+        setDefaultPrefetching(importerHints);
+    // Merges along the last dimension, or along a new one, write each input
+    // to the output in slabs instead of assembling the merged array in memory
+    bool appendDimension = (mergeDimension && mergeDimensionArg == underscoreValue);
+    bool mergeInSlabs = (mergeDimension && box.size() == 0 && !cmdLine.isSet("dimensions"));
+
+    // With --split, each output file is initialized just before its array is written
+    auto prepareExporter = [&] (size_t index) -> TGD::Error {
+        TGD::Exporter& exporter = exporters[index % exporters.size()];
+        if (cmdLine.isSet("split")) {
+            // report errors of the previous file of this exporter
+            TGD::Error e = exporter.finish();
+            if (e != TGD::ErrorNone) {
+                fprintf(stderr, "tgd convert: %s: %s\n", exporter.fileName().c_str(), TGD::strerror(e));
+                return e;
+            }
+            std::string arrayIndexString = std::to_string(index);
+            outFileName = splitTemplate.substr(0, splitTemplateFirstIndex);
+            if (arrayIndexString.length() < splitTemplateFieldWidth)
+                outFileName += std::string(splitTemplateFieldWidth - arrayIndexString.length(), '0');
+            outFileName += arrayIndexString;
+            outFileName += splitTemplate.substr(splitTemplateLastIndex + 1);
+            exporter.initialize(outFileName, cmdLine.isSet("append") ? TGD::Append : TGD::Overwrite, exporterHints);
+        }
+        return TGD::ErrorNone;
+    };
+    size_t threadCount = TGD::ThreadPool::instance().threadCount() + 1;
+    if (cmdLine.isSet("threads") && getUInt(cmdLine.value("threads")) > 0)
+        threadCount = getUInt(cmdLine.value("threads"));
+    ConvertPipeline pipeline(threadCount,
+            [&] (TGD::ArrayContainer& a, const std::string& name, const std::vector<size_t>& b) -> bool {
+                return tgd_convert_array(a, name, cmdLine, b, dimensions, components, type);
+            },
+            [&] (TGD::ArrayContainer& a, size_t index) -> TGD::Error {
+                TGD::Error e = prepareExporter(index);
+                if (e == TGD::ErrorNone) {
+                    TGD::Exporter& exporter = exporters[index % exporters.size()];
+                    e = exporter.writeArray(a);
+                    if (e != TGD::ErrorNone)
+                        fprintf(stderr, "tgd convert: %s: %s\n", exporter.fileName().c_str(), TGD::strerror(e));
+                }
+                return e;
+            });
+
     TGD::Error err = TGD::ErrorNone;
     size_t arrayIndex = 0;
-    std::vector<TGD::Importer> importers(cmdLine.arguments().size() - 1);
-    for (size_t i = 0; i < importers.size(); i++)
-        importers[i].initialize(cmdLine.arguments()[i], importerHints);
+    // Merges read their inputs in parallel
+    TGD::BatchImporter batchImporter(std::vector<std::string>(cmdLine.arguments().begin(), cmdLine.arguments().end() - 1),
+            importerHints, cmdLine.isSet("threads") ? getUInt(cmdLine.value("threads")) : 0);
+    std::vector<TGD::Importer>& importers = batchImporter.importers();
     bool loopOverInputArgs = !mergeComponents && !mergeDimension;
     for (size_t i = 0; i < (loopOverInputArgs ? importers.size() : 1); i++) {
         for (;;) {
@@ -663,132 +1195,123 @@ int tgd_convert(int argc, char* argv[])
                 break;
             }
             TGD::ArrayContainer array;
+            TGD::ArrayDescription desc;
+            bool streamed = false;
             std::string inputName;
+            bool boxIsApplied = false;
+            std::vector<TGD::ArrayDescription> mergeDescs;
+            bool mergeStreamed = false;
             if (!mergeComponents && !mergeDimension) {
-                array = importers[i].readArray(&err);
+                if (box.size() > 0 && box.size() % 2 == 0) {
+                    // read only the box if the file format supports it
+                    array = importers[i].readArray(&err, -1,
+                            std::vector<size_t>(box.begin(), box.begin() + box.size() / 2),
+                            std::vector<size_t>(box.begin() + box.size() / 2, box.end()));
+                    boxIsApplied = true;
+                } else {
+                    array = readArrayWithinBudget(importers[i], memoryBudget, desc, &err);
+                    streamed = (err == TGD::ErrorNone && importers[i].remainingSlices() > 0);
+                }
                 if (err != TGD::ErrorNone) {
                     fprintf(stderr, "tgd convert: %s: %s\n", importers[i].fileName().c_str(), TGD::strerror(err));
                     break;
                 }
                 inputName = importers[i].fileName() + std::string(" array ") + std::to_string(arrayIndex);
             } else {
-                std::vector<TGD::ArrayContainer> arrays(importers.size());
-                for (size_t j = 0; j < importers.size(); j++) {
-                    arrays[j] = importers[j].readArray(&err);
-                    if (err != TGD::ErrorNone) {
-                        fprintf(stderr, "tgd convert: %s: %s\n", importers[j].fileName().c_str(), TGD::strerror(err));
+                // Begin to read the inputs one at a time; formats that can read slabs only
+                // read the description here. With a new dimension, all inputs must match the
+                // first one, so the others are begun only when their data is needed.
+                inputName = std::string("merged array ") + std::to_string(arrayIndex);
+                mergeDescs.resize(importers.size());
+                err = batchImporter.forEach([&] (size_t j, TGD::Importer& importer) -> TGD::Error {
+                        TGD::Error e = TGD::ErrorNone;
+                        mergeDescs[j] = importer.beginArray(&e);
+                        if (e != TGD::ErrorNone)
+                            fprintf(stderr, "tgd convert: %s: %s\n", importer.fileName().c_str(), TGD::strerror(e));
+                        return e;
+                    }, 0, appendDimension ? 1 : importers.size());
+                if (err != TGD::ErrorNone)
+                    break;
+                const TGD::ArrayDescription& first = mergeDescs[0];
+                if (mergeDimension && !appendDimension && mergeDimensionArg >= first.dimensionCount()) {
+                    fprintf(stderr, "tgd convert: %s: no dimension %zu\n", inputName.c_str(), mergeDimensionArg);
+                    err = TGD::ErrorInvalidData;
+                    break;
+                }
+                bool compatible = true;
+                for (size_t j = 1; j < (appendDimension ? 1 : importers.size()); j++) {
+                    if (!mergeCompatible(first, mergeDescs[j], mergeDimension, mergeComponents ? underscoreValue : mergeDimensionArg)) {
+                        compatible = false;
                         break;
                     }
                 }
-                if (err != TGD::ErrorNone)
+                if (!compatible) {
+                    fprintf(stderr, "tgd convert: %s: incompatible input arrays\n", inputName.c_str());
+                    err = TGD::ErrorInvalidData;
                     break;
-                inputName = std::string("merged array ") + std::to_string(arrayIndex);
+                }
+                std::vector<size_t> mergedDimensions = first.dimensions();
+                size_t mergedComponentCount = first.componentCount();
+                if (mergeComponents) {
+                    for (size_t j = 1; j < importers.size(); j++)
+                        mergedComponentCount += mergeDescs[j].componentCount();
+                } else if (appendDimension) {
+                    mergedDimensions.push_back(importers.size());
+                } else {
+                    for (size_t j = 1; j < importers.size(); j++)
+                        mergedDimensions[mergeDimensionArg] += mergeDescs[j].dimension(mergeDimensionArg);
+                }
+                desc = TGD::ArrayDescription(mergedDimensions, mergedComponentCount, first.componentType());
+                desc.globalTagList() = first.globalTagList();
+                for (size_t j = 0; j < first.dimensionCount(); j++)
+                    desc.dimensionTagList(j) = first.dimensionTagList(j);
                 if (mergeComponents) {
-                    size_t componentCount = 0;
-                    bool compatible = true;
-                    for (size_t j = 1; j < importers.size(); j++) {
-                        if (arrays[j].componentType() != arrays[0].componentType()
-                                || arrays[j].dimensionCount() != arrays[0].dimensionCount()) {
-                            compatible = false;
-                            break;
-                        }
-                        for (size_t k = 0; k < arrays[0].dimensionCount(); k++) {
-                            if (arrays[j].dimension(k) != arrays[0].dimension(k)) {
-                                compatible = false;
-                                break;
-                            }
-                        }
-                        if (!compatible)
-                            break;
-                        componentCount += arrays[j].componentCount();
-                    }
-                    if (!compatible) {
-                        fprintf(stderr, "tgd convert: %s: incompatible input arrays\n", inputName.c_str());
-                        err = TGD::ErrorInvalidData;
-                        break;
-                    }
-                    array = TGD::ArrayContainer(arrays[0].dimensions(), componentCount, arrays[0].componentType());
-                    for (size_t e = 0; e < array.elementCount(); e++) {
-                        unsigned char* dst = static_cast<unsigned char*>(array.get(e));
-                        for (size_t j = 0; j < arrays.size(); j++) {
-                            const unsigned char* src = static_cast<const unsigned char*>(arrays[j].get(e));
-                            std::memcpy(dst, src, arrays[j].elementSize());
-                            dst += arrays[j].elementSize();
-                        }
-                    }
-                    array.globalTagList() = arrays[0].globalTagList();
-                    for (size_t j = 0; j < array.dimensionCount(); j++)
-                        array.dimensionTagList(j) = arrays[0].dimensionTagList(j);
                     size_t componentIndex = 0;
-                    for (size_t j = 0; j < arrays.size(); j++)
-                        for (size_t k = 0; k < arrays[j].componentCount(); k++)
-                            array.componentTagList(componentIndex++) = arrays[j].componentTagList(k);
-                } else { // mergeDimension
-                    bool compatible = true;
-                    if (mergeDimensionArg != underscoreValue && mergeDimensionArg >= arrays[0].dimensionCount()) {
-                        fprintf(stderr, "tgd convert: %s: no dimension %zu\n", inputName.c_str(), mergeDimensionArg);
-                        err = TGD::ErrorInvalidData;
-                        break;
+                    for (size_t j = 0; j < importers.size(); j++)
+                        for (size_t k = 0; k < mergeDescs[j].componentCount(); k++)
+                            desc.componentTagList(componentIndex++) = mergeDescs[j].componentTagList(k);
+                } else {
+                    for (size_t j = 0; j < desc.componentCount(); j++)
+                        desc.componentTagList(j) = first.componentTagList(j);
+                }
+                mergeStreamed = (mergeInSlabs && desc.dataSize() > 0
+                        && (appendDimension || mergeDimensionArg == first.dimensionCount() - 1));
+                if (!mergeStreamed) {
+                    // copy the data of each input into the merged array
+                    array = TGD::ArrayContainer(desc);
+                    size_t blockSizeSum = 0;
+                    if (mergeDimension) {
+                        for (size_t j = 0; j < importers.size(); j++)
+                            blockSizeSum += mergeBlockSize(appendDimension ? first : mergeDescs[j], mergeDimensionArg);
                     }
+                    // each input is copied to its own offset, so that they can be read in parallel
+                    std::vector<size_t> dstOffsets(importers.size(), 0);
                     for (size_t j = 1; j < importers.size(); j++) {
-                        if (arrays[j].componentType() != arrays[0].componentType()
-                                || arrays[j].componentCount() != arrays[0].componentCount()
-                                || arrays[j].dimensionCount() != arrays[0].dimensionCount()) {
-                            compatible = false;
-                            break;
-                        }
-                        for (size_t k = 0; k < arrays[0].dimensionCount(); k++) {
-                            if (k == mergeDimension)
-                                continue;
-                            if (arrays[j].dimension(k) != arrays[0].dimension(k)) {
-                                compatible = false;
-                                break;
-                            }
-                        }
-                        if (!compatible)
-                            break;
+                        dstOffsets[j] = dstOffsets[j - 1] + (mergeComponents ? mergeDescs[j - 1].elementSize()
+                                : mergeBlockSize(appendDimension ? first : mergeDescs[j - 1], mergeDimensionArg));
                     }
-                    if (!compatible) {
-                        fprintf(stderr, "tgd convert: %s: incompatible input arrays\n", inputName.c_str());
-                        err = TGD::ErrorInvalidData;
+                    err = batchImporter.forEach([&] (size_t j, TGD::Importer& importer) -> TGD::Error {
+                            TGD::Error e;
+                            if (!beginMergeInput(importers, j, appendDimension, mergeDescs, inputName, &e))
+                                return e;
+                            TGD::ArrayContainer input = readBegunArray(importer, mergeDescs[j], &e);
+                            if (e != TGD::ErrorNone) {
+                                fprintf(stderr, "tgd convert: %s: %s\n", importer.fileName().c_str(), TGD::strerror(e));
+                                return e;
+                            }
+                            unsigned char* dst = static_cast<unsigned char*>(array.data()) + dstOffsets[j];
+                            if (mergeComponents) {
+                                copyElementsStrided(dst, array.elementSize(), input.data(), input.elementSize(), input.elementCount());
+                            } else {
+                                size_t blockSize = mergeBlockSize(input, mergeDimensionArg);
+                                const unsigned char* src = static_cast<const unsigned char*>(input.data());
+                                for (size_t block = 0; block * blockSize < input.dataSize(); block++)
+                                    std::memcpy(dst + block * blockSizeSum, src + block * blockSize, blockSize);
+                            }
+                            return TGD::ErrorNone;
+                        });
+                    if (err != TGD::ErrorNone)
                         break;
-                    }
-                    std::vector<size_t> dimensions = arrays[0].dimensions();
-                    if (mergeDimensionArg == underscoreValue) {
-                        dimensions.push_back(arrays.size());
-                    } else {
-                        for (size_t j = 1; j < arrays.size(); j++)
-                            dimensions[mergeDimensionArg] += arrays[j].dimension(mergeDimensionArg);
-                    }
-                    array = TGD::ArrayContainer(dimensions, arrays[0].componentCount(), arrays[0].componentType());
-
-                    std::vector<size_t> blockSizes(arrays.size(), 0);
-                    size_t blockSizeSum = 0;
-                    for (size_t j = 0; j < arrays.size(); j++) {
-                        size_t elementsInBlock = 1;
-                        for (size_t k = 0; k < array.dimensionCount(); k++) {
-                            if (k < arrays[j].dimensionCount())
-                                elementsInBlock *= arrays[j].dimension(k);
-                            if (k == mergeDimensionArg)
-                                break;
-                        }
-                        blockSizes[j] = elementsInBlock * array.elementSize();
-                        blockSizeSum += blockSizes[j];
-                    }
-                    unsigned char* dst = static_cast<unsigned char*>(array.data());
-                    for (size_t block = 0; block * blockSizeSum < array.dataSize(); block++) {
-                        for (size_t j = 0; j < arrays.size(); j++) {
-                            const unsigned char* src = static_cast<const unsigned char*>(arrays[j].data()) + block * blockSizes[j];
-                            std::memcpy(dst, src, blockSizes[j]);
-                            dst += blockSizes[j];
-                        }
-                    }
-
-                    array.globalTagList() = arrays[0].globalTagList();
-                    for (size_t j = 0; j < arrays[0].dimensionCount(); j++)
-                        array.dimensionTagList(j) = arrays[0].dimensionTagList(j);
-                    for (size_t j = 0; j < array.componentCount(); j++)
-                        array.componentTagList(j) = arrays[0].componentTagList(j);
                 }
             }
             bool keep = true;
@@ -809,236 +1332,130 @@ int tgd_convert(int argc, char* argv[])
                 }
             }
             if (keep) {
-                if (box.size() > 0) {
-                    if (box.size() != array.dimensionCount() * 2) {
-                        fprintf(stderr, "tgd convert: %s: box does not match dimensions\n", inputName.c_str());
-                        err = TGD::ErrorInvalidData;
+                if (!mergeStreamed && !streamed) {
+                    err = pipeline.push(array, inputName, boxIsApplied ? std::vector<size_t>() : box, arrayIndex);
+                    if (err != TGD::ErrorNone)
                         break;
-                    }
-                    std::vector<size_t> localBox = restrictBoxToArray(box, array);
-                    if (boxIsEmpty(localBox)) {
-                        fprintf(stderr, "tgd convert: %s: empty box\n", inputName.c_str());
-                        err = TGD::ErrorInvalidData;
-                        break;
-                    }
-                    TGD::ArrayContainer arrayBox(
-                            std::vector<size_t>(localBox.begin() + array.dimensionCount(), localBox.end()),
-                            array.componentCount(), array.componentType());
-                    std::vector<size_t> arrayIndex(array.dimensionCount());
-                    std::vector<size_t> boxIndex(array.dimensionCount());
-                    initBoxIndex(localBox, arrayIndex);
-                    size_t lowestDimBoxSize = localBox[array.dimensionCount()];
-                    for (;;) {
-                        for (size_t i = 0; i < array.dimensionCount(); i++)
-                            boxIndex[i] = arrayIndex[i] - localBox[i];
-                        std::memcpy(arrayBox.get(boxIndex), array.get(arrayIndex),
-                                lowestDimBoxSize * array.elementSize());
-                        if (!incBoxIndex(localBox, arrayIndex, 1))
-                            break;
-                    }
-                    arrayBox.globalTagList() = array.globalTagList();
-                    for (size_t i = 0; i < array.dimensionCount(); i++)
-                        arrayBox.dimensionTagList(i) = array.dimensionTagList(i);
-                    for (size_t i = 0; i < array.componentCount(); i++)
-                        arrayBox.componentTagList(i) = array.componentTagList(i);
-                    array = arrayBox;
-                }
-                if (cmdLine.isSet("dimensions")) {
-                    bool valid = true;
-                    for (size_t i = 0; i < dimensions.size(); i++) {
-                        if (dimensions[i] != underscoreValue && dimensions[i] >= array.dimensionCount()) {
-                            fprintf(stderr, "tgd convert: %s: no dimension %zu\n", inputName.c_str(), dimensions[i]);
-                            err = TGD::ErrorInvalidData;
-                            valid = false;
-                            break;
-                        }
-                    }
-                    if (!valid)
+                } else {
+                    // slabs are written directly, after all arrays before this one
+                    err = pipeline.flush();
+                    if (err == TGD::ErrorNone)
+                        err = prepareExporter(arrayIndex);
+                    if (err != TGD::ErrorNone)
                         break;
-                    std::vector<size_t> dimensionsNew(dimensions.size());
-                    std::vector<size_t> srcIndexMap(array.dimensionCount(), underscoreValue);
-                    for (size_t i = 0; i < dimensions.size(); i++) {
-                        if (dimensions[i] == underscoreValue) {
-                            dimensionsNew[i] = 1;
+                    TGD::Exporter& exporter = exporters[arrayIndex % exporters.size()];
+                    if (mergeStreamed) {
+                        size_t lastDim = desc.dimensionCount() - 1;
+                        bool beginArray = true;
+                        auto writeMergedSlab = [&] (TGD::ArrayContainer& slab) -> TGD::Error {
+                            if (!tgd_convert_array(slab, inputName, cmdLine, box, dimensions, components, type))
+                                return TGD::ErrorInvalidData;
+                            TGD::Error e = TGD::ErrorNone;
+                            if (beginArray) {
+                                e = beginArrayInSlabs(exporter, slab, desc.dimension(lastDim));
+                                beginArray = false;
+                            }
+                            if (e == TGD::ErrorNone)
+                                e = exporter.writeSlab(slab);
+                            if (e != TGD::ErrorNone)
+                                fprintf(stderr, "tgd convert: %s: %s\n", exporter.fileName().c_str(), TGD::strerror(e));
+                            return e;
+                        };
+                        if (appendDimension) {
+                            // a new dimension needs complete inputs since each is one slice of the output;
+                            // read as many of them in parallel as there are threads, and write them in order
+                            size_t groupSize = batchImporter.threadCount();
+                            std::vector<TGD::ArrayContainer> inputs(groupSize);
+                            for (size_t g = 0; g < importers.size(); g += groupSize) {
+                                err = batchImporter.forEach([&] (size_t j, TGD::Importer& importer) -> TGD::Error {
+                                        TGD::Error e;
+                                        if (!beginMergeInput(importers, j, appendDimension, mergeDescs, inputName, &e))
+                                            return e;
+                                        inputs[j - g] = readBegunArray(importer, mergeDescs[j], &e);
+                                        if (e != TGD::ErrorNone)
+                                            fprintf(stderr, "tgd convert: %s: %s\n", importer.fileName().c_str(), TGD::strerror(e));
+                                        return e;
+                                    }, g, groupSize);
+                                for (size_t j = g; err == TGD::ErrorNone && j < std::min(g + groupSize, importers.size()); j++) {
+                                    TGD::ArrayContainer slab = appendSliceDimension(inputs[j - g]);
+                                    inputs[j - g] = TGD::ArrayContainer();
+                                    err = writeMergedSlab(slab);
+                                }
+                                if (err != TGD::ErrorNone)
+                                    break;
+                            }
                         } else {
-                            dimensionsNew[i] = array.dimension(dimensions[i]);
-                            srcIndexMap[dimensions[i]] = i;
+                            for (size_t j = 0; j < importers.size(); j++) {
+                                size_t sliceCount = (memoryBudget > 0
+                                        ? slabSliceCount(mergeDescs[j], memoryBudget) : importers[j].remainingSlices());
+                                while (importers[j].remainingSlices() > 0) {
+                                    TGD::ArrayContainer slab = importers[j].readSlab(sliceCount, &err);
+                                    if (err != TGD::ErrorNone) {
+                                        fprintf(stderr, "tgd convert: %s: %s\n", importers[j].fileName().c_str(), TGD::strerror(err));
+                                        break;
+                                    }
+                                    err = writeMergedSlab(slab);
+                                    if (err != TGD::ErrorNone)
+                                        break;
+                                }
+                                if (err != TGD::ErrorNone)
+                                    break;
+                            }
                         }
-                    }
-                    TGD::ArrayContainer arrayNew(dimensionsNew, array.componentCount(), array.componentType());
-                    std::vector<size_t> srcIndex(array.dimensionCount());
-                    std::vector<size_t> dstIndex(arrayNew.dimensionCount());
-                    for (size_t e = 0; e < arrayNew.elementCount(); e++) {
-                        void* dst = arrayNew.get(e);
-                        arrayNew.toVectorIndex(e, dstIndex.data());
-                        for (size_t i = 0; i < srcIndex.size(); i++)
-                            srcIndex[i] = (srcIndexMap[i] == underscoreValue ? 0 : dstIndex[srcIndexMap[i]]);
-                        void* src = array.get(srcIndex);
-                        std::memcpy(dst, src, array.elementSize());
-                    }
-                    arrayNew.globalTagList() = array.globalTagList();
-                    for (size_t i = 0; i < arrayNew.dimensionCount(); i++)
-                        if (dimensions[i] != underscoreValue)
-                            arrayNew.dimensionTagList(i) = array.dimensionTagList(dimensions[i]);
-                    for (size_t i = 0; i < arrayNew.componentCount(); i++)
-                        arrayNew.componentTagList(i) = array.componentTagList(i);
-                    array = arrayNew;
-                }
-                if (cmdLine.isSet("components")) {
-                    bool valid = true;
-                    for (size_t i = 0; i < components.size(); i++) {
-                        if (components[i] != underscoreValue && components[i] >= array.componentCount()) {
-                            fprintf(stderr, "tgd convert: %s: no component %zu\n", inputName.c_str(), components[i]);
-                            err = TGD::ErrorInvalidData;
-                            valid = false;
+                        if (err != TGD::ErrorNone)
                             break;
-                        }
-                    }
-                    if (!valid)
-                        break;
-                    TGD::ArrayContainer arrayNew(array.dimensions(), components.size(), array.componentType());
-                    for (size_t i = 0; i < components.size(); i++) {
-                        for (size_t e = 0; e < array.elementCount(); e++) {
-                            unsigned char* dst = reinterpret_cast<unsigned char*>(arrayNew.get(e));
-                            dst += i * array.componentSize();
-                            if (components[i] == underscoreValue) {
-                                std::memset(dst, 0, array.componentSize());
-                            } else {
-                                assert(components[i] < array.componentCount());
-                                const unsigned char* src = reinterpret_cast<const unsigned char*>(array.get(e));
-                                src += components[i] * array.componentSize();
-                                std::memcpy(dst, src, array.componentSize());
+                    } else if (streamed) {
+                        size_t lastDim = desc.dimensionCount() - 1;
+                        size_t sliceCount = slabSliceCount(desc, memoryBudget);
+                        bool beginArray = true;
+                        while (importers[i].remainingSlices() > 0) {
+                            TGD::ArrayContainer slab = importers[i].readSlab(sliceCount, &err);
+                            if (err != TGD::ErrorNone) {
+                                fprintf(stderr, "tgd convert: %s: %s\n", importers[i].fileName().c_str(), TGD::strerror(err));
+                                break;
                             }
-                        }
-                    }
-                    arrayNew.globalTagList() = array.globalTagList();
-                    for (size_t i = 0; i < array.dimensionCount(); i++)
-                        arrayNew.dimensionTagList(i) = array.dimensionTagList(i);
-                    for (size_t i = 0; i < arrayNew.componentCount(); i++)
-                        if (components[i] != underscoreValue)
-                            arrayNew.componentTagList(i) = array.componentTagList(components[i]);
-                    array = arrayNew;
-                }
-                if (cmdLine.isSet("type")) {
-                    TGD::Type oldType = array.componentType();
-                    if (cmdLine.isSet("normalize")) {
-                        if (type == TGD::float32) {
-                            array = convert(array, type);
-                            TGD::Array<float> floatArray(array);
-                            tgd_convert_normalize_helper_to_float<float>(floatArray, oldType);
-                        } else if (type == TGD::float64) {
-                            array = convert(array, type);
-                            TGD::Array<double> doubleArray(array);
-                            tgd_convert_normalize_helper_to_float<double>(doubleArray, oldType);
-                        } else if (oldType == TGD::float32) {
-                            if (type == TGD::int8 || type == TGD::uint8 || type == TGD::int16 || type == TGD::uint16) {
-                                TGD::Array<float> floatArray(array);
-                                tgd_convert_normalize_helper_from_float<float>(floatArray, type);
+                            if (!tgd_convert_array(slab, inputName, cmdLine, box, dimensions, components, type)) {
+                                err = TGD::ErrorInvalidData;
+                                break;
+                            }
+                            if (beginArray) {
+                                err = beginArrayInSlabs(exporter, slab, desc.dimension(lastDim));
+                                beginArray = false;
                             }
-                            array = convert(array, type);
-                        } else if (oldType == TGD::float64) {
-                            if (type == TGD::int8 || type == TGD::uint8 || type == TGD::int16 || type == TGD::uint16) {
-                                TGD::Array<double> doubleArray(array);
-                                tgd_convert_normalize_helper_from_float<double>(doubleArray, type);
+                            if (err == TGD::ErrorNone)
+                                err = exporter.writeSlab(slab);
+                            if (err != TGD::ErrorNone) {
+                                fprintf(stderr, "tgd convert: %s: %s\n", exporter.fileName().c_str(), TGD::strerror(err));
+                                break;
                             }
-                            array = convert(array, type);
                         }
-                    } else {
-                        array = convert(array, type);
+                        if (err != TGD::ErrorNone)
+                            break;
                     }
                 }
-                for (size_t o = 0; o < cmdLine.orderedOptionNames().size(); o++) {
-                    const std::string& optName = cmdLine.orderedOptionNames()[o];
-                    const std::string& optVal = cmdLine.orderedOptionValues()[o];
-                    if (optName == "unset-all-tags") {
-                        array.globalTagList().clear();
-                        for (size_t d = 0; d < array.dimensionCount(); d++)
-                            array.dimensionTagList(d).clear();
-                        for (size_t c = 0; c < array.componentCount(); c++)
-                            array.componentTagList(c).clear();
-                    } else if (optName == "global-tag") {
-                        std::string n, v;
-                        getNameAndValue(optVal, &n, &v);
-                        array.globalTagList().set(n, v);
-                    } else if (optName == "unset-global-tag") {
-                        array.globalTagList().unset(optVal);
-                    } else if (optName == "unset-global-tags") {
-                        array.globalTagList().clear();
-                    } else if (optName == "dimension-tag") {
-                        size_t d;
-                        std::string n, v;
-                        getUIntAndNameAndValue(optVal, &d, &n, &v);
-                        if (d >= array.dimensionCount()) {
-                            fprintf(stderr, "tgd convert: %s: no such dimension %zu\n", inputName.c_str(), d);
-                            err = TGD::ErrorInvalidData;
-                            break;
-                        }
-                        array.dimensionTagList(d).set(n, v);
-                    } else if (optName == "unset-dimension-tag") {
-                        size_t d;
-                        std::string n;
-                        getUIntAndName(optVal, &d, &n);
-                        if (d >= array.dimensionCount()) {
-                            fprintf(stderr, "tgd convert: %s: no such dimension %zu\n", inputName.c_str(), d);
-                            err = TGD::ErrorInvalidData;
-                            break;
-                        }
-                        array.dimensionTagList(d).unset(n);
-                    } else if (optName == "unset-dimension-tags") {
-                        size_t d = getUInt(optVal);
-                        if (d >= array.dimensionCount()) {
-                            fprintf(stderr, "tgd convert: %s: no such dimension %zu\n", inputName.c_str(), d);
-                            err = TGD::ErrorInvalidData;
-                            break;
-                        }
-                        array.dimensionTagList(d).clear();
-                    } else if (optName == "component-tag") {
-                        size_t c;
-                        std::string n, v;
-                        getUIntAndNameAndValue(optVal, &c, &n, &v);
-                        if (c >= array.componentCount()) {
-                            fprintf(stderr, "tgd convert: %s: no such component %zu\n", inputName.c_str(), c);
-                            err = TGD::ErrorInvalidData;
-                            break;
-                        }
-                        array.componentTagList(c).set(n, v);
-                    } else if (optName == "unset-component-tag") {
-                        size_t c;
-                        std::string n;
-                        getUIntAndName(optVal, &c, &n);
-                        if (c >= array.componentCount()) {
-                            fprintf(stderr, "tgd convert: %s: no such component %zu\n", inputName.c_str(), c);
-                            err = TGD::ErrorInvalidData;
-                            break;
-                        }
-                        array.componentTagList(c).unset(n);
-                    } else if (optName == "unset-component-tags") {
-                        size_t c = getUInt(optVal);
-                        if (c >= array.componentCount()) {
-                            fprintf(stderr, "tgd convert: %s: no such component %zu\n", inputName.c_str(), c);
-                            err = TGD::ErrorInvalidData;
-                            break;
-                        }
-                        array.componentTagList(c).clear();
+            } else {
+                // skip the inputs of a dropped merged array
+                for (size_t j = 0; mergeStreamed && j < importers.size(); j++) {
+                    if (!beginMergeInput(importers, j, appendDimension, mergeDescs, inputName, &err))
+                        break;
+                    readBegunArray(importers[j], mergeDescs[j], &err);
+                    if (err != TGD::ErrorNone) {
+                        fprintf(stderr, "tgd convert: %s: %s\n", importers[j].fileName().c_str(), TGD::strerror(err));
+                        break;
                     }
                 }
-                if (err != TGD::ErrorNone) {
+                if (err != TGD::ErrorNone)
                     break;
+                // skip the slabs of a dropped array
+                while (streamed && importers[i].remainingSlices() > 0) {
+                    importers[i].readSlab(slabSliceCount(desc, memoryBudget), &err);
+                    if (err != TGD::ErrorNone) {
+                        fprintf(stderr, "tgd convert: %s: %s\n", importers[i].fileName().c_str(), TGD::strerror(err));
+                        break;
+                    }
                 }
-                if (cmdLine.isSet("split")) {
-                    std::string arrayIndexString = std::to_string(arrayIndex);
-                    outFileName = splitTemplate.substr(0, splitTemplateFirstIndex);
-                    if (arrayIndexString.length() < splitTemplateFieldWidth)
-                        outFileName += std::string(splitTemplateFieldWidth - arrayIndexString.length(), '0');
-                    outFileName += arrayIndexString;
-                    outFileName += splitTemplate.substr(splitTemplateLastIndex + 1);
-                    exporter.initialize(outFileName, cmdLine.isSet("append") ? TGD::Append : TGD::Overwrite, exporterHints);
-                }
-                err = exporter.writeArray(array);
-                if (err != TGD::ErrorNone) {
-                    fprintf(stderr, "tgd convert: %s: %s\n", outFileName.c_str(), TGD::strerror(err));
+                if (err != TGD::ErrorNone)
                     break;
-                }
             }
             arrayIndex++;
         }
@@ -1047,12 +1464,34 @@ int tgd_convert(int argc, char* argv[])
         }
     }
 
+    if (err == TGD::ErrorNone)
+        err = pipeline.flush();
+    for (size_t i = 0; i < exporters.size(); i++) {
+        TGD::Error e = exporters[i].finish();
+        if (e != TGD::ErrorNone && err == TGD::ErrorNone) {
+            fprintf(stderr, "tgd convert: %s: %s\n", exporters[i].fileName().c_str(), TGD::strerror(e));
+            err = e;
+        }
+    }
+
     return (err == TGD::ErrorNone ? 0 : 1);
 }
 
 #ifdef TGD_WITH_MUPARSER
 class Calc;
-Calc* calcSingleton;
+// the muParser callbacks have no user data, so they find the calculator that
+// currently evaluates in this thread here
+thread_local Calc* calcSingleton;
+
+// the state that all calculators of one tgd calc command share
+struct CalcState
+{
+    // the input arrays
+    std::vector<TGD::ArrayContainer> input_arrays;
+    // report only the first evaluation error of all calculators
+    std::mutex errorMutex;
+    bool errorReported = false;
+};
 
 class Calc
 {
@@ -1066,24 +1505,33 @@ private:
     const std::vector<std::string>& expressions;
     // the parsers
     std::vector<mu::Parser> parsers;
+    // the shared state and its input arrays
+    CalcState& state;
+    const std::vector<TGD::ArrayContainer>& input_arrays;
+    // index of the box part that this calculator works on when multithreaded
+    size_t worker;
     // user-defined variable management
     size_t expressionIndex;
-    std::vector<std::vector<std::pair<std::string, std::unique_ptr<double>>>> added_vars;
+    std::vector<std::vector<std::pair<std::string, std::unique_ptr<double[]>>>> added_vars;
     // pseudo-random numbers
     std::mt19937_64 prng;
     std::uniform_real_distribution<double> uniform_distrib;
     std::normal_distribution<double> gaussian_distrib;
-    // variables
-    double var_array_count;
-    double var_stream_index;
-    double var_dimensions;
-    std::vector<double> var_dim;
-    double var_components;
-    std::vector<double> var_box;
-    std::vector<double> var_boxdim;
-    double var_index;
-    std::vector<double> var_i;
-    std::vector<double> var_v;
+    // variables; in bulk evaluation, muParser reads and writes the values of
+    // element k of a bulk at offset k from the variable address, so each
+    // variable has bulkSize values
+    size_t bulkSize;
+    std::vector<double> var_array_count;
+    std::vector<double> var_stream_index;
+    std::vector<double> var_dimensions;
+    std::vector<std::vector<double>> var_dim;
+    std::vector<double> var_components;
+    std::vector<std::vector<double>> var_box;
+    std::vector<std::vector<double>> var_boxdim;
+    std::vector<double> var_index;
+    std::vector<std::vector<double>> var_i;
+    std::vector<std::vector<double>> var_v;
+    std::vector<double> results;
 
     static constexpr double pi = 3.1415926535897932384626433832795029;
     static constexpr double e = 2.7182818284590452353602874713526625;
@@ -1121,7 +1569,9 @@ private:
 
     static double unary_plus(double x) { return x; }
 
-    static double seed(double x) { calcSingleton->prng.seed(x); return 0.0; }
+    // each worker gets its own reproducible sequence for a given seed; worker 0
+    // behaves like the single-threaded calculator
+    static double seed(double x) { calcSingleton->setSeed(x); return 0.0; }
     static double random() { return calcSingleton->uniform_distrib(calcSingleton->prng); }
     static double gaussian() { return calcSingleton->gaussian_distrib(calcSingleton->prng); }
 
@@ -1129,47 +1579,16 @@ private:
     {
         size_t expressionIndex = *reinterpret_cast<size_t*>(expressionIndexVoid);
         calcSingleton->added_vars[expressionIndex].push_back(std::make_pair(
-                    std::string(name), std::unique_ptr<double>(new double(0.0))));
+                    std::string(name), std::unique_ptr<double[]>(new double[calcSingleton->bulkSize]())));
         return calcSingleton->added_vars[expressionIndex].back().second.get();
     }
 
     static double input_value(size_t a, size_t e, size_t c)
     {
         const std::vector<TGD::ArrayContainer>& input_arrays = calcSingleton->input_arrays;
-        double v = std::numeric_limits<double>::quiet_NaN();
-        switch (input_arrays[a].componentType()) {
-        case TGD::int8:
-            v = input_arrays[a].get<int8_t>(e)[c];
-            break;
-        case TGD::uint8:
-            v = input_arrays[a].get<uint8_t>(e)[c];
-            break;
-        case TGD::int16:
-            v = input_arrays[a].get<int16_t>(e)[c];
-            break;
-        case TGD::uint16:
-            v = input_arrays[a].get<uint16_t>(e)[c];
-            break;
-        case TGD::int32:
-            v = input_arrays[a].get<int32_t>(e)[c];
-            break;
-        case TGD::uint32:
-            v = input_arrays[a].get<uint32_t>(e)[c];
-            break;
-        case TGD::int64:
-            v = input_arrays[a].get<int64_t>(e)[c];
-            break;
-        case TGD::uint64:
-            v = input_arrays[a].get<uint64_t>(e)[c];
-            break;
-        case TGD::float32:
-            v = input_arrays[a].get<float>(e)[c];
-            break;
-        case TGD::float64:
-            v = input_arrays[a].get<double>(e)[c];
-            break;
-        }
-        return v;
+        return TGD::visitType(input_arrays[a].componentType(), [&] (auto tag) {
+                return double(input_arrays[a].get<typename decltype(tag)::type>(e)[c]);
+            });
     }
 
     static double v(const double* dx, int n)
@@ -1261,33 +1680,64 @@ private:
             linearIndex = input_arrays[a].toLinearIndex(index);
         }
 
-        std::vector<double>& var_v = calcSingleton->var_v;
+        // copy() is only used with element-wise evaluation, so only the first value is set
+        std::vector<std::vector<double>>& var_v = calcSingleton->var_v;
         for (size_t c = 0; c < var_v.size(); c++) {
             double v = std::numeric_limits<double>::quiet_NaN();
             if (c < input_arrays[a].componentCount())
                 v = input_value(a, linearIndex, c);
-            var_v[c] = v;
+            var_v[c][0] = v;
         }
         return 0.0;
     }
 
 public:
-    // input arrays
-    std::vector<TGD::ArrayContainer> input_arrays;
+    // Returns whether the expressions can be evaluated for many elements at once.
+    // This is not the case if functions with side effects are used: copy() sets
+    // the output variables itself, and the random number functions would be
+    // called from the threads that muParser may use for bulk evaluation.
+    static bool bulkEvaluationPossible(const std::vector<std::string>& expressions)
+    {
+        const char* functions[] = { "copy", "seed", "random", "gaussian" };
+        for (size_t i = 0; i < expressions.size(); i++) {
+            const std::string& expr = expressions[i];
+            for (const char* f : functions) {
+                size_t len = std::strlen(f);
+                for (size_t pos = expr.find(f); pos != std::string::npos; pos = expr.find(f, pos + 1)) {
+                    size_t end = pos + len;
+                    bool boundary = (pos == 0 || !(std::isalnum(static_cast<unsigned char>(expr[pos - 1])) || expr[pos - 1] == '_'));
+                    while (end < expr.size() && std::isspace(static_cast<unsigned char>(expr[end])))
+                        end++;
+                    if (boundary && end < expr.size() && expr[end] == '(')
+                        return false;
+                }
+            }
+        }
+        return true;
+    }
 
-    // constructor
-    Calc(const std::vector<std::string>& expressions, size_t inputCount) :
+    // constructor; bulkSize is the maximum number of elements to evaluate at once
+    Calc(const std::vector<std::string>& expressions, CalcState& state, size_t worker = 0, size_t bulkSize = 1) :
         expressions(expressions),
         parsers(expressions.size()),
+        state(state),
+        input_arrays(state.input_arrays),
+        worker(worker),
         added_vars(expressions.size()),
         uniform_distrib(0.0, 1.0),
         gaussian_distrib(0.0, 1.0),
-        var_dim(maxDimensionCount),
-        var_box(maxDimensionCount),
-        var_boxdim(maxDimensionCount),
-        var_i(maxDimensionCount),
-        var_v(maxComponentCount),
-        input_arrays(inputCount)
+        bulkSize(bulkSize),
+        var_array_count(bulkSize),
+        var_stream_index(bulkSize),
+        var_dimensions(bulkSize),
+        var_dim(maxDimensionCount, std::vector<double>(bulkSize)),
+        var_components(bulkSize),
+        var_box(maxDimensionCount, std::vector<double>(bulkSize)),
+        var_boxdim(maxDimensionCount, std::vector<double>(bulkSize)),
+        var_index(bulkSize),
+        var_i(maxDimensionCount, std::vector<double>(bulkSize)),
+        var_v(maxComponentCount, std::vector<double>(bulkSize)),
+        results(bulkSize)
     {
         calcSingleton = this;
         for (size_t i = 0; i < parsers.size(); i++) {
@@ -1322,72 +1772,91 @@ public:
             parsers[i].DefineFun("v", v);
             parsers[i].DefineFun("copy", copy);
             // input-dependent variables
-            parsers[i].DefineVar("array_count", &var_array_count);
-            parsers[i].DefineVar("stream_index", &var_stream_index);
-            parsers[i].DefineVar("dimensions", &var_dimensions);
+            parsers[i].DefineVar("array_count", var_array_count.data());
+            parsers[i].DefineVar("stream_index", var_stream_index.data());
+            parsers[i].DefineVar("dimensions", var_dimensions.data());
             for (size_t j = 0; j < maxDimensionCount; j++)
-                parsers[i].DefineVar((std::string("dim") + std::to_string(j)).c_str(), &(var_dim[j]));
-            parsers[i].DefineVar("components", &var_components);
+                parsers[i].DefineVar((std::string("dim") + std::to_string(j)).c_str(), var_dim[j].data());
+            parsers[i].DefineVar("components", var_components.data());
             for (size_t j = 0; j < maxDimensionCount; j++)
-                parsers[i].DefineVar((std::string("box") + std::to_string(j)).c_str(), &(var_box[j]));
+                parsers[i].DefineVar((std::string("box") + std::to_string(j)).c_str(), var_box[j].data());
             for (size_t j = 0; j < maxDimensionCount; j++)
-                parsers[i].DefineVar((std::string("boxdim") + std::to_string(j)).c_str(), &(var_boxdim[j]));
-            parsers[i].DefineVar("index", &var_index);
+                parsers[i].DefineVar((std::string("boxdim") + std::to_string(j)).c_str(), var_boxdim[j].data());
+            parsers[i].DefineVar("index", var_index.data());
             for (size_t j = 0; j < maxDimensionCount; j++)
-                parsers[i].DefineVar((std::string("i") + std::to_string(j)).c_str(), &(var_i[j]));
+                parsers[i].DefineVar((std::string("i") + std::to_string(j)).c_str(), var_i[j].data());
             for (size_t j = 0; j < maxComponentCount; j++)
-                parsers[i].DefineVar((std::string("v") + std::to_string(j)).c_str(), &(var_v[j]));
+                parsers[i].DefineVar((std::string("v") + std::to_string(j)).c_str(), var_v[j].data());
             // the expression
             parsers[i].SetExpr(expressions[i]);
         }
 
         // initialize random number generator
-        prng.seed(std::chrono::system_clock::now().time_since_epoch().count());
+        setSeed(std::chrono::system_clock::now().time_since_epoch().count());
+    }
+
+    void setSeed(uint64_t x)
+    {
+        prng.seed(x + worker * UINT64_C(0x9e3779b97f4a7c15));
+    }
+
+    // make this the calculator used by the parser callbacks in the calling thread
+    void activate()
+    {
+        calcSingleton = this;
     }
 
     void init(size_t arrayIndex, const std::vector<size_t>& box)
     {
-        var_array_count = input_arrays.size();
-        var_stream_index = arrayIndex;
-        var_dimensions = input_arrays[0].dimensionCount();
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        std::fill(var_array_count.begin(), var_array_count.end(), input_arrays.size());
+        std::fill(var_stream_index.begin(), var_stream_index.end(), arrayIndex);
+        std::fill(var_dimensions.begin(), var_dimensions.end(), input_arrays[0].dimensionCount());
         for (size_t i = 0; i < maxDimensionCount; i++) {
-            if (i < input_arrays[0].dimensionCount()) {
-                var_dim[i] = input_arrays[0].dimension(i);
-                var_box[i] = box[i];
-                var_boxdim[i] = box[input_arrays[0].dimensionCount() + i];
-            } else {
-                var_dim[i] = std::numeric_limits<double>::quiet_NaN();
-                var_box[i] = std::numeric_limits<double>::quiet_NaN();
-                var_boxdim[i] = std::numeric_limits<double>::quiet_NaN();
-            }
+            bool valid = (i < input_arrays[0].dimensionCount());
+            std::fill(var_dim[i].begin(), var_dim[i].end(), valid ? input_arrays[0].dimension(i) : nan);
+            std::fill(var_box[i].begin(), var_box[i].end(), valid ? box[i] : nan);
+            std::fill(var_boxdim[i].begin(), var_boxdim[i].end(), valid ? box[input_arrays[0].dimensionCount() + i] : nan);
         }
-        var_components = input_arrays[0].componentCount();
+        std::fill(var_components.begin(), var_components.end(), input_arrays[0].componentCount());
     }
 
-    void setIndex(const std::vector<size_t>& index, size_t e)
+    size_t maxBulkSize() const
     {
-        var_index = e;
+        return bulkSize;
+    }
+
+    // set the variables for element k of the next evaluation
+    void setIndex(size_t k, const std::vector<size_t>& index, size_t e)
+    {
+        var_index[k] = e;
         for (size_t i = 0; i < maxDimensionCount; i++) {
             if (i < input_arrays[0].dimensionCount())
-                var_i[i] = index[i];
-            else
-                var_i[i] = std::numeric_limits<double>::quiet_NaN();
-        }
-        for (size_t i = 0; i < maxComponentCount; i++) {
-            if (i < input_arrays[0].componentCount())
-                var_v[i] = input_value(0, e, i);
+                var_i[i][k] = index[i];
             else
-                var_v[i] = std::numeric_limits<double>::quiet_NaN();
+                var_i[i][k] = std::numeric_limits<double>::quiet_NaN();
         }
+        const size_t cc = input_arrays[0].componentCount();
+        TGD::visitType(input_arrays[0].componentType(), [&] (auto tag) {
+                const auto* element = input_arrays[0].get<typename decltype(tag)::type>(e);
+                for (size_t i = 0; i < cc; i++)
+                    var_v[i][k] = element[i];
+            });
+        for (size_t i = cc; i < maxComponentCount; i++)
+            var_v[i][k] = std::numeric_limits<double>::quiet_NaN();
     }
 
-    bool evaluate()
+    // evaluate the expressions for the first n elements
+    bool evaluate(size_t n = 1)
     {
         bool ok = true;
         for (size_t i = 0; i < parsers.size(); i++) {
             expressionIndex = i;
             try {
-                parsers[i].Eval();
+                if (bulkSize > 1)
+                    parsers[i].Eval(results.data(), int(n));
+                else
+                    parsers[i].Eval();
             }
             catch (mu::Parser::exception_type& e) {
                 // Fix up the exception before reporting the error
@@ -1405,9 +1874,13 @@ public:
                     token.pop_back();
                 mu::Parser::exception_type fixed_err(code, pos, token);
                 // Report the fixed error
-                fprintf(stderr, "tgd calc: expression %zu: %s\n", i, fixed_err.GetMsg().c_str());
-                fprintf(stderr, "tgd calc: %s\n", expressions[i].c_str());
-                fprintf(stderr, "tgd calc: %s^\n", std::string(fixed_err.GetPos() - 1, ' ').c_str());
+                std::lock_guard<std::mutex> lock(state.errorMutex);
+                if (!state.errorReported) {
+                    fprintf(stderr, "tgd calc: expression %zu: %s\n", i, fixed_err.GetMsg().c_str());
+                    fprintf(stderr, "tgd calc: %s\n", expressions[i].c_str());
+                    fprintf(stderr, "tgd calc: %s^\n", std::string(fixed_err.GetPos() - 1, ' ').c_str());
+                    state.errorReported = true;
+                }
                 ok = false;
                 break;
             }
@@ -1415,42 +1888,15 @@ public:
         return ok;
     }
 
-    void getElement(TGD::ArrayContainer& array, size_t e)
+    // read back the values of element k of the last evaluation
+    void getElement(size_t k, TGD::ArrayContainer& array, size_t e)
     {
-        for (size_t i = 0; i < array.componentCount(); i++) {
-            switch (array.componentType()) {
-            case TGD::int8:
-                array.set<int8_t>(e, i, var_v[i]);
-                break;
-            case TGD::uint8:
-                array.set<uint8_t>(e, i, var_v[i]);
-                break;
-            case TGD::int16:
-                array.set<int16_t>(e, i, var_v[i]);
-                break;
-            case TGD::uint16:
-                array.set<uint16_t>(e, i, var_v[i]);
-                break;
-            case TGD::int32:
-                array.set<int32_t>(e, i, var_v[i]);
-                break;
-            case TGD::uint32:
-                array.set<uint32_t>(e, i, var_v[i]);
-                break;
-            case TGD::int64:
-                array.set<int64_t>(e, i, var_v[i]);
-                break;
-            case TGD::uint64:
-                array.set<uint64_t>(e, i, var_v[i]);
-                break;
-            case TGD::float32:
-                array.set<float>(e, i, var_v[i]);
-                break;
-            case TGD::float64:
-                array.set<double>(e, i, var_v[i]);
-                break;
-            }
-        }
+        TGD::visitType(array.componentType(), [&] (auto tag) {
+                typedef typename decltype(tag)::type T;
+                T* element = array.get<T>(e);
+                for (size_t i = 0; i < array.componentCount(); i++)
+                    element[i] = var_v[i][k];
+            });
     }
 };
 #endif
@@ -1462,6 +1908,9 @@ int tgd_calc(int argc, char* argv[])
     cmdLine.addOptionWithArg("output", 'o');
     cmdLine.addOptionWithArg("box", 'b', parseUIntList);
     cmdLine.addOptionWithArg("expression", 'e');
+    cmdLine.addOptionWithArg("threads", 0, parseUInt);
+    cmdLine.addOptionWithArg("seed", 0, parseUInt);
+    cmdLine.addOptionWithoutArg("element-wise");
     std::string errMsg;
     if (!cmdLine.parse(argc, argv, 2, -1, errMsg)) {
         fprintf(stderr, "tgd calc: %s\n", errMsg.c_str());
@@ -1538,7 +1987,17 @@ int tgd_calc(int argc, char* argv[])
                 "  -i|--input=TAG             set input hints such as FORMAT=gdal, DPI=300 etc.\n"
                 "  -o|--output=TAG            set output hints such as FORMAT=gdal etc.\n"
                 "  -b|--box=INDEX,SIZE        set box to operate on, e.g. X,Y,WIDTH,HEIGHT for 2D\n"
-                "  -e|--expression=E          evaluate expression E (can be used more than once)\n");
+                "  -e|--expression=E          evaluate expression E (can be used more than once)\n"
+                "  --threads=N                evaluate with N threads, each working on a part of\n"
+                "                             the box along the last dimension with its own\n"
+                "                             variables and random numbers (default 1; 0 means\n"
+                "                             one per hardware thread)\n"
+                "  --seed=N                   seed the random number generators with N instead\n"
+                "                             of the current time\n"
+                "  --element-wise             evaluate the expressions for one element at a time\n"
+                "                             instead of for many elements at once; use this if\n"
+                "                             user-defined variables carry values from one\n"
+                "                             element to the next\n");
         return 0;
     }
     if (!cmdLine.isSet("expression")) {
@@ -1555,61 +2014,75 @@ int tgd_calc(int argc, char* argv[])
     const std::string& outFileName = cmdLine.arguments().back();
     TGD::TagList importerHints = createTagList(cmdLine.valueList("input"));
     TGD::TagList exporterHints = createTagList(cmdLine.valueList("output"));
-    std::vector<TGD::Importer> importers(inputCount);
-    for (size_t i = 0; i < inputCount; i++)
-        importers[i].initialize(inFileNames[i], importerHints);
+    // Several inputs are read in parallel; a single one is read in the background
+    if (inputCount == 1)
+        setDefaultPrefetching(importerHints);
+    TGD::BatchImporter batchImporter(std::vector<std::string>(inFileNames.begin(), inFileNames.end() - 1), importerHints);
     TGD::Exporter exporter(outFileName, TGD::Overwrite, exporterHints);
 
     std::vector<size_t> box;
     if (cmdLine.isSet("box"))
         box = getUIntList(cmdLine.value("box"));
 
-    Calc calc(cmdLine.valueList("expression"), inputCount);
+    size_t threadCount = 1;
+    if (cmdLine.isSet("threads")) {
+        threadCount = getUInt(cmdLine.value("threads"));
+        if (threadCount == 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // Evaluate many elements per call into muParser unless the expressions
+    // need element-wise evaluation
+    size_t bulkSize = 1;
+    if (!cmdLine.isSet("element-wise") && Calc::bulkEvaluationPossible(cmdLine.valueList("expression")))
+        bulkSize = 1024;
+    // one calculator per thread, all sharing the input arrays
+    CalcState calcState;
+    calcState.input_arrays.resize(inputCount);
+    std::vector<std::unique_ptr<Calc>> calcs;
+    for (size_t i = 0; i < threadCount; i++)
+        calcs.emplace_back(new Calc(cmdLine.valueList("expression"), calcState, i, bulkSize));
+    if (cmdLine.isSet("seed"))
+        for (size_t i = 0; i < calcs.size(); i++)
+            calcs[i]->setSeed(getUInt(cmdLine.value("seed")));
+    const std::vector<TGD::ArrayContainer>& inputArrays = calcState.input_arrays;
 
     TGD::Error err = TGD::ErrorNone;
 
     size_t arrayIndex = 0;
     for (;;) {
-        /* read inputs */
-        if (!importers[0].hasMore(&err)) {
-            if (err != TGD::ErrorNone) {
-                fprintf(stderr, "tgd calc: %s: %s\n", inFileNames[0].c_str(), TGD::strerror(err));
-            }
-            break;
-        }
-        calc.input_arrays[0] = importers[0].readArray(&err);
-        if (err != TGD::ErrorNone) {
-            fprintf(stderr, "tgd calc: %s: %s\n", inFileNames[0].c_str(), TGD::strerror(err));
+        /* read inputs in parallel */
+        std::vector<char> inputEnded(inputCount, 0);
+        err = batchImporter.forEach([&] (size_t i, TGD::Importer& importer) -> TGD::Error {
+                TGD::Error e = TGD::ErrorNone;
+                if (!importer.hasMore(&e)) {
+                    inputEnded[i] = 1;
+                    // give up only on error, but not on EOF if at least one array from that input was read
+                    if (e != TGD::ErrorNone) {
+                        fprintf(stderr, "tgd calc: %s: %s\n", inFileNames[i].c_str(), TGD::strerror(e));
+                    } else if (i > 0 && arrayIndex == 0) {
+                        fprintf(stderr, "tgd calc: %s: missing array\n", inFileNames[i].c_str());
+                        e = TGD::ErrorInvalidData;
+                    }
+                    return e;
+                }
+                calcState.input_arrays[i] = importer.readArray(&e);
+                if (e != TGD::ErrorNone)
+                    fprintf(stderr, "tgd calc: %s: %s\n", inFileNames[i].c_str(), TGD::strerror(e));
+                return e;
+            });
+        if (err != TGD::ErrorNone || inputEnded[0]) {
             break;
         }
-        if (calc.input_arrays[0].dimensionCount() > Calc::maxDimensionCount
-                || calc.input_arrays[0].componentCount() > Calc::maxComponentCount) {
+        if (inputArrays[0].dimensionCount() > Calc::maxDimensionCount
+                || inputArrays[0].componentCount() > Calc::maxComponentCount) {
             fprintf(stderr, "tgd calc: %s: too many dimensions or components\n", inFileNames[0].c_str());
             break;
         }
-        for (size_t i = 1; i < importers.size(); i++) {
-            if (!importers[i].hasMore(&err)) {
-                // give up only on error, but not on EOF if at least one array from that input was read
-                if (err != TGD::ErrorNone) {
-                    fprintf(stderr, "tgd calc: %s: %s\n", inFileNames[i].c_str(), TGD::strerror(err));
-                } else if (arrayIndex == 0) {
-                    fprintf(stderr, "tgd calc: %s: missing array\n", inFileNames[i].c_str());
-                    err = TGD::ErrorInvalidData;
-                }
-                break;
-            }
-            calc.input_arrays[i] = importers[i].readArray(&err);
-            if (err != TGD::ErrorNone) {
-                fprintf(stderr, "tgd calc: %s: %s\n", inFileNames[i].c_str(), TGD::strerror(err));
-                break;
-            }
-        }
-        if (err != TGD::ErrorNone) {
-            break;
-        }
 
-        /* set up output array */
-        TGD::ArrayContainer array = calc.input_arrays[0].deepCopy();
+        /* set up output array; this must not share data with the input since
+         * expressions can access arbitrary input elements */
+        TGD::ArrayContainer array = inputArrays[0];
+        array.detach();
 
         /* set up box to operate on */
         std::vector<size_t> index(array.dimensionCount());
@@ -1625,29 +2098,54 @@ int tgd_calc(int argc, char* argv[])
             localBox = getBoxFromArray(array);
         }
 
-        /* setup calculator for this array */
-        calc.init(arrayIndex, localBox);
+        /* setup calculators for this array */
+        for (size_t i = 0; i < calcs.size(); i++)
+            calcs[i]->init(arrayIndex, localBox);
 
-        /* calc */
+        /* calc: calculator i works on part i of the box along the last dimension,
+         * so that the result does not depend on the scheduling of the threads */
         if (!boxIsEmpty(localBox)) {
-            /* initialize box index */
-            initBoxIndex(localBox, index);
-            for (;;) {
-                /* get linear index */
-                size_t e = array.toLinearIndex(index);
-                /* give indices to calc */
-                calc.setIndex(index, e);
-                /* evaluate */
-                if (!calc.evaluate()) {
-                    err = TGD::ErrorInvalidData;
-                    break;
+            std::vector<size_t> boxIndex(localBox.begin(), localBox.begin() + index.size());
+            std::vector<size_t> boxSize(localBox.begin() + index.size(), localBox.end());
+            size_t lastDim = index.size() - 1;
+            size_t parts = std::min(calcs.size(), boxSize[lastDim]);
+            std::atomic<bool> failed(false);
+            auto calcPart = [&] (size_t part) {
+                Calc& c = *(calcs[part]);
+                c.activate();
+                std::vector<size_t> partIndex = boxIndex;
+                std::vector<size_t> partSize = boxSize;
+                partIndex[lastDim] += part * boxSize[lastDim] / parts;
+                partSize[lastDim] = (part + 1) * boxSize[lastDim] / parts - part * boxSize[lastDim] / parts;
+                std::vector<size_t> elements(c.maxBulkSize());
+                TGD::BoxIterator it(array, partIndex, partSize);
+                while (!it.atEnd() && !failed) {
+                    /* give indices to calc */
+                    size_t n = 0;
+                    for (; n < elements.size() && !it.atEnd(); n++, it.next()) {
+                        elements[n] = it.linearIndex();
+                        c.setIndex(n, it.index(), elements[n]);
+                    }
+                    /* evaluate */
+                    if (!c.evaluate(n)) {
+                        failed = true;
+                        break;
+                    }
+                    /* read back the updated elements */
+                    for (size_t k = 0; k < n; k++)
+                        c.getElement(k, array, elements[k]);
                 }
-                /* read back the updated element */
-                calc.getElement(array, e);
-                /* increment index */
-                if (!incBoxIndex(localBox, index))
-                    break;
+            };
+            if (parts == 1) {
+                calcPart(0);
+            } else {
+                TGD::ThreadPool::instance().parallelFor(parts, 1, [&] (size_t begin, size_t end) {
+                        for (size_t part = begin; part < end; part++)
+                            calcPart(part);
+                    });
             }
+            if (failed)
+                err = TGD::ErrorInvalidData;
         }
         if (err != TGD::ErrorNone) {
             break;
@@ -1670,79 +2168,259 @@ int tgd_diff(int argc, char* argv[])
     CmdLine cmdLine;
     cmdLine.addOptionWithArg("input", 'i');
     cmdLine.addOptionWithArg("output", 'o');
+    cmdLine.addOptionWithoutArg("summary", 's');
+    cmdLine.addOptionWithoutArg("quiet", 'q');
+    cmdLine.addOptionWithArg("peak", 0, parseNumber);
     std::string errMsg;
-    if (!cmdLine.parse(argc, argv, 3, 3, errMsg)) {
+    if (!cmdLine.parse(argc, argv, 2, 3, errMsg)) {
         fprintf(stderr, "tgd diff: %s\n", errMsg.c_str());
-        return 1;
+        return 2;
     }
     if (cmdLine.isSet("help")) {
-        fprintf(stderr, "Usage: tgd diff [option]... <infile0|-> <infile1|-> <outfile|->\n"
+        fprintf(stderr, "Usage: tgd diff [option]... <infile0|-> <infile1|-> [<outfile|->]\n"
                 "\n"
-                "Compute the absolute difference.\n"
+                "Compute the absolute difference, and/or compare the arrays.\n"
+                "Without output file, print a summary of the differences of each array pair,\n"
+                "and exit with status 0 if all arrays are equal, 1 if some differ, and 2\n"
+                "on errors.\n"
                 "\n"
                 "Options:\n"
                 "  -i|--input=TAG             set input hints such as FORMAT=gdal, DPI=300 etc.\n"
-                "  -o|--output=TAG            set output hints such as FORMAT=gdal etc.\n");
+                "  -o|--output=TAG            set output hints such as FORMAT=gdal etc.\n"
+                "  -s|--summary               print a summary even with output file: number of\n"
+                "                             differing values, maximum absolute difference,\n"
+                "                             RMSE, and PSNR\n"
+                "  -q|--quiet                 print nothing and stop at the first difference\n"
+                "                             (not with output file)\n"
+                "  --peak=V                   peak value for PSNR (default: size of the range\n"
+                "                             of integer types, 1 for floating point)\n");
         return 0;
     }
 
     const std::string& inFileName0 = cmdLine.arguments()[0];
     const std::string& inFileName1 = cmdLine.arguments()[1];
-    const std::string& outFileName = cmdLine.arguments()[2];
+    bool writeOutput = (cmdLine.arguments().size() == 3);
+    bool quiet = cmdLine.isSet("quiet");
+    bool summary = !quiet && (!writeOutput || cmdLine.isSet("summary"));
+    if (writeOutput && quiet) {
+        fprintf(stderr, "tgd diff: cannot use --quiet with output file\n");
+        return 2;
+    }
     TGD::TagList importerHints = createTagList(cmdLine.valueList("input"));
     TGD::TagList exporterHints = createTagList(cmdLine.valueList("output"));
+    setDefaultPrefetching(importerHints);
     TGD::Importer importer0(inFileName0, importerHints);
     TGD::Importer importer1(inFileName1, importerHints);
-    TGD::Exporter exporter(outFileName, TGD::Overwrite, exporterHints);
+    TGD::Exporter exporter;
+    if (writeOutput)
+        exporter.initialize(cmdLine.arguments()[2], TGD::Overwrite, exporterHints);
     TGD::Error err = TGD::ErrorNone;
-    for (;;) {
-        if (!importer0.hasMore(&err)) {
-            if (err != TGD::ErrorNone) {
-                fprintf(stderr, "tgd diff: %s: %s\n", inFileName0.c_str(), TGD::strerror(err));
-            }
+    bool differ = false;
+    // reused across iterations so that equally sized inputs need no new allocations
+    TGD::ArrayContainer array0, array1;
+    for (size_t arrayIndex = 0; ; arrayIndex++) {
+        bool more0 = importer0.hasMore(&err);
+        if (err != TGD::ErrorNone) {
+            fprintf(stderr, "tgd diff: %s: %s\n", inFileName0.c_str(), TGD::strerror(err));
             break;
         }
-        if (!importer1.hasMore(&err)) {
-            if (err != TGD::ErrorNone) {
-                fprintf(stderr, "tgd diff: %s: %s\n", inFileName1.c_str(), TGD::strerror(err));
+        bool more1 = importer1.hasMore(&err);
+        if (err != TGD::ErrorNone) {
+            fprintf(stderr, "tgd diff: %s: %s\n", inFileName1.c_str(), TGD::strerror(err));
+            break;
+        }
+        if (!more0 || !more1) {
+            if (!writeOutput && more0 != more1) {
+                if (!quiet)
+                    fprintf(toolOutput(), "array %zu: only in %s\n", arrayIndex, (more0 ? inFileName0 : inFileName1).c_str());
+                differ = true;
             }
             break;
         }
-        TGD::ArrayContainer array0 = importer0.readArray(&err);
+        err = importer0.readArrayInto(array0);
         if (err != TGD::ErrorNone) {
             fprintf(stderr, "tgd diff: %s: %s\n", inFileName0.c_str(), TGD::strerror(err));
             break;
         }
-        TGD::ArrayContainer array1 = importer1.readArray(&err);
+        err = importer1.readArrayInto(array1);
         if (err != TGD::ErrorNone) {
             fprintf(stderr, "tgd diff: %s: %s\n", inFileName1.c_str(), TGD::strerror(err));
             break;
         }
         if (!array0.isCompatible(array1)) {
-            fprintf(stderr, "tgd diff: incompatible input arrays\n");
-            err = TGD::ErrorInvalidData;
-            break;
+            if (writeOutput) {
+                fprintf(stderr, "tgd diff: incompatible input arrays\n");
+                err = TGD::ErrorInvalidData;
+                break;
+            }
+            if (!quiet)
+                fprintf(toolOutput(), "array %zu: incompatible\n", arrayIndex);
+            differ = true;
+            if (quiet)
+                break;
+            continue;
         }
-        TGD::Array<float> floatArray0 = convert(array0, TGD::float32);
-        TGD::Array<float> floatArray1 = convert(array1, TGD::float32);
-        TGD::Array<float> floatResult = TGD::forEachComponent(floatArray0, floatArray1,
-                [] (float v0, float v1) -> float { return std::abs(v0 - v1); });
-        TGD::ArrayContainer result = convert(floatResult, array0.componentType());
-        removeValueRelatedTags(result);
-        err = exporter.writeArray(result);
-        if (err != TGD::ErrorNone) {
-            fprintf(stderr, "tgd diff: %s: %s\n", outFileName.c_str(), TGD::strerror(err));
-            break;
+        if (quiet) {
+            differ = !TGD::equalValues(array0, array1);
+            if (differ)
+                break;
+            continue;
+        }
+        TGD::ArrayContainer result;
+        TGD::DifferenceStatistics stats = TGD::differenceStatistics(array0, array1, writeOutput ? &result : nullptr);
+        if (stats.differingCount > 0)
+            differ = true;
+        if (summary) {
+            double peak = (cmdLine.isSet("peak") ? getNumber(cmdLine.value("peak"))
+                    : TGD::differencePeak(array0.componentType()));
+            fprintf(toolOutput(), "array %zu: differing=%zu of %zu max-abs=%g rmse=%g psnr=%g",
+                    arrayIndex, stats.differingCount, stats.count,
+                    stats.maxAbs, stats.rmse(), stats.psnr(peak));
+            if (stats.nonFiniteCount > 0)
+                fprintf(toolOutput(), " non-finite=%zu", stats.nonFiniteCount);
+            fprintf(toolOutput(), "\n");
+        }
+        if (writeOutput) {
+            removeValueRelatedTags(result);
+            err = exporter.writeArray(result);
+            if (err != TGD::ErrorNone) {
+                fprintf(stderr, "tgd diff: %s: %s\n", exporter.fileName().c_str(), TGD::strerror(err));
+                break;
+            }
         }
     }
+    if (writeOutput) {
+        TGD::Error e = exporter.finish();
+        if (e != TGD::ErrorNone && err == TGD::ErrorNone) {
+            fprintf(stderr, "tgd diff: %s: %s\n", exporter.fileName().c_str(), TGD::strerror(e));
+            err = e;
+        }
+        return (err == TGD::ErrorNone ? 0 : 1);
+    }
+    return (err != TGD::ErrorNone ? 2 : differ ? 1 : 0);
+}
 
-    return (err == TGD::ErrorNone ? 0 : 1);
+bool parseFilter(const std::string& value)
+{
+    return (value == "box" || value == "lanczos");
+}
+
+bool parseReducedDimensions(const std::string& value)
+{
+    return (value == "1" || value == "2" || value == "3");
+}
+
+int tgd_pyramid(int argc, char* argv[])
+{
+    CmdLine cmdLine;
+    cmdLine.addOptionWithArg("input", 'i');
+    cmdLine.addOptionWithArg("output", 'o');
+    cmdLine.addOptionWithArg("filter", 'f', parseFilter, "box");
+    cmdLine.addOptionWithArg("reduce", 'r', parseReducedDimensions);
+    cmdLine.addOptionWithArg("levels", 'l', parseUIntLargerThanZero);
+    cmdLine.addOptionWithArg("memory-budget", 0, parseUIntLargerThanZero);
+    std::string errMsg;
+    if (!cmdLine.parse(argc, argv, 2, 2, errMsg)) {
+        fprintf(stderr, "tgd pyramid: %s\n", errMsg.c_str());
+        return 1;
+    }
+    if (cmdLine.isSet("help")) {
+        fprintf(stderr, "Usage: tgd pyramid [option]... <infile|-> <outfile|->\n"
+                "\n"
+                "Write each input array followed by versions of it that are reduced to\n"
+                "half the size of the previous one, until the reduced dimensions have size 1.\n"
+                "\n"
+                "Options:\n"
+                "  -i|--input=TAG             set input hints such as FORMAT=gdal, DPI=300 etc.\n"
+                "  -o|--output=TAG            set output hints such as FORMAT=gdal etc.\n"
+                "  -f|--filter=box|lanczos    set the filter (default box)\n"
+                "  -r|--reduce=N              reduce the first N dimensions (1, 2, or 3; default:\n"
+                "                             all, but at most 3)\n"
+                "  -l|--levels=N              write at most N arrays per input array, including\n"
+                "                             the input array itself\n"
+                "  --memory-budget=MIB        read arrays with more data in slabs along the last\n"
+                "                             dimension, and keep only the reduced versions in\n"
+                "                             memory\n");
+        return 0;
+    }
+
+    TGD::DownsamplingFilter filter = (cmdLine.value("filter") == "lanczos" ? TGD::LanczosFilter : TGD::BoxFilter);
+    size_t maxLevels = (cmdLine.isSet("levels") ? getUInt(cmdLine.value("levels")) : std::numeric_limits<size_t>::max());
+    size_t memoryBudget = getMemoryBudget(cmdLine);
+    const std::string& inFileName = cmdLine.arguments()[0];
+    const std::string& outFileName = cmdLine.arguments()[1];
+    TGD::TagList importerHints = createTagList(cmdLine.valueList("input"));
+    TGD::TagList exporterHints = createTagList(cmdLine.valueList("output"));
+    if (memoryBudget == 0)
+        setDefaultPrefetching(importerHints);
+    if (!exporterHints.contains("ASYNC"))
+        exporterHints.set("ASYNC", "1");
+    TGD::Importer importer(inFileName, importerHints);
+    TGD::Exporter exporter(outFileName, TGD::Overwrite, exporterHints);
+    TGD::Error err = TGD::ErrorNone;
+    while (importer.hasMore(&err)) {
+        TGD::ArrayDescription desc;
+        TGD::ArrayContainer array = readArrayWithinBudget(importer, memoryBudget, desc, &err);
+        if (err != TGD::ErrorNone) {
+            fprintf(stderr, "tgd pyramid: %s: %s\n", inFileName.c_str(), TGD::strerror(err));
+            return 1;
+        }
+        size_t dims = (cmdLine.isSet("reduce") ? getUInt(cmdLine.value("reduce"))
+                : std::min(desc.dimensionCount(), size_t(3)));
+        if (desc.dimensionCount() == 0 || dims > desc.dimensionCount()) {
+            fprintf(stderr, "tgd pyramid: %s: array has too few dimensions\n", inFileName.c_str());
+            return 1;
+        }
+        size_t levels = 1;
+        for (size_t d = 0; d < dims; d++) {
+            size_t l = 1;
+            for (size_t n = desc.dimension(d); n > 1; n = (n + 1) / 2)
+                l++;
+            levels = std::max(levels, l);
+        }
+        levels = std::min(levels, maxLevels);
+        // The input array is read only once: it is written as the first level
+        // and reduced to the second level at the same time.
+        TGD::Downsampler downsampler(desc, dims, filter);
+        if (array.dimensionCount() > 0) {
+            err = exporter.writeArray(array);
+            if (err == TGD::ErrorNone && levels > 1)
+                downsampler.addSlab(array);
+            array = TGD::ArrayContainer();
+        } else {
+            err = exporter.beginArray(desc);
+            while (err == TGD::ErrorNone && importer.remainingSlices() > 0) {
+                TGD::ArrayContainer slab = importer.readSlab(slabSliceCount(desc, memoryBudget), &err);
+                if (err != TGD::ErrorNone) {
+                    fprintf(stderr, "tgd pyramid: %s: %s\n", inFileName.c_str(), TGD::strerror(err));
+                    return 1;
+                }
+                err = exporter.writeSlab(slab);
+                if (err == TGD::ErrorNone && levels > 1)
+                    downsampler.addSlab(slab);
+            }
+        }
+        TGD::ArrayContainer level;
+        for (size_t l = 1; err == TGD::ErrorNone && l < levels; l++) {
+            level = (l == 1 ? downsampler.result() : TGD::downsample(level, dims, filter));
+            err = exporter.writeArray(level);
+        }
+        if (err != TGD::ErrorNone)
+            break;
+    }
+    if (err == TGD::ErrorNone)
+        err = exporter.finish();
+    if (err != TGD::ErrorNone) {
+        fprintf(stderr, "tgd pyramid: %s: %s\n", outFileName.c_str(), TGD::strerror(err));
+        return 1;
+    }
+    return 0;
 }
 
 void tgd_info_print_taglist(const TGD::TagList& tl, bool space = true)
 {
     for (auto it = tl.cbegin(); it != tl.cend(); it++) {
-        printf("%s%s=%s\n", space ? "    " : "", it->first.c_str(), it->second.c_str());
+        fprintf(toolOutput(), "%s%s=%s\n", space ? "    " : "", it->first.c_str(), it->second.c_str());
     }
 }
 
@@ -1784,6 +2462,9 @@ int tgd_info(int argc, char* argv[])
     cmdLine.addOrderedOptionWithArg("dimension-tags", 0, parseUInt);
     cmdLine.addOrderedOptionWithArg("component-tag", 0, parseUIntAndName);
     cmdLine.addOrderedOptionWithArg("component-tags", 0, parseUInt);
+    cmdLine.addOptionWithArg("memory-budget", 0, parseUIntLargerThanZero);
+    cmdLine.addOptionWithArg("percentiles", 0, parsePercentileList);
+    cmdLine.addOptionWithArg("histogram", 0, parseHistogram);
     std::string errMsg;
     if (!cmdLine.parse(argc, argv, 1, -1, errMsg)) {
         fprintf(stderr, "tgd info: %s\n", errMsg.c_str());
@@ -1799,7 +2480,15 @@ int tgd_info(int argc, char* argv[])
                 "Options:\n"
                 "  -i|--input=TAG             set input hints such as FORMAT=gdal, DPI=300 etc\n"
                 "  -s|--statistics            print statistics\n"
+                "  --percentiles=P0,P1,...    with -s, also print the given percentiles (0-100);\n"
+                "                             these are exact for 8 and 16 bit integer data\n"
+                "                             and accurate to 1%% otherwise\n"
+                "  --histogram=N[,MIN,MAX]    with -s, also print a histogram with N bins; the\n"
+                "                             range defaults to the minimum and maximum value\n"
+                "                             unless the data is read in slabs\n"
                 "  -b|--box=INDEX,SIZE        set box to operate on, e.g. X,Y,WIDTH,HEIGHT for 2D\n"
+                "  --memory-budget=MIB        read arrays with more data in slabs along the last\n"
+                "                             dimension\n"
                 "\n"
                 "The following options disable default output, and instead print their own\n"
                 "output in the order in which they are given:\n"
@@ -1833,6 +2522,22 @@ int tgd_info(int argc, char* argv[])
     std::vector<size_t> box;
     if (cmdLine.isSet("box"))
         box = getUIntList(cmdLine.value("box"));
+    size_t memoryBudget = getMemoryBudget(cmdLine);
+    std::vector<double> percentiles;
+    if (cmdLine.isSet("percentiles"))
+        percentiles = getNumberList(cmdLine.value("percentiles"));
+    size_t histogramBins = 0;
+    double histogramMin = 0.0, histogramMax = 0.0;
+    bool histogramRange = false;
+    if (cmdLine.isSet("histogram")) {
+        std::vector<double> h = getNumberList(cmdLine.value("histogram"));
+        histogramBins = h[0];
+        if (h.size() == 3) {
+            histogramRange = true;
+            histogramMin = h[1];
+            histogramMax = h[2];
+        }
+    }
 
     for (size_t arg = 0; arg < cmdLine.arguments().size(); arg++) {
         const std::string& inFileName = cmdLine.arguments()[arg];
@@ -1844,83 +2549,101 @@ int tgd_info(int argc, char* argv[])
                 }
                 break;
             }
-            TGD::ArrayContainer array = importer.readArray(&err);
+            TGD::ArrayDescription desc;
+            TGD::ArrayContainer array;
+            // statistics stored in the file make reading the data unnecessary
+            std::vector<TGD::ComponentStatistics> storedStats;
+            bool haveStoredStats = false;
+            if (defaultOutput && cmdLine.isSet("statistics") && percentiles.size() == 0 && histogramBins == 0) {
+                std::vector<size_t> boxIndex(box.begin(), box.begin() + box.size() / 2);
+                std::vector<size_t> boxSize(box.begin() + box.size() / 2, box.end());
+                haveStoredStats = (importer.readStatistics(desc, storedStats, -1, boxIndex, boxSize) == TGD::ErrorNone);
+            }
+            if (haveStoredStats) {
+                // nothing more to read
+            } else if (defaultOutput && cmdLine.isSet("statistics")) {
+                array = readArrayWithinBudget(importer, memoryBudget, desc, &err);
+            } else {
+                // only the description is needed
+                desc = importer.readDescription(&err);
+            }
             if (err != TGD::ErrorNone) {
                 fprintf(stderr, "tgd info: %s: %s\n", inFileName.c_str(), TGD::strerror(err));
                 break;
             }
+            bool streamed = (importer.remainingSlices() > 0);
             for (size_t o = 0; o < cmdLine.orderedOptionNames().size(); o++) {
                 const std::string& optName = cmdLine.orderedOptionNames()[o];
                 const std::string& optVal = cmdLine.orderedOptionValues()[o];
                 if (optName == "dimensions") {
-                    printf("%zu\n", array.dimensionCount());
+                    fprintf(toolOutput(), "%zu\n", desc.dimensionCount());
                 } else if (optName == "dimension") {
                     size_t dim = getUInt(optVal);
-                    if (dim >= array.dimensionCount()) {
+                    if (dim >= desc.dimensionCount()) {
                         fprintf(stderr, "tgd info: %s: no such dimension %zu\n", inFileName.c_str(), dim);
                         err = TGD::ErrorInvalidData;
                         break;
                     }
-                    printf("%zu\n", array.dimension(dim));
+                    fprintf(toolOutput(), "%zu\n", desc.dimension(dim));
                 } else if (optName == "components") {
-                    printf("%zu\n", array.componentCount());
+                    fprintf(toolOutput(), "%zu\n", desc.componentCount());
                 } else if (optName == "type") {
-                    printf("%s\n", TGD::typeToString(getType(cmdLine.value("type"))));
+                    fprintf(toolOutput(), "%s\n", TGD::typeToString(getType(cmdLine.value("type"))));
                 } else if (optName == "global-tag") {
-                    if (!array.globalTagList().contains(optVal)) {
+                    if (!desc.globalTagList().contains(optVal)) {
                         fprintf(stderr, "tgd info: %s: no global tag %s\n", inFileName.c_str(), optVal.c_str());
                         err = TGD::ErrorInvalidData;
                         break;
                     }
-                    printf("%s\n", array.globalTagList().value(optVal).c_str());
+                    fprintf(toolOutput(), "%s\n", desc.globalTagList().value(optVal).c_str());
                 } else if (optName == "global-tags") {
-                    tgd_info_print_taglist(array.globalTagList(), false);
+                    tgd_info_print_taglist(desc.globalTagList(), false);
                 } else if (optName == "dimension-tag") {
                     size_t dim;
                     std::string name;
                     getUIntAndName(optVal, &dim, &name);
-                    if (dim >= array.dimensionCount()) {
+                    if (dim >= desc.dimensionCount()) {
                         fprintf(stderr, "tgd info: %s: no such dimension %zu\n", inFileName.c_str(), dim);
                         err = TGD::ErrorInvalidData;
                         break;
                     }
-                    if (!array.dimensionTagList(dim).contains(name)) {
+                    if (!desc.dimensionTagList(dim).contains(name)) {
                         fprintf(stderr, "tgd info: %s: no tag %s for dimension %zu\n", inFileName.c_str(), name.c_str(), dim);
                         err = TGD::ErrorInvalidData;
                         break;
                     }
-                    printf("%s\n", array.dimensionTagList(dim).value(name).c_str());
+                    fprintf(toolOutput(), "%s\n", desc.dimensionTagList(dim).value(name).c_str());
                 } else if (optName == "dimension-tags") {
                     size_t dim = getUInt(optVal);
-                    if (dim >= array.dimensionCount()) {
+                    if (dim >= desc.dimensionCount()) {
                         fprintf(stderr, "tgd info: %s: no such dimension %zu\n", inFileName.c_str(), dim);
                         err = TGD::ErrorInvalidData;
                         break;
                     }
-                    tgd_info_print_taglist(array.dimensionTagList(dim), false);
+                    tgd_info_print_taglist(desc.dimensionTagList(dim), false);
                 } else if (optName == "component-tag") {
                     size_t comp;
                     std::string name;
                     getUIntAndName(optVal, &comp, &name);
-                    if (comp >= array.componentCount()) {
+                    if (comp >= desc.componentCount()) {
                         fprintf(stderr, "tgd info: %s: no such component %zu\n", inFileName.c_str(), comp);
                         err = TGD::ErrorInvalidData;
                         break;
                     }
-                    if (!array.componentTagList(comp).contains(name)) {
+                    if (!desc.componentTagList(comp).contains(name)) {
                         fprintf(stderr, "tgd info: %s: no tag %s for component %zu\n", inFileName.c_str(), name.c_str(), comp);
                         err = TGD::ErrorInvalidData;
                         break;
                     }
-                    printf("%s\n", array.componentTagList(comp).value(name).c_str());
+                    fprintf(toolOutput(), "%s\n", desc.componentTagList(comp).value(name).c_str());
                 } else if (optName == "component-tags") {
                     size_t comp = getUInt(optVal);
-                    if (comp >= array.componentCount()) {
+                    if (comp >= desc.componentCount()) {
                         fprintf(stderr, "tgd info: %s: no such component %zu\n", inFileName.c_str(), comp);
                         err = TGD::ErrorInvalidData;
                         break;
                     }
-                    tgd_info_print_taglist(array.componentTagList(comp), false);
+                    tgd_info_print_taglist(desc.componentTagList(comp), false);
                 }
             }
             if (err != TGD::ErrorNone) {
@@ -1928,37 +2651,37 @@ int tgd_info(int argc, char* argv[])
             }
             if (defaultOutput) {
                 std::string sizeString;
-                if (array.dimensionCount() == 0) {
+                if (desc.dimensionCount() == 0) {
                     sizeString = "0";
                 } else {
-                    sizeString = std::to_string(array.dimension(0));
-                    for (size_t i = 1; i < array.dimensionCount(); i++) {
+                    sizeString = std::to_string(desc.dimension(0));
+                    for (size_t i = 1; i < desc.dimensionCount(); i++) {
                         sizeString += 'x';
-                        sizeString += std::to_string(array.dimension(i));
+                        sizeString += std::to_string(desc.dimension(i));
                     }
                 }
-                printf("array %zu: %zu x %s, size %s (%s)\n",
-                        arrayCounter, array.componentCount(),
-                        TGD::typeToString(array.componentType()),
-                        sizeString.c_str(), tgd_info_human_readable_memsize(array.dataSize()).c_str());
-                if (array.globalTagList().size() > 0) {
-                    printf("  global:\n");
-                    tgd_info_print_taglist(array.globalTagList());
+                fprintf(toolOutput(), "array %zu: %zu x %s, size %s (%s)\n",
+                        arrayCounter, desc.componentCount(),
+                        TGD::typeToString(desc.componentType()),
+                        sizeString.c_str(), tgd_info_human_readable_memsize(desc.dataSize()).c_str());
+                if (desc.globalTagList().size() > 0) {
+                    fprintf(toolOutput(), "  global:\n");
+                    tgd_info_print_taglist(desc.globalTagList());
                 }
-                for (size_t i = 0; i < array.dimensionCount(); i++) {
-                    if (array.dimensionTagList(i).size() > 0) {
-                        printf("  dimension %zu:\n", i);
-                        tgd_info_print_taglist(array.dimensionTagList(i));
+                for (size_t i = 0; i < desc.dimensionCount(); i++) {
+                    if (desc.dimensionTagList(i).size() > 0) {
+                        fprintf(toolOutput(), "  dimension %zu:\n", i);
+                        tgd_info_print_taglist(desc.dimensionTagList(i));
                     }
                 }
-                for (size_t i = 0; i < array.componentCount(); i++) {
-                    if (array.componentTagList(i).size() > 0) {
-                        printf("  component %zu:\n", i);
-                        tgd_info_print_taglist(array.componentTagList(i));
+                for (size_t i = 0; i < desc.componentCount(); i++) {
+                    if (desc.componentTagList(i).size() > 0) {
+                        fprintf(toolOutput(), "  component %zu:\n", i);
+                        tgd_info_print_taglist(desc.componentTagList(i));
                     }
                 }
                 if (cmdLine.isSet("statistics")) {
-                    std::vector<size_t> index(array.dimensionCount());
+                    std::vector<size_t> index(desc.dimensionCount());
                     std::vector<size_t> localBox;
                     if (box.size() > 0) {
                         if (box.size() != index.size() * 2) {
@@ -1966,66 +2689,107 @@ int tgd_info(int argc, char* argv[])
                             err = TGD::ErrorInvalidData;
                             break;
                         }
-                        localBox = restrictBoxToArray(box, array);
+                        localBox = restrictBoxToArray(box, desc);
                     } else {
-                        localBox = getBoxFromArray(array);
+                        localBox = getBoxFromArray(desc);
                     }
-                    TGD::Array<float> floatArray = convert(array, TGD::float32);
-                    std::vector<size_t> finiteValues(array.componentCount(), 0);
-                    std::vector<float> tmpMinVals(array.componentCount(), 0.0f);
-                    std::vector<float> tmpMaxVals(array.componentCount(), 0.0f);
-                    std::vector<double> sums(array.componentCount(), 0.0);
-                    std::vector<double> sumsOfSquares(array.componentCount(), 0.0);
-                    if (!boxIsEmpty(localBox)) {
-                        initBoxIndex(localBox, index);
-                        for (;;) {
-                            size_t e = array.toLinearIndex(index);
-                            for (size_t i = 0; i < array.componentCount(); i++) {
-                                float val = floatArray.get<float>(e, i);
-                                if (std::isfinite(val)) {
-                                    finiteValues[i]++;
-                                    if (finiteValues[i] == 1) {
-                                        tmpMinVals[i] = val;
-                                        tmpMaxVals[i] = val;
-                                    } else if (val < tmpMinVals[i]) {
-                                        tmpMinVals[i] = val;
-                                    } else if (val > tmpMaxVals[i]) {
-                                        tmpMaxVals[i] = val;
-                                    }
-                                    sums[i] += val;
-                                    sumsOfSquares[i] += val * val;
-                                }
-                            }
-                            if (!incBoxIndex(localBox, index))
+                    std::vector<TGD::ComponentStatistics> stats;
+                    std::vector<TGD::QuantileSketch> sketches;
+                    std::vector<std::vector<size_t>> histograms;
+                    if (haveStoredStats) {
+                        stats = storedStats;
+                    } else if (streamed) {
+                        // merge the statistics of the parts of the box in each slab
+                        if (histogramBins > 0 && !histogramRange) {
+                            fprintf(stderr, "tgd info: %s: histogram range required when reading in slabs\n", inFileName.c_str());
+                            err = TGD::ErrorInvalidData;
+                            break;
+                        }
+                        size_t lastDim = desc.dimensionCount() - 1;
+                        size_t boxStart = localBox[lastDim];
+                        size_t boxEnd = boxStart + localBox[2 * lastDim + 1];
+                        size_t sliceCount = slabSliceCount(desc, memoryBudget);
+                        stats.resize(desc.componentCount());
+                        if (percentiles.size() > 0)
+                            sketches.resize(desc.componentCount());
+                        if (histogramBins > 0)
+                            histograms.resize(desc.componentCount(), std::vector<size_t>(histogramBins, 0));
+                        while (importer.remainingSlices() > 0) {
+                            size_t slabStart = desc.dimension(lastDim) - importer.remainingSlices();
+                            TGD::ArrayContainer slab = importer.readSlab(sliceCount, &err);
+                            if (err != TGD::ErrorNone) {
+                                fprintf(stderr, "tgd info: %s: %s\n", inFileName.c_str(), TGD::strerror(err));
                                 break;
+                            }
+                            size_t slabEnd = slabStart + slab.dimension(lastDim);
+                            if (slabEnd <= boxStart || slabStart >= boxEnd)
+                                continue;
+                            std::vector<size_t> slabBoxIndex(localBox.begin(), localBox.begin() + desc.dimensionCount());
+                            std::vector<size_t> slabBoxSize(localBox.begin() + desc.dimensionCount(), localBox.end());
+                            slabBoxIndex[lastDim] = std::max(boxStart, slabStart) - slabStart;
+                            slabBoxSize[lastDim] = std::min(boxEnd, slabEnd) - slabStart - slabBoxIndex[lastDim];
+                            TGD::ArrayView slabView = TGD::ArrayView(slab).box(slabBoxIndex, slabBoxSize);
+                            std::vector<TGD::ComponentStatistics> slabStats = TGD::statistics(slabView);
+                            for (size_t i = 0; i < stats.size(); i++)
+                                stats[i].merge(slabStats[i]);
+                            if (sketches.size() > 0) {
+                                std::vector<TGD::QuantileSketch> slabSketches = TGD::quantileSketches(slabView);
+                                for (size_t i = 0; i < sketches.size(); i++)
+                                    sketches[i].merge(slabSketches[i]);
+                            }
+                            for (size_t i = 0; i < histograms.size(); i++) {
+                                std::vector<size_t> h = TGD::histogram(slabView, i, histogramBins, histogramMin, histogramMax);
+                                for (size_t b = 0; b < histogramBins; b++)
+                                    histograms[i][b] += h[b];
+                            }
+                        }
+                        if (err != TGD::ErrorNone)
+                            break;
+                    } else {
+                        TGD::ArrayView view = TGD::ArrayView(array).box(
+                                std::vector<size_t>(localBox.begin(), localBox.begin() + desc.dimensionCount()),
+                                std::vector<size_t>(localBox.begin() + desc.dimensionCount(), localBox.end()));
+                        stats = TGD::statistics(view);
+                        if (percentiles.size() > 0)
+                            sketches = TGD::quantileSketches(view);
+                        for (size_t i = 0; histogramBins > 0 && i < desc.componentCount(); i++) {
+                            histograms.push_back(histogramRange
+                                    ? TGD::histogram(view, i, histogramBins, histogramMin, histogramMax)
+                                    : TGD::histogram(view, i, histogramBins, stats[i].minimum, stats[i].maximum));
                         }
                     }
-                    for (size_t i = 0; i < array.componentCount(); i++) {
-                        float minVal = std::numeric_limits<float>::quiet_NaN();
-                        float maxVal = std::numeric_limits<float>::quiet_NaN();
-                        float sampleMean = std::numeric_limits<float>::quiet_NaN();
-                        float sampleVariance = std::numeric_limits<float>::quiet_NaN();
-                        float sampleDeviation = std::numeric_limits<float>::quiet_NaN();
-                        if (finiteValues[i] > 0) {
-                            minVal = tmpMinVals[i];
-                            maxVal = tmpMaxVals[i];
-                            sampleMean = sums[i] / finiteValues[i];
-                            if (finiteValues[i] > 1) {
-                                sampleVariance = (sumsOfSquares[i] - sums[i] / finiteValues[i] * sums[i]) / (finiteValues[i] - 1);
-                                if (sampleVariance < 0.0f)
-                                    sampleVariance = 0.0f;
-                                sampleDeviation = std::sqrt(sampleVariance);
-                            } else if (finiteValues[i] == 1) {
-                                sampleVariance = 0.0f;
-                                sampleDeviation = 0.0f;
-                            }
+                    for (size_t i = 0; i < desc.componentCount(); i++) {
+                        fprintf(toolOutput(), "  component %zu: min=%g max=%g mean=%g var=%g dev=%g invalid=%zu nan=%zu inf=%zu\n", i,
+                                stats[i].minimum, stats[i].maximum, stats[i].mean,
+                                stats[i].variance(), stats[i].deviation(), stats[i].invalidCount(),
+                                stats[i].nanCount, stats[i].infCount());
+                        if (sketches.size() > 0) {
+                            fprintf(toolOutput(), "    percentiles:");
+                            for (size_t j = 0; j < percentiles.size(); j++)
+                                fprintf(toolOutput(), " p%g=%g", percentiles[j], sketches[i].quantile(percentiles[j] / 100.0));
+                            fprintf(toolOutput(), "\n");
+                        }
+                        if (histograms.size() > 0) {
+                            double lo = histogramRange ? histogramMin : stats[i].minimum;
+                            double hi = histogramRange ? histogramMax : stats[i].maximum;
+                            fprintf(toolOutput(), "    histogram: %zu bins in [%g,%g]:", histogramBins, lo, hi);
+                            for (size_t b = 0; b < histogramBins; b++)
+                                fprintf(toolOutput(), " %zu", histograms[i][b]);
+                            fprintf(toolOutput(), "\n");
                         }
-                        printf("  component %zu: min=%g max=%g mean=%g var=%g dev=%g invalid=%zu\n", i,
-                                minVal, maxVal, sampleMean, sampleVariance, sampleDeviation,
-                                array.elementCount() - finiteValues[i]);
                     }
                 }
             }
+            // skip the remaining slabs
+            while (streamed && importer.remainingSlices() > 0) {
+                importer.readSlab(slabSliceCount(desc, memoryBudget), &err);
+                if (err != TGD::ErrorNone) {
+                    fprintf(stderr, "tgd info: %s: %s\n", inFileName.c_str(), TGD::strerror(err));
+                    break;
+                }
+            }
+            if (err != TGD::ErrorNone)
+                break;
             arrayCounter++;
         }
         if (err != TGD::ErrorNone)
@@ -2035,6 +2799,730 @@ int tgd_info(int argc, char* argv[])
     return (err == TGD::ErrorNone ? 0 : 1);
 }
 
+/* Helper functions for tgd bench */
+
+typedef std::chrono::steady_clock BenchClock;
+
+double benchSecondsSince(BenchClock::time_point t0)
+{
+    return std::chrono::duration<double>(BenchClock::now() - t0).count();
+}
+
+struct BenchResult
+{
+    std::string operation;
+    std::string format;
+    std::string hints;
+    std::string error;
+    size_t bytes;                  // array data processed per repetition
+    size_t arrays;                 // arrays processed per repetition
+    long long fileSize;            // size of the written file, or -1
+    std::vector<double> totals;    // seconds per repetition
+    std::vector<double> latencies; // seconds per array
+
+    BenchResult(const std::string& op, const std::string& fmt, const std::string& h,
+            size_t b, size_t a) :
+        operation(op), format(fmt), hints(h), bytes(b), arrays(a), fileSize(-1)
+    {
+    }
+};
+
+/* Nearest-rank percentile of a sorted list */
+double benchPercentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.size() == 0)
+        return 0.0;
+    size_t rank = std::ceil(p / 100.0 * sorted.size());
+    return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+template<typename T>
+void benchFillHelper(TGD::ArrayContainer& array, const std::string& fill, std::mt19937_64& rng)
+{
+    T* data = static_cast<T*>(array.data());
+    size_t width = array.dimension(0);
+    size_t n = array.elementCount() * array.componentCount();
+    if (fill == "zero") {
+        std::memset(data, 0, array.dataSize());
+    } else if (fill == "random") {
+        if (!std::numeric_limits<T>::is_integer) {
+            std::uniform_real_distribution<double> distribution(0.0, 1.0);
+            for (size_t i = 0; i < n; i++)
+                data[i] = distribution(rng);
+        } else {
+            for (size_t i = 0; i < n; i++)
+                data[i] = static_cast<T>(rng());
+        }
+    } else {
+        // gradient along the first dimension
+        double maxVal = (!std::numeric_limits<T>::is_integer ? 1.0 : double(std::numeric_limits<T>::max()));
+        for (size_t e = 0; e < array.elementCount(); e++) {
+            T v = (e % width) * maxVal / std::max(width - 1, size_t(1));
+            for (size_t c = 0; c < array.componentCount(); c++)
+                data[e * array.componentCount() + c] = v;
+        }
+    }
+}
+
+void benchFill(TGD::ArrayContainer& array, const std::string& fill, std::mt19937_64& rng)
+{
+    TGD::visitType(array.componentType(), [&] (auto tag) {
+            benchFillHelper<typename decltype(tag)::type>(array, fill, rng);
+        });
+}
+
+/* File name extension that selects the given format backend, for backends
+ * such as stb that decide on the file type based on the extension */
+std::string benchExtension(const std::string& format)
+{
+    return (format == "stb" || format == "magick") ? "png"
+        : format == "tinyexr" ? "exr"
+        : format == "rgbe" ? "hdr"
+        : format == "jpeg" ? "jpg"
+        : format == "tiff" || format == "gdal" ? "tif"
+        : format == "hdf5" ? "h5"
+        : format == "dcmtk" ? "dcm"
+        : format == "ffmpeg" ? "mkv"
+        : format;
+}
+
+void benchWrite(const std::vector<TGD::ArrayContainer>& arrays, const std::string& fileName,
+        const TGD::TagList& hints, size_t repetitions, BenchResult& r)
+{
+    for (size_t rep = 0; rep < repetitions; rep++) {
+        BenchClock::time_point t0 = BenchClock::now();
+        TGD::Exporter exporter(fileName, TGD::Overwrite, hints);
+        TGD::Error err = TGD::ErrorNone;
+        for (size_t i = 0; i < arrays.size() && err == TGD::ErrorNone; i++) {
+            BenchClock::time_point t1 = BenchClock::now();
+            err = exporter.writeArray(arrays[i]);
+            if (err == TGD::ErrorNone && i == arrays.size() - 1)
+                err = exporter.finish();
+            r.latencies.push_back(benchSecondsSince(t1));
+        }
+        if (err != TGD::ErrorNone) {
+            r.error = TGD::strerror(err);
+            return;
+        }
+        r.totals.push_back(benchSecondsSince(t0));
+    }
+    struct stat statbuf;
+    if (stat(fileName.c_str(), &statbuf) == 0)
+        r.fileSize = statbuf.st_size;
+}
+
+void benchRead(size_t arrayCount, const std::string& fileName,
+        const TGD::TagList& hints, size_t repetitions, BenchResult& r)
+{
+    for (size_t rep = 0; rep < repetitions; rep++) {
+        BenchClock::time_point t0 = BenchClock::now();
+        TGD::Importer importer(fileName, hints);
+        TGD::Error err = TGD::ErrorNone;
+        for (size_t i = 0; i < arrayCount && err == TGD::ErrorNone; i++) {
+            BenchClock::time_point t1 = BenchClock::now();
+            TGD::ArrayContainer array = importer.readArray(&err);
+            r.latencies.push_back(benchSecondsSince(t1));
+        }
+        if (err != TGD::ErrorNone) {
+            r.error = TGD::strerror(err);
+            return;
+        }
+        r.totals.push_back(benchSecondsSince(t0));
+    }
+}
+
+template<typename FUNC>
+void benchKernel(size_t arrayCount, size_t repetitions, BenchResult& r, FUNC func)
+{
+    for (size_t rep = 0; rep < repetitions; rep++) {
+        BenchClock::time_point t0 = BenchClock::now();
+        for (size_t i = 0; i < arrayCount; i++) {
+            BenchClock::time_point t1 = BenchClock::now();
+            func(i);
+            r.latencies.push_back(benchSecondsSince(t1));
+        }
+        r.totals.push_back(benchSecondsSince(t0));
+    }
+}
+
+std::string benchJsonString(const std::string& s)
+{
+    std::string json = "\"";
+    for (size_t i = 0; i < s.size(); i++) {
+        char c = s[i];
+        if (c == '"' || c == '\\') {
+            json += '\\';
+            json += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned int>(c));
+            json += buf;
+        } else {
+            json += c;
+        }
+    }
+    json += '"';
+    return json;
+}
+
+bool parseFill(const std::string& value)
+{
+    return (value == "zero" || value == "random" || value == "gradient");
+}
+
+const char* benchOperationNames[] = { "write", "read", "convert", "foreach", "statistics" };
+
+std::vector<std::string> getNameList(const std::string& value)
+{
+    std::vector<std::string> names;
+    size_t i = 0;
+    for (;;) {
+        size_t comma = value.find_first_of(',', i);
+        names.push_back(value.substr(i, comma == std::string::npos ? std::string::npos : comma - i));
+        if (comma == std::string::npos)
+            break;
+        i = comma + 1;
+    }
+    return names;
+}
+
+bool parseOperationList(const std::string& value)
+{
+    std::vector<std::string> names = getNameList(value);
+    for (size_t i = 0; i < names.size(); i++) {
+        if (std::find(std::begin(benchOperationNames), std::end(benchOperationNames), names[i])
+                == std::end(benchOperationNames))
+            return false;
+    }
+    return true;
+}
+
+int tgd_bench(int argc, char* argv[])
+{
+    CmdLine cmdLine;
+    cmdLine.addOptionWithArg("input", 'i');
+    cmdLine.addOptionWithArg("dimensions", 'd', parseUIntLargerThanZeroList, "1024,1024");
+    cmdLine.addOptionWithArg("components", 'c', parseUIntLargerThanZero, "4");
+    cmdLine.addOptionWithArg("type", 't', parseType, "uint8");
+    cmdLine.addOptionWithArg("n", 'n', parseUIntLargerThanZero, "1");
+    cmdLine.addOptionWithArg("fill", 0, parseFill, "random");
+    cmdLine.addOptionWithArg("repetitions", 'r', parseUIntLargerThanZero, "5");
+    cmdLine.addOptionWithArg("formats", 'F');
+    cmdLine.addOptionWithArg("hints", 'H');
+    cmdLine.addOptionWithArg("operations", 'O', parseOperationList,
+            "write,read,convert,foreach,statistics");
+    cmdLine.addOptionWithArg("directory", 0);
+    cmdLine.addOptionWithoutArg("json", 'j');
+    std::string errMsg;
+    if (!cmdLine.parse(argc, argv, 0, -1, errMsg)) {
+        fprintf(stderr, "tgd bench: %s\n", errMsg.c_str());
+        return 1;
+    }
+    if (cmdLine.isSet("help")) {
+        fprintf(stderr, "Usage: tgd bench [option]... [<infile>...]\n"
+                "\n"
+                "Measure the read and write throughput of file formats and the throughput\n"
+                "of core array operations, using the arrays from the input files or\n"
+                "generated arrays.\n"
+                "\n"
+                "Options:\n"
+                "  -i|--input=TAG             set input hints for the input files\n"
+                "  -d|--dimensions=D0[,D1,...]  set dimensions of generated arrays\n"
+                "                             (default 1024,1024)\n"
+                "  -c|--components=C          set number of components of generated arrays\n"
+                "                             (default 4)\n"
+                "  -t|--type=T                set type of generated arrays (default uint8)\n"
+                "  -n|--n=N                   set number of generated arrays (default 1)\n"
+                "  --fill=zero|random|gradient  set content of generated arrays\n"
+                "                             (default random)\n"
+                "  -r|--repetitions=N         repeat each measurement N times (default 5)\n"
+                "  -F|--formats=F0[,F1,...]   measure only these formats (default: all\n"
+                "                             available formats)\n"
+                "  -H|--hints=TAG[,TAG...]    measure with these import and export hints, e.g.\n"
+                "                             -H COMPRESSION=fast; can be given multiple times\n"
+                "  -O|--operations=OP[,OP...] measure only these operations: write, read,\n"
+                "                             convert, foreach, statistics (default all)\n"
+                "  --directory=DIR            directory for temporary files\n"
+                "  -j|--json                  print results in JSON format\n");
+        return 0;
+    }
+
+    // Gather the arrays
+    std::vector<TGD::ArrayContainer> arrays;
+    if (cmdLine.arguments().size() > 0) {
+        TGD::TagList importerHints = createTagList(cmdLine.valueList("input"));
+        for (size_t i = 0; i < cmdLine.arguments().size(); i++) {
+            const std::string& inFileName = cmdLine.arguments()[i];
+            TGD::Importer importer(inFileName, importerHints);
+            TGD::Error err = TGD::ErrorNone;
+            while (importer.hasMore(&err)) {
+                arrays.push_back(importer.readArray(&err));
+                if (err != TGD::ErrorNone)
+                    break;
+            }
+            if (err != TGD::ErrorNone) {
+                fprintf(stderr, "tgd bench: %s: %s\n", inFileName.c_str(), TGD::strerror(err));
+                return 1;
+            }
+        }
+        if (arrays.size() == 0) {
+            fprintf(stderr, "tgd bench: no input arrays\n");
+            return 1;
+        }
+    } else {
+        std::mt19937_64 rng(42);
+        TGD::ArrayContainer array(getUIntList(cmdLine.value("dimensions")),
+                getUInt(cmdLine.value("components")), getType(cmdLine.value("type")));
+        benchFill(array, cmdLine.value("fill"), rng);
+        for (size_t i = 0; i < getUInt(cmdLine.value("n")); i++)
+            arrays.push_back(array.deepCopy());
+    }
+    size_t bytes = 0;
+    bool equalDescriptions = true;
+    for (size_t i = 0; i < arrays.size(); i++) {
+        bytes += arrays[i].dataSize();
+        equalDescriptions = equalDescriptions && arrays[i].isCompatible(arrays[0]);
+    }
+
+    // Measure
+    std::vector<std::string> operations = getNameList(cmdLine.value("operations"));
+    auto measure = [&](const char* op) {
+        return std::find(operations.begin(), operations.end(), op) != operations.end();
+    };
+    bool explicitFormats = cmdLine.isSet("formats");
+    std::vector<std::string> formats = getNameList(explicitFormats ? cmdLine.value("formats")
+            : "tgd,raw,pnm,csv,rgbe,stb,tinyexr,dcmtk,exr,ffmpeg,fits,gdal,gta,hdf5,jpeg,mat,pfs,png,tiff,magick");
+    std::vector<std::string> hintsList = cmdLine.valueList("hints");
+    if (hintsList.size() == 0)
+        hintsList.push_back(std::string());
+    std::string directory = cmdLine.value("directory");
+    if (directory.empty()) {
+#ifdef _WIN32
+        const char* tmp = getenv("TEMP");
+#else
+        const char* tmp = getenv("TMPDIR");
+#endif
+        directory = (tmp && tmp[0] ? tmp : ".");
+#ifndef _WIN32
+        if (!tmp || !tmp[0])
+            directory = "/tmp";
+#endif
+    }
+    size_t repetitions = getUInt(cmdLine.value("repetitions"));
+    std::vector<BenchResult> results;
+    if (measure("write") || measure("read")) {
+        std::string fileNameBase = directory + "/tgd-bench-"
+            + std::to_string(BenchClock::now().time_since_epoch().count());
+        for (size_t f = 0; f < formats.size(); f++) {
+            std::string fileName = fileNameBase + '.' + benchExtension(formats[f]);
+            for (size_t h = 0; h < hintsList.size(); h++) {
+                TGD::TagList hints = (hintsList[h].empty() ? TGD::TagList()
+                        : createTagList(getNameList(hintsList[h])));
+                hints.set("FORMAT", formats[f]);
+                BenchResult writeResult("write", formats[f], hintsList[h], bytes, arrays.size());
+                benchWrite(arrays, fileName, hints, repetitions, writeResult);
+                bool available = (writeResult.error != TGD::strerror(TGD::ErrorFormatUnsupported));
+                if (available || explicitFormats) {
+                    if (measure("write"))
+                        results.push_back(writeResult);
+                    if (measure("read")) {
+                        BenchResult readResult("read", formats[f], hintsList[h], bytes, arrays.size());
+                        if (!writeResult.error.empty()) {
+                            readResult.error = writeResult.error;
+                        } else if (formats[f] == "raw" && !equalDescriptions) {
+                            readResult.error = TGD::strerror(TGD::ErrorFeaturesUnsupported);
+                        } else {
+                            if (formats[f] == "raw") {
+                                hints.set("DIMENSIONS", std::to_string(arrays[0].dimensionCount()));
+                                for (size_t d = 0; d < arrays[0].dimensionCount(); d++)
+                                    hints.set("DIMENSION" + std::to_string(d), std::to_string(arrays[0].dimension(d)));
+                                hints.set("COMPONENTS", std::to_string(arrays[0].componentCount()));
+                                hints.set("TYPE", TGD::typeToString(arrays[0].componentType()));
+                            }
+                            benchRead(arrays.size(), fileName, hints, repetitions, readResult);
+                        }
+                        results.push_back(readResult);
+                    }
+                }
+                std::remove(fileName.c_str());
+            }
+        }
+    }
+    if (measure("convert")) {
+        TGD::Type targetType = (arrays[0].componentType() == TGD::float32 ? TGD::float64 : TGD::float32);
+        BenchResult r("convert", "-", std::string("to ") + TGD::typeToString(targetType), bytes, arrays.size());
+        TGD::ArrayContainer result;
+        benchKernel(arrays.size(), repetitions, r, [&] (size_t i) {
+                result = TGD::convert(arrays[i], targetType);
+            });
+        results.push_back(r);
+    }
+    if (measure("foreach")) {
+        std::vector<TGD::Array<float>> floatArrays;
+        size_t floatBytes = 0;
+        for (size_t i = 0; i < arrays.size(); i++) {
+            floatArrays.push_back(TGD::convert(arrays[i], TGD::float32));
+            floatBytes += floatArrays[i].dataSize();
+        }
+        BenchResult r("foreach", "-", "float32 v*0.5+0.25", floatBytes, arrays.size());
+        benchKernel(arrays.size(), repetitions, r, [&] (size_t i) {
+                TGD::forEachComponentInplace(floatArrays[i], [] (float v) { return v * 0.5f + 0.25f; });
+            });
+        results.push_back(r);
+    }
+    if (measure("statistics")) {
+        BenchResult r("statistics", "-", "", bytes, arrays.size());
+        std::vector<TGD::ComponentStatistics> stats;
+        benchKernel(arrays.size(), repetitions, r, [&] (size_t i) {
+                stats = TGD::statistics(arrays[i]);
+            });
+        results.push_back(r);
+    }
+
+    // Report
+    bool json = cmdLine.isSet("json");
+    if (json) {
+        fprintf(toolOutput(), "{\n  \"arrays\": %zu,\n  \"bytes\": %zu,\n  \"repetitions\": %zu,\n  \"results\": [",
+                arrays.size(), bytes, repetitions);
+    } else {
+        fprintf(toolOutput(), "%zu array(s), %s, %zu repetition(s)\n", arrays.size(),
+                tgd_info_human_readable_memsize(bytes).c_str(), repetitions);
+        fprintf(toolOutput(), "%-10s %-8s %-20s %10s %10s %9s %9s %9s %10s\n", "operation", "format", "hints",
+                "MB/s", "arrays/s", "p50 ms", "p90 ms", "p99 ms", "file size");
+    }
+    for (size_t i = 0; i < results.size(); i++) {
+        BenchResult& r = results[i];
+        std::sort(r.totals.begin(), r.totals.end());
+        std::sort(r.latencies.begin(), r.latencies.end());
+        // throughput of the median repetition
+        double seconds = benchPercentile(r.totals, 50.0);
+        double mbPerSecond = (seconds > 0.0 ? r.bytes / seconds / 1e6 : 0.0);
+        double arraysPerSecond = (seconds > 0.0 ? r.arrays / seconds : 0.0);
+        double p50 = benchPercentile(r.latencies, 50.0) * 1e3;
+        double p90 = benchPercentile(r.latencies, 90.0) * 1e3;
+        double p99 = benchPercentile(r.latencies, 99.0) * 1e3;
+        if (json) {
+            fprintf(toolOutput(), "%s\n    { \"operation\": %s, \"format\": %s, \"hints\": %s", i == 0 ? "" : ",",
+                    benchJsonString(r.operation).c_str(), benchJsonString(r.format).c_str(),
+                    benchJsonString(r.hints).c_str());
+            if (!r.error.empty()) {
+                fprintf(toolOutput(), ", \"error\": %s }", benchJsonString(r.error).c_str());
+            } else {
+                fprintf(toolOutput(), ", \"mb_per_s\": %.6g, \"arrays_per_s\": %.6g"
+                        ", \"latency_ms\": { \"p50\": %.6g, \"p90\": %.6g, \"p99\": %.6g }",
+                        mbPerSecond, arraysPerSecond, p50, p90, p99);
+                if (r.fileSize >= 0)
+                    fprintf(toolOutput(), ", \"file_size\": %lld", r.fileSize);
+                fprintf(toolOutput(), " }");
+            }
+        } else {
+            fprintf(toolOutput(), "%-10s %-8s %-20s ", r.operation.c_str(), r.format.c_str(),
+                    r.hints.empty() ? "-" : r.hints.c_str());
+            if (!r.error.empty()) {
+                fprintf(toolOutput(), "%s\n", r.error.c_str());
+            } else {
+                fprintf(toolOutput(), "%10.1f %10.2f %9.3f %9.3f %9.3f %10s\n", mbPerSecond, arraysPerSecond, p50, p90, p99,
+                        r.fileSize >= 0 ? tgd_info_human_readable_memsize(r.fileSize).c_str() : "-");
+            }
+        }
+    }
+    if (json)
+        fprintf(toolOutput(), "\n  ]\n}\n");
+
+    return 0;
+}
+
+/* Print the collected profiles of all importers and exporters, merged per file */
+void tgd_print_profile(const char* command)
+{
+    std::vector<TGD::IOProfile> profiles;
+    for (const TGD::IOProfile& p : TGD::collectedProfiles()) {
+        auto it = std::find_if(profiles.begin(), profiles.end(), [&] (const TGD::IOProfile& q) {
+                return q.fileName == p.fileName && q.format == p.format && q.output == p.output; });
+        if (it == profiles.end())
+            profiles.push_back(p);
+        else
+            it->merge(p);
+    }
+    TGD::IOProfile total;
+    fprintf(stderr, "tgd %s: profile:\n", command);
+    for (const TGD::IOProfile& p : profiles) {
+        fprintf(stderr, "  %s %s (%s): %zu array(s), %s, %s allocated\n",
+                p.output ? "output" : "input", p.fileName.c_str(), p.format.c_str(), p.arrays,
+                tgd_info_human_readable_memsize(p.bytes).c_str(),
+                tgd_info_human_readable_memsize(p.allocatedBytes).c_str());
+        if (p.output) {
+            fprintf(stderr, "    format %.3f ms, open %.3f ms, encode %.3f ms, flush %.3f ms\n",
+                    p.formatSeconds * 1e3, p.openSeconds * 1e3, p.dataSeconds * 1e3, p.flushSeconds * 1e3);
+        } else {
+            fprintf(stderr, "    format %.3f ms, open %.3f ms, seek %.3f ms, decode %.3f ms\n",
+                    p.formatSeconds * 1e3, p.openSeconds * 1e3, p.seekSeconds * 1e3, p.dataSeconds * 1e3);
+        }
+        total.merge(p);
+    }
+    fprintf(stderr, "  total: %.3f ms in input/output of %s\n", total.totalSeconds() * 1e3,
+            tgd_info_human_readable_memsize(total.bytes).c_str());
+}
+
+int tgd_command(int argc, char* argv[])
+{
+    int retval = 0;
+    if (std::strcmp(argv[0], "help") == 0 || std::strcmp(argv[0], "--help") == 0) {
+        retval = tgd_help();
+    } else if (std::strcmp(argv[0], "version") == 0 || std::strcmp(argv[0], "--version") == 0) {
+        retval = tgd_version();
+    } else if (std::strcmp(argv[0], "create") == 0) {
+        retval = tgd_create(argc, argv);
+    } else if (std::strcmp(argv[0], "convert") == 0) {
+        retval = tgd_convert(argc, argv);
+    } else if (std::strcmp(argv[0], "calc") == 0) {
+        retval = tgd_calc(argc, argv);
+    } else if (std::strcmp(argv[0], "diff") == 0) {
+        retval = tgd_diff(argc, argv);
+    } else if (std::strcmp(argv[0], "pyramid") == 0) {
+        retval = tgd_pyramid(argc, argv);
+    } else if (std::strcmp(argv[0], "info") == 0) {
+        retval = tgd_info(argc, argv);
+    } else if (std::strcmp(argv[0], "bench") == 0) {
+        retval = tgd_bench(argc, argv);
+    } else {
+        fprintf(stderr, "tgd: invalid command %s\n", argv[0]);
+        retval = 1;
+    }
+    return retval;
+}
+
+/* Split a line into words like a shell does: words are separated by white space,
+ * single quotes preserve everything up to the next single quote, double quotes
+ * and backslashes work as usual, and an unquoted # starts a comment. */
+bool splitCommandLine(const std::string& line, std::vector<std::string>& words)
+{
+    words.clear();
+    std::string word;
+    bool inWord = false;
+    for (size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (c == '\'') {
+            size_t j = line.find('\'', i + 1);
+            if (j == std::string::npos)
+                return false;
+            word.append(line, i + 1, j - (i + 1));
+            inWord = true;
+            i = j;
+        } else if (c == '"') {
+            for (i++; i < line.size() && line[i] != '"'; i++) {
+                if (line[i] == '\\' && i + 1 < line.size()
+                        && (line[i + 1] == '"' || line[i + 1] == '\\' || line[i + 1] == '$' || line[i + 1] == '`'))
+                    i++;
+                word.push_back(line[i]);
+            }
+            if (i == line.size())
+                return false;
+            inWord = true;
+        } else if (c == '\\') {
+            if (i + 1 < line.size())
+                word.push_back(line[++i]);
+            inWord = true;
+        } else if (std::isspace(static_cast<unsigned char>(c))) {
+            if (inWord)
+                words.push_back(word);
+            word.clear();
+            inWord = false;
+        } else if (c == '#' && !inWord) {
+            break;
+        } else {
+            word.push_back(c);
+            inWord = true;
+        }
+    }
+    if (inWord)
+        words.push_back(word);
+    return true;
+}
+
+class BatchCommand
+{
+public:
+    size_t line;
+    std::vector<std::string> words;
+    FILE* output;
+    int retval;
+    bool done;
+
+    BatchCommand(size_t l, const std::vector<std::string>& w) :
+        line(l), words(w), output(nullptr), retval(0), done(false)
+    {
+    }
+
+    void run()
+    {
+        std::vector<char*> argv;
+        for (size_t i = 0; i < words.size(); i++)
+            argv.push_back(const_cast<char*>(words[i].c_str()));
+        argv.push_back(nullptr);
+        if (words[0] == "batch") {
+            fprintf(stderr, "tgd batch: line %zu: batch cannot be nested\n", line);
+            retval = 1;
+        } else {
+            retval = tgd_command(words.size(), argv.data());
+        }
+    }
+};
+
+int tgd_batch(int argc, char* argv[])
+{
+    CmdLine cmdLine;
+    cmdLine.addOptionWithArg("jobs", 'j', parseUIntLargerThanZero, "1");
+    cmdLine.addOptionWithoutArg("exit-on-error", 'e');
+    std::string errMsg;
+    if (!cmdLine.parse(argc, argv, 0, 1, errMsg)) {
+        fprintf(stderr, "tgd batch: %s\n", errMsg.c_str());
+        return 1;
+    }
+    if (cmdLine.isSet("help")) {
+        fprintf(stderr, "Usage: tgd batch [option]... [<commandfile>|-]\n"
+                "\n"
+                "Run tgd commands in a single process, one per line of the command file\n"
+                "or of standard input. This avoids the costs of process startup and plugin\n"
+                "loading for each command. Lines are split into words like in a shell, and\n"
+                "everything after an unquoted # is ignored. A leading word tgd is optional.\n"
+                "The exit status is 0 if all commands succeeded and 1 otherwise.\n"
+                "\n"
+                "Options:\n"
+                "  -j|--jobs=N                run up to N commands in parallel (default 1);\n"
+                "                             the standard output of each command is printed\n"
+                "                             in the order of the commands; commands that\n"
+                "                             use - for standard input or output are\n"
+                "                             rejected in this case\n"
+                "  -e|--exit-on-error         stop after the first command that fails\n");
+        return 0;
+    }
+
+    size_t jobs = getUInt(cmdLine.value("jobs"));
+    bool exitOnError = cmdLine.isSet("exit-on-error");
+    std::string fileName = (cmdLine.arguments().size() > 0 ? cmdLine.arguments()[0] : std::string("-"));
+    FILE* f = (fileName == "-" ? stdin : std::fopen(fileName.c_str(), "r"));
+    if (!f) {
+        fprintf(stderr, "tgd batch: %s: %s\n", fileName.c_str(), std::strerror(errno));
+        return 1;
+    }
+
+    // Read commands. When running one job at a time, each command is run as soon
+    // as it is read, so that commands can be fed interactively through a pipe.
+    std::deque<BatchCommand> commands;
+    bool failed = false;
+    bool readError = false;
+    std::string line;
+    size_t lineCounter = 0;
+    std::vector<std::string> words;
+    for (;;) {
+        int c = std::fgetc(f);
+        if (c != EOF && c != '\n') {
+            line.push_back(c);
+            continue;
+        }
+        if (c == EOF && line.empty())
+            break;
+        lineCounter++;
+        if (!splitCommandLine(line, words)) {
+            fprintf(stderr, "tgd batch: line %zu: unterminated quote\n", lineCounter);
+            readError = true;
+            break;
+        }
+        line.clear();
+        if (words.size() > 0 && words[0] == "tgd")
+            words.erase(words.begin());
+        if (words.size() > 0 && jobs > 1 && std::find(words.begin(), words.end(), "-") != words.end()) {
+            // parallel commands would read from or write to the same streams
+            fprintf(stderr, "tgd batch: line %zu: standard input or output cannot be used with more than one job\n", lineCounter);
+            readError = true;
+            break;
+        }
+        if (words.size() > 0) {
+            commands.emplace_back(lineCounter, words);
+            if (jobs == 1) {
+                commands.back().run();
+                fflush(stdout);
+                if (commands.back().retval != 0)
+                    failed = true;
+                commands.pop_back();
+                if (failed && exitOnError)
+                    break;
+            }
+        }
+        if (c == EOF)
+            break;
+    }
+    if (std::ferror(f)) {
+        fprintf(stderr, "tgd batch: %s: %s\n", fileName.c_str(), std::strerror(errno));
+        readError = true;
+    }
+    if (f != stdin)
+        std::fclose(f);
+    if (readError)
+        return 1;
+
+    if (jobs > 1 && commands.size() > 0) {
+        // Worker threads take the next command and capture its output in a
+        // temporary file; this thread prints the outputs in the original order.
+        std::mutex mutex;
+        std::condition_variable cond;
+        size_t nextCommand = 0;
+        bool stop = false;
+        auto worker = [&] () {
+            for (;;) {
+                BatchCommand* cmd;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (stop || nextCommand >= commands.size())
+                        break;
+                    cmd = &(commands[nextCommand++]);
+                }
+                cmd->output = std::tmpfile();
+                commandOutput = cmd->output;
+                cmd->run();
+                commandOutput = nullptr;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    cmd->done = true;
+                    if (cmd->retval != 0 && exitOnError)
+                        stop = true;
+                }
+                cond.notify_all();
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < std::min(jobs, commands.size()); i++)
+            workers.push_back(std::thread(worker));
+        for (size_t i = 0; i < commands.size(); i++) {
+            BatchCommand& cmd = commands[i];
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&] { return cmd.done || (stop && i >= nextCommand); });
+                if (!cmd.done)
+                    break;
+            }
+            if (cmd.output) {
+                std::rewind(cmd.output);
+                char buf[8192];
+                size_t n;
+                while ((n = std::fread(buf, 1, sizeof(buf), cmd.output)) > 0)
+                    std::fwrite(buf, 1, n, stdout);
+                std::fclose(cmd.output);
+                cmd.output = nullptr;
+            }
+            fflush(stdout);
+            if (cmd.retval != 0)
+                failed = true;
+        }
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+        for (size_t i = 0; i < commands.size(); i++)
+            if (commands[i].output)
+                std::fclose(commands[i].output);
+    }
+    return (failed ? 1 : 0);
+}
 
 int main(int argc, char* argv[])
 {
@@ -2045,27 +3533,26 @@ int main(int argc, char* argv[])
     setbuf(stderr, NULL);
 #endif
 
+    // All array operations used by the tool are free of side effects
+    TGD::setDefaultExecutionPolicy(TGD::ParallelUnsequenced);
+
+    bool profile = (argc >= 2 && std::strcmp(argv[1], "--profile") == 0);
+    if (profile) {
+        TGD::setProfiling(true);
+        argc--;
+        argv++;
+    }
+
     int retval = 0;
     if (argc < 2) {
         tgd_help();
         retval = 1;
-    } else if (std::strcmp(argv[1], "help") == 0 || std::strcmp(argv[1], "--help") == 0) {
-        retval = tgd_help();
-    } else if (std::strcmp(argv[1], "version") == 0 || std::strcmp(argv[1], "--version") == 0) {
-        retval = tgd_version();
-    } else if (std::strcmp(argv[1], "create") == 0) {
-        retval = tgd_create(argc - 1, &(argv[1]));
-    } else if (std::strcmp(argv[1], "convert") == 0) {
-        retval = tgd_convert(argc - 1, &(argv[1]));
-    } else if (std::strcmp(argv[1], "calc") == 0) {
-        retval = tgd_calc(argc - 1, &(argv[1]));
-    } else if (std::strcmp(argv[1], "diff") == 0) {
-        retval = tgd_diff(argc - 1, &(argv[1]));
-    } else if (std::strcmp(argv[1], "info") == 0) {
-        retval = tgd_info(argc - 1, &(argv[1]));
+    } else if (std::strcmp(argv[1], "batch") == 0) {
+        retval = tgd_batch(argc - 1, &(argv[1]));
     } else {
-        fprintf(stderr, "tgd: invalid command %s\n", argv[1]);
-        retval = 1;
+        retval = tgd_command(argc - 1, &(argv[1]));
     }
+    if (profile && argc >= 2)
+        tgd_print_profile(argv[1]);
     return retval;
 }